@@ -33,6 +33,7 @@
 #include <winpr/cmdline.h>
 
 #include <freerdp/addin.h>
+#include <freerdp/codec/dsp.h>
 
 #include <winpr/stream.h>
 #include <freerdp/freerdp.h>
@@ -90,6 +91,12 @@ struct _AUDIN_PLUGIN
 	/* Device interface */
 	IAudinDevice* device;
 
+	/* Formats the device cannot record are encoded from PCM */
+	BOOL encoding;
+	audinFormat pcmFormat;
+	FREERDP_DSP_CONTEXT* dsp_context;
+	wStream* encoded;
+
 	rdpContext* rdpcontext;
 	BOOL attached;
 };
@@ -138,6 +145,70 @@ static UINT audin_send_incoming_data_pdu(IWTSVirtualChannelCallback* pChannelCal
 	return callback->channel->Write(callback->channel, 1, out_data, NULL);
 }
 
+static void audin_get_audio_format(const audinFormat* format, AUDIO_FORMAT* audio)
+{
+	ZeroMemory(audio, sizeof(AUDIO_FORMAT));
+	audio->wFormatTag = format->wFormatTag;
+	audio->nChannels = format->nChannels;
+	audio->nSamplesPerSec = format->nSamplesPerSec;
+	audio->nBlockAlign = format->nBlockAlign;
+	audio->wBitsPerSample = format->wBitsPerSample;
+}
+
+static void audin_get_pcm_format(const audinFormat* format, audinFormat* pcm)
+{
+	ZeroMemory(pcm, sizeof(audinFormat));
+	pcm->wFormatTag = WAVE_FORMAT_PCM;
+	pcm->nChannels = format->nChannels;
+	pcm->nSamplesPerSec = format->nSamplesPerSec;
+	pcm->nBlockAlign = format->nChannels * 2;
+	pcm->wBitsPerSample = 16;
+}
+
+static BOOL audin_format_supported(AUDIN_PLUGIN* audin, audinFormat* format)
+{
+	audinFormat pcm;
+	AUDIO_FORMAT audio;
+
+	if (audin->device->FormatSupported(audin->device, format))
+		return TRUE;
+
+	audin_get_audio_format(format, &audio);
+
+	if (!freerdp_dsp_supports_format(&audio, TRUE))
+		return FALSE;
+
+	audin_get_pcm_format(format, &pcm);
+	return audin->device->FormatSupported(audin->device, &pcm);
+}
+
+/**
+ * Sets up encoding for formats the device does not record itself and
+ * returns the format the device has to be set to.
+ */
+static audinFormat* audin_device_format(AUDIN_PLUGIN* audin, audinFormat* format)
+{
+	AUDIO_FORMAT audio;
+	audin->encoding = !audin->device->FormatSupported(audin->device, format);
+
+	if (!audin->encoding)
+		return format;
+
+	if (!audin->dsp_context && !(audin->dsp_context = freerdp_dsp_context_new()))
+		return NULL;
+
+	if (!audin->encoded && !(audin->encoded = Stream_New(NULL, 4096)))
+		return NULL;
+
+	audin_get_audio_format(format, &audio);
+
+	if (!freerdp_dsp_context_reset(audin->dsp_context, &audio))
+		return NULL;
+
+	audin_get_pcm_format(format, &audin->pcmFormat);
+	return &audin->pcmFormat;
+}
+
 /**
  * Function description
  *
@@ -210,7 +281,7 @@ static UINT audin_process_formats(IWTSVirtualChannelCallback* pChannelCallback,
 		if (audin->fixed_rate > 0 && audin->fixed_rate != format.nSamplesPerSec)
 			continue;
 
-		if (audin->device && audin->device->FormatSupported(audin->device, &format))
+		if (audin->device && audin_format_supported(audin, &format))
 		{
 			DEBUG_DVC("format ok");
 			/* Store the agreed format in the corresponding index */
@@ -326,6 +397,24 @@ static UINT audin_receive_wave_data(const BYTE* data, int size, void* user_data)
 	if (!audin->attached)
 		return CHANNEL_RC_OK;
 
+	if (audin->encoding)
+	{
+		Stream_SetPosition(audin->encoded, 0);
+
+		if (!freerdp_dsp_encode(audin->dsp_context, data, size, audin->encoded))
+		{
+			WLog_ERR(TAG, "freerdp_dsp_encode failed!");
+			return ERROR_INTERNAL_ERROR;
+		}
+
+		data = Stream_Buffer(audin->encoded);
+		size = (int) Stream_GetPosition(audin->encoded);
+
+		/* encoders working on whole frames may not have output yet */
+		if (size == 0)
+			return CHANNEL_RC_OK;
+	}
+
 	if ((error = audin_send_incoming_data_pdu((IWTSVirtualChannelCallback*) callback)))
 	{
 		WLog_ERR(TAG, "audin_send_incoming_data_pdu failed!");
@@ -377,6 +466,9 @@ static UINT audin_process_open(IWTSVirtualChannelCallback* pChannelCallback, wSt
 
 	if (audin->device)
 	{
+		if (!(format = audin_device_format(audin, format)))
+			return ERROR_INTERNAL_ERROR;
+
 		IFCALLRET(audin->device->SetFormat, error, audin->device, format, FramesPerPacket);
 
 		if (error != CHANNEL_RC_OK)
@@ -440,6 +532,9 @@ static UINT audin_process_format_change(IWTSVirtualChannelCallback* pChannelCall
 			return error;
 		}
 
+		if (!(format = audin_device_format(audin, format)))
+			return ERROR_INTERNAL_ERROR;
+
 		IFCALLRET(audin->device->SetFormat, error, audin->device, format, 0);
 
 		if (error != CHANNEL_RC_OK)
@@ -604,6 +699,8 @@ static UINT audin_plugin_terminated(IWTSPlugin* pPlugin)
 		audin->device = NULL;
 	}
 
+	freerdp_dsp_context_free(audin->dsp_context);
+	Stream_Free(audin->encoded, TRUE);
 	free(audin->subsystem);
 	audin->subsystem = NULL;
 	free(audin->device_name);
@@ -61,6 +61,7 @@ typedef struct _audin_server
 	DWORD SessionId;
 
 	FREERDP_DSP_CONTEXT* dsp_context;
+	wStream* decoded;
 
 } audin_server;
 
@@ -83,6 +84,13 @@ static UINT audin_server_select_format(audin_server_context* context,
 
 	context->selected_client_format = client_format_index;
 
+	if (!freerdp_dsp_context_reset(audin->dsp_context,
+	                               &context->client_formats[client_format_index]))
+	{
+		WLog_ERR(TAG, "freerdp_dsp_context_reset failed!");
+		return ERROR_INTERNAL_ERROR;
+	}
+
 	if (audin->opened)
 	{
 		/* TODO: send MSG_SNDIN_FORMATCHANGE */
@@ -278,6 +286,13 @@ static UINT audin_server_send_open(audin_server* audin, wStream* s)
 		return ERROR_INVALID_DATA;
 	}
 
+	if (!freerdp_dsp_context_reset(audin->dsp_context,
+	                               &audin->context.client_formats[audin->context.selected_client_format]))
+	{
+		WLog_ERR(TAG, "freerdp_dsp_context_reset failed!");
+		return ERROR_INTERNAL_ERROR;
+	}
+
 	audin->opened = TRUE;
 	Stream_SetPosition(s, 0);
 	Stream_Write_UINT8(s, MSG_SNDIN_OPEN);
@@ -353,21 +368,18 @@ static UINT audin_server_recv_data(audin_server* audin, wStream* s,
 
 	format = &audin->context.client_formats[audin->context.selected_client_format];
 
-	if (format->wFormatTag == WAVE_FORMAT_ADPCM)
-	{
-		audin->dsp_context->decode_ms_adpcm(audin->dsp_context,
-		                                    Stream_Pointer(s), length, format->nChannels, format->nBlockAlign);
-		size = audin->dsp_context->adpcm_size;
-		src = audin->dsp_context->adpcm_buffer;
-		sbytes_per_sample = 2;
-		sbytes_per_frame = format->nChannels * 2;
-	}
-	else if (format->wFormatTag == WAVE_FORMAT_DVI_ADPCM)
+	if (format->wFormatTag != WAVE_FORMAT_PCM)
 	{
-		audin->dsp_context->decode_ima_adpcm(audin->dsp_context,
-		                                     Stream_Pointer(s), length, format->nChannels, format->nBlockAlign);
-		size = audin->dsp_context->adpcm_size;
-		src = audin->dsp_context->adpcm_buffer;
+		Stream_SetPosition(audin->decoded, 0);
+
+		if (!freerdp_dsp_decode(audin->dsp_context, Stream_Pointer(s), length, audin->decoded))
+		{
+			WLog_ERR(TAG, "freerdp_dsp_decode failed!");
+			return ERROR_INVALID_DATA;
+		}
+
+		size = (int) Stream_GetPosition(audin->decoded);
+		src = Stream_Buffer(audin->decoded);
 		sbytes_per_sample = 2;
 		sbytes_per_frame = format->nChannels * 2;
 	}
@@ -704,6 +716,16 @@ audin_server_context* audin_server_context_new(HANDLE vcm)
 		return NULL;
 	}
 
+	audin->decoded = Stream_New(NULL, 4096);
+
+	if (!audin->decoded)
+	{
+		WLog_ERR(TAG, "Stream_New failed!");
+		freerdp_dsp_context_free(audin->dsp_context);
+		free(audin);
+		return NULL;
+	}
+
 	return (audin_server_context*) audin;
 }
 
@@ -715,6 +737,7 @@ void audin_server_context_free(audin_server_context* context)
 	if (audin->dsp_context)
 		freerdp_dsp_context_free(audin->dsp_context);
 
+	Stream_Free(audin->decoded, TRUE);
 	free(audin->context.client_formats);
 	free(audin);
 }
@@ -29,6 +29,7 @@
 
 #include <freerdp/types.h>
 #include <freerdp/constants.h>
+#include <freerdp/channels/channels.h>
 #include <freerdp/client/cliprdr.h>
 
 #include "cliprdr_main.h"
@@ -554,7 +555,7 @@ static UINT cliprdr_order_recv(cliprdrPlugin* cliprdr, wStream* s)
 			break;
 	}
 
-	Stream_Free(s, TRUE);
+	freerdp_channels_data_free(s);
 	return error;
 }
 
@@ -962,53 +963,18 @@ static UINT cliprdr_client_file_contents_response(CliprdrClientContext* context,
 static UINT cliprdr_virtual_channel_event_data_received(cliprdrPlugin* cliprdr,
         void* pData, UINT32 dataLength, UINT32 totalLength, UINT32 dataFlags)
 {
+	UINT error;
 	wStream* data_in;
 
-	if ((dataFlags & CHANNEL_FLAG_SUSPEND) || (dataFlags & CHANNEL_FLAG_RESUME))
-	{
-		return CHANNEL_RC_OK;
-	}
-
-	if (dataFlags & CHANNEL_FLAG_FIRST)
-	{
-		if (cliprdr->data_in)
-			Stream_Free(cliprdr->data_in, TRUE);
-
-		cliprdr->data_in = Stream_New(NULL, totalLength);
-	}
-
-	if (!(data_in = cliprdr->data_in))
-	{
-		WLog_ERR(TAG, "Stream_New failed!");
-		return CHANNEL_RC_NO_MEMORY;
-	}
-
-	if (!Stream_EnsureRemainingCapacity(data_in, (int) dataLength))
-	{
-		Stream_Free(cliprdr->data_in, TRUE);
-		cliprdr->data_in = NULL;
-		return CHANNEL_RC_NO_MEMORY;
-	}
-
-	Stream_Write(data_in, pData, dataLength);
+	if ((error = freerdp_channels_data_received(cliprdr->context->rdpcontext, &cliprdr->data_in,
+	             pData, dataLength, totalLength, dataFlags, &data_in)))
+		return error;
 
-	if (dataFlags & CHANNEL_FLAG_LAST)
+	if (data_in && !MessageQueue_Post(cliprdr->queue, NULL, 0, (void*) data_in, NULL))
 	{
-		if (Stream_Capacity(data_in) != Stream_GetPosition(data_in))
-		{
-			WLog_ERR(TAG, "cliprdr_plugin_process_received: read error");
-			return ERROR_INTERNAL_ERROR;
-		}
-
-		cliprdr->data_in = NULL;
-		Stream_SealLength(data_in);
-		Stream_SetPosition(data_in, 0);
-
-		if (!MessageQueue_Post(cliprdr->queue, NULL, 0, (void*) data_in, NULL))
-		{
-			WLog_ERR(TAG, "MessageQueue_Post failed!");
-			return ERROR_INTERNAL_ERROR;
-		}
+		WLog_ERR(TAG, "MessageQueue_Post failed!");
+		freerdp_channels_data_free(data_in);
+		return ERROR_INTERNAL_ERROR;
 	}
 
 	return CHANNEL_RC_OK;
@@ -1168,7 +1134,7 @@ static UINT cliprdr_virtual_channel_event_disconnected(cliprdrPlugin* cliprdr)
 
 	if (cliprdr->data_in)
 	{
-		Stream_Free(cliprdr->data_in, TRUE);
+		freerdp_channels_data_free(cliprdr->data_in);
 		cliprdr->data_in = NULL;
 	}
 
@@ -26,6 +26,8 @@
 #include <winpr/crt.h>
 #include <winpr/stream.h>
 
+#include <freerdp/channels/channels.h>
+
 #include "drdynvc_main.h"
 
 #define TAG CHANNELS_TAG("drdynvc.client")
@@ -33,6 +35,8 @@
 static void dvcman_channel_free(void* channel);
 static UINT drdynvc_write_data(drdynvcPlugin* drdynvc, UINT32 ChannelId,
                                const BYTE* data, UINT32 dataSize);
+static UINT drdynvc_write_data_compressed(drdynvcPlugin* drdynvc, DVCMAN_CHANNEL* channel,
+        const BYTE* data, UINT32 dataSize);
 
 /**
  * Function description
@@ -310,6 +314,9 @@ static void dvcman_channel_free(void* arg)
 		channel->dvc_data = NULL;
 	}
 
+	zgfx_lite_context_free(channel->compressor);
+	zgfx_lite_context_free(channel->decompressor);
+	Stream_Free(channel->zgfx_data, TRUE);
 	DeleteCriticalSection(&(channel->lock));
 
 	if (channel->channel_name)
@@ -395,8 +402,13 @@ static UINT dvcman_write_channel(IWTSVirtualChannel* pChannel, ULONG cbSize,
 		return CHANNEL_RC_BAD_CHANNEL;
 
 	EnterCriticalSection(&(channel->lock));
-	status = drdynvc_write_data(channel->dvcman->drdynvc,
-	                            channel->channel_id, pBuffer, cbSize);
+
+	if (channel->dvcman->drdynvc->compression)
+		status = drdynvc_write_data_compressed(channel->dvcman->drdynvc, channel, pBuffer, cbSize);
+	else
+		status = drdynvc_write_data(channel->dvcman->drdynvc,
+		                            channel->channel_id, pBuffer, cbSize);
+
 	LeaveCriticalSection(&(channel->lock));
 	return status;
 }
@@ -669,6 +681,61 @@ static UINT dvcman_receive_channel_data(IWTSVirtualChannelManager* pChannelMgr,
 	return status;
 }
 
+/**
+ * Decompresses a single RDP8_BULK_ENCODED_DATA segment of a DATA_COMPRESSED or
+ * DATA_FIRST_COMPRESSED PDU and forwards the result like uncompressed data.
+ * The decompressor history is kept per channel.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT dvcman_receive_channel_data_compressed(IWTSVirtualChannelManager* pChannelMgr,
+        UINT32 ChannelId, wStream* data)
+{
+	DVCMAN_CHANNEL* channel;
+	channel = (DVCMAN_CHANNEL*) dvcman_find_channel_by_id(pChannelMgr, ChannelId);
+
+	if (!channel)
+	{
+		WLog_ERR(TAG, "ChannelId %"PRIu32" not found!", ChannelId);
+		return CHANNEL_RC_OK;
+	}
+
+	if (!channel->decompressor)
+	{
+		channel->decompressor = zgfx_lite_context_new(FALSE);
+
+		if (!channel->decompressor)
+		{
+			WLog_ERR(TAG, "zgfx_lite_context_new failed!");
+			return CHANNEL_RC_NO_MEMORY;
+		}
+	}
+
+	if (!channel->zgfx_data)
+	{
+		channel->zgfx_data = Stream_New(NULL, CHANNEL_CHUNK_LENGTH);
+
+		if (!channel->zgfx_data)
+		{
+			WLog_ERR(TAG, "Stream_New failed!");
+			return CHANNEL_RC_NO_MEMORY;
+		}
+	}
+
+	Stream_SetPosition(channel->zgfx_data, 0);
+
+	if (zgfx_decompress_segment_to_stream(channel->decompressor, channel->zgfx_data,
+	                                      Stream_Pointer(data), (UINT32) Stream_GetRemainingLength(data)) < 0)
+	{
+		WLog_ERR(TAG, "zgfx_decompress_segment_to_stream failed!");
+		return ERROR_INVALID_DATA;
+	}
+
+	Stream_SealLength(channel->zgfx_data);
+	Stream_SetPosition(channel->zgfx_data, 0);
+	return dvcman_receive_channel_data(pChannelMgr, ChannelId, channel->zgfx_data);
+}
+
 static UINT drdynvc_write_variable_uint(wStream* s, UINT32 val)
 {
 	UINT cb;
@@ -823,6 +890,97 @@ static UINT drdynvc_write_data(drdynvcPlugin* drdynvc, UINT32 ChannelId,
 	return CHANNEL_RC_OK;
 }
 
+/**
+ * Sends data as DATA_FIRST_COMPRESSED / DATA_COMPRESSED PDUs (version 3).
+ * Every PDU carries one RDP8 bulk segment; slices leave one byte of headroom
+ * so that an uncompressed fallback segment still fits into a chunk.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT drdynvc_write_data_compressed(drdynvcPlugin* drdynvc, DVCMAN_CHANNEL* channel,
+        const BYTE* data, UINT32 dataSize)
+{
+	wStream* data_out;
+	size_t pos;
+	UINT32 cbChId;
+	UINT32 cbLen;
+	UINT32 flags;
+	UINT32 chunkLength;
+	BOOL first = TRUE;
+	UINT status = CHANNEL_RC_OK;
+
+	if (!drdynvc)
+		return CHANNEL_RC_BAD_CHANNEL_HANDLE;
+
+	if (dataSize == 0)
+		return drdynvc_write_data(drdynvc, channel->channel_id, data, dataSize);
+
+	if (!channel->compressor)
+	{
+		channel->compressor = zgfx_lite_context_new(TRUE);
+
+		if (!channel->compressor)
+		{
+			WLog_Print(drdynvc->log, WLOG_ERROR, "zgfx_lite_context_new failed!");
+			return CHANNEL_RC_NO_MEMORY;
+		}
+	}
+
+	while ((status == CHANNEL_RC_OK) && (dataSize > 0))
+	{
+		BYTE cmd = DATA_COMPRESSED_PDU;
+		data_out = Stream_New(NULL, CHANNEL_CHUNK_LENGTH);
+
+		if (!data_out)
+		{
+			WLog_Print(drdynvc->log, WLOG_ERROR, "Stream_New failed!");
+			return CHANNEL_RC_NO_MEMORY;
+		}
+
+		Stream_SetPosition(data_out, 1);
+		cbChId = drdynvc_write_variable_uint(data_out, channel->channel_id);
+		cbLen = 0;
+		chunkLength = CHANNEL_CHUNK_LENGTH - (UINT32) Stream_GetPosition(data_out) - 1;
+
+		if (first && (dataSize > chunkLength))
+		{
+			cmd = DATA_FIRST_COMPRESSED_PDU;
+			cbLen = drdynvc_write_variable_uint(data_out, dataSize);
+			chunkLength = CHANNEL_CHUNK_LENGTH - (UINT32) Stream_GetPosition(data_out) - 1;
+		}
+
+		if (chunkLength > dataSize)
+			chunkLength = dataSize;
+
+		pos = Stream_GetPosition(data_out);
+		Stream_SetPosition(data_out, 0);
+		Stream_Write_UINT8(data_out, (cmd << 4) | (cbLen << 2) | cbChId);
+		Stream_SetPosition(data_out, pos);
+
+		if (zgfx_compress_segment_to_stream(channel->compressor, data_out, data, chunkLength,
+		                                    &flags) < 0)
+		{
+			WLog_Print(drdynvc->log, WLOG_ERROR, "zgfx_compress_segment_to_stream failed!");
+			Stream_Free(data_out, TRUE);
+			return ERROR_INTERNAL_ERROR;
+		}
+
+		data += chunkLength;
+		dataSize -= chunkLength;
+		first = FALSE;
+		status = drdynvc_send(drdynvc, data_out);
+	}
+
+	if (status != CHANNEL_RC_OK)
+	{
+		WLog_Print(drdynvc->log, WLOG_ERROR, "VirtualChannelWriteEx failed with %s [%08"PRIX32"]",
+		           WTSErrorToString(status), status);
+		return status;
+	}
+
+	return CHANNEL_RC_OK;
+}
+
 /**
  * Function description
  *
@@ -887,6 +1045,11 @@ static UINT drdynvc_process_capability_request(drdynvcPlugin* drdynvc, int Sp,
 		Stream_Read_UINT16(s, drdynvc->PriorityCharge3);
 	}
 
+	/* Version 3 adds DATA_FIRST_COMPRESSED and DATA_COMPRESSED PDUs. Incoming
+	 * compressed data is always accepted, outgoing data is only compressed on request.
+	 */
+	drdynvc->compression = (drdynvc->version >= 3) && drdynvc->rdpcontext &&
+	                       drdynvc->rdpcontext->settings->SupportDynamicChannelCompression;
 	status = drdynvc_send_capability_response(drdynvc);
 	drdynvc->state = DRDYNVC_STATE_READY;
 	return status;
@@ -1046,6 +1209,46 @@ static UINT drdynvc_process_data(drdynvcPlugin* drdynvc, int Sp, int cbChId,
 	return dvcman_receive_channel_data(drdynvc->channel_mgr, ChannelId, s);
 }
 
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT drdynvc_process_data_first_compressed(drdynvcPlugin* drdynvc, int Sp,
+        int cbChId, wStream* s)
+{
+	UINT status;
+	UINT32 Length;
+	UINT32 ChannelId;
+	ChannelId = drdynvc_read_variable_uint(s, cbChId);
+	Length = drdynvc_read_variable_uint(s, Sp);
+	WLog_Print(drdynvc->log, WLOG_TRACE,
+	           "process_data_first_compressed: Sp=%d cbChId=%d, ChannelId=%"PRIu32" Length=%"PRIu32"",
+	           Sp, cbChId, ChannelId, Length);
+	status = dvcman_receive_channel_data_first(drdynvc->channel_mgr, ChannelId,
+	         Length);
+
+	if (status)
+		return status;
+
+	return dvcman_receive_channel_data_compressed(drdynvc->channel_mgr, ChannelId, s);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT drdynvc_process_data_compressed(drdynvcPlugin* drdynvc, int Sp, int cbChId,
+        wStream* s)
+{
+	UINT32 ChannelId;
+	ChannelId = drdynvc_read_variable_uint(s, cbChId);
+	WLog_Print(drdynvc->log, WLOG_TRACE, "process_data_compressed: Sp=%d cbChId=%d, ChannelId=%"PRIu32"",
+	           Sp, cbChId, ChannelId);
+	return dvcman_receive_channel_data_compressed(drdynvc->channel_mgr, ChannelId, s);
+}
+
 /**
  * Function description
  *
@@ -1122,6 +1325,12 @@ static UINT drdynvc_order_recv(drdynvcPlugin* drdynvc, wStream* s)
 		case CLOSE_REQUEST_PDU:
 			return drdynvc_process_close_request(drdynvc, Sp, cbChId, s);
 
+		case DATA_FIRST_COMPRESSED_PDU:
+			return drdynvc_process_data_first_compressed(drdynvc, Sp, cbChId, s);
+
+		case DATA_COMPRESSED_PDU:
+			return drdynvc_process_data_compressed(drdynvc, Sp, cbChId, s);
+
 		default:
 			WLog_ERR(TAG, "unknown drdynvc cmd 0x%x", Cmd);
 			return ERROR_INTERNAL_ERROR;
@@ -1136,56 +1345,20 @@ static UINT drdynvc_order_recv(drdynvcPlugin* drdynvc, wStream* s)
 static UINT drdynvc_virtual_channel_event_data_received(drdynvcPlugin* drdynvc,
         void* pData, UINT32 dataLength, UINT32 totalLength, UINT32 dataFlags)
 {
+	UINT error;
 	wStream* data_in;
 
-	if ((dataFlags & CHANNEL_FLAG_SUSPEND) || (dataFlags & CHANNEL_FLAG_RESUME))
-	{
-		return CHANNEL_RC_OK;
-	}
-
-	if (dataFlags & CHANNEL_FLAG_FIRST)
-	{
-		if (drdynvc->data_in)
-			Stream_Free(drdynvc->data_in, TRUE);
-
-		drdynvc->data_in = Stream_New(NULL, totalLength);
-	}
-
-	if (!(data_in = drdynvc->data_in))
-	{
-		WLog_ERR(TAG, "Stream_New failed!");
-		return CHANNEL_RC_NO_MEMORY;
-	}
+	if ((error = freerdp_channels_data_received(drdynvc->rdpcontext, &drdynvc->data_in, pData,
+	             dataLength, totalLength, dataFlags, &data_in)))
+		return error;
 
-	if (!Stream_EnsureRemainingCapacity(data_in, (int) dataLength))
+	if (data_in && !MessageQueue_Post(drdynvc->queue, NULL, 0, (void*) data_in, NULL))
 	{
-		WLog_ERR(TAG, "Stream_EnsureRemainingCapacity failed!");
-		Stream_Free(drdynvc->data_in, TRUE);
-		drdynvc->data_in = NULL;
+		WLog_ERR(TAG, "MessageQueue_Post failed!");
+		freerdp_channels_data_free(data_in);
 		return ERROR_INTERNAL_ERROR;
 	}
 
-	Stream_Write(data_in, pData, dataLength);
-
-	if (dataFlags & CHANNEL_FLAG_LAST)
-	{
-		if (Stream_Capacity(data_in) != Stream_GetPosition(data_in))
-		{
-			WLog_ERR(TAG, "drdynvc_plugin_process_received: read error");
-			return ERROR_INVALID_DATA;
-		}
-
-		drdynvc->data_in = NULL;
-		Stream_SealLength(data_in);
-		Stream_SetPosition(data_in, 0);
-
-		if (!MessageQueue_Post(drdynvc->queue, NULL, 0, (void*) data_in, NULL))
-		{
-			WLog_ERR(TAG, "MessageQueue_Post failed!");
-			return ERROR_INTERNAL_ERROR;
-		}
-	}
-
 	return CHANNEL_RC_OK;
 }
 
@@ -1260,12 +1433,12 @@ static void* drdynvc_virtual_channel_client_thread(void* arg)
 
 			if ((error = drdynvc_order_recv(drdynvc, data)))
 			{
-				Stream_Free(data, TRUE);
+				freerdp_channels_data_free(data);
 				WLog_Print(drdynvc->log, WLOG_ERROR, "drdynvc_order_recv failed with error %"PRIu32"!", error);
 				break;
 			}
 
-			Stream_Free(data, TRUE);
+			freerdp_channels_data_free(data);
 		}
 	}
 
@@ -1412,7 +1585,7 @@ static UINT drdynvc_virtual_channel_event_disconnected(drdynvcPlugin* drdynvc)
 
 	if (drdynvc->data_in)
 	{
-		Stream_Free(drdynvc->data_in, TRUE);
+		freerdp_channels_data_free(drdynvc->data_in);
 		drdynvc->data_in = NULL;
 	}
 
@@ -34,6 +34,7 @@
 #include <freerdp/channels/log.h>
 #include <freerdp/client/drdynvc.h>
 #include <freerdp/freerdp.h>
+#include <freerdp/codec/zgfx.h>
 
 typedef struct drdynvc_plugin drdynvcPlugin;
 
@@ -92,6 +93,10 @@ struct _DVCMAN_CHANNEL
 	wStream* dvc_data;
 	UINT32 dvc_data_length;
 	CRITICAL_SECTION lock;
+
+	ZGFX_LITE_CONTEXT* compressor;
+	ZGFX_LITE_CONTEXT* decompressor;
+	wStream* zgfx_data;
 };
 typedef struct _DVCMAN_CHANNEL DVCMAN_CHANNEL;
 
@@ -111,6 +116,8 @@ typedef enum _DRDYNVC_STATE DRDYNVC_STATE;
 #define DATA_PDU			0x03
 #define CLOSE_REQUEST_PDU		0x04
 #define CAPABILITY_REQUEST_PDU		0x05
+#define DATA_FIRST_COMPRESSED_PDU	0x06
+#define DATA_COMPRESSED_PDU		0x07
 
 struct drdynvc_plugin
 {
@@ -132,6 +139,7 @@ struct drdynvc_plugin
 	int PriorityCharge1;
 	int PriorityCharge2;
 	int PriorityCharge3;
+	BOOL compression;
 	rdpContext* rdpcontext;
 
 	IWTSVirtualChannelManager* channel_mgr;
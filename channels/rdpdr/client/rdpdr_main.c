@@ -37,6 +37,7 @@
 #include <freerdp/constants.h>
 #include <freerdp/channels/log.h>
 #include <freerdp/channels/rdpdr.h>
+#include <freerdp/channels/channels.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -1218,7 +1219,12 @@ static UINT rdpdr_process_irp(rdpdrPlugin* rdpdr, wStream* s)
 
 	if (!irp)
 	{
-		WLog_ERR(TAG, "irp_new failed with %"PRIu32"!", error);
+		/* the IRP did not take the stream */
+		freerdp_channels_data_free(s);
+
+		if (error)
+			WLog_ERR(TAG, "irp_new failed with %"PRIu32"!", error);
+
 		return error;
 	}
 
@@ -1407,7 +1413,7 @@ static UINT rdpdr_process_receive(rdpdrPlugin* rdpdr, wStream* s)
 		return ERROR_INVALID_DATA;
 	}
 
-	Stream_Free(s, TRUE);
+	freerdp_channels_data_free(s);
 	return CHANNEL_RC_OK;
 }
 
@@ -1450,60 +1456,18 @@ UINT rdpdr_send(rdpdrPlugin* rdpdr, wStream* s)
 static UINT rdpdr_virtual_channel_event_data_received(rdpdrPlugin* rdpdr,
         void* pData, UINT32 dataLength, UINT32 totalLength, UINT32 dataFlags)
 {
+	UINT error;
 	wStream* data_in;
 
-	if ((dataFlags & CHANNEL_FLAG_SUSPEND) || (dataFlags & CHANNEL_FLAG_RESUME))
-	{
-		/*
-		 * According to MS-RDPBCGR 2.2.6.1, "All virtual channel traffic MUST be suspended.
-		 * This flag is only valid in server-to-client virtual channel traffic. It MUST be
-		 * ignored in client-to-server data." Thus it would be best practice to cease data
-		 * transmission. However, simply returning here avoids a crash.
-		 */
-		return CHANNEL_RC_OK;
-	}
-
-	if (dataFlags & CHANNEL_FLAG_FIRST)
-	{
-		if (rdpdr->data_in != NULL)
-			Stream_Free(rdpdr->data_in, TRUE);
-
-		rdpdr->data_in = Stream_New(NULL, totalLength);
-
-		if (!rdpdr->data_in)
-		{
-			WLog_ERR(TAG,  "Stream_New failed!");
-			return CHANNEL_RC_NO_MEMORY;
-		}
-	}
-
-	data_in = rdpdr->data_in;
-
-	if (!Stream_EnsureRemainingCapacity(data_in, (int) dataLength))
-	{
-		WLog_ERR(TAG,  "Stream_EnsureRemainingCapacity failed!");
-		return ERROR_INVALID_DATA;
-	}
-
-	Stream_Write(data_in, pData, dataLength);
+	if ((error = freerdp_channels_data_received(rdpdr->rdpcontext, &rdpdr->data_in, pData,
+	             dataLength, totalLength, dataFlags, &data_in)))
+		return error;
 
-	if (dataFlags & CHANNEL_FLAG_LAST)
+	if (data_in && !MessageQueue_Post(rdpdr->queue, NULL, 0, (void*) data_in, NULL))
 	{
-		if (Stream_Capacity(data_in) != Stream_GetPosition(data_in))
-		{
-			WLog_ERR(TAG, "rdpdr_virtual_channel_event_data_received: read error");
-			return ERROR_INTERNAL_ERROR;
-		}
-
-		rdpdr->data_in = NULL;
-		Stream_SealLength(data_in);
-		Stream_SetPosition(data_in, 0);
-
-		if (!MessageQueue_Post(rdpdr->queue, NULL, 0, (void*) data_in, NULL))
-		{
-			WLog_ERR(TAG, "MessageQueue_Post failed!");
-			return ERROR_INTERNAL_ERROR;
-		}
+		WLog_ERR(TAG, "MessageQueue_Post failed!");
+		freerdp_channels_data_free(data_in);
+		return ERROR_INTERNAL_ERROR;
 	}
 
 	return CHANNEL_RC_OK;
@@ -1683,7 +1647,7 @@ static UINT rdpdr_virtual_channel_event_disconnected(rdpdrPlugin* rdpdr)
 
 	if (rdpdr->data_in)
 	{
-		Stream_Free(rdpdr->data_in, TRUE);
+		freerdp_channels_data_free(rdpdr->data_in);
 		rdpdr->data_in = NULL;
 	}
 
@@ -33,6 +33,7 @@
 
 #include <freerdp/channels/wtsvc.h>
 #include <freerdp/channels/log.h>
+#include <freerdp/utils/metrics.h>
 
 #include "rdpgfx_common.h"
 #include "rdpgfx_main.h"
@@ -395,6 +396,26 @@ static UINT rdpgfx_send_start_frame_pdu(RdpgfxServerContext* context,
 	return rdpgfx_server_single_packet_send(context, s);
 }
 
+static void rdpgfx_server_frame_sent(RdpgfxServerContext* context, UINT32 frameId)
+{
+	const UINT32 slot = frameId % RDPGFX_SERVER_FRAME_SLOTS;
+	context->priv->frameIds[slot] = frameId;
+	context->priv->frameTimes[slot] = freerdp_metrics_now();
+}
+
+static void rdpgfx_server_frame_acknowledged(RdpgfxServerContext* context, UINT32 frameId)
+{
+	const UINT32 slot = frameId % RDPGFX_SERVER_FRAME_SLOTS;
+
+	/* older frames that shared the slot have been acknowledged implicitly */
+	if ((context->priv->frameIds[slot] != frameId) || !context->priv->frameTimes[slot])
+		return;
+
+	freerdp_metric_record_since(FREERDP_METRIC_GFX_FRAME_ACK_TIME,
+	                            context->priv->frameTimes[slot]);
+	context->priv->frameTimes[slot] = 0;
+}
+
 /**
  * Function description
  *
@@ -414,6 +435,7 @@ static UINT rdpgfx_send_end_frame_pdu(RdpgfxServerContext* context,
 	}
 
 	rdpgfx_write_end_frame_pdu(s, pdu);
+	rdpgfx_server_frame_sent(context, pdu->frameId);
 	return rdpgfx_server_single_packet_send(context, s);
 }
 
@@ -793,6 +815,7 @@ static UINT rdpgfx_send_surface_frame_command(RdpgfxServerContext* context,
 
 		rdpgfx_write_end_frame_pdu(s, endFrame);
 		rdpgfx_server_packet_complete_header(s, position);
+		rdpgfx_server_frame_sent(context, endFrame->frameId);
 	}
 
 	return rdpgfx_server_packet_send(context, s);
@@ -1072,6 +1095,7 @@ static UINT rdpgfx_recv_frame_acknowledge_pdu(RdpgfxServerContext* context,
 
 	if (context)
 	{
+		rdpgfx_server_frame_acknowledged(context, pdu.frameId);
 		IFCALLRET(context->FrameAcknowledge, error, context, &pdu);
 
 		if (error)
@@ -23,6 +23,9 @@
 #include <freerdp/server/rdpgfx.h>
 #include <freerdp/codec/zgfx.h>
 
+/* frames sent but not yet acknowledged, for the acknowledge latency */
+#define RDPGFX_SERVER_FRAME_SLOTS	64
+
 struct _rdpgfx_server_private
 {
 	ZGFX_CONTEXT* zgfx;
@@ -35,6 +38,8 @@ struct _rdpgfx_server_private
 	wStream* input_stream;
 	BOOL isOpened;
 	BOOL isReady;
+	UINT32 frameIds[RDPGFX_SERVER_FRAME_SLOTS];
+	UINT64 frameTimes[RDPGFX_SERVER_FRAME_SLOTS];
 };
 
 #endif /* FREERDP_CHANNEL_RDPGFX_SERVER_MAIN_H */
@@ -591,10 +591,21 @@ static void rdpsnd_alsa_wave_play(rdpsndDevicePlugin* device, RDPSND_WAVE* wave)
 	}
 
 	free(data);
+}
 
-	/* From rdpsnd_main.c */
-	wave->wTimeStampB = wave->wTimeStampA + wave->wAudioLength + 65;
-	wave->wLocalTimeB = wave->wLocalTimeA + wave->wAudioLength + 65;
+static BOOL rdpsnd_alsa_get_delay(rdpsndDevicePlugin* device, UINT32* delay)
+{
+	snd_pcm_sframes_t frames;
+	rdpsndAlsaPlugin* alsa = (rdpsndAlsaPlugin*) device;
+
+	if (!alsa->pcm_handle || !alsa->actual_rate)
+		return FALSE;
+
+	if (snd_pcm_delay(alsa->pcm_handle, &frames) < 0)
+		return FALSE;
+
+	*delay = (frames > 0) ? (UINT32)((UINT64) frames * 1000 / alsa->actual_rate) : 0;
+	return TRUE;
 }
 
 static COMMAND_LINE_ARGUMENT_A rdpsnd_alsa_args[] =
@@ -680,6 +691,7 @@ UINT freerdp_rdpsnd_client_subsystem_entry(PFREERDP_RDPSND_DEVICE_ENTRY_POINTS p
 	alsa->device.WavePlay = rdpsnd_alsa_wave_play;
 	alsa->device.Close = rdpsnd_alsa_close;
 	alsa->device.Free = rdpsnd_alsa_free;
+	alsa->device.GetDelay = rdpsnd_alsa_get_delay;
 
 	args = pEntryPoints->args;
 	if (args->argc > 1)
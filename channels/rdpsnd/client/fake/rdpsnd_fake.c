@@ -0,0 +1,192 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Audio Output Virtual Channel - Null and File Output
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <winpr/crt.h>
+#include <winpr/cmdline.h>
+
+#include <freerdp/types.h>
+#include <freerdp/channels/log.h>
+
+#include "rdpsnd_main.h"
+
+/**
+ * Accepts PCM and discards it, or writes it to the file given with
+ * /sound:sys:fake,dev:<file>. Everything else is decoded by the channel,
+ * so sessions can be recorded and measured without an audio device.
+ */
+
+typedef struct rdpsnd_fake_plugin rdpsndFakePlugin;
+
+struct rdpsnd_fake_plugin
+{
+	rdpsndDevicePlugin device;
+
+	char* filename;
+	FILE* fp;
+	UINT32 volume;
+};
+
+static BOOL rdpsnd_fake_format_supported(rdpsndDevicePlugin* device, AUDIO_FORMAT* format)
+{
+	return (format->wFormatTag == WAVE_FORMAT_PCM) &&
+	       ((format->wBitsPerSample == 8) || (format->wBitsPerSample == 16));
+}
+
+static BOOL rdpsnd_fake_open(rdpsndDevicePlugin* device, AUDIO_FORMAT* format, int latency)
+{
+	rdpsndFakePlugin* fake = (rdpsndFakePlugin*) device;
+
+	if (!fake->filename || fake->fp)
+		return TRUE;
+
+	if (!(fake->fp = fopen(fake->filename, "wb")))
+	{
+		WLog_ERR(TAG, "failed to open %s", fake->filename);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL rdpsnd_fake_set_format(rdpsndDevicePlugin* device, AUDIO_FORMAT* format, int latency)
+{
+	return rdpsnd_fake_open(device, format, latency);
+}
+
+static UINT32 rdpsnd_fake_get_volume(rdpsndDevicePlugin* device)
+{
+	return ((rdpsndFakePlugin*) device)->volume;
+}
+
+static BOOL rdpsnd_fake_set_volume(rdpsndDevicePlugin* device, UINT32 value)
+{
+	((rdpsndFakePlugin*) device)->volume = value;
+	return TRUE;
+}
+
+static void rdpsnd_fake_play(rdpsndDevicePlugin* device, BYTE* data, int size)
+{
+	rdpsndFakePlugin* fake = (rdpsndFakePlugin*) device;
+
+	if (fake->fp && (fwrite(data, 1, size, fake->fp) != (size_t) size))
+		WLog_ERR(TAG, "failed to write %d bytes to %s", size, fake->filename);
+}
+
+static void rdpsnd_fake_close(rdpsndDevicePlugin* device)
+{
+	rdpsndFakePlugin* fake = (rdpsndFakePlugin*) device;
+
+	if (fake->fp)
+		fflush(fake->fp);
+}
+
+static void rdpsnd_fake_free(rdpsndDevicePlugin* device)
+{
+	rdpsndFakePlugin* fake = (rdpsndFakePlugin*) device;
+
+	if (fake->fp)
+		fclose(fake->fp);
+
+	free(fake->filename);
+	free(fake);
+}
+
+static COMMAND_LINE_ARGUMENT_A rdpsnd_fake_args[] =
+{
+	{ "dev", COMMAND_LINE_VALUE_REQUIRED, "<file>", NULL, NULL, -1, NULL, "output file" },
+	{ NULL, 0, NULL, NULL, NULL, -1, NULL, NULL }
+};
+
+static UINT rdpsnd_fake_parse_addin_args(rdpsndFakePlugin* fake, ADDIN_ARGV* args)
+{
+	int status;
+	DWORD flags;
+	COMMAND_LINE_ARGUMENT_A* arg;
+	flags = COMMAND_LINE_SIGIL_NONE | COMMAND_LINE_SEPARATOR_COLON | COMMAND_LINE_IGN_UNKNOWN_KEYWORD;
+	status = CommandLineParseArgumentsA(args->argc, (const char**) args->argv, rdpsnd_fake_args,
+	                                    flags, fake, NULL, NULL);
+
+	if (status < 0)
+		return ERROR_INVALID_DATA;
+
+	arg = rdpsnd_fake_args;
+
+	do
+	{
+		if (!(arg->Flags & COMMAND_LINE_VALUE_PRESENT))
+			continue;
+
+		CommandLineSwitchStart(arg)
+		CommandLineSwitchCase(arg, "dev")
+		{
+			if (!(fake->filename = _strdup(arg->Value)))
+				return CHANNEL_RC_NO_MEMORY;
+		}
+		CommandLineSwitchEnd(arg)
+	}
+	while ((arg = CommandLineFindNextArgumentA(arg)) != NULL);
+
+	return CHANNEL_RC_OK;
+}
+
+#ifdef BUILTIN_CHANNELS
+#define freerdp_rdpsnd_client_subsystem_entry	fake_freerdp_rdpsnd_client_subsystem_entry
+#else
+#define freerdp_rdpsnd_client_subsystem_entry	FREERDP_API freerdp_rdpsnd_client_subsystem_entry
+#endif
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+UINT freerdp_rdpsnd_client_subsystem_entry(PFREERDP_RDPSND_DEVICE_ENTRY_POINTS pEntryPoints)
+{
+	UINT error;
+	rdpsndFakePlugin* fake = (rdpsndFakePlugin*) calloc(1, sizeof(rdpsndFakePlugin));
+
+	if (!fake)
+		return CHANNEL_RC_NO_MEMORY;
+
+	fake->device.FormatSupported = rdpsnd_fake_format_supported;
+	fake->device.Open = rdpsnd_fake_open;
+	fake->device.SetFormat = rdpsnd_fake_set_format;
+	fake->device.GetVolume = rdpsnd_fake_get_volume;
+	fake->device.SetVolume = rdpsnd_fake_set_volume;
+	fake->device.Play = rdpsnd_fake_play;
+	fake->device.Close = rdpsnd_fake_close;
+	fake->device.Free = rdpsnd_fake_free;
+	fake->volume = 0xFFFFFFFF;
+
+	if (pEntryPoints->args &&
+	    ((error = rdpsnd_fake_parse_addin_args(fake, pEntryPoints->args)) != CHANNEL_RC_OK))
+	{
+		rdpsnd_fake_free(&fake->device);
+		return error;
+	}
+
+	pEntryPoints->pRegisterRdpsndDevice(pEntryPoints->rdpsnd, &fake->device);
+	return CHANNEL_RC_OK;
+}
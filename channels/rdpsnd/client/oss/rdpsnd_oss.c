@@ -421,12 +421,23 @@ static void rdpsnd_oss_wave_play(rdpsndDevicePlugin* device, RDPSND_WAVE* wave)
 
 		offset += status;
 	}
-
-	/* From rdpsnd_main.c */
-	wave->wTimeStampB = wave->wTimeStampA + wave->wAudioLength + 65 + latency;
-	wave->wLocalTimeB = wave->wLocalTimeA + wave->wAudioLength + 65 + latency;
 }
 
+static BOOL rdpsnd_oss_get_delay(rdpsndDevicePlugin* device, UINT32* delay)
+{
+	int bytes;
+	rdpsndOssPlugin* oss = (rdpsndOssPlugin*)device;
+
+	if (device == NULL || oss->pcm_handle == -1 || oss->format.wFormatTag != WAVE_FORMAT_PCM ||
+	    !oss->format.nAvgBytesPerSec)
+		return FALSE;
+
+	if (ioctl(oss->pcm_handle, SNDCTL_DSP_GETODELAY, &bytes) == -1)
+		return FALSE;
+
+	*delay = (UINT32)((UINT64) MAX(bytes, 0) * 1000 / oss->format.nAvgBytesPerSec);
+	return TRUE;
+}
 
 static COMMAND_LINE_ARGUMENT_A rdpsnd_oss_args[] =
 {
@@ -502,6 +513,7 @@ UINT freerdp_rdpsnd_client_subsystem_entry(PFREERDP_RDPSND_DEVICE_ENTRY_POINTS p
 	oss->device.WavePlay = rdpsnd_oss_wave_play;
 	oss->device.Close = rdpsnd_oss_close;
 	oss->device.Free = rdpsnd_oss_free;
+	oss->device.GetDelay = rdpsnd_oss_get_delay;
 	oss->pcm_handle = -1;
 	oss->mixer_handle = -1;
 	oss->dev_unit = -1;
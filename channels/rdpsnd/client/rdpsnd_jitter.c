@@ -0,0 +1,216 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Audio Output Virtual Channel - Playout Buffer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include <winpr/crt.h>
+
+#include <freerdp/types.h>
+
+#include "rdpsnd_jitter.h"
+
+struct _RDPSND_JITTER
+{
+	UINT32 minDelay;
+	UINT32 maxDelay;
+
+	/* arrivals, the jitter is kept scaled by 16 */
+	BOOL started;
+	UINT16 lastStamp;
+	UINT32 lastDuration;
+	UINT32 serverTime;
+	INT32 transit;
+	UINT32 jitter;
+
+	/* playout, the level is the audio left at the device when the next wave
+	 * is handed over, smoothed and scaled by 16 */
+	BOOL playing;
+	BOOL active;
+	UINT32 deviceEnd;
+	UINT32 deviceEndUs;
+	INT32 level;
+	INT32 drift;
+	UINT32 latency;
+	UINT32 underruns;
+};
+
+RDPSND_JITTER* rdpsnd_jitter_new(UINT32 minDelay, UINT32 maxDelay)
+{
+	RDPSND_JITTER* jitter = (RDPSND_JITTER*) calloc(1, sizeof(RDPSND_JITTER));
+
+	if (!jitter)
+		return NULL;
+
+	jitter->minDelay = minDelay;
+	jitter->maxDelay = MAX(minDelay, maxDelay);
+	return jitter;
+}
+
+void rdpsnd_jitter_free(RDPSND_JITTER* jitter)
+{
+	free(jitter);
+}
+
+/* A new stream, the statistics are kept */
+void rdpsnd_jitter_reset(RDPSND_JITTER* jitter)
+{
+	jitter->started = FALSE;
+	jitter->playing = FALSE;
+	jitter->active = FALSE;
+	jitter->drift = 0;
+}
+
+static UINT32 rdpsnd_jitter_target(RDPSND_JITTER* jitter)
+{
+	const UINT32 target = jitter->minDelay + 4 * (jitter->jitter >> 4);
+	return MIN(target, jitter->maxDelay);
+}
+
+void rdpsnd_jitter_arrival(RDPSND_JITTER* jitter, UINT16 wTimeStamp, UINT32 duration,
+                           UINT32 now)
+{
+	INT32 transit;
+
+	if (!jitter->started)
+	{
+		jitter->started = TRUE;
+		jitter->serverTime = wTimeStamp;
+		jitter->transit = (INT32)(now - jitter->serverTime);
+	}
+	else
+	{
+		UINT32 delta;
+
+		/* servers that do not stamp their waves repeat the last value */
+		if (wTimeStamp != jitter->lastStamp)
+			jitter->serverTime += (UINT16)(wTimeStamp - jitter->lastStamp);
+		else
+			jitter->serverTime += jitter->lastDuration;
+
+		transit = (INT32)(now - jitter->serverTime);
+		delta = (UINT32) abs(transit - jitter->transit);
+		jitter->jitter += MIN(delta, jitter->maxDelay) - (jitter->jitter >> 4);
+		jitter->transit = transit;
+	}
+
+	jitter->lastStamp = wTimeStamp;
+	jitter->lastDuration = duration;
+}
+
+/**
+ * Whether the oldest queued wave may go to the device. Before playback
+ * starts the queue has to cover the target beyond one wave, or the oldest
+ * wave has waited as long, which lets short sounds through.
+ */
+BOOL rdpsnd_jitter_ready(RDPSND_JITTER* jitter, UINT32 pending, UINT32 oldest, UINT32 now,
+                         UINT32* wait)
+{
+	UINT32 waited;
+	const UINT32 target = rdpsnd_jitter_target(jitter);
+
+	if (jitter->active && ((INT32)(now - jitter->deviceEnd) > 0))
+	{
+		/* a wave later than the longest delay is a pause of the source */
+		if (jitter->playing && ((INT32)(oldest - jitter->deviceEnd) < (INT32) jitter->maxDelay))
+			jitter->underruns++;
+
+		jitter->active = FALSE;
+		jitter->playing = FALSE;
+		jitter->drift = 0;
+	}
+
+	if (jitter->playing)
+		return TRUE;
+
+	waited = now - oldest;
+
+	if ((pending >= target + jitter->lastDuration) || (waited >= target))
+	{
+		jitter->playing = TRUE;
+		return TRUE;
+	}
+
+	*wait = target - waited;
+	return FALSE;
+}
+
+/* The rate to resample to so the device plays at the corrected speed */
+UINT32 rdpsnd_jitter_rate(RDPSND_JITTER* jitter, UINT32 rate)
+{
+	return (UINT32)(((UINT64) rate * (1000000 + jitter->drift) + 500000) / 1000000);
+}
+
+/**
+ * A wave of duration us goes to the device, pending ms stay queued. The
+ * duration is finer than a millisecond so the rate correction adds up.
+ * delay is the audio the device has left to play, negative if it doesn't
+ * tell. Returns the local time its last sample is played.
+ */
+UINT32 rdpsnd_jitter_play(RDPSND_JITTER* jitter, UINT32 duration, UINT32 pending,
+                          UINT32 arrival, UINT32 now, INT32 delay)
+{
+	INT32 level;
+	const INT32 target = (INT32) rdpsnd_jitter_target(jitter);
+
+	/* the device knows when its audio ends, the estimate follows the local clock */
+	if (jitter->active && (delay >= 0))
+	{
+		jitter->deviceEnd = now + (UINT32) delay;
+		jitter->deviceEndUs = 0;
+	}
+
+	if (!jitter->active || ((INT32)(now - jitter->deviceEnd) > 0))
+	{
+		jitter->active = TRUE;
+		jitter->deviceEnd = now;
+		jitter->deviceEndUs = 0;
+		jitter->level = 16 * target;
+	}
+
+	level = (INT32)(jitter->deviceEnd - now + pending);
+	jitter->level += level - jitter->level / 16;
+	level = jitter->level / 16;
+
+	/* correct outside of [target / 2, 2 * target], stop once back at the target */
+	if (level > 2 * target + (INT32) jitter->minDelay)
+		jitter->drift = -RDPSND_JITTER_MAX_DRIFT;
+	else if (level < target / 2)
+		jitter->drift = RDPSND_JITTER_MAX_DRIFT;
+	else if (((jitter->drift < 0) && (level <= target)) ||
+	         ((jitter->drift > 0) && (level >= target)))
+		jitter->drift = 0;
+
+	jitter->deviceEndUs += duration;
+	jitter->deviceEnd += jitter->deviceEndUs / 1000;
+	jitter->deviceEndUs %= 1000;
+	jitter->latency = jitter->deviceEnd - arrival;
+	return jitter->deviceEnd;
+}
+
+void rdpsnd_jitter_get_stats(RDPSND_JITTER* jitter, RDPSND_JITTER_STATS* stats)
+{
+	stats->target = rdpsnd_jitter_target(jitter);
+	stats->jitter = jitter->jitter >> 4;
+	stats->level = (UINT32) MAX(jitter->level / 16, 0);
+	stats->latency = jitter->latency;
+	stats->underruns = jitter->underruns;
+	stats->drift = jitter->drift;
+}
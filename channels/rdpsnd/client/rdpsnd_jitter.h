@@ -0,0 +1,73 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Audio Output Virtual Channel - Playout Buffer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RDPSND_JITTER_H
+#define __RDPSND_JITTER_H
+
+#include <winpr/wtypes.h>
+
+/**
+ * The arrival times of the waves are compared with their server timestamps,
+ * the variation of the difference (the interarrival jitter of RFC 3550)
+ * decides how much audio is buffered before playback starts, or resumes
+ * after the device ran dry. While playing, the smoothed level of the buffer
+ * selects a slightly faster or slower playback rate that keeps it near the
+ * target, which absorbs the drift between the server clock and the clock
+ * the level is measured with. Devices that report their delay give the
+ * level by the device clock. For the others the device is assumed to play
+ * at the rate of the local clock, and the drift of the device clock is not
+ * corrected.
+ *
+ * All times are in milliseconds of the local clock, except the duration
+ * of a played wave which is in microseconds. The functions do not lock:
+ * the caller serializes them.
+ */
+
+#define RDPSND_JITTER_MIN_DELAY		20
+#define RDPSND_JITTER_MAX_DELAY		400
+
+/* Largest playback rate correction, in parts per million */
+#define RDPSND_JITTER_MAX_DRIFT		5000
+
+typedef struct _RDPSND_JITTER RDPSND_JITTER;
+
+struct _RDPSND_JITTER_STATS
+{
+	UINT32 target;
+	UINT32 jitter;
+	UINT32 level;
+	UINT32 latency;
+	UINT32 underruns;
+	INT32 drift;
+};
+typedef struct _RDPSND_JITTER_STATS RDPSND_JITTER_STATS;
+
+RDPSND_JITTER* rdpsnd_jitter_new(UINT32 minDelay, UINT32 maxDelay);
+void rdpsnd_jitter_free(RDPSND_JITTER* jitter);
+void rdpsnd_jitter_reset(RDPSND_JITTER* jitter);
+
+void rdpsnd_jitter_arrival(RDPSND_JITTER* jitter, UINT16 wTimeStamp, UINT32 duration,
+                           UINT32 now);
+BOOL rdpsnd_jitter_ready(RDPSND_JITTER* jitter, UINT32 pending, UINT32 oldest, UINT32 now,
+                         UINT32* wait);
+UINT32 rdpsnd_jitter_rate(RDPSND_JITTER* jitter, UINT32 rate);
+UINT32 rdpsnd_jitter_play(RDPSND_JITTER* jitter, UINT32 duration, UINT32 pending,
+                          UINT32 arrival, UINT32 now, INT32 delay);
+
+void rdpsnd_jitter_get_stats(RDPSND_JITTER* jitter, RDPSND_JITTER_STATS* stats);
+
+#endif /* __RDPSND_JITTER_H */
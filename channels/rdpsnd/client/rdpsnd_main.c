@@ -44,11 +44,18 @@
 
 #include <freerdp/types.h>
 #include <freerdp/addin.h>
+#include <freerdp/codec/dsp.h>
+#include <freerdp/channels/channels.h>
+#include <freerdp/utils/metrics.h>
 
 #include "rdpsnd_main.h"
+#include "rdpsnd_jitter.h"
 
 #define TIME_DELAY_MS	65
 
+/* The longest a format change or close waits for the queued waves */
+#define RDPSND_DRAIN_TIMEOUT	10000
+
 struct rdpsnd_plugin
 {
 	CHANNEL_DEF channelDef;
@@ -90,6 +97,36 @@ struct rdpsnd_plugin
 	char* subsystem;
 	char* device_name;
 
+	/* Formats the device cannot play are decoded to PCM */
+	BOOL decoding;
+	AUDIO_FORMAT decodedFormat;
+	FREERDP_DSP_CONTEXT* dsp_context;
+	wStream* decoded;
+
+	/**
+	 * The waves wait in the playback queue until the playout buffer releases
+	 * them, the playback thread hands them to the device. The device is only
+	 * opened, changed or closed once the queue has been played out.
+	 */
+	RDPSND_JITTER* jitter;
+	wQueue* PlaybackQueue;
+	UINT32 playbackPending;
+	BOOL draining;
+	AUDIO_FORMAT playbackFormat;
+	FREERDP_DSP_CONTEXT* drift_context;
+	UINT32 driftRate;
+	CRITICAL_SECTION playbackLock;
+	BOOL playbackLockInitialized;
+	HANDLE playbackEvent;
+	HANDLE drainedEvent;
+	HANDLE PlaybackThread;
+
+	UINT32 latencyMetric;
+	UINT32 jitterMetric;
+	UINT32 levelMetric;
+	UINT32 underrunMetric;
+	UINT32 underruns;
+
 	/* Device plugin */
 	rdpsndDevicePlugin* device;
 	rdpContext* rdpcontext;
@@ -161,12 +198,11 @@ static void* rdpsnd_schedule_thread(void* arg)
 		wave = (RDPSND_WAVE*) message.wParam;
 		wCurrentTime = (UINT16) GetTickCount();
 		wTimeStamp = wave->wLocalTimeB;
+		wTimeDiff = wTimeStamp - wCurrentTime;
 
-		if (wCurrentTime <= wTimeStamp)
-		{
-			wTimeDiff = wTimeStamp - wCurrentTime;
+		/* the confirm goes out when the last sample is played */
+		if ((INT16) wTimeDiff > 0)
 			Sleep(wTimeDiff);
-		}
 
 		if ((error = rdpsnd_confirm_wave(rdpsnd, wave)))
 		{
@@ -211,6 +247,20 @@ static UINT rdpsnd_send_quality_mode_pdu(rdpsndPlugin* rdpsnd)
 	return rdpsnd_virtual_channel_write(rdpsnd, pdu);
 }
 
+static BOOL rdpsnd_format_supported(rdpsndPlugin* rdpsnd, const AUDIO_FORMAT* format)
+{
+	AUDIO_FORMAT pcm;
+
+	if (rdpsnd->device->FormatSupported(rdpsnd->device, (AUDIO_FORMAT*) format))
+		return TRUE;
+
+	if (!freerdp_dsp_supports_format(format, FALSE))
+		return FALSE;
+
+	freerdp_dsp_pcm_format(format, &pcm);
+	return rdpsnd->device->FormatSupported(rdpsnd->device, &pcm);
+}
+
 static void rdpsnd_select_supported_audio_formats(rdpsndPlugin* rdpsnd)
 {
 	int index;
@@ -245,8 +295,7 @@ static void rdpsnd_select_supported_audio_formats(rdpsndPlugin* rdpsnd)
 		    && (rdpsnd->fixedRate != serverFormat->nSamplesPerSec))
 			continue;
 
-		if (rdpsnd->device
-		    && rdpsnd->device->FormatSupported(rdpsnd->device, serverFormat))
+		if (rdpsnd->device && rdpsnd_format_supported(rdpsnd, serverFormat))
 		{
 			clientFormat = &rdpsnd->ClientFormats[rdpsnd->NumberOfClientFormats++];
 			CopyMemory(clientFormat, serverFormat, sizeof(AUDIO_FORMAT));
@@ -485,6 +534,68 @@ static UINT rdpsnd_recv_training_pdu(rdpsndPlugin* rdpsnd, wStream* s)
 	return rdpsnd_send_training_confirm_pdu(rdpsnd, wTimeStamp, wPackSize);
 }
 
+/**
+ * Sets up decoding for formats the device does not play itself and
+ * returns the format the device has to be opened with.
+ */
+static AUDIO_FORMAT* rdpsnd_device_format(rdpsndPlugin* rdpsnd, AUDIO_FORMAT* format)
+{
+	rdpsnd->decoding = !rdpsnd->device->FormatSupported(rdpsnd->device, format);
+
+	if (!rdpsnd->decoding)
+		return format;
+
+	if (!rdpsnd->dsp_context && !(rdpsnd->dsp_context = freerdp_dsp_context_new()))
+		return NULL;
+
+	if (!rdpsnd->decoded && !(rdpsnd->decoded = Stream_New(NULL, 4096)))
+		return NULL;
+
+	if (!freerdp_dsp_context_reset(rdpsnd->dsp_context, format))
+		return NULL;
+
+	freerdp_dsp_pcm_format(format, &rdpsnd->decodedFormat);
+	return &rdpsnd->decodedFormat;
+}
+
+/**
+ * Plays out the waves still queued and waits for the playback thread to
+ * hand them to the device, before it is opened, changed or closed.
+ */
+static void rdpsnd_drain_playback(rdpsndPlugin* rdpsnd)
+{
+	DWORD status;
+	HANDLE events[2];
+	events[0] = rdpsnd->drainedEvent;
+	events[1] = rdpsnd->PlaybackThread;
+	EnterCriticalSection(&rdpsnd->playbackLock);
+	rdpsnd->draining = TRUE;
+	ResetEvent(rdpsnd->drainedEvent);
+	LeaveCriticalSection(&rdpsnd->playbackLock);
+	SetEvent(rdpsnd->playbackEvent);
+
+	/* a playback thread that failed is gone, nobody drains the queue any more */
+	status = WaitForMultipleObjects(2, events, FALSE, RDPSND_DRAIN_TIMEOUT);
+
+	if (status == WAIT_OBJECT_0 + 1)
+		WLog_WARN(TAG, "the playback thread has exited, the playback queue is not drained");
+	else if (status != WAIT_OBJECT_0)
+		WLog_WARN(TAG, "the playback queue did not drain");
+
+	EnterCriticalSection(&rdpsnd->playbackLock);
+	rdpsnd->draining = FALSE;
+	LeaveCriticalSection(&rdpsnd->playbackLock);
+}
+
+/* The device plays a new stream, buffering starts over */
+static void rdpsnd_playback_format(rdpsndPlugin* rdpsnd, const AUDIO_FORMAT* format)
+{
+	EnterCriticalSection(&rdpsnd->playbackLock);
+	rdpsnd->playbackFormat = *format;
+	rdpsnd_jitter_reset(rdpsnd->jitter);
+	LeaveCriticalSection(&rdpsnd->playbackLock);
+}
+
 /**
  * Function description
  *
@@ -506,6 +617,10 @@ static UINT rdpsnd_recv_wave_info_pdu(rdpsndPlugin* rdpsnd, wStream* s,
 	Stream_Seek(s, 3); /* bPad */
 	Stream_Read(s, rdpsnd->waveData, 4);
 	rdpsnd->waveDataSize = BodySize - 8;
+
+	if (wFormatNo >= rdpsnd->NumberOfClientFormats)
+		return ERROR_INVALID_DATA;
+
 	format = &rdpsnd->ClientFormats[wFormatNo];
 	WLog_Print(rdpsnd->log, WLOG_DEBUG, "WaveInfo: cBlockNo: %"PRIu8" wFormatNo: %"PRIu16"",
 	           rdpsnd->cBlockNo, wFormatNo);
@@ -517,10 +632,16 @@ static UINT rdpsnd_recv_wave_info_pdu(rdpsndPlugin* rdpsnd, wStream* s,
 
 		//rdpsnd_print_audio_format(format);
 
-		if (rdpsnd->device && rdpsnd->device->Open &&
-		    !rdpsnd->device->Open(rdpsnd->device, format, rdpsnd->latency))
+		if (rdpsnd->device && rdpsnd->device->Open)
 		{
-			return CHANNEL_RC_INITIALIZATION_ERROR;
+			AUDIO_FORMAT* deviceFormat;
+			rdpsnd_drain_playback(rdpsnd);
+			deviceFormat = rdpsnd_device_format(rdpsnd, format);
+
+			if (!deviceFormat || !rdpsnd->device->Open(rdpsnd->device, deviceFormat, rdpsnd->latency))
+				return CHANNEL_RC_INITIALIZATION_ERROR;
+
+			rdpsnd_playback_format(rdpsnd, deviceFormat);
 		}
 	}
 	else if (wFormatNo != rdpsnd->wCurrentFormatNo)
@@ -529,9 +650,18 @@ static UINT rdpsnd_recv_wave_info_pdu(rdpsndPlugin* rdpsnd, wStream* s,
 
 		if (rdpsnd->device)
 		{
+			AUDIO_FORMAT* deviceFormat;
+			rdpsnd_drain_playback(rdpsnd);
+			deviceFormat = rdpsnd_device_format(rdpsnd, format);
+
+			if (!deviceFormat)
+				return CHANNEL_RC_INITIALIZATION_ERROR;
+
 			if (rdpsnd->device->SetFormat
-			    && !rdpsnd->device->SetFormat(rdpsnd->device, format, rdpsnd->latency))
+			    && !rdpsnd->device->SetFormat(rdpsnd->device, deviceFormat, rdpsnd->latency))
 				return CHANNEL_RC_INITIALIZATION_ERROR;
+
+			rdpsnd_playback_format(rdpsnd, deviceFormat);
 		}
 	}
 
@@ -598,6 +728,181 @@ static UINT rdpsnd_device_send_wave_confirm_pdu(rdpsndDevicePlugin* device,
 	return CHANNEL_RC_OK;
 }
 
+/**
+ * Hands a wave to the device, resampled to the rate that corrects the clock
+ * drift. The confirm reports the time the last sample is played, which
+ * includes the time the wave waited in the playback queue. Devices that
+ * know better when that is may change it in WavePlay.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT rdpsnd_play_wave(rdpsndPlugin* rdpsnd, RDPSND_WAVE* wave, UINT32 rate)
+{
+	UINT32 delay;
+	UINT32 duration;
+	UINT32 wLocalTimeEnd;
+	INT32 deviceDelay = -1;
+	RDPSND_JITTER_STATS stats;
+	rdpsndDevicePlugin* device = rdpsnd->device;
+	AUDIO_FORMAT* format = &rdpsnd->playbackFormat;
+
+	if ((format->wFormatTag == WAVE_FORMAT_PCM) && format->nChannels &&
+	    ((format->wBitsPerSample == 8) || (format->wBitsPerSample == 16)))
+	{
+		if (rate != format->nSamplesPerSec)
+		{
+			FREERDP_DSP_CONTEXT* context = rdpsnd->drift_context;
+			const int bps = format->wBitsPerSample / 8;
+
+			if (!context->resample(context, wave->data, bps, format->nChannels,
+			                       format->nSamplesPerSec, wave->length / (bps * format->nChannels),
+			                       format->nChannels, rate))
+			{
+				free(wave);
+				return ERROR_INTERNAL_ERROR;
+			}
+
+			wave->data = context->resampled_buffer;
+			wave->length = context->resampled_size;
+			wave->wAudioLength = rdpsnd_compute_audio_time_length(format, wave->length);
+			rdpsnd->driftRate = rate;
+		}
+		else if (rdpsnd->driftRate)
+		{
+			/* the filter history of the corrected rate does not fit the next correction */
+			freerdp_dsp_context_free(rdpsnd->drift_context);
+
+			if (!(rdpsnd->drift_context = freerdp_dsp_context_new()))
+			{
+				free(wave);
+				return CHANNEL_RC_NO_MEMORY;
+			}
+
+			rdpsnd->driftRate = 0;
+		}
+	}
+
+	duration = wave->wAudioLength * 1000;
+
+	if ((format->wFormatTag == WAVE_FORMAT_PCM) && format->nBlockAlign && format->nSamplesPerSec)
+		duration = (UINT32)((UINT64)(wave->length / format->nBlockAlign) * 1000000 /
+		                    format->nSamplesPerSec);
+
+	if (device->GetDelay && device->GetDelay(device, &delay))
+		deviceDelay = (INT32) MIN(delay, INT32_MAX);
+
+	EnterCriticalSection(&rdpsnd->playbackLock);
+	wLocalTimeEnd = rdpsnd_jitter_play(rdpsnd->jitter, duration,
+	                                   rdpsnd->playbackPending, wave->wLocalTimeA, GetTickCount(),
+	                                   deviceDelay);
+	rdpsnd_jitter_get_stats(rdpsnd->jitter, &stats);
+	LeaveCriticalSection(&rdpsnd->playbackLock);
+	freerdp_metric_record(rdpsnd->latencyMetric, stats.latency);
+	freerdp_metric_record(rdpsnd->jitterMetric, stats.jitter);
+	freerdp_metric_record(rdpsnd->levelMetric, stats.level);
+
+	if (stats.underruns != rdpsnd->underruns)
+	{
+		freerdp_metric_add(rdpsnd->underrunMetric, stats.underruns - rdpsnd->underruns);
+		rdpsnd->underruns = stats.underruns;
+	}
+
+	if (device->WaveDecode && !device->WaveDecode(device, wave))
+	{
+		free(wave);
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	/* the delay a device reports is part of the end estimate already */
+	if (deviceDelay < 0)
+		wLocalTimeEnd += TIME_DELAY_MS;
+
+	wave->wTimeStampB = (UINT16)(wave->wTimeStampA + (wLocalTimeEnd - wave->wLocalTimeA));
+	wave->wLocalTimeB = wLocalTimeEnd;
+
+	if (device->WavePlay)
+	{
+		IFCALL(device->WavePlay, device, wave);
+	}
+	else
+	{
+		IFCALL(device->Play, device, wave->data, wave->length);
+	}
+
+	if (wave->AutoConfirm)
+		return device->WaveConfirm(device, wave);
+
+	return CHANNEL_RC_OK;
+}
+
+static void* rdpsnd_playback_thread(void* arg)
+{
+	UINT32 rate;
+	UINT32 wait;
+	DWORD status;
+	HANDLE events[2];
+	RDPSND_WAVE* wave;
+	DWORD timeout = INFINITE;
+	UINT error = CHANNEL_RC_OK;
+	rdpsndPlugin* rdpsnd = (rdpsndPlugin*) arg;
+	events[0] = rdpsnd->stopEvent;
+	events[1] = rdpsnd->playbackEvent;
+
+	while (!error)
+	{
+		status = WaitForMultipleObjects(2, events, FALSE, timeout);
+
+		if (status == WAIT_FAILED)
+		{
+			error = GetLastError();
+			WLog_ERR(TAG, "WaitForMultipleObjects failed with error %"PRIu32"!", error);
+			break;
+		}
+
+		if (status == WAIT_OBJECT_0)
+			break;
+
+		timeout = INFINITE;
+
+		while (!error)
+		{
+			EnterCriticalSection(&rdpsnd->playbackLock);
+			wave = (RDPSND_WAVE*) Queue_Peek(rdpsnd->PlaybackQueue);
+
+			if (!wave)
+			{
+				SetEvent(rdpsnd->drainedEvent);
+				LeaveCriticalSection(&rdpsnd->playbackLock);
+				break;
+			}
+
+			if (!rdpsnd->draining &&
+			    !rdpsnd_jitter_ready(rdpsnd->jitter, rdpsnd->playbackPending, wave->wLocalTimeA,
+			                         GetTickCount(), &wait))
+			{
+				LeaveCriticalSection(&rdpsnd->playbackLock);
+				timeout = wait;
+				break;
+			}
+
+			Queue_Dequeue(rdpsnd->PlaybackQueue);
+			rdpsnd->playbackPending -= wave->wAudioLength;
+			rate = rdpsnd_jitter_rate(rdpsnd->jitter, rdpsnd->playbackFormat.nSamplesPerSec);
+			LeaveCriticalSection(&rdpsnd->playbackLock);
+
+			if ((error = rdpsnd_play_wave(rdpsnd, wave, rate)))
+				WLog_ERR(TAG, "rdpsnd_play_wave failed with error %"PRIu32"!", error);
+		}
+	}
+
+	if (error && rdpsnd->rdpcontext)
+		setChannelError(rdpsnd->rdpcontext, error,
+		                "rdpsnd_playback_thread reported an error");
+
+	ExitThread((DWORD)error);
+	return NULL;
+}
+
 /**
  * Function description
  *
@@ -619,8 +924,26 @@ static UINT rdpsnd_recv_wave_pdu(rdpsndPlugin* rdpsnd, wStream* s)
 	 */
 	CopyMemory(Stream_Buffer(s), rdpsnd->waveData, 4);
 	data = Stream_Buffer(s);
-	size = (int) Stream_Capacity(s);
-	wave = (RDPSND_WAVE*) calloc(1, sizeof(RDPSND_WAVE));
+	size = (int) Stream_Length(s);
+	format = &rdpsnd->ClientFormats[rdpsnd->wCurrentFormatNo];
+
+	if (rdpsnd->device && rdpsnd->decoding)
+	{
+		Stream_SetPosition(rdpsnd->decoded, 0);
+
+		if (!freerdp_dsp_decode(rdpsnd->dsp_context, data, size, rdpsnd->decoded))
+		{
+			WLog_ERR(TAG, "freerdp_dsp_decode failed!");
+			return ERROR_INTERNAL_ERROR;
+		}
+
+		data = Stream_Buffer(rdpsnd->decoded);
+		size = (int) Stream_GetPosition(rdpsnd->decoded);
+		format = &rdpsnd->decodedFormat;
+	}
+
+	/* the samples are kept with the wave while it waits in the playback queue */
+	wave = (RDPSND_WAVE*) calloc(1, sizeof(RDPSND_WAVE) + size);
 
 	if (!wave)
 	{
@@ -632,11 +955,11 @@ static UINT rdpsnd_recv_wave_pdu(rdpsndPlugin* rdpsnd, wStream* s)
 	wave->wTimeStampA = rdpsnd->wTimeStamp;
 	wave->wFormatNo = rdpsnd->wCurrentFormatNo;
 	wave->cBlockNo = rdpsnd->cBlockNo;
-	wave->data = data;
+	wave->data = (BYTE*) &wave[1];
 	wave->length = size;
 	wave->AutoConfirm = TRUE;
-	format = &rdpsnd->ClientFormats[rdpsnd->wCurrentFormatNo];
 	wave->wAudioLength = rdpsnd_compute_audio_time_length(format, size);
+	CopyMemory(wave->data, data, size);
 	WLog_Print(rdpsnd->log, WLOG_DEBUG, "Wave: cBlockNo: %"PRIu8" wTimeStamp: %"PRIu16"",
 	           wave->cBlockNo, wave->wTimeStampA);
 
@@ -649,42 +972,37 @@ static UINT rdpsnd_recv_wave_pdu(rdpsndPlugin* rdpsnd, wStream* s)
 		return status;
 	}
 
-	if (rdpsnd->device->WaveDecode
-	    && !rdpsnd->device->WaveDecode(rdpsnd->device, wave))
+	EnterCriticalSection(&rdpsnd->playbackLock);
+	rdpsnd_jitter_arrival(rdpsnd->jitter, wave->wTimeStampA, wave->wAudioLength,
+	                      wave->wLocalTimeA);
+
+	if (!Queue_Enqueue(rdpsnd->PlaybackQueue, wave))
 	{
+		LeaveCriticalSection(&rdpsnd->playbackLock);
 		free(wave);
 		return CHANNEL_RC_NO_MEMORY;
 	}
 
-	if (rdpsnd->device->WavePlay)
-	{
-		IFCALL(rdpsnd->device->WavePlay, rdpsnd->device, wave);
-	}
-	else
-	{
-		IFCALL(rdpsnd->device->Play, rdpsnd->device, data, size);
-	}
-
-	if (!rdpsnd->device->WavePlay)
-	{
-		wave->wTimeStampB = rdpsnd->wTimeStamp + wave->wAudioLength + TIME_DELAY_MS;
-		wave->wLocalTimeB = wave->wLocalTimeA + wave->wAudioLength + TIME_DELAY_MS;
-	}
-
-	status = CHANNEL_RC_OK;
-
-	if (wave->AutoConfirm)
-		status = rdpsnd->device->WaveConfirm(rdpsnd->device, wave);
-
-	return status;
+	rdpsnd->playbackPending += wave->wAudioLength;
+	LeaveCriticalSection(&rdpsnd->playbackLock);
+	SetEvent(rdpsnd->playbackEvent);
+	return CHANNEL_RC_OK;
 }
 
 static void rdpsnd_recv_close_pdu(rdpsndPlugin* rdpsnd)
 {
+	RDPSND_JITTER_STATS stats;
 	WLog_Print(rdpsnd->log, WLOG_DEBUG, "Close");
 
 	if (rdpsnd->device)
 	{
+		rdpsnd_drain_playback(rdpsnd);
+		EnterCriticalSection(&rdpsnd->playbackLock);
+		rdpsnd_jitter_get_stats(rdpsnd->jitter, &stats);
+		LeaveCriticalSection(&rdpsnd->playbackLock);
+		WLog_Print(rdpsnd->log, WLOG_DEBUG,
+		           "Playback: target: %"PRIu32" ms jitter: %"PRIu32" ms latency: %"PRIu32" ms "
+		           "underruns: %"PRIu32"", stats.target, stats.jitter, stats.latency, stats.underruns);
 		IFCALL(rdpsnd->device->Close, rdpsnd->device);
 	}
 
@@ -776,7 +1094,7 @@ static UINT rdpsnd_recv_pdu(rdpsndPlugin* rdpsnd, wStream* s)
 	}
 
 out:
-	Stream_Free(s, TRUE);
+	freerdp_channels_data_free(s);
 	return status;
 }
 
@@ -955,9 +1273,6 @@ static UINT rdpsnd_process_connect(rdpsndPlugin* rdpsnd)
 
 	if (rdpsnd->subsystem)
 	{
-		if (strcmp(rdpsnd->subsystem, "fake") == 0)
-			return CHANNEL_RC_OK;
-
 		if ((status = rdpsnd_load_device_plugin(rdpsnd, rdpsnd->subsystem, args)))
 		{
 			WLog_ERR(TAG, "unable to load the %s subsystem plugin because of error %"PRIu32"",
@@ -1076,16 +1391,49 @@ static UINT rdpsnd_process_connect(rdpsndPlugin* rdpsnd)
 		return CHANNEL_RC_INITIALIZATION_ERROR;
 	}
 
-	if (!rdpsnd->device->DisableConfirmThread)
+	rdpsnd->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	rdpsnd->playbackEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	rdpsnd->drainedEvent = CreateEvent(NULL, TRUE, TRUE, NULL);
+
+	if (!rdpsnd->stopEvent || !rdpsnd->playbackEvent || !rdpsnd->drainedEvent)
 	{
-		rdpsnd->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		WLog_ERR(TAG, "CreateEvent failed!");
+		return CHANNEL_RC_INITIALIZATION_ERROR;
+	}
 
-		if (!rdpsnd->stopEvent)
-		{
-			WLog_ERR(TAG, "CreateEvent failed!");
-			return CHANNEL_RC_INITIALIZATION_ERROR;
-		}
+	if (!InitializeCriticalSectionAndSpinCount(&rdpsnd->playbackLock, 4000))
+	{
+		WLog_ERR(TAG, "InitializeCriticalSectionAndSpinCount failed!");
+		return CHANNEL_RC_INITIALIZATION_ERROR;
+	}
+
+	rdpsnd->playbackLockInitialized = TRUE;
+	rdpsnd->PlaybackQueue = Queue_New(FALSE, -1, -1);
+	rdpsnd->jitter = rdpsnd_jitter_new(RDPSND_JITTER_MIN_DELAY, RDPSND_JITTER_MAX_DELAY);
+	rdpsnd->drift_context = freerdp_dsp_context_new();
+
+	if (!rdpsnd->PlaybackQueue || !rdpsnd->jitter || !rdpsnd->drift_context)
+	{
+		WLog_ERR(TAG, "unable to create the playback queue");
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	rdpsnd->latencyMetric = freerdp_metric_register("rdpsnd.latency.ms", FREERDP_METRIC_HISTOGRAM);
+	rdpsnd->jitterMetric = freerdp_metric_register("rdpsnd.jitter.ms", FREERDP_METRIC_HISTOGRAM);
+	rdpsnd->levelMetric = freerdp_metric_register("rdpsnd.buffer.ms", FREERDP_METRIC_HISTOGRAM);
+	rdpsnd->underrunMetric = freerdp_metric_register("rdpsnd.underruns", FREERDP_METRIC_COUNTER);
+	rdpsnd->PlaybackThread = CreateThread(NULL, 0,
+	                                      (LPTHREAD_START_ROUTINE) rdpsnd_playback_thread,
+	                                      (void*) rdpsnd, 0, NULL);
+
+	if (!rdpsnd->PlaybackThread)
+	{
+		WLog_ERR(TAG, "CreateThread failed!");
+		return CHANNEL_RC_INITIALIZATION_ERROR;
+	}
 
+	if (!rdpsnd->device->DisableConfirmThread)
+	{
 		rdpsnd->ScheduleThread = CreateThread(NULL, 0,
 		                                      (LPTHREAD_START_ROUTINE) rdpsnd_schedule_thread,
 		                                      (void*) rdpsnd, 0, NULL);
@@ -1102,10 +1450,23 @@ static UINT rdpsnd_process_connect(rdpsndPlugin* rdpsnd)
 
 static void rdpsnd_process_disconnect(rdpsndPlugin* rdpsnd)
 {
-	if (rdpsnd->ScheduleThread)
-	{
+	if (rdpsnd->stopEvent)
 		SetEvent(rdpsnd->stopEvent);
 
+	if (rdpsnd->PlaybackThread)
+	{
+		if (WaitForSingleObject(rdpsnd->PlaybackThread, INFINITE) == WAIT_FAILED)
+		{
+			WLog_ERR(TAG, "WaitForSingleObject failed with error %"PRIu32"!", GetLastError());
+			return;
+		}
+
+		CloseHandle(rdpsnd->PlaybackThread);
+		rdpsnd->PlaybackThread = NULL;
+	}
+
+	if (rdpsnd->ScheduleThread)
+	{
 		if (WaitForSingleObject(rdpsnd->ScheduleThread, INFINITE) == WAIT_FAILED)
 		{
 			WLog_ERR(TAG, "WaitForSingleObject failed with error %"PRIu32"!", GetLastError());
@@ -1113,7 +1474,49 @@ static void rdpsnd_process_disconnect(rdpsndPlugin* rdpsnd)
 		}
 
 		CloseHandle(rdpsnd->ScheduleThread);
+		rdpsnd->ScheduleThread = NULL;
+	}
+
+	if (rdpsnd->PlaybackQueue)
+	{
+		RDPSND_WAVE* wave;
+
+		while ((wave = (RDPSND_WAVE*) Queue_Dequeue(rdpsnd->PlaybackQueue)))
+			free(wave);
+
+		Queue_Free(rdpsnd->PlaybackQueue);
+		rdpsnd->PlaybackQueue = NULL;
+	}
+
+	rdpsnd->playbackPending = 0;
+	rdpsnd_jitter_free(rdpsnd->jitter);
+	rdpsnd->jitter = NULL;
+	freerdp_dsp_context_free(rdpsnd->drift_context);
+	rdpsnd->drift_context = NULL;
+	rdpsnd->driftRate = 0;
+
+	if (rdpsnd->playbackLockInitialized)
+	{
+		DeleteCriticalSection(&rdpsnd->playbackLock);
+		rdpsnd->playbackLockInitialized = FALSE;
+	}
+
+	if (rdpsnd->drainedEvent)
+	{
+		CloseHandle(rdpsnd->drainedEvent);
+		rdpsnd->drainedEvent = NULL;
+	}
+
+	if (rdpsnd->playbackEvent)
+	{
+		CloseHandle(rdpsnd->playbackEvent);
+		rdpsnd->playbackEvent = NULL;
+	}
+
+	if (rdpsnd->stopEvent)
+	{
 		CloseHandle(rdpsnd->stopEvent);
+		rdpsnd->stopEvent = NULL;
 	}
 }
 
@@ -1154,54 +1557,18 @@ UINT rdpsnd_virtual_channel_write(rdpsndPlugin* rdpsnd, wStream* s)
 static UINT rdpsnd_virtual_channel_event_data_received(rdpsndPlugin* plugin,
         void* pData, UINT32 dataLength, UINT32 totalLength, UINT32 dataFlags)
 {
+	UINT error;
 	wStream* s;
 
-	if ((dataFlags & CHANNEL_FLAG_SUSPEND) || (dataFlags & CHANNEL_FLAG_RESUME))
-	{
-		return CHANNEL_RC_OK;
-	}
-
-	if (dataFlags & CHANNEL_FLAG_FIRST)
-	{
-		if (plugin->data_in != NULL)
-			Stream_Free(plugin->data_in, TRUE);
-
-		plugin->data_in = Stream_New(NULL, totalLength);
-
-		if (!plugin->data_in)
-		{
-			WLog_ERR(TAG,  "Stream_New failed!");
-			return CHANNEL_RC_NO_MEMORY;
-		}
-	}
-
-	s = plugin->data_in;
-
-	if (!Stream_EnsureRemainingCapacity(s, (int) dataLength))
-	{
-		WLog_ERR(TAG,  "Stream_EnsureRemainingCapacity failed!");
-		return CHANNEL_RC_NO_MEMORY;
-	}
-
-	Stream_Write(s, pData, dataLength);
+	if ((error = freerdp_channels_data_received(plugin->rdpcontext, &plugin->data_in, pData,
+	             dataLength, totalLength, dataFlags, &s)))
+		return error;
 
-	if (dataFlags & CHANNEL_FLAG_LAST)
+	if (s && !MessageQueue_Post(plugin->MsgPipe->In, NULL, 0, (void*) s, NULL))
 	{
-		if (Stream_Capacity(s) != Stream_GetPosition(s))
-		{
-			WLog_ERR(TAG,  "rdpsnd_virtual_channel_event_data_received: read error");
-			return ERROR_INTERNAL_ERROR;
-		}
-
-		plugin->data_in = NULL;
-		Stream_SealLength(s);
-		Stream_SetPosition(s, 0);
-
-		if (!MessageQueue_Post(plugin->MsgPipe->In, NULL, 0, (void*) s, NULL))
-		{
-			WLog_ERR(TAG,  "MessageQueue_Post failed!");
-			return ERROR_INTERNAL_ERROR;
-		}
+		WLog_ERR(TAG,  "MessageQueue_Post failed!");
+		freerdp_channels_data_free(s);
+		return ERROR_INTERNAL_ERROR;
 	}
 
 	return CHANNEL_RC_OK;
@@ -1373,7 +1740,7 @@ static UINT rdpsnd_virtual_channel_event_disconnected(rdpsndPlugin* rdpsnd)
 
 	if (rdpsnd->data_in)
 	{
-		Stream_Free(rdpsnd->data_in, TRUE);
+		freerdp_channels_data_free(rdpsnd->data_in);
 		rdpsnd->data_in = NULL;
 	}
 
@@ -1385,6 +1752,11 @@ static UINT rdpsnd_virtual_channel_event_disconnected(rdpsndPlugin* rdpsnd)
 	rdpsnd_free_audio_formats(rdpsnd->ServerFormats, rdpsnd->NumberOfServerFormats);
 	rdpsnd->NumberOfServerFormats = 0;
 	rdpsnd->ServerFormats = NULL;
+	freerdp_dsp_context_free(rdpsnd->dsp_context);
+	rdpsnd->dsp_context = NULL;
+	Stream_Free(rdpsnd->decoded, TRUE);
+	rdpsnd->decoded = NULL;
+	rdpsnd->decoding = FALSE;
 
 	if (rdpsnd->device)
 	{
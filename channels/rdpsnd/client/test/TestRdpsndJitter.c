@@ -0,0 +1,211 @@
+#include <winpr/crt.h>
+
+#include "rdpsnd_jitter.h"
+
+#define TEST_WAVE	20
+#define TEST_RATE	44100
+
+/**
+ * Waves that arrive as regularly as they were stamped keep the minimum
+ * target, variations of the arrival times raise it up to the maximum. The
+ * 16 bit server timestamps may wrap meanwhile.
+ */
+static BOOL test_target(void)
+{
+	UINT32 index;
+	UINT32 now = 5000;
+	UINT16 stamp = 65500;
+	BOOL rc = FALSE;
+	RDPSND_JITTER_STATS stats;
+	RDPSND_JITTER* jitter = rdpsnd_jitter_new(RDPSND_JITTER_MIN_DELAY, RDPSND_JITTER_MAX_DELAY);
+
+	if (!jitter)
+		return FALSE;
+
+	for (index = 0; index < 100; index++)
+	{
+		rdpsnd_jitter_arrival(jitter, stamp, TEST_WAVE, now);
+		stamp += TEST_WAVE;
+		now += TEST_WAVE;
+	}
+
+	rdpsnd_jitter_get_stats(jitter, &stats);
+
+	if ((stats.jitter != 0) || (stats.target != RDPSND_JITTER_MIN_DELAY))
+		goto out;
+
+	/* every other wave is 40 ms late */
+	for (index = 0; index < 100; index++)
+	{
+		rdpsnd_jitter_arrival(jitter, stamp, TEST_WAVE, now + ((index % 2) ? 40 : 0));
+		stamp += TEST_WAVE;
+		now += TEST_WAVE;
+	}
+
+	rdpsnd_jitter_get_stats(jitter, &stats);
+
+	if ((stats.jitter < 30) || (stats.jitter > 40) ||
+	    (stats.target != RDPSND_JITTER_MIN_DELAY + 4 * stats.jitter))
+		goto out;
+
+	for (index = 0; index < 100; index++)
+	{
+		rdpsnd_jitter_arrival(jitter, stamp, TEST_WAVE, now + ((index % 2) ? 1000 : 0));
+		stamp += TEST_WAVE;
+		now += TEST_WAVE;
+	}
+
+	rdpsnd_jitter_get_stats(jitter, &stats);
+	rc = (stats.target == RDPSND_JITTER_MAX_DELAY);
+out:
+	rdpsnd_jitter_free(jitter);
+	return rc;
+}
+
+/**
+ * Playback waits until the target is buffered. A device that runs dry while
+ * waves keep coming is an underrun and buffers again, a longer silence is a
+ * pause of the source.
+ */
+static BOOL test_underrun(void)
+{
+	UINT32 wait = 0;
+	UINT32 now = 1000;
+	BOOL rc = FALSE;
+	RDPSND_JITTER_STATS stats;
+	RDPSND_JITTER* jitter = rdpsnd_jitter_new(RDPSND_JITTER_MIN_DELAY, RDPSND_JITTER_MAX_DELAY);
+
+	if (!jitter)
+		return FALSE;
+
+	rdpsnd_jitter_arrival(jitter, 0, 10, now);
+
+	if (rdpsnd_jitter_ready(jitter, 10, now, now, &wait) || (wait != RDPSND_JITTER_MIN_DELAY))
+		goto out;
+
+	/* the target and the wave about to be played */
+	if (!rdpsnd_jitter_ready(jitter, RDPSND_JITTER_MIN_DELAY + 10, now, now, &wait))
+		goto out;
+
+	if (rdpsnd_jitter_play(jitter, 10000, RDPSND_JITTER_MIN_DELAY, now, now, -1) != now + 10)
+		goto out;
+
+	/* the device ended at 1010, the next wave came at 1090 */
+	now = 1100;
+
+	if (rdpsnd_jitter_ready(jitter, 10, 1090, now, &wait) || (wait != 10))
+		goto out;
+
+	rdpsnd_jitter_get_stats(jitter, &stats);
+
+	if (stats.underruns != 1)
+		goto out;
+
+	if (!rdpsnd_jitter_ready(jitter, 10, 1090, now + 10, &wait))
+		goto out;
+
+	rdpsnd_jitter_play(jitter, 10000, 0, 1090, now + 10, -1);
+
+	/* a wave long after the last one ended */
+	now = 5000;
+
+	if (rdpsnd_jitter_ready(jitter, 10, now, now, &wait))
+		goto out;
+
+	rdpsnd_jitter_get_stats(jitter, &stats);
+	rc = (stats.underruns == 1);
+out:
+	rdpsnd_jitter_free(jitter);
+	return rc;
+}
+
+/**
+ * Plays waves of TEST_WAVE ms every TEST_WAVE ms with pending ms queued,
+ * starting once the device is done with the previous wave.
+ */
+static INT32 test_drift(UINT32 pending, UINT32* rate)
+{
+	UINT32 index;
+	UINT32 now = 1000;
+	RDPSND_JITTER_STATS stats;
+	RDPSND_JITTER* jitter = rdpsnd_jitter_new(RDPSND_JITTER_MIN_DELAY, RDPSND_JITTER_MAX_DELAY);
+
+	if (!jitter)
+		return 0;
+
+	for (index = 0; index < 100; index++)
+	{
+		now = rdpsnd_jitter_play(jitter, TEST_WAVE * 1000, pending, now, now, -1);
+		now -= (pending > 0) ? TEST_WAVE : 0;
+	}
+
+	rdpsnd_jitter_get_stats(jitter, &stats);
+	*rate = rdpsnd_jitter_rate(jitter, TEST_RATE);
+	rdpsnd_jitter_free(jitter);
+	return stats.drift;
+}
+
+/**
+ * A buffer that keeps growing is played faster, resampled to fewer samples,
+ * one that runs low slower.
+ */
+static BOOL test_drift_sign(void)
+{
+	UINT32 rate = 0;
+
+	if ((test_drift(300, &rate) != -RDPSND_JITTER_MAX_DRIFT) || (rate >= TEST_RATE))
+		return FALSE;
+
+	if ((test_drift(0, &rate) != RDPSND_JITTER_MAX_DRIFT) || (rate <= TEST_RATE))
+		return FALSE;
+
+	return (test_drift(RDPSND_JITTER_MIN_DELAY, &rate) == 0) && (rate == TEST_RATE);
+}
+
+/* The delay a device reports replaces the estimate of the local clock */
+static BOOL test_device_delay(void)
+{
+	BOOL rc = FALSE;
+	RDPSND_JITTER* jitter = rdpsnd_jitter_new(RDPSND_JITTER_MIN_DELAY, RDPSND_JITTER_MAX_DELAY);
+
+	if (!jitter)
+		return FALSE;
+
+	if (rdpsnd_jitter_play(jitter, TEST_WAVE * 1000, 0, 1000, 1000, -1) != 1000 + TEST_WAVE)
+		goto out;
+
+	/* the device plays slower than the local clock, 50 ms are left instead of 10 */
+	rc = (rdpsnd_jitter_play(jitter, TEST_WAVE * 1000, 0, 1000, 1010, 50) == 1060 + TEST_WAVE);
+out:
+	rdpsnd_jitter_free(jitter);
+	return rc;
+}
+
+int TestRdpsndJitter(int argc, char* argv[])
+{
+	if (!test_target())
+	{
+		fprintf(stderr, "jitter target test failed\n");
+		return -1;
+	}
+
+	if (!test_underrun())
+	{
+		fprintf(stderr, "underrun test failed\n");
+		return -1;
+	}
+
+	if (!test_drift_sign())
+	{
+		fprintf(stderr, "drift correction test failed\n");
+		return -1;
+	}
+
+	if (!test_device_delay())
+	{
+		fprintf(stderr, "device delay test failed\n");
+		return -1;
+	}
+
+	return 0;
+}
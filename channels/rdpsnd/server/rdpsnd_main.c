@@ -393,7 +393,12 @@ static UINT rdpsnd_server_select_format(RdpsndServerContext* context,
 		context->priv->out_buffer_size = out_buffer_size;
 	}
 
-	freerdp_dsp_context_reset_adpcm(context->priv->dsp_context);
+	if (!freerdp_dsp_context_reset(context->priv->dsp_context, format))
+	{
+		WLog_ERR(TAG, "freerdp_dsp_context_reset failed!");
+		error = ERROR_INTERNAL_ERROR;
+	}
+
 out:
 	LeaveCriticalSection(&context->priv->lock);
 	return error;
@@ -440,21 +445,26 @@ static UINT rdpsnd_server_send_audio_pdu(RdpsndServerContext* context,
 
 	size = frames * tbytes_per_frame;
 
-	if (format->wFormatTag == WAVE_FORMAT_DVI_ADPCM)
-	{
-		context->priv->dsp_context->encode_ima_adpcm(context->priv->dsp_context,
-		        src, size, format->nChannels, format->nBlockAlign);
-		src = context->priv->dsp_context->adpcm_buffer;
-		size = context->priv->dsp_context->adpcm_size;
-	}
-	else if (format->wFormatTag == WAVE_FORMAT_ADPCM)
+	if (format->wFormatTag != WAVE_FORMAT_PCM)
 	{
-		context->priv->dsp_context->encode_ms_adpcm(context->priv->dsp_context,
-		        src, size, format->nChannels, format->nBlockAlign);
-		src = context->priv->dsp_context->adpcm_buffer;
-		size = context->priv->dsp_context->adpcm_size;
+		wStream* encoded = context->priv->encoded_stream;
+		Stream_SetPosition(encoded, 0);
+
+		if (!freerdp_dsp_encode(context->priv->dsp_context, src, size, encoded))
+		{
+			WLog_ERR(TAG, "freerdp_dsp_encode failed!");
+			error = ERROR_INTERNAL_ERROR;
+			goto out;
+		}
+
+		src = Stream_Buffer(encoded);
+		size = Stream_GetPosition(encoded);
 	}
 
+	/* encoders working on whole frames may not have output yet */
+	if (size < 4)
+		goto out;
+
 	context->block_no = (context->block_no + 1) % 256;
 	/* Fill to nBlockAlign for the last audio packet */
 	fill_size = 0;
@@ -805,10 +815,20 @@ RdpsndServerContext* rdpsnd_server_context_new(HANDLE vcm)
 		goto out_free_dsp;
 	}
 
+	priv->encoded_stream = Stream_New(NULL, 4096);
+
+	if (!priv->encoded_stream)
+	{
+		WLog_ERR(TAG, "Stream_New failed!");
+		goto out_free_input;
+	}
+
 	priv->expectedBytes = 4;
 	priv->waitingHeader = TRUE;
 	priv->ownThread = TRUE;
 	return context;
+out_free_input:
+	Stream_Free(priv->input_stream, TRUE);
 out_free_dsp:
 	freerdp_dsp_context_free(priv->dsp_context);
 out_free_priv:
@@ -839,6 +859,9 @@ void rdpsnd_server_context_free(RdpsndServerContext* context)
 	if (context->priv->input_stream)
 		Stream_Free(context->priv->input_stream, TRUE);
 
+	if (context->priv->encoded_stream)
+		Stream_Free(context->priv->encoded_stream, TRUE);
+
 	free(context->client_formats);
 	free(context->priv);
 	free(context);
@@ -45,6 +45,7 @@ struct _rdpsnd_server_private
 	BYTE msgType;
 	wStream* input_stream;
 	wStream* rdpsnd_pdu;
+	wStream* encoded_stream;
 	BYTE* out_buffer;
 	int out_buffer_size;
 	int out_frames;
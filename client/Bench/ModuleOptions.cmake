@@ -0,0 +1,3 @@
+set(FREERDP_CLIENT_NAME "bfreerdp")
+set(FREERDP_CLIENT_PLATFORM "Bench")
+set(FREERDP_CLIENT_VENDOR "FreeRDP")
@@ -0,0 +1,1029 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Headless Load Generator
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/cmdline.h>
+#include <winpr/winsock.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/constants.h>
+#include <freerdp/gdi/gdi.h>
+#include <freerdp/gdi/gfx.h>
+#include <freerdp/client/rdpgfx.h>
+#include <freerdp/client/cmdline.h>
+#include <freerdp/client/channels.h>
+#include <freerdp/channels/channels.h>
+#include <freerdp/log.h>
+
+#define TAG CLIENT_TAG("bench")
+
+/**
+ * Opens many sessions against a local server from a few threads, each
+ * one rendering with the software gdi, and reports per session throughput:
+ *
+ * bfreerdp /port:3389 /sessions:32 /threads:4 /codec:gfx /duration:60
+ *          /input:script.txt /format:json /output:result.json
+ *
+ * An input script has one event per line, replayed in a loop by every session:
+ *
+ * # <delay in ms> move <x> <y> | click <x> <y> | key <scancode>
+ * 100 move 200 300
+ * 0 click 200 300
+ * 250 key 0x1E
+ *
+ * Input latency is measured from an input event to the next painted update.
+ */
+
+#define BENCH_CODEC_NONE	0
+#define BENCH_CODEC_RFX		1
+#define BENCH_CODEC_GFX		2
+#define BENCH_CODEC_AVC420	3
+
+#define BENCH_INPUT_MOVE	0
+#define BENCH_INPUT_CLICK	1
+#define BENCH_INPUT_KEY		2
+
+struct bf_input_event
+{
+	UINT32 delay;
+	UINT32 type;
+	UINT16 x;
+	UINT16 y;
+	UINT32 code;
+};
+typedef struct bf_input_event bfInputEvent;
+
+struct bf_config
+{
+	char* host;
+	UINT32 port;
+	char* username;
+	char* password;
+	char* domain;
+	char* security;
+	UINT32 width;
+	UINT32 height;
+	UINT32 codec;
+	UINT32 sessions;
+	UINT32 threads;
+	UINT32 duration;
+	UINT32 ramp;
+	BOOL json;
+	char* output;
+	bfInputEvent* script;
+	UINT32 scriptLength;
+};
+typedef struct bf_config bfConfig;
+
+struct bf_session
+{
+	UINT32 index;
+	freerdp* instance;
+	const bfConfig* config;
+	BOOL active;
+	BOOL connected;
+	const char* error;
+
+	/* set when the session is first serviced, connecting others is not measured */
+	UINT64 connectedAt;
+	UINT64 disconnectedAt;
+	UINT64 frames;
+	UINT64 bytes;
+	UINT64 decodeTime;
+
+	UINT32 scriptIndex;
+	UINT64 nextInput;
+	UINT64 inputPending;
+	UINT64 latencyCount;
+	UINT64 latencySum;
+	UINT64 latencyMax;
+};
+typedef struct bf_session bfSession;
+
+struct bf_context
+{
+	rdpContext _p;
+
+	bfSession* session;
+};
+typedef struct bf_context bfContext;
+
+struct bf_worker
+{
+	HANDLE thread;
+	const bfConfig* config;
+	bfSession** sessions;
+	UINT32 count;
+};
+typedef struct bf_worker bfWorker;
+
+static COMMAND_LINE_ARGUMENT_A bench_args[] =
+{
+	{ "v", COMMAND_LINE_VALUE_REQUIRED, "<server>", NULL, NULL, -1, NULL, "Local server address (default: 127.0.0.1)" },
+	{ "port", COMMAND_LINE_VALUE_REQUIRED, "<number>", NULL, NULL, -1, NULL, "Server port (default: 3389)" },
+	{ "u", COMMAND_LINE_VALUE_REQUIRED, "<user>", NULL, NULL, -1, NULL, "Username" },
+	{ "p", COMMAND_LINE_VALUE_REQUIRED, "<password>", NULL, NULL, -1, NULL, "Password" },
+	{ "d", COMMAND_LINE_VALUE_REQUIRED, "<domain>", NULL, NULL, -1, NULL, "Domain" },
+	{ "sec", COMMAND_LINE_VALUE_REQUIRED, "<rdp|tls|nla>", NULL, NULL, -1, NULL, "Force specific protocol security" },
+	{ "size", COMMAND_LINE_VALUE_REQUIRED, "<width>x<height>", NULL, NULL, -1, NULL, "Session size (default: 1024x768)" },
+	{ "codec", COMMAND_LINE_VALUE_REQUIRED, "<none|rfx|gfx|avc420>", NULL, NULL, -1, NULL, "Codec to negotiate (default: gfx)" },
+	{ "sessions", COMMAND_LINE_VALUE_REQUIRED, "<count>", NULL, NULL, -1, NULL, "Number of concurrent sessions (default: 1)" },
+	{ "threads", COMMAND_LINE_VALUE_REQUIRED, "<count>", NULL, NULL, -1, NULL, "Number of threads running the sessions (default: 1)" },
+	{ "duration", COMMAND_LINE_VALUE_REQUIRED, "<seconds>", NULL, NULL, -1, NULL, "Measurement duration (default: 30)" },
+	{ "ramp", COMMAND_LINE_VALUE_REQUIRED, "<ms>", NULL, NULL, -1, NULL, "Delay between two connects of a thread" },
+	{ "input", COMMAND_LINE_VALUE_REQUIRED, "<file>", NULL, NULL, -1, NULL, "Input script replayed by every session" },
+	{ "format", COMMAND_LINE_VALUE_REQUIRED, "<csv|json>", NULL, NULL, -1, NULL, "Report format (default: csv)" },
+	{ "output", COMMAND_LINE_VALUE_REQUIRED, "<file>", NULL, NULL, -1, NULL, "Report file (default: stdout)" },
+	{ "help", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_HELP, NULL, NULL, NULL, -1, "?", "Print help" },
+	{ NULL, 0, NULL, NULL, NULL, -1, NULL, NULL }
+};
+
+/* GetSystemTimeAsFileTime only has a resolution of seconds outside of windows */
+static UINT64 bf_now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER count;
+	LARGE_INTEGER freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (UINT64)(count.QuadPart / freq.QuadPart * 1000000 +
+	                (count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart);
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (UINT64) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static BOOL bf_parse_uint32(const char* str, UINT32 min, UINT32 max, UINT32* value)
+{
+	unsigned long val;
+	char* end = NULL;
+	errno = 0;
+	val = strtoul(str, &end, 0);
+
+	if ((errno != 0) || (end == str) || (*end != '\0') || (val < min) || (val > max))
+		return FALSE;
+
+	*value = (UINT32) val;
+	return TRUE;
+}
+
+static BOOL bf_is_loopback_address(const struct sockaddr* addr)
+{
+	if (addr->sa_family == AF_INET)
+	{
+		const struct sockaddr_in* sin = (const struct sockaddr_in*) addr;
+		return (ntohl(sin->sin_addr.s_addr) >> 24) == 127;
+	}
+
+	if (addr->sa_family == AF_INET6)
+	{
+		const struct sockaddr_in6* sin6 = (const struct sockaddr_in6*) addr;
+		const BYTE* bytes = sin6->sin6_addr.s6_addr;
+		static const BYTE mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF };
+
+		if (IN6_IS_ADDR_LOOPBACK(&sin6->sin6_addr))
+			return TRUE;
+
+		return (memcmp(bytes, mapped, sizeof(mapped)) == 0) && (bytes[12] == 127);
+	}
+
+	return FALSE;
+}
+
+/**
+ * The load generator must not be pointed at somebody else's server: the host
+ * must be a loopback address, or a name resolving to loopback addresses only.
+ */
+static BOOL bf_is_local_host(const char* host)
+{
+	char name[256];
+	size_t length;
+	BOOL rc = TRUE;
+	struct addrinfo hints = { 0 };
+	struct addrinfo* result = NULL;
+	struct addrinfo* ai;
+
+	if (!host)
+		return FALSE;
+
+	length = strlen(host);
+
+	/* [::1] */
+	if ((length > 2) && (host[0] == '[') && (host[length - 1] == ']'))
+	{
+		host++;
+		length -= 2;
+	}
+
+	if ((length == 0) || (length >= sizeof(name)))
+		return FALSE;
+
+	CopyMemory(name, host, length);
+	name[length] = '\0';
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if ((getaddrinfo(name, NULL, &hints, &result) != 0) || !result)
+		return FALSE;
+
+	for (ai = result; ai; ai = ai->ai_next)
+	{
+		if (!ai->ai_addr || !bf_is_loopback_address(ai->ai_addr))
+			rc = FALSE;
+	}
+
+	freeaddrinfo(result);
+	return rc;
+}
+
+static BOOL bf_load_script(bfConfig* config, const char* filename)
+{
+	char line[256];
+	FILE* fp = fopen(filename, "r");
+	bfInputEvent* events = NULL;
+	UINT32 count = 0;
+	UINT32 lineNumber = 0;
+
+	if (!fp)
+	{
+		WLog_ERR(TAG, "failed to open input script %s", filename);
+		return FALSE;
+	}
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		int n;
+		char action[16];
+		unsigned long delay;
+		long a = 0;
+		long b = 0;
+		bfInputEvent* event;
+		bfInputEvent* tmp;
+		lineNumber++;
+		n = sscanf(line, " %lu %15s %li %li", &delay, action, &a, &b);
+
+		if ((n <= 0) || (line[strspn(line, " \t")] == '#'))
+			continue;
+
+		if (!(tmp = (bfInputEvent*) realloc(events, (count + 1) * sizeof(bfInputEvent))))
+			goto fail;
+
+		events = tmp;
+		event = &events[count];
+		ZeroMemory(event, sizeof(bfInputEvent));
+		event->delay = (UINT32) delay;
+
+		if ((strcmp(action, "move") == 0) && (n == 4))
+			event->type = BENCH_INPUT_MOVE;
+		else if ((strcmp(action, "click") == 0) && (n == 4))
+			event->type = BENCH_INPUT_CLICK;
+		else if ((strcmp(action, "key") == 0) && (n == 3))
+			event->type = BENCH_INPUT_KEY;
+		else
+		{
+			WLog_ERR(TAG, "%s:%"PRIu32": invalid input event", filename, lineNumber);
+			goto fail;
+		}
+
+		event->x = (UINT16) a;
+		event->y = (UINT16) b;
+		event->code = (UINT32) a;
+		count++;
+	}
+
+	fclose(fp);
+	config->script = events;
+	config->scriptLength = count;
+	return TRUE;
+fail:
+	fclose(fp);
+	free(events);
+	return FALSE;
+}
+
+static void bf_print_help(const char* name)
+{
+	COMMAND_LINE_ARGUMENT_A* arg = bench_args;
+	printf("Usage: %s [options]\n\n", name);
+
+	do
+	{
+		char str[64];
+
+		if (arg->Format)
+			sprintf_s(str, sizeof(str), "%s:%s", arg->Name, arg->Format);
+		else
+			sprintf_s(str, sizeof(str), "%s", arg->Name);
+
+		printf("    /%-28s %s\n", str, arg->Text);
+	}
+	while ((arg = CommandLineFindNextArgumentA(arg)) != NULL);
+}
+
+static int bf_parse_command_line(bfConfig* config, int argc, char** argv)
+{
+	int status;
+	DWORD flags;
+	COMMAND_LINE_ARGUMENT_A* arg;
+	CommandLineClearArgumentsA(bench_args);
+	flags = COMMAND_LINE_SEPARATOR_COLON | COMMAND_LINE_SIGIL_SLASH;
+	status = CommandLineParseArgumentsA(argc, (const char**) argv, bench_args, flags, config, NULL,
+	                                    NULL);
+
+	if (status < 0)
+	{
+		bf_print_help(argv[0]);
+		return status;
+	}
+
+	arg = bench_args;
+
+	do
+	{
+		BOOL rc = TRUE;
+
+		if (!(arg->Flags & COMMAND_LINE_ARGUMENT_PRESENT))
+			continue;
+
+		CommandLineSwitchStart(arg)
+		CommandLineSwitchCase(arg, "v")
+		{
+			free(config->host);
+			rc = (config->host = _strdup(arg->Value)) != NULL;
+		}
+		CommandLineSwitchCase(arg, "port")
+		{
+			rc = bf_parse_uint32(arg->Value, 1, UINT16_MAX, &config->port);
+		}
+		CommandLineSwitchCase(arg, "u")
+		{
+			rc = (config->username = _strdup(arg->Value)) != NULL;
+		}
+		CommandLineSwitchCase(arg, "p")
+		{
+			rc = (config->password = _strdup(arg->Value)) != NULL;
+		}
+		CommandLineSwitchCase(arg, "d")
+		{
+			rc = (config->domain = _strdup(arg->Value)) != NULL;
+		}
+		CommandLineSwitchCase(arg, "sec")
+		{
+			rc = (strcmp(arg->Value, "rdp") == 0) || (strcmp(arg->Value, "tls") == 0) ||
+			     (strcmp(arg->Value, "nla") == 0);
+
+			if (rc)
+				rc = (config->security = _strdup(arg->Value)) != NULL;
+		}
+		CommandLineSwitchCase(arg, "size")
+		{
+			unsigned long w, h;
+			rc = (sscanf(arg->Value, "%lux%lu", &w, &h) == 2) && (w >= 64) && (h >= 64) &&
+			     (w <= 8192) && (h <= 8192);
+			config->width = (UINT32) w;
+			config->height = (UINT32) h;
+		}
+		CommandLineSwitchCase(arg, "codec")
+		{
+			if (strcmp(arg->Value, "none") == 0)
+				config->codec = BENCH_CODEC_NONE;
+			else if (strcmp(arg->Value, "rfx") == 0)
+				config->codec = BENCH_CODEC_RFX;
+			else if (strcmp(arg->Value, "gfx") == 0)
+				config->codec = BENCH_CODEC_GFX;
+			else if (strcmp(arg->Value, "avc420") == 0)
+				config->codec = BENCH_CODEC_AVC420;
+			else
+				rc = FALSE;
+		}
+		CommandLineSwitchCase(arg, "sessions")
+		{
+			rc = bf_parse_uint32(arg->Value, 1, 4096, &config->sessions);
+		}
+		CommandLineSwitchCase(arg, "threads")
+		{
+			rc = bf_parse_uint32(arg->Value, 1, 256, &config->threads);
+		}
+		CommandLineSwitchCase(arg, "duration")
+		{
+			rc = bf_parse_uint32(arg->Value, 1, 86400, &config->duration);
+		}
+		CommandLineSwitchCase(arg, "ramp")
+		{
+			rc = bf_parse_uint32(arg->Value, 0, 60000, &config->ramp);
+		}
+		CommandLineSwitchCase(arg, "input")
+		{
+			rc = bf_load_script(config, arg->Value);
+		}
+		CommandLineSwitchCase(arg, "format")
+		{
+			rc = (strcmp(arg->Value, "csv") == 0) || (strcmp(arg->Value, "json") == 0);
+			config->json = (strcmp(arg->Value, "json") == 0);
+		}
+		CommandLineSwitchCase(arg, "output")
+		{
+			rc = (config->output = _strdup(arg->Value)) != NULL;
+		}
+		CommandLineSwitchEnd(arg)
+
+		if (!rc)
+		{
+			WLog_ERR(TAG, "invalid value for /%s: %s", arg->Name, arg->Value);
+			return -1;
+		}
+	}
+	while ((arg = CommandLineFindNextArgumentA(arg)) != NULL);
+
+	if (!bf_is_local_host(config->host))
+	{
+		WLog_ERR(TAG, "%s is not a loopback address, refusing to generate load against it",
+		         config->host);
+		return -1;
+	}
+
+	if (config->threads > config->sessions)
+		config->threads = config->sessions;
+
+	return 1;
+}
+
+static void bf_OnChannelConnectedEventHandler(rdpContext* context, ChannelConnectedEventArgs* e)
+{
+	if (strcmp(e->name, RDPGFX_DVC_CHANNEL_NAME) == 0)
+		gdi_graphics_pipeline_init(context->gdi, (RdpgfxClientContext*) e->pInterface);
+}
+
+static void bf_OnChannelDisconnectedEventHandler(rdpContext* context,
+        ChannelDisconnectedEventArgs* e)
+{
+	if (strcmp(e->name, RDPGFX_DVC_CHANNEL_NAME) == 0)
+		gdi_graphics_pipeline_uninit(context->gdi, (RdpgfxClientContext*) e->pInterface);
+}
+
+static BOOL bf_begin_paint(rdpContext* context)
+{
+	rdpGdi* gdi = context->gdi;
+	gdi->primary->hdc->hwnd->invalid->null = TRUE;
+	gdi->primary->hdc->hwnd->ninvalid = 0;
+	return TRUE;
+}
+
+static BOOL bf_end_paint(rdpContext* context)
+{
+	bfSession* session = ((bfContext*) context)->session;
+	rdpGdi* gdi = context->gdi;
+
+	/* updates without any drawing (pointer, palette, ...) are not frames */
+	if (gdi->primary->hdc->hwnd->invalid->null)
+		return TRUE;
+
+	session->frames++;
+
+	if (session->inputPending)
+	{
+		const UINT64 latency = bf_now() - session->inputPending;
+		session->latencyCount++;
+		session->latencySum += latency;
+
+		if (latency > session->latencyMax)
+			session->latencyMax = latency;
+
+		session->inputPending = 0;
+	}
+
+	return TRUE;
+}
+
+static BOOL bf_pre_connect(freerdp* instance)
+{
+	rdpContext* context = instance->context;
+	PubSub_SubscribeChannelConnected(context->pubSub,
+	                                 (pChannelConnectedEventHandler) bf_OnChannelConnectedEventHandler);
+	PubSub_SubscribeChannelDisconnected(context->pubSub,
+	                                    (pChannelDisconnectedEventHandler) bf_OnChannelDisconnectedEventHandler);
+	return freerdp_client_load_addins(context->channels, instance->settings);
+}
+
+static BOOL bf_post_connect(freerdp* instance)
+{
+	if (!gdi_init(instance, PIXEL_FORMAT_BGRX32))
+		return FALSE;
+
+	instance->update->BeginPaint = bf_begin_paint;
+	instance->update->EndPaint = bf_end_paint;
+	return TRUE;
+}
+
+static BOOL bf_session_apply_settings(bfSession* session)
+{
+	const bfConfig* config = session->config;
+	rdpSettings* settings = session->instance->settings;
+
+	if (!(settings->ServerHostname = _strdup(config->host)))
+		return FALSE;
+
+	settings->ServerPort = config->port;
+	settings->IgnoreCertificate = TRUE;
+	settings->DesktopWidth = config->width;
+	settings->DesktopHeight = config->height;
+	settings->ColorDepth = 32;
+	settings->SoftwareGdi = TRUE;
+
+	if (config->username && !(settings->Username = _strdup(config->username)))
+		return FALSE;
+
+	if (config->password && !(settings->Password = _strdup(config->password)))
+		return FALSE;
+
+	if (config->domain && !(settings->Domain = _strdup(config->domain)))
+		return FALSE;
+
+	if (config->security)
+	{
+		settings->RdpSecurity = (strcmp(config->security, "rdp") == 0);
+		settings->TlsSecurity = (strcmp(config->security, "tls") == 0);
+		settings->NlaSecurity = (strcmp(config->security, "nla") == 0);
+		settings->ExtSecurity = FALSE;
+	}
+
+	settings->RemoteFxCodec = (config->codec == BENCH_CODEC_RFX);
+	settings->NSCodec = FALSE;
+	settings->SupportGraphicsPipeline = (config->codec == BENCH_CODEC_GFX) ||
+	                                    (config->codec == BENCH_CODEC_AVC420);
+	settings->GfxH264 = (config->codec == BENCH_CODEC_AVC420);
+	settings->GfxAVC444 = FALSE;
+
+	if (settings->RemoteFxCodec || settings->SupportGraphicsPipeline)
+		settings->FastPathOutput = TRUE;
+
+	return TRUE;
+}
+
+static bfSession* bf_session_new(const bfConfig* config, UINT32 index)
+{
+	bfSession* session = (bfSession*) calloc(1, sizeof(bfSession));
+
+	if (!session)
+		return NULL;
+
+	session->index = index;
+	session->config = config;
+
+	if (!(session->instance = freerdp_new()))
+		goto fail;
+
+	session->instance->PreConnect = bf_pre_connect;
+	session->instance->PostConnect = bf_post_connect;
+	session->instance->ContextSize = sizeof(bfContext);
+
+	if (!freerdp_context_new(session->instance))
+	{
+		freerdp_free(session->instance);
+		goto fail;
+	}
+
+	((bfContext*) session->instance->context)->session = session;
+
+	if (!bf_session_apply_settings(session))
+	{
+		freerdp_context_free(session->instance);
+		freerdp_free(session->instance);
+		goto fail;
+	}
+
+	return session;
+fail:
+	free(session);
+	return NULL;
+}
+
+static void bf_session_free(bfSession* session)
+{
+	if (!session)
+		return;
+
+	freerdp_context_free(session->instance);
+	freerdp_free(session->instance);
+	free(session);
+}
+
+static void bf_session_stop(bfSession* session, const char* error)
+{
+	if (!session->active)
+		return;
+
+	session->active = FALSE;
+	session->error = error;
+	session->disconnectedAt = bf_now();
+}
+
+static BOOL bf_session_send_input(bfSession* session, UINT64 now)
+{
+	BOOL rc = TRUE;
+	const bfConfig* config = session->config;
+	rdpInput* input = session->instance->input;
+	const bfInputEvent* event;
+
+	while (session->nextInput <= now)
+	{
+		event = &config->script[session->scriptIndex];
+
+		switch (event->type)
+		{
+			case BENCH_INPUT_MOVE:
+				rc = freerdp_input_send_mouse_event(input, PTR_FLAGS_MOVE, event->x, event->y);
+				break;
+
+			case BENCH_INPUT_CLICK:
+				rc = freerdp_input_send_mouse_event(input, PTR_FLAGS_DOWN | PTR_FLAGS_BUTTON1,
+				                                    event->x, event->y) &&
+				     freerdp_input_send_mouse_event(input, PTR_FLAGS_BUTTON1, event->x, event->y);
+				break;
+
+			case BENCH_INPUT_KEY:
+				rc = freerdp_input_send_keyboard_event_ex(input, TRUE, event->code) &&
+				     freerdp_input_send_keyboard_event_ex(input, FALSE, event->code);
+				break;
+		}
+
+		if (!rc)
+			return FALSE;
+
+		/* the oldest unanswered input defines the latency */
+		if (!session->inputPending)
+			session->inputPending = bf_now();
+
+		session->scriptIndex = (session->scriptIndex + 1) % config->scriptLength;
+		session->nextInput += config->script[session->scriptIndex].delay * 1000ULL;
+
+		/* a script without any delay must not starve the event loop */
+		if (session->scriptIndex == 0)
+			session->nextInput = MAX(session->nextInput, now + 1000);
+	}
+
+	return TRUE;
+}
+
+static DWORD WINAPI bf_worker_thread(LPVOID arg)
+{
+	UINT32 index;
+	UINT32 active = 0;
+	UINT64 deadline;
+	bfWorker* worker = (bfWorker*) arg;
+	const bfConfig* config = worker->config;
+
+	for (index = 0; index < worker->count; index++)
+	{
+		bfSession* session = worker->sessions[index];
+
+		if ((index > 0) && config->ramp)
+			Sleep(config->ramp);
+
+		if (!freerdp_connect(session->instance))
+		{
+			session->error = "connect";
+			WLog_ERR(TAG, "session %"PRIu32": connection failure", session->index);
+			continue;
+		}
+
+		session->active = TRUE;
+		session->connected = TRUE;
+		active++;
+	}
+
+	deadline = bf_now() + config->duration * 1000000ULL;
+
+	while (active > 0)
+	{
+		DWORD nCount = 0;
+		DWORD timeout = 10;
+		HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+		UINT64 now = bf_now();
+
+		if (now >= deadline)
+			break;
+
+		for (index = 0; index < worker->count; index++)
+		{
+			DWORD count;
+			bfSession* session = worker->sessions[index];
+
+			if (!session->active)
+				continue;
+
+			if (config->scriptLength && (session->nextInput <= now + timeout * 1000ULL))
+				timeout = (session->nextInput > now) ? (DWORD)((session->nextInput - now) / 1000) : 0;
+
+			/* sessions beyond the wait limit are still serviced every timeout */
+			if (nCount >= MAXIMUM_WAIT_OBJECTS)
+				continue;
+
+			count = freerdp_get_event_handles(session->instance->context, &handles[nCount],
+			                                  MAXIMUM_WAIT_OBJECTS - nCount);
+
+			if (count == 0)
+			{
+				WLog_ERR(TAG, "session %"PRIu32": failed to get event handles", session->index);
+				bf_session_stop(session, "transport");
+				active--;
+				continue;
+			}
+
+			nCount += count;
+		}
+
+		if (nCount > 0)
+		{
+			if (WaitForMultipleObjects(nCount, handles, FALSE, timeout) == WAIT_FAILED)
+			{
+				WLog_ERR(TAG, "WaitForMultipleObjects failed with %"PRIu32"", GetLastError());
+				break;
+			}
+		}
+		else
+			Sleep(timeout);
+
+		for (index = 0; index < worker->count; index++)
+		{
+			UINT64 start;
+			BOOL rc;
+			bfSession* session = worker->sessions[index];
+
+			if (!session->active)
+				continue;
+
+			/* the connection sequence and the wait for other sessions are not measured */
+			if (!session->connectedAt)
+			{
+				session->connectedAt = bf_now();
+				session->nextInput = session->connectedAt;
+
+				if (config->scriptLength)
+					session->nextInput += config->script[0].delay * 1000ULL;
+
+				freerdp_get_transport_received(session->instance->context, TRUE);
+			}
+
+			if (config->scriptLength && !bf_session_send_input(session, bf_now()))
+			{
+				bf_session_stop(session, "input");
+				active--;
+				continue;
+			}
+
+			start = bf_now();
+			rc = freerdp_check_event_handles(session->instance->context);
+			session->decodeTime += bf_now() - start;
+			session->bytes += freerdp_get_transport_received(session->instance->context, TRUE);
+
+			if (!rc || freerdp_shall_disconnect(session->instance))
+			{
+				bf_session_stop(session, rc ? "disconnected" : "transport");
+				active--;
+			}
+		}
+	}
+
+	for (index = 0; index < worker->count; index++)
+	{
+		bfSession* session = worker->sessions[index];
+
+		if (session->active)
+			bf_session_stop(session, NULL);
+
+		if (session->connected)
+			freerdp_disconnect(session->instance);
+	}
+
+	ExitThread(0);
+	return 0;
+}
+
+static const char* bf_codec_name(UINT32 codec)
+{
+	switch (codec)
+	{
+		case BENCH_CODEC_RFX:
+			return "rfx";
+
+		case BENCH_CODEC_GFX:
+			return "gfx";
+
+		case BENCH_CODEC_AVC420:
+			return "avc420";
+
+		default:
+			return "none";
+	}
+}
+
+static void bf_write_report(FILE* fp, const bfConfig* config, bfSession** sessions)
+{
+	UINT32 index;
+	UINT64 totalFrames = 0;
+	UINT64 totalBytes = 0;
+	UINT32 connected = 0;
+
+	if (config->json)
+		fprintf(fp, "[\n");
+	else
+		fprintf(fp, "session,codec,connected,seconds,frames,fps,bytes,kbps,decode_ms,"
+		        "decode_ms_per_frame,input_samples,latency_ms_avg,latency_ms_max,error\n");
+
+	for (index = 0; index < config->sessions; index++)
+	{
+		const bfSession* session = sessions[index];
+		const UINT64 elapsed = session->connectedAt ?
+		                       session->disconnectedAt - session->connectedAt : 0;
+		const double seconds = elapsed / 1000000.0;
+		const double fps = seconds > 0.0 ? session->frames / seconds : 0.0;
+		const double kbps = seconds > 0.0 ? session->bytes * 8.0 / 1000.0 / seconds : 0.0;
+		const double decode = session->decodeTime / 1000.0;
+		const double decodePerFrame = session->frames ? decode / session->frames : 0.0;
+		const double latencyAvg = session->latencyCount ?
+		                          session->latencySum / 1000.0 / session->latencyCount : 0.0;
+		const double latencyMax = session->latencyMax / 1000.0;
+		const char* error = session->error ? session->error : "";
+
+		if (session->connected)
+			connected++;
+
+		totalFrames += session->frames;
+		totalBytes += session->bytes;
+
+		if (config->json)
+			fprintf(fp, "  { \"session\": %"PRIu32", \"codec\": \"%s\", \"connected\": %s, "
+			        "\"seconds\": %.3f, \"frames\": %"PRIu64", \"fps\": %.2f, \"bytes\": %"PRIu64", "
+			        "\"kbps\": %.1f, \"decode_ms\": %.3f, \"decode_ms_per_frame\": %.3f, "
+			        "\"input_samples\": %"PRIu64", \"latency_ms_avg\": %.3f, \"latency_ms_max\": %.3f, "
+			        "\"error\": \"%s\" }%s\n",
+			        session->index, bf_codec_name(config->codec),
+			        session->connected ? "true" : "false", seconds, session->frames, fps,
+			        session->bytes, kbps, decode, decodePerFrame, session->latencyCount, latencyAvg,
+			        latencyMax, error, (index + 1 < config->sessions) ? "," : "");
+		else
+			fprintf(fp, "%"PRIu32",%s,%d,%.3f,%"PRIu64",%.2f,%"PRIu64",%.1f,%.3f,%.3f,%"PRIu64
+			        ",%.3f,%.3f,%s\n",
+			        session->index, bf_codec_name(config->codec), session->connected ? 1 : 0,
+			        seconds, session->frames, fps, session->bytes, kbps, decode, decodePerFrame,
+			        session->latencyCount, latencyAvg, latencyMax, error);
+	}
+
+	if (config->json)
+		fprintf(fp, "]\n");
+
+	WLog_INFO(TAG, "%"PRIu32"/%"PRIu32" sessions connected, %"PRIu64" frames, %"PRIu64" bytes",
+	          connected, config->sessions, totalFrames, totalBytes);
+}
+
+int main(int argc, char* argv[])
+{
+	int rc = 1;
+	int status;
+	UINT32 index;
+	FILE* fp = stdout;
+	bfConfig config;
+	bfSession** sessions = NULL;
+	bfWorker* workers = NULL;
+	ZeroMemory(&config, sizeof(config));
+	config.host = _strdup("127.0.0.1");
+	config.port = 3389;
+	config.width = 1024;
+	config.height = 768;
+	config.codec = BENCH_CODEC_GFX;
+	config.sessions = 1;
+	config.threads = 1;
+	config.duration = 30;
+
+	if (!config.host)
+		goto fail;
+
+	status = bf_parse_command_line(&config, argc, argv);
+
+	if (status != 1)
+	{
+		rc = (status == COMMAND_LINE_STATUS_PRINT_HELP) ? 0 : 1;
+		goto fail;
+	}
+
+	freerdp_register_addin_provider(freerdp_channels_load_static_addin_entry, 0);
+	sessions = (bfSession**) calloc(config.sessions, sizeof(bfSession*));
+	workers = (bfWorker*) calloc(config.threads, sizeof(bfWorker));
+
+	if (!sessions || !workers)
+		goto fail;
+
+	for (index = 0; index < config.sessions; index++)
+	{
+		if (!(sessions[index] = bf_session_new(&config, index)))
+		{
+			WLog_ERR(TAG, "failed to create session %"PRIu32"", index);
+			goto fail;
+		}
+	}
+
+	/* sessions are dealt round robin, so every thread ramps up at the same pace */
+	for (index = 0; index < config.threads; index++)
+	{
+		UINT32 i;
+		bfWorker* worker = &workers[index];
+		worker->config = &config;
+
+		if (!(worker->sessions = (bfSession**) calloc(config.sessions / config.threads + 1,
+		                         sizeof(bfSession*))))
+			goto fail;
+
+		for (i = index; i < config.sessions; i += config.threads)
+			worker->sessions[worker->count++] = sessions[i];
+	}
+
+	for (index = 0; index < config.threads; index++)
+	{
+		if (!(workers[index].thread = CreateThread(NULL, 0, bf_worker_thread, &workers[index], 0,
+		                              NULL)))
+		{
+			WLog_ERR(TAG, "failed to create worker thread");
+			break;
+		}
+	}
+
+	for (index = 0; index < config.threads; index++)
+	{
+		if (workers[index].thread)
+			WaitForSingleObject(workers[index].thread, INFINITE);
+	}
+
+	if (config.output && !(fp = fopen(config.output, "w")))
+	{
+		WLog_ERR(TAG, "failed to open %s", config.output);
+		goto fail;
+	}
+
+	bf_write_report(fp, &config, sessions);
+
+	if (fp != stdout)
+		fclose(fp);
+
+	rc = 0;
+fail:
+
+	if (workers)
+	{
+		for (index = 0; index < config.threads; index++)
+		{
+			if (workers[index].thread)
+				CloseHandle(workers[index].thread);
+
+			free(workers[index].sessions);
+		}
+	}
+
+	if (sessions)
+	{
+		for (index = 0; index < config.sessions; index++)
+			bf_session_free(sessions[index]);
+	}
+
+	free(workers);
+	free(sessions);
+	free(config.host);
+	free(config.username);
+	free(config.password);
+	free(config.domain);
+	free(config.security);
+	free(config.output);
+	free(config.script);
+	return rc;
+}
@@ -0,0 +1,424 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Offline Session Replay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/client.h>
+#include <freerdp/constants.h>
+#include <freerdp/gdi/gdi.h>
+#include <freerdp/gdi/gfx.h>
+#include <freerdp/client/rdpgfx.h>
+#include <freerdp/client/cmdline.h>
+#include <freerdp/client/channels.h>
+#include <freerdp/channels/channels.h>
+#include <freerdp/log.h>
+
+#define TAG CLIENT_TAG("replay")
+
+/**
+ * Replays a session recorded with /record-session through the complete
+ * client pipeline and the software gdi, without a server, and reports
+ * where the decoding time goes:
+ *
+ * bfreerdp-replay /play-session:session.rec [client options]
+ *
+ * Without /play-session it connects to /v like any client, which together
+ * with /record-session produces a recording with the same channel set.
+ *
+ * The client options must enable the same static and dynamic channels as
+ * the recorded client, so that the channel ids of the recording match.
+ *
+ * The recording is always replayed as fast as it decodes: pacing it at the
+ * original speed sleeps in the transport read and would count as dispatch.
+ */
+
+enum br_stage
+{
+	BR_STAGE_DISPATCH,
+	BR_STAGE_BITMAP,
+	BR_STAGE_SURFACE_BITS,
+	BR_STAGE_DSTBLT,
+	BR_STAGE_PATBLT,
+	BR_STAGE_SCRBLT,
+	BR_STAGE_OPAQUE_RECT,
+	BR_STAGE_MULTI_OPAQUE_RECT,
+	BR_STAGE_MEMBLT,
+	BR_STAGE_GLYPH_INDEX,
+	BR_STAGE_CACHE_BITMAP_V2,
+	BR_STAGE_CACHE_BITMAP_V3,
+	BR_STAGE_CACHE_GLYPH,
+	BR_STAGE_GFX_SURFACE_COMMAND,
+	BR_STAGE_GFX_SOLID_FILL,
+	BR_STAGE_GFX_SURFACE_TO_SURFACE,
+	BR_STAGE_GFX_SURFACE_TO_CACHE,
+	BR_STAGE_GFX_CACHE_TO_SURFACE,
+	BR_STAGE_GFX_END_FRAME,
+	BR_STAGE_COUNT
+};
+
+static const char* const br_stage_names[BR_STAGE_COUNT] =
+{
+	"dispatch",
+	"BitmapUpdate",
+	"SurfaceBits",
+	"DstBlt",
+	"PatBlt",
+	"ScrBlt",
+	"OpaqueRect",
+	"MultiOpaqueRect",
+	"MemBlt",
+	"GlyphIndex",
+	"CacheBitmapV2",
+	"CacheBitmapV3",
+	"CacheGlyph",
+	"GfxSurfaceCommand",
+	"GfxSolidFill",
+	"GfxSurfaceToSurface",
+	"GfxSurfaceToCache",
+	"GfxCacheToSurface",
+	"GfxEndFrame"
+};
+
+struct br_stage_stats
+{
+	UINT64 calls;
+	UINT64 total;
+	UINT64 max;
+};
+typedef struct br_stage_stats brStageStats;
+
+struct br_context
+{
+	rdpContext context;
+
+	brStageStats stages[BR_STAGE_COUNT];
+	UINT64 frames;
+
+	pBitmapUpdate BitmapUpdate;
+	pSurfaceBits SurfaceBits;
+	pDstBlt DstBlt;
+	pPatBlt PatBlt;
+	pScrBlt ScrBlt;
+	pOpaqueRect OpaqueRect;
+	pMultiOpaqueRect MultiOpaqueRect;
+	pMemBlt MemBlt;
+	pGlyphIndex GlyphIndex;
+	pCacheBitmapV2 CacheBitmapV2;
+	pCacheBitmapV3 CacheBitmapV3;
+	pCacheGlyph CacheGlyph;
+
+	pcRdpgfxSurfaceCommand SurfaceCommand;
+	pcRdpgfxSolidFill SolidFill;
+	pcRdpgfxSurfaceToSurface SurfaceToSurface;
+	pcRdpgfxSurfaceToCache SurfaceToCache;
+	pcRdpgfxCacheToSurface CacheToSurface;
+	pcRdpgfxEndFrame EndFrame;
+};
+typedef struct br_context brContext;
+
+/* GetSystemTimeAsFileTime only has a resolution of seconds outside of windows */
+static UINT64 br_now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER count;
+	LARGE_INTEGER freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (UINT64)(count.QuadPart / freq.QuadPart * 1000000 +
+	                (count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart);
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (UINT64) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static void br_stage_add(brStageStats* stage, UINT64 start)
+{
+	const UINT64 elapsed = br_now() - start;
+	stage->calls++;
+	stage->total += elapsed;
+
+	if (elapsed > stage->max)
+		stage->max = elapsed;
+}
+
+/* every wrapper times the gdi callback it replaces */
+#define BR_UPDATE_WRAPPER(_name, _stage, _type) \
+	static BOOL br_##_name(rdpContext* context, _type arg) \
+	{ \
+		BOOL rc; \
+		brContext* br = (brContext*) context; \
+		const UINT64 start = br_now(); \
+		rc = br->_name(context, arg); \
+		br_stage_add(&br->stages[_stage], start); \
+		return rc; \
+	}
+
+#define BR_GFX_WRAPPER(_name, _stage, _type) \
+	static UINT br_gfx_##_name(RdpgfxClientContext* context, _type arg) \
+	{ \
+		UINT rc; \
+		brContext* br = (brContext*) ((rdpGdi*) context->custom)->context; \
+		const UINT64 start = br_now(); \
+		rc = br->_name(context, arg); \
+		br_stage_add(&br->stages[_stage], start); \
+		return rc; \
+	}
+
+BR_UPDATE_WRAPPER(BitmapUpdate, BR_STAGE_BITMAP, const BITMAP_UPDATE*)
+BR_UPDATE_WRAPPER(SurfaceBits, BR_STAGE_SURFACE_BITS, const SURFACE_BITS_COMMAND*)
+BR_UPDATE_WRAPPER(DstBlt, BR_STAGE_DSTBLT, const DSTBLT_ORDER*)
+BR_UPDATE_WRAPPER(PatBlt, BR_STAGE_PATBLT, PATBLT_ORDER*)
+BR_UPDATE_WRAPPER(ScrBlt, BR_STAGE_SCRBLT, const SCRBLT_ORDER*)
+BR_UPDATE_WRAPPER(OpaqueRect, BR_STAGE_OPAQUE_RECT, const OPAQUE_RECT_ORDER*)
+BR_UPDATE_WRAPPER(MultiOpaqueRect, BR_STAGE_MULTI_OPAQUE_RECT, const MULTI_OPAQUE_RECT_ORDER*)
+BR_UPDATE_WRAPPER(MemBlt, BR_STAGE_MEMBLT, MEMBLT_ORDER*)
+BR_UPDATE_WRAPPER(GlyphIndex, BR_STAGE_GLYPH_INDEX, GLYPH_INDEX_ORDER*)
+BR_UPDATE_WRAPPER(CacheBitmapV2, BR_STAGE_CACHE_BITMAP_V2, CACHE_BITMAP_V2_ORDER*)
+BR_UPDATE_WRAPPER(CacheBitmapV3, BR_STAGE_CACHE_BITMAP_V3, CACHE_BITMAP_V3_ORDER*)
+BR_UPDATE_WRAPPER(CacheGlyph, BR_STAGE_CACHE_GLYPH, const CACHE_GLYPH_ORDER*)
+
+BR_GFX_WRAPPER(SurfaceCommand, BR_STAGE_GFX_SURFACE_COMMAND, const RDPGFX_SURFACE_COMMAND*)
+BR_GFX_WRAPPER(SolidFill, BR_STAGE_GFX_SOLID_FILL, const RDPGFX_SOLID_FILL_PDU*)
+BR_GFX_WRAPPER(SurfaceToSurface, BR_STAGE_GFX_SURFACE_TO_SURFACE,
+               const RDPGFX_SURFACE_TO_SURFACE_PDU*)
+BR_GFX_WRAPPER(SurfaceToCache, BR_STAGE_GFX_SURFACE_TO_CACHE, const RDPGFX_SURFACE_TO_CACHE_PDU*)
+BR_GFX_WRAPPER(CacheToSurface, BR_STAGE_GFX_CACHE_TO_SURFACE, const RDPGFX_CACHE_TO_SURFACE_PDU*)
+BR_GFX_WRAPPER(EndFrame, BR_STAGE_GFX_END_FRAME, const RDPGFX_END_FRAME_PDU*)
+
+static void br_OnChannelConnectedEventHandler(rdpContext* context, ChannelConnectedEventArgs* e)
+{
+	brContext* br = (brContext*) context;
+	RdpgfxClientContext* gfx;
+
+	if (strcmp(e->name, RDPGFX_DVC_CHANNEL_NAME) != 0)
+		return;
+
+	gfx = (RdpgfxClientContext*) e->pInterface;
+	gdi_graphics_pipeline_init(context->gdi, gfx);
+	br->SurfaceCommand = gfx->SurfaceCommand;
+	gfx->SurfaceCommand = br_gfx_SurfaceCommand;
+	br->SolidFill = gfx->SolidFill;
+	gfx->SolidFill = br_gfx_SolidFill;
+	br->SurfaceToSurface = gfx->SurfaceToSurface;
+	gfx->SurfaceToSurface = br_gfx_SurfaceToSurface;
+	br->SurfaceToCache = gfx->SurfaceToCache;
+	gfx->SurfaceToCache = br_gfx_SurfaceToCache;
+	br->CacheToSurface = gfx->CacheToSurface;
+	gfx->CacheToSurface = br_gfx_CacheToSurface;
+	br->EndFrame = gfx->EndFrame;
+	gfx->EndFrame = br_gfx_EndFrame;
+}
+
+static void br_OnChannelDisconnectedEventHandler(rdpContext* context,
+        ChannelDisconnectedEventArgs* e)
+{
+	if (strcmp(e->name, RDPGFX_DVC_CHANNEL_NAME) == 0)
+		gdi_graphics_pipeline_uninit(context->gdi, (RdpgfxClientContext*) e->pInterface);
+}
+
+static BOOL br_begin_paint(rdpContext* context)
+{
+	rdpGdi* gdi = context->gdi;
+	gdi->primary->hdc->hwnd->invalid->null = TRUE;
+	gdi->primary->hdc->hwnd->ninvalid = 0;
+	return TRUE;
+}
+
+static BOOL br_end_paint(rdpContext* context)
+{
+	rdpGdi* gdi = context->gdi;
+
+	if (!gdi->primary->hdc->hwnd->invalid->null)
+		((brContext*) context)->frames++;
+
+	return TRUE;
+}
+
+static BOOL br_pre_connect(freerdp* instance)
+{
+	rdpContext* context = instance->context;
+	PubSub_SubscribeChannelConnected(context->pubSub,
+	                                 (pChannelConnectedEventHandler) br_OnChannelConnectedEventHandler);
+	PubSub_SubscribeChannelDisconnected(context->pubSub,
+	                                    (pChannelDisconnectedEventHandler) br_OnChannelDisconnectedEventHandler);
+	return freerdp_client_load_addins(context->channels, instance->settings);
+}
+
+static BOOL br_post_connect(freerdp* instance)
+{
+	brContext* br = (brContext*) instance->context;
+	rdpUpdate* update = instance->update;
+	rdpPrimaryUpdate* primary = update->primary;
+	rdpSecondaryUpdate* secondary = update->secondary;
+
+	if (!gdi_init(instance, PIXEL_FORMAT_BGRX32))
+		return FALSE;
+
+	update->BeginPaint = br_begin_paint;
+	update->EndPaint = br_end_paint;
+	br->BitmapUpdate = update->BitmapUpdate;
+	update->BitmapUpdate = br_BitmapUpdate;
+	br->SurfaceBits = update->SurfaceBits;
+	update->SurfaceBits = br_SurfaceBits;
+	br->DstBlt = primary->DstBlt;
+	primary->DstBlt = br_DstBlt;
+	br->PatBlt = primary->PatBlt;
+	primary->PatBlt = br_PatBlt;
+	br->ScrBlt = primary->ScrBlt;
+	primary->ScrBlt = br_ScrBlt;
+	br->OpaqueRect = primary->OpaqueRect;
+	primary->OpaqueRect = br_OpaqueRect;
+	br->MultiOpaqueRect = primary->MultiOpaqueRect;
+	primary->MultiOpaqueRect = br_MultiOpaqueRect;
+	br->MemBlt = primary->MemBlt;
+	primary->MemBlt = br_MemBlt;
+	br->GlyphIndex = primary->GlyphIndex;
+	primary->GlyphIndex = br_GlyphIndex;
+	br->CacheBitmapV2 = secondary->CacheBitmapV2;
+	secondary->CacheBitmapV2 = br_CacheBitmapV2;
+	br->CacheBitmapV3 = secondary->CacheBitmapV3;
+	secondary->CacheBitmapV3 = br_CacheBitmapV3;
+	br->CacheGlyph = secondary->CacheGlyph;
+	secondary->CacheGlyph = br_CacheGlyph;
+	return TRUE;
+}
+
+static void br_write_report(FILE* fp, brContext* br, UINT64 elapsed)
+{
+	int index;
+	const UINT64 bytes = freerdp_get_transport_received(&br->context, FALSE);
+	fprintf(fp, "%-20s %10s %12s %10s %10s\n", "stage", "calls", "total_ms", "avg_us", "max_us");
+
+	for (index = 0; index < BR_STAGE_COUNT; index++)
+	{
+		const brStageStats* stage = &br->stages[index];
+
+		if (!stage->calls)
+			continue;
+
+		fprintf(fp, "%-20s %10"PRIu64" %12.3f %10.1f %10"PRIu64"\n", br_stage_names[index],
+		        stage->calls, stage->total / 1000.0, (double) stage->total / stage->calls, stage->max);
+	}
+
+	fprintf(fp, "replayed %"PRIu64" bytes, %"PRIu64" frames in %.3f ms (%.1f frames/s)\n",
+	        bytes, br->frames, elapsed / 1000.0,
+	        elapsed ? br->frames * 1000000.0 / elapsed : 0.0);
+}
+
+int main(int argc, char* argv[])
+{
+	int rc = 1;
+	int status;
+	UINT64 start;
+	freerdp* instance;
+	brContext* br;
+
+	if (!(instance = freerdp_new()))
+		return 1;
+
+	instance->PreConnect = br_pre_connect;
+	instance->PostConnect = br_post_connect;
+	instance->ContextSize = sizeof(brContext);
+	freerdp_register_addin_provider(freerdp_channels_load_static_addin_entry, 0);
+
+	if (!freerdp_context_new(instance))
+	{
+		freerdp_free(instance);
+		return 1;
+	}
+
+	br = (brContext*) instance->context;
+	status = freerdp_client_settings_parse_command_line(instance->settings, argc, argv, FALSE);
+
+	if (status != 0)
+	{
+		rc = freerdp_client_settings_command_line_status_print(instance->settings, status, argc,
+		        argv);
+		goto fail;
+	}
+
+	if (!instance->settings->PlaySession && !instance->settings->ServerHostname)
+	{
+		WLog_ERR(TAG, "no recording given, use /play-session:<file>");
+		goto fail;
+	}
+
+	/* the target is never contacted, it only names the session */
+	if (!instance->settings->ServerHostname &&
+	    !(instance->settings->ServerHostname = _strdup("replay")))
+		goto fail;
+
+	if (instance->settings->PlaySessionRealTime)
+	{
+		WLog_WARN(TAG, "ignoring +play-session-realtime, the replay is measured");
+		instance->settings->PlaySessionRealTime = FALSE;
+	}
+
+	instance->settings->SoftwareGdi = TRUE;
+	start = br_now();
+
+	if (!freerdp_connect(instance))
+	{
+		WLog_ERR(TAG, "failed to replay %s", instance->settings->PlaySessionFile);
+		goto fail;
+	}
+
+	/* the recording ends like a closed connection */
+	while (!freerdp_shall_disconnect(instance))
+	{
+		UINT64 dispatch;
+		DWORD count;
+		HANDLE handles[64];
+
+		if (!(count = freerdp_get_event_handles(instance->context, handles, ARRAYSIZE(handles))))
+			break;
+
+		if (WaitForMultipleObjects(count, handles, FALSE, 100) == WAIT_FAILED)
+			break;
+
+		dispatch = br_now();
+
+		if (!freerdp_check_event_handles(instance->context))
+			break;
+
+		br_stage_add(&br->stages[BR_STAGE_DISPATCH], dispatch);
+	}
+
+	br_write_report(stdout, br, br_now() - start);
+	freerdp_disconnect(instance);
+	rc = 0;
+fail:
+	freerdp_context_free(instance);
+	freerdp_free(instance);
+	return rc;
+}
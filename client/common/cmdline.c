@@ -93,6 +93,7 @@ static COMMAND_LINE_ARGUMENT_A args[] =
 	{ "app-guid", COMMAND_LINE_VALUE_REQUIRED, "<app guid>", NULL, NULL, -1, NULL, "Remote application GUID" },
 	{ "compression", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, "z", "Enable compression" },
 	{ "compression-level", COMMAND_LINE_VALUE_REQUIRED, "<level>", NULL, NULL, -1, NULL, "Compression level (0,1,2)" },
+	{ "dvc-compression", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Compress dynamic virtual channel data (DRDYNVC version 3)" },
 	{ "shell", COMMAND_LINE_VALUE_REQUIRED, NULL, NULL, NULL, -1, NULL, "Alternate shell" },
 	{ "shell-dir", COMMAND_LINE_VALUE_REQUIRED, NULL, NULL, NULL, -1, NULL, "Shell working directory" },
 	{ "sound", COMMAND_LINE_VALUE_OPTIONAL, "[sys][dev][format][rate][channel][latency][quality]", NULL, NULL, -1, "audio", "Audio output (sound)" },
@@ -168,6 +169,9 @@ static COMMAND_LINE_ARGUMENT_A args[] =
 	{ "version", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_VERSION, NULL, NULL, NULL, -1, NULL, "print version" },
 	{ "help", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_HELP, NULL, NULL, NULL, -1, "?", "print help" },
 	{ "play-rfx", COMMAND_LINE_VALUE_REQUIRED, "<pcap file>", NULL, NULL, -1, NULL, "Replay rfx pcap file" },
+	{ "record-session", COMMAND_LINE_VALUE_REQUIRED, "<file>", NULL, NULL, -1, NULL, "Record the received session to a file, it holds everything the server sent: keep it private" },
+	{ "play-session", COMMAND_LINE_VALUE_REQUIRED, "<file>", NULL, NULL, -1, NULL, "Replay a recorded session instead of connecting" },
+	{ "play-session-realtime", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Replay a recorded session at its original pace" },
 	{ "auth-only", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Authenticate only." },
 	{ "auto-reconnect", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Automatic reconnection" },
 	{ "auto-reconnect-max-retries", COMMAND_LINE_VALUE_REQUIRED, "<retries>", NULL, NULL, -1, NULL, "Automatic reconnection maximum retries, 0 for unlimited [0,1000]" },
@@ -1972,6 +1976,10 @@ int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
 		{
 			settings->CompressionLevel = atoi(arg->Value);
 		}
+		CommandLineSwitchCase(arg, "dvc-compression")
+		{
+			settings->SupportDynamicChannelCompression = arg->Value ? TRUE : FALSE;
+		}
 		CommandLineSwitchCase(arg, "drives")
 		{
 			settings->RedirectDrives = arg->Value ? TRUE : FALSE;
@@ -2420,6 +2428,28 @@ int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
 
 			settings->PlayRemoteFx = TRUE;
 		}
+		CommandLineSwitchCase(arg, "record-session")
+		{
+			free(settings->RecordSessionFile);
+
+			if (!(settings->RecordSessionFile = _strdup(arg->Value)))
+				return COMMAND_LINE_ERROR_MEMORY;
+
+			settings->RecordSession = TRUE;
+		}
+		CommandLineSwitchCase(arg, "play-session")
+		{
+			free(settings->PlaySessionFile);
+
+			if (!(settings->PlaySessionFile = _strdup(arg->Value)))
+				return COMMAND_LINE_ERROR_MEMORY;
+
+			settings->PlaySession = TRUE;
+		}
+		CommandLineSwitchCase(arg, "play-session-realtime")
+		{
+			settings->PlaySessionRealTime = arg->Value ? TRUE : FALSE;
+		}
 		CommandLineSwitchCase(arg, "auth-only")
 		{
 			settings->AuthenticationOnly = arg->Value ? TRUE : FALSE;
@@ -64,6 +64,7 @@ CMAKE_DEPENDENT_OPTION(TESTS_WTSAPI_EXTRA "Build extra WTSAPI tests (interactive
 CMAKE_DEPENDENT_OPTION(BUILD_COMM_TESTS "Build comm related tests (require comm port)" OFF "BUILD_TESTING" OFF)
 
 option(WITH_SAMPLE "Build sample code" OFF)
+option(WITH_CLIENT_BENCH "Build the headless load generator client" OFF)
 
 option(WITH_CLIENT_COMMON "Build client common library" ON)
 cmake_dependent_option(WITH_CLIENT "Build client binaries" ON "WITH_CLIENT_COMMON" OFF)
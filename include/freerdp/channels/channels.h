@@ -54,6 +54,11 @@ FREERDP_API int freerdp_channels_process_pending_messages(freerdp* instance);
 FREERDP_API int freerdp_channels_data(freerdp* instance,
                                       UINT16 channelId, BYTE* data, int dataSize, int flags, int totalSize);
 
+FREERDP_API UINT freerdp_channels_data_received(rdpContext* context, wStream** data_in,
+        const void* pData, UINT32 dataLength, UINT32 totalLength, UINT32 dataFlags,
+        wStream** message);
+FREERDP_API void freerdp_channels_data_free(wStream* s);
+
 FREERDP_API PWtsApiFunctionTable FreeRDP_InitWtsApi(void);
 
 #ifdef __cplusplus
@@ -63,6 +63,7 @@ typedef void (*pcFree) (rdpsndDevicePlugin* device);
 typedef BOOL (*pcWaveDecode) (rdpsndDevicePlugin* device, RDPSND_WAVE* wave);
 typedef void (*pcWavePlay) (rdpsndDevicePlugin* device, RDPSND_WAVE* wave);
 typedef UINT (*pcWaveConfirm) (rdpsndDevicePlugin* device, RDPSND_WAVE* wave);
+typedef BOOL (*pcGetDelay) (rdpsndDevicePlugin* device, UINT32* delay);
 
 struct rdpsnd_device_plugin
 {
@@ -83,6 +84,9 @@ struct rdpsnd_device_plugin
 	pcWaveConfirm WaveConfirm;
 
 	BOOL DisableConfirmThread;
+
+	/* Optional, milliseconds of audio the device has left to play */
+	pcGetDelay GetDelay;
 };
 
 #define RDPSND_DEVICE_EXPORT_FUNC_NAME "freerdp_rdpsnd_client_subsystem_entry"
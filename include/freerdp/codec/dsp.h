@@ -21,6 +21,9 @@
 #define FREERDP_CODEC_DSP_H
 
 #include <freerdp/api.h>
+#include <freerdp/codec/audio.h>
+
+#include <winpr/stream.h>
 
 union _ADPCM
 {
@@ -40,6 +43,8 @@ union _ADPCM
 typedef union _ADPCM ADPCM;
 
 typedef struct _FREERDP_DSP_CONTEXT FREERDP_DSP_CONTEXT;
+typedef struct _FREERDP_DSP_RESAMPLER FREERDP_DSP_RESAMPLER;
+typedef struct _FREERDP_DSP_CODEC FREERDP_DSP_CODEC;
 
 struct _FREERDP_DSP_CONTEXT
 {
@@ -47,6 +52,7 @@ struct _FREERDP_DSP_CONTEXT
 	UINT32 resampled_size;
 	UINT32 resampled_frames;
 	UINT32 resampled_maxlength;
+	FREERDP_DSP_RESAMPLER* resampler;
 
 	BYTE* adpcm_buffer;
 	UINT32 adpcm_size;
@@ -54,10 +60,14 @@ struct _FREERDP_DSP_CONTEXT
 
 	ADPCM adpcm;
 
+	AUDIO_FORMAT format;
+	FREERDP_DSP_CODEC* codec;
+
 	BOOL (*resample)(FREERDP_DSP_CONTEXT* context,
 		const BYTE* src, int bytes_per_sample,
 		UINT32 schan, UINT32 srate, int sframes,
 		UINT32 rchan, UINT32 rrate);
+	INT32 (*resample_filter)(const INT16* samples, const INT16* coeffs, UINT32 taps);
 
 	BOOL (*decode_ima_adpcm)(FREERDP_DSP_CONTEXT* context,
 		const BYTE* src, int size, int channels, int block_size);
@@ -78,6 +88,20 @@ FREERDP_API FREERDP_DSP_CONTEXT* freerdp_dsp_context_new(void);
 FREERDP_API void freerdp_dsp_context_free(FREERDP_DSP_CONTEXT* context);
 #define freerdp_dsp_context_reset_adpcm(_c) memset(&_c->adpcm, 0, sizeof(ADPCM))
 
+/**
+ * Audio codecs: the uncompressed side is 16 bit PCM with the channels and
+ * the rate of the format. PCM, A-law, mu-law and the ADPCM formats are
+ * built in, AAC, MP3 and GSM 6.10 need FFmpeg.
+ */
+FREERDP_API BOOL freerdp_dsp_supports_format(const AUDIO_FORMAT* format, BOOL encode);
+FREERDP_API BOOL freerdp_dsp_context_reset(FREERDP_DSP_CONTEXT* context,
+        const AUDIO_FORMAT* format);
+FREERDP_API BOOL freerdp_dsp_encode(FREERDP_DSP_CONTEXT* context, const BYTE* data,
+                                    size_t length, wStream* out);
+FREERDP_API BOOL freerdp_dsp_decode(FREERDP_DSP_CONTEXT* context, const BYTE* data,
+                                    size_t length, wStream* out);
+FREERDP_API void freerdp_dsp_pcm_format(const AUDIO_FORMAT* format, AUDIO_FORMAT* pcm);
+
 #ifdef __cplusplus
 }
 #endif
@@ -97,6 +97,14 @@ struct _BITMAP_PLANAR_CONTEXT
 
 	BYTE* pTempData;
 	UINT32 nTempStep;
+
+	/* Per scanline kernels, replaced by SIMD versions where available */
+	void (*delta_encode_line)(const BYTE* pSrc, const BYTE* pPrev, BYTE* pDst, UINT32 width);
+	void (*delta_decode_line)(BYTE* pLine, const BYTE* pPrev, UINT32 width);
+	void (*split_line_32)(const BYTE* pSrc, BOOL alpha, BYTE* pA, BYTE* pC0, BYTE* pC1,
+	                      BYTE* pC2, UINT32 width);
+	void (*merge_line_32)(BYTE* pDst, const BYTE* pA, const BYTE* pC0, const BYTE* pC1,
+	                      const BYTE* pC2, UINT32 width);
 };
 
 #ifdef __cplusplus
@@ -31,6 +31,7 @@
 #define ZGFX_PACKET_COMPR_TYPE_RDP8		0x04
 
 #define ZGFX_SEGMENTED_MAXSIZE			65535
+#define ZGFX_LITE_HISTORY_SIZE			8192
 
 struct _ZGFX_CONTEXT
 {
@@ -53,6 +54,8 @@ struct _ZGFX_CONTEXT
 };
 typedef struct _ZGFX_CONTEXT ZGFX_CONTEXT;
 
+typedef struct _ZGFX_LITE_CONTEXT ZGFX_LITE_CONTEXT;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -63,9 +66,21 @@ FREERDP_API int zgfx_compress_to_stream(ZGFX_CONTEXT* zgfx, wStream* sDst, const
 
 FREERDP_API void zgfx_context_reset(ZGFX_CONTEXT* zgfx, BOOL flush);
 
+/* A compressor sends raw segments unless LZ77 compression is enabled */
+FREERDP_API BOOL zgfx_context_set_compression(ZGFX_CONTEXT* zgfx, BOOL enable);
+
 FREERDP_API ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor);
 FREERDP_API void zgfx_context_free(ZGFX_CONTEXT* zgfx);
 
+/* Single RDP8_BULK_ENCODED_DATA segment (header + data) without segmented descriptor,
+ * as carried by DRDYNVC compressed data PDUs (RDP 8.0 Lite, 8 KB history window).
+ * A segment holds at most ZGFX_LITE_HISTORY_SIZE bytes of data. */
+FREERDP_API int zgfx_compress_segment_to_stream(ZGFX_LITE_CONTEXT* zgfx, wStream* sDst, const BYTE* pSrcData, UINT32 SrcSize, UINT32* pFlags);
+FREERDP_API int zgfx_decompress_segment_to_stream(ZGFX_LITE_CONTEXT* zgfx, wStream* sDst, const BYTE* pSrcData, UINT32 SrcSize);
+
+FREERDP_API ZGFX_LITE_CONTEXT* zgfx_lite_context_new(BOOL Compressor);
+FREERDP_API void zgfx_lite_context_free(ZGFX_LITE_CONTEXT* zgfx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -59,6 +59,26 @@ typedef RDP_CLIENT_ENTRY_POINTS_V1 RDP_CLIENT_ENTRY_POINTS;
 extern "C" {
 #endif
 
+/* Virtual channel send priority classes, highest first */
+#define FREERDP_CHANNEL_PRIORITY_INPUT		0
+#define FREERDP_CHANNEL_PRIORITY_AUDIO		1
+#define FREERDP_CHANNEL_PRIORITY_GFX		2
+#define FREERDP_CHANNEL_PRIORITY_BULK		3
+#define FREERDP_CHANNEL_PRIORITY_COUNT		4
+
+struct rdp_channel_queue_metrics
+{
+	UINT32 priority;
+	UINT32 queuedMessages;
+	UINT64 queuedBytes;
+	UINT64 maxQueuedBytes;
+	UINT64 sentMessages;
+	UINT64 sentChunks;
+	UINT64 sentBytes;
+	UINT32 maxDelay; /* milliseconds between enqueue and last chunk sent */
+};
+typedef struct rdp_channel_queue_metrics rdpChannelQueueMetrics;
+
 typedef BOOL (*pContextNew)(freerdp* instance, rdpContext* context);
 typedef void (*pContextFree)(freerdp* instance, rdpContext* context);
 
@@ -366,6 +386,13 @@ FREERDP_API const char* freerdp_get_logon_error_info_data(UINT32 data);
 
 FREERDP_API ULONG freerdp_get_transport_sent(rdpContext* context,
         BOOL resetCount);
+FREERDP_API ULONG freerdp_get_transport_received(rdpContext* context,
+        BOOL resetCount);
+
+FREERDP_API BOOL freerdp_channel_set_priority(rdpContext* context, const char* name,
+        UINT32 priority);
+FREERDP_API BOOL freerdp_channel_get_queue_metrics(rdpContext* context, const char* name,
+        rdpChannelQueueMetrics* metrics);
 
 FREERDP_API void clearChannelError(rdpContext* context);
 FREERDP_API HANDLE getChannelErrorEventHandle(rdpContext* context);
@@ -676,6 +676,11 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_PlayRemoteFx					1857
 #define FreeRDP_DumpRemoteFxFile				1858
 #define FreeRDP_PlayRemoteFxFile				1859
+#define FreeRDP_RecordSession					1860
+#define FreeRDP_PlaySession					1861
+#define FreeRDP_RecordSessionFile				1862
+#define FreeRDP_PlaySessionFile					1863
+#define FreeRDP_PlaySessionRealTime				1864
 #define FreeRDP_GatewayUsageMethod				1984
 #define FreeRDP_GatewayPort					1985
 #define FreeRDP_GatewayHostname					1986
@@ -750,6 +755,7 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_OffscreenCacheEntries				2818
 #define FreeRDP_VirtualChannelCompressionFlags			2880
 #define FreeRDP_VirtualChannelChunkSize				2881
+#define FreeRDP_VirtualChannelScheduling			2882
 #define FreeRDP_SoundBeepsEnabled				2944
 #define FreeRDP_MultifragMaxRequestSize				3328
 #define FreeRDP_LargePointerFlag				3392
@@ -803,6 +809,7 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_DynamicChannelArraySize				5057
 #define FreeRDP_DynamicChannelArray				5058
 #define FreeRDP_SupportDynamicChannels				5059
+#define FreeRDP_SupportDynamicChannelCompression		5060
 #define FreeRDP_SupportEchoChannel				5184
 #define FreeRDP_SupportDisplayControl				5185
 #define FreeRDP_SupportGeometryTracking				5186
@@ -1127,7 +1134,12 @@ struct rdp_settings
 	ALIGN64 BOOL PlayRemoteFx; /* 1857 */
 	ALIGN64 char* DumpRemoteFxFile; /* 1858 */
 	ALIGN64 char* PlayRemoteFxFile; /* 1859 */
-	UINT64 padding1920[1920 - 1860]; /* 1860 */
+	ALIGN64 BOOL RecordSession; /* 1860 */
+	ALIGN64 BOOL PlaySession; /* 1861 */
+	ALIGN64 char* RecordSessionFile; /* 1862 */
+	ALIGN64 char* PlaySessionFile; /* 1863 */
+	ALIGN64 BOOL PlaySessionRealTime; /* 1864 */
+	UINT64 padding1920[1920 - 1865]; /* 1865 */
 	UINT64 padding1984[1984 - 1920]; /* 1920 */
 
 	/**
@@ -1258,7 +1270,8 @@ struct rdp_settings
 	/* Virtual Channel Capabilities */
 	ALIGN64 UINT32 VirtualChannelCompressionFlags; /* 2880 */
 	ALIGN64 UINT32 VirtualChannelChunkSize; /* 2881 */
-	UINT64 padding2944[2944 - 2882]; /* 2882 */
+	ALIGN64 BOOL VirtualChannelScheduling; /* 2882 */
+	UINT64 padding2944[2944 - 2883]; /* 2883 */
 
 	/* Sound Capabilities */
 	ALIGN64 BOOL SoundBeepsEnabled; /* 2944 */
@@ -1410,7 +1423,8 @@ struct rdp_settings
 	ALIGN64 UINT32 DynamicChannelArraySize; /* 5057 */
 	ALIGN64 ADDIN_ARGV** DynamicChannelArray; /* 5058 */
 	ALIGN64 BOOL SupportDynamicChannels; /* 5059 */
-	UINT64 padding5184[5184 - 5060]; /* 5060 */
+	ALIGN64 BOOL SupportDynamicChannelCompression; /* 5060 */
+	UINT64 padding5184[5184 - 5061]; /* 5061 */
 
 	ALIGN64 BOOL SupportEchoChannel; /* 5184 */
 	ALIGN64 BOOL SupportDisplayControl; /* 5185 */
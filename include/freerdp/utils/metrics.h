@@ -0,0 +1,117 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Runtime Metrics Registry
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_UTILS_METRICS_H
+#define FREERDP_UTILS_METRICS_H
+
+#include <freerdp/api.h>
+#include <freerdp/types.h>
+
+/**
+ * Process wide counters and latency histograms for the hot paths.
+ *
+ * Every thread updates its own copy of the metrics, without locks or atomics,
+ * and a snapshot adds them up. Recording is off until freerdp_metrics_enable()
+ * is called or the FREERDP_METRICS environment variable names an export file:
+ *
+ * FREERDP_METRICS=/tmp/freerdp.metrics[:<interval in ms>]
+ *
+ * The export file is rewritten every interval (1000 ms by default) with one
+ * line per metric, so it can be watched while a session runs.
+ */
+
+#define FREERDP_METRIC_COUNTER		0
+#define FREERDP_METRIC_HISTOGRAM	1
+
+#define FREERDP_METRIC_INVALID		0xFFFFFFFF
+#define FREERDP_METRIC_MAX		128
+
+enum FREERDP_METRIC_ID
+{
+	FREERDP_METRIC_TRANSPORT_READ,
+	FREERDP_METRIC_TRANSPORT_WRITE,
+	FREERDP_METRIC_TRANSPORT_RECEIVE_TIME,
+	FREERDP_METRIC_TRANSPORT_WRITE_TIME,
+	FREERDP_METRIC_BULK_COMPRESS,
+	FREERDP_METRIC_BULK_COMPRESS_TIME,
+	FREERDP_METRIC_BULK_DECOMPRESS,
+	FREERDP_METRIC_BULK_DECOMPRESS_TIME,
+	FREERDP_METRIC_RFX_ENCODE_TIME,
+	FREERDP_METRIC_RFX_DECODE_TIME,
+	FREERDP_METRIC_NSC_ENCODE_TIME,
+	FREERDP_METRIC_NSC_DECODE_TIME,
+	FREERDP_METRIC_PLANAR_ENCODE_TIME,
+	FREERDP_METRIC_PLANAR_DECODE_TIME,
+	FREERDP_METRIC_INTERLEAVED_ENCODE_TIME,
+	FREERDP_METRIC_INTERLEAVED_DECODE_TIME,
+	FREERDP_METRIC_CLEAR_DECODE_TIME,
+	FREERDP_METRIC_PROGRESSIVE_DECODE_TIME,
+	FREERDP_METRIC_H264_ENCODE_TIME,
+	FREERDP_METRIC_H264_DECODE_TIME,
+	FREERDP_METRIC_GFX_FRAME_ACK_TIME,
+	FREERDP_METRIC_GFX_CACHE_HIT,
+	FREERDP_METRIC_GFX_CACHE_MISS,
+	FREERDP_METRIC_CHANNEL_SENT,
+	FREERDP_METRIC_CHANNEL_QUEUE_DELAY,
+	FREERDP_METRIC_BUILTIN_COUNT
+};
+
+/**
+ * For counters count is the number of updates and sum their total,
+ * histograms also keep the extremes and percentiles of the recorded values.
+ */
+struct _FREERDP_METRIC_VALUE
+{
+	const char* name;
+	UINT32 type;
+	UINT64 count;
+	UINT64 sum;
+	UINT64 min;
+	UINT64 max;
+	UINT64 p50;
+	UINT64 p90;
+	UINT64 p99;
+};
+typedef struct _FREERDP_METRIC_VALUE FREERDP_METRIC_VALUE;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+FREERDP_API void freerdp_metrics_init(void);
+FREERDP_API void freerdp_metrics_enable(BOOL enable);
+FREERDP_API BOOL freerdp_metrics_enabled(void);
+
+FREERDP_API UINT32 freerdp_metric_register(const char* name, UINT32 type);
+
+FREERDP_API UINT64 freerdp_metrics_now(void);
+FREERDP_API void freerdp_metric_add(UINT32 id, UINT64 value);
+FREERDP_API void freerdp_metric_record(UINT32 id, UINT64 value);
+FREERDP_API void freerdp_metric_record_since(UINT32 id, UINT64 start);
+
+FREERDP_API size_t freerdp_metrics_snapshot(FREERDP_METRIC_VALUE* values, size_t count);
+FREERDP_API void freerdp_metrics_reset(void);
+
+FREERDP_API BOOL freerdp_metrics_export(const char* filename);
+FREERDP_API BOOL freerdp_metrics_exporter_start(const char* filename, UINT32 interval);
+FREERDP_API void freerdp_metrics_exporter_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_UTILS_METRICS_H */
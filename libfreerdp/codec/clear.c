@@ -30,6 +30,7 @@
 #include <freerdp/codec/color.h>
 #include <freerdp/codec/clear.h>
 #include <freerdp/log.h>
+#include <freerdp/utils/metrics.h>
 
 #define TAG FREERDP_TAG("codec.clear")
 
@@ -1040,6 +1041,7 @@ INT32 clear_decompress(CLEAR_CONTEXT* clear, const BYTE* pSrcData,
 	UINT32 subcodecByteCount;
 	wStream* s;
 	BYTE* glyphData = NULL;
+	const UINT64 start = freerdp_metrics_now();
 
 	if (!pDstData)
 		return -1002;
@@ -1156,6 +1158,7 @@ INT32 clear_decompress(CLEAR_CONTEXT* clear, const BYTE* pSrcData,
 
 finish:
 	rc = 0;
+	freerdp_metric_record_since(FREERDP_METRIC_CLEAR_DECODE_TIME, start);
 fail:
 	Stream_Free(s, FALSE);
 	return rc;
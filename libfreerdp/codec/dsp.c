@@ -21,6 +21,7 @@
 #include "config.h"
 #endif
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,62 +32,375 @@
 
 #include <freerdp/codec/dsp.h>
 
+#include "dsp_sse2.h"
+#include "dsp_neon.h"
+
+#if defined(WITH_DSP_FFMPEG)
+#include "dsp_ffmpeg.h"
+#endif
+
+#ifndef DSP_INIT_SIMD
+#define DSP_INIT_SIMD(_dsp_context) do { } while (0)
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 /**
  * Microsoft Multimedia Standards Update
  * http://download.microsoft.com/download/9/8/6/9863C72A-A3AA-4DDB-B1BA-CA8D17EFD2D4/RIFFNEW.pdf
  */
 
+/**
+ * Band limited resampling with a polyphase windowed sinc filter.
+ *
+ * The input is mixed to the output channels and kept as 16 bit planes, with
+ * the tail of the previous packet in front so that the filter runs over packet
+ * boundaries. Output frame n is at input frame n * srate / rrate, the phase
+ * of the filter is the fraction of that position rounded to the nearest of
+ * at most DSP_RESAMPLE_MAX_PHASES.
+ */
+
+#define DSP_RESAMPLE_TAPS		64
+#define DSP_RESAMPLE_MAX_TAPS		256
+#define DSP_RESAMPLE_MAX_PHASES		512
+#define DSP_RESAMPLE_KAISER_BETA	7.0
+
+struct _FREERDP_DSP_RESAMPLER
+{
+	int bytes_per_sample;
+	UINT32 schan;
+	UINT32 srate;
+	UINT32 rchan;
+	UINT32 rrate;
+
+	UINT32 taps;
+	UINT32 phases;
+	INT16* coeffs;
+
+	UINT64 step;
+	UINT64 position;
+
+	INT16* history;
+	UINT32 frames;
+	UINT32 capacity;
+};
+
+static INT32 freerdp_dsp_resample_filter(const INT16* samples, const INT16* coeffs, UINT32 taps)
+{
+	UINT32 k;
+	INT32 sum = 0;
+
+	for (k = 0; k < taps; k++)
+		sum += samples[k] * coeffs[k];
+
+	return sum;
+}
+
+static double freerdp_dsp_bessel_i0(double x)
+{
+	int k;
+	double sum = 1.0;
+	double term = 1.0;
+
+	for (k = 1; k < 32; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+
+	return sum;
+}
+
+static void freerdp_dsp_resampler_free(FREERDP_DSP_RESAMPLER* resampler)
+{
+	if (resampler)
+	{
+		free(resampler->coeffs);
+		free(resampler->history);
+		free(resampler);
+	}
+}
+
+static UINT32 freerdp_dsp_gcd(UINT32 a, UINT32 b)
+{
+	while (b)
+	{
+		const UINT32 t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+static FREERDP_DSP_RESAMPLER* freerdp_dsp_resampler_new(int bytes_per_sample, UINT32 schan,
+        UINT32 srate, UINT32 rchan, UINT32 rrate)
+{
+	UINT32 p, k;
+	double ratio, cutoff, center;
+	FREERDP_DSP_RESAMPLER* resampler;
+	resampler = (FREERDP_DSP_RESAMPLER*) calloc(1, sizeof(FREERDP_DSP_RESAMPLER));
+
+	if (!resampler)
+		return NULL;
+
+	resampler->bytes_per_sample = bytes_per_sample;
+	resampler->schan = schan;
+	resampler->srate = srate;
+	resampler->rchan = rchan;
+	resampler->rrate = rrate;
+	resampler->step = ((UINT64) srate << 32) / rrate;
+	resampler->phases = MIN(rrate / freerdp_dsp_gcd(srate, rrate), DSP_RESAMPLE_MAX_PHASES);
+
+	/* when downsampling the cutoff follows the output rate and the filter gets longer */
+	ratio = (srate > rrate) ? (double) rrate / srate : 1.0;
+	resampler->taps = (UINT32)(DSP_RESAMPLE_TAPS / ratio);
+	resampler->taps = MIN((resampler->taps + 7) & ~7, DSP_RESAMPLE_MAX_TAPS);
+	cutoff = ratio * (0.5 - 0.5 * 8.0 / DSP_RESAMPLE_TAPS);
+	center = resampler->taps / 2 - 1;
+
+	/* one row more, the last phase rounds up to the first of the next frame */
+	resampler->coeffs = (INT16*) calloc((resampler->phases + 1) * resampler->taps, sizeof(INT16));
+
+	if (!resampler->coeffs)
+		goto fail;
+
+	for (p = 0; p <= resampler->phases; p++)
+	{
+		double sum = 0.0;
+		double h[DSP_RESAMPLE_MAX_TAPS];
+		INT16* row = &resampler->coeffs[p * resampler->taps];
+
+		for (k = 0; k < resampler->taps; k++)
+		{
+			const double t = k - center - (double) p / resampler->phases;
+			const double w = t / (center + 1.0);
+
+			if ((w <= -1.0) || (w >= 1.0))
+				h[k] = 0.0;
+			else
+			{
+				h[k] = (t == 0.0) ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * t) / (M_PI * t);
+				h[k] *= freerdp_dsp_bessel_i0(DSP_RESAMPLE_KAISER_BETA * sqrt(1.0 - w * w)) /
+				        freerdp_dsp_bessel_i0(DSP_RESAMPLE_KAISER_BETA);
+			}
+
+			sum += h[k];
+		}
+
+		/* unity gain for every phase */
+		for (k = 0; k < resampler->taps; k++)
+			row[k] = (INT16) floor(h[k] / sum * 32768.0 + 0.5);
+	}
+
+	/* the first output frame is at the first input frame */
+	resampler->frames = (UINT32) center;
+	resampler->capacity = 4096;
+	resampler->history = (INT16*) calloc(rchan * resampler->capacity, sizeof(INT16));
+
+	if (!resampler->history)
+		goto fail;
+
+	return resampler;
+fail:
+	freerdp_dsp_resampler_free(resampler);
+	return NULL;
+}
+
+static INLINE INT16 freerdp_dsp_read_sample(const BYTE* src, int bytes_per_sample)
+{
+	if (bytes_per_sample == 1)
+		return (INT16)((src[0] - 128) << 8);
+
+	return (INT16)(src[0] | (src[1] << 8));
+}
+
+static INLINE void freerdp_dsp_write_sample(BYTE* dst, int bytes_per_sample, INT16 sample)
+{
+	if (bytes_per_sample == 1)
+		dst[0] = (BYTE)(MIN((sample + 0x80) >> 8, 127) + 128);
+	else
+	{
+		dst[0] = (BYTE)(sample & 0xFF);
+		dst[1] = (BYTE)((sample >> 8) & 0xFF);
+	}
+}
+
+/**
+ * Mixes a frame to the output channels: extra output channels repeat the
+ * input channels, when there are fewer the input channels are averaged.
+ */
+static INLINE INT16 freerdp_dsp_mix_sample(const BYTE* frame, int bytes_per_sample,
+        UINT32 schan, UINT32 rchan, UINT32 channel)
+{
+	UINT32 c;
+	INT32 sum = 0;
+	UINT32 count = 0;
+
+	if (rchan >= schan)
+		return freerdp_dsp_read_sample(&frame[(channel % schan) * bytes_per_sample],
+		                               bytes_per_sample);
+
+	for (c = channel; c < schan; c += rchan)
+	{
+		sum += freerdp_dsp_read_sample(&frame[c * bytes_per_sample], bytes_per_sample);
+		count++;
+	}
+
+	return (INT16)(sum / (INT32) count);
+}
+
+static BOOL freerdp_dsp_resample_buffer(FREERDP_DSP_CONTEXT* context, UINT32 rsize)
+{
+	if (rsize > context->resampled_maxlength)
+	{
+		BYTE* newBuffer = (BYTE*) realloc(context->resampled_buffer, rsize + 1024);
+
+		if (!newBuffer)
+			return FALSE;
+
+		context->resampled_maxlength = rsize + 1024;
+		context->resampled_buffer = newBuffer;
+	}
+
+	return TRUE;
+}
+
 static BOOL freerdp_dsp_resample(FREERDP_DSP_CONTEXT* context,
 	const BYTE* src, int bytes_per_sample,
 	UINT32 schan, UINT32 srate, int sframes,
 	UINT32 rchan, UINT32 rrate)
 {
 	BYTE* dst;
-	BYTE* p;
-	int rframes;
-	int rsize;
-	int i, j;
-	int n1, n2;
-	int sbytes, rbytes;
+	int i;
+	UINT32 c;
+	UINT32 rframes;
+	UINT32 consumed;
+	const UINT32 sbytes = bytes_per_sample * schan;
+	const UINT32 rbytes = bytes_per_sample * rchan;
+	FREERDP_DSP_RESAMPLER* resampler = context->resampler;
+
+	if (((bytes_per_sample != 1) && (bytes_per_sample != 2)) || !schan || !rchan || !srate ||
+	    !rrate || (sframes < 0))
+		return FALSE;
+
+	/* only the channels change, there is nothing to filter */
+	if (srate == rrate)
+	{
+		if (!freerdp_dsp_resample_buffer(context, sframes * rbytes))
+			return FALSE;
 
-	sbytes = bytes_per_sample * schan;
-	rbytes = bytes_per_sample * rchan;
-	rframes = sframes * rrate / srate;
-	rsize = rbytes * rframes;
+		dst = context->resampled_buffer;
 
-	if (rsize > (int) context->resampled_maxlength)
+		for (i = 0; i < sframes; i++)
+		{
+			for (c = 0; c < rchan; c++)
+			{
+				freerdp_dsp_write_sample(dst, bytes_per_sample,
+				                         freerdp_dsp_mix_sample(&src[i * sbytes], bytes_per_sample,
+				                                 schan, rchan, c));
+				dst += bytes_per_sample;
+			}
+		}
+
+		context->resampled_frames = sframes;
+		context->resampled_size = sframes * rbytes;
+		return TRUE;
+	}
+
+	if (!resampler || (resampler->bytes_per_sample != bytes_per_sample) ||
+	    (resampler->schan != schan) || (resampler->srate != srate) ||
+	    (resampler->rchan != rchan) || (resampler->rrate != rrate))
 	{
-		BYTE *newBuffer = (BYTE*) realloc(context->resampled_buffer, rsize + 1024);
-		if (!newBuffer)
+		freerdp_dsp_resampler_free(resampler);
+
+		if (!(resampler = freerdp_dsp_resampler_new(bytes_per_sample, schan, srate, rchan, rrate)))
+		{
+			context->resampler = NULL;
 			return FALSE;
+		}
 
-		context->resampled_maxlength = rsize + 1024;
-		context->resampled_buffer = newBuffer;
+		context->resampler = resampler;
 	}
-	dst = context->resampled_buffer;
 
-	p = dst;
+	if (resampler->frames + sframes > resampler->capacity)
+	{
+		INT16* history;
+		const UINT32 capacity = resampler->frames + sframes;
+
+		if (!(history = (INT16*) calloc(rchan * capacity, sizeof(INT16))))
+			return FALSE;
+
+		for (c = 0; c < rchan; c++)
+			CopyMemory(&history[c * capacity], &resampler->history[c * resampler->capacity],
+			           resampler->frames * sizeof(INT16));
 
-	for (i = 0; i < rframes; i++)
+		free(resampler->history);
+		resampler->history = history;
+		resampler->capacity = capacity;
+	}
+
+	for (c = 0; c < rchan; c++)
 	{
-		n1 = i * srate / rrate;
+		INT16* plane = &resampler->history[c * resampler->capacity + resampler->frames];
+
+		for (i = 0; i < sframes; i++)
+			plane[i] = freerdp_dsp_mix_sample(&src[i * sbytes], bytes_per_sample, schan, rchan, c);
+	}
 
-		if (n1 >= sframes)
-			n1 = sframes - 1;
+	resampler->frames += sframes;
+	rframes = (UINT32)((UINT64) resampler->frames * rrate / srate + 2);
 
-		n2 = (n1 * rrate == i * srate || n1 == sframes - 1 ? n1 : n1 + 1);
+	if (!freerdp_dsp_resample_buffer(context, rframes * rbytes))
+		return FALSE;
+
+	dst = context->resampled_buffer;
+	rframes = 0;
+
+	for (;;)
+	{
+		UINT32 index = (UINT32)(resampler->position >> 32);
+		UINT32 phase = (UINT32)(((resampler->position & 0xFFFFFFFF) * resampler->phases +
+		                         0x80000000) >> 32);
 
-		for (j = 0; j < rbytes; j++)
+		if (index + resampler->taps > resampler->frames)
+			break;
+
+		for (c = 0; c < rchan; c++)
 		{
-			/* Nearest Interpolation, probably the easiest, but works */
-			*p++ = (i * srate - n1 * rrate > n2 * rrate - i * srate ?
-				src[n2 * sbytes + (j % sbytes)] :
-				src[n1 * sbytes + (j % sbytes)]);
+			INT32 sample = context->resample_filter(
+			                   &resampler->history[c * resampler->capacity + index],
+			                   &resampler->coeffs[phase * resampler->taps], resampler->taps);
+			sample = (sample + 0x4000) >> 15;
+
+			if (sample > 32767)
+				sample = 32767;
+			else if (sample < -32768)
+				sample = -32768;
+
+			freerdp_dsp_write_sample(dst, bytes_per_sample, (INT16) sample);
+			dst += bytes_per_sample;
 		}
+
+		resampler->position += resampler->step;
+		rframes++;
 	}
 
+	/* keep the frames the next output frames still need */
+	consumed = (UINT32)(resampler->position >> 32);
+
+	for (c = 0; c < rchan; c++)
+	{
+		INT16* plane = &resampler->history[c * resampler->capacity];
+		MoveMemory(plane, &plane[consumed], (resampler->frames - consumed) * sizeof(INT16));
+	}
+
+	resampler->frames -= consumed;
+	resampler->position -= (UINT64) consumed << 32;
 	context->resampled_frames = rframes;
-	context->resampled_size = rsize;
+	context->resampled_size = rframes * rbytes;
 	return TRUE;
 }
 
@@ -673,6 +987,280 @@ static BOOL freerdp_dsp_encode_ms_adpcm(FREERDP_DSP_CONTEXT* context,
 	return TRUE;
 }
 
+/**
+ * ITU-T G.711 A-law and mu-law
+ */
+
+static BYTE freerdp_dsp_encode_alaw_sample(INT16 sample)
+{
+	int exponent;
+	BYTE sign = 0x80;
+	INT32 value = sample;
+
+	if (value < 0)
+	{
+		sign = 0x00;
+		value = -value - 1;
+	}
+
+	value >>= 3;
+
+	for (exponent = 0; (exponent < 8) && (value > 0x1F); exponent++)
+		value >>= 1;
+
+	if (exponent == 0)
+		value >>= 1;
+
+	return (BYTE)((sign | (exponent << 4) | (value & 0x0F)) ^ 0x55);
+}
+
+static INT16 freerdp_dsp_decode_alaw_sample(BYTE sample)
+{
+	INT32 value;
+	int exponent;
+	sample ^= 0x55;
+	exponent = (sample >> 4) & 0x07;
+	value = ((sample & 0x0F) << 4) + 8;
+
+	if (exponent > 0)
+		value = (value + 0x100) << (exponent - 1);
+
+	return (INT16)((sample & 0x80) ? value : -value);
+}
+
+static BYTE freerdp_dsp_encode_mulaw_sample(INT16 sample)
+{
+	int exponent;
+	BYTE sign = 0x00;
+	INT32 value = sample;
+
+	if (value < 0)
+	{
+		sign = 0x80;
+		value = -value;
+	}
+
+	value = MIN(value, 32635) + 0x84;
+
+	for (exponent = 7; (exponent > 0) && !(value & (0x4000 >> (7 - exponent))); exponent--);
+
+	return (BYTE) ~(sign | (exponent << 4) | ((value >> (exponent + 3)) & 0x0F));
+}
+
+static INT16 freerdp_dsp_decode_mulaw_sample(BYTE sample)
+{
+	INT32 value;
+	sample = ~sample;
+	value = ((((sample & 0x0F) << 3) + 0x84) << ((sample >> 4) & 0x07)) - 0x84;
+	return (INT16)((sample & 0x80) ? -value : value);
+}
+
+/**
+ * Audio codecs
+ */
+
+BOOL freerdp_dsp_supports_format(const AUDIO_FORMAT* format, BOOL encode)
+{
+	if (!format || (format->nChannels < 1) || (format->nSamplesPerSec < 1))
+		return FALSE;
+
+	switch (format->wFormatTag)
+	{
+		case WAVE_FORMAT_PCM:
+			return (format->wBitsPerSample == 16);
+
+		case WAVE_FORMAT_ALAW:
+		case WAVE_FORMAT_MULAW:
+			return (format->wBitsPerSample == 8);
+
+		case WAVE_FORMAT_DVI_ADPCM:
+			return (format->wBitsPerSample == 4) && (format->nChannels <= 2) &&
+			       (format->nBlockAlign > 4 * format->nChannels);
+
+		case WAVE_FORMAT_ADPCM:
+			return (format->wBitsPerSample == 4) && (format->nChannels <= 2) &&
+			       (format->nBlockAlign > 7 * format->nChannels);
+
+		default:
+#if defined(WITH_DSP_FFMPEG)
+			return freerdp_dsp_ffmpeg_supports_format(format, encode);
+#else
+			return FALSE;
+#endif
+	}
+}
+
+/* The uncompressed counterpart of a format */
+void freerdp_dsp_pcm_format(const AUDIO_FORMAT* format, AUDIO_FORMAT* pcm)
+{
+	ZeroMemory(pcm, sizeof(AUDIO_FORMAT));
+	pcm->wFormatTag = WAVE_FORMAT_PCM;
+	pcm->nChannels = format->nChannels;
+	pcm->nSamplesPerSec = format->nSamplesPerSec;
+	pcm->wBitsPerSample = 16;
+	pcm->nBlockAlign = pcm->nChannels * 2;
+	pcm->nAvgBytesPerSec = pcm->nSamplesPerSec * pcm->nBlockAlign;
+}
+
+BOOL freerdp_dsp_context_reset(FREERDP_DSP_CONTEXT* context, const AUDIO_FORMAT* format)
+{
+	if (!context || !format)
+		return FALSE;
+
+	/* the codecs take what they need from the extra data when they are created */
+	context->format = *format;
+	context->format.cbSize = 0;
+	context->format.data = NULL;
+	freerdp_dsp_context_reset_adpcm(context);
+#if defined(WITH_DSP_FFMPEG)
+	freerdp_dsp_ffmpeg_free(context->codec);
+	context->codec = NULL;
+
+	switch (format->wFormatTag)
+	{
+		case WAVE_FORMAT_PCM:
+		case WAVE_FORMAT_ALAW:
+		case WAVE_FORMAT_MULAW:
+		case WAVE_FORMAT_DVI_ADPCM:
+		case WAVE_FORMAT_ADPCM:
+			break;
+
+		default:
+			if (!(context->codec = freerdp_dsp_ffmpeg_new(format)))
+				return FALSE;
+
+			break;
+	}
+#endif
+	return TRUE;
+}
+
+BOOL freerdp_dsp_encode(FREERDP_DSP_CONTEXT* context, const BYTE* data, size_t length,
+                        wStream* out)
+{
+	size_t i;
+	const AUDIO_FORMAT* format;
+
+	if (!context || !data || !out)
+		return FALSE;
+
+	format = &context->format;
+
+	switch (format->wFormatTag)
+	{
+		case WAVE_FORMAT_PCM:
+			if (!Stream_EnsureRemainingCapacity(out, length))
+				return FALSE;
+
+			Stream_Write(out, data, length);
+			return TRUE;
+
+		case WAVE_FORMAT_ALAW:
+		case WAVE_FORMAT_MULAW:
+			if (!Stream_EnsureRemainingCapacity(out, length / 2))
+				return FALSE;
+
+			for (i = 0; i + 1 < length; i += 2)
+			{
+				const INT16 sample = (INT16)(data[i] | (data[i + 1] << 8));
+
+				if (format->wFormatTag == WAVE_FORMAT_ALAW)
+					Stream_Write_UINT8(out, freerdp_dsp_encode_alaw_sample(sample));
+				else
+					Stream_Write_UINT8(out, freerdp_dsp_encode_mulaw_sample(sample));
+			}
+
+			return TRUE;
+
+		case WAVE_FORMAT_DVI_ADPCM:
+		case WAVE_FORMAT_ADPCM:
+			if (format->wFormatTag == WAVE_FORMAT_DVI_ADPCM)
+			{
+				if (!context->encode_ima_adpcm(context, data, (int) length, format->nChannels,
+				                               format->nBlockAlign))
+					return FALSE;
+			}
+			else if (!context->encode_ms_adpcm(context, data, (int) length, format->nChannels,
+			                                   format->nBlockAlign))
+				return FALSE;
+
+			if (!Stream_EnsureRemainingCapacity(out, context->adpcm_size))
+				return FALSE;
+
+			Stream_Write(out, context->adpcm_buffer, context->adpcm_size);
+			return TRUE;
+
+		default:
+#if defined(WITH_DSP_FFMPEG)
+			return freerdp_dsp_ffmpeg_encode(context->codec, data, length, out);
+#else
+			return FALSE;
+#endif
+	}
+}
+
+BOOL freerdp_dsp_decode(FREERDP_DSP_CONTEXT* context, const BYTE* data, size_t length,
+                        wStream* out)
+{
+	size_t i;
+	const AUDIO_FORMAT* format;
+
+	if (!context || !data || !out)
+		return FALSE;
+
+	format = &context->format;
+
+	switch (format->wFormatTag)
+	{
+		case WAVE_FORMAT_PCM:
+			if (!Stream_EnsureRemainingCapacity(out, length))
+				return FALSE;
+
+			Stream_Write(out, data, length);
+			return TRUE;
+
+		case WAVE_FORMAT_ALAW:
+		case WAVE_FORMAT_MULAW:
+			if (!Stream_EnsureRemainingCapacity(out, length * 2))
+				return FALSE;
+
+			for (i = 0; i < length; i++)
+			{
+				if (format->wFormatTag == WAVE_FORMAT_ALAW)
+					Stream_Write_UINT16(out, (UINT16) freerdp_dsp_decode_alaw_sample(data[i]));
+				else
+					Stream_Write_UINT16(out, (UINT16) freerdp_dsp_decode_mulaw_sample(data[i]));
+			}
+
+			return TRUE;
+
+		case WAVE_FORMAT_DVI_ADPCM:
+		case WAVE_FORMAT_ADPCM:
+			if (format->wFormatTag == WAVE_FORMAT_DVI_ADPCM)
+			{
+				if (!context->decode_ima_adpcm(context, data, (int) length, format->nChannels,
+				                               format->nBlockAlign))
+					return FALSE;
+			}
+			else if (!context->decode_ms_adpcm(context, data, (int) length, format->nChannels,
+			                                   format->nBlockAlign))
+				return FALSE;
+
+			if (!Stream_EnsureRemainingCapacity(out, context->adpcm_size))
+				return FALSE;
+
+			Stream_Write(out, context->adpcm_buffer, context->adpcm_size);
+			return TRUE;
+
+		default:
+#if defined(WITH_DSP_FFMPEG)
+			return freerdp_dsp_ffmpeg_decode(context->codec, data, length, out);
+#else
+			return FALSE;
+#endif
+	}
+}
+
 FREERDP_DSP_CONTEXT* freerdp_dsp_context_new(void)
 {
 	FREERDP_DSP_CONTEXT* context;
@@ -682,10 +1270,12 @@ FREERDP_DSP_CONTEXT* freerdp_dsp_context_new(void)
 		return NULL;
 
 	context->resample = freerdp_dsp_resample;
+	context->resample_filter = freerdp_dsp_resample_filter;
 	context->decode_ima_adpcm = freerdp_dsp_decode_ima_adpcm;
 	context->encode_ima_adpcm = freerdp_dsp_encode_ima_adpcm;
 	context->decode_ms_adpcm = freerdp_dsp_decode_ms_adpcm;
 	context->encode_ms_adpcm = freerdp_dsp_encode_ms_adpcm;
+	DSP_INIT_SIMD(context);
 
 	return context;
 }
@@ -695,6 +1285,10 @@ void freerdp_dsp_context_free(FREERDP_DSP_CONTEXT* context)
 	if (context)
 	{
 		free(context->resampled_buffer);
+		freerdp_dsp_resampler_free(context->resampler);
+#if defined(WITH_DSP_FFMPEG)
+		freerdp_dsp_ffmpeg_free(context->codec);
+#endif
 		free(context->adpcm_buffer);
 		free(context);
 	}
@@ -0,0 +1,577 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Digital Sound Processing - FFmpeg Audio Codecs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+
+#include <freerdp/log.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/frame.h>
+
+#include "dsp_ffmpeg.h"
+
+#define TAG FREERDP_TAG("codec.dsp")
+
+/**
+ * AAC is sent as ADTS frames, every frame carries its own configuration.
+ * PCM goes in and out as interleaved 16 bit samples, the codecs get it
+ * converted to their sample format.
+ */
+
+/* the send/receive API replaced avcodec_decode_audio4 with libavcodec 57.48.101 */
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(57, 48, 101)
+
+#define DSP_FFMPEG_ADTS_HEADER_LENGTH	7
+
+/* AVChannelLayout replaced the channel count and mask with libavutil 57.28.100 */
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 28, 100)
+#define DSP_FFMPEG_CH_LAYOUT
+#endif
+
+/* the FF_ profiles are deprecated since libavcodec 60.26.100 */
+#if !defined(AV_PROFILE_AAC_LOW)
+#define AV_PROFILE_AAC_LOW	FF_PROFILE_AAC_LOW
+#endif
+
+struct _FREERDP_DSP_CODEC
+{
+	AUDIO_FORMAT format;
+	enum AVCodecID id;
+	AVPacket* packet;
+
+	AVCodecContext* encoder;
+	AVFrame* frame;
+	BYTE* pending;
+	size_t pendingLength;
+	INT64 pts;
+
+	AVCodecContext* decoder;
+	AVCodecParserContext* parser;
+	AVFrame* decoded;
+};
+
+static const UINT32 adts_sample_rates[] =
+{
+	96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350
+};
+
+static enum AVCodecID freerdp_dsp_ffmpeg_codec_id(UINT16 wFormatTag)
+{
+	switch (wFormatTag)
+	{
+		case WAVE_FORMAT_AAC_MS:
+			return AV_CODEC_ID_AAC;
+
+		case WAVE_FORMAT_MPEGLAYER3:
+			return AV_CODEC_ID_MP3;
+
+		case WAVE_FORMAT_GSM610:
+			return AV_CODEC_ID_GSM_MS;
+
+		default:
+			return AV_CODEC_ID_NONE;
+	}
+}
+
+static const AVCodec* freerdp_dsp_ffmpeg_find(enum AVCodecID id, BOOL encode)
+{
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 10, 100)
+	avcodec_register_all();
+#endif
+	return encode ? avcodec_find_encoder(id) : avcodec_find_decoder(id);
+}
+
+/* The first of the sample formats of the encoder the conversion knows */
+static enum AVSampleFormat freerdp_dsp_ffmpeg_sample_format(const AVCodec* codec)
+{
+	const enum AVSampleFormat* fmt;
+
+	if (!codec->sample_fmts)
+		return AV_SAMPLE_FMT_S16;
+
+	for (fmt = codec->sample_fmts; *fmt != AV_SAMPLE_FMT_NONE; fmt++)
+	{
+		switch (*fmt)
+		{
+			case AV_SAMPLE_FMT_S16:
+			case AV_SAMPLE_FMT_S16P:
+			case AV_SAMPLE_FMT_FLT:
+			case AV_SAMPLE_FMT_FLTP:
+				return *fmt;
+
+			default:
+				break;
+		}
+	}
+
+	return AV_SAMPLE_FMT_NONE;
+}
+
+BOOL freerdp_dsp_ffmpeg_supports_format(const AUDIO_FORMAT* format, BOOL encode)
+{
+	const AVCodec* codec;
+	const enum AVCodecID id = freerdp_dsp_ffmpeg_codec_id(format->wFormatTag);
+
+	if ((id == AV_CODEC_ID_NONE) || (format->nChannels > 8))
+		return FALSE;
+
+	/* blocks of 320 samples in 65 bytes, the encoders only take 8 kHz mono */
+	if (format->wFormatTag == WAVE_FORMAT_GSM610)
+	{
+		if ((format->nChannels != 1) || (format->nBlockAlign != 65))
+			return FALSE;
+
+		if (encode && (format->nSamplesPerSec != 8000))
+			return FALSE;
+	}
+
+	if (!(codec = freerdp_dsp_ffmpeg_find(id, encode)))
+		return FALSE;
+
+	return !encode || (freerdp_dsp_ffmpeg_sample_format(codec) != AV_SAMPLE_FMT_NONE);
+}
+
+static AVCodecContext* freerdp_dsp_ffmpeg_open(FREERDP_DSP_CODEC* codec, BOOL encode)
+{
+	AVCodecContext* context;
+	const AVCodec* avcodec = freerdp_dsp_ffmpeg_find(codec->id, encode);
+
+	if (!avcodec || !(context = avcodec_alloc_context3(avcodec)))
+		return NULL;
+
+#if defined(DSP_FFMPEG_CH_LAYOUT)
+	av_channel_layout_default(&context->ch_layout, codec->format.nChannels);
+#else
+	context->channels = codec->format.nChannels;
+	context->channel_layout = av_get_default_channel_layout(context->channels);
+#endif
+	context->sample_rate = codec->format.nSamplesPerSec;
+	context->block_align = codec->format.nBlockAlign;
+
+	/* formats known only by their tag keep the default of the codec */
+	if (codec->format.nAvgBytesPerSec > 0)
+		context->bit_rate = codec->format.nAvgBytesPerSec * 8;
+
+	if (encode)
+	{
+		context->sample_fmt = freerdp_dsp_ffmpeg_sample_format(avcodec);
+		context->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+
+		if (codec->id == AV_CODEC_ID_AAC)
+			context->profile = AV_PROFILE_AAC_LOW;
+	}
+
+	if (avcodec_open2(context, avcodec, NULL) < 0)
+	{
+		WLog_ERR(TAG, "Failed to open the %s %s", avcodec->name, encode ? "encoder" : "decoder");
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(55, 69, 100)
+		avcodec_free_context(&context);
+#else
+		av_free(context);
+#endif
+		return NULL;
+	}
+
+	return context;
+}
+
+static BOOL freerdp_dsp_ffmpeg_open_encoder(FREERDP_DSP_CODEC* codec)
+{
+	if (!(codec->encoder = freerdp_dsp_ffmpeg_open(codec, TRUE)))
+		return FALSE;
+
+	if (!(codec->frame = av_frame_alloc()))
+		return FALSE;
+
+	/* encoders with variable frame sizes leave it to the caller */
+	codec->frame->nb_samples = (codec->encoder->frame_size > 0) ? codec->encoder->frame_size : 1024;
+	codec->frame->format = codec->encoder->sample_fmt;
+	codec->frame->sample_rate = codec->encoder->sample_rate;
+#if defined(DSP_FFMPEG_CH_LAYOUT)
+
+	if (av_channel_layout_copy(&codec->frame->ch_layout, &codec->encoder->ch_layout) < 0)
+		return FALSE;
+#else
+	codec->frame->channel_layout = codec->encoder->channel_layout;
+#endif
+
+	if (av_frame_get_buffer(codec->frame, 0) < 0)
+		return FALSE;
+
+	codec->pending = (BYTE*) malloc(codec->frame->nb_samples * codec->format.nChannels * 2);
+	return codec->pending != NULL;
+}
+
+static BOOL freerdp_dsp_ffmpeg_open_decoder(FREERDP_DSP_CODEC* codec)
+{
+	if (!(codec->decoder = freerdp_dsp_ffmpeg_open(codec, FALSE)))
+		return FALSE;
+
+	/* packets need not hold whole frames, without a parser they must */
+	codec->parser = av_parser_init(codec->id);
+	codec->decoded = av_frame_alloc();
+	return codec->decoded != NULL;
+}
+
+FREERDP_DSP_CODEC* freerdp_dsp_ffmpeg_new(const AUDIO_FORMAT* format)
+{
+	FREERDP_DSP_CODEC* codec = (FREERDP_DSP_CODEC*) calloc(1, sizeof(FREERDP_DSP_CODEC));
+
+	if (!codec)
+		return NULL;
+
+	codec->format = *format;
+	codec->format.cbSize = 0;
+	codec->format.data = NULL;
+	codec->id = freerdp_dsp_ffmpeg_codec_id(format->wFormatTag);
+
+	if ((codec->id == AV_CODEC_ID_NONE) || !(codec->packet = av_packet_alloc()))
+	{
+		freerdp_dsp_ffmpeg_free(codec);
+		return NULL;
+	}
+
+	return codec;
+}
+
+void freerdp_dsp_ffmpeg_free(FREERDP_DSP_CODEC* codec)
+{
+	if (!codec)
+		return;
+
+	if (codec->parser)
+		av_parser_close(codec->parser);
+
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(55, 69, 100)
+	avcodec_free_context(&codec->encoder);
+	avcodec_free_context(&codec->decoder);
+#else
+	if (codec->encoder)
+	{
+		avcodec_close(codec->encoder);
+		av_free(codec->encoder);
+	}
+
+	if (codec->decoder)
+	{
+		avcodec_close(codec->decoder);
+		av_free(codec->decoder);
+	}
+#endif
+	av_frame_free(&codec->frame);
+	av_frame_free(&codec->decoded);
+	av_packet_free(&codec->packet);
+	free(codec->pending);
+	free(codec);
+}
+
+static void freerdp_dsp_ffmpeg_fill_frame(AVFrame* frame, const BYTE* src, int channels)
+{
+	int i, c;
+
+	for (i = 0; i < frame->nb_samples; i++)
+	{
+		for (c = 0; c < channels; c++)
+		{
+			const BYTE* p = &src[(i * channels + c) * 2];
+			const INT16 sample = (INT16)(p[0] | (p[1] << 8));
+
+			switch (frame->format)
+			{
+				case AV_SAMPLE_FMT_S16:
+					((INT16*) frame->data[0])[i * channels + c] = sample;
+					break;
+
+				case AV_SAMPLE_FMT_S16P:
+					((INT16*) frame->data[c])[i] = sample;
+					break;
+
+				case AV_SAMPLE_FMT_FLT:
+					((float*) frame->data[0])[i * channels + c] = sample / 32768.0f;
+					break;
+
+				case AV_SAMPLE_FMT_FLTP:
+					((float*) frame->data[c])[i] = sample / 32768.0f;
+					break;
+			}
+		}
+	}
+}
+
+static INT16 freerdp_dsp_ffmpeg_float_sample(float value)
+{
+	const float sample = value * 32768.0f;
+
+	if (sample >= 32767.0f)
+		return 32767;
+
+	if (sample <= -32768.0f)
+		return -32768;
+
+	return (INT16) sample;
+}
+
+static BOOL freerdp_dsp_ffmpeg_write_frame(const AVFrame* frame, int channels, wStream* out)
+{
+	int i, c;
+	INT16 sample;
+
+	if (!Stream_EnsureRemainingCapacity(out, frame->nb_samples * channels * 2))
+		return FALSE;
+
+	for (i = 0; i < frame->nb_samples; i++)
+	{
+		for (c = 0; c < channels; c++)
+		{
+			switch (frame->format)
+			{
+				case AV_SAMPLE_FMT_S16:
+					sample = ((const INT16*) frame->data[0])[i * channels + c];
+					break;
+
+				case AV_SAMPLE_FMT_S16P:
+					sample = ((const INT16*) frame->extended_data[c])[i];
+					break;
+
+				case AV_SAMPLE_FMT_S32:
+					sample = (INT16)(((const INT32*) frame->data[0])[i * channels + c] >> 16);
+					break;
+
+				case AV_SAMPLE_FMT_S32P:
+					sample = (INT16)(((const INT32*) frame->extended_data[c])[i] >> 16);
+					break;
+
+				case AV_SAMPLE_FMT_FLT:
+					sample = freerdp_dsp_ffmpeg_float_sample(
+					             ((const float*) frame->data[0])[i * channels + c]);
+					break;
+
+				case AV_SAMPLE_FMT_FLTP:
+					sample = freerdp_dsp_ffmpeg_float_sample(((const float*) frame->extended_data[c])[i]);
+					break;
+
+				default:
+					WLog_ERR(TAG, "Unsupported sample format %d", frame->format);
+					return FALSE;
+			}
+
+			Stream_Write_UINT16(out, (UINT16) sample);
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL freerdp_dsp_ffmpeg_write_adts(FREERDP_DSP_CODEC* codec, size_t length, wStream* out)
+{
+	UINT32 index;
+	const size_t frameLength = length + DSP_FFMPEG_ADTS_HEADER_LENGTH;
+	const BYTE channels = (BYTE) codec->format.nChannels;
+
+	for (index = 0; index < ARRAYSIZE(adts_sample_rates); index++)
+	{
+		if (adts_sample_rates[index] == codec->format.nSamplesPerSec)
+			break;
+	}
+
+	if ((index == ARRAYSIZE(adts_sample_rates)) || (frameLength > 0x1FFF))
+		return FALSE;
+
+	/* MPEG-4, no CRC, AAC LC, one raw data block */
+	Stream_Write_UINT8(out, 0xFF);
+	Stream_Write_UINT8(out, 0xF1);
+	Stream_Write_UINT8(out, (BYTE)((1 << 6) | (index << 2) | (channels >> 2)));
+	Stream_Write_UINT8(out, (BYTE)(((channels & 0x03) << 6) | (frameLength >> 11)));
+	Stream_Write_UINT8(out, (BYTE)((frameLength >> 3) & 0xFF));
+	Stream_Write_UINT8(out, (BYTE)(((frameLength & 0x07) << 5) | 0x1F));
+	Stream_Write_UINT8(out, 0xFC);
+	return TRUE;
+}
+
+static BOOL freerdp_dsp_ffmpeg_receive_packets(FREERDP_DSP_CODEC* codec, wStream* out)
+{
+	for (;;)
+	{
+		BOOL rc = TRUE;
+		const int status = avcodec_receive_packet(codec->encoder, codec->packet);
+
+		if ((status == AVERROR(EAGAIN)) || (status == AVERROR_EOF))
+			return TRUE;
+
+		if (status < 0)
+			return FALSE;
+
+		if (!Stream_EnsureRemainingCapacity(out, codec->packet->size + DSP_FFMPEG_ADTS_HEADER_LENGTH))
+			rc = FALSE;
+		else if ((codec->id == AV_CODEC_ID_AAC) &&
+		         !freerdp_dsp_ffmpeg_write_adts(codec, codec->packet->size, out))
+			rc = FALSE;
+		else
+			Stream_Write(out, codec->packet->data, codec->packet->size);
+
+		av_packet_unref(codec->packet);
+
+		if (!rc)
+			return FALSE;
+	}
+}
+
+BOOL freerdp_dsp_ffmpeg_encode(FREERDP_DSP_CODEC* codec, const BYTE* data, size_t length,
+                               wStream* out)
+{
+	size_t frameLength;
+
+	if (!codec)
+		return FALSE;
+
+	if (!codec->encoder && !freerdp_dsp_ffmpeg_open_encoder(codec))
+		return FALSE;
+
+	/* the encoder takes whole frames, the rest waits for the next call */
+	frameLength = codec->frame->nb_samples * codec->format.nChannels * 2;
+
+	while (length > 0)
+	{
+		const size_t count = MIN(length, frameLength - codec->pendingLength);
+		CopyMemory(&codec->pending[codec->pendingLength], data, count);
+		codec->pendingLength += count;
+		data += count;
+		length -= count;
+
+		if (codec->pendingLength < frameLength)
+			break;
+
+		if (av_frame_make_writable(codec->frame) < 0)
+			return FALSE;
+
+		freerdp_dsp_ffmpeg_fill_frame(codec->frame, codec->pending, codec->format.nChannels);
+		codec->frame->pts = codec->pts;
+		codec->pts += codec->frame->nb_samples;
+		codec->pendingLength = 0;
+
+		if (avcodec_send_frame(codec->encoder, codec->frame) < 0)
+			return FALSE;
+
+		if (!freerdp_dsp_ffmpeg_receive_packets(codec, out))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL freerdp_dsp_ffmpeg_decode_packet(FREERDP_DSP_CODEC* codec, wStream* out)
+{
+	if (avcodec_send_packet(codec->decoder, codec->packet) < 0)
+		return FALSE;
+
+	for (;;)
+	{
+		const int status = avcodec_receive_frame(codec->decoder, codec->decoded);
+
+		if ((status == AVERROR(EAGAIN)) || (status == AVERROR_EOF))
+			return TRUE;
+
+		if (status < 0)
+			return FALSE;
+
+		if (!freerdp_dsp_ffmpeg_write_frame(codec->decoded, codec->format.nChannels, out))
+			return FALSE;
+	}
+}
+
+BOOL freerdp_dsp_ffmpeg_decode(FREERDP_DSP_CODEC* codec, const BYTE* data, size_t length,
+                               wStream* out)
+{
+	BOOL rc = TRUE;
+
+	if (!codec)
+		return FALSE;
+
+	if (!codec->decoder && !freerdp_dsp_ffmpeg_open_decoder(codec))
+		return FALSE;
+
+	while (rc && (length > 0))
+	{
+		if (codec->parser)
+		{
+			uint8_t* frame = NULL;
+			int frameLength = 0;
+			const int used = av_parser_parse2(codec->parser, codec->decoder, &frame, &frameLength,
+			                                  data, (int) length, AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+
+			if (used < 0)
+				return FALSE;
+
+			data += used;
+			length -= used;
+
+			if (frameLength == 0)
+				continue;
+
+			codec->packet->data = frame;
+			codec->packet->size = frameLength;
+		}
+		else
+		{
+			codec->packet->data = (uint8_t*) data;
+			codec->packet->size = (int) length;
+			length = 0;
+		}
+
+		rc = freerdp_dsp_ffmpeg_decode_packet(codec, out);
+		codec->packet->data = NULL;
+		codec->packet->size = 0;
+	}
+
+	return rc;
+}
+
+#else
+
+BOOL freerdp_dsp_ffmpeg_supports_format(const AUDIO_FORMAT* format, BOOL encode)
+{
+	return FALSE;
+}
+
+FREERDP_DSP_CODEC* freerdp_dsp_ffmpeg_new(const AUDIO_FORMAT* format)
+{
+	WLog_ERR(TAG, "libavcodec %s is too old for the audio codecs", LIBAVCODEC_IDENT);
+	return NULL;
+}
+
+void freerdp_dsp_ffmpeg_free(FREERDP_DSP_CODEC* codec)
+{
+}
+
+BOOL freerdp_dsp_ffmpeg_encode(FREERDP_DSP_CODEC* codec, const BYTE* data, size_t length,
+                               wStream* out)
+{
+	return FALSE;
+}
+
+BOOL freerdp_dsp_ffmpeg_decode(FREERDP_DSP_CODEC* codec, const BYTE* data, size_t length,
+                               wStream* out)
+{
+	return FALSE;
+}
+
+#endif
@@ -0,0 +1,34 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Digital Sound Processing - FFmpeg Audio Codecs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DSP_FFMPEG_H
+#define __DSP_FFMPEG_H
+
+#include <freerdp/codec/dsp.h>
+#include <freerdp/api.h>
+
+FREERDP_LOCAL BOOL freerdp_dsp_ffmpeg_supports_format(const AUDIO_FORMAT* format, BOOL encode);
+
+FREERDP_LOCAL FREERDP_DSP_CODEC* freerdp_dsp_ffmpeg_new(const AUDIO_FORMAT* format);
+FREERDP_LOCAL void freerdp_dsp_ffmpeg_free(FREERDP_DSP_CODEC* codec);
+
+FREERDP_LOCAL BOOL freerdp_dsp_ffmpeg_encode(FREERDP_DSP_CODEC* codec, const BYTE* data,
+        size_t length, wStream* out);
+FREERDP_LOCAL BOOL freerdp_dsp_ffmpeg_decode(FREERDP_DSP_CODEC* codec, const BYTE* data,
+        size_t length, wStream* out);
+
+#endif /* __DSP_FFMPEG_H */
@@ -0,0 +1,59 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Digital Sound Processing - NEON Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include "dsp_neon.h"
+
+/* The resampler pads the filters to a multiple of 8 taps */
+static INT32 dsp_resample_filter_neon(const INT16* samples, const INT16* coeffs, UINT32 taps)
+{
+	UINT32 k;
+	int32x2_t pair;
+	int32x4_t sum = vdupq_n_s32(0);
+
+	for (k = 0; k < taps; k += 8)
+	{
+		const int16x8_t x = vld1q_s16(&samples[k]);
+		const int16x8_t h = vld1q_s16(&coeffs[k]);
+		sum = vmlal_s16(sum, vget_low_s16(x), vget_low_s16(h));
+		sum = vmlal_s16(sum, vget_high_s16(x), vget_high_s16(h));
+	}
+
+	pair = vadd_s32(vget_low_s32(sum), vget_high_s32(sum));
+	pair = vpadd_s32(pair, pair);
+	return vget_lane_s32(pair, 0);
+}
+
+void dsp_init_neon(FREERDP_DSP_CONTEXT* context)
+{
+	if (!IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE))
+		return;
+
+	context->resample_filter = dsp_resample_filter_neon;
+}
+
+#endif /* __ARM_NEON__ */
@@ -0,0 +1,54 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Digital Sound Processing - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+#include "dsp_sse2.h"
+
+/* The resampler pads the filters to a multiple of 8 taps */
+static INT32 dsp_resample_filter_sse2(const INT16* samples, const INT16* coeffs, UINT32 taps)
+{
+	UINT32 k;
+	__m128i sum = _mm_setzero_si128();
+
+	for (k = 0; k < taps; k += 8)
+	{
+		const __m128i x = _mm_loadu_si128((const __m128i*) &samples[k]);
+		const __m128i h = _mm_loadu_si128((const __m128i*) &coeffs[k]);
+		sum = _mm_add_epi32(sum, _mm_madd_epi16(x, h));
+	}
+
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(sum);
+}
+
+void dsp_init_sse2(FREERDP_DSP_CONTEXT* context)
+{
+	if (!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+		return;
+
+	context->resample_filter = dsp_resample_filter_sse2;
+}
@@ -0,0 +1,32 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Digital Sound Processing - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DSP_SSE2_H
+#define __DSP_SSE2_H
+
+#include <freerdp/codec/dsp.h>
+#include <freerdp/api.h>
+
+FREERDP_LOCAL void dsp_init_sse2(FREERDP_DSP_CONTEXT* context);
+
+#ifdef WITH_SSE2
+#ifndef DSP_INIT_SIMD
+#define DSP_INIT_SIMD(_dsp_context) dsp_init_sse2(_dsp_context)
+#endif
+#endif
+
+#endif /* __DSP_SSE2_H */
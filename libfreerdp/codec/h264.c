@@ -29,6 +29,7 @@
 #include <freerdp/primitives.h>
 #include <freerdp/codec/h264.h>
 #include <freerdp/log.h>
+#include <freerdp/utils/metrics.h>
 
 #define TAG FREERDP_TAG("codec")
 
@@ -1571,6 +1572,7 @@ INT32 avc420_decompress(H264_CONTEXT* h264, const BYTE* pSrcData, UINT32 SrcSize
                         RECTANGLE_16* regionRects, UINT32 numRegionRects)
 {
 	int status;
+	const UINT64 start = freerdp_metrics_now();
 
 	if (!h264)
 		return -1001;
@@ -1587,6 +1589,7 @@ INT32 avc420_decompress(H264_CONTEXT* h264, const BYTE* pSrcData, UINT32 SrcSize
 	                    nDstHeight, nDstStep, pDstData, DstFormat, FALSE))
 		return -1002;
 
+	freerdp_metric_record_since(FREERDP_METRIC_H264_DECODE_TIME, start);
 	return 1;
 }
 
@@ -1600,6 +1603,7 @@ INT32 avc420_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
 	primitives_t* prims = primitives_get();
 	UINT32* iStride;
 	BYTE** pYUVData;
+	const UINT64 start = freerdp_metrics_now();
 
 	if (!h264)
 		return -1;
@@ -1631,6 +1635,10 @@ INT32 avc420_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
 	prims->RGBToYUV420_8u_P3AC4R(pSrcData, SrcFormat, nSrcStep, pYUVData, iStride,
 	                             &roi);
 	status = h264->subsystem->Compress(h264, ppDstData, pDstSize);
+
+	if (status >= 0)
+		freerdp_metric_record_since(FREERDP_METRIC_H264_ENCODE_TIME, start);
+
 	_aligned_free(pYUVData[2]);
 	pYUVData[2] = NULL;
 error_2:
@@ -1792,6 +1800,7 @@ INT32 avc444_decompress(H264_CONTEXT* h264, BYTE op,
                         UINT32 nDstStep, UINT32 nDstWidth, UINT32 nDstHeight)
 {
 	INT32 status = -1;
+	const UINT64 start = freerdp_metrics_now();
 
 	if (!h264 || !regionRects ||
 	    !pSrcData || !pDstData)
@@ -1838,6 +1847,9 @@ INT32 avc444_decompress(H264_CONTEXT* h264, BYTE op,
 			break;
 	}
 
+	if (status >= 0)
+		freerdp_metric_record_since(FREERDP_METRIC_H264_DECODE_TIME, start);
+
 #if defined(AVC444_FRAME_STAT)
 
 	switch (op)
@@ -25,139 +25,24 @@
  * Write a foreground/background image to a destination buffer.
  */
 static INLINE BYTE* WRITEFGBGIMAGE(BYTE* pbDest, UINT32 rowDelta,
-                                   BYTE bitmask, PIXEL fgPel, INT32 cBits)
+                                   BYTE bitmask, PIXEL fgPel, UINT32 cBits)
 {
+	UINT32 x;
 	PIXEL xorPixel;
-	DESTREADPIXEL(xorPixel, pbDest - rowDelta);
 
-	if (bitmask & g_MaskBit0)
+	/* runs of background pixels are common in text, they are plain copies */
+	if ((bitmask == 0) && (cBits == 8))
 	{
-		DESTWRITEPIXEL(pbDest, xorPixel ^ fgPel);
+		rle_copy_above(pbDest, rowDelta, 8 * DESTSIZE);
+		return pbDest + 8 * DESTSIZE;
 	}
-	else
-	{
-		DESTWRITEPIXEL(pbDest, xorPixel);
-	}
-
-	DESTNEXTPIXEL(pbDest);
-	cBits = cBits - 1;
 
-	if (cBits > 0)
+	for (x = 0; x < cBits; x++)
 	{
+		const PIXEL mask = fgPel & (0 - (PIXEL)((bitmask >> x) & 1));
 		DESTREADPIXEL(xorPixel, pbDest - rowDelta);
-
-		if (bitmask & g_MaskBit1)
-		{
-			DESTWRITEPIXEL(pbDest, xorPixel ^ fgPel);
-		}
-		else
-		{
-			DESTWRITEPIXEL(pbDest, xorPixel);
-		}
-
+		DESTWRITEPIXEL(pbDest, xorPixel ^ mask);
 		DESTNEXTPIXEL(pbDest);
-		cBits = cBits - 1;
-
-		if (cBits > 0)
-		{
-			DESTREADPIXEL(xorPixel, pbDest - rowDelta);
-
-			if (bitmask & g_MaskBit2)
-			{
-				DESTWRITEPIXEL(pbDest, xorPixel ^ fgPel);
-			}
-			else
-			{
-				DESTWRITEPIXEL(pbDest, xorPixel);
-			}
-
-			DESTNEXTPIXEL(pbDest);
-			cBits = cBits - 1;
-
-			if (cBits > 0)
-			{
-				DESTREADPIXEL(xorPixel, pbDest - rowDelta);
-
-				if (bitmask & g_MaskBit3)
-				{
-					DESTWRITEPIXEL(pbDest, xorPixel ^ fgPel);
-				}
-				else
-				{
-					DESTWRITEPIXEL(pbDest, xorPixel);
-				}
-
-				DESTNEXTPIXEL(pbDest);
-				cBits = cBits - 1;
-
-				if (cBits > 0)
-				{
-					DESTREADPIXEL(xorPixel, pbDest - rowDelta);
-
-					if (bitmask & g_MaskBit4)
-					{
-						DESTWRITEPIXEL(pbDest, xorPixel ^ fgPel);
-					}
-					else
-					{
-						DESTWRITEPIXEL(pbDest, xorPixel);
-					}
-
-					DESTNEXTPIXEL(pbDest);
-					cBits = cBits - 1;
-
-					if (cBits > 0)
-					{
-						DESTREADPIXEL(xorPixel, pbDest - rowDelta);
-
-						if (bitmask & g_MaskBit5)
-						{
-							DESTWRITEPIXEL(pbDest, xorPixel ^ fgPel);
-						}
-						else
-						{
-							DESTWRITEPIXEL(pbDest, xorPixel);
-						}
-
-						DESTNEXTPIXEL(pbDest);
-						cBits = cBits - 1;
-
-						if (cBits > 0)
-						{
-							DESTREADPIXEL(xorPixel, pbDest - rowDelta);
-
-							if (bitmask & g_MaskBit6)
-							{
-								DESTWRITEPIXEL(pbDest, xorPixel ^ fgPel);
-							}
-							else
-							{
-								DESTWRITEPIXEL(pbDest, xorPixel);
-							}
-
-							DESTNEXTPIXEL(pbDest);
-							cBits = cBits - 1;
-
-							if (cBits > 0)
-							{
-								DESTREADPIXEL(xorPixel, pbDest - rowDelta);
-
-								if (bitmask & g_MaskBit7)
-								{
-									DESTWRITEPIXEL(pbDest, xorPixel ^ fgPel);
-								}
-								else
-								{
-									DESTWRITEPIXEL(pbDest, xorPixel);
-								}
-
-								DESTNEXTPIXEL(pbDest);
-							}
-						}
-					}
-				}
-			}
-		}
 	}
 
 	return pbDest;
@@ -170,120 +55,12 @@ static INLINE BYTE* WRITEFGBGIMAGE(BYTE* pbDest, UINT32 rowDelta,
 static INLINE BYTE* WRITEFIRSTLINEFGBGIMAGE(BYTE* pbDest, BYTE bitmask,
         PIXEL fgPel, UINT32 cBits)
 {
-	if (bitmask & g_MaskBit0)
-	{
-		DESTWRITEPIXEL(pbDest, fgPel);
-	}
-	else
-	{
-		DESTWRITEPIXEL(pbDest, BLACK_PIXEL);
-	}
-
-	DESTNEXTPIXEL(pbDest);
-	cBits = cBits - 1;
+	UINT32 x;
 
-	if (cBits > 0)
+	for (x = 0; x < cBits; x++)
 	{
-		if (bitmask & g_MaskBit1)
-		{
-			DESTWRITEPIXEL(pbDest, fgPel);
-		}
-		else
-		{
-			DESTWRITEPIXEL(pbDest, BLACK_PIXEL);
-		}
-
+		DESTWRITEPIXEL(pbDest, fgPel & (0 - (PIXEL)((bitmask >> x) & 1)));
 		DESTNEXTPIXEL(pbDest);
-		cBits = cBits - 1;
-
-		if (cBits > 0)
-		{
-			if (bitmask & g_MaskBit2)
-			{
-				DESTWRITEPIXEL(pbDest, fgPel);
-			}
-			else
-			{
-				DESTWRITEPIXEL(pbDest, BLACK_PIXEL);
-			}
-
-			DESTNEXTPIXEL(pbDest);
-			cBits = cBits - 1;
-
-			if (cBits > 0)
-			{
-				if (bitmask & g_MaskBit3)
-				{
-					DESTWRITEPIXEL(pbDest, fgPel);
-				}
-				else
-				{
-					DESTWRITEPIXEL(pbDest, BLACK_PIXEL);
-				}
-
-				DESTNEXTPIXEL(pbDest);
-				cBits = cBits - 1;
-
-				if (cBits > 0)
-				{
-					if (bitmask & g_MaskBit4)
-					{
-						DESTWRITEPIXEL(pbDest, fgPel);
-					}
-					else
-					{
-						DESTWRITEPIXEL(pbDest, BLACK_PIXEL);
-					}
-
-					DESTNEXTPIXEL(pbDest);
-					cBits = cBits - 1;
-
-					if (cBits > 0)
-					{
-						if (bitmask & g_MaskBit5)
-						{
-							DESTWRITEPIXEL(pbDest, fgPel);
-						}
-						else
-						{
-							DESTWRITEPIXEL(pbDest, BLACK_PIXEL);
-						}
-
-						DESTNEXTPIXEL(pbDest);
-						cBits = cBits - 1;
-
-						if (cBits > 0)
-						{
-							if (bitmask & g_MaskBit6)
-							{
-								DESTWRITEPIXEL(pbDest, fgPel);
-							}
-							else
-							{
-								DESTWRITEPIXEL(pbDest, BLACK_PIXEL);
-							}
-
-							DESTNEXTPIXEL(pbDest);
-							cBits = cBits - 1;
-
-							if (cBits > 0)
-							{
-								if (bitmask & g_MaskBit7)
-								{
-									DESTWRITEPIXEL(pbDest, fgPel);
-								}
-								else
-								{
-									DESTWRITEPIXEL(pbDest, BLACK_PIXEL);
-								}
-
-								DESTNEXTPIXEL(pbDest);
-							}
-						}
-					}
-				}
-			}
-		}
 	}
 
 	return pbDest;
@@ -291,14 +68,18 @@ static INLINE BYTE* WRITEFIRSTLINEFGBGIMAGE(BYTE* pbDest, BYTE bitmask,
 
 /**
  * Decompress an RLE compressed bitmap.
+ *
+ * Runs are expanded with the word wide helpers above, every order is checked
+ * against the end of the source and the destination buffer first.
  */
-static INLINE void RLEDECOMPRESS(const BYTE* pbSrcBuffer, UINT32 cbSrcBuffer,
+static INLINE BOOL RLEDECOMPRESS(const BYTE* pbSrcBuffer, UINT32 cbSrcBuffer,
                                  BYTE* pbDestBuffer,
                                  UINT32 rowDelta, UINT32 width, UINT32 height)
 {
 	const BYTE* pbSrc = pbSrcBuffer;
 	const BYTE* pbEnd = pbSrcBuffer + cbSrcBuffer;
 	BYTE* pbDest = pbDestBuffer;
+	const BYTE* pbDestEnd = pbDestBuffer + (size_t) rowDelta * height;
 	PIXEL temp;
 	PIXEL fgPel = WHITE_PIXEL;
 	BOOL fInsertFgPel = FALSE;
@@ -308,6 +89,7 @@ static INLINE void RLEDECOMPRESS(const BYTE* pbSrcBuffer, UINT32 cbSrcBuffer,
 	UINT32 runLength;
 	UINT32 code;
 	UINT32 advance;
+	BYTE pattern[RLE_PATTERN_SIZE];
 	RLEEXTRA
 
 	while (pbSrc < pbEnd)
@@ -331,61 +113,36 @@ static INLINE void RLEDECOMPRESS(const BYTE* pbSrcBuffer, UINT32 cbSrcBuffer,
 		/* Handle Background Run Orders. */
 		if (code == REGULAR_BG_RUN || code == MEGA_MEGA_BG_RUN)
 		{
-			runLength = ExtractRunLength(code, pbSrc, &advance);
+			if (!ExtractRunLength(code, pbSrc, pbEnd, &runLength, &advance))
+				return FALSE;
+
 			pbSrc = pbSrc + advance;
 
-			if (fFirstLine)
+			if (!rle_check_dest(pbDest, pbDestEnd, runLength, DESTSIZE))
+				return FALSE;
+
+			if (fInsertFgPel && (runLength > 0))
 			{
-				if (fInsertFgPel)
+				if (fFirstLine)
 				{
 					DESTWRITEPIXEL(pbDest, fgPel);
-					DESTNEXTPIXEL(pbDest);
-					runLength = runLength - 1;
 				}
-
-				while (runLength >= UNROLL_COUNT)
-				{
-					UNROLL(
-					    DESTWRITEPIXEL(pbDest, BLACK_PIXEL);
-					    DESTNEXTPIXEL(pbDest););
-					runLength = runLength - UNROLL_COUNT;
-				}
-
-				while (runLength > 0)
-				{
-					DESTWRITEPIXEL(pbDest, BLACK_PIXEL);
-					DESTNEXTPIXEL(pbDest);
-					runLength = runLength - 1;
-				}
-			}
-			else
-			{
-				if (fInsertFgPel)
+				else
 				{
 					DESTREADPIXEL(temp, pbDest - rowDelta);
 					DESTWRITEPIXEL(pbDest, temp ^ fgPel);
-					DESTNEXTPIXEL(pbDest);
-					runLength = runLength - 1;
 				}
 
-				while (runLength >= UNROLL_COUNT)
-				{
-					UNROLL(
-					    DESTREADPIXEL(temp, pbDest - rowDelta);
-					    DESTWRITEPIXEL(pbDest, temp);
-					    DESTNEXTPIXEL(pbDest););
-					runLength = runLength - UNROLL_COUNT;
-				}
-
-				while (runLength > 0)
-				{
-					DESTREADPIXEL(temp, pbDest - rowDelta);
-					DESTWRITEPIXEL(pbDest, temp);
-					DESTNEXTPIXEL(pbDest);
-					runLength = runLength - 1;
-				}
+				DESTNEXTPIXEL(pbDest);
+				runLength = runLength - 1;
 			}
 
+			if (fFirstLine)
+				ZeroMemory(pbDest, runLength * DESTSIZE);
+			else
+				rle_copy_above(pbDest, rowDelta, runLength * DESTSIZE);
+
+			pbDest += runLength * DESTSIZE;
 			/* A follow-on background run order will need a foreground pel inserted. */
 			fInsertFgPel = TRUE;
 			continue;
@@ -402,108 +159,71 @@ static INLINE void RLEDECOMPRESS(const BYTE* pbSrcBuffer, UINT32 cbSrcBuffer,
 			case MEGA_MEGA_FG_RUN:
 			case LITE_SET_FG_FG_RUN:
 			case MEGA_MEGA_SET_FG_RUN:
-				runLength = ExtractRunLength(code, pbSrc, &advance);
+				if (!ExtractRunLength(code, pbSrc, pbEnd, &runLength, &advance))
+					return FALSE;
+
 				pbSrc = pbSrc + advance;
 
 				if (code == LITE_SET_FG_FG_RUN || code == MEGA_MEGA_SET_FG_RUN)
 				{
+					if (!rle_check_src(pbSrc, pbEnd, DESTSIZE))
+						return FALSE;
+
 					SRCREADPIXEL(fgPel, pbSrc);
 					SRCNEXTPIXEL(pbSrc);
 				}
 
-				if (fFirstLine)
-				{
-					while (runLength >= UNROLL_COUNT)
-					{
-						UNROLL(
-						    DESTWRITEPIXEL(pbDest, fgPel);
-						    DESTNEXTPIXEL(pbDest););
-						runLength = runLength - UNROLL_COUNT;
-					}
+				if (!rle_check_dest(pbDest, pbDestEnd, runLength, DESTSIZE))
+					return FALSE;
 
-					while (runLength > 0)
-					{
-						DESTWRITEPIXEL(pbDest, fgPel);
-						DESTNEXTPIXEL(pbDest);
-						runLength = runLength - 1;
-					}
-				}
-				else
-				{
-					while (runLength >= UNROLL_COUNT)
-					{
-						UNROLL(
-						    DESTREADPIXEL(temp, pbDest - rowDelta);
-						    DESTWRITEPIXEL(pbDest, temp ^ fgPel);
-						    DESTNEXTPIXEL(pbDest););
-						runLength = runLength - UNROLL_COUNT;
-					}
+				rle_pattern(pattern, fgPel, fgPel, DESTSIZE);
 
-					while (runLength > 0)
-					{
-						DESTREADPIXEL(temp, pbDest - rowDelta);
-						DESTWRITEPIXEL(pbDest, temp ^ fgPel);
-						DESTNEXTPIXEL(pbDest);
-						runLength = runLength - 1;
-					}
-				}
+				if (fFirstLine)
+					rle_fill(pbDest, pattern, runLength * DESTSIZE);
+				else
+					rle_xor_above(pbDest, rowDelta, pattern, runLength * DESTSIZE);
 
+				pbDest += runLength * DESTSIZE;
 				break;
 
 			/* Handle Dithered Run Orders. */
 			case LITE_DITHERED_RUN:
 			case MEGA_MEGA_DITHERED_RUN:
-				runLength = ExtractRunLength(code, pbSrc, &advance);
+				if (!ExtractRunLength(code, pbSrc, pbEnd, &runLength, &advance))
+					return FALSE;
+
 				pbSrc = pbSrc + advance;
+
+				if (!rle_check_src(pbSrc, pbEnd, 2 * DESTSIZE) ||
+				    !rle_check_dest(pbDest, pbDestEnd, 2 * runLength, DESTSIZE))
+					return FALSE;
+
 				SRCREADPIXEL(pixelA, pbSrc);
 				SRCNEXTPIXEL(pbSrc);
 				SRCREADPIXEL(pixelB, pbSrc);
 				SRCNEXTPIXEL(pbSrc);
-
-				while (runLength >= UNROLL_COUNT)
-				{
-					UNROLL(
-					    DESTWRITEPIXEL(pbDest, pixelA);
-					    DESTNEXTPIXEL(pbDest);
-					    DESTWRITEPIXEL(pbDest, pixelB);
-					    DESTNEXTPIXEL(pbDest););
-					runLength = runLength - UNROLL_COUNT;
-				}
-
-				while (runLength > 0)
-				{
-					DESTWRITEPIXEL(pbDest, pixelA);
-					DESTNEXTPIXEL(pbDest);
-					DESTWRITEPIXEL(pbDest, pixelB);
-					DESTNEXTPIXEL(pbDest);
-					runLength = runLength - 1;
-				}
-
+				rle_pattern(pattern, pixelA, pixelB, DESTSIZE);
+				rle_fill(pbDest, pattern, 2 * runLength * DESTSIZE);
+				pbDest += 2 * runLength * DESTSIZE;
 				break;
 
 			/* Handle Color Run Orders. */
 			case REGULAR_COLOR_RUN:
 			case MEGA_MEGA_COLOR_RUN:
-				runLength = ExtractRunLength(code, pbSrc, &advance);
-				pbSrc = pbSrc + advance;
-				SRCREADPIXEL(pixelA, pbSrc);
-				SRCNEXTPIXEL(pbSrc);
+				if (!ExtractRunLength(code, pbSrc, pbEnd, &runLength, &advance))
+					return FALSE;
 
-				while (runLength >= UNROLL_COUNT)
-				{
-					UNROLL(
-					    DESTWRITEPIXEL(pbDest, pixelA);
-					    DESTNEXTPIXEL(pbDest););
-					runLength = runLength - UNROLL_COUNT;
-				}
+				pbSrc = pbSrc + advance;
 
-				while (runLength > 0)
-				{
-					DESTWRITEPIXEL(pbDest, pixelA);
-					DESTNEXTPIXEL(pbDest);
-					runLength = runLength - 1;
-				}
+				if (!rle_check_src(pbSrc, pbEnd, DESTSIZE) ||
+				    !rle_check_dest(pbDest, pbDestEnd, runLength, DESTSIZE))
+					return FALSE;
 
+				SRCREADPIXEL(pixelA, pbSrc);
+				SRCNEXTPIXEL(pbSrc);
+				rle_pattern(pattern, pixelA, pixelA, DESTSIZE);
+				rle_fill(pbDest, pattern, runLength * DESTSIZE);
+				pbDest += runLength * DESTSIZE;
 				break;
 
 			/* Handle Foreground/Background Image Orders. */
@@ -511,15 +231,24 @@ static INLINE void RLEDECOMPRESS(const BYTE* pbSrcBuffer, UINT32 cbSrcBuffer,
 			case MEGA_MEGA_FGBG_IMAGE:
 			case LITE_SET_FG_FGBG_IMAGE:
 			case MEGA_MEGA_SET_FGBG_IMAGE:
-				runLength = ExtractRunLength(code, pbSrc, &advance);
+				if (!ExtractRunLength(code, pbSrc, pbEnd, &runLength, &advance))
+					return FALSE;
+
 				pbSrc = pbSrc + advance;
 
 				if (code == LITE_SET_FG_FGBG_IMAGE || code == MEGA_MEGA_SET_FGBG_IMAGE)
 				{
+					if (!rle_check_src(pbSrc, pbEnd, DESTSIZE))
+						return FALSE;
+
 					SRCREADPIXEL(fgPel, pbSrc);
 					SRCNEXTPIXEL(pbSrc);
 				}
 
+				if (!rle_check_src(pbSrc, pbEnd, (runLength + 7) / 8) ||
+				    !rle_check_dest(pbDest, pbDestEnd, runLength, DESTSIZE))
+					return FALSE;
+
 				if (fFirstLine)
 				{
 					while (runLength > 8)
@@ -561,34 +290,28 @@ static INLINE void RLEDECOMPRESS(const BYTE* pbSrcBuffer, UINT32 cbSrcBuffer,
 			/* Handle Color Image Orders. */
 			case REGULAR_COLOR_IMAGE:
 			case MEGA_MEGA_COLOR_IMAGE:
-				runLength = ExtractRunLength(code, pbSrc, &advance);
-				pbSrc = pbSrc + advance;
+				if (!ExtractRunLength(code, pbSrc, pbEnd, &runLength, &advance))
+					return FALSE;
 
-				while (runLength >= UNROLL_COUNT)
-				{
-					UNROLL(
-					    SRCREADPIXEL(temp, pbSrc);
-					    SRCNEXTPIXEL(pbSrc);
-					    DESTWRITEPIXEL(pbDest, temp);
-					    DESTNEXTPIXEL(pbDest););
-					runLength = runLength - UNROLL_COUNT;
-				}
+				pbSrc = pbSrc + advance;
 
-				while (runLength > 0)
-				{
-					SRCREADPIXEL(temp, pbSrc);
-					SRCNEXTPIXEL(pbSrc);
-					DESTWRITEPIXEL(pbDest, temp);
-					DESTNEXTPIXEL(pbDest);
-					runLength = runLength - 1;
-				}
+				if (!rle_check_src(pbSrc, pbEnd, runLength * DESTSIZE) ||
+				    !rle_check_dest(pbDest, pbDestEnd, runLength, DESTSIZE))
+					return FALSE;
 
+				/* source and destination pixels have the same size */
+				CopyMemory(pbDest, pbSrc, runLength * DESTSIZE);
+				pbSrc += runLength * DESTSIZE;
+				pbDest += runLength * DESTSIZE;
 				break;
 
 			/* Handle Special Order 1. */
 			case SPECIAL_FGBG_1:
 				pbSrc = pbSrc + 1;
 
+				if (!rle_check_dest(pbDest, pbDestEnd, 8, DESTSIZE))
+					return FALSE;
+
 				if (fFirstLine)
 				{
 					pbDest = WRITEFIRSTLINEFGBGIMAGE(pbDest, g_MaskSpecialFgBg1, fgPel, 8);
@@ -604,6 +327,9 @@ static INLINE void RLEDECOMPRESS(const BYTE* pbSrcBuffer, UINT32 cbSrcBuffer,
 			case SPECIAL_FGBG_2:
 				pbSrc = pbSrc + 1;
 
+				if (!rle_check_dest(pbDest, pbDestEnd, 8, DESTSIZE))
+					return FALSE;
+
 				if (fFirstLine)
 				{
 					pbDest = WRITEFIRSTLINEFGBGIMAGE(pbDest, g_MaskSpecialFgBg2, fgPel, 8);
@@ -618,6 +344,10 @@ static INLINE void RLEDECOMPRESS(const BYTE* pbSrcBuffer, UINT32 cbSrcBuffer,
 			/* Handle White Order. */
 			case SPECIAL_WHITE:
 				pbSrc = pbSrc + 1;
+
+				if (!rle_check_dest(pbDest, pbDestEnd, 1, DESTSIZE))
+					return FALSE;
+
 				DESTWRITEPIXEL(pbDest, WHITE_PIXEL);
 				DESTNEXTPIXEL(pbDest);
 				break;
@@ -625,9 +355,19 @@ static INLINE void RLEDECOMPRESS(const BYTE* pbSrcBuffer, UINT32 cbSrcBuffer,
 			/* Handle Black Order. */
 			case SPECIAL_BLACK:
 				pbSrc = pbSrc + 1;
+
+				if (!rle_check_dest(pbDest, pbDestEnd, 1, DESTSIZE))
+					return FALSE;
+
 				DESTWRITEPIXEL(pbDest, BLACK_PIXEL);
 				DESTNEXTPIXEL(pbDest);
 				break;
+
+			default:
+				WLog_ERR(TAG, "invalid RLE order 0x%02"PRIX8"", *pbSrc);
+				return FALSE;
 		}
 	}
+
+	return TRUE;
 }
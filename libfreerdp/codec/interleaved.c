@@ -27,6 +27,7 @@
 
 #include <freerdp/codec/interleaved.h>
 #include <freerdp/log.h>
+#include <freerdp/utils/metrics.h>
 
 #define TAG FREERDP_TAG("codec")
 
@@ -63,15 +64,6 @@
 
 typedef UINT32 PIXEL;
 
-static const BYTE g_MaskBit0 = 0x01; /* Least significant bit */
-static const BYTE g_MaskBit1 = 0x02;
-static const BYTE g_MaskBit2 = 0x04;
-static const BYTE g_MaskBit3 = 0x08;
-static const BYTE g_MaskBit4 = 0x10;
-static const BYTE g_MaskBit5 = 0x20;
-static const BYTE g_MaskBit6 = 0x40;
-static const BYTE g_MaskBit7 = 0x80; /* Most significant bit */
-
 static const BYTE g_MaskSpecialFgBg1 = 0x03;
 static const BYTE g_MaskSpecialFgBg2 = 0x05;
 
@@ -108,42 +100,47 @@ static INLINE UINT32 ExtractCodeId(BYTE bOrderHdr)
 /**
  * Extract the run length of a compression order.
  */
-static INLINE UINT32 ExtractRunLength(UINT32 code, const BYTE* pbOrderHdr,
-                                      UINT32* advance)
+static INLINE BOOL ExtractRunLength(UINT32 code, const BYTE* pbOrderHdr, const BYTE* pbEnd,
+                                    UINT32* runLength, UINT32* advance)
 {
-	UINT32 runLength;
-	UINT32 ladvance;
-	ladvance = 1;
-	runLength = 0;
+	UINT32 ladvance = 1;
+	UINT32 length = 0;
+	const size_t available = pbEnd - pbOrderHdr;
 
 	switch (code)
 	{
 		case REGULAR_FGBG_IMAGE:
-			runLength = (*pbOrderHdr) & g_MaskRegularRunLength;
+			length = (*pbOrderHdr) & g_MaskRegularRunLength;
 
-			if (runLength == 0)
+			if (length == 0)
 			{
-				runLength = (*(pbOrderHdr + 1)) + 1;
+				if (available < 2)
+					return FALSE;
+
+				length = (*(pbOrderHdr + 1)) + 1;
 				ladvance += 1;
 			}
 			else
 			{
-				runLength = runLength * 8;
+				length = length * 8;
 			}
 
 			break;
 
 		case LITE_SET_FG_FGBG_IMAGE:
-			runLength = (*pbOrderHdr) & g_MaskLiteRunLength;
+			length = (*pbOrderHdr) & g_MaskLiteRunLength;
 
-			if (runLength == 0)
+			if (length == 0)
 			{
-				runLength = (*(pbOrderHdr + 1)) + 1;
+				if (available < 2)
+					return FALSE;
+
+				length = (*(pbOrderHdr + 1)) + 1;
 				ladvance += 1;
 			}
 			else
 			{
-				runLength = runLength * 8;
+				length = length * 8;
 			}
 
 			break;
@@ -152,12 +149,15 @@ static INLINE UINT32 ExtractRunLength(UINT32 code, const BYTE* pbOrderHdr,
 		case REGULAR_FG_RUN:
 		case REGULAR_COLOR_RUN:
 		case REGULAR_COLOR_IMAGE:
-			runLength = (*pbOrderHdr) & g_MaskRegularRunLength;
+			length = (*pbOrderHdr) & g_MaskRegularRunLength;
 
-			if (runLength == 0)
+			if (length == 0)
 			{
+				if (available < 2)
+					return FALSE;
+
 				/* An extended (MEGA) run. */
-				runLength = (*(pbOrderHdr + 1)) + 32;
+				length = (*(pbOrderHdr + 1)) + 32;
 				ladvance += 1;
 			}
 
@@ -165,12 +165,15 @@ static INLINE UINT32 ExtractRunLength(UINT32 code, const BYTE* pbOrderHdr,
 
 		case LITE_SET_FG_FG_RUN:
 		case LITE_DITHERED_RUN:
-			runLength = (*pbOrderHdr) & g_MaskLiteRunLength;
+			length = (*pbOrderHdr) & g_MaskLiteRunLength;
 
-			if (runLength == 0)
+			if (length == 0)
 			{
+				if (available < 2)
+					return FALSE;
+
 				/* An extended (MEGA) run. */
-				runLength = (*(pbOrderHdr + 1)) + 16;
+				length = (*(pbOrderHdr + 1)) + 16;
 				ladvance += 1;
 			}
 
@@ -184,17 +187,112 @@ static INLINE UINT32 ExtractRunLength(UINT32 code, const BYTE* pbOrderHdr,
 		case MEGA_MEGA_FGBG_IMAGE:
 		case MEGA_MEGA_SET_FGBG_IMAGE:
 		case MEGA_MEGA_COLOR_IMAGE:
-			runLength = ((UINT16) pbOrderHdr[1]) | ((UINT16)(pbOrderHdr[2] << 8));
+			if (available < 3)
+				return FALSE;
+
+			length = ((UINT16) pbOrderHdr[1]) | ((UINT16)(pbOrderHdr[2] << 8));
 			ladvance += 2;
 			break;
+
+		default:
+			return FALSE;
 	}
 
+	*runLength = length;
 	*advance = ladvance;
-	return runLength;
+	return TRUE;
+}
+
+static INLINE BOOL rle_check_src(const BYTE* pbSrc, const BYTE* pbEnd, size_t length)
+{
+	return (size_t)(pbEnd - pbSrc) >= length;
+}
+
+static INLINE BOOL rle_check_dest(const BYTE* pbDest, const BYTE* pbDestEnd, size_t pixels,
+                                  size_t size)
+{
+	return (size_t)(pbDestEnd - pbDest) >= pixels * size;
+}
+
+/* 24 bytes hold a whole number of 1, 2, 3, 4 and 6 byte patterns */
+#define RLE_PATTERN_SIZE 24
+
+/**
+ * Repeats the pixels a and b, each size bytes wide, over a pattern that the
+ * run helpers store 8 bytes at a time.
+ */
+static INLINE void rle_pattern(BYTE* pattern, PIXEL a, PIXEL b, UINT32 size)
+{
+	UINT32 x, y;
+
+	for (x = 0; x < RLE_PATTERN_SIZE; x += 2 * size)
+	{
+		for (y = 0; y < size; y++)
+		{
+			pattern[x + y] = (BYTE)(a >> (8 * y));
+			pattern[x + size + y] = (BYTE)(b >> (8 * y));
+		}
+	}
 }
 
-#define UNROLL_COUNT 4
-#define UNROLL(_exp) do { _exp _exp _exp _exp } while (0)
+static INLINE void rle_fill(BYTE* pbDest, const BYTE* pattern, size_t length)
+{
+	while (length >= RLE_PATTERN_SIZE)
+	{
+		CopyMemory(pbDest, pattern, RLE_PATTERN_SIZE);
+		pbDest += RLE_PATTERN_SIZE;
+		length -= RLE_PATTERN_SIZE;
+	}
+
+	CopyMemory(pbDest, pattern, length);
+}
+
+/**
+ * A run longer than a row reads pixels it has just written itself,
+ * so the row above is processed at most one row at a time.
+ */
+static INLINE void rle_copy_above(BYTE* pbDest, size_t rowDelta, size_t length)
+{
+	while (length > 0)
+	{
+		const size_t chunk = MIN(length, rowDelta);
+		CopyMemory(pbDest, pbDest - rowDelta, chunk);
+		pbDest += chunk;
+		length -= chunk;
+	}
+}
+
+static INLINE void rle_xor_above(BYTE* pbDest, size_t rowDelta, const BYTE* pattern,
+                                 size_t length)
+{
+	while (length > 0)
+	{
+		size_t x;
+		size_t chunk = MIN(length, rowDelta);
+		const BYTE* pbAbove = pbDest - rowDelta;
+		length -= chunk;
+
+		for (; chunk >= RLE_PATTERN_SIZE; chunk -= RLE_PATTERN_SIZE)
+		{
+			for (x = 0; x < RLE_PATTERN_SIZE; x += 8)
+			{
+				UINT64 above, value;
+				CopyMemory(&above, &pbAbove[x], 8);
+				CopyMemory(&value, &pattern[x], 8);
+				value ^= above;
+				CopyMemory(&pbDest[x], &value, 8);
+			}
+
+			pbDest += RLE_PATTERN_SIZE;
+			pbAbove += RLE_PATTERN_SIZE;
+		}
+
+		for (x = 0; x < chunk; x++)
+			pbDest[x] = pbAbove[x] ^ pattern[x];
+
+		pbDest += chunk;
+	}
+}
 
 #undef DESTWRITEPIXEL
 #undef DESTREADPIXEL
@@ -205,6 +303,8 @@ static INLINE UINT32 ExtractRunLength(UINT32 code, const BYTE* pbOrderHdr,
 #undef WRITEFIRSTLINEFGBGIMAGE
 #undef RLEDECOMPRESS
 #undef RLEEXTRA
+#undef DESTSIZE
+#define DESTSIZE 1
 #define DESTWRITEPIXEL(_buf, _pix) (_buf)[0] = (BYTE)(_pix)
 #define DESTREADPIXEL(_pix, _buf) _pix = (_buf)[0]
 #define SRCREADPIXEL(_pix, _buf) _pix = (_buf)[0]
@@ -225,6 +325,8 @@ static INLINE UINT32 ExtractRunLength(UINT32 code, const BYTE* pbOrderHdr,
 #undef WRITEFIRSTLINEFGBGIMAGE
 #undef RLEDECOMPRESS
 #undef RLEEXTRA
+#undef DESTSIZE
+#define DESTSIZE 2
 #define DESTWRITEPIXEL(_buf, _pix) ((UINT16*)(_buf))[0] = (UINT16)(_pix)
 #define DESTREADPIXEL(_pix, _buf) _pix = ((UINT16*)(_buf))[0]
 #ifdef HAVE_ALIGNED_REQUIRED
@@ -249,6 +351,8 @@ static INLINE UINT32 ExtractRunLength(UINT32 code, const BYTE* pbOrderHdr,
 #undef WRITEFIRSTLINEFGBGIMAGE
 #undef RLEDECOMPRESS
 #undef RLEEXTRA
+#undef DESTSIZE
+#define DESTSIZE 3
 #define DESTWRITEPIXEL(_buf, _pix) do { (_buf)[0] = (BYTE)(_pix);  \
 		(_buf)[1] = (BYTE)((_pix) >> 8); (_buf)[2] = (BYTE)((_pix) >> 16); } while (0)
 #define DESTREADPIXEL(_pix, _buf) _pix = (_buf)[0] | ((_buf)[1] << 8) | \
@@ -263,6 +367,544 @@ static INLINE UINT32 ExtractRunLength(UINT32 code, const BYTE* pbOrderHdr,
 #define RLEEXTRA
 #include "include/bitmap.c"
 
+/**
+ * RLE encoder
+ *
+ * The encoder works on the bitmap in its wire format, with the scanlines in
+ * the order they are sent, and tracks the decoder state (first line, pending
+ * foreground pel insertion and foreground colour) so that every order it
+ * picks decodes to the source pixels. At each position the longest
+ * background, foreground, colour and dithered runs are measured with word
+ * wide compares and the order saving the most bytes over plain colour image
+ * pixels is emitted.
+ */
+
+#define RLE_MAX_RUN			0xFFFF
+#define RLE_FGBG_BREAK			16
+
+/* Number of leading bytes in which data equals the repeated pattern */
+static INLINE size_t rle_match_pattern(const BYTE* data, const BYTE* pattern, size_t length)
+{
+	size_t x;
+	size_t offset = 0;
+
+	for (; offset + RLE_PATTERN_SIZE <= length; offset += RLE_PATTERN_SIZE)
+	{
+		for (x = 0; x < RLE_PATTERN_SIZE; x += 8)
+		{
+			UINT64 a, b;
+			CopyMemory(&a, &data[offset + x], 8);
+			CopyMemory(&b, &pattern[x], 8);
+
+			if (a != b)
+				goto mismatch;
+		}
+	}
+
+mismatch:
+
+	for (x = 0; offset < length; offset++, x++)
+	{
+		if (data[offset] != pattern[x])
+			break;
+	}
+
+	return offset;
+}
+
+/* Number of leading bytes in which data equals the row above xored with the pattern */
+static INLINE size_t rle_match_above(const BYTE* data, const BYTE* above, const BYTE* pattern,
+                                     size_t length)
+{
+	size_t x;
+	size_t offset = 0;
+
+	for (; offset + RLE_PATTERN_SIZE <= length; offset += RLE_PATTERN_SIZE)
+	{
+		for (x = 0; x < RLE_PATTERN_SIZE; x += 8)
+		{
+			UINT64 a, b, c;
+			CopyMemory(&a, &data[offset + x], 8);
+			CopyMemory(&b, &above[offset + x], 8);
+			CopyMemory(&c, &pattern[x], 8);
+
+			if (a != (b ^ c))
+				goto mismatch;
+		}
+	}
+
+mismatch:
+
+	for (x = 0; offset < length; offset++, x++)
+	{
+		if (data[offset] != (above[offset] ^ pattern[x]))
+			break;
+	}
+
+	return offset;
+}
+
+static INLINE PIXEL rle_read_pixel(const BYTE* data, UINT32 size)
+{
+	PIXEL pixel = data[0];
+
+	if (size > 1)
+		pixel |= ((PIXEL) data[1]) << 8;
+
+	if (size > 2)
+		pixel |= ((PIXEL) data[2]) << 16;
+
+	return pixel;
+}
+
+static INLINE void rle_write_pixel(wStream* s, PIXEL pixel, UINT32 size)
+{
+	Stream_Write_UINT8(s, (BYTE) pixel);
+
+	if (size > 1)
+		Stream_Write_UINT8(s, (BYTE)(pixel >> 8));
+
+	if (size > 2)
+		Stream_Write_UINT8(s, (BYTE)(pixel >> 16));
+}
+
+/* Header sizes of orders with a 5 bit (regular) or 4 bit (lite) length */
+static INLINE UINT32 rle_regular_size(UINT32 length)
+{
+	return (length < 32) ? 1 : (length < 256 + 32) ? 2 : 3;
+}
+
+static INLINE UINT32 rle_lite_size(UINT32 length)
+{
+	return (length < 16) ? 1 : (length < 256 + 16) ? 2 : 3;
+}
+
+static INLINE UINT32 rle_fgbg_size(UINT32 length, UINT32 max)
+{
+	if (((length % 8) == 0) && (length / 8 <= max))
+		return 1 + (length + 7) / 8;
+
+	return ((length <= 256) ? 2 : 3) + (length + 7) / 8;
+}
+
+static INLINE BOOL rle_write_regular(wStream* s, BYTE code, BYTE megaMega, UINT32 length)
+{
+	if (Stream_GetRemainingCapacity(s) < 3)
+		return FALSE;
+
+	if (length < 32)
+		Stream_Write_UINT8(s, (BYTE)((code << 5) | length));
+	else if (length < 256 + 32)
+	{
+		Stream_Write_UINT8(s, (BYTE)(code << 5));
+		Stream_Write_UINT8(s, (BYTE)(length - 32));
+	}
+	else
+	{
+		Stream_Write_UINT8(s, megaMega);
+		Stream_Write_UINT16(s, (UINT16) length);
+	}
+
+	return TRUE;
+}
+
+static INLINE BOOL rle_write_lite(wStream* s, BYTE code, BYTE megaMega, UINT32 length)
+{
+	if (Stream_GetRemainingCapacity(s) < 3)
+		return FALSE;
+
+	if (length < 16)
+		Stream_Write_UINT8(s, (BYTE)((code << 4) | length));
+	else if (length < 256 + 16)
+	{
+		Stream_Write_UINT8(s, (BYTE)(code << 4));
+		Stream_Write_UINT8(s, (BYTE)(length - 16));
+	}
+	else
+	{
+		Stream_Write_UINT8(s, megaMega);
+		Stream_Write_UINT16(s, (UINT16) length);
+	}
+
+	return TRUE;
+}
+
+static INLINE BOOL rle_write_fgbg(wStream* s, BOOL setFg, UINT32 length)
+{
+	const BYTE code = setFg ? (LITE_SET_FG_FGBG_IMAGE << 4) : (REGULAR_FGBG_IMAGE << 5);
+	const UINT32 max = setFg ? 15 : 31;
+
+	if (Stream_GetRemainingCapacity(s) < 3)
+		return FALSE;
+
+	if (((length % 8) == 0) && (length / 8 <= max))
+		Stream_Write_UINT8(s, (BYTE)(code | (length / 8)));
+	else if (length <= 256)
+	{
+		Stream_Write_UINT8(s, code);
+		Stream_Write_UINT8(s, (BYTE)(length - 1));
+	}
+	else
+	{
+		Stream_Write_UINT8(s, setFg ? MEGA_MEGA_SET_FGBG_IMAGE : MEGA_MEGA_FGBG_IMAGE);
+		Stream_Write_UINT16(s, (UINT16) length);
+	}
+
+	return TRUE;
+}
+
+static INLINE BOOL rle_write_color_image(wStream* s, const BYTE* data, UINT32 count,
+        UINT32 size)
+{
+	while (count > 0)
+	{
+		const UINT32 length = MIN(count, RLE_MAX_RUN);
+
+		/* single black or white pixels have their own orders */
+		if ((length == 1) && (rle_read_pixel(data, size) == 0))
+		{
+			if (Stream_GetRemainingCapacity(s) < 1)
+				return FALSE;
+
+			Stream_Write_UINT8(s, SPECIAL_BLACK);
+		}
+		else
+		{
+			if (!rle_write_regular(s, REGULAR_COLOR_IMAGE, MEGA_MEGA_COLOR_IMAGE, length) ||
+			    (Stream_GetRemainingCapacity(s) < length * size))
+				return FALSE;
+
+			Stream_Write(s, data, length * size);
+		}
+
+		data += length * size;
+		count -= length;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Measures a foreground/background image: pixels that are either the
+ * reference or the reference xored with the foreground. The image stops
+ * before a long plain background or foreground run, those are cheaper as
+ * run orders.
+ */
+static INLINE UINT32 rle_measure_fgbg(const BYTE* data, const BYTE* above, UINT32 size,
+                                      UINT32 limit, PIXEL* fgPel, BOOL* fgFound)
+{
+	UINT32 x;
+	UINT32 bgCount = 0;
+	UINT32 fgCount = 0;
+	PIXEL fg = *fgPel;
+	BOOL found = *fgFound;
+
+	for (x = 0; x < limit; x++)
+	{
+		const PIXEL ref = above ? rle_read_pixel(&above[x * size], size) : 0;
+		const PIXEL pixel = rle_read_pixel(&data[x * size], size);
+
+		if (pixel == ref)
+		{
+			fgCount = 0;
+
+			if (++bgCount >= RLE_FGBG_BREAK)
+				break;
+
+			continue;
+		}
+
+		if (!found)
+		{
+			fg = pixel ^ ref;
+			found = TRUE;
+		}
+
+		if (pixel != (ref ^ fg))
+			break;
+
+		bgCount = 0;
+
+		if (++fgCount >= RLE_FGBG_BREAK)
+			break;
+	}
+
+	if ((bgCount >= RLE_FGBG_BREAK) || (fgCount >= RLE_FGBG_BREAK))
+		x = x + 1 - RLE_FGBG_BREAK;
+
+	*fgPel = fg;
+	*fgFound = found;
+	return x;
+}
+
+static INLINE BOOL rle_write_fgbg_mask(wStream* s, const BYTE* data, const BYTE* above,
+                                       UINT32 size, UINT32 count, PIXEL fgPel)
+{
+	UINT32 x;
+	BYTE bitmask = 0;
+
+	if (Stream_GetRemainingCapacity(s) < (count + 7) / 8)
+		return FALSE;
+
+	for (x = 0; x < count; x++)
+	{
+		const PIXEL ref = above ? rle_read_pixel(&above[x * size], size) : 0;
+
+		if (rle_read_pixel(&data[x * size], size) == (ref ^ fgPel))
+			bitmask |= (1 << (x % 8));
+
+		if ((x % 8) == 7)
+		{
+			Stream_Write_UINT8(s, bitmask);
+			bitmask = 0;
+		}
+	}
+
+	if (count % 8)
+		Stream_Write_UINT8(s, bitmask);
+
+	return TRUE;
+}
+
+enum RLE_ORDER
+{
+	RLE_ORDER_NONE,
+	RLE_ORDER_BG_RUN,
+	RLE_ORDER_FG_RUN,
+	RLE_ORDER_SET_FG_RUN,
+	RLE_ORDER_COLOR_RUN,
+	RLE_ORDER_DITHERED_RUN,
+	RLE_ORDER_FGBG_IMAGE,
+	RLE_ORDER_SET_FGBG_IMAGE
+};
+
+static INLINE void rle_candidate(enum RLE_ORDER* order, UINT32* length, INT64* saving,
+                                 enum RLE_ORDER candidate, UINT32 pixels, UINT32 cost,
+                                 UINT32 size)
+{
+	const INT64 value = (INT64) pixels * size - cost;
+
+	if ((pixels > 0) && (value > *saving))
+	{
+		*order = candidate;
+		*length = pixels;
+		*saving = value;
+	}
+}
+
+static INLINE BOOL rle_compress(const BYTE* data, UINT32 width, UINT32 height, UINT32 size,
+                                wStream* s)
+{
+	size_t i = 0;
+	size_t literal = 0;
+	const size_t count = (size_t) width * height;
+	const size_t rowDelta = (size_t) width * size;
+	BYTE zero[RLE_PATTERN_SIZE] = { 0 };
+	BYTE pattern[RLE_PATTERN_SIZE];
+	PIXEL fgPel = WHITE_PIXEL;
+	BOOL fgKnown = FALSE;
+	BOOL fFirstLine = TRUE;
+	BOOL fInsertFgPel = FALSE;
+
+	while (i < count)
+	{
+		UINT32 length = 0;
+		INT64 saving;
+		enum RLE_ORDER order = RLE_ORDER_NONE;
+		const BYTE* pixel = &data[i * size];
+		const BYTE* above;
+		PIXEL value, ref, xorPel = 0;
+		BOOL xorFound = FALSE;
+		UINT32 limit, limitAll, run;
+
+		/* the decoder decides about the first line at the start of each order */
+		if (fFirstLine && (i >= width))
+		{
+			fFirstLine = FALSE;
+			fInsertFgPel = FALSE;
+		}
+
+		above = fFirstLine ? NULL : pixel - rowDelta;
+		limitAll = (UINT32) MIN(count - i, RLE_MAX_RUN);
+		limit = fFirstLine ? (UINT32) MIN(width - i, limitAll) : limitAll;
+		value = rle_read_pixel(pixel, size);
+		ref = above ? rle_read_pixel(above, size) : 0;
+		/* breaking up a colour image costs another header */
+		saving = (i > literal) ? 1 : 0;
+
+		/* background run */
+		if (!fInsertFgPel)
+		{
+			run = (UINT32)((above ? rle_match_above(pixel, above, zero, limit * size) :
+			                rle_match_pattern(pixel, zero, limit * size)) / size);
+			rle_candidate(&order, &length, &saving, RLE_ORDER_BG_RUN, run,
+			              rle_regular_size(run), size);
+		}
+		else if (fgKnown && (value == (ref ^ fgPel)))
+		{
+			/* the decoder turns the first pixel of a follow-on run into a foreground pel */
+			run = 1;
+
+			if (limit > 1)
+				run += (UINT32)((above ? rle_match_above(pixel + size, above + size, zero,
+				                 (limit - 1) * size) :
+				                 rle_match_pattern(pixel + size, zero, (limit - 1) * size)) / size);
+
+			rle_candidate(&order, &length, &saving, RLE_ORDER_BG_RUN, run,
+			              rle_regular_size(run), size);
+		}
+
+		/* foreground run, with the current or a new foreground colour */
+		if (value != ref)
+		{
+			const PIXEL fg = value ^ ref;
+			const BOOL setFg = !fgKnown || (fg != fgPel);
+			rle_pattern(pattern, fg, fg, size);
+			run = (UINT32)((above ? rle_match_above(pixel, above, pattern, limit * size) :
+			                rle_match_pattern(pixel, pattern, limit * size)) / size);
+
+			if (setFg)
+				rle_candidate(&order, &length, &saving, RLE_ORDER_SET_FG_RUN, run,
+				              rle_lite_size(run) + size, size);
+			else
+				rle_candidate(&order, &length, &saving, RLE_ORDER_FG_RUN, run,
+				              rle_regular_size(run), size);
+		}
+
+		/* colour run */
+		rle_pattern(pattern, value, value, size);
+		run = (UINT32)(rle_match_pattern(pixel, pattern, limitAll * size) / size);
+		rle_candidate(&order, &length, &saving, RLE_ORDER_COLOR_RUN, run,
+		              rle_regular_size(run) + size, size);
+
+		/* dithered run of two alternating colours */
+		if ((limitAll >= 4) && (value != rle_read_pixel(pixel + size, size)))
+		{
+			rle_pattern(pattern, value, rle_read_pixel(pixel + size, size), size);
+			run = (UINT32)(rle_match_pattern(pixel, pattern, limitAll * size) / (2 * size));
+			rle_candidate(&order, &length, &saving, RLE_ORDER_DITHERED_RUN, 2 * run,
+			              rle_lite_size(run) + 2 * size, size);
+		}
+
+		/* foreground/background image */
+		if (fgKnown)
+		{
+			xorPel = fgPel;
+			xorFound = TRUE;
+		}
+
+		run = rle_measure_fgbg(pixel, above, size, limit, &xorPel, &xorFound);
+
+		if (run > 0)
+		{
+			if (xorFound && (!fgKnown || (xorPel != fgPel)))
+				rle_candidate(&order, &length, &saving, RLE_ORDER_SET_FGBG_IMAGE, run,
+				              rle_fgbg_size(run, 15) + size, size);
+			else
+				rle_candidate(&order, &length, &saving, RLE_ORDER_FGBG_IMAGE, run,
+				              rle_fgbg_size(run, 31), size);
+		}
+
+		if (order == RLE_ORDER_NONE)
+		{
+			/* collected into a colour image */
+			i++;
+			fInsertFgPel = FALSE;
+			continue;
+		}
+
+		if (!rle_write_color_image(s, &data[literal * size], (UINT32)(i - literal), size))
+			return FALSE;
+
+		switch (order)
+		{
+			case RLE_ORDER_BG_RUN:
+				if (!rle_write_regular(s, REGULAR_BG_RUN, MEGA_MEGA_BG_RUN, length))
+					return FALSE;
+
+				break;
+
+			case RLE_ORDER_FG_RUN:
+				if (!rle_write_regular(s, REGULAR_FG_RUN, MEGA_MEGA_FG_RUN, length))
+					return FALSE;
+
+				break;
+
+			case RLE_ORDER_SET_FG_RUN:
+				if (!rle_write_lite(s, LITE_SET_FG_FG_RUN, MEGA_MEGA_SET_FG_RUN, length) ||
+				    (Stream_GetRemainingCapacity(s) < size))
+					return FALSE;
+
+				fgPel = value ^ ref;
+				fgKnown = TRUE;
+				rle_write_pixel(s, fgPel, size);
+				break;
+
+			case RLE_ORDER_COLOR_RUN:
+				if (!rle_write_regular(s, REGULAR_COLOR_RUN, MEGA_MEGA_COLOR_RUN, length) ||
+				    (Stream_GetRemainingCapacity(s) < size))
+					return FALSE;
+
+				rle_write_pixel(s, value, size);
+				break;
+
+			case RLE_ORDER_DITHERED_RUN:
+				if (!rle_write_lite(s, LITE_DITHERED_RUN, MEGA_MEGA_DITHERED_RUN, length / 2) ||
+				    (Stream_GetRemainingCapacity(s) < 2 * size))
+					return FALSE;
+
+				rle_write_pixel(s, value, size);
+				rle_write_pixel(s, rle_read_pixel(pixel + size, size), size);
+				break;
+
+			case RLE_ORDER_SET_FGBG_IMAGE:
+				fgPel = xorPel;
+				fgKnown = TRUE;
+
+				if (!rle_write_fgbg(s, TRUE, length) || (Stream_GetRemainingCapacity(s) < size))
+					return FALSE;
+
+				rle_write_pixel(s, fgPel, size);
+
+				if (!rle_write_fgbg_mask(s, pixel, above, size, length, fgPel))
+					return FALSE;
+
+				break;
+
+			case RLE_ORDER_FGBG_IMAGE:
+				if (!rle_write_fgbg(s, FALSE, length) ||
+				    !rle_write_fgbg_mask(s, pixel, above, size, length, fgPel))
+					return FALSE;
+
+				break;
+
+			default:
+				return FALSE;
+		}
+
+		fInsertFgPel = (order == RLE_ORDER_BG_RUN);
+		i += length;
+		literal = i;
+	}
+
+	return rle_write_color_image(s, &data[literal * size], (UINT32)(i - literal), size);
+}
+
+static BOOL RleCompress8(const BYTE* data, UINT32 width, UINT32 height, wStream* s)
+{
+	return rle_compress(data, width, height, 1, s);
+}
+
+static BOOL RleCompress16(const BYTE* data, UINT32 width, UINT32 height, wStream* s)
+{
+	return rle_compress(data, width, height, 2, s);
+}
+
+static BOOL RleCompress24(const BYTE* data, UINT32 width, UINT32 height, wStream* s)
+{
+	return rle_compress(data, width, height, 3, s);
+}
+
 BOOL interleaved_decompress(BITMAP_INTERLEAVED_CONTEXT* interleaved,
                             const BYTE* pSrcData, UINT32 SrcSize,
                             UINT32 nSrcWidth, UINT32 nSrcHeight,
@@ -272,9 +914,13 @@ BOOL interleaved_decompress(BITMAP_INTERLEAVED_CONTEXT* interleaved,
                             UINT32 nDstWidth, UINT32 nDstHeight,
                             const gdiPalette* palette)
 {
+	BOOL rc;
 	UINT32 scanline;
 	UINT32 SrcFormat;
 	UINT32 BufferSize;
+	const UINT32 w = MIN(nSrcWidth, nDstWidth);
+	const UINT32 h = MIN(nSrcHeight, nDstHeight);
+	const UINT64 start = freerdp_metrics_now();
 
 	if (!interleaved)
 		return FALSE;
@@ -310,40 +956,49 @@ BOOL interleaved_decompress(BITMAP_INTERLEAVED_CONTEXT* interleaved,
 
 	if (BufferSize > interleaved->TempSize)
 	{
-		interleaved->TempBuffer = _aligned_realloc(
-		                              interleaved->TempBuffer,
-		                              BufferSize, 16);
+		BYTE* buffer = _aligned_realloc(interleaved->TempBuffer, BufferSize, 16);
+
+		if (!buffer)
+			return FALSE;
+
+		interleaved->TempBuffer = buffer;
 		interleaved->TempSize = BufferSize;
 	}
 
-	if (!interleaved->TempBuffer)
-		return FALSE;
-
 	switch (bpp)
 	{
 		case 24:
-			RleDecompress24to24(pSrcData, SrcSize, interleaved->TempBuffer,
-			                    scanline, nSrcWidth, nSrcHeight);
+			rc = RleDecompress24to24(pSrcData, SrcSize, interleaved->TempBuffer,
+			                         scanline, nSrcWidth, nSrcHeight);
 			break;
 
 		case 16:
 		case 15:
-			RleDecompress16to16(pSrcData, SrcSize, interleaved->TempBuffer,
-			                    scanline, nSrcWidth, nSrcHeight);
+			rc = RleDecompress16to16(pSrcData, SrcSize, interleaved->TempBuffer,
+			                         scanline, nSrcWidth, nSrcHeight);
 			break;
 
 		case 8:
-			RleDecompress8to8(pSrcData, SrcSize, interleaved->TempBuffer,
-			                  scanline, nSrcWidth, nSrcHeight);
+			rc = RleDecompress8to8(pSrcData, SrcSize, interleaved->TempBuffer,
+			                       scanline, nSrcWidth, nSrcHeight);
 			break;
 
 		default:
 			return FALSE;
 	}
 
-	return freerdp_image_copy(pDstData, DstFormat, nDstStep, nXDst, nYDst,
-	                          nDstWidth, nDstHeight, interleaved->TempBuffer,
-	                          SrcFormat, scanline, 0, 0, palette, FREERDP_FLIP_VERTICAL);
+	if (!rc)
+		return FALSE;
+
+	/* the bitmap is stored bottom up, a clipped destination takes its top rows */
+	rc = freerdp_image_copy(pDstData, DstFormat, nDstStep, nXDst, nYDst, w, h,
+	                        &interleaved->TempBuffer[(nSrcHeight - h) * scanline],
+	                        SrcFormat, scanline, 0, 0, palette, FREERDP_FLIP_VERTICAL);
+
+	if (rc)
+		freerdp_metric_record_since(FREERDP_METRIC_INTERLEAVED_DECODE_TIME, start);
+
+	return rc;
 }
 
 BOOL interleaved_compress(BITMAP_INTERLEAVED_CONTEXT* interleaved,
@@ -353,10 +1008,15 @@ BOOL interleaved_compress(BITMAP_INTERLEAVED_CONTEXT* interleaved,
                           UINT32 nSrcStep, UINT32 nXSrc, UINT32 nYSrc,
                           const gdiPalette* palette, UINT32 bpp)
 {
-	int status;
+	BOOL rc;
 	wStream* s;
-	UINT32 DstFormat = 0;
-	int maxSize = 64 * 64 * 4;
+	UINT32 DstFormat;
+	UINT32 scanline;
+	UINT32 BufferSize;
+	const UINT64 start = freerdp_metrics_now();
+
+	if (!interleaved || !pDstData || !pDstSize)
+		return FALSE;
 
 	if (nWidth % 4)
 	{
@@ -364,41 +1024,83 @@ BOOL interleaved_compress(BITMAP_INTERLEAVED_CONTEXT* interleaved,
 		return FALSE;
 	}
 
-	if ((nWidth > 64) || (nHeight > 64))
+	switch (bpp)
 	{
-		WLog_ERR(TAG,
-		         "interleaved_compress: width (%"PRIu32") or height (%"PRIu32") is greater than 64", nWidth,
-		         nHeight);
-		return FALSE;
+		case 24:
+			scanline = nWidth * 3;
+			DstFormat = PIXEL_FORMAT_BGR24;
+			break;
+
+		case 16:
+			scanline = nWidth * 2;
+			DstFormat = PIXEL_FORMAT_RGB16;
+			break;
+
+		case 15:
+			scanline = nWidth * 2;
+			DstFormat = PIXEL_FORMAT_RGB15;
+			break;
+
+		case 8:
+			scanline = nWidth;
+			DstFormat = PIXEL_FORMAT_RGB8;
+			break;
+
+		default:
+			WLog_ERR(TAG, "Invalid color depth %"PRIu32"", bpp);
+			return FALSE;
 	}
 
-	if (bpp == 24)
-		DstFormat = PIXEL_FORMAT_BGRX32;
-	else if (bpp == 16)
-		DstFormat = PIXEL_FORMAT_RGB16;
-	else if (bpp == 15)
-		DstFormat = PIXEL_FORMAT_RGB15;
-	else if (bpp == 8)
-		DstFormat = PIXEL_FORMAT_RGB8;
+	BufferSize = scanline * nHeight;
+
+	if (BufferSize > interleaved->TempSize)
+	{
+		BYTE* buffer = _aligned_realloc(interleaved->TempBuffer, BufferSize, 16);
 
-	if (!DstFormat)
+		if (!buffer)
+			return FALSE;
+
+		interleaved->TempBuffer = buffer;
+		interleaved->TempSize = BufferSize;
+	}
+
+	/**
+	 * The encoder works on the wire format, bottom row first. A flipped copy
+	 * mirrors the source offset as well, so the rows are offset up front.
+	 */
+	if (!freerdp_image_copy(interleaved->TempBuffer, DstFormat, scanline, 0, 0, nWidth, nHeight,
+	                        &pSrcData[nYSrc * nSrcStep], SrcFormat, nSrcStep, nXSrc, 0, palette,
+	                        FREERDP_FLIP_VERTICAL))
 		return FALSE;
 
-	status = freerdp_image_copy(interleaved->TempBuffer, DstFormat, 0, 0, 0, nWidth,
-	                            nHeight,
-	                            pSrcData, SrcFormat, nSrcStep, nXSrc, nYSrc, palette, FREERDP_FLIP_NONE);
-	s = Stream_New(pDstData, maxSize);
+	s = Stream_New(pDstData, *pDstSize);
 
 	if (!s)
 		return FALSE;
 
-	status = freerdp_bitmap_compress((char*) interleaved->TempBuffer, nWidth,
-	                                 nHeight,
-	                                 s, bpp, maxSize, nHeight - 1, interleaved->bts, 0);
-	Stream_SealLength(s);
-	*pDstSize = (UINT32) Stream_Length(s);
+	switch (bpp)
+	{
+		case 24:
+			rc = RleCompress24(interleaved->TempBuffer, nWidth, nHeight, s);
+			break;
+
+		case 16:
+		case 15:
+			rc = RleCompress16(interleaved->TempBuffer, nWidth, nHeight, s);
+			break;
+
+		default:
+			rc = RleCompress8(interleaved->TempBuffer, nWidth, nHeight, s);
+			break;
+	}
+
+	*pDstSize = (UINT32) Stream_GetPosition(s);
 	Stream_Free(s, FALSE);
-	return status;
+
+	if (rc)
+		freerdp_metric_record_since(FREERDP_METRIC_INTERLEAVED_ENCODE_TIME, start);
+
+	return rc;
 }
 
 BOOL bitmap_interleaved_context_reset(BITMAP_INTERLEAVED_CONTEXT* interleaved)
@@ -32,6 +32,7 @@
 
 #include <freerdp/codec/nsc.h>
 #include <freerdp/codec/color.h>
+#include <freerdp/utils/metrics.h>
 
 #include "nsc_types.h"
 #include "nsc_encode.h"
@@ -354,6 +355,7 @@ BOOL nsc_process_message(NSC_CONTEXT* context, UINT16 bpp,
 {
 	wStream* s;
 	BOOL ret;
+	const UINT64 start = freerdp_metrics_now();
 	s = Stream_New((BYTE*)data, length);
 
 	if (!s)
@@ -410,5 +412,6 @@ BOOL nsc_process_message(NSC_CONTEXT* context, UINT16 bpp,
 	                        PIXEL_FORMAT_BGRA32, 0, 0, 0, NULL, flip))
 		return FALSE;
 
+	freerdp_metric_record_since(FREERDP_METRIC_NSC_DECODE_TIME, start);
 	return TRUE;
 }
@@ -31,6 +31,7 @@
 
 #include <freerdp/codec/nsc.h>
 #include <freerdp/codec/color.h>
+#include <freerdp/utils/metrics.h>
 
 #include "nsc_types.h"
 #include "nsc_encode.h"
@@ -576,8 +577,10 @@ void nsc_message_free(NSC_CONTEXT* context, NSC_MESSAGE* message)
 BOOL nsc_compose_message(NSC_CONTEXT* context, wStream* s, const BYTE* data,
                          UINT32 width, UINT32 height, UINT32 scanline)
 {
+	BOOL rc;
 	NSC_MESSAGE s_message = { 0 };
 	NSC_MESSAGE* message = &s_message;
+	const UINT64 start = freerdp_metrics_now();
 	context->width = width;
 	context->height = height;
 
@@ -602,5 +605,10 @@ BOOL nsc_compose_message(NSC_CONTEXT* context, wStream* s, const BYTE* data,
 	message->AlphaPlaneByteCount = context->PlaneByteCount[3];
 	message->ColorLossLevel = context->ColorLossLevel;
 	message->ChromaSubsamplingLevel = context->ChromaSubsamplingLevel;
-	return nsc_write_message(context, s, message);
+	rc = nsc_write_message(context, s, message);
+
+	if (rc)
+		freerdp_metric_record_since(FREERDP_METRIC_NSC_ENCODE_TIME, start);
+
+	return rc;
 }
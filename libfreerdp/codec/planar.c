@@ -30,15 +30,76 @@
 #include <freerdp/log.h>
 #include <freerdp/codec/bitmap.h>
 #include <freerdp/codec/planar.h>
+#include <freerdp/utils/metrics.h>
+
+#include "planar_sse2.h"
 
 #define TAG FREERDP_TAG("codec")
 
+#ifndef PLANAR_INIT_SIMD
+#define PLANAR_INIT_SIMD(_planar_context) do { } while (0)
+#endif
+
 static INLINE BYTE* freerdp_bitmap_planar_compress_plane_rle(
     const BYTE* plane, UINT32 width, UINT32 height,
     BYTE* outPlane, UINT32* dstSize);
-static INLINE BYTE* freerdp_bitmap_planar_delta_encode_plane(
+static INLINE BYTE* freerdp_bitmap_planar_delta_encode_plane(BITMAP_PLANAR_CONTEXT* planar,
     const BYTE* inPlane, UINT32 width, UINT32 height, BYTE* outPlane);
 
+static void planar_delta_encode_line(const BYTE* pSrc, const BYTE* pPrev, BYTE* pDst,
+                                     UINT32 width)
+{
+	UINT32 x;
+
+	/* signed difference stored as magnitude << 1 with the sign in bit 0 */
+	for (x = 0; x < width; x++)
+	{
+		const BYTE delta = pSrc[x] - pPrev[x];
+		pDst[x] = (BYTE)(delta << 1) ^ ((delta & 0x80) ? 0xFF : 0x00);
+	}
+}
+
+static void planar_delta_decode_line(BYTE* pLine, const BYTE* pPrev, UINT32 width)
+{
+	UINT32 x;
+
+	for (x = 0; x < width; x++)
+	{
+		const BYTE value = pLine[x];
+		pLine[x] = pPrev[x] + ((value >> 1) ^ ((value & 1) ? 0xFF : 0x00));
+	}
+}
+
+static void planar_split_line_32(const BYTE* pSrc, BOOL alpha, BYTE* pA, BYTE* pC0,
+                                 BYTE* pC1, BYTE* pC2, UINT32 width)
+{
+	UINT32 x;
+
+	for (x = 0; x < width; x++)
+	{
+		const BYTE* pixel = &pSrc[x * 4];
+		pC0[x] = pixel[0];
+		pC1[x] = pixel[1];
+		pC2[x] = pixel[2];
+		pA[x] = alpha ? pixel[3] : 0xFF;
+	}
+}
+
+static void planar_merge_line_32(BYTE* pDst, const BYTE* pA, const BYTE* pC0,
+                                 const BYTE* pC1, const BYTE* pC2, UINT32 width)
+{
+	UINT32 x;
+
+	for (x = 0; x < width; x++)
+	{
+		BYTE* pixel = &pDst[x * 4];
+		pixel[0] = pC0[x];
+		pixel[1] = pC1[x];
+		pixel[2] = pC2[x];
+		pixel[3] = pA ? pA[x] : 0xFF;
+	}
+}
+
 static INLINE INT32 planar_skip_plane_rle(const BYTE* pSrcData, UINT32 SrcSize,
         UINT32 nWidth, UINT32 nHeight)
 {
@@ -87,54 +148,40 @@ static INLINE INT32 planar_skip_plane_rle(const BYTE* pSrcData, UINT32 SrcSize,
 	return (INT32)(pRLE - pSrcData);
 }
 
-static INLINE INT32 planar_decompress_plane_rle(const BYTE* pSrcData, UINT32 SrcSize,
-        BYTE* pDstData, INT32 nDstStep,
-        UINT32 nXDst, UINT32 nYDst,
-        UINT32 nWidth, UINT32 nHeight,
-        UINT32 nChannel, BOOL vFlip)
+static INLINE INT32 planar_decompress_plane_rle(BITMAP_PLANAR_CONTEXT* planar,
+        const BYTE* pSrcData, UINT32 SrcSize,
+        BYTE* pDstPlane, UINT32 nWidth, UINT32 nHeight)
 {
 	UINT32 x, y;
-	UINT32 pixel;
+	BYTE value;
 	UINT32 cRawBytes;
 	UINT32 nRunLength;
-	INT32 deltaValue;
-	INT32 beg, end, inc;
 	BYTE controlByte;
 	BYTE* currentScanline;
-	BYTE* previousScanline;
 	const BYTE* srcp = pSrcData;
-	previousScanline = NULL;
-
-	if (vFlip)
-	{
-		beg = nHeight - 1;
-		end = -1;
-		inc = -1;
-	}
-	else
-	{
-		beg = 0;
-		end = nHeight;
-		inc = 1;
-	}
+	const BYTE* pEnd = &pSrcData[SrcSize];
 
-	for (y = beg; y != end; y += inc)
+	/**
+	 * Each scanline is expanded to its raw or delta encoded bytes first, a run
+	 * repeats the last raw byte (or zero at the start of a scanline) which holds
+	 * for the absolute values of the first scanline as well as for the deltas.
+	 * The deltas are then resolved against the previous scanline in one pass.
+	 */
+	for (y = 0; y < nHeight; y++)
 	{
-		BYTE* dstp = &pDstData[((nYDst + y) * nDstStep) + (nXDst * 4) + nChannel];
-		pixel = 0;
-		currentScanline = dstp;
+		currentScanline = &pDstPlane[y * nWidth];
+		value = 0;
 
 		for (x = 0; x < nWidth;)
 		{
-			controlByte = *srcp;
-			srcp++;
-
-			if ((srcp - pSrcData) > SrcSize)
+			if (srcp >= pEnd)
 			{
 				WLog_ERR(TAG,  "error reading input buffer");
 				return -1;
 			}
 
+			controlByte = *srcp;
+			srcp++;
 			nRunLength = PLANAR_CONTROL_BYTE_RUN_LENGTH(controlByte);
 			cRawBytes = PLANAR_CONTROL_BYTE_RAW_BYTES(controlByte);
 
@@ -149,116 +196,72 @@ static INLINE INT32 planar_decompress_plane_rle(const BYTE* pSrcData, UINT32 Src
 				cRawBytes = 0;
 			}
 
-			if (((dstp + (cRawBytes + nRunLength)) - currentScanline) > nWidth * 4)
+			if ((x + cRawBytes + nRunLength) > nWidth)
 			{
 				WLog_ERR(TAG,  "too many pixels in scanline");
 				return -1;
 			}
 
-			if (!previousScanline)
+			if (cRawBytes > 0)
 			{
-				/* first scanline, absolute values */
-				while (cRawBytes > 0)
+				if ((UINT32)(pEnd - srcp) < cRawBytes)
 				{
-					pixel = *srcp;
-					srcp++;
-					*dstp = pixel;
-					dstp += 4;
-					x++;
-					cRawBytes--;
+					WLog_ERR(TAG,  "error reading input buffer");
+					return -1;
 				}
 
-				while (nRunLength > 0)
-				{
-					*dstp = pixel;
-					dstp += 4;
-					x++;
-					nRunLength--;
-				}
+				CopyMemory(&currentScanline[x], srcp, cRawBytes);
+				srcp += cRawBytes;
+				x += cRawBytes;
+				value = currentScanline[x - 1];
 			}
-			else
-			{
-				/* delta values relative to previous scanline */
-				while (cRawBytes > 0)
-				{
-					deltaValue = *srcp;
-					srcp++;
-
-					if (deltaValue & 1)
-					{
-						deltaValue = deltaValue >> 1;
-						deltaValue = deltaValue + 1;
-						pixel = -deltaValue;
-					}
-					else
-					{
-						deltaValue = deltaValue >> 1;
-						pixel = deltaValue;
-					}
-
-					deltaValue = previousScanline[x * 4] + pixel;
-					*dstp = deltaValue;
-					dstp += 4;
-					x++;
-					cRawBytes--;
-				}
 
-				while (nRunLength > 0)
-				{
-					deltaValue = previousScanline[x * 4] + pixel;
-					*dstp = deltaValue;
-					dstp += 4;
-					x++;
-					nRunLength--;
-				}
+			if (nRunLength > 0)
+			{
+				FillMemory(&currentScanline[x], nRunLength, value);
+				x += nRunLength;
 			}
 		}
 
-		previousScanline = currentScanline;
+		if (y > 0)
+			planar->delta_decode_line(currentScanline, currentScanline - nWidth, nWidth);
 	}
 
 	return (INT32)(srcp - pSrcData);
 }
 
-static INLINE BOOL writeLine(BYTE** ppRgba, UINT32 DstFormat, UINT32 width, const BYTE** ppR,
-                             const BYTE** ppG, const BYTE** ppB, const BYTE** ppA)
+static INLINE BOOL writeLine(BITMAP_PLANAR_CONTEXT* planar, BYTE** ppRgba, UINT32 DstFormat,
+                             UINT32 width, const BYTE** ppR, const BYTE** ppG, const BYTE** ppB,
+                             const BYTE** ppA)
 {
 	UINT32 x;
 
-	if (!ppRgba || !ppR || !ppG || !ppB)
+	if (!ppRgba || !ppR || !ppG || !ppB || !ppA)
 		return FALSE;
 
 	switch (DstFormat)
 	{
 		case PIXEL_FORMAT_BGRA32:
-			for (x = 0; x < width; x++)
-			{
-				*(*ppRgba)++ = *(*ppB)++;
-				*(*ppRgba)++ = *(*ppG)++;
-				*(*ppRgba)++ = *(*ppR)++;
-				*(*ppRgba)++ = *(*ppA)++;
-			}
-
-			return TRUE;
-
 		case PIXEL_FORMAT_BGRX32:
-			for (x = 0; x < width; x++)
-			{
-				*(*ppRgba)++ = *(*ppB)++;
-				*(*ppRgba)++ = *(*ppG)++;
-				*(*ppRgba)++ = *(*ppR)++;
-				*(*ppRgba)++ = 0xFF;
-			}
+			planar->merge_line_32(*ppRgba, (DstFormat == PIXEL_FORMAT_BGRA32) ? *ppA : NULL,
+			                      *ppB, *ppG, *ppR, width);
+			*ppRgba += width * 4;
+			break;
 
-			return TRUE;
+		case PIXEL_FORMAT_RGBA32:
+		case PIXEL_FORMAT_RGBX32:
+			planar->merge_line_32(*ppRgba, *ppA, *ppR, *ppG, *ppB, width);
+			*ppRgba += width * 4;
+			break;
 
 		default:
-			if (ppA)
+			if (*ppA)
 			{
+				const BYTE* pA = *ppA;
+
 				for (x = 0; x < width; x++)
 				{
-					BYTE alpha = *(*ppA)++;
-					UINT32 color = GetColor(DstFormat, *(*ppR)++, *(*ppG)++, *(*ppB)++, alpha);
+					UINT32 color = GetColor(DstFormat, (*ppR)[x], (*ppG)[x], (*ppB)[x], pA[x]);
 					WriteColor(*ppRgba, DstFormat, color);
 					*ppRgba += GetBytesPerPixel(DstFormat);
 				}
@@ -269,18 +272,27 @@ static INLINE BOOL writeLine(BYTE** ppRgba, UINT32 DstFormat, UINT32 width, cons
 
 				for (x = 0; x < width; x++)
 				{
-					UINT32 color = GetColor(DstFormat, *(*ppR)++, *(*ppG)++, *(*ppB)++, alpha);
+					UINT32 color = GetColor(DstFormat, (*ppR)[x], (*ppG)[x], (*ppB)[x], alpha);
 					WriteColor(*ppRgba, DstFormat, color);
 					*ppRgba += GetBytesPerPixel(DstFormat);
 				}
 			}
 
-			return TRUE;
+			break;
 	}
+
+	*ppR += width;
+	*ppG += width;
+	*ppB += width;
+
+	if (*ppA)
+		*ppA += width;
+
+	return TRUE;
 }
 
-static INLINE BOOL planar_decompress_planes_raw(const BYTE* pSrcData[4],
-        BYTE* pDstData, UINT32 DstFormat,
+static INLINE BOOL planar_decompress_planes_raw(BITMAP_PLANAR_CONTEXT* planar,
+        const BYTE* pSrcData[4], BYTE* pDstData, UINT32 DstFormat,
         UINT32 nDstStep, UINT32 nXDst, UINT32 nYDst, UINT32 nWidth, UINT32 nHeight,
         BOOL alpha, BOOL vFlip)
 {
@@ -289,7 +301,7 @@ static INLINE BOOL planar_decompress_planes_raw(const BYTE* pSrcData[4],
 	const BYTE* pR = pSrcData[0];
 	const BYTE* pG = pSrcData[1];
 	const BYTE* pB = pSrcData[2];
-	const BYTE* pA = pSrcData[3];
+	const BYTE* pA = alpha ? pSrcData[3] : NULL;
 
 	if (vFlip)
 	{
@@ -304,27 +316,13 @@ static INLINE BOOL planar_decompress_planes_raw(const BYTE* pSrcData[4],
 		inc = 1;
 	}
 
-	if (alpha)
-	{
-		for (y = beg; y != end; y += inc)
-		{
-			BYTE* pRGB = &pDstData[((nYDst + y) * nDstStep) + (nXDst * GetBytesPerPixel(
-			                           DstFormat))];
-
-			if (!writeLine(&pRGB, DstFormat, nWidth, &pR, &pG, &pB, &pA))
-				return FALSE;
-		}
-	}
-	else
+	for (y = beg; y != end; y += inc)
 	{
-		for (y = beg; y != end; y += inc)
-		{
-			BYTE* pRGB = &pDstData[((nYDst + y) * nDstStep) + (nXDst * GetBytesPerPixel(
-			                           DstFormat))];
+		BYTE* pRGB = &pDstData[((nYDst + y) * nDstStep) + (nXDst * GetBytesPerPixel(
+		                           DstFormat))];
 
-			if (!writeLine(&pRGB, DstFormat, nWidth, &pR, &pG, &pB, &pA))
-				return FALSE;
-		}
+		if (!writeLine(planar, &pRGB, DstFormat, nWidth, &pR, &pG, &pB, &pA))
+			return FALSE;
 	}
 
 	return TRUE;
@@ -346,6 +344,7 @@ BOOL planar_decompress(BITMAP_PLANAR_CONTEXT* planar,
 	UINT32 subSize;
 	UINT32 subWidth;
 	UINT32 subHeight;
+	const UINT64 start = freerdp_metrics_now();
 	UINT32 planeSize;
 	INT32 rleSizes[4] = { 0, 0, 0, 0 };
 	UINT32 rawSizes[4];
@@ -497,11 +496,57 @@ BOOL planar_decompress(BITMAP_PLANAR_CONTEXT* planar,
 		}
 	}
 
+	if (cll && cs)
+	{
+		WLog_ERR(TAG, "Chroma subsampling unimplemented");
+		return FALSE;
+	}
+
+	/* the temporary buffer holds the whole source bitmap */
+	if ((planar->maxWidth < nSrcWidth) || (planar->maxHeight < nSrcHeight))
+	{
+		if (!freerdp_bitmap_planar_context_reset(planar, MAX(planar->maxWidth, nSrcWidth),
+		        MAX(planar->maxHeight, nSrcHeight)))
+			return FALSE;
+	}
+
+	if (!rle) /* RAW */
+	{
+		if (alpha)
+			srcp += rawSizes[0] + rawSizes[1] + rawSizes[2] + rawSizes[3];
+		else /* NoAlpha */
+			srcp += rawSizes[0] + rawSizes[1] + rawSizes[2];
+
+		if ((SrcSize - (srcp - pSrcData)) == 1)
+			srcp++; /* pad */
+	}
+	else /* RLE */
+	{
+		UINT32 i;
+		const UINT32 nPlanes = alpha ? 4 : 3;
+
+		/* the planes are expanded into the context buffers and merged like raw planes */
+		for (i = 0; i < nPlanes; i++)
+		{
+			BYTE* pPlane = &planar->planesBuffer[planeSize * i];
+			status = planar_decompress_plane_rle(planar, planes[i], rleSizes[i], pPlane,
+			                                     nSrcWidth, nSrcHeight);
+
+			if (status < 0)
+				return FALSE;
+
+			planes[i] = pPlane;
+			srcp += rleSizes[i];
+		}
+	}
+
 	if (!cll) /* RGB */
 	{
 		UINT32 TempFormat;
 		BYTE* pTempData = pDstData;
 		UINT32 nTempStep = nDstStep;
+		UINT32 nXTemp = nXDst;
+		UINT32 nYTemp = nYDst;
 
 		if (alpha)
 			TempFormat = PIXEL_FORMAT_BGRA32;
@@ -513,102 +558,19 @@ BOOL planar_decompress(BITMAP_PLANAR_CONTEXT* planar,
 		{
 			pTempData = planar->pTempData;
 			nTempStep = planar->nTempStep;
+			nXTemp = 0;
+			nYTemp = 0;
 		}
 
-		if (!rle) /* RAW */
-		{
-			if (alpha)
-			{
-				if (!planar_decompress_planes_raw(planes, pTempData, TempFormat, nTempStep,
-				                                  nXDst, nYDst, nSrcWidth, nSrcHeight, alpha, vFlip))
-					return FALSE;
-
-				srcp += rawSizes[0] + rawSizes[1] + rawSizes[2] + rawSizes[3];
-			}
-			else /* NoAlpha */
-			{
-				if (!planar_decompress_planes_raw(planes, pTempData, TempFormat, nTempStep,
-				                                  nXDst, nYDst, nSrcWidth, nSrcHeight, alpha, vFlip))
-					return FALSE;
-
-				srcp += rawSizes[0] + rawSizes[1] + rawSizes[2];
-			}
-
-			if ((SrcSize - (srcp - pSrcData)) == 1)
-				srcp++; /* pad */
-		}
-		else /* RLE */
-		{
-			if (alpha)
-			{
-				status = planar_decompress_plane_rle(planes[3], rleSizes[3],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 3,
-				                                     vFlip); /* AlphaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[0], rleSizes[0],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 2,
-				                                     vFlip); /* RedPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[1], rleSizes[1],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 1,
-				                                     vFlip); /* GreenPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[2], rleSizes[2],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 0,
-				                                     vFlip); /* BluePlane */
-
-				if (status < 0)
-					return FALSE;
-
-				srcp += rleSizes[0] + rleSizes[1] + rleSizes[2] + rleSizes[3];
-			}
-			else /* NoAlpha */
-			{
-				const UINT32 color = GetColor(TempFormat, 0, 0, 0, 0xFF);
-
-				if (!freerdp_image_fill(pTempData, TempFormat, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight,
-				                        color))
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[0], rleSizes[0],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 2,
-				                                     vFlip); /* RedPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[1], rleSizes[1],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 1,
-				                                     vFlip); /* GreenPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[2], rleSizes[2],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 0,
-				                                     vFlip); /* BluePlane */
-
-				if (status < 0)
-					return FALSE;
-
-				srcp += rleSizes[0] + rleSizes[1] + rleSizes[2];
-			}
-		}
+		if (!planar_decompress_planes_raw(planar, planes, pTempData, TempFormat, nTempStep,
+		                                  nXTemp, nYTemp, nSrcWidth, nSrcHeight, alpha, vFlip))
+			return FALSE;
 
 		if (pTempData != pDstData)
 		{
 			if (!freerdp_image_copy(pDstData, DstFormat, nDstStep, nXDst, nYDst, w,
 			                        h, pTempData,
-			                        TempFormat, nTempStep, nXDst, nYDst, NULL, FREERDP_FLIP_NONE))
+			                        TempFormat, nTempStep, 0, 0, NULL, FREERDP_FLIP_NONE))
 				return FALSE;
 		}
 	}
@@ -617,109 +579,29 @@ BOOL planar_decompress(BITMAP_PLANAR_CONTEXT* planar,
 		BYTE* pTempData = planar->pTempData;
 		UINT32 nTempStep = planar->nTempStep;
 		UINT32 TempFormat = PIXEL_FORMAT_BGRA32;
+		BYTE* pDst = &pDstData[(nYDst * nDstStep) + (nXDst * GetBytesPerPixel(DstFormat))];
 
 		if (!pTempData)
 			return FALSE;
 
-		if (cs)
-		{
-			WLog_ERR(TAG, "Chroma subsampling unimplemented");
+		if (!planar_decompress_planes_raw(planar, planes, pTempData, TempFormat, nTempStep,
+		                                  0, 0, nSrcWidth, nSrcHeight, alpha, vFlip))
 			return FALSE;
-		}
 
-		if (!rle) /* RAW */
-		{
-			if (alpha)
-			{
-				if (!planar_decompress_planes_raw(planes, pTempData, TempFormat, nTempStep,
-				                                  nXDst, nYDst, nSrcWidth, nSrcHeight, alpha, vFlip))
-					return FALSE;
-
-				srcp += rawSizes[0] + rawSizes[1] + rawSizes[2] + rawSizes[3];
-			}
-			else /* NoAlpha */
-			{
-				if (!planar_decompress_planes_raw(planes, pTempData, TempFormat, nTempStep,
-				                                  nXDst, nYDst, nSrcWidth, nSrcHeight, alpha, vFlip))
-					return FALSE;
-
-				srcp += rawSizes[0] + rawSizes[1] + rawSizes[2];
-			}
-
-			if ((SrcSize - (srcp - pSrcData)) == 1)
-				srcp++; /* pad */
-		}
-		else /* RLE */
-		{
-			if (alpha)
-			{
-				status = planar_decompress_plane_rle(planes[3], rleSizes[3],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 3,
-				                                     vFlip); /* AlphaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[0], rleSizes[0],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 2,
-				                                     vFlip); /* LumaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[1], rleSizes[1],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 1,
-				                                     vFlip); /* OrangeChromaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[2], rleSizes[2],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 0,
-				                                     vFlip); /* GreenChromaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				srcp += rleSizes[0] + rleSizes[1] + rleSizes[2] + rleSizes[3];
-			}
-			else /* NoAlpha */
-			{
-				status = planar_decompress_plane_rle(planes[0], rleSizes[0],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 2,
-				                                     vFlip); /* LumaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[1], rleSizes[1],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 1,
-				                                     vFlip); /* OrangeChromaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				status = planar_decompress_plane_rle(planes[2], rleSizes[2],
-				                                     pTempData, nTempStep, nXDst, nYDst, nSrcWidth, nSrcHeight, 0,
-				                                     vFlip); /* GreenChromaPlane */
-
-				if (status < 0)
-					return FALSE;
-
-				srcp += rleSizes[0] + rleSizes[1] + rleSizes[2];
-			}
-		}
-
-		if (prims->YCoCgToRGB_8u_AC4R(pTempData, nTempStep, pDstData, DstFormat,
-		                              nDstStep,
+		if (prims->YCoCgToRGB_8u_AC4R(pTempData, nTempStep, pDst, DstFormat, nDstStep,
 		                              w, h, cll, alpha) != PRIMITIVES_SUCCESS)
 			return FALSE;
 	}
 
-	return (SrcSize == (srcp - pSrcData)) ? TRUE : FALSE;
+	if (SrcSize != (srcp - pSrcData))
+		return FALSE;
+
+	freerdp_metric_record_since(FREERDP_METRIC_PLANAR_DECODE_TIME, start);
+	return TRUE;
 }
 
-static INLINE BOOL freerdp_split_color_planes(const BYTE* data, UINT32 format,
+static INLINE BOOL freerdp_split_color_planes(BITMAP_PLANAR_CONTEXT* planar,
+        const BYTE* data, UINT32 format,
         UINT32 width, UINT32 height,
         UINT32 scanline, BYTE* planes[4])
 {
@@ -729,6 +611,34 @@ static INLINE BOOL freerdp_split_color_planes(const BYTE* data, UINT32 format,
 	if (scanline == 0)
 		scanline = width * GetBytesPerPixel(format);
 
+	switch (format)
+	{
+		case PIXEL_FORMAT_BGRA32:
+		case PIXEL_FORMAT_BGRX32:
+			for (i = height - 1; i >= 0; i--)
+			{
+				planar->split_line_32(&data[scanline * i], (format == PIXEL_FORMAT_BGRA32),
+				                      &planes[0][k], &planes[3][k], &planes[2][k], &planes[1][k], width);
+				k += width;
+			}
+
+			return TRUE;
+
+		case PIXEL_FORMAT_RGBA32:
+		case PIXEL_FORMAT_RGBX32:
+			for (i = height - 1; i >= 0; i--)
+			{
+				planar->split_line_32(&data[scanline * i], (format == PIXEL_FORMAT_RGBA32),
+				                      &planes[0][k], &planes[1][k], &planes[2][k], &planes[3][k], width);
+				k += width;
+			}
+
+			return TRUE;
+
+		default:
+			break;
+	}
+
 	for (i = height - 1; i >= 0; i--)
 	{
 		const BYTE* pixel = &data[scanline * i];
@@ -860,74 +770,96 @@ static INLINE UINT32 freerdp_bitmap_planar_write_rle_bytes(
 	return (pOutput - pOutBuffer);
 }
 
+/**
+ * Returns the number of bytes equal to symbol at the start of pInput, comparing
+ * a machine word at a time before falling back to single bytes.
+ */
+static INLINE UINT32 freerdp_bitmap_planar_scan_run(const BYTE* pInput, UINT32 size, BYTE symbol)
+{
+	UINT32 count = 0;
+	const UINT64 pattern = symbol * 0x0101010101010101ULL;
+
+	while ((size - count) >= 8)
+	{
+		UINT64 value;
+		CopyMemory(&value, &pInput[count], sizeof(value));
+
+		if (value != pattern)
+			break;
+
+		count += 8;
+	}
+
+	while ((count < size) && (pInput[count] == symbol))
+		count++;
+
+	return count;
+}
+
 static INLINE UINT32 freerdp_bitmap_planar_encode_rle_bytes(const BYTE* pInBuffer,
         UINT32 inBufferSize,
         BYTE* pOutBuffer,
         UINT32 outBufferSize)
 {
 	BYTE symbol;
-	const BYTE* pInput;
-	BYTE* pOutput;
-	const BYTE* pBytes;
+	UINT32 index;
 	UINT32 cRawBytes;
 	UINT32 nRunLength;
-	UINT32 bSymbolMatch;
 	UINT32 nBytesWritten;
 	UINT32 nTotalBytesWritten;
+	const BYTE* pBytes;
+	BYTE* pOutput;
 	symbol = 0;
+	index = 0;
 	cRawBytes = 0;
-	nRunLength = 0;
-	pInput = pInBuffer;
+	pBytes = pInBuffer;
 	pOutput = pOutBuffer;
 	nTotalBytesWritten = 0;
 
 	if (!outBufferSize)
 		return 0;
 
-	do
+	/**
+	 * Every byte repeating its predecessor (with an implicit zero before the
+	 * first one) extends the current run, any other byte is a raw byte.
+	 * Runs shorter than three bytes are cheaper stored as raw bytes.
+	 */
+	while (index < inBufferSize)
 	{
-		if (!inBufferSize)
-			break;
+		nRunLength = freerdp_bitmap_planar_scan_run(&pInBuffer[index], inBufferSize - index,
+		             symbol);
+		index += nRunLength;
 
-		bSymbolMatch = (symbol == *pInput) ? TRUE : FALSE;
-		symbol = *pInput;
-		pInput++;
-		inBufferSize--;
+		if (index >= inBufferSize)
+			break;
 
-		if (nRunLength && !bSymbolMatch)
+		if (nRunLength < 3)
 		{
-			if (nRunLength < 3)
-			{
-				cRawBytes += nRunLength;
-				nRunLength = 0;
-			}
-			else
-			{
-				pBytes = pInput - (cRawBytes + nRunLength + 1);
-				nBytesWritten = freerdp_bitmap_planar_write_rle_bytes(
-				                    pBytes, cRawBytes,
-				                    nRunLength, pOutput,
-				                    outBufferSize);
-				nRunLength = 0;
+			cRawBytes += nRunLength;
+		}
+		else
+		{
+			nBytesWritten = freerdp_bitmap_planar_write_rle_bytes(
+			                    pBytes, cRawBytes, nRunLength, pOutput, outBufferSize);
 
-				if (!nBytesWritten || (nBytesWritten > outBufferSize))
-					return nRunLength;
+			if (!nBytesWritten || (nBytesWritten > outBufferSize))
+				return 0;
 
-				nTotalBytesWritten += nBytesWritten;
-				outBufferSize -= nBytesWritten;
-				pOutput += nBytesWritten;
-				cRawBytes = 0;
-			}
+			nTotalBytesWritten += nBytesWritten;
+			outBufferSize -= nBytesWritten;
+			pOutput += nBytesWritten;
+			pBytes = &pInBuffer[index];
+			cRawBytes = 0;
 		}
 
-		nRunLength += bSymbolMatch;
-		cRawBytes += (!bSymbolMatch) ? TRUE : FALSE;
+		symbol = pInBuffer[index++];
+		cRawBytes++;
 	}
-	while (outBufferSize);
+
+	nRunLength = inBufferSize - (UINT32)(pBytes - pInBuffer) - cRawBytes;
 
 	if (cRawBytes || nRunLength)
 	{
-		pBytes = pInput - (cRawBytes + nRunLength);
 		nBytesWritten = freerdp_bitmap_planar_write_rle_bytes(pBytes,
 		                cRawBytes, nRunLength, pOutput, outBufferSize);
 
@@ -937,9 +869,6 @@ static INLINE UINT32 freerdp_bitmap_planar_encode_rle_bytes(const BYTE* pInBuffe
 		nTotalBytesWritten += nBytesWritten;
 	}
 
-	if (inBufferSize)
-		return 0;
-
 	return nTotalBytesWritten;
 }
 
@@ -994,6 +923,10 @@ BYTE* freerdp_bitmap_planar_compress_plane_rle(const BYTE* inPlane,
 			break;
 	}
 
+	/* the output buffer ran out before all scanlines were encoded */
+	if (index < height)
+		return NULL;
+
 	*dstSize = nTotalBytesWritten;
 	return outPlane;
 }
@@ -1049,15 +982,11 @@ static INLINE UINT32 freerdp_bitmap_planar_compress_planes_rle(
 	return 1;
 }
 
-BYTE* freerdp_bitmap_planar_delta_encode_plane(const BYTE* inPlane,
-        UINT32 width, UINT32 height,
+BYTE* freerdp_bitmap_planar_delta_encode_plane(BITMAP_PLANAR_CONTEXT* planar,
+        const BYTE* inPlane, UINT32 width, UINT32 height,
         BYTE* outPlane)
 {
-	char s2c;
-	INT32 delta;
-	UINT32 y, x;
-	BYTE* outPtr;
-	const BYTE* srcPtr, *prevLinePtr;
+	UINT32 y;
 
 	if (!outPlane)
 	{
@@ -1070,26 +999,18 @@ BYTE* freerdp_bitmap_planar_delta_encode_plane(const BYTE* inPlane,
 
 	// first line is copied as is
 	CopyMemory(outPlane, inPlane, width);
-	outPtr = outPlane + width;
-	srcPtr = inPlane + width;
-	prevLinePtr = inPlane;
 
 	for (y = 1; y < height; y++)
 	{
-		for (x = 0; x < width; x++, outPtr++, srcPtr++, prevLinePtr++)
-		{
-			delta = *srcPtr - *prevLinePtr;
-			s2c = (delta >= 0) ? (char) delta : (char)(~((BYTE)(-delta)) + 1);
-			s2c = (s2c >= 0) ? (s2c << 1) : (char)(((~((BYTE) s2c) + 1) << 1) - 1);
-			*outPtr = (BYTE)s2c;
-		}
+		planar->delta_encode_line(&inPlane[y * width], &inPlane[(y - 1) * width],
+		                          &outPlane[y * width], width);
 	}
 
 	return outPlane;
 }
 
-static INLINE BOOL freerdp_bitmap_planar_delta_encode_planes(BYTE* inPlanes[4],
-        UINT32 width, UINT32 height,
+static INLINE BOOL freerdp_bitmap_planar_delta_encode_planes(BITMAP_PLANAR_CONTEXT* planar,
+        BYTE* inPlanes[4], UINT32 width, UINT32 height,
         BYTE* outPlanes[4])
 {
 	UINT32 i;
@@ -1097,7 +1018,7 @@ static INLINE BOOL freerdp_bitmap_planar_delta_encode_planes(BYTE* inPlanes[4],
 	for (i = 0; i < 4; i++)
 	{
 		outPlanes[i] = freerdp_bitmap_planar_delta_encode_plane(
-		                   inPlanes[i], width, height, outPlanes[i]);
+		                   planar, inPlanes[i], width, height, outPlanes[i]);
 
 		if (!outPlanes[i])
 			return FALSE;
@@ -1116,6 +1037,7 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context,
 	UINT32 planeSize;
 	UINT32 dstSizes[4] = { 0 };
 	BYTE FormatHeader = 0;
+	const UINT64 start = freerdp_metrics_now();
 
 	if (!context || !context->rlePlanesBuffer)
 		return NULL;
@@ -1125,13 +1047,13 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context,
 
 	planeSize = width * height;
 
-	if (!freerdp_split_color_planes(data, format, width, height, scanline,
+	if (!freerdp_split_color_planes(context, data, format, width, height, scanline,
 	                                context->planes))
 		return NULL;
 
 	if (context->AllowRunLengthEncoding)
 	{
-		if (!freerdp_bitmap_planar_delta_encode_planes(
+		if (!freerdp_bitmap_planar_delta_encode_planes(context,
 		        context->planes, width, height,
 		        context->deltaPlanes))
 			return NULL;
@@ -1252,6 +1174,7 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context,
 
 	size = (dstp - dstData);
 	*pDstSize = size;
+	freerdp_metric_record_since(FREERDP_METRIC_PLANAR_ENCODE_TIME, start);
 	return dstData;
 }
 
@@ -1312,6 +1235,11 @@ BITMAP_PLANAR_CONTEXT* freerdp_bitmap_planar_context_new(
 		context->AllowColorSubsampling = TRUE;
 
 	context->ColorLossLevel = flags & PLANAR_FORMAT_HEADER_CLL_MASK;
+	context->delta_encode_line = planar_delta_encode_line;
+	context->delta_decode_line = planar_delta_decode_line;
+	context->split_line_32 = planar_split_line_32;
+	context->merge_line_32 = planar_merge_line_32;
+	PLANAR_INIT_SIMD(context);
 
 	if (context->ColorLossLevel)
 		context->AllowDynamicColorFidelity = TRUE;
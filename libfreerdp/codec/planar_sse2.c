@@ -0,0 +1,171 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RDP6 Planar Codec - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+#include "planar_sse2.h"
+
+/**
+ * Delta encoding of a scanline against the previous one:
+ * the signed byte difference is stored as magnitude << 1 with the sign in bit 0,
+ * which is (delta << 1) ^ (delta >> 7) in two's complement.
+ */
+static void planar_delta_encode_line_sse2(const BYTE* pSrc, const BYTE* pPrev, BYTE* pDst,
+        UINT32 width)
+{
+	UINT32 x = 0;
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; x + 16 <= width; x += 16)
+	{
+		const __m128i cur = _mm_loadu_si128((const __m128i*) &pSrc[x]);
+		const __m128i prev = _mm_loadu_si128((const __m128i*) &pPrev[x]);
+		const __m128i delta = _mm_sub_epi8(cur, prev);
+		const __m128i sign = _mm_cmpgt_epi8(zero, delta);
+		const __m128i twice = _mm_add_epi8(delta, delta);
+		_mm_storeu_si128((__m128i*) &pDst[x], _mm_xor_si128(twice, sign));
+	}
+
+	for (; x < width; x++)
+	{
+		const BYTE delta = pSrc[x] - pPrev[x];
+		pDst[x] = (BYTE)(delta << 1) ^ ((delta & 0x80) ? 0xFF : 0x00);
+	}
+}
+
+static void planar_delta_decode_line_sse2(BYTE* pLine, const BYTE* pPrev, UINT32 width)
+{
+	UINT32 x = 0;
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i low7 = _mm_set1_epi8(0x7F);
+
+	for (; x + 16 <= width; x += 16)
+	{
+		const __m128i value = _mm_loadu_si128((const __m128i*) &pLine[x]);
+		const __m128i prev = _mm_loadu_si128((const __m128i*) &pPrev[x]);
+		const __m128i magnitude = _mm_and_si128(_mm_srli_epi16(value, 1), low7);
+		const __m128i sign = _mm_cmpeq_epi8(_mm_and_si128(value, one), one);
+		const __m128i delta = _mm_xor_si128(magnitude, sign);
+		_mm_storeu_si128((__m128i*) &pLine[x], _mm_add_epi8(prev, delta));
+	}
+
+	for (; x < width; x++)
+	{
+		const BYTE value = pLine[x];
+		pLine[x] = pPrev[x] + ((value >> 1) ^ ((value & 1) ? 0xFF : 0x00));
+	}
+}
+
+static void planar_split_line_32_sse2(const BYTE* pSrc, BOOL alpha, BYTE* pA, BYTE* pC0,
+                                      BYTE* pC1, BYTE* pC2, UINT32 width)
+{
+	UINT32 x = 0;
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	const __m128i opaque = _mm_set1_epi8((char) 0xFF);
+
+	for (; x + 16 <= width; x += 16)
+	{
+		const __m128i p0 = _mm_loadu_si128((const __m128i*) &pSrc[x * 4 + 0]);
+		const __m128i p1 = _mm_loadu_si128((const __m128i*) &pSrc[x * 4 + 16]);
+		const __m128i p2 = _mm_loadu_si128((const __m128i*) &pSrc[x * 4 + 32]);
+		const __m128i p3 = _mm_loadu_si128((const __m128i*) &pSrc[x * 4 + 48]);
+		/* every channel is isolated in the low byte of a 32 bit lane, then the
+		 * lanes are narrowed 32 -> 16 -> 8 bit without saturating */
+		__m128i lo = _mm_packs_epi32(_mm_and_si128(p0, mask), _mm_and_si128(p1, mask));
+		__m128i hi = _mm_packs_epi32(_mm_and_si128(p2, mask), _mm_and_si128(p3, mask));
+		_mm_storeu_si128((__m128i*) &pC0[x], _mm_packus_epi16(lo, hi));
+		lo = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask),
+		                     _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+		hi = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 8), mask),
+		                     _mm_and_si128(_mm_srli_epi32(p3, 8), mask));
+		_mm_storeu_si128((__m128i*) &pC1[x], _mm_packus_epi16(lo, hi));
+		lo = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask),
+		                     _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+		hi = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 16), mask),
+		                     _mm_and_si128(_mm_srli_epi32(p3, 16), mask));
+		_mm_storeu_si128((__m128i*) &pC2[x], _mm_packus_epi16(lo, hi));
+
+		if (alpha)
+		{
+			lo = _mm_packs_epi32(_mm_srli_epi32(p0, 24), _mm_srli_epi32(p1, 24));
+			hi = _mm_packs_epi32(_mm_srli_epi32(p2, 24), _mm_srli_epi32(p3, 24));
+			_mm_storeu_si128((__m128i*) &pA[x], _mm_packus_epi16(lo, hi));
+		}
+		else
+			_mm_storeu_si128((__m128i*) &pA[x], opaque);
+	}
+
+	for (; x < width; x++)
+	{
+		const BYTE* pixel = &pSrc[x * 4];
+		pC0[x] = pixel[0];
+		pC1[x] = pixel[1];
+		pC2[x] = pixel[2];
+		pA[x] = alpha ? pixel[3] : 0xFF;
+	}
+}
+
+static void planar_merge_line_32_sse2(BYTE* pDst, const BYTE* pA, const BYTE* pC0,
+                                      const BYTE* pC1, const BYTE* pC2, UINT32 width)
+{
+	UINT32 x = 0;
+	const __m128i opaque = _mm_set1_epi8((char) 0xFF);
+
+	for (; x + 16 <= width; x += 16)
+	{
+		const __m128i c0 = _mm_loadu_si128((const __m128i*) &pC0[x]);
+		const __m128i c1 = _mm_loadu_si128((const __m128i*) &pC1[x]);
+		const __m128i c2 = _mm_loadu_si128((const __m128i*) &pC2[x]);
+		const __m128i a = pA ? _mm_loadu_si128((const __m128i*) &pA[x]) : opaque;
+		const __m128i c01lo = _mm_unpacklo_epi8(c0, c1);
+		const __m128i c01hi = _mm_unpackhi_epi8(c0, c1);
+		const __m128i c2alo = _mm_unpacklo_epi8(c2, a);
+		const __m128i c2ahi = _mm_unpackhi_epi8(c2, a);
+		_mm_storeu_si128((__m128i*) &pDst[x * 4 + 0], _mm_unpacklo_epi16(c01lo, c2alo));
+		_mm_storeu_si128((__m128i*) &pDst[x * 4 + 16], _mm_unpackhi_epi16(c01lo, c2alo));
+		_mm_storeu_si128((__m128i*) &pDst[x * 4 + 32], _mm_unpacklo_epi16(c01hi, c2ahi));
+		_mm_storeu_si128((__m128i*) &pDst[x * 4 + 48], _mm_unpackhi_epi16(c01hi, c2ahi));
+	}
+
+	for (; x < width; x++)
+	{
+		BYTE* pixel = &pDst[x * 4];
+		pixel[0] = pC0[x];
+		pixel[1] = pC1[x];
+		pixel[2] = pC2[x];
+		pixel[3] = pA ? pA[x] : 0xFF;
+	}
+}
+
+void planar_init_sse2(BITMAP_PLANAR_CONTEXT* context)
+{
+	if (!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+		return;
+
+	context->delta_encode_line = planar_delta_encode_line_sse2;
+	context->delta_decode_line = planar_delta_decode_line_sse2;
+	context->split_line_32 = planar_split_line_32_sse2;
+	context->merge_line_32 = planar_merge_line_32_sse2;
+}
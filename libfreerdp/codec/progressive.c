@@ -30,6 +30,7 @@
 #include <freerdp/codec/progressive.h>
 #include <freerdp/codec/region.h>
 #include <freerdp/log.h>
+#include <freerdp/utils/metrics.h>
 
 #include "rfx_differential.h"
 #include "rfx_quantization.h"
@@ -1556,6 +1557,7 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 	REGION16 clippingRects, updateRegion;
 	PROGRESSIVE_SURFACE_CONTEXT* surface;
 	PROGRESSIVE_BLOCK_REGION* region;
+	const UINT64 start = freerdp_metrics_now();
 	surface = (PROGRESSIVE_SURFACE_CONTEXT*) progressive_get_surface_data(
 	              progressive, surfaceId);
 
@@ -1916,6 +1918,10 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 	}
 
 	region16_uninit(&clippingRects);
+
+	if (rc >= 0)
+		freerdp_metric_record_since(FREERDP_METRIC_PROGRESSIVE_DECODE_TIME, start);
+
 	return rc;
 }
 
@@ -40,6 +40,7 @@
 #include <freerdp/primitives.h>
 #include <freerdp/codec/region.h>
 #include <freerdp/build-config.h>
+#include <freerdp/utils/metrics.h>
 #include <freerdp/codec/region.h>
 
 #include "rfx_constants.h"
@@ -1007,6 +1008,7 @@ BOOL rfx_process_message(RFX_CONTEXT* context, const BYTE* data, UINT32 length,
 	wStream* s = NULL;
 	BOOL ok = TRUE;
 	UINT16 expectedDataBlockType = WBT_FRAME_BEGIN;
+	const UINT64 start = freerdp_metrics_now();
 
 	if (!context || !data || !length)
 		goto fail;
@@ -1204,6 +1206,7 @@ BOOL rfx_process_message(RFX_CONTEXT* context, const BYTE* data, UINT32 length,
 		region16_uninit(&clippingRects);
 		Stream_Free(s, FALSE);
 		rfx_message_free(context, message);
+		freerdp_metric_record_since(FREERDP_METRIC_RFX_DECODE_TIME, start);
 		return TRUE;
 	}
 
@@ -1437,6 +1440,7 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects,
 	RECTANGLE_16 currentTileRect;
 	const RECTANGLE_16* regionRect;
 	const RECTANGLE_16* extents;
+	const UINT64 start = freerdp_metrics_now();
 	assert(data);
 	assert(rects);
 	assert(numRects > 0);
@@ -1650,7 +1654,10 @@ skip_encoding_loop:
 	region16_uninit(&rectsRegion);
 
 	if (success)
+	{
+		freerdp_metric_record_since(FREERDP_METRIC_RFX_ENCODE_TIME, start);
 		return message;
+	}
 
 	WLog_ERR(TAG, "%s: failed", __FUNCTION__);
 	message->freeRects = TRUE;
@@ -32,12 +32,10 @@
 
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/synch.h>
 #include <winpr/sysinfo.h>
-#include <winpr/bitstream.h>
 #include <winpr/intrin.h>
 
-#include "rfx_bitstream.h"
-
 #include "rfx_rlgr.h"
 
 /* Constants used in RLGR1/RLGR3 algorithm */
@@ -48,18 +46,6 @@
 #define UQ_GR	(3)	/* increase in kp after nonzero symbol in GR mode */
 #define DQ_GR	(3)	/* decrease in kp after zero symbol in GR mode */
 
-/* Returns the least number of bits required to represent a given value */
-#define GetMinBits(_val, _nbits) \
-{ \
-	UINT32 _v = _val; \
-	_nbits = 0; \
-	while (_v) \
-	{ \
-		_v >>= 1; \
-		_nbits++; \
-	} \
-}
-
 /*
  * Update the passed parameter and clamp it to the range [0, KPMAX]
  * Return the value of parameter right-shifted by LSGR
@@ -74,13 +60,28 @@
 	_k = (_param >> LSGR); \
 }
 
+#if defined(_WIN32)
 static BOOL g_LZCNT = FALSE;
+static INIT_ONCE g_LZCNTOnce = INIT_ONCE_STATIC_INIT;
+
+/* CPUID is expensive (and traps in virtual machines), probe it only once */
+static BOOL CALLBACK rfx_rlgr_init_lzcnt(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	g_LZCNT = IsProcessorFeaturePresentEx(PF_EX_LZCNT);
+	return TRUE;
+}
+#endif
 
 static INLINE UINT32 lzcnt_s(UINT32 x)
 {
 	if (!x)
 		return 32;
-	
+
+#if defined(_WIN32)
+	/* the MSVC intrinsic requires the LZCNT instruction, elsewhere __lzcnt
+	 * maps to a compiler builtin that is available on any CPU */
+	InitOnceExecuteOnce(&g_LZCNTOnce, rfx_rlgr_init_lzcnt, NULL, NULL);
+
 	if (!g_LZCNT)
 	{
 		UINT32 y;
@@ -92,18 +93,165 @@ static INLINE UINT32 lzcnt_s(UINT32 x)
 		y = x >>  1;  if (y != 0) return n - 2;
 		return n - x;
 	}
+#endif
 
 	return __lzcnt(x);
 }
 
+/* x must not be zero */
+static INLINE UINT32 lzcnt64_s(UINT64 x)
+{
+#if defined(__GNUC__)
+	return (UINT32) __builtin_clzll(x);
+#else
+	const UINT32 hi = (UINT32)(x >> 32);
+
+	if (hi)
+		return lzcnt_s(hi);
+
+	return 32 + lzcnt_s((UINT32) x);
+#endif
+}
+
+/**
+ * Bit reader working on a 64-bit MSB aligned accumulator.
+ * bits is the number of valid bits in the accumulator, the bits below may
+ * already hold upcoming stream data but are not accounted for yet.
+ */
+struct _RFX_RLGR_READER
+{
+	const BYTE* data;
+	const BYTE* end;
+	UINT64 accumulator;
+	UINT32 bits;
+};
+typedef struct _RFX_RLGR_READER RFX_RLGR_READER;
+
+static INLINE void rfx_rlgr_reader_refill(RFX_RLGR_READER* br)
+{
+	if (br->bits > 56)
+		return;
+
+	if ((br->end - br->data) >= 8)
+	{
+		const BYTE* p = br->data;
+		const UINT64 value = ((UINT64) p[0] << 56) | ((UINT64) p[1] << 48) |
+		                     ((UINT64) p[2] << 40) | ((UINT64) p[3] << 32) |
+		                     ((UINT64) p[4] << 24) | ((UINT64) p[5] << 16) |
+		                     ((UINT64) p[6] << 8) | ((UINT64) p[7]);
+		br->accumulator |= value >> br->bits;
+		br->data += (63 - br->bits) >> 3;
+		br->bits |= 56;
+		return;
+	}
+
+	while ((br->bits <= 56) && (br->data < br->end))
+	{
+		br->accumulator |= ((UINT64) * br->data++) << (56 - br->bits);
+		br->bits += 8;
+	}
+}
+
+static INLINE UINT32 rfx_rlgr_reader_remaining(const RFX_RLGR_READER* br)
+{
+	return br->bits + (UINT32)(br->end - br->data) * 8;
+}
+
+static INLINE void rfx_rlgr_reader_skip(RFX_RLGR_READER* br, UINT32 nbits)
+{
+	br->accumulator <<= nbits;
+	br->bits -= nbits;
+}
+
+/* Reads up to 32 bits, the caller checks that enough bits are remaining */
+static INLINE UINT32 rfx_rlgr_reader_get_bits(RFX_RLGR_READER* br, UINT32 nbits)
+{
+	UINT32 value;
+
+	if (!nbits)
+		return 0;
+
+	if (br->bits < nbits)
+		rfx_rlgr_reader_refill(br);
+
+	value = (UINT32)(br->accumulator >> (64 - nbits));
+	rfx_rlgr_reader_skip(br, nbits);
+	return value;
+}
+
+/**
+ * Counts and consumes the run of identical leading bits (ones or zeros),
+ * stopping at the first differing bit or at the end of the stream.
+ */
+static INLINE UINT32 rfx_rlgr_reader_count_run(RFX_RLGR_READER* br, BOOL ones)
+{
+	UINT32 count = 0;
+
+	for (;;)
+	{
+		UINT32 cnt;
+		UINT64 value;
+		rfx_rlgr_reader_refill(br);
+
+		if (!br->bits)
+			break;
+
+		value = ones ? ~br->accumulator : br->accumulator;
+		cnt = value ? lzcnt64_s(value) : 64;
+
+		if (cnt < br->bits)
+		{
+			rfx_rlgr_reader_skip(br, cnt);
+			count += cnt;
+			break;
+		}
+
+		count += br->bits;
+		br->accumulator = 0;
+		br->bits = 0;
+	}
+
+	return count;
+}
+
+/**
+ * Reads a Golomb-Rice code (unary prefix of ones, a zero, kr bits) and
+ * updates kr/krp. Returns FALSE if the stream ends in the middle of the code.
+ */
+static INLINE BOOL rfx_rlgr_read_gr(RFX_RLGR_READER* br, int* kr, int* krp, UINT16* code)
+{
+	const UINT32 vk = rfx_rlgr_reader_count_run(br, TRUE);
+
+	if (rfx_rlgr_reader_remaining(br) < 1)
+		return FALSE;
+
+	rfx_rlgr_reader_skip(br, 1);
+
+	if (rfx_rlgr_reader_remaining(br) < (UINT32) *kr)
+		return FALSE;
+
+	*code = (UINT16) rfx_rlgr_reader_get_bits(br, *kr);
+	*code |= (vk << *kr);
+
+	if (!vk)
+	{
+		/* update kr, krp params */
+		UpdateParam(*krp, -2, *kr);
+	}
+	else if (vk != 1)
+	{
+		/* update kr, krp params */
+		UpdateParam(*krp, (int) vk, *kr);
+	}
+
+	return TRUE;
+}
+
 int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16* pDstData, UINT32 DstSize)
 {
-	int vk;
-	int run;
-	int cnt;
-	int size;
-	int nbits;
-	int offset;
+	UINT32 vk;
+	UINT32 run;
+	UINT32 size;
 	INT16 mag;
 	int k, kp;
 	int kr, krp;
@@ -113,10 +261,9 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 	UINT32 val1;
 	UINT32 val2;
 	INT16* pOutput;
-	wBitStream* bs;
-	wBitStream s_bs;
-
-	g_LZCNT = IsProcessorFeaturePresentEx(PF_EX_LZCNT);
+	INT16* pOutputEnd;
+	RFX_RLGR_READER* br;
+	RFX_RLGR_READER s_br;
 
 	k = 1;
 	kp = k << LSGR;
@@ -134,159 +281,64 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 		return -1;
 
 	pOutput = pDstData;
+	pOutputEnd = pDstData + DstSize;
 
-	bs = &s_bs;
+	br = &s_br;
+	br->data = pSrcData;
+	br->end = pSrcData + SrcSize;
+	br->accumulator = 0;
+	br->bits = 0;
 
-	BitStream_Attach(bs, pSrcData, SrcSize);
-	BitStream_Fetch(bs);
-
-	while ((BitStream_GetRemainingLength(bs) > 0) && ((pOutput - pDstData) < DstSize))
+	while ((rfx_rlgr_reader_remaining(br) > 0) && (pOutput < pOutputEnd))
 	{
 		if (k)
 		{
 			/* Run-Length (RL) Mode */
 
-			run = 0;
-
 			/* count number of leading 0s */
 
-			cnt = lzcnt_s(bs->accumulator);
-
-			nbits = BitStream_GetRemainingLength(bs);
-
-			if (cnt > nbits)
-				cnt = nbits;
-
-			vk = cnt;
-
-			while ((cnt == 32) && (BitStream_GetRemainingLength(bs) > 0))
-			{
-				BitStream_Shift32(bs);
+			vk = rfx_rlgr_reader_count_run(br, FALSE);
 
-				cnt = lzcnt_s(bs->accumulator);
-
-				nbits = BitStream_GetRemainingLength(bs);
-
-				if (cnt > nbits)
-					cnt = nbits;
-
-				vk += cnt;
-			}
-
-			BitStream_Shift(bs, (vk % 32));
-
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (rfx_rlgr_reader_remaining(br) < 1)
 				break;
 
-			BitStream_Shift(bs, 1);
-
-			while (vk--)
-			{
-				run += (1 << k); /* add (1 << k) to run length */
-
-				/* update k, kp params */
+			rfx_rlgr_reader_skip(br, 1);
 
-				kp += UP_GR;
+			/* add (1 << k) to run length for each zero, updating k until kp saturates */
 
-				if (kp > KPMAX)
-					kp = KPMAX;
+			run = 0;
 
-				k = kp >> LSGR;
+			while (vk && (kp < KPMAX))
+			{
+				run += (1 << k);
+				UpdateParam(kp, UP_GR, k);
+				vk--;
 			}
 
+			run += (vk << k);
+
 			/* next k bits contain run length remainder */
 
-			if (BitStream_GetRemainingLength(bs) < k)
+			if (rfx_rlgr_reader_remaining(br) < (UINT32) k)
 				break;
 
-			bs->mask = ((1 << k) - 1);
-			run += ((bs->accumulator >> (32 - k)) & bs->mask);
-			BitStream_Shift(bs, k);
+			run += rfx_rlgr_reader_get_bits(br, k);
 
 			/* read sign bit */
 
-			if (BitStream_GetRemainingLength(bs) < 1)
-				break;
-
-			sign = (bs->accumulator & 0x80000000) ? 1 : 0;
-			BitStream_Shift(bs, 1);
-
-			/* count number of leading 1s */
-
-			cnt = lzcnt_s(~(bs->accumulator));
-
-			nbits = BitStream_GetRemainingLength(bs);
-
-			if (cnt > nbits)
-				cnt = nbits;
-
-			vk = cnt;
-
-			while ((cnt == 32) && (BitStream_GetRemainingLength(bs) > 0))
-			{
-				BitStream_Shift32(bs);
-
-				cnt = lzcnt_s(~(bs->accumulator));
-
-				nbits = BitStream_GetRemainingLength(bs);
-
-				if (cnt > nbits)
-					cnt = nbits;
-
-				vk += cnt;
-			}
-
-			BitStream_Shift(bs, (vk % 32));
-
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (rfx_rlgr_reader_remaining(br) < 1)
 				break;
 
-			BitStream_Shift(bs, 1);
+			sign = rfx_rlgr_reader_get_bits(br, 1);
 
-			/* next kr bits contain code remainder */
+			/* GR code of (magnitude - 1) */
 
-			if (BitStream_GetRemainingLength(bs) < kr)
+			if (!rfx_rlgr_read_gr(br, &kr, &krp, &code))
 				break;
 
-			bs->mask = ((1 << kr) - 1);
-			code = (UINT16) ((bs->accumulator >> (32 - kr)) & bs->mask);
-			BitStream_Shift(bs, kr);
-
-			/* add (vk << kr) to code */
-
-			code |= (vk << kr);
-
-			if (!vk)
-			{
-				/* update kr, krp params */
-
-				krp -= 2;
-
-				if (krp < 0)
-					krp = 0;
-
-				kr = krp >> LSGR;
-			}
-			else if (vk != 1)
-			{
-				/* update kr, krp params */
-
-				krp += vk;
-
-				if (krp > KPMAX)
-					krp = KPMAX;
-
-				kr = krp >> LSGR;
-			}
-
 			/* update k, kp params */
 
-			kp -= DN_GR;
-
-			if (kp < 0)
-				kp = 0;
-
-			k = kp >> LSGR;
+			UpdateParam(kp, -DN_GR, k);
 
 			/* compute magnitude from code */
 
@@ -297,11 +349,10 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 
 			/* write to output stream */
 
-			offset = (int) (pOutput - pDstData);
-			size = run;
+			size = (UINT32) (pOutputEnd - pOutput);
 
-			if ((offset + size) > DstSize)
-				size = DstSize - offset;
+			if (run < size)
+				size = run;
 
 			if (size)
 			{
@@ -309,96 +360,23 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 				pOutput += size;
 			}
 
-			if ((pOutput - pDstData) < DstSize)
-			{
-				*pOutput = mag;
-				pOutput++;
-			}
+			if (pOutput < pOutputEnd)
+				*pOutput++ = mag;
 		}
 		else
 		{
 			/* Golomb-Rice (GR) Mode */
 
-			/* count number of leading 1s */
-
-			cnt = lzcnt_s(~(bs->accumulator));
-
-			nbits = BitStream_GetRemainingLength(bs);
-
-			if (cnt > nbits)
-				cnt = nbits;
-
-			vk = cnt;
-
-			while ((cnt == 32) && (BitStream_GetRemainingLength(bs) > 0))
-			{
-				BitStream_Shift32(bs);
-
-				cnt = lzcnt_s(~(bs->accumulator));
-
-				nbits = BitStream_GetRemainingLength(bs);
-
-				if (cnt > nbits)
-					cnt = nbits;
-
-				vk += cnt;
-			}
-
-			BitStream_Shift(bs, (vk % 32));
-
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (!rfx_rlgr_read_gr(br, &kr, &krp, &code))
 				break;
 
-			BitStream_Shift(bs, 1);
-
-			/* next kr bits contain code remainder */
-
-			if (BitStream_GetRemainingLength(bs) < kr)
-				break;
-
-			bs->mask = ((1 << kr) - 1);
-			code = (UINT16) ((bs->accumulator >> (32 - kr)) & bs->mask);
-			BitStream_Shift(bs, kr);
-
-			/* add (vk << kr) to code */
-
-			code |= (vk << kr);
-
-			if (!vk)
-			{
-				/* update kr, krp params */
-
-				krp -= 2;
-
-				if (krp < 0)
-					krp = 0;
-
-				kr = krp >> LSGR;
-			}
-			else if (vk != 1)
-			{
-				/* update kr, krp params */
-
-				krp += vk;
-
-				if (krp > KPMAX)
-					krp = KPMAX;
-
-				kr = krp >> LSGR;
-			}
-
 			if (mode == RLGR1) /* RLGR1 */
 			{
 				if (!code)
 				{
 					/* update k, kp params */
 
-					kp += UQ_GR;
-
-					if (kp > KPMAX)
-						kp = KPMAX;
-
-					k = kp >> LSGR;
+					UpdateParam(kp, UQ_GR, k);
 
 					mag = 0;
 				}
@@ -406,12 +384,7 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 				{
 					/* update k, kp params */
 
-					kp -= DQ_GR;
-
-					if (kp < 0)
-						kp = 0;
-
-					k = kp >> LSGR;
+					UpdateParam(kp, -DQ_GR, k);
 
 					/*
 					 * code = 2 * mag - sign
@@ -424,52 +397,29 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 						mag = (INT16) (code >> 1);
 				}
 
-				if ((pOutput - pDstData) < DstSize)
-				{
-					*pOutput = mag;
-					pOutput++;
-				}
+				*pOutput++ = mag;
 			}
 			else if (mode == RLGR3) /* RLGR3 */
 			{
-				nIdx = 0;
+				nIdx = code ? (32 - lzcnt_s(code)) : 0;
 
-				if (code)
-				{
-					mag = (UINT32) code;
-					nIdx = 32 - lzcnt_s(mag);
-				}
-
-				if (BitStream_GetRemainingLength(bs) < nIdx)
+				if (rfx_rlgr_reader_remaining(br) < nIdx)
 					break;
 
-				bs->mask = ((1 << nIdx) - 1);
-				val1 = ((bs->accumulator >> (32 - nIdx)) & bs->mask);
-				BitStream_Shift(bs, nIdx);
-
+				val1 = rfx_rlgr_reader_get_bits(br, nIdx);
 				val2 = code - val1;
 
 				if (val1 && val2)
 				{
 					/* update k, kp params */
 
-					kp -= (2 * DQ_GR);
-
-					if (kp < 0)
-						kp = 0;
-
-					k = kp >> LSGR;
+					UpdateParam(kp, -(2 * DQ_GR), k);
 				}
 				else if (!val1 && !val2)
 				{
 					/* update k, kp params */
 
-					kp += (2 * UQ_GR);
-
-					if (kp > KPMAX)
-						kp = KPMAX;
-
-					k = kp >> LSGR;
+					UpdateParam(kp, (2 * UQ_GR), k);
 				}
 
 				if (val1 & 1)
@@ -477,89 +427,130 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 				else
 					mag = (INT16) (val1 >> 1);
 
-				if ((pOutput - pDstData) < DstSize)
-				{
-					*pOutput = mag;
-					pOutput++;
-				}
+				*pOutput++ = mag;
 
 				if (val2 & 1)
 					mag = ((INT16) ((val2 + 1) >> 1)) * -1;
 				else
 					mag = (INT16) (val2 >> 1);
 
-				if ((pOutput - pDstData) < DstSize)
-				{
-					*pOutput = mag;
-					pOutput++;
-				}
+				if (pOutput < pOutputEnd)
+					*pOutput++ = mag;
 			}
 		}
 	}
 
-	offset = (int) (pOutput - pDstData);
+	if (pOutput < pOutputEnd)
+		ZeroMemory(pOutput, (pOutputEnd - pOutput) * sizeof(INT16));
+
+	return 1;
+}
 
-	if (offset < DstSize)
+/**
+ * Bit writer collecting up to 63 bits in a 64-bit accumulator and emitting
+ * 32 bits at a time. Data past the end of the buffer is dropped, the buffer
+ * does not need to be zeroed.
+ */
+struct _RFX_RLGR_WRITER
+{
+	BYTE* buffer;
+	UINT32 capacity;
+	UINT32 position;
+	UINT64 accumulator;
+	UINT32 bits;
+};
+typedef struct _RFX_RLGR_WRITER RFX_RLGR_WRITER;
+
+static INLINE void rfx_rlgr_writer_emit_byte(RFX_RLGR_WRITER* bw, BYTE value)
+{
+	if (bw->position < bw->capacity)
+		bw->buffer[bw->position] = value;
+
+	bw->position++;
+}
+
+/* Writes up to 32 bits */
+static INLINE void rfx_rlgr_writer_put_bits(RFX_RLGR_WRITER* bw, UINT32 value, UINT32 nbits)
+{
+	bw->accumulator = (bw->accumulator << nbits) | (value & ((1ULL << nbits) - 1));
+	bw->bits += nbits;
+
+	if (bw->bits >= 32)
 	{
-		size = DstSize - offset;
-		ZeroMemory(pOutput, size * 2);
-		pOutput += size;
+		const UINT32 out = (UINT32)(bw->accumulator >> (bw->bits - 32));
+		bw->bits -= 32;
+
+		if (bw->position + 4 <= bw->capacity)
+		{
+			BYTE* p = &bw->buffer[bw->position];
+			p[0] = (BYTE)(out >> 24);
+			p[1] = (BYTE)(out >> 16);
+			p[2] = (BYTE)(out >> 8);
+			p[3] = (BYTE) out;
+			bw->position += 4;
+		}
+		else
+		{
+			rfx_rlgr_writer_emit_byte(bw, (BYTE)(out >> 24));
+			rfx_rlgr_writer_emit_byte(bw, (BYTE)(out >> 16));
+			rfx_rlgr_writer_emit_byte(bw, (BYTE)(out >> 8));
+			rfx_rlgr_writer_emit_byte(bw, (BYTE) out);
+		}
 	}
+}
 
-	offset = (int) (pOutput - pDstData);
+/* Emit a bit (0 or 1), count number of times */
+static INLINE void rfx_rlgr_writer_put_run(RFX_RLGR_WRITER* bw, UINT32 count, UINT32 bit)
+{
+	const UINT32 pattern = bit ? 0xFFFFFFFF : 0;
 
-	if (offset != DstSize)
-		return -1;
+	for (; count > 32; count -= 32)
+		rfx_rlgr_writer_put_bits(bw, pattern, 32);
 
-	return 1;
+	rfx_rlgr_writer_put_bits(bw, pattern, count);
 }
 
-/* Returns the next coefficient (a signed int) to encode, from the input stream */
-#define GetNextInput(_n) \
-{ \
-	if (data_size > 0) \
-	{ \
-		_n = *data++; \
-		data_size--; \
-	} \
-	else \
-	{ \
-		_n = 0; \
-	} \
-}
+/* Flushes the pending bits and returns the number of bytes written */
+static INLINE UINT32 rfx_rlgr_writer_flush(RFX_RLGR_WRITER* bw)
+{
+	while (bw->bits >= 8)
+	{
+		bw->bits -= 8;
+		rfx_rlgr_writer_emit_byte(bw, (BYTE)(bw->accumulator >> bw->bits));
+	}
 
-/* Emit bitPattern to the output bitstream */
-#define OutputBits(numBits, bitPattern) rfx_bitstream_put_bits(bs, bitPattern, numBits)
+	if (bw->bits)
+	{
+		rfx_rlgr_writer_emit_byte(bw, (BYTE)(bw->accumulator << (8 - bw->bits)));
+		bw->bits = 0;
+	}
 
-/* Emit a bit (0 or 1), count number of times, to the output bitstream */
-#define OutputBit(count, bit) \
-{	\
-	UINT16 _b = (bit ? 0xFFFF : 0); \
-	int _c = (count); \
-	for (; _c > 0; _c -= 16) \
-		rfx_bitstream_put_bits(bs, _b, (_c > 16 ? 16 : _c)); \
+	return (bw->position < bw->capacity) ? bw->position : bw->capacity;
 }
 
-/* Converts the input value to (2 * abs(input) - sign(input)), where sign(input) = (input < 0 ? 1 : 0) and returns it */
-#define Get2MagSign(input) ((input) >= 0 ? 2 * (input) : -2 * (input) - 1)
+/* Converts the input value to (2 * abs(input) - sign(input)), where sign(input) = (input < 0 ? 1 : 0) */
+static INLINE UINT32 rfx_rlgr_get_2magsign(INT32 input)
+{
+	return (UINT32)((input << 1) ^ (input >> 31));
+}
 
 /* Outputs the Golomb/Rice encoding of a non-negative integer */
-#define CodeGR(krp, val) rfx_rlgr_code_gr(bs, krp, val)
-
-static void rfx_rlgr_code_gr(RFX_BITSTREAM* bs, int* krp, UINT32 val)
+static INLINE void rfx_rlgr_code_gr(RFX_RLGR_WRITER* bw, int* krp, UINT32 val)
 {
 	int kr = *krp >> LSGR;
+	const UINT32 vk = val >> kr;
+	const UINT32 remainder = val & ((1 << kr) - 1);
 
-	/* unary part of GR code */
-
-	UINT32 vk = (val) >> kr;
-	OutputBit(vk, 1);
-	OutputBit(1, 0);
-
-	/* remainder part of GR code, if needed */
-	if (kr)
+	/* unary part of GR code (vk ones and a zero) followed by the kr bit remainder */
+	if (vk + 1 + kr <= 32)
+	{
+		rfx_rlgr_writer_put_bits(bw, (UINT32)(((1ULL << vk) - 1) << (kr + 1)) | remainder,
+		                         vk + 1 + kr);
+	}
+	else
 	{
-		OutputBits(kr, val & ((1 << kr) - 1));
+		rfx_rlgr_writer_put_run(bw, vk, 1);
+		rfx_rlgr_writer_put_bits(bw, remainder, kr + 1);
 	}
 
 	/* update krp, only if it is not equal to 1 */
@@ -567,9 +558,9 @@ static void rfx_rlgr_code_gr(RFX_BITSTREAM* bs, int* krp, UINT32 val)
 	{
 		UpdateParam(*krp, -2, kr);
 	}
- 	else if (vk > 1)
+	else if (vk > 1)
 	{
-		UpdateParam(*krp, vk, kr);
+		UpdateParam(*krp, (int) vk, kr);
 	}
 }
 
@@ -578,13 +569,15 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 	int k;
 	int kp;
 	int krp;
-	RFX_BITSTREAM* bs;
-	int processed_size;
+	RFX_RLGR_WRITER* bw;
+	RFX_RLGR_WRITER s_bw;
 
-	if (!(bs = (RFX_BITSTREAM*) calloc(1, sizeof(RFX_BITSTREAM))))
-		return 0;
-
-	rfx_bitstream_attach(bs, buffer, buffer_size);
+	bw = &s_bw;
+	bw->buffer = buffer;
+	bw->capacity = buffer_size;
+	bw->position = 0;
+	bw->accumulator = 0;
+	bw->bits = 0;
 
 	/* initialize the parameters */
 	k = 1;
@@ -594,51 +587,71 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 	/* process all the input coefficients */
 	while (data_size > 0)
 	{
-		int input;
+		INT32 input;
 
 		if (k)
 		{
-			int numZeros;
-			int runmax;
-			int mag;
-			int sign;
+			UINT32 numZeros;
+			UINT32 runmax;
+			UINT32 mag;
+			UINT32 sign;
+			UINT32 n = 0;
 
 			/* RUN-LENGTH MODE */
 
-			/* collect the run of zeros in the input stream */
-			numZeros = 0;
-			GetNextInput(input);
-			while (input == 0 && data_size > 0)
+			/* collect the run of zeros in the input stream, four coefficients at a time */
+			while ((n + 4 <= data_size) && !(data[n] | data[n + 1] | data[n + 2] | data[n + 3]))
+				n += 4;
+
+			while ((n < data_size) && !data[n])
+				n++;
+
+			if (n < data_size)
 			{
-				numZeros++;
-				GetNextInput(input);
+				numZeros = n;
+				input = data[n];
+				data += n + 1;
+				data_size -= n + 1;
+			}
+			else
+			{
+				/* the last zero coefficient is encoded as the terminating value */
+				numZeros = n - 1;
+				input = 0;
+				data += n;
+				data_size = 0;
 			}
 
-			// emit output zeros
+			/* emit output zeros */
 			runmax = 1 << k;
-			while (numZeros >= runmax)
+
+			while ((numZeros >= runmax) && (kp < KPMAX))
 			{
-				OutputBit(1, 0); /* output a zero bit */
+				rfx_rlgr_writer_put_bits(bw, 0, 1); /* output a zero bit */
 				numZeros -= runmax;
 				UpdateParam(kp, UP_GR, k); /* update kp, k */
 				runmax = 1 << k;
 			}
 
-			/* output a 1 to terminate runs */
-			OutputBit(1, 1);
+			/* once kp saturated every zero bit stands for (1 << k) coefficients */
+			if (numZeros >= runmax)
+			{
+				rfx_rlgr_writer_put_run(bw, numZeros >> k, 0);
+				numZeros &= runmax - 1;
+			}
 
-			/* output the remaining run length using k bits */
-			OutputBits(k, numZeros);
+			/* output a 1 to terminate runs, then the remaining run length using k bits */
+			rfx_rlgr_writer_put_bits(bw, (1 << k) | numZeros, k + 1);
 
 			/* note: when we reach here and the last byte being encoded is 0, we still
 			   need to output the last two bits, otherwise mstsc will crash */
 
 			/* encode the nonzero value using GR coding */
-			mag = (input < 0 ? -input : input); /* absolute value of input coefficient */
+			mag = (UINT32)(input < 0 ? -input : input); /* absolute value of input coefficient */
 			sign = (input < 0 ? 1 : 0);  /* sign of input coefficient */
 
-			OutputBit(1, sign); /* output the sign bit */
-			CodeGR(&krp, mag ? mag - 1 : 0); /* output GR code for (mag - 1) */
+			rfx_rlgr_writer_put_bits(bw, sign, 1); /* output the sign bit */
+			rfx_rlgr_code_gr(bw, &krp, mag ? mag - 1 : 0); /* output GR code for (mag - 1) */
 
 			UpdateParam(kp, -DN_GR, k);
 		}
@@ -653,21 +666,15 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 				/* RLGR1 variant */
 
 				/* convert input to (2*magnitude - sign), encode using GR code */
-				GetNextInput(input);
-				twoMs = Get2MagSign(input);
-				CodeGR(&krp, twoMs);
+				input = *data++;
+				data_size--;
+				twoMs = rfx_rlgr_get_2magsign(input);
+				rfx_rlgr_code_gr(bw, &krp, twoMs);
 
 				/* update k, kp */
 				/* NOTE: as of Aug 2011, the algorithm is still wrongly documented
 				   and the update direction is reversed */
-				if (twoMs)
-				{
-					UpdateParam(kp, -DQ_GR, k);
-				}
-				else
-				{
-					UpdateParam(kp, UQ_GR, k);
-				}
+				UpdateParam(kp, twoMs ? -DQ_GR : UQ_GR, k);
 			}
 			else /* mode == RLGR3 */
 			{
@@ -681,17 +688,23 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 				/* convert the next two input values to (2*magnitude - sign) and */
 				/* encode their sum using GR code */
 
-				GetNextInput(input);
-				twoMs1 = Get2MagSign(input);
-				GetNextInput(input);
-				twoMs2 = Get2MagSign(input);
+				twoMs1 = rfx_rlgr_get_2magsign(*data++);
+				data_size--;
+				twoMs2 = 0;
+
+				if (data_size > 0)
+				{
+					twoMs2 = rfx_rlgr_get_2magsign(*data++);
+					data_size--;
+				}
+
 				sum2Ms = twoMs1 + twoMs2;
 
-				CodeGR(&krp, sum2Ms);
+				rfx_rlgr_code_gr(bw, &krp, sum2Ms);
 
 				/* encode binary representation of the first input (twoMs1). */
-				GetMinBits(sum2Ms, nIdx);
-				OutputBits(nIdx, twoMs1);
+				nIdx = sum2Ms ? (32 - lzcnt_s(sum2Ms)) : 0;
+				rfx_rlgr_writer_put_bits(bw, twoMs1, nIdx);
 
 				/* update k,kp for the two input values */
 
@@ -707,8 +720,5 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 		}
 	}
 
-	processed_size = rfx_bitstream_get_processed_bytes(bs);
-	free(bs);
-
-	return processed_size;
+	return (int) rfx_rlgr_writer_flush(bw);
 }
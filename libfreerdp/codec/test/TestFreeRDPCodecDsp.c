@@ -0,0 +1,356 @@
+#include <math.h>
+
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/types.h>
+#include <freerdp/codec/dsp.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static void FillTone(BYTE* data, int bytes_per_sample, UINT32 channels, UINT32 rate,
+                     UINT32 frames, double frequency)
+{
+	UINT32 i, c;
+
+	for (i = 0; i < frames; i++)
+	{
+		const double value = 16384.0 * sin(2.0 * M_PI * frequency * i / rate);
+
+		for (c = 0; c < channels; c++)
+		{
+			BYTE* sample = &data[(i * channels + c) * bytes_per_sample];
+			const INT16 s = (INT16) floor(value + 0.5);
+
+			if (bytes_per_sample == 1)
+				sample[0] = (BYTE)(floor(value / 256.0 + 0.5) + 128);
+			else
+			{
+				sample[0] = (BYTE)(s & 0xFF);
+				sample[1] = (BYTE)((s >> 8) & 0xFF);
+			}
+		}
+	}
+}
+
+static double ReadSample(const BYTE* data, int bytes_per_sample)
+{
+	if (bytes_per_sample == 1)
+		return (double)((data[0] - 128) << 8);
+
+	return (double)(INT16)(data[0] | (data[1] << 8));
+}
+
+/* Resamples in packets of varying size, the output must not depend on them */
+static BYTE* Resample(const BYTE* src, int bytes_per_sample, UINT32 schan, UINT32 srate,
+                      UINT32 sframes, UINT32 rchan, UINT32 rrate, UINT32* rframes)
+{
+	UINT32 offset = 0;
+	UINT32 packet = 0;
+	const UINT32 packets[] = { 441, 1, 1024, 137, 4000, 2 };
+	const UINT32 rbytes = bytes_per_sample * rchan;
+	BYTE* dst = (BYTE*) malloc(((UINT64) sframes * rrate / srate + 16) * rbytes);
+	FREERDP_DSP_CONTEXT* context = freerdp_dsp_context_new();
+	*rframes = 0;
+
+	if (!dst || !context)
+		goto fail;
+
+	while (offset < sframes)
+	{
+		const UINT32 frames = MIN(packets[packet++ % ARRAYSIZE(packets)], sframes - offset);
+
+		if (!context->resample(context, &src[offset * bytes_per_sample * schan], bytes_per_sample,
+		                       schan, srate, frames, rchan, rrate))
+			goto fail;
+
+		CopyMemory(&dst[*rframes * rbytes], context->resampled_buffer, context->resampled_size);
+		*rframes += context->resampled_frames;
+		offset += frames;
+	}
+
+	freerdp_dsp_context_free(context);
+	return dst;
+fail:
+	freerdp_dsp_context_free(context);
+	free(dst);
+	return NULL;
+}
+
+static BOOL TestDspResampleTone(int bytes_per_sample, UINT32 schan, UINT32 srate, UINT32 rchan,
+                                UINT32 rrate, double frequency, double minSnr)
+{
+	UINT32 i, c;
+	BOOL rc = FALSE;
+	UINT32 rframes = 0;
+	double signal = 0.0;
+	double noise = 0.0;
+	double snr;
+	const UINT32 sframes = srate;
+	BYTE* src = (BYTE*) malloc(sframes * schan * bytes_per_sample);
+	BYTE* dst = NULL;
+
+	if (!src)
+		return FALSE;
+
+	FillTone(src, bytes_per_sample, schan, srate, sframes, frequency);
+
+	if (!(dst = Resample(src, bytes_per_sample, schan, srate, sframes, rchan, rrate, &rframes)))
+		goto fail;
+
+	/* all but the filter delay at the end must come out */
+	if ((rframes > (UINT64) sframes * rrate / srate) ||
+	    (rframes + 256 * rrate / srate + 1 < (UINT64) sframes * rrate / srate))
+		goto fail;
+
+	/* output frame n is at input frame n * srate / rrate, skip the start up */
+	for (i = 256; i < rframes; i++)
+	{
+		const double expected = 16384.0 * sin(2.0 * M_PI * frequency * i / rrate);
+
+		for (c = 0; c < rchan; c++)
+		{
+			const double value = ReadSample(&dst[(i * rchan + c) * bytes_per_sample],
+			                                 bytes_per_sample);
+			signal += expected * expected;
+			noise += (value - expected) * (value - expected);
+		}
+	}
+
+	snr = 10.0 * log10(signal / MAX(noise, 1.0));
+	printf("%s: %d bit %"PRIu32"x%"PRIu32" Hz -> %"PRIu32"x%"PRIu32" Hz, %.0f Hz tone: "
+	       "SNR %.1f dB\n", __FUNCTION__, bytes_per_sample * 8, schan, srate, rchan, rrate,
+	       frequency, snr);
+	rc = (snr >= minSnr);
+fail:
+	free(src);
+	free(dst);
+	return rc;
+}
+
+/* Tones above the output Nyquist frequency must be filtered, not folded back */
+static BOOL TestDspResampleAlias(void)
+{
+	UINT32 i;
+	BOOL rc = FALSE;
+	UINT32 rframes = 0;
+	double energy = 0.0;
+	double level;
+	BYTE* src = (BYTE*) malloc(48000 * 2);
+	BYTE* dst = NULL;
+
+	if (!src)
+		return FALSE;
+
+	FillTone(src, 2, 1, 48000, 48000, 15000.0);
+
+	if (!(dst = Resample(src, 2, 1, 48000, 48000, 1, 22050, &rframes)))
+		goto fail;
+
+	for (i = 256; i < rframes; i++)
+	{
+		const double value = ReadSample(&dst[i * 2], 2);
+		energy += value * value;
+	}
+
+	level = 10.0 * log10(MAX(energy / (rframes - 256), 1.0) / (16384.0 * 16384.0 / 2.0));
+	printf("%s: 15000 Hz tone at 22050 Hz: %.1f dB\n", __FUNCTION__, level);
+	rc = (level < -50.0);
+fail:
+	free(src);
+	free(dst);
+	return rc;
+}
+
+static BOOL TestDspResampleBenchmark(void)
+{
+	UINT32 i;
+	UINT64 start;
+	UINT64 elapsed;
+	BOOL rc = FALSE;
+	UINT32 frames = 0;
+	const UINT32 seconds = 20;
+	const UINT32 packet = 441 * 4;
+	BYTE* src = (BYTE*) malloc(packet * 2 * 2);
+	FREERDP_DSP_CONTEXT* context = freerdp_dsp_context_new();
+
+	if (!src || !context)
+		goto fail;
+
+	FillTone(src, 2, 2, 44100, packet, 1000.0);
+	start = GetTickCount64();
+
+	for (i = 0; i < seconds * 44100 / packet; i++)
+	{
+		if (!context->resample(context, src, 2, 2, 44100, packet, 2, 48000))
+			goto fail;
+
+		frames += context->resampled_frames;
+	}
+
+	elapsed = MAX(GetTickCount64() - start, 1);
+	printf("%s: 16 bit 2x44100 Hz -> 2x48000 Hz, %"PRIu32" frames in %"PRIu64" ms, "
+	       "%.0fx real time\n", __FUNCTION__, frames, elapsed, seconds * 1000.0 / elapsed);
+	rc = TRUE;
+fail:
+	free(src);
+	freerdp_dsp_context_free(context);
+	return rc;
+}
+
+/* Frames per packet, whole ADPCM blocks like the rdpsnd server sends them */
+static UINT32 CodecPacketFrames(const AUDIO_FORMAT* format)
+{
+	UINT32 block;
+	const UINT32 frames = format->nSamplesPerSec / 20;
+
+	switch (format->wFormatTag)
+	{
+		case WAVE_FORMAT_DVI_ADPCM:
+			block = (format->nBlockAlign - 4 * format->nChannels) * 2 / format->nChannels;
+			break;
+
+		case WAVE_FORMAT_ADPCM:
+			block = (format->nBlockAlign - 7 * format->nChannels) * 2 / format->nChannels + 2;
+			break;
+
+		default:
+			return frames;
+	}
+
+	return MAX(frames - frames % block, block);
+}
+
+/**
+ * Encodes and decodes five seconds of a tone, reports the bitrate, the time
+ * spent per second of audio and the signal to noise ratio of the round trip.
+ * Codecs with a delay are not aligned, minSnr is 0 for those.
+ */
+static BOOL TestDspCodec(const AUDIO_FORMAT* format, const char* name, double minSnr)
+{
+	UINT32 i;
+	BOOL rc = FALSE;
+	UINT64 start;
+	UINT64 encodeTime = 0;
+	UINT64 decodeTime = 0;
+	size_t encodedSize = 0;
+	size_t count;
+	double signal = 0.0;
+	double noise = 0.0;
+	double snr;
+	const UINT32 seconds = 5;
+	const UINT32 frames = format->nSamplesPerSec * seconds;
+	const UINT32 frameSize = format->nChannels * 2;
+	const UINT32 packet = CodecPacketFrames(format);
+	BYTE* src = (BYTE*) malloc(frames * frameSize);
+	wStream* encoded = Stream_New(NULL, 4096);
+	wStream* decoded = Stream_New(NULL, frames * frameSize);
+	FREERDP_DSP_CONTEXT* encoder = freerdp_dsp_context_new();
+	FREERDP_DSP_CONTEXT* decoder = freerdp_dsp_context_new();
+
+	if (!freerdp_dsp_supports_format(format, TRUE) || !freerdp_dsp_supports_format(format, FALSE))
+	{
+		printf("%s: %s not available\n", __FUNCTION__, name);
+		rc = TRUE;
+		goto fail;
+	}
+
+	if (!src || !encoded || !decoded || !encoder || !decoder)
+		goto fail;
+
+	if (!freerdp_dsp_context_reset(encoder, format) || !freerdp_dsp_context_reset(decoder, format))
+		goto fail;
+
+	FillTone(src, 2, format->nChannels, format->nSamplesPerSec, frames, 1000.0);
+
+	for (i = 0; i + packet <= frames; i += packet)
+	{
+		Stream_SetPosition(encoded, 0);
+		start = GetTickCount64();
+
+		if (!freerdp_dsp_encode(encoder, &src[i * frameSize], packet * frameSize, encoded))
+			goto fail;
+
+		encodeTime += GetTickCount64() - start;
+		encodedSize += Stream_GetPosition(encoded);
+
+		if (Stream_GetPosition(encoded) == 0)
+			continue;
+
+		start = GetTickCount64();
+
+		if (!freerdp_dsp_decode(decoder, Stream_Buffer(encoded), Stream_GetPosition(encoded),
+		                        decoded))
+			goto fail;
+
+		decodeTime += GetTickCount64() - start;
+	}
+
+	count = MIN(Stream_GetPosition(decoded), i * frameSize) / 2;
+
+	for (i = 0; i < count; i++)
+	{
+		const double ref = ReadSample(&src[i * 2], 2);
+		const double diff = ReadSample(Stream_Buffer(decoded) + i * 2, 2) - ref;
+		signal += ref * ref;
+		noise += diff * diff;
+	}
+
+	snr = (noise > 0.0) ? 10.0 * log10(signal / noise) : 999.0;
+	printf("%s: %-10s %"PRIu16"x%"PRIu32" Hz, %7.1f kbit/s, encode %4.1f ms/s, decode %4.1f ms/s, "
+	       "SNR %5.1f dB\n", __FUNCTION__, name, format->nChannels, format->nSamplesPerSec,
+	       encodedSize * 8.0 / seconds / 1000.0, (double) encodeTime / seconds,
+	       (double) decodeTime / seconds, snr);
+
+	if ((count == 0) || (snr < minSnr))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	free(src);
+	Stream_Free(encoded, TRUE);
+	Stream_Free(decoded, TRUE);
+	freerdp_dsp_context_free(encoder);
+	freerdp_dsp_context_free(decoder);
+	return rc;
+}
+
+static BOOL TestDspCodecs(void)
+{
+	const AUDIO_FORMAT pcm = { WAVE_FORMAT_PCM, 2, 44100, 176400, 4, 16, 0, NULL };
+	const AUDIO_FORMAT alaw = { WAVE_FORMAT_ALAW, 2, 22050, 44100, 2, 8, 0, NULL };
+	const AUDIO_FORMAT mulaw = { WAVE_FORMAT_MULAW, 1, 8000, 8000, 1, 8, 0, NULL };
+	const AUDIO_FORMAT ima = { WAVE_FORMAT_DVI_ADPCM, 2, 44100, 44251, 2048, 4, 0, NULL };
+	const AUDIO_FORMAT ms = { WAVE_FORMAT_ADPCM, 2, 44100, 44359, 2048, 4, 0, NULL };
+	const AUDIO_FORMAT aac = { WAVE_FORMAT_AAC_MS, 2, 44100, 12000, 4, 16, 0, NULL };
+	const AUDIO_FORMAT mp3 = { WAVE_FORMAT_MPEGLAYER3, 2, 44100, 16000, 1, 0, 0, NULL };
+	const AUDIO_FORMAT gsm = { WAVE_FORMAT_GSM610, 1, 8000, 1625, 65, 0, 0, NULL };
+	return TestDspCodec(&pcm, "PCM", 200.0) && TestDspCodec(&alaw, "A-law", 30.0) &&
+	       TestDspCodec(&mulaw, "mu-law", 30.0) && TestDspCodec(&ima, "IMA ADPCM", 20.0) &&
+	       TestDspCodec(&ms, "MS ADPCM", 20.0) && TestDspCodec(&aac, "AAC", 0.0) &&
+	       TestDspCodec(&mp3, "MP3", 0.0) && TestDspCodec(&gsm, "GSM 6.10", 0.0);
+}
+
+int TestFreeRDPCodecDsp(int argc, char* argv[])
+{
+	if (!TestDspResampleTone(2, 2, 44100, 2, 48000, 1000.0, 60.0) ||
+	    !TestDspResampleTone(2, 2, 48000, 2, 44100, 1000.0, 60.0) ||
+	    !TestDspResampleTone(2, 2, 48000, 2, 44100, 15000.0, 50.0) ||
+	    !TestDspResampleTone(2, 1, 22050, 2, 48000, 3000.0, 60.0) ||
+	    !TestDspResampleTone(2, 2, 44100, 1, 8000, 440.0, 60.0) ||
+	    !TestDspResampleTone(1, 1, 11025, 2, 44100, 1000.0, 35.0))
+		return -1;
+
+	if (!TestDspResampleAlias())
+		return -1;
+
+	if (!TestDspResampleBenchmark())
+		return -1;
+
+	if (!TestDspCodecs())
+		return -1;
+
+	return 0;
+}
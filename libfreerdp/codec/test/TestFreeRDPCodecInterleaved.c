@@ -0,0 +1,369 @@
+#include <winpr/crt.h>
+#include <winpr/print.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/log.h>
+#include <freerdp/codec/color.h>
+#include <freerdp/codec/bitmap.h>
+#include <freerdp/codec/interleaved.h>
+
+#include "interleaved_legacy.h"
+
+static UINT32 test_rand(UINT32* seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 16) & 0x7FFF;
+}
+
+static UINT32 TestFormat(UINT32 bpp)
+{
+	switch (bpp)
+	{
+		case 24:
+			return PIXEL_FORMAT_BGR24;
+
+		case 16:
+			return PIXEL_FORMAT_RGB16;
+
+		case 15:
+			return PIXEL_FORMAT_RGB15;
+
+		default:
+			return PIXEL_FORMAT_RGB8;
+	}
+}
+
+static void WriteTestPixel(BYTE* pixel, UINT32 bpp, UINT32 value)
+{
+	if (bpp == 15)
+		value &= 0x7FFF;
+
+	pixel[0] = (BYTE) value;
+
+	if (bpp > 8)
+		pixel[1] = (BYTE)(value >> 8);
+
+	if (bpp > 16)
+		pixel[2] = (BYTE)(value >> 16);
+}
+
+/**
+ * Areas that exercise every order: flat fills, text like two colour blocks,
+ * dithering, gradients, rows repeating the row above and noise.
+ */
+static void FillTestBitmap(BYTE* data, UINT32 bpp, UINT32 width, UINT32 height, UINT32* seed)
+{
+	UINT32 x, y;
+	const UINT32 bytes = (bpp + 7) / 8;
+	const UINT32 fg = test_rand(seed) | (test_rand(seed) << 15);
+	const UINT32 bg = test_rand(seed) | (test_rand(seed) << 15);
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			BYTE* pixel = &data[(y * width + x) * bytes];
+			UINT32 value;
+
+			switch ((x / 16 + y / 8) % 6)
+			{
+				case 0:
+					value = bg;
+					break;
+
+				case 1:
+					value = (test_rand(seed) % 3) ? bg : fg;
+					break;
+
+				case 2:
+					value = ((x + y) % 2) ? fg : bg;
+					break;
+
+				case 3:
+					value = x * 0x010203 + y;
+					break;
+
+				case 4:
+					if (y > 0)
+					{
+						CopyMemory(pixel, pixel - width * bytes, bytes);
+						continue;
+					}
+
+					value = 0xFFFFFF;
+					break;
+
+				default:
+					value = test_rand(seed) | (test_rand(seed) << 15);
+					break;
+			}
+
+			WriteTestPixel(pixel, bpp, value);
+		}
+	}
+}
+
+static BOOL RunTestInterleaved(BITMAP_INTERLEAVED_CONTEXT* encoder,
+                               BITMAP_INTERLEAVED_CONTEXT* decoder, const BYTE* bitmap,
+                               UINT32 bpp, UINT32 width, UINT32 height)
+{
+	BOOL rc = FALSE;
+	const UINT32 format = TestFormat(bpp);
+	const UINT32 step = width * GetBytesPerPixel(format);
+	UINT32 compressedSize = width * height * 4 + 64;
+	BYTE* compressed = (BYTE*) malloc(compressedSize);
+	BYTE* decompressed = (BYTE*) calloc(height, step);
+
+	if (!compressed || !decompressed)
+		goto fail;
+
+	if (!interleaved_compress(encoder, compressed, &compressedSize, width, height, bitmap,
+	                          format, step, 0, 0, NULL, bpp))
+		goto fail;
+
+	if (!interleaved_decompress(decoder, compressed, compressedSize, width, height, bpp,
+	                            decompressed, format, step, 0, 0, width, height, NULL))
+		goto fail;
+
+	if (memcmp(bitmap, decompressed, height * step) != 0)
+		goto fail;
+
+	/* the decoder before the rewrite must read the same image from the stream */
+	ZeroMemory(decompressed, height * step);
+
+	if (!interleaved_legacy_decompress(compressed, compressedSize, width, height, bpp,
+	                                   decompressed, format, step))
+		goto fail;
+
+	rc = (memcmp(bitmap, decompressed, height * step) == 0);
+fail:
+	free(compressed);
+	free(decompressed);
+	return rc;
+}
+
+/* Streams of the original encoder must still decode to the same image */
+static BOOL RunTestInterleavedLegacy(BITMAP_INTERLEAVED_CONTEXT* decoder, const BYTE* bitmap,
+                                     UINT32 bpp, UINT32 width, UINT32 height)
+{
+	BOOL rc = FALSE;
+	wStream* s = NULL;
+	wStream* temp = NULL;
+	const UINT32 format = TestFormat(bpp);
+	const UINT32 step = width * GetBytesPerPixel(format);
+	BYTE* decompressed = (BYTE*) calloc(height, step);
+
+	if (!decompressed)
+		goto fail;
+
+	if (!(s = Stream_New(NULL, width * height * 4 + 64)) || !(temp = Stream_New(NULL, 64 * 64 * 4)))
+		goto fail;
+
+	if (freerdp_bitmap_compress((const char*) bitmap, width, height, s, bpp,
+	                            width * height * 4, height - 1, temp, 0) != height)
+		goto fail;
+
+	if (!interleaved_decompress(decoder, Stream_Buffer(s), Stream_GetPosition(s), width, height,
+	                            bpp, decompressed, format, step, 0, 0, width, height, NULL))
+		goto fail;
+
+	rc = (memcmp(bitmap, decompressed, height * step) == 0);
+fail:
+	Stream_Free(s, TRUE);
+	Stream_Free(temp, TRUE);
+	free(decompressed);
+	return rc;
+}
+
+static BOOL TestInterleavedRoundTrip(void)
+{
+	UINT32 i, j, k;
+	BOOL rc = FALSE;
+	UINT32 seed = 0x1234;
+	const UINT32 bpps[] = { 8, 15, 16, 24 };
+	const UINT32 widths[] = { 4, 8, 12, 32, 64, 128, 256 };
+	const UINT32 heights[] = { 1, 2, 5, 64, 100 };
+	BYTE* bitmap = (BYTE*) malloc(256 * 100 * 3);
+	BITMAP_INTERLEAVED_CONTEXT* encoder = bitmap_interleaved_context_new(TRUE);
+	BITMAP_INTERLEAVED_CONTEXT* decoder = bitmap_interleaved_context_new(FALSE);
+	printf("%s: ", __FUNCTION__);
+
+	if (!bitmap || !encoder || !decoder)
+		goto fail;
+
+	for (i = 0; i < ARRAYSIZE(bpps); i++)
+	{
+		for (j = 0; j < ARRAYSIZE(widths); j++)
+		{
+			for (k = 0; k < ARRAYSIZE(heights); k++)
+			{
+				FillTestBitmap(bitmap, bpps[i], widths[j], heights[k], &seed);
+
+				if (!RunTestInterleaved(encoder, decoder, bitmap, bpps[i], widths[j], heights[k]))
+				{
+					printf("FAIL %"PRIu32"bpp %"PRIu32"x%"PRIu32"", bpps[i], widths[j], heights[k]);
+					goto fail;
+				}
+
+				/* the original encoder only produced valid 16 bpp tiles up to 64x64 */
+				if ((bpps[i] == 16) && (widths[j] <= 64) && (heights[k] <= 64) &&
+				    !RunTestInterleavedLegacy(decoder, bitmap, bpps[i], widths[j], heights[k]))
+				{
+					printf("FAIL legacy %"PRIu32"bpp %"PRIu32"x%"PRIu32"", bpps[i], widths[j],
+					       heights[k]);
+					goto fail;
+				}
+			}
+		}
+	}
+
+	printf("SUCCESS");
+	rc = TRUE;
+fail:
+	printf("\n");
+	free(bitmap);
+	bitmap_interleaved_context_free(encoder);
+	bitmap_interleaved_context_free(decoder);
+	return rc;
+}
+
+/* Malformed streams must be rejected without touching memory outside the buffers */
+static BOOL TestInterleavedFuzz(void)
+{
+	UINT32 i, j;
+	BOOL rc = FALSE;
+	UINT32 seed = 0x5678;
+	BYTE src[512];
+	BYTE dst[64 * 64 * 4];
+	wLog* log = WLog_Get(FREERDP_TAG("codec"));
+	const DWORD level = WLog_GetLogLevel(log);
+	BITMAP_INTERLEAVED_CONTEXT* decoder = bitmap_interleaved_context_new(FALSE);
+
+	if (!decoder)
+		return FALSE;
+
+	/* every rejected stream is logged */
+	WLog_SetLogLevel(log, WLOG_OFF);
+
+	for (i = 0; i < 20000; i++)
+	{
+		const UINT32 bpp = (i % 2) ? 24 : 16;
+		const UINT32 length = 1 + test_rand(&seed) % sizeof(src);
+
+		for (j = 0; j < length; j++)
+			src[j] = (BYTE) test_rand(&seed);
+
+		interleaved_decompress(decoder, src, length, 16, 16, bpp, dst, PIXEL_FORMAT_BGRX32, 0,
+		                       0, 0, 16, 16, NULL);
+	}
+
+	WLog_SetLogLevel(log, level);
+	rc = TRUE;
+	bitmap_interleaved_context_free(decoder);
+	return rc;
+}
+
+static BOOL TestInterleavedBenchmark(UINT32 bpp, UINT32 tileSize)
+{
+	UINT32 i, x, y;
+	BOOL rc = FALSE;
+	UINT64 start;
+	UINT64 encodeTime = 0;
+	UINT64 decodeTime = 0;
+	UINT32 seed = 0x4321;
+	UINT32 totalSize = 0;
+	const UINT32 width = 2048;
+	const UINT32 height = 1024;
+	const UINT32 iterations = 3;
+	const UINT32 format = TestFormat(bpp);
+	const UINT32 bytes = GetBytesPerPixel(format);
+	const UINT32 size = width * height * bytes;
+	const UINT32 tiles = (width / tileSize) * (height / tileSize);
+	const UINT32 tileCapacity = tileSize * tileSize * 4;
+	BYTE* bitmap = (BYTE*) malloc(size);
+	BYTE* compressed = (BYTE*) malloc(tileCapacity * tiles);
+	UINT32* compressedSizes = (UINT32*) calloc(tiles, sizeof(UINT32));
+	BYTE* decompressed = (BYTE*) malloc(size);
+	BITMAP_INTERLEAVED_CONTEXT* encoder = bitmap_interleaved_context_new(TRUE);
+	BITMAP_INTERLEAVED_CONTEXT* decoder = bitmap_interleaved_context_new(FALSE);
+
+	if (!bitmap || !compressed || !compressedSizes || !decompressed || !encoder || !decoder)
+		goto fail;
+
+	FillTestBitmap(bitmap, bpp, width, height, &seed);
+
+	for (i = 0; i < iterations; i++)
+	{
+		UINT32 tile = 0;
+		totalSize = 0;
+		start = GetTickCount64();
+
+		for (y = 0; y < height; y += tileSize)
+		{
+			for (x = 0; x < width; x += tileSize)
+			{
+				compressedSizes[tile] = tileCapacity;
+
+				if (!interleaved_compress(encoder, &compressed[tile * tileCapacity],
+				                          &compressedSizes[tile], tileSize, tileSize, bitmap, format,
+				                          width * bytes, x, y, NULL, bpp))
+					goto fail;
+
+				totalSize += compressedSizes[tile++];
+			}
+		}
+
+		encodeTime += GetTickCount64() - start;
+		tile = 0;
+		start = GetTickCount64();
+
+		for (y = 0; y < height; y += tileSize)
+		{
+			for (x = 0; x < width; x += tileSize)
+			{
+				if (!interleaved_decompress(decoder, &compressed[tile * tileCapacity],
+				                            compressedSizes[tile], tileSize, tileSize, bpp,
+				                            decompressed, format, width * bytes, x, y, tileSize,
+				                            tileSize, NULL))
+					goto fail;
+
+				tile++;
+			}
+		}
+
+		decodeTime += GetTickCount64() - start;
+	}
+
+	if (memcmp(bitmap, decompressed, size) != 0)
+		goto fail;
+
+	printf("%s: %"PRIu32"bpp %"PRIu32"x%"PRIu32" tiles, %"PRIu32" -> %"PRIu32" bytes, "
+	       "encode %.1f MB/s, decode %.1f MB/s\n", __FUNCTION__, bpp, tileSize, tileSize, size,
+	       totalSize, (double) size * iterations / 1000.0 / MAX(encodeTime, 1),
+	       (double) size * iterations / 1000.0 / MAX(decodeTime, 1));
+	rc = TRUE;
+fail:
+	free(bitmap);
+	free(compressed);
+	free(compressedSizes);
+	free(decompressed);
+	bitmap_interleaved_context_free(encoder);
+	bitmap_interleaved_context_free(decoder);
+	return rc;
+}
+
+int TestFreeRDPCodecInterleaved(int argc, char* argv[])
+{
+	if (!TestInterleavedRoundTrip())
+		return -1;
+
+	if (!TestInterleavedFuzz())
+		return -1;
+
+	if (!TestInterleavedBenchmark(16, 64) || !TestInterleavedBenchmark(24, 64) ||
+	    !TestInterleavedBenchmark(24, 256))
+		return -1;
+
+	return 0;
+}
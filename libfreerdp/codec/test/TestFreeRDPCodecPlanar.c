@@ -3,6 +3,7 @@
 
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/freerdp.h>
 #include <freerdp/codec/color.h>
@@ -3121,6 +3122,209 @@ fail:
 	return rc;
 }
 
+static UINT32 test_rand(UINT32* seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 16) & 0x7FFF;
+}
+
+/* Flat areas, gradients and noise so that runs, raw bytes and all delta values occur */
+static void FillTestBitmap(BYTE* data, UINT32 width, UINT32 height, UINT32* seed)
+{
+	UINT32 x, y;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			BYTE* pixel = &data[(y * width + x) * 4];
+
+			switch ((x / 8 + y / 4) % 3)
+			{
+				case 0:
+					pixel[0] = pixel[1] = pixel[2] = 0x40;
+					pixel[3] = 0xFF;
+					break;
+
+				case 1:
+					pixel[0] = (BYTE)(x * 3);
+					pixel[1] = (BYTE)(y * 5);
+					pixel[2] = (BYTE)(x + y);
+					pixel[3] = (BYTE)(0xFF - y);
+					break;
+
+				default:
+					pixel[0] = (BYTE) test_rand(seed);
+					pixel[1] = (BYTE) test_rand(seed);
+					pixel[2] = (BYTE) test_rand(seed);
+					pixel[3] = (BYTE) test_rand(seed);
+					break;
+			}
+		}
+	}
+}
+
+static BOOL RunTestPlanarRoundTrip(BITMAP_PLANAR_CONTEXT* planar, const BYTE* srcBitmap,
+                                   UINT32 format, UINT32 width, UINT32 height)
+{
+	UINT32 y;
+	BOOL rc = FALSE;
+	UINT32 compressedSize = 0;
+	const UINT32 step = width * 4;
+	BYTE* compressedBitmap = freerdp_bitmap_compress_planar(planar, srcBitmap, format,
+	                         width, height, 0, NULL, &compressedSize);
+	BYTE* decompressedBitmap = (BYTE*) calloc(height, step);
+	BYTE* flippedBitmap = (BYTE*) calloc(height, step);
+	const UINT32 clipWidth = (width + 1) / 2;
+	const UINT32 clipHeight = (height + 1) / 2;
+	const UINT32 surfaceStep = (width + 8) * 4;
+	BYTE* surface = (BYTE*) calloc(height + 4, surfaceStep);
+
+	if (!compressedBitmap || !decompressedBitmap || !flippedBitmap || !surface)
+		goto fail;
+
+	/* the encoder stores the scanlines bottom up */
+	if (!planar_decompress(planar, compressedBitmap, compressedSize, width, height,
+	                       decompressedBitmap, format, 0, 0, 0, width, height, TRUE))
+		goto fail;
+
+	if (!CompareBitmap(decompressedBitmap, format, srcBitmap, format, width, height))
+		goto fail;
+
+	if (!planar_decompress(planar, compressedBitmap, compressedSize, width, height,
+	                       flippedBitmap, format, 0, 0, 0, width, height, FALSE))
+		goto fail;
+
+	for (y = 0; y < height; y++)
+	{
+		if (memcmp(&flippedBitmap[y * step], &decompressedBitmap[(height - y - 1) * step],
+		           step) != 0)
+			goto fail;
+	}
+
+	/* a destination region smaller than the bitmap takes its top left part */
+	if (!planar_decompress(planar, compressedBitmap, compressedSize, width, height,
+	                       surface, format, surfaceStep, 5, 3, clipWidth, clipHeight, TRUE))
+		goto fail;
+
+	for (y = 0; y < clipHeight; y++)
+	{
+		if (memcmp(&surface[(y + 3) * surfaceStep + 5 * 4], &decompressedBitmap[y * step],
+		           clipWidth * 4) != 0)
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	free(compressedBitmap);
+	free(decompressedBitmap);
+	free(flippedBitmap);
+	free(surface);
+	return rc;
+}
+
+static BOOL TestPlanarRoundTrip(void)
+{
+	UINT32 i, j;
+	BOOL rc = FALSE;
+	UINT32 seed = 0x1234;
+	const UINT32 widths[] = { 1, 3, 15, 16, 17, 33, 64, 100 };
+	const UINT32 heights[] = { 1, 2, 7, 64 };
+	BYTE* bitmap = (BYTE*) malloc(100 * 64 * 4);
+	BITMAP_PLANAR_CONTEXT* planar = freerdp_bitmap_planar_context_new(
+	                                    PLANAR_FORMAT_HEADER_RLE, 100, 64);
+	BITMAP_PLANAR_CONTEXT* planarNoAlpha = freerdp_bitmap_planar_context_new(
+	        PLANAR_FORMAT_HEADER_NA | PLANAR_FORMAT_HEADER_RLE, 100, 64);
+	printf("%s: ", __FUNCTION__);
+
+	if (!bitmap || !planar || !planarNoAlpha)
+		goto fail;
+
+	for (i = 0; i < ARRAYSIZE(widths); i++)
+	{
+		for (j = 0; j < ARRAYSIZE(heights); j++)
+		{
+			FillTestBitmap(bitmap, widths[i], heights[j], &seed);
+
+			if (!RunTestPlanarRoundTrip(planar, bitmap, PIXEL_FORMAT_BGRA32, widths[i], heights[j]) ||
+			    !RunTestPlanarRoundTrip(planar, bitmap, PIXEL_FORMAT_RGBA32, widths[i], heights[j]) ||
+			    !RunTestPlanarRoundTrip(planarNoAlpha, bitmap, PIXEL_FORMAT_BGRX32, widths[i],
+			                            heights[j]))
+			{
+				printf("FAIL %"PRIu32"x%"PRIu32"", widths[i], heights[j]);
+				goto fail;
+			}
+		}
+	}
+
+	printf("SUCCESS");
+	rc = TRUE;
+fail:
+	printf("\n");
+	free(bitmap);
+	freerdp_bitmap_planar_context_free(planar);
+	freerdp_bitmap_planar_context_free(planarNoAlpha);
+	return rc;
+}
+
+static BOOL TestPlanarBenchmark(void)
+{
+	UINT32 i;
+	BOOL rc = FALSE;
+	UINT64 start;
+	UINT64 encodeTime;
+	UINT64 decodeTime;
+	UINT32 seed = 0x4321;
+	UINT32 compressedSize = 0;
+	const UINT32 width = 1920;
+	const UINT32 height = 1080;
+	const UINT32 size = width * height * 4;
+	const UINT32 iterations = 10;
+	BYTE* bitmap = (BYTE*) malloc(size);
+	BYTE* compressedBitmap = (BYTE*) malloc(size + 1);
+	BYTE* decompressedBitmap = (BYTE*) malloc(size);
+	BITMAP_PLANAR_CONTEXT* planar = freerdp_bitmap_planar_context_new(
+	                                    PLANAR_FORMAT_HEADER_NA | PLANAR_FORMAT_HEADER_RLE, width, height);
+
+	if (!bitmap || !compressedBitmap || !decompressedBitmap || !planar)
+		goto fail;
+
+	FillTestBitmap(bitmap, width, height, &seed);
+	start = GetTickCount64();
+
+	for (i = 0; i < iterations; i++)
+	{
+		compressedSize = size + 1;
+
+		if (!freerdp_bitmap_compress_planar(planar, bitmap, PIXEL_FORMAT_BGRX32, width, height,
+		                                    0, compressedBitmap, &compressedSize))
+			goto fail;
+	}
+
+	encodeTime = GetTickCount64() - start;
+	start = GetTickCount64();
+
+	for (i = 0; i < iterations; i++)
+	{
+		if (!planar_decompress(planar, compressedBitmap, compressedSize, width, height,
+		                       decompressedBitmap, PIXEL_FORMAT_BGRX32, 0, 0, 0, width, height, FALSE))
+			goto fail;
+	}
+
+	decodeTime = GetTickCount64() - start;
+	printf("%s: %"PRIu32"x%"PRIu32" -> %"PRIu32" bytes, encode %.1f MB/s, decode %.1f MB/s\n",
+	       __FUNCTION__, width, height, compressedSize,
+	       (double) size * iterations / 1000.0 / MAX(encodeTime, 1),
+	       (double) size * iterations / 1000.0 / MAX(decodeTime, 1));
+	rc = TRUE;
+fail:
+	free(bitmap);
+	free(compressedBitmap);
+	free(decompressedBitmap);
+	freerdp_bitmap_planar_context_free(planar);
+	return rc;
+}
+
 int TestFreeRDPCodecPlanar(int argc, char* argv[])
 {
 	UINT32 x;
@@ -3131,5 +3335,11 @@ int TestFreeRDPCodecPlanar(int argc, char* argv[])
 			return -1;
 	}
 
+	if (!TestPlanarRoundTrip())
+		return -1;
+
+	if (!TestPlanarBenchmark())
+		return -1;
+
 	return 0;
 }
@@ -0,0 +1,324 @@
+#include <winpr/crt.h>
+#include <winpr/print.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/codec/rfx.h>
+
+/**
+ * Reference RLGR encoder following the [MS-RDPRFX] 3.1.8.1.7.3 pseudocode
+ * bit by bit, used to check that the optimized encoder is bit exact.
+ */
+
+#define KPMAX	(80)
+#define LSGR	(3)
+#define UP_GR	(4)
+#define DN_GR	(6)
+#define UQ_GR	(3)
+#define DQ_GR	(3)
+
+struct _REF_BITSTREAM
+{
+	BYTE* buffer;
+	UINT32 nbytes;
+	UINT32 bitPos;
+};
+typedef struct _REF_BITSTREAM REF_BITSTREAM;
+
+static void ref_put_bit(REF_BITSTREAM* bs, UINT32 bit)
+{
+	if ((bs->bitPos / 8) < bs->nbytes)
+	{
+		if (bit)
+			bs->buffer[bs->bitPos / 8] |= 0x80 >> (bs->bitPos % 8);
+	}
+
+	bs->bitPos++;
+}
+
+static void ref_put_bits(REF_BITSTREAM* bs, UINT32 value, UINT32 nbits)
+{
+	while (nbits--)
+		ref_put_bit(bs, (value >> nbits) & 1);
+}
+
+static void ref_update_param(int* param, int delta, int* k)
+{
+	*param += delta;
+
+	if (*param > KPMAX)
+		*param = KPMAX;
+
+	if (*param < 0)
+		*param = 0;
+
+	*k = *param >> LSGR;
+}
+
+static void ref_code_gr(REF_BITSTREAM* bs, int* krp, UINT32 val)
+{
+	int kr = *krp >> LSGR;
+	UINT32 vk = val >> kr;
+	UINT32 i;
+
+	for (i = 0; i < vk; i++)
+		ref_put_bit(bs, 1);
+
+	ref_put_bit(bs, 0);
+	ref_put_bits(bs, val & ((1 << kr) - 1), kr);
+
+	if (vk == 0)
+		ref_update_param(krp, -2, &kr);
+	else if (vk > 1)
+		ref_update_param(krp, vk, &kr);
+}
+
+static UINT32 ref_2magsign(int input)
+{
+	return (input >= 0) ? 2 * input : -2 * input - 1;
+}
+
+static int ref_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* buffer,
+                           UINT32 buffer_size)
+{
+	int k = 1;
+	int kp = 1 << LSGR;
+	int krp = 1 << LSGR;
+	UINT32 index = 0;
+	UINT32 bytes;
+	REF_BITSTREAM bs;
+	bs.buffer = buffer;
+	bs.nbytes = buffer_size;
+	bs.bitPos = 0;
+	ZeroMemory(buffer, buffer_size);
+
+	while (index < data_size)
+	{
+		int input;
+
+		if (k)
+		{
+			UINT32 numZeros = 0;
+			UINT32 mag;
+			input = data[index++];
+
+			while ((input == 0) && (index < data_size))
+			{
+				numZeros++;
+				input = data[index++];
+			}
+
+			while (numZeros >= (1U << k))
+			{
+				ref_put_bit(&bs, 0);
+				numZeros -= (1 << k);
+				ref_update_param(&kp, UP_GR, &k);
+			}
+
+			ref_put_bit(&bs, 1);
+			ref_put_bits(&bs, numZeros, k);
+			mag = (input < 0) ? -input : input;
+			ref_put_bit(&bs, (input < 0) ? 1 : 0);
+			ref_code_gr(&bs, &krp, mag ? mag - 1 : 0);
+			ref_update_param(&kp, -DN_GR, &k);
+		}
+		else if (mode == RLGR1)
+		{
+			UINT32 twoMs = ref_2magsign(data[index++]);
+			ref_code_gr(&bs, &krp, twoMs);
+
+			if (twoMs)
+				ref_update_param(&kp, -DQ_GR, &k);
+			else
+				ref_update_param(&kp, UQ_GR, &k);
+		}
+		else
+		{
+			UINT32 nIdx = 0;
+			UINT32 twoMs1 = ref_2magsign(data[index++]);
+			UINT32 twoMs2 = (index < data_size) ? ref_2magsign(data[index++]) : 0;
+			UINT32 sum2Ms = twoMs1 + twoMs2;
+			ref_code_gr(&bs, &krp, sum2Ms);
+
+			while ((sum2Ms >> nIdx) != 0)
+				nIdx++;
+
+			ref_put_bits(&bs, twoMs1, nIdx);
+
+			if (twoMs1 && twoMs2)
+				ref_update_param(&kp, -2 * DQ_GR, &k);
+			else if (!twoMs1 && !twoMs2)
+				ref_update_param(&kp, 2 * UQ_GR, &k);
+		}
+	}
+
+	bytes = (bs.bitPos + 7) / 8;
+	return (bytes > buffer_size) ? buffer_size : bytes;
+}
+
+static UINT32 test_rand(UINT32* seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 16) & 0x7FFF;
+}
+
+/* Roughly shaped like quantized DWT output: long zero runs in the high bands,
+ * small values, and a dense low band at the end of the tile */
+static void test_fill_tile(INT16* tile, UINT32* seed, int density)
+{
+	int i;
+
+	for (i = 0; i < 4096; i++)
+	{
+		UINT32 r = test_rand(seed);
+
+		if ((i >= 4032) || ((int)(r % 100) < density))
+		{
+			int value = (int)(test_rand(seed) % 64) - 32;
+
+			if ((r & 0x3F) == 0)
+				value *= 40;
+
+			tile[i] = (INT16) value;
+		}
+		else
+		{
+			tile[i] = 0;
+		}
+	}
+}
+
+static BOOL test_rlgr_exact(RFX_CONTEXT* context, RLGR_MODE mode, const INT16* tile,
+                            UINT32 size, UINT32 buffer_size)
+{
+	int status;
+	int refStatus;
+	INT16 decoded[4096];
+	BYTE encoded[16384];
+	BYTE reference[16384];
+	/* the optimized encoder must not depend on a zeroed output buffer */
+	FillMemory(encoded, sizeof(encoded), 0xCD);
+	status = context->rlgr_encode(mode, tile, size, encoded, buffer_size);
+	refStatus = ref_rlgr_encode(mode, tile, size, reference, buffer_size);
+
+	if ((status != refStatus) || (memcmp(encoded, reference, status) != 0))
+	{
+		printf("RLGR%d encode mismatch: %d / %d bytes\n", (mode == RLGR1) ? 1 : 3, status,
+		       refStatus);
+		return FALSE;
+	}
+
+	/* truncated output cannot be decoded back */
+	if (status >= (int) buffer_size)
+		return TRUE;
+
+	if (context->rlgr_decode(mode, encoded, status, decoded, size) < 0)
+		return FALSE;
+
+	/* a trailing zero coefficient ending a run is not restored exactly,
+	 * the encoder emits it as the terminating value of the run */
+	if ((memcmp(decoded, tile, (size - 1) * sizeof(INT16)) != 0) ||
+	    (tile[size - 1] && (decoded[size - 1] != tile[size - 1])))
+	{
+		printf("RLGR%d decode mismatch\n", (mode == RLGR1) ? 1 : 3);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static int test_RlgrExact(RFX_CONTEXT* context)
+{
+	int i;
+	int density;
+	UINT32 seed = 0x1234;
+	INT16 tile[4096];
+
+	for (i = 0; i < 200; i++)
+	{
+		density = (i * 7) % 101;
+		test_fill_tile(tile, &seed, density);
+
+		if (!test_rlgr_exact(context, RLGR1, tile, 4096, 16384))
+			return -1;
+
+		if (!test_rlgr_exact(context, RLGR3, tile, 4096, 16384))
+			return -1;
+
+		/* odd sizes and output buffers too small for the tile */
+		if (!test_rlgr_exact(context, RLGR3, tile, 4095 - i, 16384))
+			return -1;
+
+		if (!test_rlgr_exact(context, RLGR1, tile, 4096, 64 + i))
+			return -1;
+	}
+
+	/* all zero tile */
+	ZeroMemory(tile, sizeof(tile));
+
+	if (!test_rlgr_exact(context, RLGR1, tile, 4096, 16384) ||
+	    !test_rlgr_exact(context, RLGR3, tile, 4096, 16384))
+		return -1;
+
+	return 0;
+}
+
+static int test_RlgrBenchmark(RFX_CONTEXT* context, RLGR_MODE mode)
+{
+	int i;
+	int status = 0;
+	UINT64 start;
+	UINT64 encodeTime;
+	UINT64 decodeTime;
+	UINT32 seed = 0x4321;
+	UINT64 totalSize = 0;
+	const int tiles = 2000;
+	INT16 tile[4096];
+	INT16 decoded[4096];
+	BYTE encoded[16384];
+	test_fill_tile(tile, &seed, 15);
+	start = GetTickCount64();
+
+	for (i = 0; i < tiles; i++)
+	{
+		status = context->rlgr_encode(mode, tile, 4096, encoded, sizeof(encoded));
+		totalSize += status;
+	}
+
+	encodeTime = GetTickCount64() - start;
+	start = GetTickCount64();
+
+	for (i = 0; i < tiles; i++)
+	{
+		if (context->rlgr_decode(mode, encoded, status, decoded, 4096) < 0)
+			return -1;
+	}
+
+	decodeTime = GetTickCount64() - start;
+	printf("RLGR%d: %d tiles, %"PRIu64" bytes, encode %"PRIu64" ms, decode %"PRIu64" ms\n",
+	       (mode == RLGR1) ? 1 : 3, tiles, totalSize, encodeTime, decodeTime);
+	return 0;
+}
+
+int TestFreeRDPCodecRlgr(int argc, char* argv[])
+{
+	int rc = -1;
+	RFX_CONTEXT* context = rfx_context_new(TRUE);
+
+	if (!context)
+		return -1;
+
+	if (test_RlgrExact(context) < 0)
+		goto fail;
+
+	if (test_RlgrBenchmark(context, RLGR1) < 0)
+		goto fail;
+
+	if (test_RlgrBenchmark(context, RLGR3) < 0)
+		goto fail;
+
+	rc = 0;
+fail:
+	rfx_context_free(context);
+	return rc;
+}
@@ -198,6 +198,181 @@ int test_ZGfxCompressConsistent()
 	return 0;
 }
 
+/* Without compression enabled a compressor sends raw segments */
+static int test_ZGfxCompressRaw()
+{
+	int rc = -1;
+	UINT32 index;
+	UINT32 Flags = 0;
+	UINT32 DstSize;
+	BYTE* pDstData = NULL;
+	UINT32 SrcSize = 100000;
+	BYTE* pSrcData = (BYTE*) malloc(SrcSize);
+	ZGFX_CONTEXT* zgfx = zgfx_context_new(TRUE);
+
+	if (!pSrcData || !zgfx)
+		goto fail;
+
+	for (index = 0; index < SrcSize; index++)
+		pSrcData[index] = TEST_FOX_DATA[index % (sizeof(TEST_FOX_DATA) - 1)];
+
+	if (zgfx_compress(zgfx, pSrcData, SrcSize, &pDstData, &DstSize, &Flags) < 0)
+		goto fail;
+
+	/* descriptor, segment count, size and two segments of a header byte each */
+	if ((Flags & PACKET_COMPRESSED) || (DstSize != SrcSize + 7 + 2 * 5))
+		goto fail;
+
+	rc = 0;
+fail:
+	free(pSrcData);
+	free(pDstData);
+	zgfx_context_free(zgfx);
+	return rc;
+}
+
+static int test_ZGfxCompressRoundTrip()
+{
+	int status;
+	int round;
+	UINT32 index;
+	UINT32 Flags;
+	UINT32 DstSize;
+	UINT32 CompressedSize;
+	BYTE* pDstData;
+	BYTE* pCompressed;
+	BYTE* pSrcData;
+	ZGFX_CONTEXT* compressor;
+	ZGFX_CONTEXT* decompressor;
+	UINT32 SrcSize = 150000;
+	UINT32 seed = 0x12345678;
+	UINT64 totalIn = 0;
+	UINT64 totalOut = 0;
+	compressor = zgfx_context_new(TRUE);
+	decompressor = zgfx_context_new(FALSE);
+	pSrcData = (BYTE*) malloc(SrcSize);
+
+	if (!compressor || !decompressor || !pSrcData)
+		return -1;
+
+	if (!zgfx_context_set_compression(compressor, TRUE))
+		return -1;
+
+	/* several messages sharing one history, text with repetitions and noise */
+	for (round = 0; round < 20; round++)
+	{
+		for (index = 0; index < SrcSize; index++)
+		{
+			seed = seed * 1103515245 + 12345;
+
+			if ((seed >> 24) < 16)
+				pSrcData[index] = (BYTE)(seed >> 16);
+			else
+				pSrcData[index] = TEST_FOX_DATA[(index + round * 7) % (sizeof(TEST_FOX_DATA) - 1)];
+		}
+
+		Flags = 0;
+		status = zgfx_compress(compressor, pSrcData, SrcSize, &pCompressed, &CompressedSize, &Flags);
+
+		if (status < 0)
+			return -1;
+
+		status = zgfx_decompress(decompressor, pCompressed, CompressedSize, &pDstData, &DstSize, 0);
+
+		if ((status < 0) || (DstSize != SrcSize) || (memcmp(pDstData, pSrcData, SrcSize) != 0))
+		{
+			printf("test_ZGfxCompressRoundTrip: round %d mismatch\n", round);
+			return -1;
+		}
+
+		totalIn += SrcSize;
+		totalOut += CompressedSize;
+		free(pCompressed);
+		free(pDstData);
+	}
+
+	printf("test_ZGfxCompressRoundTrip: %"PRIu64" -> %"PRIu64" bytes\n", totalIn, totalOut);
+
+	if (totalOut >= totalIn)
+		return -1;
+
+	free(pSrcData);
+	zgfx_context_free(compressor);
+	zgfx_context_free(decompressor);
+	return 0;
+}
+
+static int test_ZGfxSegmentRoundTrip()
+{
+	int rc = -1;
+	UINT32 index;
+	UINT32 Flags;
+	UINT32 chunk;
+	UINT32 seed = 0x87654321;
+	UINT32 SliceSize = 1590; /* DRDYNVC chunk payload */
+	UINT32 SrcSize = 200000;
+	UINT64 totalOut = 0;
+	BYTE* pSrcData = (BYTE*) malloc(SrcSize);
+	wStream* sCompressed = Stream_New(NULL, SliceSize + 1);
+	wStream* sDecompressed = Stream_New(NULL, SrcSize);
+	ZGFX_LITE_CONTEXT* compressor = zgfx_lite_context_new(TRUE);
+	ZGFX_LITE_CONTEXT* decompressor = zgfx_lite_context_new(FALSE);
+
+	if (!pSrcData || !sCompressed || !sDecompressed || !compressor || !decompressor)
+		goto fail;
+
+	for (index = 0; index < SrcSize; index++)
+	{
+		seed = seed * 1103515245 + 12345;
+
+		if ((seed >> 24) < 32)
+			pSrcData[index] = (BYTE)(seed >> 16);
+		else
+			pSrcData[index] = TEST_FOX_DATA[index % (sizeof(TEST_FOX_DATA) - 1)];
+	}
+
+	for (index = 0; index < SrcSize; index += chunk)
+	{
+		chunk = MIN(SliceSize, SrcSize - index);
+		Stream_SetPosition(sCompressed, 0);
+		Flags = 0;
+
+		if (zgfx_compress_segment_to_stream(compressor, sCompressed, &pSrcData[index], chunk,
+		                                    &Flags) < 0)
+			goto fail;
+
+		/* a segment never exceeds its slice plus the header byte */
+		if (Stream_GetPosition(sCompressed) > chunk + 1)
+			goto fail;
+
+		if (zgfx_decompress_segment_to_stream(decompressor, sDecompressed,
+		                                      Stream_Buffer(sCompressed), Stream_GetPosition(sCompressed)) < 0)
+			goto fail;
+
+		totalOut += Stream_GetPosition(sCompressed);
+	}
+
+	if ((Stream_GetPosition(sDecompressed) != SrcSize) ||
+	    (memcmp(Stream_Buffer(sDecompressed), pSrcData, SrcSize) != 0))
+	{
+		printf("test_ZGfxSegmentRoundTrip: mismatch\n");
+		goto fail;
+	}
+
+	printf("test_ZGfxSegmentRoundTrip: %"PRIu32" -> %"PRIu64" bytes\n", SrcSize, totalOut);
+
+	if (totalOut < SrcSize)
+		rc = 0;
+
+fail:
+	free(pSrcData);
+	Stream_Free(sCompressed, TRUE);
+	Stream_Free(sDecompressed, TRUE);
+	zgfx_lite_context_free(compressor);
+	zgfx_lite_context_free(decompressor);
+	return rc;
+}
+
 int TestFreeRDPCodecZGfx(int argc, char* argv[])
 {
 	if (test_ZGfxCompressFox() < 0)
@@ -212,6 +387,15 @@ int TestFreeRDPCodecZGfx(int argc, char* argv[])
 	if (test_ZGfxCompressConsistent() < 0)
 		return -1;
 
+	if (test_ZGfxCompressRaw() < 0)
+		return -1;
+
+	if (test_ZGfxCompressRoundTrip() < 0)
+		return -1;
+
+	if (test_ZGfxSegmentRoundTrip() < 0)
+		return -1;
+
 	return 0;
 }
 
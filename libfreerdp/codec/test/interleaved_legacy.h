@@ -0,0 +1,28 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Interleaved RLE Bitmap Codec, decoder before the rewrite
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CODEC_TEST_INTERLEAVED_LEGACY_H
+#define FREERDP_CODEC_TEST_INTERLEAVED_LEGACY_H
+
+#include <winpr/wtypes.h>
+
+/* Decodes with the decoder the rewritten one must match, streams are trusted */
+BOOL interleaved_legacy_decompress(const BYTE* pSrcData, UINT32 SrcSize, UINT32 nWidth,
+                                   UINT32 nHeight, UINT32 bpp, BYTE* pDstData, UINT32 DstFormat,
+                                   UINT32 nDstStep);
+
+#endif /* FREERDP_CODEC_TEST_INTERLEAVED_LEGACY_H */
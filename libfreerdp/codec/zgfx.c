@@ -98,6 +98,71 @@ static const ZGFX_TOKEN ZGFX_TOKEN_TABLE[] =
 	{ 0 }
 };
 
+/**
+ * Working state of a context. The history ring and output buffer of a
+ * ZGFX_CONTEXT are its public arrays, a ZGFX_LITE_CONTEXT sizes them to the
+ * RDP 8.0 Lite window instead.
+ */
+struct _ZGFX_STATE
+{
+	const BYTE* pbInputCurrent;
+	const BYTE* pbInputEnd;
+
+	UINT32 bits;
+	UINT32 cBitsRemaining;
+	UINT32 BitsCurrent;
+	UINT32 cBitsCurrent;
+
+	BYTE* OutputBuffer;
+	UINT32 OutputCount;
+	UINT32 OutputBufferSize;
+
+	BYTE* HistoryBuffer;
+	UINT32 HistoryIndex;
+	UINT32 HistoryBufferSize;
+	UINT32 HistoryValid;
+
+	/* compressor only, NULL while segments are sent raw */
+	UINT32* HashTable;
+	UINT32 HashMask;
+	UINT32 MaxSegmentSize;
+};
+typedef struct _ZGFX_STATE ZGFX_STATE;
+
+/* Allocated by zgfx_context_new, the public layout stays unchanged */
+struct _ZGFX_CONTEXT_PRIVATE
+{
+	ZGFX_CONTEXT context;
+	ZGFX_STATE state;
+};
+typedef struct _ZGFX_CONTEXT_PRIVATE ZGFX_CONTEXT_PRIVATE;
+
+#define ZGFX_LITE_HISTORY_BUFFER_SIZE	(2 * ZGFX_LITE_HISTORY_SIZE + 1)
+
+struct _ZGFX_LITE_CONTEXT
+{
+	ZGFX_STATE state;
+	BYTE OutputBuffer[ZGFX_LITE_HISTORY_SIZE];
+	BYTE HistoryBuffer[ZGFX_LITE_HISTORY_BUFFER_SIZE];
+};
+
+#define ZGFX_HASH_BITS		16
+#define ZGFX_LITE_HASH_BITS	13
+#define ZGFX_MIN_MATCH		3
+
+static INLINE ZGFX_STATE* zgfx_get_state(ZGFX_CONTEXT* zgfx)
+{
+	return &((ZGFX_CONTEXT_PRIVATE*) zgfx)->state;
+}
+
+/* Mirrors the counters into the public fields */
+static void zgfx_context_sync(ZGFX_CONTEXT* zgfx)
+{
+	const ZGFX_STATE* state = zgfx_get_state(zgfx);
+	zgfx->OutputCount = state->OutputCount;
+	zgfx->HistoryIndex = state->HistoryIndex;
+}
+
 #define zgfx_GetBits(_zgfx, _nbits) \
 	while (_zgfx->cBitsCurrent < _nbits) { \
 		_zgfx->BitsCurrent <<= 8; \
@@ -110,7 +175,7 @@ static const ZGFX_TOKEN ZGFX_TOKEN_TABLE[] =
 	_zgfx->bits = _zgfx->BitsCurrent >> _zgfx->cBitsCurrent; \
 	_zgfx->BitsCurrent &= ((1 << _zgfx->cBitsCurrent) - 1);
 
-static void zgfx_history_buffer_ring_write(ZGFX_CONTEXT* zgfx, const BYTE* src, UINT32 count)
+static void zgfx_history_buffer_ring_write(ZGFX_STATE* zgfx, const BYTE* src, UINT32 count)
 {
 	UINT32 front;
 	UINT32 residue;
@@ -142,7 +207,7 @@ static void zgfx_history_buffer_ring_write(ZGFX_CONTEXT* zgfx, const BYTE* src,
 	}
 }
 
-static void zgfx_history_buffer_ring_read(ZGFX_CONTEXT* zgfx, int offset, BYTE* dst, UINT32 count)
+static void zgfx_history_buffer_ring_read(ZGFX_STATE* zgfx, int offset, BYTE* dst, UINT32 count)
 {
 	UINT32 front;
 	UINT32 index;
@@ -190,7 +255,7 @@ static void zgfx_history_buffer_ring_read(ZGFX_CONTEXT* zgfx, int offset, BYTE*
 	while ((bytesLeft -= bytes) > 0);
 }
 
-static int zgfx_decompress_segment(ZGFX_CONTEXT* zgfx, const BYTE* pbSegment, UINT32 cbSegment)
+static int zgfx_decompress_segment(ZGFX_STATE* zgfx, const BYTE* pbSegment, UINT32 cbSegment)
 {
 	BYTE c;
 	BYTE flags;
@@ -211,6 +276,9 @@ static int zgfx_decompress_segment(ZGFX_CONTEXT* zgfx, const BYTE* pbSegment, UI
 
 	if (!(flags & PACKET_COMPRESSED))
 	{
+		if (cbSegment > zgfx->OutputBufferSize)
+			return -1;
+
 		zgfx_history_buffer_ring_write(zgfx, pbSegment, cbSegment);
 		CopyMemory(zgfx->OutputBuffer, pbSegment, cbSegment);
 		zgfx->OutputCount = cbSegment;
@@ -243,6 +311,9 @@ static int zgfx_decompress_segment(ZGFX_CONTEXT* zgfx, const BYTE* pbSegment, UI
 				if (ZGFX_TOKEN_TABLE[opIndex].tokenType == 0)
 				{
 					/* Literal */
+					if (zgfx->OutputCount >= zgfx->OutputBufferSize)
+						return -1;
+
 					zgfx_GetBits(zgfx, ZGFX_TOKEN_TABLE[opIndex].valueBits);
 					c = (BYTE)(ZGFX_TOKEN_TABLE[opIndex].valueBase + zgfx->bits);
 					zgfx->HistoryBuffer[zgfx->HistoryIndex] = c;
@@ -283,6 +354,10 @@ static int zgfx_decompress_segment(ZGFX_CONTEXT* zgfx, const BYTE* pbSegment, UI
 							count += zgfx->bits;
 						}
 
+						if ((distance > zgfx->HistoryBufferSize) ||
+						    (count > zgfx->OutputBufferSize - zgfx->OutputCount))
+							return -1;
+
 						zgfx_history_buffer_ring_read(zgfx, distance, &(zgfx->OutputBuffer[zgfx->OutputCount]), count);
 						zgfx_history_buffer_ring_write(zgfx, &(zgfx->OutputBuffer[zgfx->OutputCount]), count);
 						zgfx->OutputCount += count;
@@ -292,6 +367,11 @@ static int zgfx_decompress_segment(ZGFX_CONTEXT* zgfx, const BYTE* pbSegment, UI
 						/* Unencoded */
 						zgfx_GetBits(zgfx, 15);
 						count = zgfx->bits;
+
+						if ((count > zgfx->OutputBufferSize - zgfx->OutputCount) ||
+						    (count > (UINT32)(zgfx->pbInputEnd - zgfx->pbInputCurrent)))
+							return -1;
+
 						zgfx->cBitsRemaining -= zgfx->cBitsCurrent;
 						zgfx->cBitsCurrent = 0;
 						zgfx->BitsCurrent = 0;
@@ -316,6 +396,7 @@ int zgfx_decompress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BY
 {
 	int status;
 	BYTE descriptor;
+	ZGFX_STATE* state = zgfx_get_state(zgfx);
 
 	if (SrcSize < 1)
 		return -1;
@@ -324,18 +405,19 @@ int zgfx_decompress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BY
 
 	if (descriptor == ZGFX_SEGMENTED_SINGLE)
 	{
-		status = zgfx_decompress_segment(zgfx, &pSrcData[1], SrcSize - 1);
+		status = zgfx_decompress_segment(state, &pSrcData[1], SrcSize - 1);
+		zgfx_context_sync(zgfx);
 
 		if (status < 0)
 			return status;
 
-		*ppDstData = (BYTE*) malloc(zgfx->OutputCount);
+		*ppDstData = (BYTE*) malloc(state->OutputCount);
 
 		if (!*ppDstData)
 			return -1;
 
-		*pDstSize = zgfx->OutputCount;
-		CopyMemory(*ppDstData, zgfx->OutputBuffer, zgfx->OutputCount);
+		*pDstSize = state->OutputCount;
+		CopyMemory(*ppDstData, state->OutputBuffer, state->OutputCount);
 	}
 	else if (descriptor == ZGFX_SEGMENTED_MULTIPART)
 	{
@@ -360,14 +442,15 @@ int zgfx_decompress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BY
 		{
 			segmentSize = *((UINT32*) &pSrcData[segmentOffset]); /* segmentSize (4 bytes) */
 			segmentOffset += 4;
-			status = zgfx_decompress_segment(zgfx, &pSrcData[segmentOffset], segmentSize);
+			status = zgfx_decompress_segment(state, &pSrcData[segmentOffset], segmentSize);
+			zgfx_context_sync(zgfx);
 
 			if (status < 0)
 				return status;
 
 			segmentOffset += segmentSize;
-			CopyMemory(pConcatenated, zgfx->OutputBuffer, zgfx->OutputCount);
-			pConcatenated += zgfx->OutputCount;
+			CopyMemory(pConcatenated, state->OutputBuffer, state->OutputCount);
+			pConcatenated += state->OutputCount;
 		}
 	}
 	else
@@ -378,18 +461,285 @@ int zgfx_decompress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BY
 	return 1;
 }
 
-static int zgfx_compress_segment(ZGFX_CONTEXT* zgfx, wStream* s, const BYTE* pSrcData,
+struct _ZGFX_BIT_WRITER
+{
+	BYTE* buffer;
+	UINT32 length;
+	UINT32 capacity;
+	UINT32 accumulator;
+	UINT32 count;
+};
+typedef struct _ZGFX_BIT_WRITER ZGFX_BIT_WRITER;
+
+static INLINE BOOL zgfx_write_bits(ZGFX_BIT_WRITER* bw, UINT32 value, UINT32 nbits)
+{
+	while (nbits > 0)
+	{
+		UINT32 n = (nbits > 16) ? 16 : nbits;
+		nbits -= n;
+		bw->accumulator = (bw->accumulator << n) | ((value >> nbits) & ((1 << n) - 1));
+		bw->count += n;
+
+		while (bw->count >= 8)
+		{
+			if (bw->length >= bw->capacity)
+				return FALSE;
+
+			bw->count -= 8;
+			bw->buffer[bw->length++] = (BYTE)(bw->accumulator >> bw->count);
+		}
+
+		bw->accumulator &= (1 << bw->count) - 1;
+	}
+
+	return TRUE;
+}
+
+/* Code and length of each literal, the prefix of a token or 0 and the byte */
+struct _ZGFX_LITERAL
+{
+	UINT16 code;
+	BYTE length;
+};
+typedef struct _ZGFX_LITERAL ZGFX_LITERAL;
+
+static const ZGFX_LITERAL ZGFX_LITERAL_TABLE[256] =
+{
+	{ 0x018, 5 }, { 0x019, 5 }, { 0x034, 6 }, { 0x035, 6 }, /* 0x00 */
+	{ 0x06E, 7 }, { 0x06F, 7 }, { 0x070, 7 }, { 0x071, 7 }, /* 0x04 */
+	{ 0x072, 7 }, { 0x073, 7 }, { 0x074, 7 }, { 0x075, 7 }, /* 0x08 */
+	{ 0x0FC, 8 }, { 0x00D, 9 }, { 0x00E, 9 }, { 0x00F, 9 }, /* 0x0C */
+	{ 0x010, 9 }, { 0x011, 9 }, { 0x012, 9 }, { 0x013, 9 }, /* 0x10 */
+	{ 0x014, 9 }, { 0x015, 9 }, { 0x016, 9 }, { 0x017, 9 }, /* 0x14 */
+	{ 0x018, 9 }, { 0x019, 9 }, { 0x01A, 9 }, { 0x01B, 9 }, /* 0x18 */
+	{ 0x01C, 9 }, { 0x01D, 9 }, { 0x01E, 9 }, { 0x01F, 9 }, /* 0x1C */
+	{ 0x020, 9 }, { 0x021, 9 }, { 0x022, 9 }, { 0x023, 9 }, /* 0x20 */
+	{ 0x024, 9 }, { 0x025, 9 }, { 0x026, 9 }, { 0x027, 9 }, /* 0x24 */
+	{ 0x028, 9 }, { 0x029, 9 }, { 0x02A, 9 }, { 0x02B, 9 }, /* 0x28 */
+	{ 0x02C, 9 }, { 0x02D, 9 }, { 0x02E, 9 }, { 0x02F, 9 }, /* 0x2C */
+	{ 0x030, 9 }, { 0x031, 9 }, { 0x032, 9 }, { 0x033, 9 }, /* 0x30 */
+	{ 0x034, 9 }, { 0x035, 9 }, { 0x036, 9 }, { 0x037, 9 }, /* 0x34 */
+	{ 0x0FD, 8 }, { 0x0FE, 8 }, { 0x076, 7 }, { 0x077, 7 }, /* 0x38 */
+	{ 0x078, 7 }, { 0x079, 7 }, { 0x07A, 7 }, { 0x07B, 7 }, /* 0x3C */
+	{ 0x07C, 7 }, { 0x041, 9 }, { 0x042, 9 }, { 0x043, 9 }, /* 0x40 */
+	{ 0x044, 9 }, { 0x045, 9 }, { 0x046, 9 }, { 0x047, 9 }, /* 0x44 */
+	{ 0x048, 9 }, { 0x049, 9 }, { 0x04A, 9 }, { 0x04B, 9 }, /* 0x48 */
+	{ 0x04C, 9 }, { 0x04D, 9 }, { 0x04E, 9 }, { 0x04F, 9 }, /* 0x4C */
+	{ 0x050, 9 }, { 0x051, 9 }, { 0x052, 9 }, { 0x053, 9 }, /* 0x50 */
+	{ 0x054, 9 }, { 0x055, 9 }, { 0x056, 9 }, { 0x057, 9 }, /* 0x54 */
+	{ 0x058, 9 }, { 0x059, 9 }, { 0x05A, 9 }, { 0x05B, 9 }, /* 0x58 */
+	{ 0x05C, 9 }, { 0x05D, 9 }, { 0x05E, 9 }, { 0x05F, 9 }, /* 0x5C */
+	{ 0x060, 9 }, { 0x061, 9 }, { 0x062, 9 }, { 0x063, 9 }, /* 0x60 */
+	{ 0x064, 9 }, { 0x065, 9 }, { 0x0FF, 8 }, { 0x067, 9 }, /* 0x64 */
+	{ 0x068, 9 }, { 0x069, 9 }, { 0x06A, 9 }, { 0x06B, 9 }, /* 0x68 */
+	{ 0x06C, 9 }, { 0x06D, 9 }, { 0x06E, 9 }, { 0x06F, 9 }, /* 0x6C */
+	{ 0x070, 9 }, { 0x071, 9 }, { 0x072, 9 }, { 0x073, 9 }, /* 0x70 */
+	{ 0x074, 9 }, { 0x075, 9 }, { 0x076, 9 }, { 0x077, 9 }, /* 0x74 */
+	{ 0x078, 9 }, { 0x079, 9 }, { 0x07A, 9 }, { 0x07B, 9 }, /* 0x78 */
+	{ 0x07C, 9 }, { 0x07D, 9 }, { 0x07E, 9 }, { 0x07F, 9 }, /* 0x7C */
+	{ 0x07D, 7 }, { 0x081, 9 }, { 0x082, 9 }, { 0x083, 9 }, /* 0x80 */
+	{ 0x084, 9 }, { 0x085, 9 }, { 0x086, 9 }, { 0x087, 9 }, /* 0x84 */
+	{ 0x088, 9 }, { 0x089, 9 }, { 0x08A, 9 }, { 0x08B, 9 }, /* 0x88 */
+	{ 0x08C, 9 }, { 0x08D, 9 }, { 0x08E, 9 }, { 0x08F, 9 }, /* 0x8C */
+	{ 0x090, 9 }, { 0x091, 9 }, { 0x092, 9 }, { 0x093, 9 }, /* 0x90 */
+	{ 0x094, 9 }, { 0x095, 9 }, { 0x096, 9 }, { 0x097, 9 }, /* 0x94 */
+	{ 0x098, 9 }, { 0x099, 9 }, { 0x09A, 9 }, { 0x09B, 9 }, /* 0x98 */
+	{ 0x09C, 9 }, { 0x09D, 9 }, { 0x09E, 9 }, { 0x09F, 9 }, /* 0x9C */
+	{ 0x0A0, 9 }, { 0x0A1, 9 }, { 0x0A2, 9 }, { 0x0A3, 9 }, /* 0xA0 */
+	{ 0x0A4, 9 }, { 0x0A5, 9 }, { 0x0A6, 9 }, { 0x0A7, 9 }, /* 0xA4 */
+	{ 0x0A8, 9 }, { 0x0A9, 9 }, { 0x0AA, 9 }, { 0x0AB, 9 }, /* 0xA8 */
+	{ 0x0AC, 9 }, { 0x0AD, 9 }, { 0x0AE, 9 }, { 0x0AF, 9 }, /* 0xAC */
+	{ 0x0B0, 9 }, { 0x0B1, 9 }, { 0x0B2, 9 }, { 0x0B3, 9 }, /* 0xB0 */
+	{ 0x0B4, 9 }, { 0x0B5, 9 }, { 0x0B6, 9 }, { 0x0B7, 9 }, /* 0xB4 */
+	{ 0x0B8, 9 }, { 0x0B9, 9 }, { 0x0BA, 9 }, { 0x0BB, 9 }, /* 0xB8 */
+	{ 0x0BC, 9 }, { 0x0BD, 9 }, { 0x0BE, 9 }, { 0x0BF, 9 }, /* 0xBC */
+	{ 0x0C0, 9 }, { 0x0C1, 9 }, { 0x0C2, 9 }, { 0x0C3, 9 }, /* 0xC0 */
+	{ 0x0C4, 9 }, { 0x0C5, 9 }, { 0x0C6, 9 }, { 0x0C7, 9 }, /* 0xC4 */
+	{ 0x0C8, 9 }, { 0x0C9, 9 }, { 0x0CA, 9 }, { 0x0CB, 9 }, /* 0xC8 */
+	{ 0x0CC, 9 }, { 0x0CD, 9 }, { 0x0CE, 9 }, { 0x0CF, 9 }, /* 0xCC */
+	{ 0x0D0, 9 }, { 0x0D1, 9 }, { 0x0D2, 9 }, { 0x0D3, 9 }, /* 0xD0 */
+	{ 0x0D4, 9 }, { 0x0D5, 9 }, { 0x0D6, 9 }, { 0x0D7, 9 }, /* 0xD4 */
+	{ 0x0D8, 9 }, { 0x0D9, 9 }, { 0x0DA, 9 }, { 0x0DB, 9 }, /* 0xD8 */
+	{ 0x0DC, 9 }, { 0x0DD, 9 }, { 0x0DE, 9 }, { 0x0DF, 9 }, /* 0xDC */
+	{ 0x0E0, 9 }, { 0x0E1, 9 }, { 0x0E2, 9 }, { 0x0E3, 9 }, /* 0xE0 */
+	{ 0x0E4, 9 }, { 0x0E5, 9 }, { 0x0E6, 9 }, { 0x0E7, 9 }, /* 0xE4 */
+	{ 0x0E8, 9 }, { 0x0E9, 9 }, { 0x0EA, 9 }, { 0x0EB, 9 }, /* 0xE8 */
+	{ 0x0EC, 9 }, { 0x0ED, 9 }, { 0x0EE, 9 }, { 0x0EF, 9 }, /* 0xEC */
+	{ 0x0F0, 9 }, { 0x0F1, 9 }, { 0x0F2, 9 }, { 0x0F3, 9 }, /* 0xF0 */
+	{ 0x0F4, 9 }, { 0x0F5, 9 }, { 0x0F6, 9 }, { 0x0F7, 9 }, /* 0xF4 */
+	{ 0x0F8, 9 }, { 0x0F9, 9 }, { 0x0FA, 9 }, { 0x0FB, 9 }, /* 0xF8 */
+	{ 0x0FC, 9 }, { 0x0FD, 9 }, { 0x0FE, 9 }, { 0x036, 6 }  /* 0xFC */
+};
+
+static INLINE BOOL zgfx_write_literal(ZGFX_BIT_WRITER* bw, BYTE c)
+{
+	return zgfx_write_bits(bw, ZGFX_LITERAL_TABLE[c].code, ZGFX_LITERAL_TABLE[c].length);
+}
+
+static INLINE BOOL zgfx_write_match(ZGFX_BIT_WRITER* bw, UINT32 distance, UINT32 count)
+{
+	int index;
+	UINT32 extra;
+	UINT32 base;
+
+	for (index = 0; ZGFX_TOKEN_TABLE[index].prefixLength != 0; index++)
+	{
+		const ZGFX_TOKEN* token = &ZGFX_TOKEN_TABLE[index];
+
+		if ((token->tokenType == 1) && (distance >= token->valueBase) &&
+		    (distance - token->valueBase < (1U << token->valueBits)))
+		{
+			if (!zgfx_write_bits(bw, token->prefixCode, token->prefixLength))
+				return FALSE;
+
+			if (!zgfx_write_bits(bw, distance - token->valueBase, token->valueBits))
+				return FALSE;
+
+			break;
+		}
+	}
+
+	if (ZGFX_TOKEN_TABLE[index].prefixLength == 0)
+		return FALSE;
+
+	if (count == 3)
+		return zgfx_write_bits(bw, 0, 1);
+
+	/* 1, then (extra - 2) ones and a zero, then extra bits of count - base */
+	base = 4;
+	extra = 2;
+
+	while (count >= (base << 1))
+	{
+		base <<= 1;
+		extra++;
+	}
+
+	if (!zgfx_write_bits(bw, ((1 << (extra - 1)) - 1) << 1, extra))
+		return FALSE;
+
+	return zgfx_write_bits(bw, count - base, extra);
+}
+
+static INLINE UINT32 zgfx_hash(const BYTE* p, UINT32 mask)
+{
+	return ((p[0] << 8) ^ (p[1] << 4) ^ p[2]) & mask;
+}
+
+/**
+ * Greedy LZ77 encoder for one segment. Matches are searched through a single
+ * entry hash table over the history ring, which holds the same data as the
+ * decompressor history once the segment has been written to it. Without a
+ * hash table the segment is sent raw and the history is not kept.
+ */
+static int zgfx_compress_segment(ZGFX_STATE* zgfx, wStream* s, const BYTE* pSrcData,
                                  UINT32 SrcSize, UINT32* pFlags)
 {
-	/* FIXME: Currently compression not implemented. Just copy the raw source */
+	UINT32 i;
+	BYTE header;
+	UINT32 start;
+	UINT32 available;
+	ZGFX_BIT_WRITER bw;
+	const UINT32 size = zgfx->HistoryBufferSize;
+	/* the segment is written to the history ring before it is encoded and may
+	 * overwrite the oldest entries, never reach back that far */
+	const UINT32 maxDistance = size - zgfx->MaxSegmentSize - 1;
+
 	if (!Stream_EnsureRemainingCapacity(s, SrcSize + 1))
 	{
 		WLog_ERR(TAG, "Stream_EnsureRemainingCapacity failed!");
 		return -1;
 	}
 
-	(*pFlags) |= ZGFX_PACKET_COMPR_TYPE_RDP8; /* RDP 8.0 compression format */
-	Stream_Write_UINT8(s, (*pFlags)); /* header (1 byte) */
+	if (zgfx->HashTable && (SrcSize > ZGFX_MIN_MATCH))
+	{
+		start = zgfx->HistoryIndex;
+		available = zgfx->HistoryValid;
+		zgfx_history_buffer_ring_write(zgfx, pSrcData, SrcSize);
+		zgfx->HistoryValid = MIN(available + SrcSize, size);
+		bw.buffer = Stream_Pointer(s) + 1;
+		bw.length = 0;
+		/* leave room for the trailing padding byte */
+		bw.capacity = SrcSize - 1;
+		bw.accumulator = 0;
+		bw.count = 0;
+
+		for (i = 0; i < SrcSize;)
+		{
+			UINT32 count = 0;
+			UINT32 distance = 0;
+			const UINT32 position = (start + i) % size;
+
+			if (i + ZGFX_MIN_MATCH <= SrcSize)
+			{
+				const UINT32 hash = zgfx_hash(&pSrcData[i], zgfx->HashMask);
+				const UINT32 candidate = zgfx->HashTable[hash];
+				zgfx->HashTable[hash] = position + 1;
+
+				if (candidate)
+				{
+					distance = (position + size - (candidate - 1)) % size;
+
+					if ((distance > 0) && (distance <= available + i) && (distance <= maxDistance))
+					{
+						const UINT32 maxCount = SrcSize - i;
+						UINT32 index = candidate - 1;
+
+						while ((count < maxCount) && (zgfx->HistoryBuffer[index] == pSrcData[i + count]))
+						{
+							count++;
+
+							if (++index == size)
+								index = 0;
+						}
+					}
+				}
+			}
+
+			if (count >= ZGFX_MIN_MATCH)
+			{
+				if (!zgfx_write_match(&bw, distance, count))
+					break;
+
+				i += count;
+			}
+			else
+			{
+				if (!zgfx_write_literal(&bw, pSrcData[i]))
+					break;
+
+				i++;
+			}
+		}
+
+		if ((i == SrcSize) && (bw.length + ((bw.count > 0) ? 1 : 0) < bw.capacity))
+		{
+			BYTE padding = 0;
+
+			if (bw.count > 0)
+			{
+				padding = (BYTE)(8 - bw.count);
+				zgfx_write_bits(&bw, 0, padding);
+			}
+
+			bw.buffer[bw.length++] = padding;
+			header = ZGFX_PACKET_COMPR_TYPE_RDP8 | PACKET_COMPRESSED;
+			(*pFlags) |= header;
+			Stream_Write_UINT8(s, header); /* header (1 byte) */
+			Stream_Seek(s, bw.length);
+			return 1;
+		}
+	}
+	else if (zgfx->HashTable)
+	{
+		zgfx_history_buffer_ring_write(zgfx, pSrcData, SrcSize);
+		zgfx->HistoryValid = MIN(zgfx->HistoryValid + SrcSize, size);
+	}
+
+	/* Incompressible, send raw. The history already holds the data */
+	header = ZGFX_PACKET_COMPR_TYPE_RDP8;
+	(*pFlags) |= header;
+	Stream_Write_UINT8(s, header); /* header (1 byte) */
 	Stream_Write(s, pSrcData, SrcSize);
 	return 1;
 }
@@ -403,6 +753,7 @@ int zgfx_compress_to_stream(ZGFX_CONTEXT* zgfx, wStream* sDst, const BYTE* pUnco
 	size_t posSegmentCount = 0;
 	const BYTE* pSrcData;
 	int status = 0;
+	ZGFX_STATE* state = zgfx_get_state(zgfx);
 	maxLength = ZGFX_SEGMENTED_MAXSIZE;
 	totalLength = uncompressedSize;
 	pSrcData = pUncompressed;
@@ -448,7 +799,7 @@ int zgfx_compress_to_stream(ZGFX_CONTEXT* zgfx, wStream* sDst, const BYTE* pUnco
 
 		posDataStart = Stream_GetPosition(sDst);
 
-		if ((status = zgfx_compress_segment(zgfx, sDst, pSrcData, SrcSize, pFlags)) < 0)
+		if ((status = zgfx_compress_segment(state, sDst, pSrcData, SrcSize, pFlags)) < 0)
 		{
 			return status;
 		}
@@ -465,6 +816,7 @@ int zgfx_compress_to_stream(ZGFX_CONTEXT* zgfx, wStream* sDst, const BYTE* pUnco
 		pSrcData += SrcSize;
 	}
 
+	zgfx_context_sync(zgfx);
 	Stream_SealLength(sDst);
 
 	/* fill back segmentCount */
@@ -491,28 +843,151 @@ int zgfx_compress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BYTE
 }
 
 
+static void zgfx_state_reset(ZGFX_STATE* state)
+{
+	state->HistoryIndex = 0;
+	state->HistoryValid = 0;
+	state->OutputCount = 0;
+
+	if (state->HashTable)
+		ZeroMemory(state->HashTable, sizeof(UINT32) * (state->HashMask + 1));
+}
+
+static void zgfx_state_init(ZGFX_STATE* state, BYTE* history, UINT32 historySize, BYTE* output,
+                            UINT32 outputSize, UINT32 maxSegmentSize)
+{
+	state->HistoryBuffer = history;
+	state->HistoryBufferSize = historySize;
+	state->OutputBuffer = output;
+	state->OutputBufferSize = outputSize;
+	state->MaxSegmentSize = maxSegmentSize;
+}
+
+static BOOL zgfx_state_set_compression(ZGFX_STATE* state, UINT32 hashBits, BOOL enable)
+{
+	free(state->HashTable);
+	state->HashTable = NULL;
+	state->HashMask = 0;
+
+	if (enable)
+	{
+		state->HashTable = (UINT32*) calloc(1 << hashBits, sizeof(UINT32));
+
+		if (!state->HashTable)
+			return FALSE;
+
+		state->HashMask = (1 << hashBits) - 1;
+	}
+
+	zgfx_state_reset(state);
+	return TRUE;
+}
+
+BOOL zgfx_context_set_compression(ZGFX_CONTEXT* zgfx, BOOL enable)
+{
+	if (!zgfx || !zgfx->Compressor)
+		return FALSE;
+
+	if (!zgfx_state_set_compression(zgfx_get_state(zgfx), ZGFX_HASH_BITS, enable))
+		return FALSE;
+
+	zgfx_context_sync(zgfx);
+	return TRUE;
+}
+
 void zgfx_context_reset(ZGFX_CONTEXT* zgfx, BOOL flush)
 {
-	zgfx->HistoryIndex = 0;
+	zgfx_state_reset(zgfx_get_state(zgfx));
+	zgfx_context_sync(zgfx);
 }
 
 ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 {
 	ZGFX_CONTEXT* zgfx;
-	zgfx = (ZGFX_CONTEXT*) calloc(1, sizeof(ZGFX_CONTEXT));
+	ZGFX_CONTEXT_PRIVATE* priv;
+	priv = (ZGFX_CONTEXT_PRIVATE*) calloc(1, sizeof(ZGFX_CONTEXT_PRIVATE));
+
+	if (!priv)
+		return NULL;
+
+	zgfx = &priv->context;
+	zgfx->Compressor = Compressor;
+	zgfx->HistoryBufferSize = sizeof(zgfx->HistoryBuffer);
+	zgfx_state_init(&priv->state, zgfx->HistoryBuffer, sizeof(zgfx->HistoryBuffer),
+	                zgfx->OutputBuffer, sizeof(zgfx->OutputBuffer), ZGFX_SEGMENTED_MAXSIZE);
+	zgfx_context_reset(zgfx, FALSE);
+	return zgfx;
+}
 
+void zgfx_context_free(ZGFX_CONTEXT* zgfx)
+{
 	if (zgfx)
+		free(zgfx_get_state(zgfx)->HashTable);
+
+	free(zgfx);
+}
+
+int zgfx_compress_segment_to_stream(ZGFX_LITE_CONTEXT* zgfx, wStream* sDst, const BYTE* pSrcData,
+                                    UINT32 SrcSize, UINT32* pFlags)
+{
+	if (!zgfx || !sDst || !pFlags || (SrcSize > zgfx->state.MaxSegmentSize))
+		return -1;
+
+	return zgfx_compress_segment(&zgfx->state, sDst, pSrcData, SrcSize, pFlags);
+}
+
+int zgfx_decompress_segment_to_stream(ZGFX_LITE_CONTEXT* zgfx, wStream* sDst,
+                                      const BYTE* pSrcData, UINT32 SrcSize)
+{
+	int status;
+
+	if (!zgfx || !sDst)
+		return -1;
+
+	status = zgfx_decompress_segment(&zgfx->state, pSrcData, SrcSize);
+
+	if (status < 0)
+		return status;
+
+	if (!Stream_EnsureRemainingCapacity(sDst, zgfx->state.OutputCount))
+		return -1;
+
+	Stream_Write(sDst, zgfx->state.OutputBuffer, zgfx->state.OutputCount);
+	return 1;
+}
+
+/**
+ * The decompressor only keeps the window, the compressor the window and the
+ * segment it is encoding, see zgfx_compress_segment.
+ */
+ZGFX_LITE_CONTEXT* zgfx_lite_context_new(BOOL Compressor)
+{
+	ZGFX_LITE_CONTEXT* zgfx;
+	UINT32 historySize = ZGFX_LITE_HISTORY_SIZE;
+	zgfx = (ZGFX_LITE_CONTEXT*) calloc(1, sizeof(ZGFX_LITE_CONTEXT));
+
+	if (!zgfx)
+		return NULL;
+
+	if (Compressor)
+		historySize = ZGFX_LITE_HISTORY_BUFFER_SIZE;
+
+	zgfx_state_init(&zgfx->state, zgfx->HistoryBuffer, historySize, zgfx->OutputBuffer,
+	                sizeof(zgfx->OutputBuffer), ZGFX_LITE_HISTORY_SIZE);
+
+	if (Compressor && !zgfx_state_set_compression(&zgfx->state, ZGFX_LITE_HASH_BITS, TRUE))
 	{
-		zgfx->Compressor = Compressor;
-		zgfx->HistoryBufferSize = sizeof(zgfx->HistoryBuffer);
-		zgfx_context_reset(zgfx, FALSE);
+		free(zgfx);
+		return NULL;
 	}
 
 	return zgfx;
 }
 
-void zgfx_context_free(ZGFX_CONTEXT* zgfx)
+void zgfx_lite_context_free(ZGFX_LITE_CONTEXT* zgfx)
 {
+	if (zgfx)
+		free(zgfx->state.HashTable);
+
 	free(zgfx);
 }
-
@@ -972,6 +972,15 @@ BOOL freerdp_get_param_bool(rdpSettings* settings, int id)
 		case FreeRDP_PlayRemoteFx:
 			return settings->PlayRemoteFx;
 
+		case FreeRDP_RecordSession:
+			return settings->RecordSession;
+
+		case FreeRDP_PlaySession:
+			return settings->PlaySession;
+
+		case FreeRDP_PlaySessionRealTime:
+			return settings->PlaySessionRealTime;
+
 		case FreeRDP_GatewayUseSameCredentials:
 			return settings->GatewayUseSameCredentials;
 
@@ -1065,6 +1074,12 @@ BOOL freerdp_get_param_bool(rdpSettings* settings, int id)
 		case FreeRDP_SoundBeepsEnabled:
 			return settings->SoundBeepsEnabled;
 
+		case FreeRDP_VirtualChannelScheduling:
+			return settings->VirtualChannelScheduling;
+
+		case FreeRDP_SupportDynamicChannelCompression:
+			return settings->SupportDynamicChannelCompression;
+
 		case FreeRDP_SurfaceCommandsEnabled:
 			return settings->SurfaceCommandsEnabled;
 
@@ -1449,6 +1464,18 @@ int freerdp_set_param_bool(rdpSettings* settings, int id, BOOL param)
 			settings->PlayRemoteFx = param;
 			break;
 
+		case FreeRDP_RecordSession:
+			settings->RecordSession = param;
+			break;
+
+		case FreeRDP_PlaySession:
+			settings->PlaySession = param;
+			break;
+
+		case FreeRDP_PlaySessionRealTime:
+			settings->PlaySessionRealTime = param;
+			break;
+
 		case FreeRDP_GatewayUseSameCredentials:
 			settings->GatewayUseSameCredentials = param;
 			break;
@@ -1573,6 +1600,14 @@ int freerdp_set_param_bool(rdpSettings* settings, int id, BOOL param)
 			settings->SoundBeepsEnabled = param;
 			break;
 
+		case FreeRDP_VirtualChannelScheduling:
+			settings->VirtualChannelScheduling = param;
+			break;
+
+		case FreeRDP_SupportDynamicChannelCompression:
+			settings->SupportDynamicChannelCompression = param;
+			break;
+
 		case FreeRDP_SurfaceCommandsEnabled:
 			settings->SurfaceCommandsEnabled = param;
 			break;
@@ -2475,6 +2510,12 @@ char* freerdp_get_param_string(rdpSettings* settings, int id)
 		case FreeRDP_PlayRemoteFxFile:
 			return settings->PlayRemoteFxFile;
 
+		case FreeRDP_RecordSessionFile:
+			return settings->RecordSessionFile;
+
+		case FreeRDP_PlaySessionFile:
+			return settings->PlaySessionFile;
+
 		case FreeRDP_GatewayHostname:
 			return settings->GatewayHostname;
 
@@ -2681,6 +2722,14 @@ int freerdp_set_param_string(rdpSettings* settings, int id, const char* param)
 			tmp = &settings->PlayRemoteFxFile;
 			break;
 
+		case FreeRDP_RecordSessionFile:
+			tmp = &settings->RecordSessionFile;
+			break;
+
+		case FreeRDP_PlaySessionFile:
+			tmp = &settings->PlaySessionFile;
+			break;
+
 		case FreeRDP_GatewayHostname:
 			tmp = &settings->GatewayHostname;
 			break;
@@ -21,6 +21,8 @@
 #include "config.h"
 #endif
 
+#include <freerdp/utils/metrics.h>
+
 #include "bulk.h"
 
 #define TAG "com.freerdp.core"
@@ -117,6 +119,7 @@ int bulk_decompress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstD
 	UINT32 CompressedBytes;
 	UINT32 UncompressedBytes;
 	double CompressionRatio;
+	const UINT64 start = freerdp_metrics_now();
 	metrics = bulk->context->metrics;
 	bulk_compression_max_size(bulk);
 	type = flags & BULK_COMPRESSION_TYPE_MASK;
@@ -147,6 +150,12 @@ int bulk_decompress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstD
 				status = -1;
 				break;
 		}
+
+		if (status >= 0)
+		{
+			freerdp_metric_add(FREERDP_METRIC_BULK_DECOMPRESS, *pDstSize);
+			freerdp_metric_record_since(FREERDP_METRIC_BULK_DECOMPRESS_TIME, start);
+		}
 	}
 	else
 	{
@@ -187,6 +196,7 @@ int bulk_compress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstDat
 	UINT32 CompressedBytes;
 	UINT32 UncompressedBytes;
 	double CompressionRatio;
+	const UINT64 start = freerdp_metrics_now();
 	metrics = bulk->context->metrics;
 
 	if ((SrcSize <= 50) || (SrcSize >= 16384))
@@ -225,6 +235,8 @@ int bulk_compress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstDat
 		CompressedBytes = *pDstSize;
 		UncompressedBytes = SrcSize;
 		CompressionRatio = metrics_write_bytes(metrics, UncompressedBytes, CompressedBytes);
+		freerdp_metric_add(FREERDP_METRIC_BULK_COMPRESS, UncompressedBytes);
+		freerdp_metric_record_since(FREERDP_METRIC_BULK_COMPRESS_TIME, start);
 #ifdef WITH_BULK_DEBUG
 		{
 			WLog_DBG(TAG,
@@ -41,6 +41,7 @@
 #include <freerdp/client/channels.h>
 #include <freerdp/client/drdynvc.h>
 #include <freerdp/channels/channels.h>
+#include <freerdp/utils/metrics.h>
 
 #include "rdp.h"
 #include "client.h"
@@ -49,78 +50,714 @@
 
 #define TAG FREERDP_TAG("core.channels")
 
-BOOL freerdp_channel_send(rdpRdp* rdp, UINT16 channelId, BYTE* data, int size)
+#define CHANNEL_SCHEDULER_QUANTUM	8192
+#define CHANNEL_SCHEDULER_NO_DVC	0xFFFFFFFF
+
+/**
+ * Deficit round robin weights, indexed by FREERDP_CHANNEL_PRIORITY_*.
+ * A flow may send weight * CHANNEL_SCHEDULER_QUANTUM bytes per round.
+ */
+static const UINT32 CHANNEL_SCHEDULER_WEIGHTS[FREERDP_CHANNEL_PRIORITY_COUNT] =
+{
+	8, /* FREERDP_CHANNEL_PRIORITY_INPUT */
+	4, /* FREERDP_CHANNEL_PRIORITY_AUDIO */
+	2, /* FREERDP_CHANNEL_PRIORITY_GFX */
+	1  /* FREERDP_CHANNEL_PRIORITY_BULK */
+};
+
+struct rdp_channel_message
+{
+	BYTE* data;
+	UINT32 length;
+	UINT32 offset;
+	UINT64 enqueueTime;
+};
+typedef struct rdp_channel_message rdpChannelMessage;
+
+struct rdp_channel_flow
+{
+	UINT64 key;
+	UINT16 channelId;
+	UINT32 dvcChannelId;
+	UINT32 priority;
+	UINT32 deficit;
+	BOOL closing;
+	wQueue* messages;
+	rdpChannelQueueMetrics metrics;
+};
+typedef struct rdp_channel_flow rdpChannelFlow;
+
+struct rdp_channel_scheduler
+{
+	rdpRdp* rdp;
+	HANDLE event;
+	CRITICAL_SECTION lock;
+
+	UINT32 flowCount;
+	UINT32 flowSize;
+	rdpChannelFlow** flows;
+	wHashTable* index;
+	wHashTable* busy;
+	UINT32 pending;
+};
+
+static rdpMcsChannel* freerdp_channel_find_by_id(rdpMcs* mcs, UINT16 channelId)
+{
+	UINT32 index;
+
+	for (index = 0; index < mcs->channelCount; index++)
+	{
+		if (mcs->channels[index].ChannelId == channelId)
+			return &mcs->channels[index];
+	}
+
+	return NULL;
+}
+
+static rdpMcsChannel* freerdp_channel_find_by_name(rdpMcs* mcs, const char* name)
+{
+	UINT32 index;
+
+	for (index = 0; index < mcs->channelCount; index++)
+	{
+		if (strncmp(mcs->channels[index].Name, name, sizeof(mcs->channels[index].Name)) == 0)
+			return &mcs->channels[index];
+	}
+
+	return NULL;
+}
+
+static BOOL freerdp_channel_send_chunk(rdpRdp* rdp, rdpMcsChannel* channel, const BYTE* data,
+                                       UINT32 totalLength, UINT32 offset, UINT32 chunkSize)
 {
-	DWORD i;
-	int left;
 	wStream* s;
-	UINT32 flags;
-	int chunkSize;
-	rdpMcs* mcs = rdp->mcs;
-	rdpMcsChannel* channel = NULL;
+	UINT32 flags = 0;
+
+	if (offset == 0)
+		flags |= CHANNEL_FLAG_FIRST;
+
+	if (offset + chunkSize >= totalLength)
+		flags |= CHANNEL_FLAG_LAST;
+
+	if ((channel->options & CHANNEL_OPTION_SHOW_PROTOCOL))
+		flags |= CHANNEL_FLAG_SHOW_PROTOCOL;
+
+	s = rdp_send_stream_init(rdp);
 
-	for (i = 0; i < mcs->channelCount; i++)
+	if (!s)
+		return FALSE;
+
+	Stream_Write_UINT32(s, totalLength);
+	Stream_Write_UINT32(s, flags);
+
+	if (!Stream_EnsureCapacity(s, chunkSize))
 	{
-		if (mcs->channels[i].ChannelId == channelId)
-		{
-			channel = &mcs->channels[i];
-			break;
-		}
+		Stream_Release(s);
+		return FALSE;
 	}
 
-	if (!channel)
+	Stream_Write(s, &data[offset], chunkSize);
+
+	if (!rdp_send(rdp, s, channel->ChannelId))
 	{
-		WLog_ERR(TAG,  "freerdp_channel_send: unknown channelId %"PRIu16"", channelId);
+		Stream_Release(s);
 		return FALSE;
 	}
 
-	flags = CHANNEL_FLAG_FIRST;
-	left = size;
+	return TRUE;
+}
+
+static UINT32 freerdp_channel_default_priority(const char* name)
+{
+	if ((strncmp(name, "rdpsnd", 8) == 0) || (strncmp(name, "audin", 8) == 0))
+		return FREERDP_CHANNEL_PRIORITY_AUDIO;
+
+	if (strncmp(name, "drdynvc", 8) == 0)
+		return FREERDP_CHANNEL_PRIORITY_GFX;
+
+	/* cliprdr, rdpdr and unknown channels, a plugin must not starve the others */
+	return FREERDP_CHANNEL_PRIORITY_BULK;
+}
+
+/**
+ * Messages on the drdynvc static channel carry exactly one dynamic channel PDU,
+ * so each dynamic channel gets its own flow and is scheduled fairly against the
+ * others while keeping per dynamic channel ordering.
+ */
+static UINT32 freerdp_channel_dvc_id(const BYTE* data, UINT32 length)
+{
+	BYTE cmd;
+	BYTE cbChId;
+
+	if (length < 1)
+		return CHANNEL_SCHEDULER_NO_DVC;
+
+	cmd = (data[0] & 0xF0) >> 4;
+	cbChId = data[0] & 0x03;
 
-	while (left > 0)
+	if (cmd == CAPABILITY_REQUEST_PDU)
+		return CHANNEL_SCHEDULER_NO_DVC;
+
+	switch (cbChId)
 	{
-		s = rdp_send_stream_init(rdp);
+		case 0:
+			return (length >= 2) ? data[1] : CHANNEL_SCHEDULER_NO_DVC;
 
-		if (!s)
-			return FALSE;
+		case 1:
+			return (length >= 3) ? (data[1] | (data[2] << 8)) : CHANNEL_SCHEDULER_NO_DVC;
 
-		if (left > (int) rdp->settings->VirtualChannelChunkSize)
-		{
-			chunkSize = rdp->settings->VirtualChannelChunkSize;
-		}
-		else
+		default:
+			return (length >= 5) ? (data[1] | (data[2] << 8) | (data[3] << 16) | ((UINT32) data[4] <<
+			                        24)) : CHANNEL_SCHEDULER_NO_DVC;
+	}
+}
+
+static void channel_message_free(void* obj)
+{
+	rdpChannelMessage* message = (rdpChannelMessage*) obj;
+
+	if (message)
+	{
+		free(message->data);
+		free(message);
+	}
+}
+
+static void channel_flow_free(rdpChannelFlow* flow)
+{
+	if (flow)
+	{
+		Queue_Free(flow->messages);
+		free(flow);
+	}
+}
+
+static UINT64 channel_flow_key(UINT16 channelId, UINT32 dvcChannelId)
+{
+	return ((UINT64) channelId << 32) | dvcChannelId;
+}
+
+static UINT32 channel_flow_key_hash(void* key)
+{
+	const UINT64 value = *((UINT64*) key);
+	return (UINT32)(value >> 32) * 31 + (UINT32) value;
+}
+
+static BOOL channel_flow_key_compare(void* key1, void* key2)
+{
+	return *((UINT64*) key1) == *((UINT64*) key2);
+}
+
+static rdpChannelFlow* channel_scheduler_get_flow(rdpChannelScheduler* scheduler,
+        rdpMcsChannel* channel, UINT32 dvcChannelId)
+{
+	UINT64 key;
+	rdpChannelFlow* flow;
+	rdpChannelFlow* parent;
+	key = channel_flow_key(channel->ChannelId, dvcChannelId);
+	flow = (rdpChannelFlow*) HashTable_GetItemValue(scheduler->index, &key);
+
+	if (flow)
+		return flow;
+
+	if (scheduler->flowCount >= scheduler->flowSize)
+	{
+		UINT32 size = scheduler->flowSize ? scheduler->flowSize * 2 : 8;
+		rdpChannelFlow** flows = (rdpChannelFlow**) realloc(scheduler->flows,
+		                         sizeof(rdpChannelFlow*) * size);
+
+		if (!flows)
+			return NULL;
+
+		scheduler->flows = flows;
+		scheduler->flowSize = size;
+	}
+
+	flow = (rdpChannelFlow*) calloc(1, sizeof(rdpChannelFlow));
+
+	if (!flow)
+		return NULL;
+
+	flow->messages = Queue_New(FALSE, -1, -1);
+
+	if (!flow->messages)
+	{
+		free(flow);
+		return NULL;
+	}
+
+	Queue_Object(flow->messages)->fnObjectFree = channel_message_free;
+	flow->key = key;
+	flow->channelId = channel->ChannelId;
+	flow->dvcChannelId = dvcChannelId;
+	flow->priority = freerdp_channel_default_priority(channel->Name);
+
+	/* dynamic channel flows inherit a priority override of their static channel */
+	if (dvcChannelId != CHANNEL_SCHEDULER_NO_DVC)
+	{
+		key = channel_flow_key(channel->ChannelId, CHANNEL_SCHEDULER_NO_DVC);
+		parent = (rdpChannelFlow*) HashTable_GetItemValue(scheduler->index, &key);
+
+		if (parent)
+			flow->priority = parent->priority;
+	}
+
+	if (HashTable_Add(scheduler->index, &flow->key, flow) < 0)
+	{
+		channel_flow_free(flow);
+		return NULL;
+	}
+
+	scheduler->flows[scheduler->flowCount++] = flow;
+	return flow;
+}
+
+/**
+ * Drops the flow of a dynamic channel once its close PDU went out, a dynamic
+ * channel id reused later on gets a fresh flow. The counters move to the flow
+ * of the static channel so the channel metrics do not go backwards.
+ */
+static void channel_scheduler_remove_flow(rdpChannelScheduler* scheduler, UINT32 index)
+{
+	rdpChannelFlow* parent = NULL;
+	rdpChannelFlow* flow = scheduler->flows[index];
+	rdpMcsChannel* channel = freerdp_channel_find_by_id(scheduler->rdp->mcs, flow->channelId);
+
+	if (channel)
+		parent = channel_scheduler_get_flow(scheduler, channel, CHANNEL_SCHEDULER_NO_DVC);
+
+	if (parent)
+	{
+		parent->metrics.sentMessages += flow->metrics.sentMessages;
+		parent->metrics.sentChunks += flow->metrics.sentChunks;
+		parent->metrics.sentBytes += flow->metrics.sentBytes;
+		parent->metrics.maxQueuedBytes = MAX(parent->metrics.maxQueuedBytes,
+		                                     flow->metrics.maxQueuedBytes);
+		parent->metrics.maxDelay = MAX(parent->metrics.maxDelay, flow->metrics.maxDelay);
+	}
+
+	HashTable_Remove(scheduler->index, &flow->key);
+	scheduler->pending -= Queue_Count(flow->messages);
+
+	if (HashTable_GetItemValue(scheduler->busy, (void*)(UINT_PTR) flow->channelId) == flow)
+		HashTable_Remove(scheduler->busy, (void*)(UINT_PTR) flow->channelId);
+
+	channel_flow_free(flow);
+	scheduler->flowCount--;
+	MoveMemory(&scheduler->flows[index], &scheduler->flows[index + 1],
+	           sizeof(rdpChannelFlow*) * (scheduler->flowCount - index));
+}
+
+static BOOL channel_scheduler_enqueue(rdpChannelScheduler* scheduler, rdpMcsChannel* channel,
+                                      const BYTE* data, UINT32 length)
+{
+	UINT32 dvcChannelId = CHANNEL_SCHEDULER_NO_DVC;
+	rdpChannelFlow* flow;
+	rdpChannelMessage* message;
+	message = (rdpChannelMessage*) calloc(1, sizeof(rdpChannelMessage));
+
+	if (!message)
+		return FALSE;
+
+	message->data = (BYTE*) malloc(length);
+
+	if (!message->data)
+	{
+		free(message);
+		return FALSE;
+	}
+
+	CopyMemory(message->data, data, length);
+	message->length = length;
+	message->enqueueTime = GetTickCount64();
+
+	if (strncmp(channel->Name, "drdynvc", sizeof(channel->Name)) == 0)
+		dvcChannelId = freerdp_channel_dvc_id(data, length);
+
+	EnterCriticalSection(&scheduler->lock);
+	flow = channel_scheduler_get_flow(scheduler, channel, dvcChannelId);
+
+	if (!flow || !Queue_Enqueue(flow->messages, message))
+	{
+		LeaveCriticalSection(&scheduler->lock);
+		channel_message_free(message);
+		return FALSE;
+	}
+
+	if (dvcChannelId != CHANNEL_SCHEDULER_NO_DVC)
+		flow->closing = (((data[0] & 0xF0) >> 4) == CLOSE_REQUEST_PDU);
+
+	flow->metrics.queuedMessages++;
+	flow->metrics.queuedBytes += length;
+
+	if (flow->metrics.queuedBytes > flow->metrics.maxQueuedBytes)
+		flow->metrics.maxQueuedBytes = flow->metrics.queuedBytes;
+
+	scheduler->pending++;
+	SetEvent(scheduler->event);
+	LeaveCriticalSection(&scheduler->lock);
+	return TRUE;
+}
+
+/**
+ * Chunks of different messages must not interleave on one static channel,
+ * the receiver reassembles them per static channel. The busy table maps a
+ * static channel to the flow with a partially sent message.
+ */
+static BOOL channel_scheduler_channel_locked(rdpChannelScheduler* scheduler, rdpChannelFlow* flow)
+{
+	rdpChannelFlow* owner;
+	owner = (rdpChannelFlow*) HashTable_GetItemValue(scheduler->busy,
+	        (void*)(UINT_PTR) flow->channelId);
+	return owner && (owner != flow);
+}
+
+static BOOL channel_scheduler_service_flow(rdpChannelScheduler* scheduler, rdpChannelFlow* flow)
+{
+	UINT32 chunkSize;
+	UINT64 delay;
+	rdpMcsChannel* channel;
+	rdpChannelMessage* message;
+	rdpRdp* rdp = scheduler->rdp;
+	UINT32 maxChunkSize = rdp->settings->VirtualChannelChunkSize;
+	channel = freerdp_channel_find_by_id(rdp->mcs, flow->channelId);
+
+	if (!channel)
+		return FALSE;
+
+	/* a flow with nothing sendable earns no deficit, it would burst once unblocked */
+	message = (rdpChannelMessage*) Queue_Peek(flow->messages);
+
+	if (message && (message->offset == 0) && channel_scheduler_channel_locked(scheduler, flow))
+	{
+		flow->deficit = 0;
+		return TRUE;
+	}
+
+	flow->deficit += CHANNEL_SCHEDULER_WEIGHTS[flow->priority] * CHANNEL_SCHEDULER_QUANTUM;
+
+	while ((message = (rdpChannelMessage*) Queue_Peek(flow->messages)))
+	{
+		if ((message->offset == 0) && channel_scheduler_channel_locked(scheduler, flow))
 		{
-			chunkSize = left;
-			flags |= CHANNEL_FLAG_LAST;
+			flow->deficit = 0;
+			break;
 		}
 
-		if ((channel->options & CHANNEL_OPTION_SHOW_PROTOCOL))
+		chunkSize = message->length - message->offset;
+
+		if (chunkSize > maxChunkSize)
+			chunkSize = maxChunkSize;
+
+		if (chunkSize > flow->deficit)
+			break;
+
+		if (!freerdp_channel_send_chunk(rdp, channel, message->data, message->length,
+		                                message->offset, chunkSize))
+			return FALSE;
+
+		if ((message->offset == 0) && (chunkSize < message->length))
+			HashTable_Add(scheduler->busy, (void*)(UINT_PTR) flow->channelId, flow);
+
+		message->offset += chunkSize;
+		flow->deficit -= chunkSize;
+		flow->metrics.queuedBytes -= chunkSize;
+		flow->metrics.sentBytes += chunkSize;
+		flow->metrics.sentChunks++;
+		freerdp_metric_add(FREERDP_METRIC_CHANNEL_SENT, chunkSize);
+
+		if (message->offset >= message->length)
 		{
-			flags |= CHANNEL_FLAG_SHOW_PROTOCOL;
+			delay = GetTickCount64() - message->enqueueTime;
+			freerdp_metric_record(FREERDP_METRIC_CHANNEL_QUEUE_DELAY, delay);
+
+			if (delay > flow->metrics.maxDelay)
+				flow->metrics.maxDelay = (UINT32) delay;
+
+			flow->metrics.queuedMessages--;
+			flow->metrics.sentMessages++;
+			scheduler->pending--;
+			HashTable_Remove(scheduler->busy, (void*)(UINT_PTR) flow->channelId);
+			Queue_Dequeue(flow->messages);
+			channel_message_free(message);
 		}
+	}
+
+	if (Queue_Count(flow->messages) < 1)
+		flow->deficit = 0;
+
+	return TRUE;
+}
+
+rdpChannelScheduler* channel_scheduler_new(rdpRdp* rdp)
+{
+	rdpChannelScheduler* scheduler;
+	scheduler = (rdpChannelScheduler*) calloc(1, sizeof(rdpChannelScheduler));
+
+	if (!scheduler)
+		return NULL;
 
-		Stream_Write_UINT32(s, size);
-		Stream_Write_UINT32(s, flags);
+	scheduler->rdp = rdp;
+	scheduler->event = CreateEvent(NULL, TRUE, FALSE, NULL);
 
-		if (!Stream_EnsureCapacity(s, chunkSize))
+	if (!scheduler->event)
+	{
+		free(scheduler);
+		return NULL;
+	}
+
+	scheduler->index = HashTable_New(FALSE);
+	scheduler->busy = HashTable_New(FALSE);
+
+	if (!scheduler->index || !scheduler->busy)
+		goto fail_tables;
+
+	scheduler->index->hash = channel_flow_key_hash;
+	scheduler->index->keyCompare = channel_flow_key_compare;
+
+	if (!InitializeCriticalSectionAndSpinCount(&scheduler->lock, 4000))
+		goto fail_tables;
+
+	return scheduler;
+fail_tables:
+	HashTable_Free(scheduler->index);
+	HashTable_Free(scheduler->busy);
+	CloseHandle(scheduler->event);
+	free(scheduler);
+	return NULL;
+}
+
+void channel_scheduler_reset(rdpChannelScheduler* scheduler)
+{
+	UINT32 index;
+
+	if (!scheduler)
+		return;
+
+	EnterCriticalSection(&scheduler->lock);
+
+	for (index = 0; index < scheduler->flowCount; index++)
+		channel_flow_free(scheduler->flows[index]);
+
+	HashTable_Clear(scheduler->index);
+	HashTable_Clear(scheduler->busy);
+	scheduler->flowCount = 0;
+	scheduler->pending = 0;
+	ResetEvent(scheduler->event);
+	LeaveCriticalSection(&scheduler->lock);
+}
+
+void channel_scheduler_free(rdpChannelScheduler* scheduler)
+{
+	if (!scheduler)
+		return;
+
+	channel_scheduler_reset(scheduler);
+	HashTable_Free(scheduler->index);
+	HashTable_Free(scheduler->busy);
+	free(scheduler->flows);
+	DeleteCriticalSection(&scheduler->lock);
+	CloseHandle(scheduler->event);
+	free(scheduler);
+}
+
+HANDLE channel_scheduler_get_event_handle(rdpChannelScheduler* scheduler)
+{
+	return scheduler->event;
+}
+
+UINT32 channel_scheduler_get_flow_count(rdpChannelScheduler* scheduler)
+{
+	UINT32 count;
+	EnterCriticalSection(&scheduler->lock);
+	count = scheduler->flowCount;
+	LeaveCriticalSection(&scheduler->lock);
+	return count;
+}
+
+/**
+ * Runs one deficit round robin round over all flows, higher priority classes
+ * first. Data left over is sent on the next call, the event handle stays
+ * signaled until all queues are empty.
+ */
+BOOL channel_scheduler_check(rdpChannelScheduler* scheduler)
+{
+	UINT32 index;
+	UINT32 priority;
+	BOOL status = TRUE;
+
+	if (!scheduler)
+		return FALSE;
+
+	EnterCriticalSection(&scheduler->lock);
+
+	for (priority = 0; status && (priority < FREERDP_CHANNEL_PRIORITY_COUNT); priority++)
+	{
+		for (index = 0; index < scheduler->flowCount; index++)
 		{
-			Stream_Release(s);
-			return FALSE;
+			rdpChannelFlow* flow = scheduler->flows[index];
+
+			if ((flow->priority != priority) || (Queue_Count(flow->messages) < 1))
+				continue;
+
+			if (!channel_scheduler_service_flow(scheduler, flow))
+			{
+				status = FALSE;
+				break;
+			}
 		}
+	}
 
-		Stream_Write(s, data, chunkSize);
+	for (index = 0; index < scheduler->flowCount;)
+	{
+		rdpChannelFlow* flow = scheduler->flows[index];
 
-		if (!rdp_send(rdp, s, channelId))
-		{
-			Stream_Release(s);
+		if (flow->closing && (Queue_Count(flow->messages) < 1))
+			channel_scheduler_remove_flow(scheduler, index);
+		else
+			index++;
+	}
+
+	if (scheduler->pending == 0)
+		ResetEvent(scheduler->event);
+
+	LeaveCriticalSection(&scheduler->lock);
+	return status;
+}
+
+/**
+ * Sends everything still queued, used before the transport is torn down so
+ * that data accepted by freerdp_channel_send is not silently dropped.
+ */
+BOOL channel_scheduler_flush(rdpChannelScheduler* scheduler)
+{
+	BOOL status = TRUE;
+
+	if (!scheduler)
+		return FALSE;
+
+	EnterCriticalSection(&scheduler->lock);
+
+	while (status && (scheduler->pending > 0))
+		status = channel_scheduler_check(scheduler);
+
+	LeaveCriticalSection(&scheduler->lock);
+	return status;
+}
+
+BOOL freerdp_channel_send(rdpRdp* rdp, UINT16 channelId, BYTE* data, int size)
+{
+	UINT32 offset;
+	UINT32 chunkSize;
+	rdpMcsChannel* channel;
+	channel = freerdp_channel_find_by_id(rdp->mcs, channelId);
+
+	if (!channel)
+	{
+		WLog_ERR(TAG,  "freerdp_channel_send: unknown channelId %"PRIu16"", channelId);
+		return FALSE;
+	}
+
+	if (size <= 0)
+		return TRUE;
+
+	if (rdp->settings->VirtualChannelScheduling && rdp->channelScheduler)
+		return channel_scheduler_enqueue(rdp->channelScheduler, channel, data, (UINT32) size);
+
+	for (offset = 0; offset < (UINT32) size; offset += chunkSize)
+	{
+		chunkSize = size - offset;
+
+		if (chunkSize > rdp->settings->VirtualChannelChunkSize)
+			chunkSize = rdp->settings->VirtualChannelChunkSize;
+
+		if (!freerdp_channel_send_chunk(rdp, channel, data, size, offset, chunkSize))
 			return FALSE;
-		}
+	}
+
+	return TRUE;
+}
+
+BOOL freerdp_channel_set_priority(rdpContext* context, const char* name, UINT32 priority)
+{
+	UINT32 index;
+	rdpMcsChannel* channel;
+	rdpChannelFlow* flow;
+	rdpChannelScheduler* scheduler;
 
-		data += chunkSize;
-		left -= chunkSize;
-		flags = 0;
+	if (!context || !context->rdp || !name || (priority >= FREERDP_CHANNEL_PRIORITY_COUNT))
+		return FALSE;
+
+	scheduler = context->rdp->channelScheduler;
+	channel = freerdp_channel_find_by_name(context->rdp->mcs, name);
+
+	if (!scheduler || !channel)
+		return FALSE;
+
+	EnterCriticalSection(&scheduler->lock);
+	flow = channel_scheduler_get_flow(scheduler, channel, CHANNEL_SCHEDULER_NO_DVC);
+
+	for (index = 0; index < scheduler->flowCount; index++)
+	{
+		if (scheduler->flows[index]->channelId == channel->ChannelId)
+			scheduler->flows[index]->priority = priority;
 	}
 
+	LeaveCriticalSection(&scheduler->lock);
+	return flow != NULL;
+}
+
+BOOL freerdp_channel_get_queue_metrics(rdpContext* context, const char* name,
+                                       rdpChannelQueueMetrics* metrics)
+{
+	UINT64 key;
+	UINT32 index;
+	rdpMcsChannel* channel;
+	rdpChannelFlow* parent;
+	rdpChannelScheduler* scheduler;
+
+	if (!context || !context->rdp || !name || !metrics)
+		return FALSE;
+
+	scheduler = context->rdp->channelScheduler;
+	channel = freerdp_channel_find_by_name(context->rdp->mcs, name);
+
+	if (!scheduler || !channel)
+		return FALSE;
+
+	ZeroMemory(metrics, sizeof(rdpChannelQueueMetrics));
+	metrics->priority = freerdp_channel_default_priority(channel->Name);
+	EnterCriticalSection(&scheduler->lock);
+
+	for (index = 0; index < scheduler->flowCount; index++)
+	{
+		rdpChannelFlow* flow = scheduler->flows[index];
+
+		if (flow->channelId != channel->ChannelId)
+			continue;
+
+		metrics->priority = flow->priority;
+		metrics->queuedMessages += flow->metrics.queuedMessages;
+		metrics->queuedBytes += flow->metrics.queuedBytes;
+		metrics->sentMessages += flow->metrics.sentMessages;
+		metrics->sentChunks += flow->metrics.sentChunks;
+		metrics->sentBytes += flow->metrics.sentBytes;
+
+		if (flow->metrics.maxQueuedBytes > metrics->maxQueuedBytes)
+			metrics->maxQueuedBytes = flow->metrics.maxQueuedBytes;
+
+		if (flow->metrics.maxDelay > metrics->maxDelay)
+			metrics->maxDelay = flow->metrics.maxDelay;
+	}
+
+	/* the flow of the static channel holds the priority, dynamic flows inherit it */
+	key = channel_flow_key(channel->ChannelId, CHANNEL_SCHEDULER_NO_DVC);
+	parent = (rdpChannelFlow*) HashTable_GetItemValue(scheduler->index, &key);
+
+	if (parent)
+		metrics->priority = parent->priority;
+
+	LeaveCriticalSection(&scheduler->lock);
 	return TRUE;
 }
 
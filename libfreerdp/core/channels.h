@@ -23,6 +23,16 @@
 #include <freerdp/api.h>
 #include "client.h"
 
+typedef struct rdp_channel_scheduler rdpChannelScheduler;
+
+FREERDP_LOCAL rdpChannelScheduler* channel_scheduler_new(rdpRdp* rdp);
+FREERDP_LOCAL void channel_scheduler_reset(rdpChannelScheduler* scheduler);
+FREERDP_LOCAL void channel_scheduler_free(rdpChannelScheduler* scheduler);
+FREERDP_LOCAL HANDLE channel_scheduler_get_event_handle(rdpChannelScheduler* scheduler);
+FREERDP_LOCAL UINT32 channel_scheduler_get_flow_count(rdpChannelScheduler* scheduler);
+FREERDP_LOCAL BOOL channel_scheduler_check(rdpChannelScheduler* scheduler);
+FREERDP_LOCAL BOOL channel_scheduler_flush(rdpChannelScheduler* scheduler);
+
 FREERDP_LOCAL BOOL freerdp_channel_send(rdpRdp* rdp, UINT16 channelId,
                                         BYTE* data, int size);
 FREERDP_LOCAL BOOL freerdp_channel_process(freerdp* instance, wStream* s,
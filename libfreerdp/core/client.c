@@ -34,6 +34,18 @@
 static WINPR_TLS void* g_pInterface = NULL;
 static WINPR_TLS rdpChannels* g_channels = NULL; /* use only for VirtualChannelInit hack */
 
+/* reassembly buffers of the channel messages, shared by all instances */
+static wStreamPool* g_ChannelDataPool = NULL;
+static INIT_ONCE g_ChannelDataPoolOnce = INIT_ONCE_STATIC_INIT;
+
+/* A message handed over in place, it holds a reference on the receive buffer */
+struct _CHANNEL_DATA_SLICE
+{
+	wStream s;
+	wStream* parent;
+};
+typedef struct _CHANNEL_DATA_SLICE CHANNEL_DATA_SLICE;
+
 static volatile LONG g_OpenHandleSeq =
     1; /* use global counter to ensure uniqueness across channel manager instances */
 static WINPR_TLS rdpChannelHandles g_ChannelHandles = { NULL, NULL };
@@ -412,6 +424,155 @@ fail:
 	return error;
 }
 
+static BOOL CALLBACK freerdp_channels_init_data_pool(PINIT_ONCE once, PVOID param,
+        PVOID* context)
+{
+	g_ChannelDataPool = StreamPool_New(TRUE, CHANNEL_CHUNK_LENGTH);
+	return g_ChannelDataPool != NULL;
+}
+
+static wStream* freerdp_channels_data_take(size_t size)
+{
+	wStream* s;
+
+	if (!InitOnceExecuteOnce(&g_ChannelDataPoolOnce, freerdp_channels_init_data_pool, NULL, NULL))
+		return NULL;
+
+	if (!(s = StreamPool_Take(g_ChannelDataPool, size)))
+		return NULL;
+
+	Stream_SetLength(s, size);
+	return s;
+}
+
+/**
+ * The chunks are passed to the plugins while the transport still holds the
+ * pooled stream they were received in, a message of a single chunk is kept
+ * there instead of being copied.
+ */
+static wStream* freerdp_channels_data_slice(rdpContext* context, const BYTE* data,
+        UINT32 length)
+{
+	wStream* parent;
+	CHANNEL_DATA_SLICE* slice;
+	rdpTransport* transport;
+
+	if (!context || !context->rdp || !(transport = context->rdp->transport))
+		return NULL;
+
+	if (!(parent = StreamPool_Find(transport->ReceivePool, (BYTE*) data)))
+		return NULL;
+
+	if (data + length > Stream_Buffer(parent) + Stream_Capacity(parent))
+		return NULL;
+
+	if (!(slice = (CHANNEL_DATA_SLICE*) calloc(1, sizeof(CHANNEL_DATA_SLICE))))
+		return NULL;
+
+	Stream_AddRef(parent);
+	slice->parent = parent;
+	slice->s.buffer = (BYTE*) data;
+	slice->s.pointer = (BYTE*) data;
+	slice->s.length = length;
+	slice->s.capacity = length;
+	return &slice->s;
+}
+
+/**
+ * Reassembles the chunks of a static channel message for the plugins.
+ * data_in keeps the partial message between the calls, once the last chunk
+ * arrived message is set to the complete message, positioned at its start.
+ * Messages are released with freerdp_channels_data_free().
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+UINT freerdp_channels_data_received(rdpContext* context, wStream** data_in, const void* pData,
+                                    UINT32 dataLength, UINT32 totalLength, UINT32 dataFlags,
+                                    wStream** message)
+{
+	wStream* s;
+	*message = NULL;
+
+	if ((dataFlags & CHANNEL_FLAG_SUSPEND) || (dataFlags & CHANNEL_FLAG_RESUME))
+		return CHANNEL_RC_OK;
+
+	if (dataFlags & CHANNEL_FLAG_FIRST)
+	{
+		freerdp_channels_data_free(*data_in);
+		*data_in = NULL;
+
+		if (dataFlags & CHANNEL_FLAG_LAST)
+		{
+			if (dataLength != totalLength)
+			{
+				WLog_ERR(TAG, "channel message of %"PRIu32" bytes declared %"PRIu32"", dataLength,
+				         totalLength);
+				return ERROR_INVALID_DATA;
+			}
+
+			if ((*message = freerdp_channels_data_slice(context, (const BYTE*) pData, dataLength)))
+				return CHANNEL_RC_OK;
+		}
+
+		if (!(*data_in = freerdp_channels_data_take(totalLength)))
+		{
+			WLog_ERR(TAG, "StreamPool_Take failed!");
+			return CHANNEL_RC_NO_MEMORY;
+		}
+	}
+
+	if (!(s = *data_in))
+	{
+		WLog_ERR(TAG, "channel chunk without a first chunk");
+		return ERROR_INVALID_DATA;
+	}
+
+	if (Stream_GetRemainingLength(s) < dataLength)
+	{
+		WLog_ERR(TAG, "channel chunk exceeds the declared length");
+		freerdp_channels_data_free(s);
+		*data_in = NULL;
+		return ERROR_INVALID_DATA;
+	}
+
+	Stream_Write(s, pData, dataLength);
+
+	if (dataFlags & CHANNEL_FLAG_LAST)
+	{
+		*data_in = NULL;
+
+		if (Stream_GetRemainingLength(s) != 0)
+		{
+			WLog_ERR(TAG, "channel message is shorter than declared");
+			freerdp_channels_data_free(s);
+			return ERROR_INTERNAL_ERROR;
+		}
+
+		Stream_SetPosition(s, 0);
+		*message = s;
+	}
+
+	return CHANNEL_RC_OK;
+}
+
+void freerdp_channels_data_free(wStream* s)
+{
+	CHANNEL_DATA_SLICE* slice;
+
+	if (!s)
+		return;
+
+	if (s->pool)
+	{
+		Stream_Release(s);
+		return;
+	}
+
+	slice = (CHANNEL_DATA_SLICE*) s;
+	Stream_Release(slice->parent);
+	free(slice);
+}
+
 int freerdp_channels_data(freerdp* instance, UINT16 channelId, BYTE* data,
                           int dataSize, int flags, int totalSize)
 {
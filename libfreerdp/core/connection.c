@@ -257,7 +257,15 @@ BOOL rdp_client_connect(rdpRdp* rdp)
 
 	rdp_client_transition_to_state(rdp, CONNECTION_STATE_NEGO);
 
-	if (!nego_connect(rdp->nego))
+	if (settings->PlaySession)
+	{
+		if (!session_player_connect(rdp))
+		{
+			freerdp_set_last_error(rdp->context, FREERDP_ERROR_CONNECT_TRANSPORT_FAILED);
+			return FALSE;
+		}
+	}
+	else if (!nego_connect(rdp->nego))
 	{
 		if (!freerdp_get_last_error(rdp->context))
 			freerdp_set_last_error(rdp->context, FREERDP_ERROR_SECURITY_NEGO_CONNECT_FAILED);
@@ -273,6 +281,10 @@ BOOL rdp_client_connect(rdpRdp* rdp)
 			settings->AutoLogonEnabled = TRUE;
 	}
 
+	/* only the first connection is recorded, a replay can't follow a reconnect */
+	if (settings->RecordSession && !rdp->recorder && !settings->PlaySession)
+		rdp->recorder = session_recorder_new(settings->RecordSessionFile);
+
 	/* everything beyond this point is event-driven and non blocking */
 
 	rdp->transport->ReceiveCallback = rdp_recv_callback;
@@ -302,8 +314,12 @@ BOOL rdp_client_disconnect(rdpRdp* rdp)
 {
 	BOOL status;
 
+	if (!channel_scheduler_flush(rdp->channelScheduler))
+		WLog_WARN(TAG, "failed to send queued channel data before disconnect");
+
 	status = nego_disconnect(rdp->nego);
 
+	session_recorder_stop(rdp->recorder);
 	rdp_reset(rdp);
 
 	rdp_client_transition_to_state(rdp, CONNECTION_STATE_INITIAL);
@@ -295,6 +295,15 @@ BOOL freerdp_get_fds(freerdp* instance, void** rfds, int* rcount, void** wfds,
 {
 	rdpRdp* rdp = instance->context->rdp;
 	transport_get_fds(rdp->transport, rfds, rcount);
+
+	/* queued channel writes are sent by freerdp_check_fds */
+	if (rdp->settings->VirtualChannelScheduling)
+	{
+		HANDLE event = channel_scheduler_get_event_handle(rdp->channelScheduler);
+		rfds[*rcount] = GetEventWaitObject(event);
+		(*rcount)++;
+	}
+
 	return TRUE;
 }
 
@@ -356,6 +365,14 @@ DWORD freerdp_get_event_handles(rdpContext* context, HANDLE* events,
 		                       context->instance, FREERDP_INPUT_MESSAGE_QUEUE);
 	}
 
+	if (context->settings->VirtualChannelScheduling)
+	{
+		if (nCount >= count)
+			return 0;
+
+		events[nCount++] = channel_scheduler_get_event_handle(context->rdp->channelScheduler);
+	}
+
 	return nCount;
 }
 
@@ -952,6 +969,16 @@ ULONG freerdp_get_transport_sent(rdpContext* context, BOOL resetCount)
 	return written;
 }
 
+ULONG freerdp_get_transport_received(rdpContext* context, BOOL resetCount)
+{
+	ULONG received = context->rdp->transport->received;
+
+	if (resetCount)
+		context->rdp->transport->received = 0;
+
+	return received;
+}
+
 HANDLE getChannelErrorEventHandle(rdpContext* context)
 {
 	return context->channelErrorEvent;
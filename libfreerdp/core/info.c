@@ -100,6 +100,8 @@ static BOOL rdp_read_server_auto_reconnect_cookie(rdpRdp* rdp, wStream* s, logon
 	Stream_Read_UINT32(s, autoReconnectCookie->version); /* Version (4 bytes) */
 	Stream_Read_UINT32(s, autoReconnectCookie->logonId); /* LogonId (4 bytes) */
 	Stream_Read(s, autoReconnectCookie->arcRandomBits, 16); /* ArcRandomBits (16 bytes) */
+	/* the cookie lets anybody holding it reconnect to the session */
+	session_recorder_redact(rdp->recorder, Stream_Pointer(s) - 16, 16);
 	p = autoReconnectCookie->arcRandomBits;
 	WLog_DBG(TAG, "ServerAutoReconnectCookie: Version: %"PRIu32" LogonId: %"PRIu32" SecurityVerifier: "
 	         "%02"PRIX8"%02"PRIX8"%02"PRIX8"%02"PRIX8"%02"PRIX8"%02"PRIX8"%02"PRIX8"%02"PRIX8""
@@ -39,24 +39,250 @@
 #define TAG FREERDP_TAG("core.message")
 #define WITH_STREAM_POOL	1
 
+/**
+ * Frame arena
+ *
+ * The parameters of the update, order and cache messages queued between
+ * BeginPaint and EndPaint are bump allocated from a per frame arena instead
+ * of being malloc'ed one by one. The arena travels with the EndPaint message
+ * and is recycled as a whole once that message has been freed, which happens
+ * after every other message of the frame has been processed.
+ * Allocations which do not fit are chained as separate blocks, the arena is
+ * then grown on recycling so that the next frame of that size fits.
+ */
+
+#define UPDATE_ARENA_ALIGN(_size)	(((_size) + 15) & ~((size_t) 15))
+#define UPDATE_ARENA_SIZE		0x10000
+#define UPDATE_ARENA_MAX_SIZE		0x400000
+#define UPDATE_ARENA_MAX_FREE		8
+
+/**
+ * Set in the id of messages whose parameters live in the frame arena.
+ * GetMessageClass and GetMessageType ignore the bit.
+ */
+#define UPDATE_MESSAGE_ARENA		0x01000000
+
+typedef struct _UPDATE_ARENA_BLOCK UPDATE_ARENA_BLOCK;
+
+struct _UPDATE_ARENA_BLOCK
+{
+	UPDATE_ARENA_BLOCK* next;
+	size_t size;
+};
+
+struct rdp_update_arena
+{
+	BYTE* buffer;
+	size_t size;
+	size_t used;
+	size_t overflowSize;
+	UPDATE_ARENA_BLOCK* overflow;
+	rdpUpdateArena* next;
+};
+
+static rdpUpdateArena* update_arena_new(size_t size)
+{
+	rdpUpdateArena* arena = (rdpUpdateArena*) calloc(1, sizeof(rdpUpdateArena));
+
+	if (!arena)
+		return NULL;
+
+	arena->buffer = (BYTE*) _aligned_malloc(size, 16);
+
+	if (!arena->buffer)
+	{
+		free(arena);
+		return NULL;
+	}
+
+	arena->size = size;
+	return arena;
+}
+
+static void update_arena_free_overflow(rdpUpdateArena* arena)
+{
+	while (arena->overflow)
+	{
+		UPDATE_ARENA_BLOCK* block = arena->overflow;
+		arena->overflow = block->next;
+		_aligned_free(block);
+	}
+
+	arena->overflowSize = 0;
+}
+
+static void update_arena_free(rdpUpdateArena* arena)
+{
+	if (!arena)
+		return;
+
+	update_arena_free_overflow(arena);
+	_aligned_free(arena->buffer);
+	free(arena);
+}
+
+static void* update_arena_alloc(rdpUpdateArena* arena, size_t size)
+{
+	BYTE* ptr;
+	UPDATE_ARENA_BLOCK* block;
+	size = UPDATE_ARENA_ALIGN(size ? size : 1);
+
+	if (size <= arena->size - arena->used)
+	{
+		ptr = &arena->buffer[arena->used];
+		arena->used += size;
+		return ptr;
+	}
+
+	block = (UPDATE_ARENA_BLOCK*) _aligned_malloc(UPDATE_ARENA_ALIGN(sizeof(UPDATE_ARENA_BLOCK)) + size,
+	        16);
+
+	if (!block)
+		return NULL;
+
+	block->size = size;
+	block->next = arena->overflow;
+	arena->overflow = block;
+	arena->overflowSize += size;
+	return ((BYTE*) block) + UPDATE_ARENA_ALIGN(sizeof(UPDATE_ARENA_BLOCK));
+}
+
+static void update_arena_reset(rdpUpdateArena* arena)
+{
+	size_t size = arena->used + arena->overflowSize;
+	update_arena_free_overflow(arena);
+	arena->used = 0;
+
+	if ((size > arena->size) && (size <= UPDATE_ARENA_MAX_SIZE))
+	{
+		BYTE* buffer = (BYTE*) _aligned_realloc(arena->buffer, size, 16);
+
+		if (buffer)
+		{
+			arena->buffer = buffer;
+			arena->size = size;
+		}
+	}
+}
+
+static rdpUpdateArena* update_message_arena_take(rdpUpdateProxy* proxy)
+{
+	rdpUpdateArena* arena;
+	EnterCriticalSection(&proxy->arenaLock);
+	arena = proxy->freeArenas;
+
+	if (arena)
+	{
+		proxy->freeArenas = arena->next;
+		proxy->freeArenaCount--;
+		arena->next = NULL;
+	}
+
+	LeaveCriticalSection(&proxy->arenaLock);
+
+	if (!arena)
+		arena = update_arena_new(UPDATE_ARENA_SIZE);
+
+	return arena;
+}
+
+static void update_message_arena_recycle(rdpUpdateProxy* proxy, rdpUpdateArena* arena)
+{
+	if (!arena)
+		return;
+
+	update_arena_reset(arena);
+	EnterCriticalSection(&proxy->arenaLock);
+
+	if (proxy->freeArenaCount < UPDATE_ARENA_MAX_FREE)
+	{
+		arena->next = proxy->freeArenas;
+		proxy->freeArenas = arena;
+		proxy->freeArenaCount++;
+		arena = NULL;
+	}
+
+	LeaveCriticalSection(&proxy->arenaLock);
+	update_arena_free(arena);
+}
+
+static void* update_message_alloc(rdpContext* context, size_t size)
+{
+	rdpUpdateProxy* proxy = context->update->proxy;
+
+	if (proxy && proxy->arena)
+		return update_arena_alloc(proxy->arena, size);
+
+	return malloc(size);
+}
+
+/* Releases parameters that could not be posted */
+static void update_message_discard(rdpContext* context, void* ptr)
+{
+	rdpUpdateProxy* proxy = context->update->proxy;
+
+	if (!proxy || !proxy->arena)
+		free(ptr);
+}
+
+static void update_message_free_param(wMessage* msg, void* ptr)
+{
+	if (!(msg->id & UPDATE_MESSAGE_ARENA))
+		free(ptr);
+}
+
+static BOOL update_message_post(rdpContext* context, UINT32 id, void* wParam, void* lParam)
+{
+	wMessage message;
+	rdpUpdateProxy* proxy = context->update->proxy;
+	message.id = (proxy && proxy->arena) ? (id | UPDATE_MESSAGE_ARENA) : id;
+	message.context = (void*) context;
+	message.wParam = wParam;
+	message.lParam = lParam;
+	message.time = 0;
+	message.Free = NULL;
+	return MessageQueue_Dispatch(context->update->queue, &message);
+}
+
 /* Update */
 
 static BOOL update_message_BeginPaint(rdpContext* context)
 {
-	if (!context || !context->update)
+	rdpUpdateProxy* proxy;
+
+	if (!context || !context->update || !context->update->proxy)
 		return FALSE;
 
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, BeginPaint), NULL, NULL);
+	proxy = context->update->proxy;
+
+	/* without an arena the parameters of this frame are simply malloc'ed */
+	if (!proxy->arena)
+		proxy->arena = update_message_arena_take(proxy);
+
+	return update_message_post(context, MakeMessageId(Update, BeginPaint),
+	                           NULL, NULL);
 }
 
 static BOOL update_message_EndPaint(rdpContext* context)
 {
-	if (!context || !context->update)
+	rdpUpdateProxy* proxy;
+	rdpUpdateArena* arena;
+
+	if (!context || !context->update || !context->update->proxy)
 		return FALSE;
 
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, EndPaint), NULL, NULL);
+	proxy = context->update->proxy;
+	arena = proxy->arena;
+	proxy->arena = NULL;
+
+	if (!update_message_post(context, MakeMessageId(Update, EndPaint),
+	                         (void*) arena, NULL))
+	{
+		proxy->arena = arena;
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 static BOOL update_message_SetBounds(rdpContext* context,
@@ -69,7 +295,7 @@ static BOOL update_message_SetBounds(rdpContext* context,
 
 	if (bounds)
 	{
-		wParam = (rdpBounds*) malloc(sizeof(rdpBounds));
+		wParam = (rdpBounds*) update_message_alloc(context, sizeof(rdpBounds));
 
 		if (!wParam)
 			return FALSE;
@@ -77,8 +303,8 @@ static BOOL update_message_SetBounds(rdpContext* context,
 		CopyMemory(wParam, bounds, sizeof(rdpBounds));
 	}
 
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, SetBounds), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(Update, SetBounds),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_Synchronize(rdpContext* context)
@@ -86,8 +312,8 @@ static BOOL update_message_Synchronize(rdpContext* context)
 	if (!context || !context->update)
 		return FALSE;
 
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, Synchronize), NULL, NULL);
+	return update_message_post(context, MakeMessageId(Update, Synchronize),
+	                           NULL, NULL);
 }
 
 static BOOL update_message_DesktopResize(rdpContext* context)
@@ -95,8 +321,8 @@ static BOOL update_message_DesktopResize(rdpContext* context)
 	if (!context || !context->update)
 		return FALSE;
 
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, DesktopResize), NULL, NULL);
+	return update_message_post(context, MakeMessageId(Update, DesktopResize),
+	                           NULL, NULL);
 }
 
 static BOOL update_message_BitmapUpdate(rdpContext* context,
@@ -108,18 +334,18 @@ static BOOL update_message_BitmapUpdate(rdpContext* context,
 	if (!context || !context->update || !bitmap)
 		return FALSE;
 
-	wParam = (BITMAP_UPDATE*) malloc(sizeof(BITMAP_UPDATE));
+	wParam = (BITMAP_UPDATE*) update_message_alloc(context, sizeof(BITMAP_UPDATE));
 
 	if (!wParam)
 		return FALSE;
 
 	wParam->number = bitmap->number;
 	wParam->count = wParam->number;
-	wParam->rectangles = (BITMAP_DATA*) malloc(sizeof(BITMAP_DATA) * wParam->number);
+	wParam->rectangles = (BITMAP_DATA*) update_message_alloc(context, sizeof(BITMAP_DATA) * wParam->number);
 
 	if (!wParam->rectangles)
 	{
-		free(wParam);
+		update_message_discard(context, wParam);
 		return FALSE;
 	}
 
@@ -130,15 +356,15 @@ static BOOL update_message_BitmapUpdate(rdpContext* context,
 #ifdef WITH_STREAM_POOL
 		StreamPool_AddRef(context->rdp->transport->ReceivePool, bitmap->rectangles[index].bitmapDataStream);
 #else
-		wParam->rectangles[index].bitmapDataStream = (BYTE*) malloc(wParam->rectangles[index].bitmapLength);
+		wParam->rectangles[index].bitmapDataStream = (BYTE*) update_message_alloc(context, wParam->rectangles[index].bitmapLength);
 
 		if (!wParam->rectangles[index].bitmapDataStream)
 		{
 			while (index)
-				free(wParam->rectangles[--index].bitmapDataStream);
+				update_message_discard(context, wParam->rectangles[--index].bitmapDataStream);
 
-			free(wParam->rectangles);
-			free(wParam);
+			update_message_discard(context, wParam->rectangles);
+			update_message_discard(context, wParam);
 			return FALSE;
 		}
 
@@ -147,8 +373,8 @@ static BOOL update_message_BitmapUpdate(rdpContext* context,
 #endif
 	}
 
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, BitmapUpdate), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(Update, BitmapUpdate),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_Palette(rdpContext* context,
@@ -159,14 +385,14 @@ static BOOL update_message_Palette(rdpContext* context,
 	if (!context || !context->update || !palette)
 		return FALSE;
 
-	wParam = (PALETTE_UPDATE*) malloc(sizeof(PALETTE_UPDATE));
+	wParam = (PALETTE_UPDATE*) update_message_alloc(context, sizeof(PALETTE_UPDATE));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, palette, sizeof(PALETTE_UPDATE));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, Palette), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(Update, Palette),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_PlaySound(rdpContext* context,
@@ -177,14 +403,14 @@ static BOOL update_message_PlaySound(rdpContext* context,
 	if (!context || !context->update || !playSound)
 		return FALSE;
 
-	wParam = (PLAY_SOUND_UPDATE*) malloc(sizeof(PLAY_SOUND_UPDATE));
+	wParam = (PLAY_SOUND_UPDATE*) update_message_alloc(context, sizeof(PLAY_SOUND_UPDATE));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, playSound, sizeof(PLAY_SOUND_UPDATE));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, PlaySound), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(Update, PlaySound),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_SetKeyboardIndicators(rdpContext* context, UINT16 led_flags)
@@ -192,8 +418,8 @@ static BOOL update_message_SetKeyboardIndicators(rdpContext* context, UINT16 led
 	if (!context || !context->update)
 		return FALSE;
 
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, SetKeyboardIndicators), (void*)(size_t)led_flags, NULL);
+	return update_message_post(context, MakeMessageId(Update, SetKeyboardIndicators),
+	                           (void*)(size_t)led_flags, NULL);
 }
 
 static BOOL update_message_RefreshRect(rdpContext* context, BYTE count,
@@ -204,14 +430,14 @@ static BOOL update_message_RefreshRect(rdpContext* context, BYTE count,
 	if (!context || !context->update || !areas)
 		return FALSE;
 
-	lParam = (RECTANGLE_16*) malloc(sizeof(RECTANGLE_16) * count);
+	lParam = (RECTANGLE_16*) update_message_alloc(context, sizeof(RECTANGLE_16) * count);
 
 	if (!lParam)
 		return FALSE;
 
 	CopyMemory(lParam, areas, sizeof(RECTANGLE_16) * count);
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, RefreshRect), (void*)(size_t) count, (void*) lParam);
+	return update_message_post(context, MakeMessageId(Update, RefreshRect),
+	                           (void*)(size_t) count, (void*) lParam);
 }
 
 static BOOL update_message_SuppressOutput(rdpContext* context, BYTE allow,
@@ -224,7 +450,7 @@ static BOOL update_message_SuppressOutput(rdpContext* context, BYTE allow,
 
 	if (area)
 	{
-		lParam = (RECTANGLE_16*) malloc(sizeof(RECTANGLE_16));
+		lParam = (RECTANGLE_16*) update_message_alloc(context, sizeof(RECTANGLE_16));
 
 		if (!lParam)
 			return FALSE;
@@ -232,8 +458,8 @@ static BOOL update_message_SuppressOutput(rdpContext* context, BYTE allow,
 		CopyMemory(lParam, area, sizeof(RECTANGLE_16));
 	}
 
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, SuppressOutput), (void*)(size_t) allow, (void*) lParam);
+	return update_message_post(context, MakeMessageId(Update, SuppressOutput),
+	                           (void*)(size_t) allow, (void*) lParam);
 }
 
 static BOOL update_message_SurfaceCommand(rdpContext* context, wStream* s)
@@ -250,8 +476,8 @@ static BOOL update_message_SurfaceCommand(rdpContext* context, wStream* s)
 
 	Stream_Copy(s, wParam, Stream_GetRemainingLength(s));
 	Stream_SetPosition(wParam, 0);
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, SurfaceCommand), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(Update, SurfaceCommand),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_SurfaceBits(rdpContext* context,
@@ -262,7 +488,7 @@ static BOOL update_message_SurfaceBits(rdpContext* context,
 	if (!context || !context->update || !surfaceBitsCommand)
 		return FALSE;
 
-	wParam = (SURFACE_BITS_COMMAND*) malloc(sizeof(SURFACE_BITS_COMMAND));
+	wParam = (SURFACE_BITS_COMMAND*) update_message_alloc(context, sizeof(SURFACE_BITS_COMMAND));
 
 	if (!wParam)
 		return FALSE;
@@ -271,18 +497,18 @@ static BOOL update_message_SurfaceBits(rdpContext* context,
 #ifdef WITH_STREAM_POOL
 	StreamPool_AddRef(context->rdp->transport->ReceivePool, surfaceBitsCommand->bitmapData);
 #else
-	wParam->bitmapData = (BYTE*) malloc(wParam->bitmapDataLength);
+	wParam->bitmapData = (BYTE*) update_message_alloc(context, wParam->bitmapDataLength);
 
 	if (!wParam->bitmapData)
 	{
-		free(wParam);
+		update_message_discard(context, wParam);
 		return FALSE;
 	}
 
 	CopyMemory(wParam->bitmapData, surfaceBitsCommand->bitmapData, wParam->bitmapDataLength);
 #endif
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, SurfaceBits), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(Update, SurfaceBits),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_SurfaceFrameMarker(rdpContext* context,
@@ -293,14 +519,14 @@ static BOOL update_message_SurfaceFrameMarker(rdpContext* context,
 	if (!context || !context->update || !surfaceFrameMarker)
 		return FALSE;
 
-	wParam = (SURFACE_FRAME_MARKER*) malloc(sizeof(SURFACE_FRAME_MARKER));
+	wParam = (SURFACE_FRAME_MARKER*) update_message_alloc(context, sizeof(SURFACE_FRAME_MARKER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, surfaceFrameMarker, sizeof(SURFACE_FRAME_MARKER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, SurfaceFrameMarker), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(Update, SurfaceFrameMarker),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_SurfaceFrameAcknowledge(rdpContext* context, UINT32 frameId)
@@ -308,8 +534,8 @@ static BOOL update_message_SurfaceFrameAcknowledge(rdpContext* context, UINT32 f
 	if (!context || !context->update)
 		return FALSE;
 
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(Update, SurfaceFrameAcknowledge), (void*)(size_t) frameId, NULL);
+	return update_message_post(context, MakeMessageId(Update, SurfaceFrameAcknowledge),
+	                           (void*)(size_t) frameId, NULL);
 }
 
 /* Primary Update */
@@ -321,14 +547,14 @@ static BOOL update_message_DstBlt(rdpContext* context, const DSTBLT_ORDER* dstBl
 	if (!context || !context->update || !dstBlt)
 		return FALSE;
 
-	wParam = (DSTBLT_ORDER*) malloc(sizeof(DSTBLT_ORDER));
+	wParam = (DSTBLT_ORDER*) update_message_alloc(context, sizeof(DSTBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, dstBlt, sizeof(DSTBLT_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, DstBlt), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, DstBlt),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_PatBlt(rdpContext* context, PATBLT_ORDER* patBlt)
@@ -338,15 +564,15 @@ static BOOL update_message_PatBlt(rdpContext* context, PATBLT_ORDER* patBlt)
 	if (!context || !context->update || !patBlt)
 		return FALSE;
 
-	wParam = (PATBLT_ORDER*) malloc(sizeof(PATBLT_ORDER));
+	wParam = (PATBLT_ORDER*) update_message_alloc(context, sizeof(PATBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, patBlt, sizeof(PATBLT_ORDER));
 	wParam->brush.data = (BYTE*) wParam->brush.p8x8;
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, PatBlt), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, PatBlt),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_ScrBlt(rdpContext* context,
@@ -357,14 +583,14 @@ static BOOL update_message_ScrBlt(rdpContext* context,
 	if (!context || !context->update || !scrBlt)
 		return FALSE;
 
-	wParam = (SCRBLT_ORDER*) malloc(sizeof(SCRBLT_ORDER));
+	wParam = (SCRBLT_ORDER*) update_message_alloc(context, sizeof(SCRBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, scrBlt, sizeof(SCRBLT_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, ScrBlt), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, ScrBlt),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_OpaqueRect(
@@ -376,14 +602,14 @@ static BOOL update_message_OpaqueRect(
 	if (!context || !context->update || !opaqueRect)
 		return FALSE;
 
-	wParam = (OPAQUE_RECT_ORDER*) malloc(sizeof(OPAQUE_RECT_ORDER));
+	wParam = (OPAQUE_RECT_ORDER*) update_message_alloc(context, sizeof(OPAQUE_RECT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, opaqueRect, sizeof(OPAQUE_RECT_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, OpaqueRect), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, OpaqueRect),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_DrawNineGrid(
@@ -395,14 +621,14 @@ static BOOL update_message_DrawNineGrid(
 	if (!context || !context->update || !drawNineGrid)
 		return FALSE;
 
-	wParam = (DRAW_NINE_GRID_ORDER*) malloc(sizeof(DRAW_NINE_GRID_ORDER));
+	wParam = (DRAW_NINE_GRID_ORDER*) update_message_alloc(context, sizeof(DRAW_NINE_GRID_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, drawNineGrid, sizeof(DRAW_NINE_GRID_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, DrawNineGrid), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, DrawNineGrid),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_MultiDstBlt(rdpContext* context,
@@ -413,14 +639,14 @@ static BOOL update_message_MultiDstBlt(rdpContext* context,
 	if (!context || !context->update || !multiDstBlt)
 		return FALSE;
 
-	wParam = (MULTI_DSTBLT_ORDER*) malloc(sizeof(MULTI_DSTBLT_ORDER));
+	wParam = (MULTI_DSTBLT_ORDER*) update_message_alloc(context, sizeof(MULTI_DSTBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, multiDstBlt, sizeof(MULTI_DSTBLT_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, MultiDstBlt), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, MultiDstBlt),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_MultiPatBlt(rdpContext* context,
@@ -431,15 +657,15 @@ static BOOL update_message_MultiPatBlt(rdpContext* context,
 	if (!context || !context->update || !multiPatBlt)
 		return FALSE;
 
-	wParam = (MULTI_PATBLT_ORDER*) malloc(sizeof(MULTI_PATBLT_ORDER));
+	wParam = (MULTI_PATBLT_ORDER*) update_message_alloc(context, sizeof(MULTI_PATBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, multiPatBlt, sizeof(MULTI_PATBLT_ORDER));
 	wParam->brush.data = (BYTE*) wParam->brush.p8x8;
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, MultiPatBlt), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, MultiPatBlt),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_MultiScrBlt(rdpContext* context,
@@ -450,14 +676,14 @@ static BOOL update_message_MultiScrBlt(rdpContext* context,
 	if (!context || !context->update || !multiScrBlt)
 		return FALSE;
 
-	wParam = (MULTI_SCRBLT_ORDER*) malloc(sizeof(MULTI_SCRBLT_ORDER));
+	wParam = (MULTI_SCRBLT_ORDER*) update_message_alloc(context, sizeof(MULTI_SCRBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, multiScrBlt, sizeof(MULTI_SCRBLT_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, MultiScrBlt), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, MultiScrBlt),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_MultiOpaqueRect(
@@ -469,14 +695,14 @@ static BOOL update_message_MultiOpaqueRect(
 	if (!context || !context->update || !multiOpaqueRect)
 		return FALSE;
 
-	wParam = (MULTI_OPAQUE_RECT_ORDER*) malloc(sizeof(MULTI_OPAQUE_RECT_ORDER));
+	wParam = (MULTI_OPAQUE_RECT_ORDER*) update_message_alloc(context, sizeof(MULTI_OPAQUE_RECT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, multiOpaqueRect, sizeof(MULTI_OPAQUE_RECT_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, MultiOpaqueRect), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, MultiOpaqueRect),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_MultiDrawNineGrid(rdpContext* context,
@@ -487,15 +713,15 @@ static BOOL update_message_MultiDrawNineGrid(rdpContext* context,
 	if (!context || !context->update || !multiDrawNineGrid)
 		return FALSE;
 
-	wParam = (MULTI_DRAW_NINE_GRID_ORDER*) malloc(sizeof(MULTI_DRAW_NINE_GRID_ORDER));
+	wParam = (MULTI_DRAW_NINE_GRID_ORDER*) update_message_alloc(context, sizeof(MULTI_DRAW_NINE_GRID_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, multiDrawNineGrid, sizeof(MULTI_DRAW_NINE_GRID_ORDER));
 	/* TODO: complete copy */
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, MultiDrawNineGrid), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, MultiDrawNineGrid),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_LineTo(rdpContext* context,
@@ -506,14 +732,14 @@ static BOOL update_message_LineTo(rdpContext* context,
 	if (!context || !context->update || !lineTo)
 		return FALSE;
 
-	wParam = (LINE_TO_ORDER*) malloc(sizeof(LINE_TO_ORDER));
+	wParam = (LINE_TO_ORDER*) update_message_alloc(context, sizeof(LINE_TO_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, lineTo, sizeof(LINE_TO_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, LineTo), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, LineTo),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_Polyline(rdpContext* context,
@@ -524,23 +750,23 @@ static BOOL update_message_Polyline(rdpContext* context,
 	if (!context || !context->update || !polyline)
 		return FALSE;
 
-	wParam = (POLYLINE_ORDER*) malloc(sizeof(POLYLINE_ORDER));
+	wParam = (POLYLINE_ORDER*) update_message_alloc(context, sizeof(POLYLINE_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, polyline, sizeof(POLYLINE_ORDER));
-	wParam->points = (DELTA_POINT*) malloc(sizeof(DELTA_POINT) * wParam->numDeltaEntries);
+	wParam->points = (DELTA_POINT*) update_message_alloc(context, sizeof(DELTA_POINT) * wParam->numDeltaEntries);
 
 	if (!wParam->points)
 	{
-		free(wParam);
+		update_message_discard(context, wParam);
 		return FALSE;
 	}
 
 	CopyMemory(wParam->points, polyline->points, sizeof(DELTA_POINT) * wParam->numDeltaEntries);
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, Polyline), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, Polyline),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_MemBlt(rdpContext* context, MEMBLT_ORDER* memBlt)
@@ -550,14 +776,14 @@ static BOOL update_message_MemBlt(rdpContext* context, MEMBLT_ORDER* memBlt)
 	if (!context || !context->update || !memBlt)
 		return FALSE;
 
-	wParam = (MEMBLT_ORDER*) malloc(sizeof(MEMBLT_ORDER));
+	wParam = (MEMBLT_ORDER*) update_message_alloc(context, sizeof(MEMBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, memBlt, sizeof(MEMBLT_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, MemBlt), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, MemBlt),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_Mem3Blt(rdpContext* context, MEM3BLT_ORDER* mem3Blt)
@@ -567,15 +793,15 @@ static BOOL update_message_Mem3Blt(rdpContext* context, MEM3BLT_ORDER* mem3Blt)
 	if (!context || !context->update || !mem3Blt)
 		return FALSE;
 
-	wParam = (MEM3BLT_ORDER*) malloc(sizeof(MEM3BLT_ORDER));
+	wParam = (MEM3BLT_ORDER*) update_message_alloc(context, sizeof(MEM3BLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, mem3Blt, sizeof(MEM3BLT_ORDER));
 	wParam->brush.data = (BYTE*) wParam->brush.p8x8;
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, Mem3Blt), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, Mem3Blt),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_SaveBitmap(rdpContext* context,
@@ -586,14 +812,14 @@ static BOOL update_message_SaveBitmap(rdpContext* context,
 	if (!context || !context->update || !saveBitmap)
 		return FALSE;
 
-	wParam = (SAVE_BITMAP_ORDER*) malloc(sizeof(SAVE_BITMAP_ORDER));
+	wParam = (SAVE_BITMAP_ORDER*) update_message_alloc(context, sizeof(SAVE_BITMAP_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, saveBitmap, sizeof(SAVE_BITMAP_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, SaveBitmap), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, SaveBitmap),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_GlyphIndex(rdpContext* context,
@@ -604,15 +830,15 @@ static BOOL update_message_GlyphIndex(rdpContext* context,
 	if (!context || !context->update || !glyphIndex)
 		return FALSE;
 
-	wParam = (GLYPH_INDEX_ORDER*) malloc(sizeof(GLYPH_INDEX_ORDER));
+	wParam = (GLYPH_INDEX_ORDER*) update_message_alloc(context, sizeof(GLYPH_INDEX_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, glyphIndex, sizeof(GLYPH_INDEX_ORDER));
 	wParam->brush.data = (BYTE*) wParam->brush.p8x8;
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, GlyphIndex), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, GlyphIndex),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_FastIndex(rdpContext* context,
@@ -623,14 +849,14 @@ static BOOL update_message_FastIndex(rdpContext* context,
 	if (!context || !context->update || !fastIndex)
 		return FALSE;
 
-	wParam = (FAST_INDEX_ORDER*) malloc(sizeof(FAST_INDEX_ORDER));
+	wParam = (FAST_INDEX_ORDER*) update_message_alloc(context, sizeof(FAST_INDEX_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, fastIndex, sizeof(FAST_INDEX_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, FastIndex), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, FastIndex),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_FastGlyph(rdpContext* context,
@@ -641,7 +867,7 @@ static BOOL update_message_FastGlyph(rdpContext* context,
 	if (!context || !context->update || !fastGlyph)
 		return FALSE;
 
-	wParam = (FAST_GLYPH_ORDER*) malloc(sizeof(FAST_GLYPH_ORDER));
+	wParam = (FAST_GLYPH_ORDER*) update_message_alloc(context, sizeof(FAST_GLYPH_ORDER));
 
 	if (!wParam)
 		return FALSE;
@@ -650,11 +876,11 @@ static BOOL update_message_FastGlyph(rdpContext* context,
 
 	if (wParam->cbData > 1)
 	{
-		wParam->glyphData.aj = (BYTE*) malloc(fastGlyph->glyphData.cb);
+		wParam->glyphData.aj = (BYTE*) update_message_alloc(context, fastGlyph->glyphData.cb);
 
 		if (!wParam->glyphData.aj)
 		{
-			free(wParam);
+			update_message_discard(context, wParam);
 			return FALSE;
 		}
 
@@ -665,8 +891,8 @@ static BOOL update_message_FastGlyph(rdpContext* context,
 		wParam->glyphData.aj = NULL;
 	}
 
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, FastGlyph), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, FastGlyph),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_PolygonSC(rdpContext* context,
@@ -677,23 +903,23 @@ static BOOL update_message_PolygonSC(rdpContext* context,
 	if (!context || !context->update || !polygonSC)
 		return FALSE;
 
-	wParam = (POLYGON_SC_ORDER*) malloc(sizeof(POLYGON_SC_ORDER));
+	wParam = (POLYGON_SC_ORDER*) update_message_alloc(context, sizeof(POLYGON_SC_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, polygonSC, sizeof(POLYGON_SC_ORDER));
-	wParam->points = (DELTA_POINT*) malloc(sizeof(DELTA_POINT) * wParam->numPoints);
+	wParam->points = (DELTA_POINT*) update_message_alloc(context, sizeof(DELTA_POINT) * wParam->numPoints);
 
 	if (!wParam->points)
 	{
-		free(wParam);
+		update_message_discard(context, wParam);
 		return FALSE;
 	}
 
-	CopyMemory(wParam->points, polygonSC, sizeof(DELTA_POINT) * wParam->numPoints);
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, PolygonSC), (void*) wParam, NULL);
+	CopyMemory(wParam->points, polygonSC->points, sizeof(DELTA_POINT) * wParam->numPoints);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, PolygonSC),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_PolygonCB(rdpContext* context, POLYGON_CB_ORDER* polygonCB)
@@ -703,24 +929,24 @@ static BOOL update_message_PolygonCB(rdpContext* context, POLYGON_CB_ORDER* poly
 	if (!context || !context->update || !polygonCB)
 		return FALSE;
 
-	wParam = (POLYGON_CB_ORDER*) malloc(sizeof(POLYGON_CB_ORDER));
+	wParam = (POLYGON_CB_ORDER*) update_message_alloc(context, sizeof(POLYGON_CB_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, polygonCB, sizeof(POLYGON_CB_ORDER));
-	wParam->points = (DELTA_POINT*) malloc(sizeof(DELTA_POINT) * wParam->numPoints);
+	wParam->points = (DELTA_POINT*) update_message_alloc(context, sizeof(DELTA_POINT) * wParam->numPoints);
 
 	if (!wParam->points)
 	{
-		free(wParam);
+		update_message_discard(context, wParam);
 		return FALSE;
 	}
 
-	CopyMemory(wParam->points, polygonCB, sizeof(DELTA_POINT) * wParam->numPoints);
+	CopyMemory(wParam->points, polygonCB->points, sizeof(DELTA_POINT) * wParam->numPoints);
 	wParam->brush.data = (BYTE*) wParam->brush.p8x8;
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, PolygonCB), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, PolygonCB),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_EllipseSC(rdpContext* context,
@@ -731,14 +957,14 @@ static BOOL update_message_EllipseSC(rdpContext* context,
 	if (!context || !context->update || !ellipseSC)
 		return FALSE;
 
-	wParam = (ELLIPSE_SC_ORDER*) malloc(sizeof(ELLIPSE_SC_ORDER));
+	wParam = (ELLIPSE_SC_ORDER*) update_message_alloc(context, sizeof(ELLIPSE_SC_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, ellipseSC, sizeof(ELLIPSE_SC_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, EllipseSC), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, EllipseSC),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_EllipseCB(rdpContext* context,
@@ -749,15 +975,15 @@ static BOOL update_message_EllipseCB(rdpContext* context,
 	if (!context || !context->update || !ellipseCB)
 		return FALSE;
 
-	wParam = (ELLIPSE_CB_ORDER*) malloc(sizeof(ELLIPSE_CB_ORDER));
+	wParam = (ELLIPSE_CB_ORDER*) update_message_alloc(context, sizeof(ELLIPSE_CB_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, ellipseCB, sizeof(ELLIPSE_CB_ORDER));
 	wParam->brush.data = (BYTE*) wParam->brush.p8x8;
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(PrimaryUpdate, EllipseCB), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, EllipseCB),
+	                           (void*) wParam, NULL);
 }
 
 /* Secondary Update */
@@ -770,23 +996,27 @@ static BOOL update_message_CacheBitmap(rdpContext* context,
 	if (!context || !context->update || !cacheBitmapOrder)
 		return FALSE;
 
-	wParam = (CACHE_BITMAP_ORDER*) malloc(sizeof(CACHE_BITMAP_ORDER));
+	wParam = (CACHE_BITMAP_ORDER*) update_message_alloc(context, sizeof(CACHE_BITMAP_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, cacheBitmapOrder, sizeof(CACHE_BITMAP_ORDER));
-	wParam->bitmapDataStream = (BYTE*) malloc(wParam->bitmapLength);
+#ifdef WITH_STREAM_POOL
+	StreamPool_AddRef(context->rdp->transport->ReceivePool, wParam->bitmapDataStream);
+#else
+	wParam->bitmapDataStream = (BYTE*) update_message_alloc(context, wParam->bitmapLength);
 
 	if (!wParam->bitmapDataStream)
 	{
-		free(wParam);
+		update_message_discard(context, wParam);
 		return FALSE;
 	}
 
-	CopyMemory(wParam->bitmapDataStream, cacheBitmapOrder, wParam->bitmapLength);
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(SecondaryUpdate, CacheBitmap), (void*) wParam, NULL);
+	CopyMemory(wParam->bitmapDataStream, cacheBitmapOrder->bitmapDataStream, wParam->bitmapLength);
+#endif
+	return update_message_post(context, MakeMessageId(SecondaryUpdate, CacheBitmap),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_CacheBitmapV2(rdpContext* context,
@@ -797,23 +1027,27 @@ static BOOL update_message_CacheBitmapV2(rdpContext* context,
 	if (!context || !context->update || !cacheBitmapV2Order)
 		return FALSE;
 
-	wParam = (CACHE_BITMAP_V2_ORDER*) malloc(sizeof(CACHE_BITMAP_V2_ORDER));
+	wParam = (CACHE_BITMAP_V2_ORDER*) update_message_alloc(context, sizeof(CACHE_BITMAP_V2_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, cacheBitmapV2Order, sizeof(CACHE_BITMAP_V2_ORDER));
-	wParam->bitmapDataStream = (BYTE*) malloc(wParam->bitmapLength);
+#ifdef WITH_STREAM_POOL
+	StreamPool_AddRef(context->rdp->transport->ReceivePool, wParam->bitmapDataStream);
+#else
+	wParam->bitmapDataStream = (BYTE*) update_message_alloc(context, wParam->bitmapLength);
 
 	if (!wParam->bitmapDataStream)
 	{
-		free(wParam);
+		update_message_discard(context, wParam);
 		return FALSE;
 	}
 
 	CopyMemory(wParam->bitmapDataStream, cacheBitmapV2Order->bitmapDataStream, wParam->bitmapLength);
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(SecondaryUpdate, CacheBitmapV2), (void*) wParam, NULL);
+#endif
+	return update_message_post(context, MakeMessageId(SecondaryUpdate, CacheBitmapV2),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_CacheBitmapV3(rdpContext* context,
@@ -824,23 +1058,23 @@ static BOOL update_message_CacheBitmapV3(rdpContext* context,
 	if (!context || !context->update || !cacheBitmapV3Order)
 		return FALSE;
 
-	wParam = (CACHE_BITMAP_V3_ORDER*) malloc(sizeof(CACHE_BITMAP_V3_ORDER));
+	wParam = (CACHE_BITMAP_V3_ORDER*) update_message_alloc(context, sizeof(CACHE_BITMAP_V3_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, cacheBitmapV3Order, sizeof(CACHE_BITMAP_V3_ORDER));
-	wParam->bitmapData.data = (BYTE*) malloc(wParam->bitmapData.length);
+	wParam->bitmapData.data = (BYTE*) update_message_alloc(context, wParam->bitmapData.length);
 
 	if (!wParam->bitmapData.data)
 	{
-		free(wParam);
+		update_message_discard(context, wParam);
 		return FALSE;
 	}
 
 	CopyMemory(wParam->bitmapData.data, cacheBitmapV3Order->bitmapData.data, wParam->bitmapData.length);
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(SecondaryUpdate, CacheBitmapV3), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(SecondaryUpdate, CacheBitmapV3),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_CacheColorTable(
@@ -852,14 +1086,14 @@ static BOOL update_message_CacheColorTable(
 	if (!context || !context->update || !cacheColorTableOrder)
 		return FALSE;
 
-	wParam = (CACHE_COLOR_TABLE_ORDER*) malloc(sizeof(CACHE_COLOR_TABLE_ORDER));
+	wParam = (CACHE_COLOR_TABLE_ORDER*) update_message_alloc(context, sizeof(CACHE_COLOR_TABLE_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, cacheColorTableOrder, sizeof(CACHE_COLOR_TABLE_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(SecondaryUpdate, CacheColorTable), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(SecondaryUpdate, CacheColorTable),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_CacheGlyph(
@@ -871,14 +1105,14 @@ static BOOL update_message_CacheGlyph(
 	if (!context || !context->update || !cacheGlyphOrder)
 		return FALSE;
 
-	wParam = (CACHE_GLYPH_ORDER*) malloc(sizeof(CACHE_GLYPH_ORDER));
+	wParam = (CACHE_GLYPH_ORDER*) update_message_alloc(context, sizeof(CACHE_GLYPH_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, cacheGlyphOrder, sizeof(CACHE_GLYPH_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(SecondaryUpdate, CacheGlyph), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(SecondaryUpdate, CacheGlyph),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_CacheGlyphV2(
@@ -890,14 +1124,14 @@ static BOOL update_message_CacheGlyphV2(
 	if (!context || !context->update || !cacheGlyphV2Order)
 		return FALSE;
 
-	wParam = (CACHE_GLYPH_V2_ORDER*) malloc(sizeof(CACHE_GLYPH_V2_ORDER));
+	wParam = (CACHE_GLYPH_V2_ORDER*) update_message_alloc(context, sizeof(CACHE_GLYPH_V2_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, cacheGlyphV2Order, sizeof(CACHE_GLYPH_V2_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(SecondaryUpdate, CacheGlyphV2), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(SecondaryUpdate, CacheGlyphV2),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_CacheBrush(
@@ -909,14 +1143,14 @@ static BOOL update_message_CacheBrush(
 	if (!context || !context->update || !cacheBrushOrder)
 		return FALSE;
 
-	wParam = (CACHE_BRUSH_ORDER*) malloc(sizeof(CACHE_BRUSH_ORDER));
+	wParam = (CACHE_BRUSH_ORDER*) update_message_alloc(context, sizeof(CACHE_BRUSH_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, cacheBrushOrder, sizeof(CACHE_BRUSH_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(SecondaryUpdate, CacheBrush), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(SecondaryUpdate, CacheBrush),
+	                           (void*) wParam, NULL);
 }
 
 /* Alternate Secondary Update */
@@ -930,7 +1164,7 @@ static BOOL update_message_CreateOffscreenBitmap(
 	if (!context || !context->update || !createOffscreenBitmap)
 		return FALSE;
 
-	wParam = (CREATE_OFFSCREEN_BITMAP_ORDER*) malloc(sizeof(CREATE_OFFSCREEN_BITMAP_ORDER));
+	wParam = (CREATE_OFFSCREEN_BITMAP_ORDER*) update_message_alloc(context, sizeof(CREATE_OFFSCREEN_BITMAP_ORDER));
 
 	if (!wParam)
 		return FALSE;
@@ -938,18 +1172,18 @@ static BOOL update_message_CreateOffscreenBitmap(
 	CopyMemory(wParam, createOffscreenBitmap, sizeof(CREATE_OFFSCREEN_BITMAP_ORDER));
 	wParam->deleteList.cIndices = createOffscreenBitmap->deleteList.cIndices;
 	wParam->deleteList.sIndices = wParam->deleteList.cIndices;
-	wParam->deleteList.indices = (UINT16*) malloc(sizeof(UINT16) * wParam->deleteList.cIndices);
+	wParam->deleteList.indices = (UINT16*) update_message_alloc(context, sizeof(UINT16) * wParam->deleteList.cIndices);
 
 	if (!wParam->deleteList.indices)
 	{
-		free(wParam);
+		update_message_discard(context, wParam);
 		return FALSE;
 	}
 
 	CopyMemory(wParam->deleteList.indices, createOffscreenBitmap->deleteList.indices,
 	           wParam->deleteList.cIndices);
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(AltSecUpdate, CreateOffscreenBitmap), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, CreateOffscreenBitmap),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_SwitchSurface(
@@ -961,14 +1195,14 @@ static BOOL update_message_SwitchSurface(
 	if (!context || !context->update || !switchSurface)
 		return FALSE;
 
-	wParam = (SWITCH_SURFACE_ORDER*) malloc(sizeof(SWITCH_SURFACE_ORDER));
+	wParam = (SWITCH_SURFACE_ORDER*) update_message_alloc(context, sizeof(SWITCH_SURFACE_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, switchSurface, sizeof(SWITCH_SURFACE_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(AltSecUpdate, SwitchSurface), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, SwitchSurface),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_CreateNineGridBitmap(
@@ -980,14 +1214,14 @@ static BOOL update_message_CreateNineGridBitmap(
 	if (!context || !context->update || !createNineGridBitmap)
 		return FALSE;
 
-	wParam = (CREATE_NINE_GRID_BITMAP_ORDER*) malloc(sizeof(CREATE_NINE_GRID_BITMAP_ORDER));
+	wParam = (CREATE_NINE_GRID_BITMAP_ORDER*) update_message_alloc(context, sizeof(CREATE_NINE_GRID_BITMAP_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, createNineGridBitmap, sizeof(CREATE_NINE_GRID_BITMAP_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(AltSecUpdate, CreateNineGridBitmap), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, CreateNineGridBitmap),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_FrameMarker(
@@ -999,14 +1233,14 @@ static BOOL update_message_FrameMarker(
 	if (!context || !context->update || !frameMarker)
 		return FALSE;
 
-	wParam = (FRAME_MARKER_ORDER*) malloc(sizeof(FRAME_MARKER_ORDER));
+	wParam = (FRAME_MARKER_ORDER*) update_message_alloc(context, sizeof(FRAME_MARKER_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, frameMarker, sizeof(FRAME_MARKER_ORDER));
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(AltSecUpdate, FrameMarker), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, FrameMarker),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_StreamBitmapFirst(
@@ -1018,15 +1252,15 @@ static BOOL update_message_StreamBitmapFirst(
 	if (!context || !context->update || !streamBitmapFirst)
 		return FALSE;
 
-	wParam = (STREAM_BITMAP_FIRST_ORDER*) malloc(sizeof(STREAM_BITMAP_FIRST_ORDER));
+	wParam = (STREAM_BITMAP_FIRST_ORDER*) update_message_alloc(context, sizeof(STREAM_BITMAP_FIRST_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, streamBitmapFirst, sizeof(STREAM_BITMAP_FIRST_ORDER));
 	/* TODO: complete copy */
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(AltSecUpdate, StreamBitmapFirst), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, StreamBitmapFirst),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_StreamBitmapNext(
@@ -1038,15 +1272,15 @@ static BOOL update_message_StreamBitmapNext(
 	if (!context || !context->update || !streamBitmapNext)
 		return FALSE;
 
-	wParam = (STREAM_BITMAP_NEXT_ORDER*) malloc(sizeof(STREAM_BITMAP_NEXT_ORDER));
+	wParam = (STREAM_BITMAP_NEXT_ORDER*) update_message_alloc(context, sizeof(STREAM_BITMAP_NEXT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, streamBitmapNext, sizeof(STREAM_BITMAP_NEXT_ORDER));
 	/* TODO: complete copy */
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(AltSecUpdate, StreamBitmapNext), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, StreamBitmapNext),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_DrawGdiPlusFirst(
@@ -1058,15 +1292,15 @@ static BOOL update_message_DrawGdiPlusFirst(
 	if (!context || !context->update || !drawGdiPlusFirst)
 		return FALSE;
 
-	wParam = (DRAW_GDIPLUS_FIRST_ORDER*) malloc(sizeof(DRAW_GDIPLUS_FIRST_ORDER));
+	wParam = (DRAW_GDIPLUS_FIRST_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_FIRST_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, drawGdiPlusFirst, sizeof(DRAW_GDIPLUS_FIRST_ORDER));
 	/* TODO: complete copy */
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(AltSecUpdate, DrawGdiPlusFirst), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, DrawGdiPlusFirst),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_DrawGdiPlusNext(
@@ -1078,15 +1312,15 @@ static BOOL update_message_DrawGdiPlusNext(
 	if (!context || !context->update || !drawGdiPlusNext)
 		return FALSE;
 
-	wParam = (DRAW_GDIPLUS_NEXT_ORDER*) malloc(sizeof(DRAW_GDIPLUS_NEXT_ORDER));
+	wParam = (DRAW_GDIPLUS_NEXT_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_NEXT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, drawGdiPlusNext, sizeof(DRAW_GDIPLUS_NEXT_ORDER));
 	/* TODO: complete copy */
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(AltSecUpdate, DrawGdiPlusNext), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, DrawGdiPlusNext),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_DrawGdiPlusEnd(
@@ -1098,15 +1332,15 @@ static BOOL update_message_DrawGdiPlusEnd(
 	if (!context || !context->update || !drawGdiPlusEnd)
 		return FALSE;
 
-	wParam = (DRAW_GDIPLUS_END_ORDER*) malloc(sizeof(DRAW_GDIPLUS_END_ORDER));
+	wParam = (DRAW_GDIPLUS_END_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_END_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, drawGdiPlusEnd, sizeof(DRAW_GDIPLUS_END_ORDER));
 	/* TODO: complete copy */
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(AltSecUpdate, DrawGdiPlusEnd), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, DrawGdiPlusEnd),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_DrawGdiPlusCacheFirst(
@@ -1118,15 +1352,15 @@ static BOOL update_message_DrawGdiPlusCacheFirst(
 	if (!context || !context->update || !drawGdiPlusCacheFirst)
 		return FALSE;
 
-	wParam = (DRAW_GDIPLUS_CACHE_FIRST_ORDER*) malloc(sizeof(DRAW_GDIPLUS_CACHE_FIRST_ORDER));
+	wParam = (DRAW_GDIPLUS_CACHE_FIRST_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_CACHE_FIRST_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, drawGdiPlusCacheFirst, sizeof(DRAW_GDIPLUS_CACHE_FIRST_ORDER));
 	/* TODO: complete copy */
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(AltSecUpdate, DrawGdiPlusCacheFirst), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, DrawGdiPlusCacheFirst),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_DrawGdiPlusCacheNext(
@@ -1138,15 +1372,15 @@ static BOOL update_message_DrawGdiPlusCacheNext(
 	if (!context || !context->update || !drawGdiPlusCacheNext)
 		return FALSE;
 
-	wParam = (DRAW_GDIPLUS_CACHE_NEXT_ORDER*) malloc(sizeof(DRAW_GDIPLUS_CACHE_NEXT_ORDER));
+	wParam = (DRAW_GDIPLUS_CACHE_NEXT_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_CACHE_NEXT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, drawGdiPlusCacheNext, sizeof(DRAW_GDIPLUS_CACHE_NEXT_ORDER));
 	/* TODO: complete copy */
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(AltSecUpdate, DrawGdiPlusCacheNext), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, DrawGdiPlusCacheNext),
+	                           (void*) wParam, NULL);
 }
 
 static BOOL update_message_DrawGdiPlusCacheEnd(
@@ -1158,15 +1392,15 @@ static BOOL update_message_DrawGdiPlusCacheEnd(
 	if (!context || !context->update || !drawGdiPlusCacheEnd)
 		return FALSE;
 
-	wParam = (DRAW_GDIPLUS_CACHE_END_ORDER*) malloc(sizeof(DRAW_GDIPLUS_CACHE_END_ORDER));
+	wParam = (DRAW_GDIPLUS_CACHE_END_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_CACHE_END_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, drawGdiPlusCacheEnd, sizeof(DRAW_GDIPLUS_CACHE_END_ORDER));
 	/* TODO: complete copy */
-	return MessageQueue_Post(context->update->queue, (void*) context,
-	                         MakeMessageId(AltSecUpdate, DrawGdiPlusCacheEnd), (void*) wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, DrawGdiPlusCacheEnd),
+	                           (void*) wParam, NULL);
 }
 
 /* Window Update */
@@ -1630,10 +1864,14 @@ static int update_message_free_update_class(wMessage* msg, int type)
 			break;
 
 		case Update_EndPaint:
+			{
+				rdpContext* context = (rdpContext*) msg->context;
+				update_message_arena_recycle(context->update->proxy, (rdpUpdateArena*) msg->wParam);
+			}
 			break;
 
 		case Update_SetBounds:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case Update_Synchronize:
@@ -1654,29 +1892,29 @@ static int update_message_free_update_class(wMessage* msg, int type)
 					StreamPool_Release(context->rdp->transport->ReceivePool,
 					                   wParam->rectangles[index].bitmapDataStream);
 #else
-					free(wParam->rectangles[index].bitmapDataStream);
+					update_message_free_param(msg, wParam->rectangles[index].bitmapDataStream);
 #endif
 				}
 
-				free(wParam->rectangles);
-				free(wParam);
+				update_message_free_param(msg, wParam->rectangles);
+				update_message_free_param(msg, wParam);
 			}
 			break;
 
 		case Update_Palette:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case Update_PlaySound:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case Update_RefreshRect:
-			free(msg->lParam);
+			update_message_free_param(msg, msg->lParam);
 			break;
 
 		case Update_SuppressOutput:
-			free(msg->lParam);
+			update_message_free_param(msg, msg->lParam);
 			break;
 
 		case Update_SurfaceCommand:
@@ -1692,16 +1930,17 @@ static int update_message_free_update_class(wMessage* msg, int type)
 				rdpContext* context = (rdpContext*) msg->context;
 				SURFACE_BITS_COMMAND* wParam = (SURFACE_BITS_COMMAND*) msg->wParam;
 				StreamPool_Release(context->rdp->transport->ReceivePool, wParam->bitmapData);
+				update_message_free_param(msg, wParam);
 #else
 				SURFACE_BITS_COMMAND* wParam = (SURFACE_BITS_COMMAND*) msg->wParam;
-				free(wParam->bitmapData);
-				free(wParam);
+				update_message_free_param(msg, wParam->bitmapData);
+				update_message_free_param(msg, wParam);
 #endif
 			}
 			break;
 
 		case Update_SurfaceFrameMarker:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case Update_SurfaceFrameAcknowledge:
@@ -1806,107 +2045,107 @@ static int update_message_free_primary_update_class(wMessage* msg, int type)
 	switch (type)
 	{
 		case PrimaryUpdate_DstBlt:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_PatBlt:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_ScrBlt:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_OpaqueRect:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_DrawNineGrid:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiDstBlt:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiPatBlt:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiScrBlt:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiOpaqueRect:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiDrawNineGrid:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_LineTo:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_Polyline:
 			{
 				POLYLINE_ORDER* wParam = (POLYLINE_ORDER*) msg->wParam;
-				free(wParam->points);
-				free(wParam);
+				update_message_free_param(msg, wParam->points);
+				update_message_free_param(msg, wParam);
 			}
 			break;
 
 		case PrimaryUpdate_MemBlt:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_Mem3Blt:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_SaveBitmap:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_GlyphIndex:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_FastIndex:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_FastGlyph:
 			{
 				FAST_GLYPH_ORDER* wParam = (FAST_GLYPH_ORDER*) msg->wParam;
-				free(wParam->glyphData.aj);
-				free(wParam);
+				update_message_free_param(msg, wParam->glyphData.aj);
+				update_message_free_param(msg, wParam);
 			}
 			break;
 
 		case PrimaryUpdate_PolygonSC:
 			{
 				POLYGON_SC_ORDER* wParam = (POLYGON_SC_ORDER*) msg->wParam;
-				free(wParam->points);
-				free(wParam);
+				update_message_free_param(msg, wParam->points);
+				update_message_free_param(msg, wParam);
 			}
 			break;
 
 		case PrimaryUpdate_PolygonCB:
 			{
 				POLYGON_CB_ORDER* wParam = (POLYGON_CB_ORDER*) msg->wParam;
-				free(wParam->points);
-				free(wParam);
+				update_message_free_param(msg, wParam->points);
+				update_message_free_param(msg, wParam);
 			}
 			break;
 
 		case PrimaryUpdate_EllipseSC:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case PrimaryUpdate_EllipseCB:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		default:
@@ -2036,52 +2275,62 @@ static int update_message_free_secondary_update_class(wMessage* msg, int type)
 		case SecondaryUpdate_CacheBitmap:
 			{
 				CACHE_BITMAP_ORDER* wParam = (CACHE_BITMAP_ORDER*) msg->wParam;
-				free(wParam->bitmapDataStream);
-				free(wParam);
+#ifdef WITH_STREAM_POOL
+				rdpContext* context = (rdpContext*) msg->context;
+				StreamPool_Release(context->rdp->transport->ReceivePool, wParam->bitmapDataStream);
+#else
+				update_message_free_param(msg, wParam->bitmapDataStream);
+#endif
+				update_message_free_param(msg, wParam);
 			}
 			break;
 
 		case SecondaryUpdate_CacheBitmapV2:
 			{
 				CACHE_BITMAP_V2_ORDER* wParam = (CACHE_BITMAP_V2_ORDER*) msg->wParam;
-				free(wParam->bitmapDataStream);
-				free(wParam);
+#ifdef WITH_STREAM_POOL
+				rdpContext* context = (rdpContext*) msg->context;
+				StreamPool_Release(context->rdp->transport->ReceivePool, wParam->bitmapDataStream);
+#else
+				update_message_free_param(msg, wParam->bitmapDataStream);
+#endif
+				update_message_free_param(msg, wParam);
 			}
 			break;
 
 		case SecondaryUpdate_CacheBitmapV3:
 			{
 				CACHE_BITMAP_V3_ORDER* wParam = (CACHE_BITMAP_V3_ORDER*) msg->wParam;
-				free(wParam->bitmapData.data);
-				free(wParam);
+				update_message_free_param(msg, wParam->bitmapData.data);
+				update_message_free_param(msg, wParam);
 			}
 			break;
 
 		case SecondaryUpdate_CacheColorTable:
 			{
 				CACHE_COLOR_TABLE_ORDER* wParam = (CACHE_COLOR_TABLE_ORDER*) msg->wParam;
-				free(wParam);
+				update_message_free_param(msg, wParam);
 			}
 			break;
 
 		case SecondaryUpdate_CacheGlyph:
 			{
 				CACHE_GLYPH_ORDER* wParam = (CACHE_GLYPH_ORDER*) msg->wParam;
-				free(wParam);
+				update_message_free_param(msg, wParam);
 			}
 			break;
 
 		case SecondaryUpdate_CacheGlyphV2:
 			{
 				CACHE_GLYPH_V2_ORDER* wParam = (CACHE_GLYPH_V2_ORDER*) msg->wParam;
-				free(wParam);
+				update_message_free_param(msg, wParam);
 			}
 			break;
 
 		case SecondaryUpdate_CacheBrush:
 			{
 				CACHE_BRUSH_ORDER* wParam = (CACHE_BRUSH_ORDER*) msg->wParam;
-				free(wParam);
+				update_message_free_param(msg, wParam);
 			}
 			break;
 
@@ -2152,53 +2401,53 @@ static int update_message_free_altsec_update_class(wMessage* msg, int type)
 		case AltSecUpdate_CreateOffscreenBitmap:
 			{
 				CREATE_OFFSCREEN_BITMAP_ORDER* wParam = (CREATE_OFFSCREEN_BITMAP_ORDER*) msg->wParam;
-				free(wParam->deleteList.indices);
-				free(wParam);
+				update_message_free_param(msg, wParam->deleteList.indices);
+				update_message_free_param(msg, wParam);
 			}
 			break;
 
 		case AltSecUpdate_SwitchSurface:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case AltSecUpdate_CreateNineGridBitmap:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case AltSecUpdate_FrameMarker:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case AltSecUpdate_StreamBitmapFirst:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case AltSecUpdate_StreamBitmapNext:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusFirst:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusNext:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusEnd:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusCacheFirst:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusCacheNext:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusCacheEnd:
-			free(msg->wParam);
+			update_message_free_param(msg, msg->wParam);
 			break;
 
 		default:
@@ -2867,12 +3116,20 @@ rdpUpdateProxy* update_message_proxy_new(rdpUpdate* update)
 		return NULL;
 
 	message->update = update;
+
+	if (!InitializeCriticalSectionAndSpinCount(&message->arenaLock, 4000))
+	{
+		free(message);
+		return NULL;
+	}
+
 	update_message_register_interface(message, update);
 
 	if (!(message->thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) update_message_proxy_thread,
 	                                     update, 0, NULL)))
 	{
 		WLog_ERR(TAG, "Failed to create proxy thread");
+		DeleteCriticalSection(&message->arenaLock);
 		free(message);
 		return NULL;
 	}
@@ -2888,6 +3145,16 @@ void update_message_proxy_free(rdpUpdateProxy* message)
 			WaitForSingleObject(message->thread, INFINITE);
 
 		CloseHandle(message->thread);
+		update_arena_free(message->arena);
+
+		while (message->freeArenas)
+		{
+			rdpUpdateArena* arena = message->freeArenas;
+			message->freeArenas = arena->next;
+			update_arena_free(arena);
+		}
+
+		DeleteCriticalSection(&message->arenaLock);
 		free(message);
 	}
 }
@@ -30,6 +30,8 @@
 
 /* Update Proxy Interface */
 
+typedef struct rdp_update_arena rdpUpdateArena;
+
 struct rdp_update_proxy
 {
 	rdpUpdate* update;
@@ -124,6 +126,12 @@ struct rdp_update_proxy
 	pPointerCached PointerCached;
 
 	HANDLE thread;
+
+	/* Parameters of the messages queued between BeginPaint and EndPaint */
+	rdpUpdateArena* arena;
+	rdpUpdateArena* freeArenas;
+	UINT32 freeArenaCount;
+	CRITICAL_SECTION arenaLock;
 };
 
 FREERDP_LOCAL int update_message_queue_process_message(rdpUpdate* update,
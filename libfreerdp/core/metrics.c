@@ -21,6 +21,8 @@
 #include "config.h"
 #endif
 
+#include <freerdp/utils/metrics.h>
+
 #include "rdp.h"
 
 double metrics_write_bytes(rdpMetrics* metrics, UINT32 UncompressedBytes, UINT32 CompressedBytes)
@@ -42,6 +44,8 @@ rdpMetrics* metrics_new(rdpContext* context)
 {
 	rdpMetrics* metrics;
 
+	/* picks up an exporter configured in the environment */
+	freerdp_metrics_init();
 	metrics = (rdpMetrics*) calloc(1, sizeof(rdpMetrics));
 
 	if (metrics)
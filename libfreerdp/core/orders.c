@@ -1406,7 +1406,7 @@ static BOOL update_read_glyph_index_order(wStream* s, ORDER_INFO* orderInfo,
 int update_approximate_glyph_index_order(ORDER_INFO* orderInfo,
         const GLYPH_INDEX_ORDER* glyph_index)
 {
-	return 64;
+	return 64 + glyph_index->cbData;
 }
 BOOL update_write_glyph_index_order(wStream* s, ORDER_INFO* orderInfo,
                                     GLYPH_INDEX_ORDER* glyph_index)
@@ -2123,7 +2123,18 @@ static BOOL update_read_cache_glyph_order(wStream* s,
 int update_approximate_cache_glyph_order(
     const CACHE_GLYPH_ORDER* cache_glyph, UINT16* flags)
 {
-	return 2 + cache_glyph->cGlyphs * 32;
+	UINT32 i;
+	int inf = 2 + cache_glyph->cGlyphs * 2;
+
+	for (i = 0; i < cache_glyph->cGlyphs; i++)
+	{
+		const GLYPH_DATA* glyph = &cache_glyph->glyphData[i];
+		UINT32 cb = ((glyph->cx + 7) / 8) * glyph->cy;
+		cb += ((cb % 4) > 0) ? 4 - (cb % 4) : 0;
+		inf += 10 + cb;
+	}
+
+	return inf;
 }
 BOOL update_write_cache_glyph_order(wStream* s,
                                     const CACHE_GLYPH_ORDER* cache_glyph,
@@ -2211,7 +2222,18 @@ static BOOL update_read_cache_glyph_v2_order(wStream* s,
 int update_approximate_cache_glyph_v2_order(
     const CACHE_GLYPH_V2_ORDER* cache_glyph_v2, UINT16* flags)
 {
-	return 8 + cache_glyph_v2->cGlyphs * 32;
+	UINT32 i;
+	int inf = 8 + cache_glyph_v2->cGlyphs * 2;
+
+	for (i = 0; i < cache_glyph_v2->cGlyphs; i++)
+	{
+		const GLYPH_DATA_V2* glyph = &cache_glyph_v2->glyphData[i];
+		UINT32 cb = ((glyph->cx + 7) / 8) * glyph->cy;
+		cb += ((cb % 4) > 0) ? 4 - (cb % 4) : 0;
+		inf += 9 + cb;
+	}
+
+	return inf;
 }
 BOOL update_write_cache_glyph_v2_order(wStream* s,
                                        const CACHE_GLYPH_V2_ORDER* cache_glyph_v2,
@@ -120,69 +120,19 @@ int freerdp_peer_virtual_channel_read(freerdp_peer* client, HANDLE hChannel, BYT
 static int freerdp_peer_virtual_channel_write(freerdp_peer* client, HANDLE hChannel, BYTE* buffer,
         UINT32 length)
 {
-	wStream* s;
-	UINT32 flags;
-	UINT32 chunkSize;
-	UINT32 maxChunkSize;
-	UINT32 totalLength;
 	rdpPeerChannel* peerChannel;
-	rdpMcsChannel* mcsChannel;
 	rdpRdp* rdp = client->context->rdp;
 
 	if (!hChannel)
 		return -1;
 
 	peerChannel = (rdpPeerChannel*) hChannel;
-	mcsChannel = peerChannel->mcsChannel;
 
 	if (peerChannel->channelFlags & WTS_CHANNEL_OPTION_DYNAMIC)
 		return -1; /* not yet supported */
 
-	maxChunkSize = rdp->settings->VirtualChannelChunkSize;
-	totalLength = length;
-	flags = CHANNEL_FLAG_FIRST;
-
-	while (length > 0)
-	{
-		s = rdp_send_stream_init(rdp);
-
-		if (!s)
-			return -1;
-
-		if (length > maxChunkSize)
-		{
-			chunkSize = rdp->settings->VirtualChannelChunkSize;
-		}
-		else
-		{
-			chunkSize = length;
-			flags |= CHANNEL_FLAG_LAST;
-		}
-
-		if (mcsChannel->options & CHANNEL_OPTION_SHOW_PROTOCOL)
-			flags |= CHANNEL_FLAG_SHOW_PROTOCOL;
-
-		Stream_Write_UINT32(s, totalLength);
-		Stream_Write_UINT32(s, flags);
-
-		if (!Stream_EnsureRemainingCapacity(s, chunkSize))
-		{
-			Stream_Release(s);
-			return -1;
-		}
-
-		Stream_Write(s, buffer, chunkSize);
-
-		if (!rdp_send(rdp, s, peerChannel->channelId))
-		{
-			Stream_Release(s);
-			return -1;
-		}
-
-		buffer += chunkSize;
-		length -= chunkSize;
-		flags = 0;
-	}
+	if (!freerdp_channel_send(rdp, peerChannel->channelId, buffer, length))
+		return -1;
 
 	return 1;
 }
@@ -258,7 +208,19 @@ static HANDLE freerdp_peer_get_event_handle(freerdp_peer* client)
 
 static DWORD freerdp_peer_get_event_handles(freerdp_peer* client, HANDLE* events, DWORD count)
 {
-	return transport_get_event_handles(client->context->rdp->transport, events, count);
+	DWORD nCount;
+	rdpRdp* rdp = client->context->rdp;
+	nCount = transport_get_event_handles(rdp->transport, events, count);
+
+	if ((nCount > 0) && rdp->settings->VirtualChannelScheduling)
+	{
+		if (nCount >= count)
+			return 0;
+
+		events[nCount++] = channel_scheduler_get_event_handle(rdp->channelScheduler);
+	}
+
+	return nCount;
 }
 
 static BOOL freerdp_peer_check_fds(freerdp_peer* peer)
@@ -660,7 +622,11 @@ static BOOL freerdp_peer_close(freerdp_peer* client)
 	 * [MS-RDPBCGR] 1.3.1.4.2 User-Initiated Disconnection Sequence on Server
 	 * The server first sends the client a Deactivate All PDU followed by an
 	 * optional MCS Disconnect Provider Ultimatum PDU.
+	 * Channel data still queued by the scheduler goes out first.
 	 */
+	if (!channel_scheduler_flush(client->context->rdp->channelScheduler))
+		WLog_WARN(TAG, "failed to send queued channel data before disconnect");
+
 	if (!rdp_send_deactivate_all(client->context->rdp))
 		return FALSE;
 
@@ -675,6 +641,10 @@ static BOOL freerdp_peer_close(freerdp_peer* client)
 static void freerdp_peer_disconnect(freerdp_peer* client)
 {
 	rdpTransport* transport = client->context->rdp->transport;
+
+	if (!channel_scheduler_flush(client->context->rdp->channelScheduler))
+		WLog_WARN(TAG, "failed to send queued channel data before disconnect");
+
 	transport_disconnect(transport);
 }
 
@@ -1278,6 +1278,9 @@ int rdp_recv_callback(rdpTransport* transport, wStream* s, void* extra)
 	int status = 0;
 	rdpRdp* rdp = (rdpRdp*) extra;
 
+	if (rdp->recorder)
+		session_recorder_add(rdp->recorder, rdp, s);
+
 	/* 
 	 * At any point in the connection sequence between when all
 	 * MCS channels have been joined and when the RDP connection
@@ -1482,7 +1485,16 @@ int rdp_check_fds(rdpRdp* rdp)
 		status = rdp_client_redirect(rdp); /* session redirection */
 	}
 	if (status < 0)
+	{
 		WLog_DBG(TAG, "transport_check_fds() - %i", status);
+		return status;
+	}
+
+	if (!channel_scheduler_check(rdp->channelScheduler))
+	{
+		WLog_DBG(TAG, "channel_scheduler_check() failed");
+		return -1;
+	}
 
 	return status;
 }
@@ -1580,8 +1592,14 @@ rdpRdp* rdp_new(rdpContext* context)
 	if (!rdp->bulk)
 		goto out_free_multitransport;
 
+	rdp->channelScheduler = channel_scheduler_new(rdp);
+	if (!rdp->channelScheduler)
+		goto out_free_bulk;
+
 	return rdp;
 
+out_free_bulk:
+	bulk_free(rdp->bulk);
 out_free_multitransport:
 	multitransport_free(rdp->multitransport);
 out_free_heartbeat:
@@ -1621,6 +1639,7 @@ void rdp_reset(rdpRdp* rdp)
 	settings = rdp->settings;
 
 	bulk_reset(rdp->bulk);
+	channel_scheduler_reset(rdp->channelScheduler);
 
 	if (rdp->rc4_decrypt_key)
 	{
@@ -1707,6 +1726,8 @@ void rdp_free(rdpRdp* rdp)
 		heartbeat_free(rdp->heartbeat);
 		multitransport_free(rdp->multitransport);
 		bulk_free(rdp->bulk);
+		channel_scheduler_free(rdp->channelScheduler);
+		session_recorder_free(rdp->recorder);
 		free(rdp);
 	}
 }
@@ -45,6 +45,7 @@
 #include "redirection.h"
 #include "capabilities.h"
 #include "channels.h"
+#include "record.h"
 
 #include <freerdp/freerdp.h>
 #include <freerdp/settings.h>
@@ -149,6 +150,8 @@ struct rdp_rdp
 	rdpAutoDetect* autodetect;
 	rdpHeartbeat* heartbeat;
 	rdpMultitransport* multitransport;
+	rdpChannelScheduler* channelScheduler;
+	rdpSessionRecorder* recorder;
 	WINPR_RC4_CTX* rc4_decrypt_key;
 	int decrypt_use_count;
 	int decrypt_checksum_use_count;
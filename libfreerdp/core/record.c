@@ -0,0 +1,700 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Session Recording and Replay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <freerdp/log.h>
+
+#include "record.h"
+
+#define TAG FREERDP_TAG("core.record")
+
+#define BIO_TYPE_SESSION_PLAYER		69
+
+#define SESSION_RECORD_HEADER_FIXED	36
+#define SESSION_RECORD_RECORD_HEADER	16
+#define SESSION_RECORD_ALIGN(_x)	(((_x) + 7) & ~((size_t) 7))
+
+struct rdp_session_recorder
+{
+	FILE* fp;
+	char* filename;
+	BOOL started;
+	BOOL stopped;
+	UINT64 start;
+	UINT64 records;
+
+	/* the PDU written last, parsers may ask for parts of it to be blanked */
+	const BYTE* pdu;
+	size_t pduLength;
+	long pduOffset;
+};
+
+struct rdp_session_player
+{
+	BYTE* data;
+	size_t size;
+	size_t offset;
+	size_t remaining;
+	BOOL realtime;
+	UINT64 start;
+	UINT64 records;
+	HANDLE event;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
+typedef struct rdp_session_player rdpSessionPlayer;
+
+/* wraps a buffer without allocating, records are parsed on every read */
+static wStream* session_record_stream(wStream* s, BYTE* data, size_t size)
+{
+	ZeroMemory(s, sizeof(wStream));
+	s->buffer = s->pointer = data;
+	s->length = s->capacity = size;
+	return s;
+}
+
+static UINT64 session_record_time(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER count;
+	LARGE_INTEGER freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (UINT64)(count.QuadPart / freq.QuadPart * 1000000 +
+	                (count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UINT64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+rdpSessionRecorder* session_recorder_new(const char* filename)
+{
+	rdpSessionRecorder* recorder;
+
+	if (!filename)
+		return NULL;
+
+	recorder = (rdpSessionRecorder*) calloc(1, sizeof(rdpSessionRecorder));
+
+	if (!recorder)
+		return NULL;
+
+	if (!(recorder->filename = _strdup(filename)))
+		goto fail;
+
+	if (!(recorder->fp = fopen(filename, "wb")))
+	{
+		WLog_ERR(TAG, "failed to create session recording %s", filename);
+		goto fail;
+	}
+
+	return recorder;
+fail:
+	free(recorder->filename);
+	free(recorder);
+	return NULL;
+}
+
+void session_recorder_free(rdpSessionRecorder* recorder)
+{
+	if (!recorder)
+		return;
+
+	session_recorder_stop(recorder);
+	free(recorder->filename);
+	free(recorder);
+}
+
+void session_recorder_stop(rdpSessionRecorder* recorder)
+{
+	if (!recorder || recorder->stopped)
+		return;
+
+	recorder->stopped = TRUE;
+
+	if (recorder->fp)
+	{
+		fclose(recorder->fp);
+		recorder->fp = NULL;
+		WLog_INFO(TAG, "recorded %"PRIu64" PDUs to %s", recorder->records, recorder->filename);
+	}
+}
+
+static BOOL session_recorder_write_header(rdpSessionRecorder* recorder, rdpSettings* settings)
+{
+	UINT32 index;
+	size_t length;
+	wStream* s;
+	BOOL rc = FALSE;
+	length = SESSION_RECORD_HEADER_FIXED + settings->ChannelCount * SESSION_RECORD_CHANNEL_NAME +
+	         settings->DynamicChannelCount * SESSION_RECORD_DVC_NAME;
+
+	if (!(s = Stream_New(NULL, SESSION_RECORD_ALIGN(length))))
+		return FALSE;
+
+	Stream_Zero(s, Stream_Capacity(s));
+	Stream_SetPosition(s, 0);
+	Stream_Write(s, SESSION_RECORD_MAGIC, 8);
+	Stream_Write_UINT32(s, SESSION_RECORD_VERSION);
+	Stream_Write_UINT32(s, (UINT32) Stream_Capacity(s));
+	Stream_Write_UINT32(s, settings->RequestedProtocols);
+	Stream_Write_UINT32(s, settings->SelectedProtocol);
+	Stream_Write_UINT32(s, settings->NegotiationFlags);
+	Stream_Write_UINT32(s, settings->ChannelCount);
+	Stream_Write_UINT32(s, settings->DynamicChannelCount);
+
+	for (index = 0; index < settings->ChannelCount; index++)
+	{
+		const char* name = settings->ChannelDefArray[index].name;
+		CopyMemory(Stream_Pointer(s), name, strnlen(name, SESSION_RECORD_CHANNEL_NAME - 1));
+		Stream_Seek(s, SESSION_RECORD_CHANNEL_NAME);
+	}
+
+	for (index = 0; index < settings->DynamicChannelCount; index++)
+	{
+		ADDIN_ARGV* args = settings->DynamicChannelArray[index];
+
+		if (args && (args->argc > 0))
+			CopyMemory(Stream_Pointer(s), args->argv[0],
+			           strnlen(args->argv[0], SESSION_RECORD_DVC_NAME - 1));
+
+		Stream_Seek(s, SESSION_RECORD_DVC_NAME);
+	}
+
+	rc = fwrite(Stream_Buffer(s), Stream_Capacity(s), 1, recorder->fp) == 1;
+	Stream_Free(s, TRUE);
+	return rc;
+}
+
+void session_recorder_add(rdpSessionRecorder* recorder, rdpRdp* rdp, wStream* s)
+{
+	BYTE header[SESSION_RECORD_RECORD_HEADER];
+	const BYTE padding[8] = { 0 };
+	const size_t length = Stream_Length(s);
+	wStream sbuffer;
+	wStream* hs;
+
+	if (!recorder || recorder->stopped)
+		return;
+
+	/* NLA messages are bound to this connection's credentials and can't be replayed */
+	if (rdp->state < CONNECTION_STATE_MCS_CONNECT)
+		return;
+
+	if (!recorder->started)
+	{
+		/* standard RDP security encrypts with keys derived from the client random */
+		if (rdp->settings->UseRdpSecurityLayer)
+		{
+			WLog_WARN(TAG, "sessions using standard RDP security can't be recorded");
+			session_recorder_stop(recorder);
+			return;
+		}
+
+		if (!session_recorder_write_header(recorder, rdp->settings))
+			goto fail;
+
+		recorder->start = session_record_time();
+		recorder->started = TRUE;
+	}
+
+	hs = session_record_stream(&sbuffer, header, sizeof(header));
+	Stream_Write_UINT64(hs, session_record_time() - recorder->start);
+	Stream_Write_UINT32(hs, (UINT32) length);
+	Stream_Write_UINT32(hs, 0); /* reserved */
+	recorder->pdu = NULL;
+
+	if (fwrite(header, sizeof(header), 1, recorder->fp) != 1)
+		goto fail;
+
+	if (((recorder->pduOffset = ftell(recorder->fp)) < 0) ||
+	    (fwrite(Stream_Buffer(s), length, 1, recorder->fp) != 1))
+		goto fail;
+
+	recorder->pdu = Stream_Buffer(s);
+	recorder->pduLength = length;
+
+	if ((SESSION_RECORD_ALIGN(length) > length) &&
+	    (fwrite(padding, SESSION_RECORD_ALIGN(length) - length, 1, recorder->fp) != 1))
+		goto fail;
+
+	recorder->records++;
+	return;
+fail:
+	WLog_ERR(TAG, "failed to write session recording %s, recording stopped", recorder->filename);
+	session_recorder_stop(recorder);
+}
+
+/**
+ * Blanks secrets in the PDU recorded last, data points into the stream
+ * that was passed to session_recorder_add. Data the client only sees after
+ * decompression can't be blanked in the recording, which then keeps it.
+ */
+void session_recorder_redact(rdpSessionRecorder* recorder, const BYTE* data, size_t length)
+{
+	size_t offset;
+	const BYTE zero[32] = { 0 };
+
+	if (!recorder || !recorder->fp || !recorder->pdu)
+		return;
+
+	if ((data < recorder->pdu) || (data >= recorder->pdu + recorder->pduLength) ||
+	    (length > (size_t)(recorder->pdu + recorder->pduLength - data)))
+	{
+		WLog_WARN(TAG, "secret not found in the recorded PDU, %s keeps it", recorder->filename);
+		return;
+	}
+
+	offset = (size_t)(data - recorder->pdu);
+
+	if (fseek(recorder->fp, recorder->pduOffset + (long) offset, SEEK_SET) != 0)
+		goto fail;
+
+	while (length > 0)
+	{
+		const size_t count = MIN(length, sizeof(zero));
+
+		if (fwrite(zero, count, 1, recorder->fp) != 1)
+			goto fail;
+
+		length -= count;
+	}
+
+	if (fseek(recorder->fp, 0, SEEK_END) != 0)
+		goto fail;
+
+	return;
+fail:
+	WLog_ERR(TAG, "failed to write session recording %s, recording stopped", recorder->filename);
+	session_recorder_stop(recorder);
+}
+
+static void session_player_free(rdpSessionPlayer* player)
+{
+	if (!player)
+		return;
+
+#ifdef _WIN32
+
+	if (player->data)
+		UnmapViewOfFile(player->data);
+
+	if (player->mapping)
+		CloseHandle(player->mapping);
+
+	if (player->file && (player->file != INVALID_HANDLE_VALUE))
+		CloseHandle(player->file);
+
+#else
+
+	if (player->data)
+		munmap(player->data, player->size);
+
+#endif
+
+	if (player->event)
+		CloseHandle(player->event);
+
+	free(player);
+}
+
+static rdpSessionPlayer* session_player_new(const char* filename, BOOL realtime)
+{
+	rdpSessionPlayer* player = (rdpSessionPlayer*) calloc(1, sizeof(rdpSessionPlayer));
+
+	if (!player)
+		return NULL;
+
+	player->realtime = realtime;
+
+	/* there is always data to read, until the end of the recording */
+	if (!(player->event = CreateEvent(NULL, TRUE, TRUE, NULL)))
+		goto fail;
+
+#ifdef _WIN32
+	{
+		LARGE_INTEGER size;
+		player->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		                           FILE_ATTRIBUTE_NORMAL, NULL);
+
+		if ((player->file == INVALID_HANDLE_VALUE) || !GetFileSizeEx(player->file, &size))
+			goto fail_open;
+
+		player->size = (size_t) size.QuadPart;
+
+		if (!(player->mapping = CreateFileMappingA(player->file, NULL, PAGE_WRITECOPY, 0, 0, NULL)))
+			goto fail_open;
+
+		if (!(player->data = (BYTE*) MapViewOfFile(player->mapping, FILE_MAP_COPY, 0, 0, 0)))
+			goto fail_open;
+	}
+#else
+	{
+		struct stat st;
+		void* data;
+		int fd = open(filename, O_RDONLY);
+
+		if (fd < 0)
+			goto fail_open;
+
+		if ((fstat(fd, &st) < 0) || (st.st_size <= 0))
+		{
+			close(fd);
+			goto fail_open;
+		}
+
+		/* private and writable: PDU parsers are free to scribble on their input */
+		data = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if (data == MAP_FAILED)
+			goto fail_open;
+
+		player->data = (BYTE*) data;
+		player->size = (size_t) st.st_size;
+	}
+#endif
+	return player;
+fail_open:
+	WLog_ERR(TAG, "failed to open session recording %s", filename);
+fail:
+	session_player_free(player);
+	return NULL;
+}
+
+static BOOL session_player_find_channel(const char* names, UINT32 count, size_t size,
+                                        const char* name)
+{
+	UINT32 index;
+
+	for (index = 0; index < count; index++)
+	{
+		if (strncmp(&names[index * size], name, size - 1) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * The recording is only meaningful for a client that joins the same
+ * channels in the same order, as the server addressed them by id.
+ */
+static BOOL session_player_read_header(rdpSessionPlayer* player, rdpSettings* settings)
+{
+	UINT32 index;
+	UINT32 version;
+	UINT32 headerLength;
+	UINT32 channelCount;
+	UINT32 dynamicChannelCount;
+	const char* names;
+	wStream sbuffer;
+	wStream* s;
+
+	if (player->size < SESSION_RECORD_HEADER_FIXED)
+		goto invalid;
+
+	s = session_record_stream(&sbuffer, player->data, player->size);
+
+	if (memcmp(Stream_Pointer(s), SESSION_RECORD_MAGIC, 8) != 0)
+		goto invalid;
+
+	Stream_Seek(s, 8);
+	Stream_Read_UINT32(s, version);
+	Stream_Read_UINT32(s, headerLength);
+
+	if ((version != SESSION_RECORD_VERSION) || (headerLength > player->size) ||
+	    (headerLength != SESSION_RECORD_ALIGN(headerLength)))
+		goto invalid;
+
+	Stream_Read_UINT32(s, settings->RequestedProtocols);
+	Stream_Read_UINT32(s, settings->SelectedProtocol);
+	Stream_Read_UINT32(s, settings->NegotiationFlags);
+	Stream_Read_UINT32(s, channelCount);
+	Stream_Read_UINT32(s, dynamicChannelCount);
+
+	if ((channelCount > 31) || (dynamicChannelCount > 256) ||
+	    (SESSION_RECORD_HEADER_FIXED + channelCount * SESSION_RECORD_CHANNEL_NAME +
+	     dynamicChannelCount * SESSION_RECORD_DVC_NAME > headerLength))
+		goto invalid;
+
+	names = (const char*) Stream_Pointer(s);
+
+	if (channelCount != settings->ChannelCount)
+		goto mismatch;
+
+	for (index = 0; index < channelCount; index++)
+	{
+		if (strncmp(&names[index * SESSION_RECORD_CHANNEL_NAME],
+		            settings->ChannelDefArray[index].name, SESSION_RECORD_CHANNEL_NAME - 1) != 0)
+			goto mismatch;
+	}
+
+	names += channelCount * SESSION_RECORD_CHANNEL_NAME;
+
+	/* dynamic channels are opened by name, only the set matters */
+	for (index = 0; index < dynamicChannelCount; index++)
+	{
+		const char* name = &names[index * SESSION_RECORD_DVC_NAME];
+
+		if (!freerdp_dynamic_channel_collection_find(settings, name))
+			WLog_WARN(TAG, "dynamic channel %.*s of the recording is not loaded",
+			          SESSION_RECORD_DVC_NAME, name);
+	}
+
+	for (index = 0; index < settings->DynamicChannelCount; index++)
+	{
+		ADDIN_ARGV* args = settings->DynamicChannelArray[index];
+
+		if (args && (args->argc > 0) &&
+		    !session_player_find_channel(names, dynamicChannelCount, SESSION_RECORD_DVC_NAME,
+		                                 args->argv[0]))
+			WLog_WARN(TAG, "dynamic channel %s was not loaded by the recorded client", args->argv[0]);
+	}
+
+	player->offset = headerLength;
+	player->remaining = 0;
+
+	if (settings->SelectedProtocol == PROTOCOL_RDP)
+		goto invalid;
+
+	return TRUE;
+mismatch:
+	WLog_ERR(TAG, "the static channels of the recording don't match the client's:");
+
+	for (index = 0; index < channelCount; index++)
+		WLog_ERR(TAG, "  recorded channel %"PRIu32": %.*s", index, SESSION_RECORD_CHANNEL_NAME - 1,
+		         &names[index * SESSION_RECORD_CHANNEL_NAME]);
+
+	for (index = 0; index < settings->ChannelCount; index++)
+		WLog_ERR(TAG, "  client channel %"PRIu32": %s", index, settings->ChannelDefArray[index].name);
+
+	return FALSE;
+invalid:
+	WLog_ERR(TAG, "invalid session recording %s", settings->PlaySessionFile);
+	return FALSE;
+}
+
+/* Moves to the next record, returns FALSE at the end of the recording */
+static BOOL session_player_next(rdpSessionPlayer* player)
+{
+	UINT64 timestamp;
+	UINT32 length;
+	wStream sbuffer;
+	wStream* s;
+
+	if ((player->offset >= player->size) ||
+	    (player->size - player->offset < SESSION_RECORD_RECORD_HEADER))
+		return FALSE;
+
+	s = session_record_stream(&sbuffer, &player->data[player->offset], SESSION_RECORD_RECORD_HEADER);
+	Stream_Read_UINT64(s, timestamp);
+	Stream_Read_UINT32(s, length);
+
+	if (length > player->size - player->offset - SESSION_RECORD_RECORD_HEADER)
+	{
+		WLog_WARN(TAG, "truncated session recording, ignoring the last record");
+		player->offset = player->size;
+		return FALSE;
+	}
+
+	if (!player->records)
+		player->start = session_record_time();
+	else if (player->realtime)
+	{
+		/* blocks the caller, meant for watching a recording, not for measuring */
+		const UINT64 now = session_record_time() - player->start;
+
+		if (timestamp > now)
+			Sleep((DWORD)((timestamp - now) / 1000));
+	}
+
+	player->offset += SESSION_RECORD_RECORD_HEADER;
+	player->remaining = length;
+	player->records++;
+	return TRUE;
+}
+
+static int session_player_bio_write(BIO* bio, const char* buf, int size)
+{
+	/* whatever the client answers, the recorded server has already replied */
+	return size;
+}
+
+static int session_player_bio_read(BIO* bio, char* buf, int size)
+{
+	int length;
+	rdpSessionPlayer* player = (rdpSessionPlayer*) BIO_get_data(bio);
+	/* the recording never blocks, reaching its end closes the connection */
+	BIO_clear_flags(bio, BIO_FLAGS_READ | BIO_FLAGS_SHOULD_RETRY);
+
+	if (!player || !buf || (size <= 0))
+		return 0;
+
+	while (!player->remaining)
+	{
+		/* skip the padding of the previous record */
+		player->offset = SESSION_RECORD_ALIGN(player->offset);
+
+		if (!session_player_next(player))
+		{
+			WLog_INFO(TAG, "replayed %"PRIu64" PDUs", player->records);
+			return 0;
+		}
+	}
+
+	length = (player->remaining < (size_t) size) ? (int) player->remaining : size;
+	CopyMemory(buf, &player->data[player->offset], length);
+	player->offset += length;
+	player->remaining -= length;
+	return length;
+}
+
+static int session_player_bio_puts(BIO* bio, const char* str)
+{
+	return 1;
+}
+
+static int session_player_bio_gets(BIO* bio, char* str, int size)
+{
+	return 1;
+}
+
+static long session_player_bio_ctrl(BIO* bio, int cmd, long arg1, void* arg2)
+{
+	rdpSessionPlayer* player = (rdpSessionPlayer*) BIO_get_data(bio);
+
+	switch (cmd)
+	{
+		case BIO_C_GET_EVENT:
+			if (!player || !arg2)
+				return 0;
+
+			*((ULONG_PTR*) arg2) = (ULONG_PTR) player->event;
+			return 1;
+
+		case BIO_C_SET_NONBLOCK:
+		case BIO_C_WAIT_READ:
+		case BIO_C_WAIT_WRITE:
+		case BIO_CTRL_FLUSH:
+			return 1;
+
+		case BIO_C_READ_BLOCKED:
+		case BIO_C_WRITE_BLOCKED:
+			return 0;
+
+		case BIO_CTRL_PENDING:
+			return (player && (player->remaining > 0)) ? 1 : 0;
+
+		default:
+			return 0;
+	}
+}
+
+static int session_player_bio_new(BIO* bio)
+{
+	BIO_set_init(bio, 1);
+	return 1;
+}
+
+static int session_player_bio_free(BIO* bio)
+{
+	if (!bio)
+		return 0;
+
+	session_player_free((rdpSessionPlayer*) BIO_get_data(bio));
+	BIO_set_data(bio, NULL);
+	return 1;
+}
+
+static BIO_METHOD* BIO_s_session_player(void)
+{
+	static BIO_METHOD* bio_methods = NULL;
+
+	if (bio_methods == NULL)
+	{
+		if (!(bio_methods = BIO_meth_new(BIO_TYPE_SESSION_PLAYER, "SessionPlayer")))
+			return NULL;
+
+		BIO_meth_set_write(bio_methods, session_player_bio_write);
+		BIO_meth_set_read(bio_methods, session_player_bio_read);
+		BIO_meth_set_puts(bio_methods, session_player_bio_puts);
+		BIO_meth_set_gets(bio_methods, session_player_bio_gets);
+		BIO_meth_set_ctrl(bio_methods, session_player_bio_ctrl);
+		BIO_meth_set_create(bio_methods, session_player_bio_new);
+		BIO_meth_set_destroy(bio_methods, session_player_bio_free);
+	}
+
+	return bio_methods;
+}
+
+BOOL session_player_connect(rdpRdp* rdp)
+{
+	BIO* bio;
+	rdpSettings* settings = rdp->settings;
+	rdpSessionPlayer* player = session_player_new(settings->PlaySessionFile,
+	                           settings->PlaySessionRealTime);
+
+	if (!player)
+		return FALSE;
+
+	if (!session_player_read_header(player, settings))
+	{
+		session_player_free(player);
+		return FALSE;
+	}
+
+	if (!(bio = BIO_new(BIO_s_session_player())))
+	{
+		session_player_free(player);
+		return FALSE;
+	}
+
+	BIO_set_data(bio, player);
+	rdp->nego->RequestedProtocols = settings->RequestedProtocols;
+	rdp->nego->SelectedProtocol = settings->SelectedProtocol;
+	rdp->nego->flags = settings->NegotiationFlags;
+	rdp->nego->state = NEGO_STATE_FINAL;
+	rdp->nego->TcpConnected = TRUE;
+	rdp->nego->SecurityConnected = TRUE;
+	rdp->transport->frontBio = bio;
+	rdp->transport->layer = TRANSPORT_LAYER_TCP;
+	WLog_INFO(TAG, "replaying session recording %s%s", settings->PlaySessionFile,
+	          settings->PlaySessionRealTime ? " in real time" : "");
+	return TRUE;
+}
@@ -0,0 +1,59 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Session Recording and Replay
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RECORD_H
+#define __RECORD_H
+
+typedef struct rdp_session_recorder rdpSessionRecorder;
+
+#include "rdp.h"
+
+#include <freerdp/api.h>
+
+#include <winpr/stream.h>
+
+/**
+ * A session recording holds every PDU the client received after the
+ * security layer, starting with the MCS connect response, so that the
+ * connection sequence and the session can be replayed without a server:
+ *
+ * header:  "FRDPSREC" | version (4) | header length (4)
+ *          | requested protocols (4) | selected protocol (4) | negotiation flags (4)
+ *          | static channel count (4) | dynamic channel count (4)
+ *          | static channel names (8 each) | dynamic channel names (16 each)
+ * records: timestamp in us (8) | length (4) | reserved (4) | PDU | padding to 8
+ *
+ * All fields are little endian and records are 8 byte aligned, so that a
+ * recording can be memory mapped and walked in place.
+ */
+
+#define SESSION_RECORD_MAGIC		"FRDPSREC"
+#define SESSION_RECORD_VERSION		1
+#define SESSION_RECORD_CHANNEL_NAME	8
+#define SESSION_RECORD_DVC_NAME		16
+
+FREERDP_LOCAL rdpSessionRecorder* session_recorder_new(const char* filename);
+FREERDP_LOCAL void session_recorder_free(rdpSessionRecorder* recorder);
+FREERDP_LOCAL void session_recorder_add(rdpSessionRecorder* recorder, rdpRdp* rdp, wStream* s);
+FREERDP_LOCAL void session_recorder_stop(rdpSessionRecorder* recorder);
+FREERDP_LOCAL void session_recorder_redact(rdpSessionRecorder* recorder, const BYTE* data,
+        size_t length);
+
+/* Replaces the network by the recording given in the settings */
+FREERDP_LOCAL BOOL session_player_connect(rdpRdp* rdp);
+
+#endif /* __RECORD_H */
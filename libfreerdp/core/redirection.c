@@ -364,6 +364,9 @@ static BOOL rdp_recv_server_redirection_pdu(rdpRdp* rdp, wStream* s)
 		if (!redirection->Password)
 			return -1;
 		Stream_Read(s, redirection->Password, redirection->PasswordLength);
+		/* the cookie logs on to the redirection target like a password */
+		session_recorder_redact(rdp->recorder, Stream_Pointer(s) - redirection->PasswordLength,
+		                        redirection->PasswordLength);
 
 		WLog_DBG(TAG, "PasswordCookie:");
 		winpr_HexDump(TAG, WLOG_DEBUG, redirection->Password, redirection->PasswordLength);
@@ -34,6 +34,8 @@
 #include <freerdp/log.h>
 #include <freerdp/constants.h>
 #include <freerdp/server/channels.h>
+#include <freerdp/channels/rdpgfx.h>
+#include <freerdp/channels/tsmf.h>
 
 #include "rdp.h"
 
@@ -153,6 +155,7 @@ static BOOL wts_read_drdynvc_capabilities_response(rdpPeerChannel* channel,
 	Stream_Seek_UINT8(channel->receiveData); /* Pad (1 byte) */
 	Stream_Read_UINT16(channel->receiveData, Version);
 	DEBUG_DVC("Version: %"PRIu16"", Version);
+	channel->vcm->drdynvc_version = Version;
 	channel->vcm->drdynvc_state = DRDYNVC_STATE_READY;
 	return TRUE;
 }
@@ -238,6 +241,95 @@ static BOOL wts_read_drdynvc_data(rdpPeerChannel* channel, wStream* s,
 	return ret;
 }
 
+/**
+ * DATA_FIRST_COMPRESSED and DATA_COMPRESSED PDUs carry one RDP 8.0 Lite segment,
+ * decompressed with a per channel history and then handled like plain data.
+ */
+static BOOL wts_read_drdynvc_data_compressed(rdpPeerChannel* channel, wStream* s,
+        int cbLen, UINT32 length, BOOL first)
+{
+	int value;
+	UINT32 size;
+
+	if (first)
+	{
+		value = wts_read_variable_uint(s, cbLen, &channel->dvc_total_length);
+
+		if (value == 0)
+			return FALSE;
+
+		length -= value;
+	}
+
+	if (!channel->decompressor)
+	{
+		channel->decompressor = zgfx_lite_context_new(FALSE);
+
+		if (!channel->decompressor)
+			return FALSE;
+	}
+
+	if (!channel->decompressData)
+	{
+		channel->decompressData = Stream_New(NULL, ZGFX_SEGMENTED_MAXSIZE);
+
+		if (!channel->decompressData)
+			return FALSE;
+	}
+
+	Stream_SetPosition(channel->decompressData, 0);
+
+	if (zgfx_decompress_segment_to_stream(channel->decompressor, channel->decompressData,
+	                                      Stream_Pointer(s), length) < 0)
+	{
+		WLog_ERR(TAG, "failed to decompress ChannelId %"PRIu32" data", channel->channelId);
+		return FALSE;
+	}
+
+	size = (UINT32) Stream_GetPosition(channel->decompressData);
+	Stream_SetPosition(channel->decompressData, 0);
+
+	if (first)
+	{
+		if (size > channel->dvc_total_length)
+			return FALSE;
+
+		Stream_SetPosition(channel->receiveData, 0);
+
+		if (!Stream_EnsureRemainingCapacity(channel->receiveData,
+		                                    (int) channel->dvc_total_length))
+			return FALSE;
+
+		Stream_Write(channel->receiveData, Stream_Buffer(channel->decompressData), size);
+		return TRUE;
+	}
+
+	return wts_read_drdynvc_data(channel, channel->decompressData, size);
+}
+
+/**
+ * Channels carrying already compressed payloads (zgfx bulk data for the
+ * graphics pipeline, encoded media samples for TSMF) only pay the CPU cost of
+ * another compression pass, so they are sent as plain data PDUs.
+ */
+static BOOL wts_drdynvc_channel_compressible(const char* name)
+{
+	if (strcmp(name, RDPGFX_DVC_CHANNEL_NAME) == 0)
+		return FALSE;
+
+	if (strcmp(name, TSMF_DVC_CHANNEL_NAME) == 0)
+		return FALSE;
+
+	return TRUE;
+}
+
+static BOOL wts_drdynvc_compression_enabled(rdpPeerChannel* channel)
+{
+	WTSVirtualChannelManager* vcm = channel->vcm;
+	return channel->compress && (vcm->drdynvc_version >= 3) &&
+	       vcm->client->settings->SupportDynamicChannelCompression;
+}
+
 static void wts_read_drdynvc_close_response(rdpPeerChannel* channel)
 {
 	DEBUG_DVC("ChannelId %"PRIu32" close response", channel->channelId);
@@ -293,6 +385,12 @@ static BOOL wts_read_drdynvc_pdu(rdpPeerChannel* channel)
 				case DATA_PDU:
 					return wts_read_drdynvc_data(dvc, channel->receiveData, length);
 
+				case DATA_FIRST_COMPRESSED_PDU:
+					return wts_read_drdynvc_data_compressed(dvc, channel->receiveData, Sp, length, TRUE);
+
+				case DATA_COMPRESSED_PDU:
+					return wts_read_drdynvc_data_compressed(dvc, channel->receiveData, Sp, length, FALSE);
+
 				case CLOSE_REQUEST_PDU:
 					wts_read_drdynvc_close_response(dvc);
 					break;
@@ -462,7 +560,6 @@ BOOL WTSVirtualChannelManagerCheckFileDescriptor(HANDLE hServer)
 	wMessage message;
 	BOOL status = TRUE;
 	rdpPeerChannel* channel;
-	UINT32 dynvc_caps;
 	WTSVirtualChannelManager* vcm = (WTSVirtualChannelManager*) hServer;
 
 	if ((vcm->drdynvc_state == DRDYNVC_STATE_NONE) && vcm->client->activated)
@@ -475,11 +572,35 @@ BOOL WTSVirtualChannelManagerCheckFileDescriptor(HANDLE hServer)
 		if (channel)
 		{
 			ULONG written;
+			BOOL rc;
+			wStream* s = Stream_New(NULL, 12);
+
+			if (!s)
+				return FALSE;
+
 			vcm->drdynvc_channel = channel;
-			dynvc_caps = 0x00010050; /* DYNVC_CAPS_VERSION1 (4 bytes) */
+			Stream_Write_UINT8(s, 0x50); /* Cmd+Sp+cbChId */
+			Stream_Write_UINT8(s, 0x00); /* Pad */
+
+			if (vcm->client->settings->SupportDynamicChannelCompression)
+			{
+				/* DYNVC_CAPS_VERSION3 (12 bytes), enables compressed data PDUs */
+				Stream_Write_UINT16(s, 3);
+				Stream_Write_UINT16(s, 936); /* PriorityCharge0 */
+				Stream_Write_UINT16(s, 3276); /* PriorityCharge1 */
+				Stream_Write_UINT16(s, 9362); /* PriorityCharge2 */
+				Stream_Write_UINT16(s, 21845); /* PriorityCharge3 */
+			}
+			else
+			{
+				Stream_Write_UINT16(s, 1); /* DYNVC_CAPS_VERSION1 (4 bytes) */
+			}
+
+			rc = WTSVirtualChannelWrite(channel, (PCHAR) Stream_Buffer(s),
+			                            (ULONG) Stream_GetPosition(s), &written);
+			Stream_Free(s, TRUE);
 
-			if (!WTSVirtualChannelWrite(channel, (PCHAR) &dynvc_caps, sizeof(dynvc_caps),
-			                            &written))
+			if (!rc)
 				return FALSE;
 		}
 	}
@@ -1131,6 +1252,7 @@ HANDLE WINAPI FreeRDP_WTSVirtualChannelOpenEx(DWORD SessionId,
 	channel->vcm = vcm;
 	channel->client = client;
 	channel->channelType = RDP_PEER_CHANNEL_TYPE_DVC;
+	channel->compress = wts_drdynvc_channel_compressible(pVirtualName);
 	channel->receiveData = Stream_New(NULL,
 	                                  client->settings->VirtualChannelChunkSize);
 
@@ -1223,6 +1345,10 @@ BOOL WINAPI FreeRDP_WTSVirtualChannelClose(HANDLE hChannelHandle)
 		if (channel->receiveData)
 			Stream_Free(channel->receiveData, TRUE);
 
+		Stream_Free(channel->decompressData, TRUE);
+		zgfx_lite_context_free(channel->compressor);
+		zgfx_lite_context_free(channel->decompressor);
+
 		if (channel->queue)
 		{
 			MessageQueue_Free(channel->queue);
@@ -1314,6 +1440,21 @@ BOOL WINAPI FreeRDP_WTSVirtualChannelWrite(HANDLE hChannelHandle, PCHAR Buffer,
 	}
 	else
 	{
+		/* compressed PDUs need one spare byte for the segment header */
+		const BOOL compress = wts_drdynvc_compression_enabled(channel);
+		const UINT32 headroom = compress ? 1 : 0;
+
+		if (compress && !channel->compressor)
+		{
+			channel->compressor = zgfx_lite_context_new(TRUE);
+
+			if (!channel->compressor)
+			{
+				SetLastError(E_OUTOFMEMORY);
+				return FALSE;
+			}
+		}
+
 		first = TRUE;
 
 		while (Length > 0)
@@ -1331,23 +1472,45 @@ BOOL WINAPI FreeRDP_WTSVirtualChannelWrite(HANDLE hChannelHandle, PCHAR Buffer,
 			Stream_Seek_UINT8(s);
 			cbChId = wts_write_variable_uint(s, channel->channelId);
 
-			if (first && (Length > (UINT32) Stream_GetRemainingLength(s)))
+			if (first && (Length > (UINT32) Stream_GetRemainingLength(s) - headroom))
 			{
 				cbLen = wts_write_variable_uint(s, Length);
-				buffer[0] = (DATA_FIRST_PDU << 4) | (cbLen << 2) | cbChId;
+				buffer[0] = ((compress ? DATA_FIRST_COMPRESSED_PDU : DATA_FIRST_PDU) << 4) |
+				            (cbLen << 2) | cbChId;
 			}
 			else
 			{
-				buffer[0] = (DATA_PDU << 4) | cbChId;
+				buffer[0] = ((compress ? DATA_COMPRESSED_PDU : DATA_PDU) << 4) | cbChId;
 			}
 
 			first = FALSE;
-			written = Stream_GetRemainingLength(s);
+			written = Stream_GetRemainingLength(s) - headroom;
 
 			if (written > Length)
 				written = Length;
 
-			Stream_Write(s, Buffer, written);
+			if (compress && (written > ZGFX_LITE_HISTORY_SIZE))
+				written = ZGFX_LITE_HISTORY_SIZE;
+
+			if (compress)
+			{
+				UINT32 flags = 0;
+
+				if (zgfx_compress_segment_to_stream(channel->compressor, s, (BYTE*) Buffer, written,
+				                                    &flags) < 0)
+				{
+					WLog_ERR(TAG, "zgfx_compress_segment_to_stream failed!");
+					Stream_Free(s, TRUE);
+					return FALSE;
+				}
+
+				buffer = Stream_Buffer(s);
+			}
+			else
+			{
+				Stream_Write(s, Buffer, written);
+			}
+
 			length = Stream_GetPosition(s);
 			Stream_Free(s, FALSE);
 			Length -= written;
@@ -24,6 +24,7 @@
 #include <freerdp/freerdp.h>
 #include <freerdp/api.h>
 #include <freerdp/channels/wtsvc.h>
+#include <freerdp/codec/zgfx.h>
 
 #include <winpr/synch.h>
 #include <winpr/stream.h>
@@ -40,6 +41,8 @@ typedef struct WTSVirtualChannelManager WTSVirtualChannelManager;
 #define DATA_PDU				0x03
 #define CLOSE_REQUEST_PDU			0x04
 #define CAPABILITY_REQUEST_PDU			0x05
+#define DATA_FIRST_COMPRESSED_PDU		0x06
+#define DATA_COMPRESSED_PDU			0x07
 
 enum
 {
@@ -72,6 +75,11 @@ struct rdp_peer_channel
 	BYTE dvc_open_state;
 	UINT32 dvc_total_length;
 	rdpMcsChannel* mcsChannel;
+
+	BOOL compress;
+	ZGFX_LITE_CONTEXT* compressor;
+	ZGFX_LITE_CONTEXT* decompressor;
+	wStream* decompressData;
 };
 
 struct WTSVirtualChannelManager
@@ -84,6 +92,7 @@ struct WTSVirtualChannelManager
 
 	rdpPeerChannel* drdynvc_channel;
 	BYTE drdynvc_state;
+	UINT16 drdynvc_version;
 	LONG dvc_channel_id_seq;
 
 	wArrayList* dynamicVirtualChannels;
@@ -497,6 +497,9 @@ rdpSettings* freerdp_settings_new(DWORD flags)
 	settings->RemoteAppNumIconCaches = 3;
 	settings->RemoteAppNumIconCacheEntries = 12;
 	settings->VirtualChannelChunkSize = CHANNEL_CHUNK_LENGTH;
+	settings->VirtualChannelScheduling = (flags & FREERDP_SETTINGS_SERVER_MODE) ?
+	                                     FALSE : TRUE;
+	settings->SupportDynamicChannelCompression = FALSE;
 	settings->MultifragMaxRequestSize = (flags & FREERDP_SETTINGS_SERVER_MODE) ?
 	                                    0 : 0xFFFF;
 	settings->GatewayUseSameCredentials = FALSE;
@@ -685,6 +688,8 @@ rdpSettings* freerdp_settings_clone(rdpSettings* settings)
 		CHECKED_STRDUP(CurrentPath); /* 1794 */
 		CHECKED_STRDUP(DumpRemoteFxFile); /* 1858 */
 		CHECKED_STRDUP(PlayRemoteFxFile); /* 1859 */
+		CHECKED_STRDUP(RecordSessionFile); /* 1862 */
+		CHECKED_STRDUP(PlaySessionFile); /* 1863 */
 		CHECKED_STRDUP(GatewayHostname); /* 1986 */
 		CHECKED_STRDUP(GatewayUsername); /* 1987 */
 		CHECKED_STRDUP(GatewayPassword); /* 1988 */
@@ -1089,6 +1094,8 @@ void freerdp_settings_free(rdpSettings* settings)
 	free(settings->KerberosRealm);
 	free(settings->DumpRemoteFxFile);
 	free(settings->PlayRemoteFxFile);
+	free(settings->RecordSessionFile);
+	free(settings->PlaySessionFile);
 	free(settings->RemoteApplicationName);
 	free(settings->RemoteApplicationIcon);
 	free(settings->RemoteApplicationProgram);
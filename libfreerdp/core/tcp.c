@@ -454,12 +454,23 @@ BIO_METHOD* BIO_s_simple_socket(void)
 
 /* Buffered Socket BIO */
 
+/**
+ * With read ahead enabled, reads are served from a receive buffer which is
+ * refilled with a single large read once it runs empty, so that the small
+ * header and body reads done per PDU (or per TLS record) do not each end up
+ * in a syscall. Consumers of the BIO must then keep reading until it would
+ * block (or check BIO_pending) instead of waiting for the socket again.
+ */
+#define BUFFERED_SOCKET_RECV_CHUNK	0x10000
+
 struct _WINPR_BIO_BUFFERED_SOCKET
 {
 	BIO* bufferedBio;
 	BOOL readBlocked;
 	BOOL writeBlocked;
+	BOOL readAhead;
 	RingBuffer xmitBuffer;
+	RingBuffer recvBuffer;
 };
 typedef struct _WINPR_BIO_BUFFERED_SOCKET WINPR_BIO_BUFFERED_SOCKET;
 
@@ -531,31 +542,69 @@ out:
 
 static int transport_bio_buffered_read(BIO* bio, char* buf, int size)
 {
+	int i;
 	int status;
+	int nchunks;
+	DataChunk chunks[2];
+	BYTE* recvData = NULL;
 	WINPR_BIO_BUFFERED_SOCKET* ptr = (WINPR_BIO_BUFFERED_SOCKET*) BIO_get_data(bio);
 	BIO* next_bio = BIO_next(bio);
 	ptr->readBlocked = FALSE;
 	BIO_clear_flags(bio, BIO_FLAGS_READ);
-	status = BIO_read(next_bio, buf, size);
 
-	if (status <= 0)
+	if (size <= 0)
+		return 0;
+
+	if (!ringbuffer_used(&ptr->recvBuffer))
 	{
-		if (!BIO_should_retry(next_bio))
+		/* large reads go straight to the caller, there is nothing to gain by buffering them */
+		if (!ptr->readAhead || (size >= BUFFERED_SOCKET_RECV_CHUNK))
+			status = BIO_read(next_bio, buf, size);
+		else
 		{
-			BIO_clear_flags(bio, BIO_FLAGS_SHOULD_RETRY);
-			goto out;
-		}
+			if (!(recvData = ringbuffer_ensure_linear_write(&ptr->recvBuffer,
+			                 BUFFERED_SOCKET_RECV_CHUNK)))
+				return -1;
 
-		BIO_set_flags(bio, BIO_FLAGS_SHOULD_RETRY);
+			status = BIO_read(next_bio, recvData, BUFFERED_SOCKET_RECV_CHUNK);
+		}
 
-		if (BIO_should_read(next_bio))
+		if (status <= 0)
 		{
-			BIO_set_flags(bio, BIO_FLAGS_READ);
-			ptr->readBlocked = TRUE;
+			if (!BIO_should_retry(next_bio))
+			{
+				BIO_clear_flags(bio, BIO_FLAGS_SHOULD_RETRY);
+				goto out;
+			}
+
+			BIO_set_flags(bio, BIO_FLAGS_SHOULD_RETRY);
+
+			if (BIO_should_read(next_bio))
+			{
+				BIO_set_flags(bio, BIO_FLAGS_READ);
+				ptr->readBlocked = TRUE;
+			}
+
 			goto out;
 		}
+
+		if (!recvData)
+			goto out;
+
+		if (!ringbuffer_commit_written_bytes(&ptr->recvBuffer, status))
+			return -1;
+	}
+
+	status = 0;
+	nchunks = ringbuffer_peek(&ptr->recvBuffer, chunks, size);
+
+	for (i = 0; i < nchunks; i++)
+	{
+		CopyMemory(buf + status, chunks[i].data, chunks[i].size);
+		status += chunks[i].size;
 	}
 
+	ringbuffer_commit_read_bytes(&ptr->recvBuffer, status);
 out:
 	return status;
 }
@@ -590,7 +639,20 @@ static long transport_bio_buffered_ctrl(BIO* bio, int cmd, long arg1, void* arg2
 			break;
 
 		case BIO_CTRL_PENDING:
-			status = 0;
+			status = ringbuffer_used(&ptr->recvBuffer);
+			break;
+
+		case BIO_C_WAIT_READ:
+			if (ringbuffer_used(&ptr->recvBuffer))
+				status = 1;
+			else
+				status = BIO_ctrl(BIO_next(bio), cmd, arg1, arg2);
+
+			break;
+
+		case BIO_C_SET_READ_AHEAD:
+			ptr->readAhead = arg1 ? TRUE : FALSE;
+			status = 1;
 			break;
 
 		case BIO_C_READ_BLOCKED:
@@ -624,6 +686,9 @@ static int transport_bio_buffered_new(BIO* bio)
 	if (!ringbuffer_init(&ptr->xmitBuffer, 0x10000))
 		return -1;
 
+	if (!ringbuffer_init(&ptr->recvBuffer, BUFFERED_SOCKET_RECV_CHUNK))
+		return -1;
+
 	return 1;
 }
 
@@ -639,6 +704,7 @@ static int transport_bio_buffered_free(BIO* bio)
 	}
 
 	ringbuffer_destroy(&ptr->xmitBuffer);
+	ringbuffer_destroy(&ptr->recvBuffer);
 	free(ptr);
 	return 1;
 }
@@ -50,6 +50,7 @@
 #define BIO_C_WRITE_BLOCKED		1106
 #define BIO_C_WAIT_READ			1107
 #define BIO_C_WAIT_WRITE		1108
+#define BIO_C_SET_READ_AHEAD		1109
 
 #define BIO_set_socket(b, s, c)		BIO_ctrl(b, BIO_C_SET_SOCKET, c, s);
 #define BIO_get_socket(b, c)		BIO_ctrl(b, BIO_C_GET_SOCKET, 0, (char*) c)
@@ -59,6 +60,7 @@
 #define BIO_write_blocked(b)		BIO_ctrl(b, BIO_C_WRITE_BLOCKED, 0, NULL)
 #define BIO_wait_read(b, c)		BIO_ctrl(b, BIO_C_WAIT_READ, c, NULL)
 #define BIO_wait_write(b, c)		BIO_ctrl(b, BIO_C_WAIT_WRITE, c, NULL)
+#define BIO_set_read_ahead(b, c)	BIO_ctrl(b, BIO_C_SET_READ_AHEAD, c, NULL)
 
 FREERDP_LOCAL BIO_METHOD* BIO_s_simple_socket(void);
 FREERDP_LOCAL BIO_METHOD* BIO_s_buffered_socket(void);
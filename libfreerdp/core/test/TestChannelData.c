@@ -0,0 +1,172 @@
+#include <winpr/crt.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/channels/channels.h>
+
+#include "rdp.h"
+#include "transport.h"
+
+static BOOL test_single_chunk(const BYTE* data)
+{
+	wStream* message;
+	wStream* data_in = NULL;
+
+	if (freerdp_channels_data_received(NULL, &data_in, data, 100, 100,
+	                                   CHANNEL_FLAG_FIRST | CHANNEL_FLAG_LAST, &message) != CHANNEL_RC_OK)
+		return FALSE;
+
+	if (!message || data_in || (Stream_Length(message) != 100) ||
+	    (Stream_GetPosition(message) != 0) || (memcmp(Stream_Buffer(message), data, 100) != 0))
+		return FALSE;
+
+	freerdp_channels_data_free(message);
+	return TRUE;
+}
+
+/**
+ * A single chunk received in the transport stream is handed over as a slice
+ * of that stream, which stays referenced until the message is freed.
+ */
+static BOOL test_slice(const BYTE* data)
+{
+	DWORD count;
+	wStream* rx = NULL;
+	wStream* message = NULL;
+	wStream* data_in = NULL;
+	BOOL rc = FALSE;
+	freerdp* instance = freerdp_new();
+
+	if (!instance || !freerdp_context_new(instance))
+		goto out;
+
+	if (!(rx = StreamPool_Take(instance->context->rdp->transport->ReceivePool, 3000)))
+		goto out;
+
+	CopyMemory(Stream_Buffer(rx) + 20, data, 1000);
+	count = rx->count;
+
+	if (freerdp_channels_data_received(instance->context, &data_in, Stream_Buffer(rx) + 20, 1000,
+	                                   1000, CHANNEL_FLAG_FIRST | CHANNEL_FLAG_LAST, &message) != CHANNEL_RC_OK)
+		goto out;
+
+	if (!message || data_in || message->pool || (Stream_Buffer(message) != Stream_Buffer(rx) + 20) ||
+	    (Stream_Length(message) != 1000) || (Stream_GetPosition(message) != 0) ||
+	    (rx->count != count + 1))
+		goto out;
+
+	freerdp_channels_data_free(message);
+	message = NULL;
+
+	if (rx->count != count)
+		goto out;
+
+	/* a chunk that is not in a transport stream is copied */
+	if (freerdp_channels_data_received(instance->context, &data_in, data, 1000, 1000,
+	                                   CHANNEL_FLAG_FIRST | CHANNEL_FLAG_LAST, &message) != CHANNEL_RC_OK)
+		goto out;
+
+	rc = message && message->pool && (Stream_Buffer(message) != data) &&
+	     (memcmp(Stream_Buffer(message), data, 1000) == 0) && (rx->count == count);
+out:
+	freerdp_channels_data_free(message);
+
+	if (rx)
+		Stream_Release(rx);
+
+	if (instance)
+	{
+		freerdp_context_free(instance);
+		freerdp_free(instance);
+	}
+
+	return rc;
+}
+
+static BOOL test_chunks(const BYTE* data, UINT32 length)
+{
+	UINT32 offset;
+	wStream* message = NULL;
+	wStream* data_in = NULL;
+
+	for (offset = 0; offset < length; offset += CHANNEL_CHUNK_LENGTH)
+	{
+		UINT32 flags = 0;
+		const UINT32 chunk = MIN(length - offset, CHANNEL_CHUNK_LENGTH);
+
+		if (offset == 0)
+			flags |= CHANNEL_FLAG_FIRST;
+
+		if (offset + chunk == length)
+			flags |= CHANNEL_FLAG_LAST;
+
+		if (message)
+			return FALSE;
+
+		if (freerdp_channels_data_received(NULL, &data_in, &data[offset], chunk, length, flags,
+		                                   &message) != CHANNEL_RC_OK)
+			return FALSE;
+	}
+
+	if (!message || data_in || (Stream_Length(message) != length) ||
+	    (memcmp(Stream_Buffer(message), data, length) != 0))
+		return FALSE;
+
+	freerdp_channels_data_free(message);
+	return TRUE;
+}
+
+static BOOL test_invalid(const BYTE* data)
+{
+	wStream* message;
+	wStream* data_in = NULL;
+
+	/* a chunk without the first one */
+	if (freerdp_channels_data_received(NULL, &data_in, data, 100, 200, CHANNEL_FLAG_LAST,
+	                                   &message) == CHANNEL_RC_OK)
+		return FALSE;
+
+	/* more data than declared */
+	if (freerdp_channels_data_received(NULL, &data_in, data, 150, 200, CHANNEL_FLAG_FIRST,
+	                                   &message) != CHANNEL_RC_OK)
+		return FALSE;
+
+	if (freerdp_channels_data_received(NULL, &data_in, data, 100, 200, CHANNEL_FLAG_LAST,
+	                                   &message) == CHANNEL_RC_OK)
+		return FALSE;
+
+	if (message || data_in)
+		return FALSE;
+
+	/* less data than declared */
+	if (freerdp_channels_data_received(NULL, &data_in, data, 100, 200,
+	                                   CHANNEL_FLAG_FIRST | CHANNEL_FLAG_LAST, &message) == CHANNEL_RC_OK)
+		return FALSE;
+
+	return !message && !data_in;
+}
+
+int TestChannelData(int argc, char* argv[])
+{
+	int index;
+	BYTE data[5000];
+
+	for (index = 0; index < sizeof(data); index++)
+		data[index] = (BYTE)(index * 7);
+
+	if (!test_single_chunk(data))
+		return -1;
+
+	if (!test_slice(data))
+		return -1;
+
+	if (!test_chunks(data, sizeof(data)))
+		return -1;
+
+	if (!test_chunks(data, 2 * CHANNEL_CHUNK_LENGTH))
+		return -1;
+
+	if (!test_invalid(data))
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,362 @@
+#include <winpr/crt.h>
+
+#include <openssl/bio.h>
+
+#include <freerdp/freerdp.h>
+
+#include "rdp.h"
+#include "channels.h"
+#include "transport.h"
+
+#define TEST_CHANNEL_AUDIO	1004
+#define TEST_CHANNEL_BULK	1005
+#define TEST_CHANNEL_DVC	1006
+#define TEST_CHANNEL_PLUGIN	1007
+
+/* TPKT, X.224 data and the MCS send data request written by rdp_write_header */
+#define TEST_PDU_HEADER_LENGTH	15
+
+#define TEST_MAX_CHUNKS	1024
+
+struct test_chunk
+{
+	UINT16 channelId;
+	UINT32 flags;
+	UINT32 length;
+};
+
+static struct test_chunk g_Chunks[TEST_MAX_CHUNKS];
+static UINT32 g_ChunkCount = 0;
+
+static int test_bio_write(BIO* bio, const char* buf, int size)
+{
+	wStream* s;
+	struct test_chunk* chunk;
+
+	if ((size < TEST_PDU_HEADER_LENGTH + 8) || (g_ChunkCount >= TEST_MAX_CHUNKS))
+		return -1;
+
+	s = Stream_New((BYTE*) buf, size);
+
+	if (!s)
+		return -1;
+
+	chunk = &g_Chunks[g_ChunkCount++];
+	Stream_SetPosition(s, 10);
+	Stream_Read_UINT16_BE(s, chunk->channelId);
+	Stream_SetPosition(s, TEST_PDU_HEADER_LENGTH + 4);
+	Stream_Read_UINT32(s, chunk->flags);
+	chunk->length = size - TEST_PDU_HEADER_LENGTH - 8;
+	Stream_Free(s, FALSE);
+	return size;
+}
+
+static long test_bio_ctrl(BIO* bio, int cmd, long arg1, void* arg2)
+{
+	return (cmd == BIO_CTRL_FLUSH) ? 1 : 0;
+}
+
+static int test_bio_new(BIO* bio)
+{
+	BIO_set_init(bio, 1);
+	return 1;
+}
+
+static BIO_METHOD* test_bio_method(void)
+{
+	static BIO_METHOD* method = NULL;
+
+	if (!method)
+	{
+		method = BIO_meth_new(BIO_TYPE_SOURCE_SINK, "TestChannelScheduler");
+
+		if (!method)
+			return NULL;
+
+		BIO_meth_set_write(method, test_bio_write);
+		BIO_meth_set_ctrl(method, test_bio_ctrl);
+		BIO_meth_set_create(method, test_bio_new);
+	}
+
+	return method;
+}
+
+static UINT32 test_sent_bytes(UINT16 channelId, UINT32 first, UINT32 last)
+{
+	UINT32 index;
+	UINT32 bytes = 0;
+
+	for (index = first; index < last; index++)
+	{
+		if (g_Chunks[index].channelId == channelId)
+			bytes += g_Chunks[index].length;
+	}
+
+	return bytes;
+}
+
+static BOOL test_send(rdpRdp* rdp, UINT16 channelId, BYTE* data, UINT32 length, UINT32 count)
+{
+	UINT32 index;
+
+	for (index = 0; index < count; index++)
+	{
+		if (!freerdp_channel_send(rdp, channelId, data, length))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static rdpRdp* test_setup(freerdp* instance)
+{
+	rdpRdp* rdp;
+	rdpMcs* mcs;
+
+	if (!freerdp_context_new(instance))
+		return NULL;
+
+	rdp = instance->context->rdp;
+	mcs = rdp->mcs;
+	rdp->settings->VirtualChannelScheduling = TRUE;
+	rdp->settings->VirtualChannelChunkSize = CHANNEL_CHUNK_LENGTH;
+	strncpy(mcs->channels[0].Name, "rdpsnd", 8);
+	mcs->channels[0].ChannelId = TEST_CHANNEL_AUDIO;
+	strncpy(mcs->channels[1].Name, "cliprdr", 8);
+	mcs->channels[1].ChannelId = TEST_CHANNEL_BULK;
+	strncpy(mcs->channels[2].Name, "drdynvc", 8);
+	mcs->channels[2].ChannelId = TEST_CHANNEL_DVC;
+	strncpy(mcs->channels[3].Name, "plugin", 8);
+	mcs->channels[3].ChannelId = TEST_CHANNEL_PLUGIN;
+	mcs->channelCount = 4;
+	rdp->transport->frontBio = BIO_new(test_bio_method());
+
+	if (!rdp->transport->frontBio)
+		return NULL;
+
+	g_ChunkCount = 0;
+	return rdp;
+}
+
+/**
+ * One round sends weight * quantum bytes per flow, audio (weight 4) ahead of
+ * bulk data (weight 1).
+ */
+static BOOL test_weights(rdpRdp* rdp, BYTE* data)
+{
+	UINT32 index;
+	UINT32 audio;
+	UINT32 bulk;
+
+	if (!test_send(rdp, TEST_CHANNEL_BULK, data, 8192, 8))
+		return FALSE;
+
+	if (!test_send(rdp, TEST_CHANNEL_AUDIO, data, 8192, 8))
+		return FALSE;
+
+	if (g_ChunkCount != 0)
+		return FALSE;
+
+	if (!channel_scheduler_check(rdp->channelScheduler))
+		return FALSE;
+
+	audio = test_sent_bytes(TEST_CHANNEL_AUDIO, 0, g_ChunkCount);
+	bulk = test_sent_bytes(TEST_CHANNEL_BULK, 0, g_ChunkCount);
+
+	if ((audio != 4 * 8192) || (bulk != 8192))
+	{
+		fprintf(stderr, "unexpected round: audio %"PRIu32" bulk %"PRIu32"\n", audio, bulk);
+		return FALSE;
+	}
+
+	for (index = 0; index < g_ChunkCount; index++)
+	{
+		if ((g_Chunks[index].channelId == TEST_CHANNEL_BULK) &&
+		    (test_sent_bytes(TEST_CHANNEL_AUDIO, index, g_ChunkCount) > 0))
+			return FALSE;
+	}
+
+	while (test_sent_bytes(TEST_CHANNEL_AUDIO, 0, g_ChunkCount) < 8 * 8192)
+	{
+		if (!channel_scheduler_check(rdp->channelScheduler))
+			return FALSE;
+	}
+
+	return test_sent_bytes(TEST_CHANNEL_BULK, 0, g_ChunkCount) == 2 * 8192;
+}
+
+/**
+ * Unknown channels are bulk data, a priority set later on is the one reported.
+ */
+static BOOL test_priority(rdpRdp* rdp)
+{
+	rdpChannelQueueMetrics metrics;
+
+	if (!freerdp_channel_get_queue_metrics(rdp->context, "plugin", &metrics) ||
+	    (metrics.priority != FREERDP_CHANNEL_PRIORITY_BULK))
+		return FALSE;
+
+	if (!freerdp_channel_set_priority(rdp->context, "plugin", FREERDP_CHANNEL_PRIORITY_AUDIO))
+		return FALSE;
+
+	if (!freerdp_channel_get_queue_metrics(rdp->context, "plugin", &metrics) ||
+	    (metrics.priority != FREERDP_CHANNEL_PRIORITY_AUDIO))
+		return FALSE;
+
+	return freerdp_channel_get_queue_metrics(rdp->context, "drdynvc", &metrics) &&
+	       (metrics.priority == FREERDP_CHANNEL_PRIORITY_GFX);
+}
+
+/**
+ * A dynamic channel waiting for another one to finish a message on drdynvc
+ * has nothing sendable and earns no deficit, so it does not burst once the
+ * static channel is free again.
+ */
+static BOOL test_blocked_deficit(rdpRdp* rdp, BYTE* data)
+{
+	UINT32 first;
+	UINT32 round = 2 * 8192; /* weight of the GFX class */
+	data[0] = 0x30; /* DATA_PDU, one byte channel id */
+	data[1] = 0x07;
+
+	if (!test_send(rdp, TEST_CHANNEL_DVC, data, 20000, 1))
+		return FALSE;
+
+	data[1] = 0x08;
+
+	if (!test_send(rdp, TEST_CHANNEL_DVC, data, 1000, 64))
+		return FALSE;
+
+	/* the first message holds drdynvc, the second channel is blocked */
+	first = g_ChunkCount;
+
+	if (!channel_scheduler_check(rdp->channelScheduler))
+		return FALSE;
+
+	if (test_sent_bytes(TEST_CHANNEL_DVC, first, g_ChunkCount) > round)
+		return FALSE;
+
+	/* the first message completes, the second channel gets a single round */
+	first = g_ChunkCount;
+
+	if (!channel_scheduler_check(rdp->channelScheduler))
+		return FALSE;
+
+	/* the 4000 bytes left of the first message, 10 chunks were sent */
+	if (test_sent_bytes(TEST_CHANNEL_DVC, first, g_ChunkCount) > 4000 + round)
+		return FALSE;
+
+	return channel_scheduler_flush(rdp->channelScheduler);
+}
+
+/**
+ * The flow of a dynamic channel goes away once its close PDU is sent.
+ */
+static BOOL test_dvc_close(rdpRdp* rdp, BYTE* data)
+{
+	UINT32 count;
+	BYTE close[2] = { 0x40, 0x05 };
+	rdpChannelQueueMetrics metrics;
+	data[0] = 0x30; /* DATA_PDU, one byte channel id */
+	data[1] = 0x05;
+	count = channel_scheduler_get_flow_count(rdp->channelScheduler);
+
+	if (!test_send(rdp, TEST_CHANNEL_DVC, data, 4000, 2))
+		return FALSE;
+
+	if (channel_scheduler_get_flow_count(rdp->channelScheduler) != count + 1)
+		return FALSE;
+
+	if (!test_send(rdp, TEST_CHANNEL_DVC, close, sizeof(close), 1))
+		return FALSE;
+
+	if (!channel_scheduler_flush(rdp->channelScheduler))
+		return FALSE;
+
+	/* the dynamic flow is replaced by the static drdynvc flow keeping the counters */
+	if (channel_scheduler_get_flow_count(rdp->channelScheduler) != count + 1)
+		return FALSE;
+
+	if (!freerdp_channel_get_queue_metrics(rdp->context, "drdynvc", &metrics))
+		return FALSE;
+
+	return (metrics.sentMessages == 3) && (metrics.sentBytes == 8002) &&
+	       (metrics.queuedMessages == 0);
+}
+
+/**
+ * Data queued when the session disconnects is sent before the transport closes.
+ */
+static BOOL test_disconnect(rdpRdp* rdp, BYTE* data)
+{
+	UINT32 first = g_ChunkCount;
+
+	if (!test_send(rdp, TEST_CHANNEL_BULK, data, 20000, 4))
+		return FALSE;
+
+	if (!test_send(rdp, TEST_CHANNEL_AUDIO, data, 3000, 4))
+		return FALSE;
+
+	rdp_client_disconnect(rdp);
+
+	return (test_sent_bytes(TEST_CHANNEL_BULK, first, g_ChunkCount) == 4 * 20000) &&
+	       (test_sent_bytes(TEST_CHANNEL_AUDIO, first, g_ChunkCount) == 4 * 3000);
+}
+
+int TestChannelScheduler(int argc, char* argv[])
+{
+	int rc = -1;
+	rdpRdp* rdp;
+	BYTE* data;
+	freerdp* instance;
+	instance = freerdp_new();
+	data = (BYTE*) calloc(1, 20000);
+
+	if (!instance || !data)
+		goto fail;
+
+	rdp = test_setup(instance);
+
+	if (!rdp)
+		goto fail;
+
+	if (!test_weights(rdp, data))
+	{
+		fprintf(stderr, "deficit round robin weights test failed\n");
+		goto fail;
+	}
+
+	if (!test_priority(rdp))
+	{
+		fprintf(stderr, "channel priority test failed\n");
+		goto fail;
+	}
+
+	if (!test_dvc_close(rdp, data))
+	{
+		fprintf(stderr, "dynamic channel close test failed\n");
+		goto fail;
+	}
+
+	if (!test_blocked_deficit(rdp, data))
+	{
+		fprintf(stderr, "blocked flow deficit test failed\n");
+		goto fail;
+	}
+
+	if (!test_disconnect(rdp, data))
+	{
+		fprintf(stderr, "disconnect drain test failed\n");
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+
+	if (instance && instance->context)
+		freerdp_context_free(instance);
+
+	freerdp_free(instance);
+	free(data);
+	return rc;
+}
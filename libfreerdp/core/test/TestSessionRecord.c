@@ -0,0 +1,234 @@
+#include <winpr/crt.h>
+#include <winpr/path.h>
+
+#include <openssl/bio.h>
+
+#include <freerdp/freerdp.h>
+
+#include "rdp.h"
+#include "record.h"
+#include "transport.h"
+
+#define TEST_RECORDS		5
+#define TEST_RECORD_LENGTH(_i)	(100 + (_i) * 37)
+#define TEST_REDACT_RECORD	2
+#define TEST_REDACT_OFFSET	10
+#define TEST_REDACT_LENGTH	16
+
+static size_t test_record_offset(UINT32 index)
+{
+	UINT32 i;
+	size_t offset = 0;
+
+	for (i = 0; i < index; i++)
+		offset += TEST_RECORD_LENGTH(i);
+
+	return offset;
+}
+
+/**
+ * Records TEST_RECORDS PDUs of data, blanking part of one of them the way
+ * the auto-reconnect cookie is, and returns what a replay must deliver.
+ */
+static BOOL test_record(rdpRdp* rdp, const char* filename, BYTE* data, BYTE* expected)
+{
+	UINT32 index;
+	rdpSessionRecorder* recorder;
+	BYTE outside[TEST_REDACT_LENGTH] = { 0 };
+	const size_t size = test_record_offset(TEST_RECORDS);
+
+	for (index = 0; index < size; index++)
+		data[index] = (BYTE)(index * 7 + 1);
+
+	CopyMemory(expected, data, size);
+	rdp->settings->SelectedProtocol = PROTOCOL_TLS;
+	rdp->state = CONNECTION_STATE_MCS_CONNECT;
+
+	if (!(recorder = session_recorder_new(filename)))
+		return FALSE;
+
+	for (index = 0; index < TEST_RECORDS; index++)
+	{
+		BYTE* pdu = &data[test_record_offset(index)];
+		wStream* s = Stream_New(pdu, TEST_RECORD_LENGTH(index));
+
+		if (!s)
+		{
+			session_recorder_free(recorder);
+			return FALSE;
+		}
+
+		session_recorder_add(recorder, rdp, s);
+
+		if (index == TEST_REDACT_RECORD)
+		{
+			session_recorder_redact(recorder, &pdu[TEST_REDACT_OFFSET], TEST_REDACT_LENGTH);
+			/* data outside of the recorded PDU is left alone */
+			session_recorder_redact(recorder, outside, sizeof(outside));
+			ZeroMemory(&expected[test_record_offset(index) + TEST_REDACT_OFFSET],
+			           TEST_REDACT_LENGTH);
+		}
+
+		Stream_Free(s, FALSE);
+	}
+
+	session_recorder_free(recorder);
+	return TRUE;
+}
+
+/* Returns the number of bytes the recording delivers, -1 if it can't be replayed */
+static int test_replay(rdpRdp* rdp, const char* filename, BYTE* buffer, size_t size)
+{
+	int status;
+	size_t length = 0;
+	rdpSettings* settings = rdp->settings;
+
+	if (rdp->transport->frontBio)
+	{
+		BIO_free(rdp->transport->frontBio);
+		rdp->transport->frontBio = NULL;
+	}
+
+	free(settings->PlaySessionFile);
+
+	if (!(settings->PlaySessionFile = _strdup(filename)))
+		return -1;
+
+	if (!session_player_connect(rdp))
+		return -1;
+
+	/* small reads, so that they cross the record boundaries */
+	do
+	{
+		status = BIO_read(rdp->transport->frontBio, &buffer[length], (int) MIN(64, size - length));
+
+		if (status > 0)
+			length += (size_t) status;
+	}
+	while ((status > 0) && (length < size));
+
+	return (int) length;
+}
+
+/* Copies the first length bytes of the recording, a negative length cuts that much off its end */
+static BOOL test_truncate(const char* filename, const char* truncated, long length)
+{
+	long size;
+	BOOL rc = FALSE;
+	BYTE* content = NULL;
+	FILE* in = fopen(filename, "rb");
+	FILE* out = NULL;
+
+	if (!in || (fseek(in, 0, SEEK_END) != 0) || ((size = ftell(in)) <= 0))
+		goto fail;
+
+	if (length < 0)
+		length += size;
+
+	if ((length <= 0) || (length >= size))
+		goto fail;
+
+	if ((fseek(in, 0, SEEK_SET) != 0) || !(content = (BYTE*) malloc((size_t) size)))
+		goto fail;
+
+	if (fread(content, (size_t) size, 1, in) != 1)
+		goto fail;
+
+	if (!(out = fopen(truncated, "wb")) || (fwrite(content, (size_t) length, 1, out) != 1))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	free(content);
+
+	if (in)
+		fclose(in);
+
+	if (out)
+		fclose(out);
+
+	return rc;
+}
+
+int TestSessionRecord(int argc, char* argv[])
+{
+	int rc = -1;
+	int length;
+	BYTE* data = NULL;
+	BYTE* expected = NULL;
+	BYTE* replayed = NULL;
+	char* filename = NULL;
+	char* truncated = NULL;
+	rdpRdp* rdp;
+	freerdp* instance;
+	const size_t size = test_record_offset(TEST_RECORDS);
+	instance = freerdp_new();
+	filename = GetKnownSubPath(KNOWN_PATH_TEMP, "TestSessionRecord.rec");
+	truncated = GetKnownSubPath(KNOWN_PATH_TEMP, "TestSessionRecordTruncated.rec");
+	data = (BYTE*) calloc(1, size);
+	expected = (BYTE*) calloc(1, size);
+	replayed = (BYTE*) calloc(1, size + 64);
+
+	if (!instance || !filename || !truncated || !data || !expected || !replayed)
+		goto fail;
+
+	if (!freerdp_context_new(instance))
+		goto fail;
+
+	rdp = instance->context->rdp;
+
+	if (!test_record(rdp, filename, data, expected))
+	{
+		fprintf(stderr, "failed to record %s\n", filename);
+		goto fail;
+	}
+
+	length = test_replay(rdp, filename, replayed, size + 64);
+
+	if ((length != (int) size) || (memcmp(replayed, expected, size) != 0))
+	{
+		fprintf(stderr, "round trip failed, replayed %d of %"PRIuz" bytes\n", length, size);
+		goto fail;
+	}
+
+	/* a recording cut in its last record replays everything before it */
+	if (!test_truncate(filename, truncated, -50))
+		goto fail;
+
+	length = test_replay(rdp, truncated, replayed, size + 64);
+
+	if ((length != (int) test_record_offset(TEST_RECORDS - 1)) ||
+	    (memcmp(replayed, expected, length) != 0))
+	{
+		fprintf(stderr, "truncated replay failed, replayed %d bytes\n", length);
+		goto fail;
+	}
+
+	/* a recording cut in its header is refused */
+	if (!test_truncate(filename, truncated, 20) ||
+	    (test_replay(rdp, truncated, replayed, size + 64) >= 0))
+	{
+		fprintf(stderr, "recording without a complete header was replayed\n");
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+
+	if (filename)
+		DeleteFileA(filename);
+
+	if (truncated)
+		DeleteFileA(truncated);
+
+	if (instance && instance->context)
+		freerdp_context_free(instance);
+
+	freerdp_free(instance);
+	free(filename);
+	free(truncated);
+	free(data);
+	free(expected);
+	free(replayed);
+	return rc;
+}
@@ -0,0 +1,150 @@
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/freerdp.h>
+
+#include "message.h"
+
+#define TEST_FRAMES	2000
+#define TEST_RECTS	64
+
+struct test_counters
+{
+	UINT32 frames;
+	UINT32 rects;
+	UINT64 rectSum;
+	UINT32 bounds;
+	UINT64 boundsSum;
+	BOOL inPaint;
+	BOOL failed;
+};
+
+static struct test_counters g_Counters;
+
+static BOOL test_begin_paint(rdpContext* context)
+{
+	if (g_Counters.inPaint)
+		g_Counters.failed = TRUE;
+
+	g_Counters.inPaint = TRUE;
+	return TRUE;
+}
+
+static BOOL test_end_paint(rdpContext* context)
+{
+	if (!g_Counters.inPaint)
+		g_Counters.failed = TRUE;
+
+	g_Counters.inPaint = FALSE;
+	g_Counters.frames++;
+	return TRUE;
+}
+
+static BOOL test_set_bounds(rdpContext* context, const rdpBounds* bounds)
+{
+	if (!bounds)
+		return TRUE;
+
+	g_Counters.bounds++;
+	g_Counters.boundsSum += bounds->left + bounds->bottom;
+	return TRUE;
+}
+
+static BOOL test_opaque_rect(rdpContext* context, const OPAQUE_RECT_ORDER* order)
+{
+	if (!g_Counters.inPaint || (order->nWidth != order->nLeftRect + 1))
+		g_Counters.failed = TRUE;
+
+	g_Counters.rects++;
+	g_Counters.rectSum += order->nLeftRect;
+	return TRUE;
+}
+
+/**
+ * Posts frames of orders through the asynchronous update proxy. Orders inside
+ * BeginPaint/EndPaint use the frame arena, bounds set outside of a frame are
+ * malloc'ed, both must reach the callbacks unchanged and be released once.
+ */
+int TestUpdateMessageQueue(int argc, char* argv[])
+{
+	int rc = -1;
+	UINT32 frame;
+	UINT32 index;
+	UINT64 start;
+	UINT64 elapsed;
+	UINT64 rectSum = 0;
+	UINT64 boundsSum = 0;
+	rdpUpdate* update = NULL;
+	freerdp* instance = freerdp_new();
+
+	if (!instance || !freerdp_context_new(instance))
+		goto fail;
+
+	update = instance->context->update;
+	update->BeginPaint = test_begin_paint;
+	update->EndPaint = test_end_paint;
+	update->SetBounds = test_set_bounds;
+	update->primary->OpaqueRect = test_opaque_rect;
+	ZeroMemory(&g_Counters, sizeof(g_Counters));
+
+	if (!(update->proxy = update_message_proxy_new(update)))
+		goto fail;
+
+	start = GetTickCount64();
+
+	for (frame = 0; frame < TEST_FRAMES; frame++)
+	{
+		rdpBounds bounds = { 0 };
+		bounds.left = frame;
+		bounds.bottom = 1;
+
+		if (!update->SetBounds(instance->context, &bounds) || !update->BeginPaint(instance->context))
+			goto fail;
+
+		for (index = 0; index < TEST_RECTS; index++)
+		{
+			OPAQUE_RECT_ORDER order = { 0 };
+			order.nLeftRect = frame + index;
+			order.nWidth = order.nLeftRect + 1;
+
+			if (!update->primary->OpaqueRect(instance->context, &order))
+				goto fail;
+
+			rectSum += order.nLeftRect;
+		}
+
+		if (!update->EndPaint(instance->context))
+			goto fail;
+
+		boundsSum += bounds.left + bounds.bottom;
+	}
+
+	update_message_proxy_free(update->proxy);
+	update->proxy = NULL;
+	elapsed = GetTickCount64() - start;
+	printf("%d frames of %d orders through the update proxy in %"PRIu64" ms\n", TEST_FRAMES,
+	       TEST_RECTS, elapsed);
+
+	if (g_Counters.failed || (g_Counters.frames != TEST_FRAMES) ||
+	    (g_Counters.rects != TEST_FRAMES * TEST_RECTS) || (g_Counters.rectSum != rectSum) ||
+	    (g_Counters.bounds != TEST_FRAMES) || (g_Counters.boundsSum != boundsSum))
+	{
+		fprintf(stderr, "update messages were lost or corrupted\n");
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+
+	if (update && update->proxy)
+	{
+		update_message_proxy_free(update->proxy);
+		update->proxy = NULL;
+	}
+
+	if (instance && instance->context)
+		freerdp_context_free(instance);
+
+	freerdp_free(instance);
+	return rc;
+}
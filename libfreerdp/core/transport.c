@@ -32,6 +32,7 @@
 
 #include <freerdp/log.h>
 #include <freerdp/error.h>
+#include <freerdp/utils/metrics.h>
 #include <freerdp/utils/ringbuffer.h>
 
 #include <openssl/bio.h>
@@ -238,6 +239,12 @@ BOOL transport_attach(rdpTransport* transport, int sockfd)
 		return FALSE;
 
 	bufferedBio = BIO_push(bufferedBio, socketBio);
+
+	/* transport_check_fds reads until the BIO would block, so several PDUs
+	 * can be pulled from the socket at once */
+	if (BIO_set_read_ahead(bufferedBio, TRUE) != 1)
+		return FALSE;
+
 	transport->frontBio = bufferedBio;
 	return TRUE;
 }
@@ -594,6 +601,7 @@ int transport_read_layer(rdpTransport* transport, BYTE* data, int bytes)
 		VALGRIND_MAKE_MEM_DEFINED(data + read, bytes - read);
 #endif
 		read += status;
+		transport->received += status;
 	}
 
 	return read;
@@ -787,6 +795,7 @@ int transport_write(rdpTransport* transport, wStream* s)
 	int length;
 	int status = -1;
 	int writtenlength = 0;
+	const UINT64 start = freerdp_metrics_now();
 
 	if (!transport)
 		return -1;
@@ -866,6 +875,8 @@ int transport_write(rdpTransport* transport, wStream* s)
 	}
 
 	transport->written += writtenlength;
+	freerdp_metric_add(FREERDP_METRIC_TRANSPORT_WRITE, writtenlength);
+	freerdp_metric_record_since(FREERDP_METRIC_TRANSPORT_WRITE_TIME, start);
 out_cleanup:
 
 	if (status < 0)
@@ -948,14 +959,13 @@ void transport_get_fds(rdpTransport* transport, void** rfds, int* rcount)
 	DWORD nCount;
 	HANDLE events[64];
 	nCount = transport_get_event_handles(transport, events, 64);
-	*rcount = nCount + 1;
+	*rcount = nCount;
 
+	/* the reread event is the first of the handles */
 	for (index = 0; index < nCount; index++)
 	{
 		rfds[index] = GetEventWaitObject(events[index]);
 	}
-
-	rfds[nCount + 1] = GetEventWaitObject(transport->rereadEvent);
 }
 
 BOOL transport_is_write_blocked(rdpTransport* transport)
@@ -982,6 +992,7 @@ int transport_check_fds(rdpTransport* transport)
 {
 	int status;
 	int recv_status;
+	UINT64 start;
 	wStream* received;
 	DWORD now = GetTickCount();
 	DWORD dueDate = 0;
@@ -1017,10 +1028,13 @@ int transport_check_fds(rdpTransport* transport)
 		}
 
 		received = transport->ReceiveBuffer;
+		freerdp_metric_add(FREERDP_METRIC_TRANSPORT_READ, status);
 
 		if (!(transport->ReceiveBuffer = StreamPool_Take(transport->ReceivePool, 0)))
 			return -1;
 
+		start = freerdp_metrics_now();
+
 		/**
 		 * status:
 		 * 	-1: error
@@ -1030,10 +1044,21 @@ int transport_check_fds(rdpTransport* transport)
 		recv_status = transport->ReceiveCallback(transport, received,
 		              transport->ReceiveExtra);
 		Stream_Release(received);
+		freerdp_metric_record_since(FREERDP_METRIC_TRANSPORT_RECEIVE_TIME, start);
 
 		/* session redirection or activation */
 		if (recv_status == 1 || recv_status == 2)
 		{
+			/**
+			 * PDUs already pulled from the socket into the receive buffers
+			 * won't signal the socket event again, make sure they are read.
+			 */
+			if (BIO_pending(transport->frontBio) > 0)
+			{
+				SetEvent(transport->rereadEvent);
+				transport->haveMoreBytesToRead = TRUE;
+			}
+
 			return recv_status;
 		}
 
@@ -79,6 +79,7 @@ struct rdp_transport
 	CRITICAL_SECTION ReadLock;
 	CRITICAL_SECTION WriteLock;
 	ULONG written;
+	ULONG received;
 	HANDLE rereadEvent;
 	BOOL haveMoreBytesToRead;
 	wLog* log;
@@ -457,7 +457,17 @@ BOOL gdi_bitmap_update(rdpContext* context,
 	for (index = 0; index < bitmapUpdate->number; index++)
 	{
 		const BITMAP_DATA* bitmap = &(bitmapUpdate->rectangles[index]);
-		rdpBitmap* bmp = Bitmap_Alloc(context);
+		rdpBitmap* bmp;
+
+		if (gdi_bitmap_direct_supported(context, bitmap))
+		{
+			if (!gdi_bitmap_decompress_direct(context, bitmap))
+				return FALSE;
+
+			continue;
+		}
+
+		bmp = Bitmap_Alloc(context);
 
 		if (!bmp)
 			return FALSE;
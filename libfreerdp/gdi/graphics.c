@@ -129,13 +129,50 @@ static BOOL gdi_Bitmap_Paint(rdpContext* context, rdpBitmap* bitmap)
 	                  0, 0, GDI_SRCCOPY, &context->gdi->palette);
 }
 
+static BOOL gdi_decompress_bitmap_data(rdpContext* context, const BYTE* pSrcData,
+                                       UINT32 SrcWidth, UINT32 SrcHeight, UINT32 bpp,
+                                       UINT32 length, BOOL compressed, BYTE* pDstData,
+                                       UINT32 DstFormat, UINT32 nDstStep, UINT32 nXDst,
+                                       UINT32 nYDst, UINT32 DstWidth, UINT32 DstHeight)
+{
+	UINT32 SrcFormat;
+	UINT32 nSrcStep;
+	rdpGdi* gdi = context->gdi;
+
+	if (compressed)
+	{
+		if (bpp < 32)
+			return interleaved_decompress(context->codecs->interleaved,
+			                              pSrcData, length,
+			                              SrcWidth, SrcHeight,
+			                              bpp,
+			                              pDstData, DstFormat,
+			                              nDstStep, nXDst, nYDst, DstWidth, DstHeight,
+			                              &gdi->palette);
+
+		return planar_decompress(context->codecs->planar, pSrcData, length,
+		                         SrcWidth, SrcHeight,
+		                         pDstData, DstFormat, nDstStep, nXDst, nYDst,
+		                         DstWidth, DstHeight, TRUE);
+	}
+
+	SrcFormat = gdi_get_pixel_format(bpp);
+	nSrcStep = SrcWidth * GetBytesPerPixel(SrcFormat);
+
+	if (length < nSrcStep * SrcHeight)
+		return FALSE;
+
+	/* uncompressed bitmaps are bottom up, a clipped destination takes the top rows */
+	return freerdp_image_copy(pDstData, DstFormat, nDstStep, nXDst, nYDst,
+	                          DstWidth, DstHeight, &pSrcData[(SrcHeight - DstHeight) * nSrcStep],
+	                          SrcFormat, nSrcStep, 0, 0, &gdi->palette, FREERDP_FLIP_VERTICAL);
+}
+
 static BOOL gdi_Bitmap_Decompress(rdpContext* context, rdpBitmap* bitmap,
                                   const BYTE* pSrcData, UINT32 DstWidth, UINT32 DstHeight,
                                   UINT32 bpp, UINT32 length, BOOL compressed,
                                   UINT32 codecId)
 {
-	UINT32 SrcSize = length;
-	UINT32 SrcFormat;
 	rdpGdi* gdi = context->gdi;
 	bitmap->compressed = FALSE;
 	bitmap->format = gdi->dstFormat;
@@ -145,39 +182,57 @@ static BOOL gdi_Bitmap_Decompress(rdpContext* context, rdpBitmap* bitmap,
 	if (!bitmap->data)
 		return FALSE;
 
-	if (compressed)
-	{
-		if (bpp < 32)
-		{
-			if (!interleaved_decompress(context->codecs->interleaved,
-			                            pSrcData, SrcSize,
-			                            DstWidth, DstHeight,
-			                            bpp,
-			                            bitmap->data, bitmap->format,
-			                            0, 0, 0, DstWidth, DstHeight,
-			                            &gdi->palette))
-				return FALSE;
-		}
-		else
-		{
-			if (!planar_decompress(context->codecs->planar, pSrcData, SrcSize,
-			                       DstWidth, DstHeight,
-			                       bitmap->data, bitmap->format, 0, 0, 0,
-			                       DstWidth, DstHeight, TRUE))
-				return FALSE;
-		}
-	}
-	else
-	{
-		SrcFormat = gdi_get_pixel_format(bpp);
+	return gdi_decompress_bitmap_data(context, pSrcData, DstWidth, DstHeight, bpp, length,
+	                                  compressed, bitmap->data, bitmap->format, 0, 0, 0,
+	                                  DstWidth, DstHeight);
+}
 
-		if (!freerdp_image_copy(bitmap->data, bitmap->format, 0, 0, 0,
-		                        DstWidth, DstHeight, pSrcData, SrcFormat,
-		                        0, 0, 0, &gdi->palette, FREERDP_FLIP_VERTICAL))
-			return FALSE;
-	}
+/**
+ * Bitmap updates are only painted once, so as long as the gdi bitmap class
+ * paints them they are decoded straight into the primary surface instead of
+ * going through a temporary rdpBitmap.
+ */
+BOOL gdi_bitmap_direct_supported(rdpContext* context, const BITMAP_DATA* bitmap)
+{
+	UINT32 width, height;
+	rdpGdi* gdi = context->gdi;
+	const rdpBitmap* prototype = context->graphics->Bitmap_Prototype;
 
-	return TRUE;
+	if ((prototype->Decompress != gdi_Bitmap_Decompress) ||
+	    (prototype->Paint != gdi_Bitmap_Paint))
+		return FALSE;
+
+	if (!gdi->primary || !gdi->primary->hdc->clip->null)
+		return FALSE;
+
+	if ((bitmap->destRight < bitmap->destLeft) || (bitmap->destBottom < bitmap->destTop))
+		return FALSE;
+
+	width = bitmap->destRight - bitmap->destLeft + 1;
+	height = bitmap->destBottom - bitmap->destTop + 1;
+
+	/* rectangles that need clipping keep using gdi_BitBlt */
+	if ((width > bitmap->width) || (height > bitmap->height))
+		return FALSE;
+
+	return (bitmap->destLeft + width <= gdi->width) && (bitmap->destTop + height <= gdi->height);
+}
+
+BOOL gdi_bitmap_decompress_direct(rdpContext* context, const BITMAP_DATA* bitmap)
+{
+	rdpGdi* gdi = context->gdi;
+	const UINT32 width = bitmap->destRight - bitmap->destLeft + 1;
+	const UINT32 height = bitmap->destBottom - bitmap->destTop + 1;
+
+	if (!gdi_decompress_bitmap_data(context, bitmap->bitmapDataStream, bitmap->width,
+	                                bitmap->height, bitmap->bitsPerPixel, bitmap->bitmapLength,
+	                                bitmap->compressed, gdi->primary_buffer, gdi->dstFormat,
+	                                gdi->stride, bitmap->destLeft, bitmap->destTop, width,
+	                                height))
+		return FALSE;
+
+	return gdi_InvalidateRegion(gdi->primary->hdc, bitmap->destLeft, bitmap->destTop,
+	                            width, height);
 }
 
 static BOOL gdi_Bitmap_SetSurface(rdpContext* context, rdpBitmap* bitmap,
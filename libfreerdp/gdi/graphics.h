@@ -32,4 +32,9 @@ FREERDP_LOCAL HGDI_BITMAP gdi_create_bitmap(rdpGdi* gdi, UINT32 width,
 
 FREERDP_LOCAL BOOL gdi_register_graphics(rdpGraphics* graphics);
 
+FREERDP_LOCAL BOOL gdi_bitmap_direct_supported(rdpContext* context,
+        const BITMAP_DATA* bitmap);
+FREERDP_LOCAL BOOL gdi_bitmap_decompress_direct(rdpContext* context,
+        const BITMAP_DATA* bitmap);
+
 #endif /* __GDI_GRAPHICS_H */
@@ -0,0 +1,766 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Runtime Metrics Registry
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/interlocked.h>
+#include <winpr/environment.h>
+
+#ifndef _WIN32
+#include <time.h>
+#include <pthread.h>
+#endif
+
+#include <freerdp/log.h>
+#include <freerdp/utils/metrics.h>
+
+#define TAG FREERDP_TAG("utils.metrics")
+
+/**
+ * Histograms use log linear buckets like HdrHistogram: values below 8 have
+ * their own bucket, above that every power of two is split in 8 buckets,
+ * which keeps the error of a percentile below 12.5%.
+ */
+#define METRICS_SUB_BITS	3
+#define METRICS_SUB_COUNT	(1 << METRICS_SUB_BITS)
+#define METRICS_MAX_BITS	40
+#define METRICS_MAX_VALUE	((1ULL << METRICS_MAX_BITS) - 1)
+#define METRICS_BUCKETS		((METRICS_MAX_BITS - METRICS_SUB_BITS + 1) * METRICS_SUB_COUNT)
+
+#define METRICS_EXPORT_INTERVAL	1000
+
+/**
+ * Only the owning thread writes its block. Every metric has a sequence
+ * number that is odd while it is updated, snapshots copy a metric until
+ * they read the same even sequence before and after. A reset bumps the
+ * registry epoch, each thread clears its block on its next update and
+ * snapshots skip the blocks that are not cleared yet.
+ */
+struct _METRICS_THREAD
+{
+	struct _METRICS_THREAD* next;
+	struct _METRICS_THREAD* prev;
+
+	volatile LONG epoch;
+	volatile LONG sequence[FREERDP_METRIC_MAX];
+
+	UINT64 count[FREERDP_METRIC_MAX];
+	UINT64 sum[FREERDP_METRIC_MAX];
+	UINT64 min[FREERDP_METRIC_MAX];
+	UINT64 max[FREERDP_METRIC_MAX];
+	UINT64* buckets[FREERDP_METRIC_MAX];
+};
+typedef struct _METRICS_THREAD METRICS_THREAD;
+
+struct _METRICS_REGISTRY
+{
+	CRITICAL_SECTION lock;
+	UINT32 count;
+	char* names[FREERDP_METRIC_MAX];
+	UINT32 types[FREERDP_METRIC_MAX];
+
+	/* threads that exited are folded in here */
+	METRICS_THREAD retired;
+	METRICS_THREAD* threads;
+	volatile LONG epoch;
+
+	HANDLE exporter;
+	HANDLE exporterStop;
+	char* exportFile;
+	UINT32 exportInterval;
+
+#ifdef _WIN32
+	DWORD key;
+#else
+	pthread_key_t key;
+#endif
+};
+typedef struct _METRICS_REGISTRY METRICS_REGISTRY;
+
+static const char* const METRICS_BUILTIN_NAMES[FREERDP_METRIC_BUILTIN_COUNT] =
+{
+	"transport.read.bytes",
+	"transport.write.bytes",
+	"transport.receive.us",
+	"transport.write.us",
+	"bulk.compress.bytes",
+	"bulk.compress.us",
+	"bulk.decompress.bytes",
+	"bulk.decompress.us",
+	"codec.rfx.encode.us",
+	"codec.rfx.decode.us",
+	"codec.nsc.encode.us",
+	"codec.nsc.decode.us",
+	"codec.planar.encode.us",
+	"codec.planar.decode.us",
+	"codec.interleaved.encode.us",
+	"codec.interleaved.decode.us",
+	"codec.clear.decode.us",
+	"codec.progressive.decode.us",
+	"codec.h264.encode.us",
+	"codec.h264.decode.us",
+	"gfx.frame_ack.us",
+	"gfx.cache.hit.tiles",
+	"gfx.cache.miss.tiles",
+	"channel.sent.bytes",
+	"channel.queue.ms"
+};
+
+static const UINT32 METRICS_BUILTIN_TYPES[FREERDP_METRIC_BUILTIN_COUNT] =
+{
+	FREERDP_METRIC_COUNTER,
+	FREERDP_METRIC_COUNTER,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_COUNTER,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_COUNTER,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_HISTOGRAM,
+	FREERDP_METRIC_COUNTER,
+	FREERDP_METRIC_COUNTER,
+	FREERDP_METRIC_COUNTER,
+	FREERDP_METRIC_HISTOGRAM
+};
+
+static METRICS_REGISTRY g_Metrics;
+static volatile LONG g_MetricsEnabled = 0;
+static INIT_ONCE g_MetricsOnce = INIT_ONCE_STATIC_INIT;
+
+static void metrics_thread_reset(METRICS_THREAD* thread)
+{
+	UINT32 index;
+
+	for (index = 0; index < FREERDP_METRIC_MAX; index++)
+	{
+		InterlockedIncrement(&thread->sequence[index]);
+		thread->count[index] = 0;
+		thread->sum[index] = 0;
+		thread->min[index] = 0;
+		thread->max[index] = 0;
+
+		if (thread->buckets[index])
+			ZeroMemory(thread->buckets[index], METRICS_BUCKETS * sizeof(UINT64));
+
+		InterlockedIncrement(&thread->sequence[index]);
+	}
+}
+
+/* Copies one metric of a block its owner may be updating meanwhile */
+static BOOL metrics_thread_copy(METRICS_THREAD* dst, METRICS_THREAD* src, UINT32 index)
+{
+	LONG sequence;
+
+	do
+	{
+		while ((sequence = InterlockedCompareExchange(&src->sequence[index], 0, 0)) & 1)
+			SwitchToThread();
+
+		dst->count[index] = src->count[index];
+		dst->sum[index] = src->sum[index];
+		dst->min[index] = src->min[index];
+		dst->max[index] = src->max[index];
+
+		if (src->buckets[index])
+		{
+			if (!dst->buckets[index] &&
+			    !(dst->buckets[index] = (UINT64*) calloc(METRICS_BUCKETS, sizeof(UINT64))))
+				return FALSE;
+
+			CopyMemory(dst->buckets[index], src->buckets[index], METRICS_BUCKETS * sizeof(UINT64));
+		}
+		else if (dst->buckets[index])
+			ZeroMemory(dst->buckets[index], METRICS_BUCKETS * sizeof(UINT64));
+	}
+	while (InterlockedCompareExchange(&src->sequence[index], 0, 0) != sequence);
+
+	return TRUE;
+}
+
+static BOOL metrics_thread_merge(METRICS_THREAD* dst, const METRICS_THREAD* src)
+{
+	UINT32 index;
+	UINT32 bucket;
+
+	for (index = 0; index < FREERDP_METRIC_MAX; index++)
+	{
+		if (!src->count[index])
+			continue;
+
+		if (!dst->count[index] || (src->min[index] < dst->min[index]))
+			dst->min[index] = src->min[index];
+
+		if (src->max[index] > dst->max[index])
+			dst->max[index] = src->max[index];
+
+		dst->count[index] += src->count[index];
+		dst->sum[index] += src->sum[index];
+
+		if (!src->buckets[index])
+			continue;
+
+		if (!dst->buckets[index] &&
+		    !(dst->buckets[index] = (UINT64*) calloc(METRICS_BUCKETS, sizeof(UINT64))))
+			return FALSE;
+
+		for (bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+			dst->buckets[index][bucket] += src->buckets[index][bucket];
+	}
+
+	return TRUE;
+}
+
+static void metrics_thread_free(METRICS_THREAD* thread)
+{
+	UINT32 index;
+
+	for (index = 0; index < FREERDP_METRIC_MAX; index++)
+		free(thread->buckets[index]);
+
+	free(thread);
+}
+
+static void metrics_thread_unlink(METRICS_THREAD* thread)
+{
+	EnterCriticalSection(&g_Metrics.lock);
+
+	if (thread->epoch == g_Metrics.epoch)
+		metrics_thread_merge(&g_Metrics.retired, thread);
+
+	if (thread->prev)
+		thread->prev->next = thread->next;
+	else
+		g_Metrics.threads = thread->next;
+
+	if (thread->next)
+		thread->next->prev = thread->prev;
+
+	LeaveCriticalSection(&g_Metrics.lock);
+	metrics_thread_free(thread);
+}
+
+#ifdef _WIN32
+static VOID WINAPI metrics_thread_exit(PVOID arg)
+#else
+static void metrics_thread_exit(void* arg)
+#endif
+{
+	if (arg)
+		metrics_thread_unlink((METRICS_THREAD*) arg);
+}
+
+static METRICS_THREAD* metrics_thread_get(void)
+{
+	METRICS_THREAD* thread;
+#ifdef _WIN32
+	thread = (METRICS_THREAD*) FlsGetValue(g_Metrics.key);
+#else
+	thread = (METRICS_THREAD*) pthread_getspecific(g_Metrics.key);
+#endif
+
+	if (thread)
+		return thread;
+
+	if (!(thread = (METRICS_THREAD*) calloc(1, sizeof(METRICS_THREAD))))
+		return NULL;
+
+	EnterCriticalSection(&g_Metrics.lock);
+	thread->epoch = g_Metrics.epoch;
+	thread->next = g_Metrics.threads;
+
+	if (thread->next)
+		thread->next->prev = thread;
+
+	g_Metrics.threads = thread;
+	LeaveCriticalSection(&g_Metrics.lock);
+#ifdef _WIN32
+	FlsSetValue(g_Metrics.key, thread);
+#else
+	pthread_setspecific(g_Metrics.key, thread);
+#endif
+	return thread;
+}
+
+static UINT32 metrics_bucket(UINT64 value)
+{
+	UINT32 msb = METRICS_SUB_BITS;
+	UINT32 shift;
+
+	if (value < METRICS_SUB_COUNT)
+		return (UINT32) value;
+
+	if (value > METRICS_MAX_VALUE)
+		value = METRICS_MAX_VALUE;
+
+	while (value >> (msb + 1))
+		msb++;
+
+	shift = msb - METRICS_SUB_BITS;
+	return (shift + 1) * METRICS_SUB_COUNT + (UINT32)((value >> shift) & (METRICS_SUB_COUNT - 1));
+}
+
+/* The middle of the bucket */
+static UINT64 metrics_bucket_value(UINT32 bucket)
+{
+	UINT32 shift;
+	UINT64 low;
+
+	if (bucket < METRICS_SUB_COUNT)
+		return bucket;
+
+	shift = bucket / METRICS_SUB_COUNT - 1;
+	low = ((UINT64)(METRICS_SUB_COUNT + bucket % METRICS_SUB_COUNT)) << shift;
+	return low + (((1ULL << shift) - 1) >> 1);
+}
+
+static UINT64 metrics_percentile(const UINT64* buckets, UINT64 count, UINT32 percentile,
+                                 UINT64 min, UINT64 max)
+{
+	UINT32 bucket;
+	UINT64 seen = 0;
+	UINT64 value = max;
+	const UINT64 rank = (count * percentile + 99) / 100;
+
+	for (bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+	{
+		seen += buckets[bucket];
+
+		if (seen >= rank)
+		{
+			value = metrics_bucket_value(bucket);
+			break;
+		}
+	}
+
+	if (value < min)
+		return min;
+
+	return (value > max) ? max : value;
+}
+
+static BOOL metrics_exporter_start(const char* filename, UINT32 interval);
+
+static BOOL CALLBACK metrics_init(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	UINT32 index;
+	char* env;
+	char* sep;
+	DWORD length;
+
+	if (!InitializeCriticalSectionAndSpinCount(&g_Metrics.lock, 4000))
+		return FALSE;
+
+#ifdef _WIN32
+	if ((g_Metrics.key = FlsAlloc(metrics_thread_exit)) == FLS_OUT_OF_INDEXES)
+		return FALSE;
+#else
+	if (pthread_key_create(&g_Metrics.key, metrics_thread_exit) != 0)
+		return FALSE;
+#endif
+
+	for (index = 0; index < FREERDP_METRIC_BUILTIN_COUNT; index++)
+	{
+		g_Metrics.names[index] = (char*) METRICS_BUILTIN_NAMES[index];
+		g_Metrics.types[index] = METRICS_BUILTIN_TYPES[index];
+	}
+
+	g_Metrics.count = FREERDP_METRIC_BUILTIN_COUNT;
+	length = GetEnvironmentVariableA("FREERDP_METRICS", NULL, 0);
+
+	if (!length || !(env = (char*) calloc(length, sizeof(char))))
+		return TRUE;
+
+	if (GetEnvironmentVariableA("FREERDP_METRICS", env, length) == length - 1)
+	{
+		UINT32 interval = METRICS_EXPORT_INTERVAL;
+
+		if ((sep = strrchr(env, ':')) && (sep[1] >= '0') && (sep[1] <= '9'))
+		{
+			interval = strtoul(sep + 1, NULL, 0);
+			*sep = '\0';
+		}
+
+		metrics_exporter_start(env, interval);
+	}
+
+	free(env);
+	return TRUE;
+}
+
+void freerdp_metrics_init(void)
+{
+	InitOnceExecuteOnce(&g_MetricsOnce, metrics_init, NULL, NULL);
+}
+
+void freerdp_metrics_enable(BOOL enable)
+{
+	freerdp_metrics_init();
+	InterlockedExchange(&g_MetricsEnabled, enable ? 1 : 0);
+}
+
+BOOL freerdp_metrics_enabled(void)
+{
+	return g_MetricsEnabled ? TRUE : FALSE;
+}
+
+UINT32 freerdp_metric_register(const char* name, UINT32 type)
+{
+	UINT32 index;
+	UINT32 id = FREERDP_METRIC_INVALID;
+
+	if (!name || (type > FREERDP_METRIC_HISTOGRAM))
+		return FREERDP_METRIC_INVALID;
+
+	freerdp_metrics_init();
+	EnterCriticalSection(&g_Metrics.lock);
+
+	for (index = 0; index < g_Metrics.count; index++)
+	{
+		if (strcmp(g_Metrics.names[index], name) == 0)
+		{
+			if (g_Metrics.types[index] == type)
+				id = index;
+
+			goto out;
+		}
+	}
+
+	if ((g_Metrics.count < FREERDP_METRIC_MAX) &&
+	    (g_Metrics.names[g_Metrics.count] = _strdup(name)))
+	{
+		g_Metrics.types[g_Metrics.count] = type;
+		id = g_Metrics.count++;
+	}
+
+out:
+	LeaveCriticalSection(&g_Metrics.lock);
+	return id;
+}
+
+/* Microseconds of a monotonic clock, 0 while recording is off */
+UINT64 freerdp_metrics_now(void)
+{
+	if (!g_MetricsEnabled)
+		return 0;
+
+	{
+#ifdef _WIN32
+		LARGE_INTEGER count;
+		LARGE_INTEGER freq;
+		QueryPerformanceCounter(&count);
+		QueryPerformanceFrequency(&freq);
+		return (UINT64)(count.QuadPart / freq.QuadPart * 1000000 +
+		                (count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart);
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (UINT64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+	}
+}
+
+/* The block of the calling thread, cleared if a reset happened since its last update */
+static METRICS_THREAD* metrics_thread_current(UINT32 id)
+{
+	LONG epoch;
+	METRICS_THREAD* thread;
+
+	if (!g_MetricsEnabled || (id >= FREERDP_METRIC_MAX))
+		return NULL;
+
+	if (!(thread = metrics_thread_get()))
+		return NULL;
+
+	if (thread->epoch != (epoch = g_Metrics.epoch))
+	{
+		metrics_thread_reset(thread);
+		InterlockedExchange(&thread->epoch, epoch);
+	}
+
+	return thread;
+}
+
+static void metrics_update(METRICS_THREAD* thread, UINT32 id, UINT64 value, BOOL histogram)
+{
+	InterlockedIncrement(&thread->sequence[id]);
+
+	if (!thread->count[id] || (value < thread->min[id]))
+		thread->min[id] = value;
+
+	if (value > thread->max[id])
+		thread->max[id] = value;
+
+	thread->count[id]++;
+	thread->sum[id] += value;
+
+	if (histogram && thread->buckets[id])
+		thread->buckets[id][metrics_bucket(value)]++;
+
+	InterlockedIncrement(&thread->sequence[id]);
+}
+
+void freerdp_metric_add(UINT32 id, UINT64 value)
+{
+	METRICS_THREAD* thread = metrics_thread_current(id);
+
+	if (thread)
+		metrics_update(thread, id, value, FALSE);
+}
+
+void freerdp_metric_record(UINT32 id, UINT64 value)
+{
+	METRICS_THREAD* thread = metrics_thread_current(id);
+
+	if (!thread)
+		return;
+
+	if (!thread->buckets[id])
+		thread->buckets[id] = (UINT64*) calloc(METRICS_BUCKETS, sizeof(UINT64));
+
+	metrics_update(thread, id, value, TRUE);
+}
+
+void freerdp_metric_record_since(UINT32 id, UINT64 start)
+{
+	/* recording was off when the measurement started */
+	if (!start)
+		return;
+
+	freerdp_metric_record(id, freerdp_metrics_now() - start);
+}
+
+/**
+ * Returns the number of registered metrics and fills up to count values.
+ * Every metric of a thread is read consistently, but other threads keep
+ * updating while the snapshot goes through them.
+ */
+size_t freerdp_metrics_snapshot(FREERDP_METRIC_VALUE* values, size_t count)
+{
+	UINT32 index;
+	size_t total;
+	METRICS_THREAD* sum;
+	METRICS_THREAD* copy;
+	METRICS_THREAD* thread;
+	freerdp_metrics_init();
+	sum = (METRICS_THREAD*) calloc(1, sizeof(METRICS_THREAD));
+	copy = (METRICS_THREAD*) calloc(1, sizeof(METRICS_THREAD));
+
+	if (!sum || !copy)
+	{
+		free(sum);
+		free(copy);
+		return 0;
+	}
+
+	EnterCriticalSection(&g_Metrics.lock);
+	metrics_thread_merge(sum, &g_Metrics.retired);
+	total = g_Metrics.count;
+
+	for (thread = g_Metrics.threads; thread; thread = thread->next)
+	{
+		/* not cleared since the last reset */
+		if (thread->epoch != g_Metrics.epoch)
+			continue;
+
+		for (index = 0; index < total; index++)
+			metrics_thread_copy(copy, thread, index);
+
+		metrics_thread_merge(sum, copy);
+	}
+
+	for (index = 0; (index < total) && (index < count); index++)
+	{
+		FREERDP_METRIC_VALUE* value = &values[index];
+		ZeroMemory(value, sizeof(FREERDP_METRIC_VALUE));
+		value->name = g_Metrics.names[index];
+		value->type = g_Metrics.types[index];
+		value->count = sum->count[index];
+		value->sum = sum->sum[index];
+		value->min = sum->min[index];
+		value->max = sum->max[index];
+
+		if (sum->buckets[index] && value->count)
+		{
+			value->p50 = metrics_percentile(sum->buckets[index], value->count, 50, value->min,
+			                                value->max);
+			value->p90 = metrics_percentile(sum->buckets[index], value->count, 90, value->min,
+			                                value->max);
+			value->p99 = metrics_percentile(sum->buckets[index], value->count, 99, value->min,
+			                                value->max);
+		}
+	}
+
+	LeaveCriticalSection(&g_Metrics.lock);
+	metrics_thread_free(sum);
+	metrics_thread_free(copy);
+	return total;
+}
+
+void freerdp_metrics_reset(void)
+{
+	freerdp_metrics_init();
+	EnterCriticalSection(&g_Metrics.lock);
+	metrics_thread_reset(&g_Metrics.retired);
+	InterlockedIncrement(&g_Metrics.epoch);
+	LeaveCriticalSection(&g_Metrics.lock);
+}
+
+/**
+ * Writes a snapshot as text, one metric per line:
+ *
+ * <name> counter count=<n> sum=<n>
+ * <name> histogram count=<n> sum=<n> min=<n> max=<n> p50=<n> p90=<n> p99=<n>
+ *
+ * The file is replaced at once, readers never see a partial snapshot.
+ */
+BOOL freerdp_metrics_export(const char* filename)
+{
+	FILE* fp;
+	size_t index;
+	size_t count;
+	char* tmp;
+	size_t length;
+	BOOL rc = FALSE;
+	FREERDP_METRIC_VALUE values[FREERDP_METRIC_MAX];
+
+	if (!filename)
+		return FALSE;
+
+	count = freerdp_metrics_snapshot(values, ARRAYSIZE(values));
+	length = strlen(filename) + 5;
+
+	if (!(tmp = (char*) malloc(length)))
+		return FALSE;
+
+	sprintf_s(tmp, length, "%s.tmp", filename);
+
+	if (!(fp = fopen(tmp, "w")))
+		goto out;
+
+	for (index = 0; index < count; index++)
+	{
+		const FREERDP_METRIC_VALUE* value = &values[index];
+
+		if (value->type == FREERDP_METRIC_HISTOGRAM)
+			fprintf(fp, "%s histogram count=%"PRIu64" sum=%"PRIu64" min=%"PRIu64" max=%"PRIu64
+			        " p50=%"PRIu64" p90=%"PRIu64" p99=%"PRIu64"\n", value->name, value->count,
+			        value->sum, value->min, value->max, value->p50, value->p90, value->p99);
+		else
+			fprintf(fp, "%s counter count=%"PRIu64" sum=%"PRIu64"\n", value->name, value->count,
+			        value->sum);
+	}
+
+	if (fclose(fp) != 0)
+		goto out;
+
+#ifdef _WIN32
+	remove(filename);
+#endif
+	rc = (rename(tmp, filename) == 0);
+out:
+
+	if (!rc)
+		WLog_WARN(TAG, "failed to export metrics to %s", filename);
+
+	free(tmp);
+	return rc;
+}
+
+static DWORD WINAPI metrics_exporter_thread(LPVOID arg)
+{
+	while (WaitForSingleObject(g_Metrics.exporterStop, g_Metrics.exportInterval) == WAIT_TIMEOUT)
+		freerdp_metrics_export(g_Metrics.exportFile);
+
+	freerdp_metrics_export(g_Metrics.exportFile);
+	ExitThread(0);
+	return 0;
+}
+
+static BOOL metrics_exporter_start(const char* filename, UINT32 interval)
+{
+	freerdp_metrics_exporter_stop();
+
+	if (!(g_Metrics.exportFile = _strdup(filename)))
+		return FALSE;
+
+	g_Metrics.exportInterval = interval ? interval : METRICS_EXPORT_INTERVAL;
+
+	if (!(g_Metrics.exporterStop = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		goto fail;
+
+	if (!(g_Metrics.exporter = CreateThread(NULL, 0, metrics_exporter_thread, NULL, 0, NULL)))
+		goto fail;
+
+	InterlockedExchange(&g_MetricsEnabled, 1);
+	WLog_INFO(TAG, "exporting metrics to %s every %"PRIu32" ms", filename,
+	          g_Metrics.exportInterval);
+	return TRUE;
+fail:
+	freerdp_metrics_exporter_stop();
+	return FALSE;
+}
+
+/* Enables recording and rewrites filename every interval milliseconds */
+BOOL freerdp_metrics_exporter_start(const char* filename, UINT32 interval)
+{
+	if (!filename)
+		return FALSE;
+
+	freerdp_metrics_init();
+	return metrics_exporter_start(filename, interval);
+}
+
+void freerdp_metrics_exporter_stop(void)
+{
+	if (g_Metrics.exporter)
+	{
+		SetEvent(g_Metrics.exporterStop);
+		WaitForSingleObject(g_Metrics.exporter, INFINITE);
+		CloseHandle(g_Metrics.exporter);
+		g_Metrics.exporter = NULL;
+	}
+
+	if (g_Metrics.exporterStop)
+	{
+		CloseHandle(g_Metrics.exporterStop);
+		g_Metrics.exporterStop = NULL;
+	}
+
+	free(g_Metrics.exportFile);
+	g_Metrics.exportFile = NULL;
+}
@@ -0,0 +1,274 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <winpr/crt.h>
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include <winpr/thread.h>
+#include <winpr/interlocked.h>
+
+#include <freerdp/utils/metrics.h>
+
+static BOOL test_metric_get(UINT32 id, FREERDP_METRIC_VALUE* value)
+{
+	FREERDP_METRIC_VALUE values[FREERDP_METRIC_MAX];
+	size_t count = freerdp_metrics_snapshot(values, ARRAYSIZE(values));
+
+	if (id >= count)
+		return FALSE;
+
+	*value = values[id];
+	return TRUE;
+}
+
+static BOOL test_disabled(void)
+{
+	FREERDP_METRIC_VALUE value;
+	freerdp_metrics_enable(FALSE);
+	freerdp_metric_add(FREERDP_METRIC_TRANSPORT_READ, 100);
+
+	if (freerdp_metrics_now() != 0)
+		return FALSE;
+
+	if (!test_metric_get(FREERDP_METRIC_TRANSPORT_READ, &value))
+		return FALSE;
+
+	return (value.count == 0) && (value.type == FREERDP_METRIC_COUNTER);
+}
+
+static BOOL test_counter(void)
+{
+	FREERDP_METRIC_VALUE value;
+	freerdp_metrics_enable(TRUE);
+	freerdp_metrics_reset();
+	freerdp_metric_add(FREERDP_METRIC_TRANSPORT_READ, 100);
+	freerdp_metric_add(FREERDP_METRIC_TRANSPORT_READ, 23);
+
+	if (!test_metric_get(FREERDP_METRIC_TRANSPORT_READ, &value))
+		return FALSE;
+
+	if (strcmp(value.name, "transport.read.bytes") != 0)
+		return FALSE;
+
+	return (value.count == 2) && (value.sum == 123);
+}
+
+static BOOL test_histogram(void)
+{
+	UINT64 index;
+	FREERDP_METRIC_VALUE value;
+	freerdp_metrics_reset();
+
+	for (index = 1; index <= 1000; index++)
+		freerdp_metric_record(FREERDP_METRIC_TRANSPORT_WRITE_TIME, index);
+
+	if (!test_metric_get(FREERDP_METRIC_TRANSPORT_WRITE_TIME, &value))
+		return FALSE;
+
+	if ((value.type != FREERDP_METRIC_HISTOGRAM) || (value.count != 1000) ||
+	    (value.sum != 500500) || (value.min != 1) || (value.max != 1000))
+		return FALSE;
+
+	/* buckets are 1/8 of a power of two wide */
+	if ((value.p50 < 440) || (value.p50 > 560))
+		return FALSE;
+
+	if ((value.p90 < 790) || (value.p90 > 1000))
+		return FALSE;
+
+	return (value.p99 >= 870) && (value.p99 <= 1000) && (value.p50 <= value.p90) &&
+	       (value.p90 <= value.p99);
+}
+
+static BOOL test_register(void)
+{
+	FREERDP_METRIC_VALUE value;
+	const UINT32 id = freerdp_metric_register("test.custom", FREERDP_METRIC_HISTOGRAM);
+
+	if ((id == FREERDP_METRIC_INVALID) || (id < FREERDP_METRIC_BUILTIN_COUNT))
+		return FALSE;
+
+	if (freerdp_metric_register("test.custom", FREERDP_METRIC_HISTOGRAM) != id)
+		return FALSE;
+
+	if (freerdp_metric_register("test.custom", FREERDP_METRIC_COUNTER) != FREERDP_METRIC_INVALID)
+		return FALSE;
+
+	freerdp_metric_record(id, 7);
+
+	if (!test_metric_get(id, &value))
+		return FALSE;
+
+	return (strcmp(value.name, "test.custom") == 0) && (value.count == 1) && (value.p50 == 7);
+}
+
+static DWORD WINAPI test_metrics_thread(LPVOID arg)
+{
+	int index;
+
+	for (index = 0; index < 10; index++)
+		freerdp_metric_add(FREERDP_METRIC_BULK_COMPRESS, 10);
+
+	ExitThread(0);
+	return 0;
+}
+
+static BOOL test_threads(void)
+{
+	HANDLE thread;
+	FREERDP_METRIC_VALUE value;
+	freerdp_metrics_reset();
+	freerdp_metric_add(FREERDP_METRIC_BULK_COMPRESS, 1);
+
+	if (!(thread = CreateThread(NULL, 0, test_metrics_thread, NULL, 0, NULL)))
+		return FALSE;
+
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+
+	/* the values of an exited thread must not be lost */
+	if (!test_metric_get(FREERDP_METRIC_BULK_COMPRESS, &value))
+		return FALSE;
+
+	return (value.count == 11) && (value.sum == 101);
+}
+
+static volatile LONG g_Stop = 0;
+
+static DWORD WINAPI test_metrics_writer(LPVOID arg)
+{
+	while (!g_Stop)
+		freerdp_metric_record(FREERDP_METRIC_BULK_DECOMPRESS_TIME, 3);
+
+	ExitThread(0);
+	return 0;
+}
+
+/**
+ * Snapshots and resets while another thread keeps recording must always see
+ * the count, sum and histogram of a metric from the same update.
+ */
+static BOOL test_concurrent(void)
+{
+	int index;
+	HANDLE thread;
+	BOOL rc = TRUE;
+	FREERDP_METRIC_VALUE value;
+	freerdp_metrics_reset();
+	g_Stop = 0;
+
+	if (!(thread = CreateThread(NULL, 0, test_metrics_writer, NULL, 0, NULL)))
+		return FALSE;
+
+	for (index = 0; (index < 2000) && rc; index++)
+	{
+		if (index % 100 == 0)
+			freerdp_metrics_reset();
+
+		if (!test_metric_get(FREERDP_METRIC_BULK_DECOMPRESS_TIME, &value))
+			rc = FALSE;
+		else if ((value.sum != value.count * 3) ||
+		         (value.count && ((value.min != 3) || (value.p99 != 3))))
+			rc = FALSE;
+	}
+
+	InterlockedExchange(&g_Stop, 1);
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	return rc;
+}
+
+static BOOL test_export(void)
+{
+	FILE* fp;
+	char* path;
+	char line[256];
+	BOOL found = FALSE;
+	freerdp_metrics_reset();
+	freerdp_metric_add(FREERDP_METRIC_TRANSPORT_WRITE, 42);
+
+	if (!(path = GetKnownSubPath(KNOWN_PATH_TEMP, "TestMetrics.txt")))
+		return FALSE;
+
+	if (!freerdp_metrics_export(path))
+		goto out;
+
+	if (!(fp = fopen(path, "r")))
+		goto out;
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (strcmp(line, "transport.write.bytes counter count=1 sum=42\n") == 0)
+			found = TRUE;
+	}
+
+	fclose(fp);
+out:
+	DeleteFileA(path);
+	free(path);
+	return found;
+}
+
+int TestMetrics(int argc, char* argv[])
+{
+	if (!test_disabled())
+	{
+		fprintf(stderr, "test_disabled failed\n");
+		return -1;
+	}
+
+	if (!test_counter())
+	{
+		fprintf(stderr, "test_counter failed\n");
+		return -1;
+	}
+
+	if (!test_histogram())
+	{
+		fprintf(stderr, "test_histogram failed\n");
+		return -1;
+	}
+
+	if (!test_register())
+	{
+		fprintf(stderr, "test_register failed\n");
+		return -1;
+	}
+
+	if (!test_threads())
+	{
+		fprintf(stderr, "test_threads failed\n");
+		return -1;
+	}
+
+	if (!test_concurrent())
+	{
+		fprintf(stderr, "test_concurrent failed\n");
+		return -1;
+	}
+
+	if (!test_export())
+	{
+		fprintf(stderr, "test_export failed\n");
+		return -1;
+	}
+
+	freerdp_metrics_enable(FALSE);
+	return 0;
+}
@@ -672,6 +672,17 @@ static int x11_shadow_blend_cursor(x11ShadowSubsystem* subsystem)
 	return 1;
 }
 
+/* The next capture takes the whole screen, the previous frame is no longer valid */
+static void x11_shadow_damage_all(x11ShadowSubsystem* subsystem)
+{
+	RECTANGLE_16 rect;
+	rect.left = 0;
+	rect.top = 0;
+	rect.right = subsystem->width;
+	rect.bottom = subsystem->height;
+	region16_union_rect(&(subsystem->damage), &(subsystem->damage), &rect);
+}
+
 static BOOL x11_shadow_check_resize(x11ShadowSubsystem* subsystem)
 {
 	MONITOR_DEF* virtualScreen;
@@ -693,6 +704,7 @@ static BOOL x11_shadow_check_resize(x11ShadowSubsystem* subsystem)
 		virtualScreen->right = subsystem->width;
 		virtualScreen->bottom = subsystem->height;
 		virtualScreen->flags = 1;
+		x11_shadow_damage_all(subsystem);
 		return TRUE;
 	}
 
@@ -716,18 +728,141 @@ static int x11_shadow_error_handler_for_capture(Display* display,
 	return 0;
 }
 
-static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
+/**
+ * Moves the damage the X server accumulated since the last call into the
+ * damage region, in surface coordinates. The server side damage is reset.
+ */
+static BOOL x11_shadow_fetch_damage(x11ShadowSubsystem* subsystem,
+                                    rdpShadowSurface* surface)
+{
+#if defined(WITH_XDAMAGE) && defined(WITH_XFIXES)
+	int index;
+	int count = 0;
+	XRectangle* rects;
+	RECTANGLE_16 rect;
+	XDamageSubtract(subsystem->display, subsystem->xdamage, None,
+	                subsystem->xdamage_region);
+	rects = XFixesFetchRegion(subsystem->display, subsystem->xdamage_region, &count);
+
+	if (!rects)
+		return (count == 0);
+
+	for (index = 0; index < count; index++)
+	{
+		const int left = MAX(rects[index].x - (int) surface->x, 0);
+		const int top = MAX(rects[index].y - (int) surface->y, 0);
+		const int right = rects[index].x + rects[index].width - (int) surface->x;
+		const int bottom = rects[index].y + rects[index].height - (int) surface->y;
+
+		if ((right <= left) || (bottom <= top))
+			continue;
+
+		rect.left = left;
+		rect.top = top;
+		rect.right = right;
+		rect.bottom = bottom;
+
+		if (!region16_union_rect(&(subsystem->damage), &(subsystem->damage), &rect))
+		{
+			XFree(rects);
+			return FALSE;
+		}
+	}
+
+	XFree(rects);
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+/**
+ * Captures one rectangle of the surface, compares it against the previous
+ * frame and copies the changed part into the surface.
+ *
+ * @return 1 if the rectangle changed, 0 if not and -1 if the capture failed
+ */
+static int x11_shadow_capture_rect(x11ShadowSubsystem* subsystem,
+                                   rdpShadowSurface* surface, const RECTANGLE_16* rect)
 {
-	int count;
 	int status;
-	int x, y;
-	int width, height;
+	BYTE* data;
+	UINT32 step;
 	XImage* image;
+	RECTANGLE_16 invalidRect;
+	const int width = rect->right - rect->left;
+	const int height = rect->bottom - rect->top;
+
+	if (subsystem->use_xshm)
+	{
+		/* the pixmap shares its memory with fb_image, only the rectangle is copied */
+		image = subsystem->fb_image;
+		XCopyArea(subsystem->display, subsystem->root_window, subsystem->fb_pixmap,
+		          subsystem->xshm_gc, surface->x + rect->left, surface->y + rect->top,
+		          width, height, surface->x + rect->left, surface->y + rect->top);
+		XSync(subsystem->display, False);
+		step = image->bytes_per_line;
+		data = (BYTE*) &image->data[((surface->y + rect->top) * step) +
+		                            ((surface->x + rect->left) * 4)];
+	}
+	else
+	{
+		image = XGetImage(subsystem->display, subsystem->root_window,
+		                  surface->x + rect->left, surface->y + rect->top,
+		                  width, height, AllPlanes, ZPixmap);
+
+		if (!image)
+		{
+			/*
+			 * BadMatch error happened. The size may have been changed again.
+			 * Give up this frame and we will resize again in next frame
+			 */
+			return -1;
+		}
+
+		step = image->bytes_per_line;
+		data = (BYTE*) image->data;
+	}
+
+	status = shadow_capture_compare(&surface->data[(rect->top * surface->scanline) +
+	                                (rect->left * 4)], surface->scanline, width, height,
+	                                data, step, &invalidRect);
+
+	if (status)
+	{
+		const UINT32 x = invalidRect.left;
+		const UINT32 y = invalidRect.top;
+		invalidRect.left += rect->left;
+		invalidRect.top += rect->top;
+		invalidRect.right += rect->left;
+		invalidRect.bottom += rect->top;
+
+		if (!freerdp_image_copy(surface->data, surface->format, surface->scanline,
+		                        invalidRect.left, invalidRect.top,
+		                        invalidRect.right - invalidRect.left,
+		                        invalidRect.bottom - invalidRect.top,
+		                        data, PIXEL_FORMAT_BGRX32, step, x, y, NULL, FREERDP_FLIP_NONE) ||
+		    !region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
+		                         &invalidRect))
+			status = -1;
+	}
+
+	if (!subsystem->use_xshm)
+		XDestroyImage(image);
+
+	return status;
+}
+
+static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
+{
+	int count;
+	UINT32 index;
+	UINT32 nrects;
+	int status = 0;
 	rdpShadowServer* server;
 	rdpShadowSurface* surface;
-	RECTANGLE_16 invalidRect;
 	RECTANGLE_16 surfaceRect;
-	const RECTANGLE_16* extents;
+	const RECTANGLE_16* rects;
 	server = subsystem->server;
 	surface = server->surface;
 	count = ArrayList_Count(server->clients);
@@ -746,61 +881,53 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	 */
 	XSetErrorHandler(x11_shadow_error_handler_for_capture);
 
-	if (subsystem->use_xshm)
+	/**
+	 * With XDamage only the damaged rectangles are captured and compared,
+	 * otherwise the whole surface is compared against the previous frame.
+	 */
+	if (subsystem->use_xdamage && x11_shadow_fetch_damage(subsystem, surface))
 	{
-		image = subsystem->fb_image;
-		XCopyArea(subsystem->display, subsystem->root_window, subsystem->fb_pixmap,
-		          subsystem->xshm_gc, 0, 0, subsystem->width, subsystem->height, 0, 0);
-		status = shadow_capture_compare(surface->data, surface->scanline,
-		                                surface->width, surface->height,
-		                                (BYTE*) & (image->data[surface->width * 4]), image->bytes_per_line,
-		                                &invalidRect);
+		region16_intersect_rect(&(subsystem->damage), &(subsystem->damage), &surfaceRect);
+		rects = region16_rects(&(subsystem->damage), &nrects);
 	}
 	else
 	{
-		image = XGetImage(subsystem->display, subsystem->root_window,
-		                  surface->x, surface->y, surface->width, surface->height, AllPlanes, ZPixmap);
+		rects = &surfaceRect;
+		nrects = 1;
+	}
 
-		if (!image)
+	for (index = 0; index < nrects; index++)
+	{
+		const int rc = x11_shadow_capture_rect(subsystem, surface, &rects[index]);
+
+		if (rc < 0)
 		{
-			/*
-			 * BadMatch error happened. The size may have been changed again.
-			 * Give up this frame and we will resize again in next frame
-			 */
-			goto fail_capture;
+			status = -1;
+			break;
 		}
 
-		status = shadow_capture_compare(surface->data, surface->scanline,
-		                                surface->width, surface->height,
-		                                (BYTE*) image->data, image->bytes_per_line, &invalidRect);
+		status |= rc;
 	}
 
+	/* a failed capture keeps its damage for the next frame */
+	if (status >= 0)
+		region16_clear(&(subsystem->damage));
+
 	/* Restore the default error handler */
 	XSetErrorHandler(NULL);
 	XSync(subsystem->display, False);
 	XUnlockDisplay(subsystem->display);
 
+	if (status < 0)
+		return 0;
+
 	if (status)
 	{
-		region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
-		                    &invalidRect);
 		region16_intersect_rect(&(surface->invalidRegion), &(surface->invalidRegion),
 		                        &surfaceRect);
 
 		if (!region16_is_empty(&(surface->invalidRegion)))
 		{
-			extents = region16_extents(&(surface->invalidRegion));
-			x = extents->left;
-			y = extents->top;
-			width = extents->right - extents->left;
-			height = extents->bottom - extents->top;
-
-			if (!freerdp_image_copy(surface->data, surface->format,
-			                        surface->scanline, x, y, width, height,
-			                        (BYTE*) image->data, PIXEL_FORMAT_BGRX32,
-			                        image->bytes_per_line, x, y, NULL, FREERDP_FLIP_NONE))
-				goto fail_capture;
-
 			//x11_shadow_blend_cursor(subsystem);
 			count = ArrayList_Count(server->clients);
 			shadow_subsystem_frame_update((rdpShadowSubsystem*)subsystem);
@@ -818,19 +945,7 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 		}
 	}
 
-	if (!subsystem->use_xshm)
-		XDestroyImage(image);
-
 	return 1;
-fail_capture:
-
-	if (!subsystem->use_xshm && image)
-		XDestroyImage(image);
-
-	XSetErrorHandler(NULL);
-	XSync(subsystem->display, False);
-	XUnlockDisplay(subsystem->display);
-	return 0;
 }
 
 static int x11_shadow_subsystem_process_message(x11ShadowSubsystem* subsystem,
@@ -1012,8 +1127,9 @@ static int x11_shadow_xdamage_init(x11ShadowSubsystem* subsystem)
 		return -1;
 
 	subsystem->xdamage_notify_event = damage_event + XDamageNotify;
+	/* the damage itself is fetched at capture time, a single event is enough */
 	subsystem->xdamage = XDamageCreate(subsystem->display, subsystem->root_window,
-	                                   XDamageReportDeltaRectangles);
+	                                   XDamageReportNonEmpty);
 
 	if (!subsystem->xdamage)
 		return -1;
@@ -1303,6 +1419,7 @@ static int x11_shadow_subsystem_init(x11ShadowSubsystem* subsystem)
 	virtualScreen->right = subsystem->width;
 	virtualScreen->bottom = subsystem->height;
 	virtualScreen->flags = 1;
+	x11_shadow_damage_all(subsystem);
 	WLog_INFO(TAG,
 	          "X11 Extensions: XFixes: %"PRId32" Xinerama: %"PRId32" XDamage: %"PRId32" XShm: %"PRId32"",
 	          subsystem->use_xfixes, subsystem->use_xinerama, subsystem->use_xdamage,
@@ -1333,6 +1450,7 @@ static int x11_shadow_subsystem_uninit(x11ShadowSubsystem* subsystem)
 		subsystem->cursorPixels = NULL;
 	}
 
+	region16_clear(&(subsystem->damage));
 	return 1;
 }
 
@@ -1394,6 +1512,7 @@ static x11ShadowSubsystem* x11_shadow_subsystem_new(void)
 	subsystem->use_xfixes = TRUE;
 	subsystem->use_xdamage = FALSE;
 	subsystem->use_xinerama = TRUE;
+	region16_init(&(subsystem->damage));
 	return subsystem;
 }
 
@@ -1403,6 +1522,7 @@ static void x11_shadow_subsystem_free(x11ShadowSubsystem* subsystem)
 		return;
 
 	x11_shadow_subsystem_uninit(subsystem);
+	region16_uninit(&(subsystem->damage));
 	free(subsystem);
 }
 
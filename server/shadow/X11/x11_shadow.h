@@ -75,6 +75,7 @@ struct x11_shadow_subsystem
 	BOOL use_xdamage;
 	BOOL use_xinerama;
 
+	REGION16 damage;
 	XImage* fb_image;
 	Pixmap fb_pixmap;
 	Window root_window;
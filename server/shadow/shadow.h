@@ -31,6 +31,7 @@
 #include "shadow_subsystem.h"
 #include "shadow_lobby.h"
 #include "shadow_mcevent.h"
+#include "shadow_reactor.h"
 
 #ifdef __cplusplus
 extern "C" {
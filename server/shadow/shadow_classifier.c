@@ -0,0 +1,183 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/log.h>
+
+#include "shadow_classifier.h"
+
+#define TAG SERVER_TAG("shadow.classifier")
+
+/**
+ * Every tile of the 64x64 grid keeps one bit per frame for the last eight
+ * frames, set if the tile changed in that frame. A changed tile is sampled
+ * on every other row for
+ *
+ * - the number of distinct colours, up to SHADOW_CLASSIFY_MAX_COLORS
+ * - the pixels that equal their left neighbour (flat areas)
+ * - the pixels whose luma differs from their left neighbour by more than
+ *   SHADOW_CLASSIFY_EDGE (edges)
+ *
+ * Few colours or mostly flat pixels are text and user interface. Other
+ * tiles that changed in most of the recent frames are video, the rest are
+ * images unless they are full of sharp edges, like text on a gradient.
+ */
+
+#define SHADOW_CLASSIFY_MAX_COLORS	32
+#define SHADOW_CLASSIFY_TABLE_SIZE	64
+#define SHADOW_CLASSIFY_EDGE		32
+#define SHADOW_CLASSIFY_VIDEO_FRAMES	6
+
+struct rdp_shadow_classifier
+{
+	UINT32 gridWidth;
+	UINT32 gridHeight;
+	BYTE* history;
+};
+
+static INLINE UINT32 shadow_classifier_luma(UINT32 pixel)
+{
+	return (((pixel >> 16) & 0xFF) + (((pixel >> 8) & 0xFF) * 2) + (pixel & 0xFF)) / 4;
+}
+
+static INLINE UINT32 shadow_classifier_bits(BYTE history)
+{
+	UINT32 count = 0;
+
+	for (; history; history &= history - 1)
+		count++;
+
+	return count;
+}
+
+void shadow_classifier_frame(rdpShadowClassifier* classifier)
+{
+	UINT32 index;
+
+	if (!classifier)
+		return;
+
+	for (index = 0; index < classifier->gridWidth * classifier->gridHeight; index++)
+		classifier->history[index] <<= 1;
+}
+
+UINT32 shadow_classifier_tile(rdpShadowClassifier* classifier, const BYTE* pSrcData,
+                              UINT32 nSrcStep, const RECTANGLE_16* tile)
+{
+	UINT32 x, y;
+	UINT32 colors = 0;
+	UINT32 samples = 0;
+	UINT32 flat = 0;
+	UINT32 edges = 0;
+	UINT32 changes = 0;
+	UINT32 table[SHADOW_CLASSIFY_TABLE_SIZE];
+	BOOL used[SHADOW_CLASSIFY_TABLE_SIZE] = { 0 };
+
+	if (!classifier || !pSrcData || !tile)
+		return SHADOW_CONTENT_TEXT;
+
+	if (((tile->left / 64U) < classifier->gridWidth) && ((tile->top / 64U) < classifier->gridHeight))
+	{
+		BYTE* history = &classifier->history[((tile->top / 64) * classifier->gridWidth) +
+		                                                        (tile->left / 64)];
+		*history |= 1;
+		changes = shadow_classifier_bits(*history);
+	}
+
+	for (y = tile->top; y < tile->bottom; y += 2)
+	{
+		const UINT32* row = (const UINT32*) &pSrcData[(y * nSrcStep) + (tile->left * 4)];
+		const UINT32 width = tile->right - tile->left;
+
+		for (x = 1; x < width; x++)
+		{
+			const UINT32 pixel = row[x] & 0x00FFFFFF;
+			const UINT32 left = row[x - 1] & 0x00FFFFFF;
+			samples++;
+
+			if (pixel == left)
+			{
+				flat++;
+				continue;
+			}
+
+			if ((UINT32) abs((int) shadow_classifier_luma(pixel) -
+			                 (int) shadow_classifier_luma(left)) > SHADOW_CLASSIFY_EDGE)
+				edges++;
+
+			if (colors <= SHADOW_CLASSIFY_MAX_COLORS)
+			{
+				UINT32 slot = ((pixel * 0x9E3779B1) >> 26) % SHADOW_CLASSIFY_TABLE_SIZE;
+
+				while (used[slot] && (table[slot] != pixel))
+					slot = (slot + 1) % SHADOW_CLASSIFY_TABLE_SIZE;
+
+				if (!used[slot])
+				{
+					used[slot] = TRUE;
+					table[slot] = pixel;
+					colors++;
+				}
+			}
+		}
+	}
+
+	if ((colors <= SHADOW_CLASSIFY_MAX_COLORS) || (flat * 2 >= samples))
+		return SHADOW_CONTENT_TEXT;
+
+	if (changes >= SHADOW_CLASSIFY_VIDEO_FRAMES)
+		return SHADOW_CONTENT_VIDEO;
+
+	if (edges * 4 >= samples)
+		return SHADOW_CONTENT_TEXT;
+
+	return SHADOW_CONTENT_IMAGE;
+}
+
+rdpShadowClassifier* shadow_classifier_new(UINT32 width, UINT32 height)
+{
+	rdpShadowClassifier* classifier;
+	classifier = (rdpShadowClassifier*) calloc(1, sizeof(rdpShadowClassifier));
+
+	if (!classifier)
+		return NULL;
+
+	classifier->gridWidth = (width + 63) / 64;
+	classifier->gridHeight = (height + 63) / 64;
+	classifier->history = (BYTE*) calloc(MAX(classifier->gridWidth * classifier->gridHeight, 1),
+	                                     sizeof(BYTE));
+
+	if (!classifier->history)
+	{
+		WLog_ERR(TAG, "Failed to allocate the tile history");
+		free(classifier);
+		return NULL;
+	}
+
+	return classifier;
+}
+
+void shadow_classifier_free(rdpShadowClassifier* classifier)
+{
+	if (!classifier)
+		return;
+
+	free(classifier->history);
+	free(classifier);
+}
@@ -0,0 +1,51 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SHADOW_SERVER_CLASSIFIER_H
+#define FREERDP_SHADOW_SERVER_CLASSIFIER_H
+
+#include <winpr/crt.h>
+
+#include <freerdp/freerdp.h>
+
+#define SHADOW_CONTENT_TEXT	0
+#define SHADOW_CONTENT_IMAGE	1
+#define SHADOW_CONTENT_VIDEO	2
+
+typedef struct rdp_shadow_classifier rdpShadowClassifier;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Starts a frame, the change history of every tile moves by one frame */
+void shadow_classifier_frame(rdpShadowClassifier* classifier);
+
+/**
+ * Classifies a changed tile of the 64x64 grid of a BGRX32 frame as text and
+ * user interface, which must stay sharp, as a still image or as video.
+ */
+UINT32 shadow_classifier_tile(rdpShadowClassifier* classifier, const BYTE* pSrcData,
+                              UINT32 nSrcStep, const RECTANGLE_16* tile);
+
+rdpShadowClassifier* shadow_classifier_new(UINT32 width, UINT32 height);
+void shadow_classifier_free(rdpShadowClassifier* classifier);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SHADOW_SERVER_CLASSIFIER_H */
@@ -31,11 +31,28 @@
 #include <winpr/interlocked.h>
 
 #include <freerdp/log.h>
+#include <freerdp/utils/metrics.h>
 
 #include "shadow.h"
 
 #define TAG CLIENT_TAG("shadow")
 
+/* Encoding another rectangle is worth about as much as a 64x64 tile of pixels */
+#define SHADOW_RECT_COST	(64 * 64)
+#define SHADOW_MAX_RECTS	64
+#define SHADOW_MAX_REGION_RECTS	256
+/**
+ * Tile cache budgets. The small cache capability allows 16 MB of client
+ * cache, the other 100 MB, the server keeps a copy of every cached tile and
+ * only uses 32 MB of those.
+ */
+#define SHADOW_TILE_CACHE_SMALL_SLOTS	4096
+#define SHADOW_TILE_CACHE_SMALL_BYTES	(16 * 1024 * 1024)
+#define SHADOW_TILE_CACHE_SLOTS		25600
+#define SHADOW_TILE_CACHE_BYTES		(32 * 1024 * 1024)
+/* Rectangles are only merged with the ones following them closely in band order */
+#define SHADOW_MERGE_WINDOW	16
+
 struct _SHADOW_GFX_STATUS
 {
 	BOOL gfxOpened;
@@ -147,6 +164,8 @@ static BOOL shadow_client_context_new(freerdp_peer* peer,
 	settings->DrawAllowSkipAlpha = TRUE;
 	settings->DrawAllowColorSubsampling = TRUE;
 	settings->DrawAllowDynamicColorFidelity = TRUE;
+	settings->VirtualChannelScheduling = TRUE;
+	settings->SupportDynamicChannelCompression = TRUE;
 	settings->CompressionLevel = PACKET_COMPR_TYPE_RDP6;
 
 	if (!(settings->CertificateFile = _strdup(server->CertificateFile)))
@@ -612,6 +631,43 @@ static UINT shadow_client_rdpgfx_frame_acknowledge(RdpgfxServerContext* context,
 	return CHANNEL_RC_OK;
 }
 
+/**
+ * Confirms the selected capability set. A new channel starts with an empty
+ * client cache, the client loop replaces the tile cache before its next
+ * frame, this runs on the channel thread while the loop may be encoding.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT shadow_client_rdpgfx_caps_confirm(RdpgfxServerContext* context,
+        RDPGFX_CAPS_CONFIRM_PDU* pdu)
+{
+	rdpShadowClient* client = (rdpShadowClient*)context->custom;
+
+	if (client && client->encoder)
+		InterlockedExchange(&client->encoder->tileCacheReset, 1);
+
+	return context->CapsConfirm(context, pdu);
+}
+
+/* Starts a tile cache matching the client cache size of the confirmed capabilities */
+static BOOL shadow_client_reset_tile_cache(rdpShadowClient* client, rdpSettings* settings)
+{
+	rdpShadowEncoder* encoder = client->encoder;
+	const BOOL small = settings->GfxSmallCache || settings->GfxThinClient;
+	shadow_tile_cache_free(encoder->tileCache);
+	encoder->tileCache = shadow_tile_cache_new(
+	                         small ? SHADOW_TILE_CACHE_SMALL_SLOTS : SHADOW_TILE_CACHE_SLOTS,
+	                         small ? SHADOW_TILE_CACHE_SMALL_BYTES : SHADOW_TILE_CACHE_BYTES);
+
+	if (!encoder->tileCache)
+	{
+		WLog_ERR(TAG, "Failed to create the GFX tile cache");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 /**
  * Function description
  *
@@ -640,7 +696,7 @@ static UINT shadow_client_rdpgfx_caps_advertise(RdpgfxServerContext* context,
 				settings->GfxH264 = !(flags & RDPGFX_CAPS_FLAG_AVC_DISABLED);
 			}
 
-			return context->CapsConfirm(context, &pdu);
+			return shadow_client_rdpgfx_caps_confirm(context, &pdu);
 		}
 	}
 
@@ -657,7 +713,7 @@ static UINT shadow_client_rdpgfx_caps_advertise(RdpgfxServerContext* context,
 				settings->GfxH264 = !(flags & RDPGFX_CAPS_FLAG_AVC_DISABLED);
 			}
 
-			return context->CapsConfirm(context, &pdu);
+			return shadow_client_rdpgfx_caps_confirm(context, &pdu);
 		}
 	}
 
@@ -673,7 +729,7 @@ static UINT shadow_client_rdpgfx_caps_advertise(RdpgfxServerContext* context,
 				settings->GfxH264 = (flags & RDPGFX_CAPS_FLAG_AVC420_ENABLED);
 			}
 
-			return context->CapsConfirm(context, &pdu);
+			return shadow_client_rdpgfx_caps_confirm(context, &pdu);
 		}
 	}
 
@@ -688,7 +744,7 @@ static UINT shadow_client_rdpgfx_caps_advertise(RdpgfxServerContext* context,
 				settings->GfxSmallCache = (flags & RDPGFX_CAPS_FLAG_SMALL_CACHE);
 			}
 
-			return context->CapsConfirm(context, &pdu);
+			return shadow_client_rdpgfx_caps_confirm(context, &pdu);
 		}
 	}
 
@@ -697,294 +753,969 @@ static UINT shadow_client_rdpgfx_caps_advertise(RdpgfxServerContext* context,
 
 
 /**
- * Function description
+ * Sends the rectangles encoded as AVC420. The encoder always encodes the
+ * whole surface, the client only updates the rectangles.
  *
  * @return TRUE on success
  */
-static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
-        const BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc, int nWidth, int nHeight)
+static BOOL shadow_client_send_surface_avc420(rdpShadowClient* client,
+        const BYTE* pSrcData, int nSrcStep, int nWidth, int nHeight,
+        const RECTANGLE_16* rects, UINT32 numRects)
 {
+	UINT32 index;
 	UINT error = CHANNEL_RC_OK;
-	rdpContext* context = (rdpContext*) client;
-	rdpSettings* settings;
-	rdpShadowEncoder* encoder;
 	RDPGFX_SURFACE_COMMAND cmd;
-	RDPGFX_START_FRAME_PDU cmdstart;
-	RDPGFX_END_FRAME_PDU cmdend;
-	SYSTEMTIME sTime;
-
-	if (!context || !pSrcData)
-		return FALSE;
-
-	settings = context->settings;
-	encoder = client->encoder;
-
-	if (!settings || !encoder)
-		return FALSE;
+	RDPGFX_AVC420_BITMAP_STREAM avc420;
+	RDPGFX_H264_QUANT_QUALITY* quantQualityVals;
+	rdpSettings* settings = ((rdpContext*) client)->settings;
+	rdpShadowEncoder* encoder = client->encoder;
 
-	cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
-	GetSystemTime(&sTime);
-	cmdstart.timestamp = sTime.wHour << 22 | sTime.wMinute << 16 |
-	                     sTime.wSecond << 10 | sTime.wMilliseconds;
-	cmdend.frameId = cmdstart.frameId;
 	cmd.surfaceId = 0;
-	cmd.codecId = 0;
+	cmd.codecId = RDPGFX_CODECID_AVC420;
 	cmd.contextId = 0;
 	cmd.format = PIXEL_FORMAT_BGRX32;
-	cmd.left = nXSrc;
-	cmd.top = nYSrc;
-	cmd.right = cmd.left + nWidth;
-	cmd.bottom = cmd.top + nHeight;
+	cmd.left = 0;
+	cmd.top = 0;
+	cmd.right = nWidth;
+	cmd.bottom = nHeight;
 	cmd.width = nWidth;
 	cmd.height = nHeight;
 	cmd.length = 0;
 	cmd.data = NULL;
-	cmd.extra = NULL;
+	cmd.extra = (void*) &avc420;
 
-	if (settings->GfxH264)
+	/* the dummy subsystem is used when no H.264 encoder was built */
+	if (avc420_compress(encoder->h264, pSrcData, cmd.format, nSrcStep, nWidth, nHeight,
+	                    &avc420.data, &avc420.length) < 0)
 	{
-		RDPGFX_AVC420_BITMAP_STREAM avc420;
-		RECTANGLE_16 regionRect;
-		RDPGFX_H264_QUANT_QUALITY quantQualityVal;
+		WLog_WARN(TAG, "H.264 encoding failed, sending video with RemoteFX");
+		settings->GfxH264 = FALSE;
+		return FALSE;
+	}
 
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_AVC420) < 0)
-		{
-			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_AVC420");
-			return FALSE;
-		}
+	if (!(quantQualityVals = (RDPGFX_H264_QUANT_QUALITY*) calloc(numRects,
+	                         sizeof(RDPGFX_H264_QUANT_QUALITY))))
+		return FALSE;
+
+	for (index = 0; index < numRects; index++)
+	{
+		quantQualityVals[index].qp = encoder->h264->QP;
+		quantQualityVals[index].r = 0;
+		quantQualityVals[index].p = 0;
+		quantQualityVals[index].qualityVal = 100 - quantQualityVals[index].qp;
+	}
 
-		avc420_compress(encoder->h264, pSrcData, cmd.format, nSrcStep,
-		                nWidth, nHeight, &avc420.data, &avc420.length);
-		cmd.codecId = RDPGFX_CODECID_AVC420;
-		cmd.extra = (void*)&avc420;
-		regionRect.left = cmd.left;
-		regionRect.top = cmd.top;
-		regionRect.right = cmd.right;
-		regionRect.bottom = cmd.bottom;
-		quantQualityVal.qp = encoder->h264->QP;
-		quantQualityVal.r = 0;
-		quantQualityVal.p = 0;
-		quantQualityVal.qualityVal = 100 - quantQualityVal.qp;
-		avc420.meta.numRegionRects = 1;
-		avc420.meta.regionRects = &regionRect;
-		avc420.meta.quantQualityVals = &quantQualityVal;
-		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd,
-		          &cmdstart, &cmdend);
+	avc420.meta.numRegionRects = numRects;
+	avc420.meta.regionRects = (RECTANGLE_16*) rects;
+	avc420.meta.quantQualityVals = quantQualityVals;
+	IFCALLRET(client->rdpgfx->SurfaceCommand, error, client->rdpgfx, &cmd);
+	free(quantQualityVals);
 
-		if (error)
-		{
-			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %"PRIu32"", error);
-			return FALSE;
-		}
+	if (error)
+	{
+		WLog_ERR(TAG, "SurfaceCommand failed with error %"PRIu32"", error);
+		return FALSE;
 	}
 
 	return TRUE;
 }
 
 /**
- * Function description
+ * Sends the rectangles encoded with RemoteFX, in one message with the tiles
+ * positioned relative to the surface origin.
  *
  * @return TRUE on success
  */
-static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
-        BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc, int nWidth, int nHeight)
+static BOOL shadow_client_send_surface_rfx(rdpShadowClient* client,
+        const BYTE* pSrcData, int nSrcStep, int nWidth, int nHeight,
+        const RFX_RECT* rects, UINT32 numRects)
 {
-	BOOL ret = TRUE;
-	int i;
-	BOOL first;
-	BOOL last;
+	BOOL ret;
 	wStream* s;
-	int numMessages;
-	UINT32 frameId = 0;
-	rdpUpdate* update;
-	rdpContext* context = (rdpContext*) client;
-	rdpSettings* settings;
-	rdpShadowEncoder* encoder;
-	SURFACE_BITS_COMMAND cmd;
+	RFX_MESSAGE* message;
+	UINT error = CHANNEL_RC_OK;
+	RDPGFX_SURFACE_COMMAND cmd;
+	rdpShadowEncoder* encoder = client->encoder;
 
-	if (!context || !pSrcData)
+	if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
+	{
+		WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_REMOTEFX");
 		return FALSE;
+	}
 
-	update = context->update;
-	settings = context->settings;
-	encoder = client->encoder;
-
-	if (!update || !settings || !encoder)
+	if (!(message = rfx_encode_message(encoder->rfx, rects, numRects, (BYTE*) pSrcData, nWidth,
+	                                   nHeight, nSrcStep)))
+	{
+		WLog_ERR(TAG, "rfx_encode_message failed");
 		return FALSE;
+	}
 
-	if (encoder->frameAck)
-		frameId = shadow_encoder_create_frame_id(encoder);
+	s = encoder->bs;
+	Stream_SetPosition(s, 0);
+	ret = rfx_write_message(encoder->rfx, s, message);
+	message->freeRects = TRUE;
+	rfx_message_free(encoder->rfx, message);
 
-	if (settings->RemoteFxCodec)
+	if (!ret)
 	{
-		RFX_RECT rect;
-		RFX_MESSAGE* messages;
-		RFX_RECT* messageRects = NULL;
+		WLog_ERR(TAG, "rfx_write_message failed");
+		return FALSE;
+	}
 
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
-		{
-			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_REMOTEFX");
-			return FALSE;
-		}
+	cmd.surfaceId = 0;
+	cmd.codecId = RDPGFX_CODECID_CAVIDEO;
+	cmd.contextId = 0;
+	cmd.format = PIXEL_FORMAT_BGRX32;
+	cmd.left = 0;
+	cmd.top = 0;
+	cmd.right = nWidth;
+	cmd.bottom = nHeight;
+	cmd.width = nWidth;
+	cmd.height = nHeight;
+	cmd.length = Stream_GetPosition(s);
+	cmd.data = Stream_Buffer(s);
+	cmd.extra = NULL;
+	IFCALLRET(client->rdpgfx->SurfaceCommand, error, client->rdpgfx, &cmd);
 
-		s = encoder->bs;
-		rect.x = nXSrc;
-		rect.y = nYSrc;
-		rect.width = nWidth;
-		rect.height = nHeight;
+	if (error)
+	{
+		WLog_ERR(TAG, "SurfaceCommand failed with error %"PRIu32"", error);
+		return FALSE;
+	}
 
-		if (!(messages = rfx_encode_messages(encoder->rfx, &rect, 1, pSrcData,
-		                                     settings->DesktopWidth, settings->DesktopHeight, nSrcStep, &numMessages,
-		                                     settings->MultifragMaxRequestSize)))
-		{
-			WLog_ERR(TAG, "rfx_encode_messages failed");
-			return FALSE;
-		}
+	return TRUE;
+}
 
-		cmd.codecID = settings->RemoteFxCodecId;
-		cmd.destLeft = 0;
-		cmd.destTop = 0;
-		cmd.destRight = settings->DesktopWidth;
-		cmd.destBottom = settings->DesktopHeight;
-		cmd.bpp = 32;
-		cmd.width = settings->DesktopWidth;
-		cmd.height = settings->DesktopHeight;
-		cmd.skipCompression = TRUE;
+/* Pieces of the invalid region in a single colour are filled instead of encoded */
+struct _SHADOW_FILL
+{
+	UINT32 color;
+	RECTANGLE_16 rect;
+};
+typedef struct _SHADOW_FILL SHADOW_FILL;
 
-		if (numMessages > 0)
-			messageRects = messages[0].rects;
+static int shadow_client_compare_fills(const void* a, const void* b)
+{
+	const UINT32 colorA = ((const SHADOW_FILL*) a)->color;
+	const UINT32 colorB = ((const SHADOW_FILL*) b)->color;
+	return (colorA < colorB) ? -1 : (colorA > colorB) ? 1 : 0;
+}
 
-		for (i = 0; i < numMessages; i++)
-		{
-			Stream_SetPosition(s, 0);
+/**
+ * The rows are compared with or instead of branches, so that the compiler
+ * can vectorise the loops.
+ *
+ * @return TRUE if all pixels of the rectangle have the same colour
+ */
+static BOOL shadow_client_solid_color(const BYTE* pSrcData, int nSrcStep,
+                                      const RECTANGLE_16* rect, UINT32* color)
+{
+	int x, y;
+	UINT32 diff = 0;
+	const int width = rect->right - rect->left;
+	const UINT32* first = (const UINT32*) &pSrcData[(rect->top * nSrcStep) + (rect->left * 4)];
+	const UINT32 value = first[0];
 
-			if (!rfx_write_message(encoder->rfx, s, &messages[i]))
-			{
-				while (i < numMessages)
-				{
-					rfx_message_free(encoder->rfx, &messages[i++]);
-				}
+	for (x = 1; x < width; x++)
+		diff |= first[x] ^ value;
 
-				WLog_ERR(TAG, "rfx_write_message failed");
-				ret = FALSE;
-				break;
-			}
+	if (diff)
+		return FALSE;
 
-			rfx_message_free(encoder->rfx, &messages[i]);
-			cmd.bitmapDataLength = Stream_GetPosition(s);
-			cmd.bitmapData = Stream_Buffer(s);
-			first = (i == 0) ? TRUE : FALSE;
-			last = ((i + 1) == numMessages) ? TRUE : FALSE;
+	for (y = rect->top + 1; y < rect->bottom; y++)
+	{
+		if (memcmp(&pSrcData[(y * nSrcStep) + (rect->left * 4)], first, width * 4) != 0)
+			return FALSE;
+	}
 
-			if (!encoder->frameAck)
-				IFCALLRET(update->SurfaceBits, ret, update->context, &cmd);
-			else
-				IFCALLRET(update->SurfaceFrameBits, ret, update->context, &cmd, first, last,
-				          frameId);
+	*color = value;
+	return TRUE;
+}
 
-			if (!ret)
-			{
-				WLog_ERR(TAG, "Send surface bits(RemoteFxCodec) failed");
-				break;
-			}
-		}
+/**
+ * Splits the region along the 64x64 grid. Single colour pieces are returned
+ * as fills, joined with their left neighbour if it has the same colour,
+ * all other pieces are added to codecRegion.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_split_fills(const BYTE* pSrcData, int nSrcStep,
+                                      const REGION16* region, REGION16* codecRegion,
+                                      SHADOW_FILL** pFills, UINT32* pNumFills)
+{
+	UINT32 index;
+	UINT32 numRects = 0;
+	UINT32 numFills = 0;
+	size_t capacity = 0;
+	SHADOW_FILL* fills;
+	const RECTANGLE_16* rects = region16_rects(region, &numRects);
 
-		free(messageRects);
-		free(messages);
+	for (index = 0; index < numRects; index++)
+	{
+		const RECTANGLE_16* r = &rects[index];
+		capacity += (size_t)(((r->right + 63) / 64) - (r->left / 64)) *
+		            (((r->bottom + 63) / 64) - (r->top / 64));
 	}
-	else if (settings->NSCodec)
+
+	if (!(fills = (SHADOW_FILL*) calloc(MAX(capacity, 1), sizeof(SHADOW_FILL))))
+		return FALSE;
+
+	for (index = 0; index < numRects; index++)
 	{
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_NSCODEC) < 0)
+		RECTANGLE_16 piece;
+		const RECTANGLE_16* r = &rects[index];
+
+		for (piece.top = r->top; piece.top < r->bottom; piece.top = piece.bottom)
 		{
-			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_NSCODEC");
-			return FALSE;
-		}
+			piece.bottom = MIN((piece.top & ~63) + 64, r->bottom);
 
-		s = encoder->bs;
-		Stream_SetPosition(s, 0);
-		pSrcData = &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)];
-		nsc_compose_message(encoder->nsc, s, pSrcData, nWidth, nHeight, nSrcStep);
-		cmd.bpp = 32;
-		cmd.codecID = settings->NSCodecId;
-		cmd.destLeft = nXSrc;
-		cmd.destTop = nYSrc;
-		cmd.destRight = cmd.destLeft + nWidth;
-		cmd.destBottom = cmd.destTop + nHeight;
-		cmd.width = nWidth;
-		cmd.height = nHeight;
-		cmd.bitmapDataLength = Stream_GetPosition(s);
-		cmd.bitmapData = Stream_Buffer(s);
-		first = TRUE;
-		last = TRUE;
-
-		if (!encoder->frameAck)
-			IFCALLRET(update->SurfaceBits, ret, update->context, &cmd);
-		else
-			IFCALLRET(update->SurfaceFrameBits, ret, update->context, &cmd, first, last,
-			          frameId);
+			for (piece.left = r->left; piece.left < r->right; piece.left = piece.right)
+			{
+				UINT32 color;
+				SHADOW_FILL* last = (numFills > 0) ? &fills[numFills - 1] : NULL;
+				piece.right = MIN((piece.left & ~63) + 64, r->right);
 
-		if (!ret)
-		{
-			WLog_ERR(TAG, "Send surface bits(NSCodec) failed");
+				if (!shadow_client_solid_color(pSrcData, nSrcStep, &piece, &color))
+				{
+					if (!region16_union_rect(codecRegion, codecRegion, &piece))
+						goto fail;
+				}
+				else if (last && (last->color == color) && (last->rect.right == piece.left) &&
+				         (last->rect.top == piece.top) && (last->rect.bottom == piece.bottom))
+				{
+					last->rect.right = piece.right;
+				}
+				else
+				{
+					fills[numFills].color = color;
+					fills[numFills].rect = piece;
+					numFills++;
+				}
+			}
 		}
 	}
 
-	return ret;
+	/* keep the region as it was when there is nothing to fill */
+	if ((numFills == 0) && !region16_copy(codecRegion, region))
+		goto fail;
+
+	*pFills = fills;
+	*pNumFills = numFills;
+	return TRUE;
+fail:
+	free(fills);
+	return FALSE;
 }
 
 /**
- * Function description
+ * Sends one tile of the GFX surface. A tile the client has cached is copied
+ * from the cache, any other tile is planar encoded and then cached.
  *
  * @return TRUE on success
  */
-static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client,
-        BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc, int nWidth, int nHeight)
+static BOOL shadow_client_send_surface_tile(rdpShadowClient* client,
+        const BYTE* pSrcData, int nSrcStep, const RECTANGLE_16* tile)
 {
-	BOOL ret = TRUE;
-	BYTE* data;
 	BYTE* buffer;
-	int yIdx, xIdx, k;
-	int rows, cols;
-	UINT32 DstSize;
-	UINT32 SrcFormat;
-	BITMAP_DATA* bitmap;
-	rdpUpdate* update;
-	rdpContext* context = (rdpContext*) client;
-	rdpSettings* settings;
-	UINT32 maxUpdateSize;
-	UINT32 totalBitmapSize;
-	UINT32 updateSizeEstimate;
-	BITMAP_DATA* bitmapData;
-	BITMAP_UPDATE bitmapUpdate;
-	rdpShadowEncoder* encoder;
-
-	if (!context || !pSrcData)
-		return FALSE;
-
-	update = context->update;
-	settings = context->settings;
-	encoder = client->encoder;
-
-	if (!update || !settings || !encoder)
-		return FALSE;
-
-	maxUpdateSize = settings->MultifragMaxRequestSize;
-
-	if (settings->ColorDepth < 32)
+	UINT16 cacheSlot;
+	UINT32 dstSize = 0;
+	UINT error = CHANNEL_RC_OK;
+	RDPGFX_SURFACE_COMMAND cmd;
+	RDPGFX_SURFACE_TO_CACHE_PDU surfaceToCache;
+	rdpShadowEncoder* encoder = client->encoder;
+	RdpgfxServerContext* rdpgfx = client->rdpgfx;
+	const UINT32 width = tile->right - tile->left;
+	const UINT32 height = tile->bottom - tile->top;
+	const BYTE* data = &pSrcData[(tile->top * nSrcStep) + (tile->left * 4)];
+	const UINT64 cacheKey = shadow_tile_cache_hash(data, nSrcStep, width, height);
+
+	if ((cacheSlot = shadow_tile_cache_lookup(encoder->tileCache, cacheKey, data, nSrcStep, width,
+	                 height)))
 	{
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_INTERLEAVED) < 0)
+		RDPGFX_POINT16 destPt;
+		RDPGFX_CACHE_TO_SURFACE_PDU cacheToSurface;
+		destPt.x = tile->left;
+		destPt.y = tile->top;
+		cacheToSurface.cacheSlot = cacheSlot;
+		cacheToSurface.surfaceId = 0;
+		cacheToSurface.destPtsCount = 1;
+		cacheToSurface.destPts = &destPt;
+		freerdp_metric_add(FREERDP_METRIC_GFX_CACHE_HIT, 1);
+		IFCALLRET(rdpgfx->CacheToSurface, error, rdpgfx, &cacheToSurface);
+
+		if (error)
 		{
-			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_INTERLEAVED");
+			WLog_ERR(TAG, "CacheToSurface failed with error %"PRIu32"", error);
 			return FALSE;
 		}
+
+		return TRUE;
 	}
-	else
+
+	freerdp_metric_add(FREERDP_METRIC_GFX_CACHE_MISS, 1);
+
+	if (!(buffer = freerdp_bitmap_compress_planar(encoder->planar, data, PIXEL_FORMAT_BGRX32,
+	               width, height, nSrcStep, NULL, &dstSize)))
 	{
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PLANAR) < 0)
-		{
-			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PLANAR");
-			return FALSE;
-		}
+		WLog_ERR(TAG, "freerdp_bitmap_compress_planar failed");
+		return FALSE;
+	}
+
+	cmd.surfaceId = 0;
+	cmd.codecId = RDPGFX_CODECID_PLANAR;
+	cmd.contextId = 0;
+	cmd.format = PIXEL_FORMAT_BGRX32;
+	cmd.left = tile->left;
+	cmd.top = tile->top;
+	cmd.right = tile->right;
+	cmd.bottom = tile->bottom;
+	cmd.width = width;
+	cmd.height = height;
+	cmd.length = dstSize;
+	cmd.data = buffer;
+	cmd.extra = NULL;
+	IFCALLRET(rdpgfx->SurfaceCommand, error, rdpgfx, &cmd);
+	free(buffer);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "SurfaceCommand failed with error %"PRIu32"", error);
+		return FALSE;
+	}
+
+	while ((cacheSlot = shadow_tile_cache_evict(encoder->tileCache, width, height)))
+	{
+		RDPGFX_EVICT_CACHE_ENTRY_PDU evictCacheEntry;
+		evictCacheEntry.cacheSlot = cacheSlot;
+		IFCALLRET(rdpgfx->EvictCacheEntry, error, rdpgfx, &evictCacheEntry);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "EvictCacheEntry failed with error %"PRIu32"", error);
+			return FALSE;
+		}
+	}
+
+	if (!(cacheSlot = shadow_tile_cache_add(encoder->tileCache, cacheKey, data, nSrcStep, width,
+	                                        height)))
+		return TRUE;
+
+	surfaceToCache.surfaceId = 0;
+	surfaceToCache.cacheKey = cacheKey;
+	surfaceToCache.cacheSlot = cacheSlot;
+	surfaceToCache.rectSrc = *tile;
+	IFCALLRET(rdpgfx->SurfaceToCache, error, rdpgfx, &surfaceToCache);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "SurfaceToCache failed with error %"PRIu32"", error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Sends the rectangles on the GFX channel as tiles of a 64x64 grid. Each
+ * tile goes to the codec for its content: text and user interface tiles are
+ * planar encoded and cached, so that content that reappears at a tile
+ * position is found in the tile cache, images are sent with RemoteFX and
+ * video with AVC420. Moved content is copied from moveSrc to moveDst before,
+ * if given, and single colour rectangles are filled.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_tiles(rdpShadowClient* client,
+        const BYTE* pSrcData, int nSrcStep, int nWidth, int nHeight,
+        const RECTANGLE_16* rects, UINT32 numRects, const RECTANGLE_16* moveSrc,
+        const RECTANGLE_16* moveDst, SHADOW_FILL* fills, UINT32 numFills)
+{
+	BOOL ret = FALSE;
+	UINT32 index;
+	UINT32 next;
+	UINT32 numTileRects = 0;
+	UINT32 numTiles = 0;
+	UINT32 numImageRects = 0;
+	UINT32 numVideoRects = 0;
+	BOOL avc420 = FALSE;
+	RECTANGLE_16* fillRects = NULL;
+	RFX_RECT* imageRects = NULL;
+	RECTANGLE_16* videoRects = NULL;
+	UINT error = CHANNEL_RC_OK;
+	REGION16 tileRegion;
+	SYSTEMTIME sTime;
+	RDPGFX_START_FRAME_PDU startFrame;
+	RDPGFX_END_FRAME_PDU endFrame;
+	const RECTANGLE_16* tileRects;
+	rdpSettings* settings = ((rdpContext*) client)->settings;
+	rdpShadowEncoder* encoder = client->encoder;
+	RdpgfxServerContext* rdpgfx = client->rdpgfx;
+
+	if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PLANAR) < 0)
+	{
+		WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PLANAR");
+		return FALSE;
+	}
+
+	/* without an H.264 encoder video goes to RemoteFX as well */
+	if (settings->GfxH264)
+	{
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_AVC420) < 0)
+		{
+			WLog_WARN(TAG, "Failed to prepare encoder FREERDP_CODEC_AVC420");
+			settings->GfxH264 = FALSE;
+		}
+		else
+			avc420 = TRUE;
+	}
+
+	region16_init(&tileRegion);
+
+	for (index = 0; index < numRects; index++)
+	{
+		RECTANGLE_16 rect;
+		rect.left = rects[index].left & ~63;
+		rect.top = rects[index].top & ~63;
+		rect.right = MIN((rects[index].right + 63) & ~63, nWidth);
+		rect.bottom = MIN((rects[index].bottom + 63) & ~63, nHeight);
+
+		if (!region16_union_rect(&tileRegion, &tileRegion, &rect))
+			goto out;
+	}
+
+	startFrame.frameId = shadow_encoder_create_frame_id(encoder);
+	GetSystemTime(&sTime);
+	startFrame.timestamp = sTime.wHour << 22 | sTime.wMinute << 16 |
+	                       sTime.wSecond << 10 | sTime.wMilliseconds;
+	endFrame.frameId = startFrame.frameId;
+	IFCALLRET(rdpgfx->StartFrame, error, rdpgfx, &startFrame);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "StartFrame failed with error %"PRIu32"", error);
+		goto out;
+	}
+
+	if (moveSrc)
+	{
+		RDPGFX_POINT16 destPt;
+		RDPGFX_SURFACE_TO_SURFACE_PDU surfaceToSurface;
+		destPt.x = moveDst->left;
+		destPt.y = moveDst->top;
+		surfaceToSurface.surfaceIdSrc = 0;
+		surfaceToSurface.surfaceIdDest = 0;
+		surfaceToSurface.rectSrc = *moveSrc;
+		surfaceToSurface.destPtsCount = 1;
+		surfaceToSurface.destPts = &destPt;
+		IFCALLRET(rdpgfx->SurfaceToSurface, error, rdpgfx, &surfaceToSurface);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "SurfaceToSurface failed with error %"PRIu32"", error);
+			goto out;
+		}
+	}
+
+	/* one solid fill per colour */
+	qsort(fills, numFills, sizeof(SHADOW_FILL), shadow_client_compare_fills);
+
+	for (index = 0; index < numFills; index = next)
+	{
+		UINT32 fill;
+		RDPGFX_SOLID_FILL_PDU solidFill;
+		next = index + 1;
+
+		while ((next < numFills) && (fills[next].color == fills[index].color) &&
+		       (next - index < 0xFFFF))
+			next++;
+
+		if (!(fillRects = (RECTANGLE_16*) realloc(fillRects, (next - index) * sizeof(RECTANGLE_16))))
+			goto out;
+
+		for (fill = index; fill < next; fill++)
+			fillRects[fill - index] = fills[fill].rect;
+
+		solidFill.surfaceId = 0;
+		solidFill.fillPixel.B = fills[index].color & 0xFF;
+		solidFill.fillPixel.G = (fills[index].color >> 8) & 0xFF;
+		solidFill.fillPixel.R = (fills[index].color >> 16) & 0xFF;
+		solidFill.fillPixel.XA = 0xFF;
+		solidFill.fillRectCount = next - index;
+		solidFill.fillRects = fillRects;
+		IFCALLRET(rdpgfx->SolidFill, error, rdpgfx, &solidFill);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "SolidFill failed with error %"PRIu32"", error);
+			goto out;
+		}
+	}
+
+	/* the region bands and edges of grid aligned rectangles stay on the grid */
+	tileRects = region16_rects(&tileRegion, &numTileRects);
+
+	for (index = 0; index < numTileRects; index++)
+	{
+		const RECTANGLE_16* rect = &tileRects[index];
+		numTiles += ((rect->right - rect->left + 63) / 64) * ((rect->bottom - rect->top + 63) / 64);
+	}
+
+	imageRects = (RFX_RECT*) calloc(MAX(numTiles, 1), sizeof(RFX_RECT));
+	videoRects = (RECTANGLE_16*) calloc(MAX(numTiles, 1), sizeof(RECTANGLE_16));
+
+	if (!imageRects || !videoRects)
+		goto out;
+
+	/* text and user interface tiles are sent right away, the others are collected */
+	shadow_classifier_frame(encoder->classifier);
+
+	for (index = 0; index < numTileRects; index++)
+	{
+		RECTANGLE_16 tile;
+		const RECTANGLE_16* rect = &tileRects[index];
+
+		for (tile.top = rect->top; tile.top < rect->bottom; tile.top += 64)
+		{
+			tile.bottom = MIN(tile.top + 64, rect->bottom);
+
+			for (tile.left = rect->left; tile.left < rect->right; tile.left += 64)
+			{
+				UINT32 content;
+				RFX_RECT* last = (numImageRects > 0) ? &imageRects[numImageRects - 1] : NULL;
+				tile.right = MIN(tile.left + 64, rect->right);
+				content = shadow_classifier_tile(encoder->classifier, pSrcData, nSrcStep, &tile);
+
+				/* RemoteFX and H.264 code whole blocks, small pieces are cheaper in planar */
+				if ((tile.right - tile.left) * (tile.bottom - tile.top) < 64 * 64 / 4)
+					content = SHADOW_CONTENT_TEXT;
+
+				switch (content)
+				{
+					case SHADOW_CONTENT_VIDEO:
+						if (avc420)
+						{
+							videoRects[numVideoRects++] = tile;
+							break;
+						}
+
+					/* fall through */
+					case SHADOW_CONTENT_IMAGE:
+						if (last && (last->x + last->width == tile.left) && (last->y == tile.top) &&
+						    (last->height == tile.bottom - tile.top))
+						{
+							last->width += tile.right - tile.left;
+							break;
+						}
+
+						imageRects[numImageRects].x = tile.left;
+						imageRects[numImageRects].y = tile.top;
+						imageRects[numImageRects].width = tile.right - tile.left;
+						imageRects[numImageRects].height = tile.bottom - tile.top;
+						numImageRects++;
+						break;
+
+					default:
+						if (!shadow_client_send_surface_tile(client, pSrcData, nSrcStep, &tile))
+							goto out;
+
+						break;
+				}
+			}
+		}
+	}
+
+	if ((numVideoRects > 0) &&
+	    !shadow_client_send_surface_avc420(client, pSrcData, nSrcStep, nWidth, nHeight, videoRects,
+	                                       numVideoRects))
+	{
+		if (settings->GfxH264)
+			goto out;
+
+		for (index = 0; index < numVideoRects; index++)
+		{
+			imageRects[numImageRects].x = videoRects[index].left;
+			imageRects[numImageRects].y = videoRects[index].top;
+			imageRects[numImageRects].width = videoRects[index].right - videoRects[index].left;
+			imageRects[numImageRects].height = videoRects[index].bottom - videoRects[index].top;
+			numImageRects++;
+		}
+	}
+
+	if ((numImageRects > 0) &&
+	    !shadow_client_send_surface_rfx(client, pSrcData, nSrcStep, nWidth, nHeight, imageRects,
+	                                    numImageRects))
+		goto out;
+
+	IFCALLRET(rdpgfx->EndFrame, error, rdpgfx, &endFrame);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "EndFrame failed with error %"PRIu32"", error);
+		goto out;
+	}
+
+	ret = TRUE;
+out:
+	free(fillRects);
+	free(imageRects);
+	free(videoRects);
+	region16_uninit(&tileRegion);
+	return ret;
+}
+
+/**
+ * Function description
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
+        BYTE* pSrcData, int nSrcStep, const RECTANGLE_16* rects, UINT32 numRects)
+{
+	BOOL ret = TRUE;
+	int i;
+	UINT32 index;
+	BOOL first;
+	BOOL last;
+	wStream* s;
+	int numMessages;
+	UINT32 frameId = 0;
+	rdpUpdate* update;
+	rdpContext* context = (rdpContext*) client;
+	rdpSettings* settings;
+	rdpShadowEncoder* encoder;
+	SURFACE_BITS_COMMAND cmd;
+
+	if (!context || !pSrcData)
+		return FALSE;
+
+	update = context->update;
+	settings = context->settings;
+	encoder = client->encoder;
+
+	if (!update || !settings || !encoder)
+		return FALSE;
+
+	if (encoder->frameAck)
+		frameId = shadow_encoder_create_frame_id(encoder);
+
+	if (settings->RemoteFxCodec)
+	{
+		RFX_RECT rfxRects[SHADOW_MAX_RECTS];
+		RFX_MESSAGE* messages;
+		RFX_RECT* messageRects = NULL;
+
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_REMOTEFX");
+			return FALSE;
+		}
+
+		s = encoder->bs;
+
+		/* tiles are only encoded where they intersect one of the rectangles */
+		for (index = 0; index < numRects; index++)
+		{
+			rfxRects[index].x = rects[index].left;
+			rfxRects[index].y = rects[index].top;
+			rfxRects[index].width = rects[index].right - rects[index].left;
+			rfxRects[index].height = rects[index].bottom - rects[index].top;
+		}
+
+		if (!(messages = rfx_encode_messages(encoder->rfx, rfxRects, numRects, pSrcData,
+		                                     settings->DesktopWidth, settings->DesktopHeight, nSrcStep, &numMessages,
+		                                     settings->MultifragMaxRequestSize)))
+		{
+			WLog_ERR(TAG, "rfx_encode_messages failed");
+			return FALSE;
+		}
+
+		cmd.codecID = settings->RemoteFxCodecId;
+		cmd.destLeft = 0;
+		cmd.destTop = 0;
+		cmd.destRight = settings->DesktopWidth;
+		cmd.destBottom = settings->DesktopHeight;
+		cmd.bpp = 32;
+		cmd.width = settings->DesktopWidth;
+		cmd.height = settings->DesktopHeight;
+		cmd.skipCompression = TRUE;
+
+		if (numMessages > 0)
+			messageRects = messages[0].rects;
+
+		for (i = 0; i < numMessages; i++)
+		{
+			Stream_SetPosition(s, 0);
+
+			if (!rfx_write_message(encoder->rfx, s, &messages[i]))
+			{
+				while (i < numMessages)
+				{
+					rfx_message_free(encoder->rfx, &messages[i++]);
+				}
+
+				WLog_ERR(TAG, "rfx_write_message failed");
+				ret = FALSE;
+				break;
+			}
+
+			rfx_message_free(encoder->rfx, &messages[i]);
+			cmd.bitmapDataLength = Stream_GetPosition(s);
+			cmd.bitmapData = Stream_Buffer(s);
+			first = (i == 0) ? TRUE : FALSE;
+			last = ((i + 1) == numMessages) ? TRUE : FALSE;
+
+			if (!encoder->frameAck)
+				IFCALLRET(update->SurfaceBits, ret, update->context, &cmd);
+			else
+				IFCALLRET(update->SurfaceFrameBits, ret, update->context, &cmd, first, last,
+				          frameId);
+
+			if (!ret)
+			{
+				WLog_ERR(TAG, "Send surface bits(RemoteFxCodec) failed");
+				break;
+			}
+		}
+
+		free(messageRects);
+		free(messages);
+	}
+	else if (settings->NSCodec)
+	{
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_NSCODEC) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_NSCODEC");
+			return FALSE;
+		}
+
+		s = encoder->bs;
+
+		for (index = 0; index < numRects; index++)
+		{
+			const int nXSrc = rects[index].left;
+			const int nYSrc = rects[index].top;
+			const int nWidth = rects[index].right - rects[index].left;
+			const int nHeight = rects[index].bottom - rects[index].top;
+			Stream_SetPosition(s, 0);
+			nsc_compose_message(encoder->nsc, s, &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)],
+			                    nWidth, nHeight, nSrcStep);
+			cmd.bpp = 32;
+			cmd.codecID = settings->NSCodecId;
+			cmd.destLeft = nXSrc;
+			cmd.destTop = nYSrc;
+			cmd.destRight = cmd.destLeft + nWidth;
+			cmd.destBottom = cmd.destTop + nHeight;
+			cmd.width = nWidth;
+			cmd.height = nHeight;
+			cmd.bitmapDataLength = Stream_GetPosition(s);
+			cmd.bitmapData = Stream_Buffer(s);
+			first = (index == 0) ? TRUE : FALSE;
+			last = ((index + 1) == numRects) ? TRUE : FALSE;
+
+			if (!encoder->frameAck)
+				IFCALLRET(update->SurfaceBits, ret, update->context, &cmd);
+			else
+				IFCALLRET(update->SurfaceFrameBits, ret, update->context, &cmd, first, last,
+				          frameId);
+
+			if (!ret)
+			{
+				WLog_ERR(TAG, "Send surface bits(NSCodec) failed");
+				break;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * Sends runs of horizontally adjacent tiles sharing the same two colors
+ * as glyph orders and marks them in textTiles, those tiles need not be
+ * sent as bitmaps anymore.
+ *
+ * Only clients on the legacy bitmap update path get glyph orders, i.e.
+ * without the graphics pipeline, RemoteFX and NSCodec. Those paths encode
+ * text with their own codecs and never reach shadow_client_send_bitmap_update.
+ *
+ * @return TRUE if at least one tile was sent as text
+ */
+static BOOL shadow_client_send_glyph_tiles(rdpShadowClient* client,
+        BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc, int nWidth,
+        int nHeight, int rows, int cols, BYTE* textTiles)
+{
+	int yIdx, xIdx;
+	BOOL sent = FALSE;
+	BOOL painting = FALSE;
+	rdpContext* context = (rdpContext*) client;
+	rdpUpdate* update = context->update;
+	rdpShadowGlyphCache* glyphCache = client->encoder->glyphCache;
+
+	for (yIdx = 0; yIdx < rows; yIdx++)
+	{
+		int runStart = 0;
+		int runColorCount = 0;
+		BOOL runHasText = FALSE;
+		UINT32 runColors[2] = { 0 };
+		UINT32 runCounts[2] = { 0 };
+		RECTANGLE_16 tile;
+		tile.top = nYSrc + (yIdx * 64);
+		tile.bottom = MIN(tile.top + 64, nYSrc + nHeight);
+
+		for (xIdx = 0; xIdx <= cols; xIdx++)
+		{
+			int i, j;
+			int count = 0;
+			UINT32 colors[2];
+			UINT32 counts[2];
+			UINT32 merged[2];
+			UINT32 mergedCounts[2];
+			int mergedCount = runColorCount;
+			CopyMemory(merged, runColors, sizeof(merged));
+			CopyMemory(mergedCounts, runCounts, sizeof(mergedCounts));
+			tile.left = nXSrc + (xIdx * 64);
+			tile.right = MIN(tile.left + 64, nXSrc + nWidth);
+
+			if ((xIdx < cols) && ((tile.right - tile.left) >= 4) &&
+			    ((tile.bottom - tile.top) >= 4))
+				count = shadow_glyph_classify(pSrcData, nSrcStep, &tile, colors, counts);
+
+			for (i = 0; i < count; i++)
+			{
+				for (j = 0; j < mergedCount; j++)
+				{
+					if (merged[j] == colors[i])
+						break;
+				}
+
+				if (j == mergedCount)
+				{
+					if (mergedCount == 2)
+					{
+						mergedCount = 3;
+						break;
+					}
+
+					merged[mergedCount] = colors[i];
+					mergedCounts[mergedCount++] = 0;
+				}
+
+				mergedCounts[j] += counts[i];
+			}
+
+			if ((count > 0) && (mergedCount <= 2))
+			{
+				runColorCount = mergedCount;
+				CopyMemory(runColors, merged, sizeof(runColors));
+				CopyMemory(runCounts, mergedCounts, sizeof(runCounts));
+				runHasText |= (count == 2);
+				continue;
+			}
+
+			/* the run ends here */
+			if (runHasText)
+			{
+				const BOOL bgFirst = (runCounts[0] >= runCounts[1]);
+				RECTANGLE_16 rect;
+				rect.left = nXSrc + (runStart * 64);
+				rect.top = tile.top;
+				rect.right = MIN(tile.left, nXSrc + nWidth);
+				rect.bottom = tile.bottom;
+
+				if (!painting)
+				{
+					update->BeginPaint(context);
+					painting = TRUE;
+				}
+
+				if (shadow_glyph_cache_encode(glyphCache, context, pSrcData, nSrcStep, &rect,
+				                              runColors[bgFirst ? 0 : 1], runColors[bgFirst ? 1 : 0]))
+				{
+					for (i = runStart; i < xIdx; i++)
+						textTiles[(yIdx * cols) + i] = 1;
+
+					sent = TRUE;
+				}
+			}
+
+			runStart = xIdx;
+			runColorCount = 0;
+			runHasText = FALSE;
+
+			if (count > 0)
+			{
+				runColorCount = count;
+				CopyMemory(runColors, colors, sizeof(runColors));
+				CopyMemory(runCounts, counts, sizeof(runCounts));
+				runHasText = (count == 2);
+			}
+			else
+			{
+				runStart = xIdx + 1;
+			}
+		}
+	}
+
+	if (painting)
+		update->EndPaint(context);
+
+	return sent;
+}
+
+/**
+ * Function description
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client,
+        BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc, int nWidth, int nHeight)
+{
+	BOOL ret = TRUE;
+	BYTE* data;
+	BYTE* buffer;
+	int yIdx, xIdx, k;
+	int rows, cols;
+	UINT32 DstSize;
+	UINT32 SrcFormat;
+	BITMAP_DATA* bitmap;
+	rdpUpdate* update;
+	rdpContext* context = (rdpContext*) client;
+	rdpSettings* settings;
+	UINT32 maxUpdateSize;
+	UINT32 totalBitmapSize;
+	UINT32 updateSizeEstimate;
+	BITMAP_DATA* bitmapData;
+	BITMAP_UPDATE bitmapUpdate;
+	rdpShadowEncoder* encoder;
+	BYTE* textTiles = NULL;
+
+	if (!context || !pSrcData)
+		return FALSE;
+
+	update = context->update;
+	settings = context->settings;
+	encoder = client->encoder;
+
+	if (!update || !settings || !encoder)
+		return FALSE;
+
+	maxUpdateSize = settings->MultifragMaxRequestSize;
+
+	if (settings->ColorDepth < 32)
+	{
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_INTERLEAVED) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_INTERLEAVED");
+			return FALSE;
+		}
+	}
+	else
+	{
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PLANAR) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PLANAR");
+			return FALSE;
+		}
 	}
 
 	SrcFormat = PIXEL_FORMAT_BGRX32;
@@ -1023,6 +1754,19 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client,
 		nHeight += (4 - (nHeight % 4));
 	}
 
+	/* tiles containing only two colors are tried as text first */
+	if (encoder->glyphCache)
+	{
+		textTiles = (BYTE*) calloc(rows * cols, sizeof(BYTE));
+
+		if (textTiles && !shadow_client_send_glyph_tiles(client, pSrcData, nSrcStep, nXSrc,
+		        nYSrc, nWidth, nHeight, rows, cols, textTiles))
+		{
+			free(textTiles);
+			textTiles = NULL;
+		}
+	}
+
 	for (yIdx = 0; yIdx < rows; yIdx++)
 	{
 		for (xIdx = 0; xIdx < cols; xIdx++)
@@ -1046,6 +1790,9 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client,
 			if ((bitmap->width < 4) || (bitmap->height < 4))
 				continue;
 
+			if (textTiles && textTiles[(yIdx * cols) + xIdx])
+				continue;
+
 			if (settings->ColorDepth < 32)
 			{
 				int bitsPerPixel = settings->ColorDepth;
@@ -1140,7 +1887,7 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client,
 
 		free(fragBitmapData);
 	}
-	else
+	else if (k > 0)
 	{
 		IFCALLRET(update->BitmapUpdate, ret, context, &bitmapUpdate);
 
@@ -1151,10 +1898,244 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client,
 	}
 
 out:
+	free(textTiles);
 	free(bitmapData);
 	return ret;
 }
 
+static INLINE INT64 shadow_rect_area(const RECTANGLE_16* rect)
+{
+	return (INT64)(rect->right - rect->left) * (rect->bottom - rect->top);
+}
+
+/* The pixels the bounding box of both rectangles adds */
+static INT64 shadow_rect_merge_waste(const RECTANGLE_16* a, const RECTANGLE_16* b,
+                                     RECTANGLE_16* merged)
+{
+	INT64 waste;
+	RECTANGLE_16 rect;
+	rect.left = MIN(a->left, b->left);
+	rect.top = MIN(a->top, b->top);
+	rect.right = MAX(a->right, b->right);
+	rect.bottom = MAX(a->bottom, b->bottom);
+	waste = shadow_rect_area(&rect) - shadow_rect_area(a) - shadow_rect_area(b);
+
+	if (merged)
+		*merged = rect;
+
+	return MAX(waste, 0);
+}
+
+/* Finds the cheapest merge of rects[index] with one of the rectangles after it */
+static void shadow_rect_find_merge(const RECTANGLE_16* rects, UINT32 count, UINT32 index,
+                                   INT64* waste, BYTE* partner)
+{
+	UINT32 j;
+	const UINT32 last = MIN(count - 1, index + SHADOW_MERGE_WINDOW);
+	partner[index] = 0;
+
+	for (j = index + 1; j <= last; j++)
+	{
+		const INT64 w = shadow_rect_merge_waste(&rects[index], &rects[j], NULL);
+
+		if (!partner[index] || (w < waste[index]))
+		{
+			partner[index] = (BYTE)(j - index);
+			waste[index] = w;
+		}
+	}
+}
+
+/**
+ * Splits the invalid region into the rectangles to encode. The pair of
+ * rectangles whose bounding box adds the fewest pixels is merged as long
+ * as that costs less than encoding one more rectangle, or while there are
+ * more than SHADOW_MAX_RECTS.
+ *
+ * Region rectangles are sorted in bands, neighbours on screen are close in
+ * that order. Each rectangle only considers the next SHADOW_MERGE_WINDOW
+ * ones and its best merge is kept, a merge updates the few entries whose
+ * window changed. That bounds the work to O(n * (n + window^2)).
+ *
+ * @return the number of rectangles written to rects
+ */
+static UINT32 shadow_client_encode_rects(const REGION16* region, RECTANGLE_16* rects)
+{
+	UINT32 i, j;
+	UINT32 best;
+	UINT32 count = 0;
+	INT64 waste[SHADOW_MAX_REGION_RECTS];
+	BYTE partner[SHADOW_MAX_REGION_RECTS];
+	const RECTANGLE_16* regionRects = region16_rects(region, &count);
+
+	if ((count < 1) || (count > SHADOW_MAX_REGION_RECTS))
+	{
+		rects[0] = *region16_extents(region);
+		return 1;
+	}
+
+	CopyMemory(rects, regionRects, sizeof(RECTANGLE_16) * count);
+
+	for (i = 0; i < count; i++)
+		shadow_rect_find_merge(rects, count, i, waste, partner);
+
+	while (count > 1)
+	{
+		best = 0;
+
+		for (i = 1; i < count - 1; i++)
+		{
+			if (waste[i] < waste[best])
+				best = i;
+		}
+
+		if ((waste[best] > SHADOW_RECT_COST) && (count <= SHADOW_MAX_RECTS))
+			break;
+
+		j = best + partner[best];
+		shadow_rect_merge_waste(&rects[best], &rects[j], &rects[best]);
+		MoveMemory(&rects[j], &rects[j + 1], sizeof(RECTANGLE_16) * (count - j - 1));
+		MoveMemory(&waste[j], &waste[j + 1], sizeof(INT64) * (count - j - 1));
+		MoveMemory(&partner[j], &partner[j + 1], sizeof(BYTE) * (count - j - 1));
+		count--;
+
+		/* the windows that held rects[best] or the removed rectangle */
+		for (i = (best > SHADOW_MERGE_WINDOW) ? best - SHADOW_MERGE_WINDOW : 0; i < j; i++)
+		{
+			if (i < count - 1)
+				shadow_rect_find_merge(rects, count, i, waste, partner);
+		}
+	}
+
+	return count;
+}
+
+/**
+ * Copies moved content on the client with a screen to screen blit.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_scrblt(rdpShadowClient* client, const RECTANGLE_16* moveSrc,
+                                      const RECTANGLE_16* moveDst)
+{
+	BOOL ret;
+	SCRBLT_ORDER scrblt;
+	rdpContext* context = (rdpContext*) client;
+	rdpUpdate* update = context->update;
+	scrblt.nLeftRect = moveDst->left;
+	scrblt.nTopRect = moveDst->top;
+	scrblt.nWidth = moveDst->right - moveDst->left;
+	scrblt.nHeight = moveDst->bottom - moveDst->top;
+	scrblt.bRop = 0xCC; /* SRCCOPY */
+	scrblt.nXSrc = moveSrc->left;
+	scrblt.nYSrc = moveSrc->top;
+	update->BeginPaint(context);
+	ret = IFCALLRESULT(FALSE, update->primary->ScrBlt, context, &scrblt);
+	update->EndPaint(context);
+	return ret;
+}
+
+/**
+ * Fills single colour rectangles with opaque rectangle orders.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_opaque_rects(rdpShadowClient* client, const SHADOW_FILL* fills,
+        UINT32 numFills)
+{
+	UINT32 index;
+	UINT32 format;
+	BOOL ret = TRUE;
+	OPAQUE_RECT_ORDER opaqueRect;
+	rdpContext* context = (rdpContext*) client;
+	rdpUpdate* update = context->update;
+
+	switch (context->settings->ColorDepth)
+	{
+		case 32:
+		case 24:
+			format = PIXEL_FORMAT_BGR24;
+			break;
+
+		case 16:
+			format = PIXEL_FORMAT_RGB16;
+			break;
+
+		default:
+			format = PIXEL_FORMAT_RGB15;
+			break;
+	}
+
+	update->BeginPaint(context);
+
+	for (index = 0; ret && (index < numFills); index++)
+	{
+		const SHADOW_FILL* fill = &fills[index];
+		opaqueRect.nLeftRect = fill->rect.left;
+		opaqueRect.nTopRect = fill->rect.top;
+		opaqueRect.nWidth = fill->rect.right - fill->rect.left;
+		opaqueRect.nHeight = fill->rect.bottom - fill->rect.top;
+		opaqueRect.color = GetColor(format, (fill->color >> 16) & 0xFF, (fill->color >> 8) & 0xFF,
+		                            fill->color & 0xFF, 0xFF);
+		ret = IFCALLRESULT(FALSE, update->primary->OpaqueRect, context, &opaqueRect);
+	}
+
+	update->EndPaint(context);
+	return ret;
+}
+
+/* Adds the parts of the rectangles of src that are outside of rect to dst */
+static BOOL shadow_client_subtract_rect(REGION16* dst, const REGION16* src,
+                                        const RECTANGLE_16* rect)
+{
+	UINT32 index;
+	UINT32 numRects = 0;
+	const RECTANGLE_16* rects = region16_rects(src, &numRects);
+
+	for (index = 0; index < numRects; index++)
+	{
+		UINT32 part;
+		RECTANGLE_16 inner;
+		RECTANGLE_16 parts[4];
+		const RECTANGLE_16* r = &rects[index];
+
+		if (!rectangles_intersection(r, rect, &inner))
+		{
+			if (!region16_union_rect(dst, dst, r))
+				return FALSE;
+
+			continue;
+		}
+
+		/* the bands above and below the intersection, and its left and right */
+		parts[0].left = r->left;
+		parts[0].top = r->top;
+		parts[0].right = r->right;
+		parts[0].bottom = inner.top;
+		parts[1].left = r->left;
+		parts[1].top = inner.bottom;
+		parts[1].right = r->right;
+		parts[1].bottom = r->bottom;
+		parts[2].left = r->left;
+		parts[2].top = inner.top;
+		parts[2].right = inner.left;
+		parts[2].bottom = inner.bottom;
+		parts[3].left = inner.right;
+		parts[3].top = inner.top;
+		parts[3].right = r->right;
+		parts[3].bottom = inner.bottom;
+
+		for (part = 0; part < 4; part++)
+		{
+			if ((parts[part].left < parts[part].right) && (parts[part].top < parts[part].bottom) &&
+			    !region16_union_rect(dst, dst, &parts[part]))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
 /**
  * Function description
  *
@@ -1164,19 +2145,29 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client,
         SHADOW_GFX_STATUS* pStatus)
 {
 	BOOL ret = TRUE;
-	int nXSrc, nYSrc;
 	int nWidth, nHeight;
 	rdpContext* context = (rdpContext*) client;
 	rdpSettings* settings;
 	rdpShadowServer* server;
 	rdpShadowSurface* surface;
 	REGION16 invalidRegion;
+	REGION16 encodeRegion;
+	REGION16 codecRegion;
 	RECTANGLE_16 surfaceRect;
-	const RECTANGLE_16* extents;
+	RECTANGLE_16 encodeRects[SHADOW_MAX_REGION_RECTS];
+	RECTANGLE_16 moveSrc;
+	RECTANGLE_16 moveDst;
 	BYTE* pSrcData;
 	int nSrcStep;
 	int index;
+	int subX = 0;
+	int subY = 0;
+	BOOL gfx;
+	BOOL moved = FALSE;
 	UINT32 numRects = 0;
+	UINT32 numEncodeRects = 0;
+	UINT32 numFills = 0;
+	SHADOW_FILL* fills = NULL;
 	const RECTANGLE_16* rects;
 
 	if (!context || !pStatus)
@@ -1195,6 +2186,8 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client,
 
 	EnterCriticalSection(&(client->lock));
 	region16_init(&invalidRegion);
+	region16_init(&encodeRegion);
+	region16_init(&codecRegion);
 	region16_copy(&invalidRegion, &(client->invalidRegion));
 	region16_clear(&(client->invalidRegion));
 	LeaveCriticalSection(&(client->lock));
@@ -1211,76 +2204,161 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client,
 	surfaceRect.bottom = surface->height;
 	region16_intersect_rect(&invalidRegion, &invalidRegion, &surfaceRect);
 
-	if (server->shareSubRect)
-	{
-		region16_intersect_rect(&invalidRegion, &invalidRegion, &(server->subRect));
+	if (server->shareSubRect)
+	{
+		region16_intersect_rect(&invalidRegion, &invalidRegion, &(server->subRect));
+	}
+
+	if (region16_is_empty(&invalidRegion))
+	{
+		/* No image region need to be updated. Success */
+		goto out;
+	}
+
+	/* the GFX channel is open by now, falling back to surface bits is no option */
+	if (InterlockedExchange(&client->encoder->tileCacheReset, 0) &&
+	    !(ret = shadow_client_reset_tile_cache(client, settings)))
+		goto out;
+
+	/* the tile cache exists once the GFX capabilities have been confirmed */
+	gfx = settings->SupportGraphicsPipeline && pStatus->gfxOpened && client->encoder->tileCache;
+
+	/* Create primary surface if have not */
+	if (gfx && !pStatus->gfxSurfaceCreated)
+	{
+		if (!(ret = shadow_client_rdpgfx_reset_graphic(client)))
+			goto out;
+
+		if (!(ret = shadow_client_rdpgfx_new_surface(client)))
+			goto out;
+
+		/* the new surface is blank, nothing on it can be moved yet */
+		shadow_motion_reset(client->encoder->motion);
+
+		/* and its RemoteFX decoder needs the headers */
+		if (client->encoder->rfx)
+			rfx_context_reset(client->encoder->rfx, client->encoder->width,
+			                  client->encoder->height);
+
+		pStatus->gfxSurfaceCreated = TRUE;
 	}
 
-	if (region16_is_empty(&invalidRegion))
+	/* scrolled or moved content is copied on the client instead of encoded again */
+	if ((gfx || settings->OrderSupport[NEG_SCRBLT_INDEX]) &&
+	    shadow_motion_detect(client->encoder->motion, surface->data, surface->scanline,
+	                         region16_extents(&invalidRegion), &moveSrc, &moveDst))
 	{
-		/* No image region need to be updated. Success */
+		if (!(ret = shadow_client_subtract_rect(&encodeRegion, &invalidRegion, &moveDst)))
+			goto out;
+
+		moved = TRUE;
+	}
+	else if (!(ret = region16_copy(&encodeRegion, &invalidRegion)))
 		goto out;
+
+	/* single colour areas are filled, only the rest goes to the codec */
+	if (gfx || (settings->OrderSupport[NEG_OPAQUE_RECT_INDEX] && (settings->ColorDepth >= 15)))
+	{
+		if (!(ret = shadow_client_split_fills(surface->data, surface->scanline, &encodeRegion,
+		                                      &codecRegion, &fills, &numFills)))
+			goto out;
 	}
+	else if (!(ret = region16_copy(&codecRegion, &encodeRegion)))
+		goto out;
+
+	/* sparse updates are encoded rectangle by rectangle instead of as their bounding box */
+	if (!region16_is_empty(&codecRegion))
+		numEncodeRects = shadow_client_encode_rects(&codecRegion, encodeRects);
 
-	extents = region16_extents(&invalidRegion);
-	nXSrc = extents->left;
-	nYSrc = extents->top;
-	nWidth = extents->right - extents->left;
-	nHeight = extents->bottom - extents->top;
 	pSrcData = surface->data;
 	nSrcStep = surface->scanline;
 
-	/* Move to new pSrcData / nXSrc / nYSrc according to sub rect */
+	/* Move to new pSrcData / rectangles according to sub rect */
 	if (server->shareSubRect)
 	{
-		int subX, subY;
 		subX = server->subRect.left;
 		subY = server->subRect.top;
-		nXSrc -= subX;
-		nYSrc -= subY;
 		pSrcData = &pSrcData[(subY * nSrcStep) + (subX * 4)];
-	}
 
-	//WLog_INFO(TAG, "shadow_client_send_surface_update: x: %d y: %d width: %d height: %d right: %d bottom: %d",
-	//	nXSrc, nYSrc, nWidth, nHeight, nXSrc + nWidth, nYSrc + nHeight);
+		for (index = 0; index < numEncodeRects; index++)
+		{
+			encodeRects[index].left -= subX;
+			encodeRects[index].top -= subY;
+			encodeRects[index].right -= subX;
+			encodeRects[index].bottom -= subY;
+		}
 
-	if (settings->SupportGraphicsPipeline &&
-	    settings->GfxH264 &&
-	    pStatus->gfxOpened)
-	{
-		/* GFX/h264 always full screen encoded */
-		nWidth = settings->DesktopWidth;
-		nHeight = settings->DesktopHeight;
+		for (index = 0; index < numFills; index++)
+		{
+			fills[index].rect.left -= subX;
+			fills[index].rect.top -= subY;
+			fills[index].rect.right -= subX;
+			fills[index].rect.bottom -= subY;
+		}
 
-		/* Create primary surface if have not */
-		if (!pStatus->gfxSurfaceCreated)
+		if (moved)
 		{
-			/* Only init surface when we have h264 supported */
-			if (!(ret = shadow_client_rdpgfx_reset_graphic(client)))
-				goto out;
+			moveSrc.left -= subX;
+			moveSrc.top -= subY;
+			moveSrc.right -= subX;
+			moveSrc.bottom -= subY;
+			moveDst.left -= subX;
+			moveDst.top -= subY;
+			moveDst.right -= subX;
+			moveDst.bottom -= subY;
+		}
+	}
+
+	if (moved && !gfx && !(ret = shadow_client_send_scrblt(client, &moveSrc, &moveDst)))
+	{
+		WLog_ERR(TAG, "ScrBlt failed");
+		goto out;
+	}
 
-			if (!(ret = shadow_client_rdpgfx_new_surface(client)))
-				goto out;
+	if ((numFills > 0) && !gfx && !(ret = shadow_client_send_opaque_rects(client, fills, numFills)))
+	{
+		WLog_ERR(TAG, "OpaqueRect failed");
+		goto out;
+	}
 
-			pStatus->gfxSurfaceCreated = TRUE;
-		}
+	if (gfx)
+	{
+		nWidth = settings->DesktopWidth;
+		nHeight = settings->DesktopHeight;
 
-		ret = shadow_client_send_surface_gfx(client, pSrcData, nSrcStep, 0, 0, nWidth,
-		                                     nHeight);
+		ret = shadow_client_send_surface_tiles(client, pSrcData, nSrcStep, nWidth, nHeight,
+		                                       encodeRects, numEncodeRects,
+		                                       moved ? &moveSrc : NULL, &moveDst, fills, numFills);
 	}
 	else if (settings->RemoteFxCodec || settings->NSCodec)
 	{
-		ret = shadow_client_send_surface_bits(client, pSrcData, nSrcStep, nXSrc, nYSrc,
-		                                      nWidth, nHeight);
+		if (numEncodeRects > 0)
+			ret = shadow_client_send_surface_bits(client, pSrcData, nSrcStep, encodeRects,
+			                                      numEncodeRects);
 	}
 	else
 	{
-		ret = shadow_client_send_bitmap_update(client, pSrcData, nSrcStep, nXSrc, nYSrc,
-		                                       nWidth, nHeight);
+		for (index = 0; ret && (index < numEncodeRects); index++)
+		{
+			const RECTANGLE_16* rect = &encodeRects[index];
+			ret = shadow_client_send_bitmap_update(client, pSrcData, nSrcStep, rect->left,
+			                                       rect->top, rect->right - rect->left,
+			                                       rect->bottom - rect->top);
+		}
+	}
+
+	if (ret)
+	{
+		rects = region16_rects(&invalidRegion, &numRects);
+		shadow_motion_update(client->encoder->motion, surface->data, surface->scanline, rects,
+		                     numRects);
 	}
 
 out:
 	region16_uninit(&invalidRegion);
+	region16_uninit(&encodeRegion);
+	region16_uninit(&codecRegion);
+	free(fills);
 	return ret;
 }
 
@@ -1475,33 +2553,28 @@ static int shadow_client_subsystem_process_message(rdpShadowClient* client,
 	return 1;
 }
 
-static void* shadow_client_thread(rdpShadowClient* client)
+struct rdp_shadow_client_loop
 {
-	DWORD status;
-	DWORD nCount;
-	wMessage message;
-	wMessage pointerPositionMsg;
-	wMessage pointerAlphaMsg;
-	wMessage audioVolumeMsg;
-	HANDLE events[32];
-	HANDLE ChannelEvent;
+	rdpShadowClient* client;
+	BOOL shared;
 	void* UpdateSubscriber;
 	HANDLE UpdateEvent;
+	HANDLE ChannelEvent;
+	/* This should only be visited in client thread */
+	SHADOW_GFX_STATUS gfxstatus;
+};
+
+rdpShadowClientLoop* shadow_client_loop_new(rdpShadowClient* client, BOOL shared)
+{
 	freerdp_peer* peer;
 	rdpContext* context;
-	rdpSettings* settings;
 	rdpShadowServer* server;
 	rdpShadowSubsystem* subsystem;
-	wMessageQueue* MsgQueue = client->MsgQueue;
-	/* This should only be visited in client thread */
-	SHADOW_GFX_STATUS gfxstatus;
-	gfxstatus.gfxOpened = FALSE;
-	gfxstatus.gfxSurfaceCreated = FALSE;
+	rdpShadowClientLoop* loop;
 	server = client->server;
 	subsystem = server->subsystem;
 	context = (rdpContext*) client;
 	peer = context->peer;
-	settings = peer->settings;
 	peer->Capabilities = shadow_client_capabilities;
 	peer->PostConnect = shadow_client_post_connect;
 	peer->Activate = shadow_client_activate;
@@ -1516,213 +2589,308 @@ static void* shadow_client_thread(rdpShadowClient* client)
 	if ((!client->vcm) || (!subsystem->updateEvent))
 		goto out;
 
-	UpdateSubscriber = shadow_multiclient_get_subscriber(subsystem->updateEvent);
-
-	if (!UpdateSubscriber)
+	if (!(loop = (rdpShadowClientLoop*) calloc(1, sizeof(rdpShadowClientLoop))))
 		goto out;
 
-	UpdateEvent = shadow_multiclient_getevent(UpdateSubscriber);
-	ChannelEvent = WTSVirtualChannelManagerGetEventHandle(client->vcm);
+	loop->client = client;
+	loop->shared = shared;
 
-	while (1)
+	/* A shared loop subscribes once its client is activated */
+	if (!shared)
 	{
-		nCount = 0;
-		events[nCount++] = UpdateEvent;
+		if (!(loop->UpdateSubscriber = shadow_multiclient_get_subscriber(subsystem->updateEvent)))
 		{
-			DWORD tmp = peer->GetEventHandles(peer, &events[nCount], 64 - nCount);
+			free(loop);
+			goto out;
+		}
 
-			if (tmp == 0)
-			{
-				WLog_ERR(TAG, "Failed to get FreeRDP transport event handles");
-				break;
-			}
+		loop->UpdateEvent = shadow_multiclient_getevent(loop->UpdateSubscriber);
+	}
 
-			nCount += tmp;
-		}
-		events[nCount++] = ChannelEvent;
-		events[nCount++] = MessageQueue_Event(MsgQueue);
-		status = WaitForMultipleObjects(nCount, events, FALSE, INFINITE);
+	loop->ChannelEvent = WTSVirtualChannelManagerGetEventHandle(client->vcm);
+	return loop;
+out:
+	peer->Disconnect(peer);
+	freerdp_peer_context_free(peer);
+	freerdp_peer_free(peer);
+	return NULL;
+}
 
-		if (status == WAIT_FAILED)
-			break;
+/**
+ * Every subscriber holds up the frame updates until it consumed them, a client
+ * blocked in its TLS or NLA handshake must not be one. The shared loop of an
+ * activated client subscribes here, without waiting for the other subscribers.
+ */
+
+BOOL shadow_client_loop_subscribe(rdpShadowClientLoop* loop)
+{
+	rdpShadowSubsystem* subsystem = loop->client->server->subsystem;
+
+	if (loop->UpdateSubscriber)
+		return TRUE;
+
+	if (!(loop->UpdateSubscriber = shadow_multiclient_get_subscriber_nowait(subsystem->updateEvent)))
+		return FALSE;
+
+	loop->UpdateEvent = shadow_multiclient_getevent(loop->UpdateSubscriber);
+	return TRUE;
+}
+
+HANDLE shadow_client_loop_get_update_event(rdpShadowClientLoop* loop)
+{
+	return loop->UpdateEvent;
+}
+
+/**
+ * Returns the handles of this client only, the update event is shared by all clients
+ */
+
+DWORD shadow_client_loop_get_event_handles(rdpShadowClientLoop* loop, HANDLE* events,
+        DWORD count)
+{
+	DWORD nCount;
+	freerdp_peer* peer = ((rdpContext*) loop->client)->peer;
+
+	if (count < 2)
+		return 0;
+
+	nCount = peer->GetEventHandles(peer, events, count - 2);
+
+	if (nCount == 0)
+	{
+		WLog_ERR(TAG, "Failed to get FreeRDP transport event handles");
+		return 0;
+	}
+
+	events[nCount++] = loop->ChannelEvent;
+	events[nCount++] = MessageQueue_Event(loop->client->MsgQueue);
+	return nCount;
+}
+
+static BOOL shadow_client_loop_update_pending(rdpShadowClientLoop* loop)
+{
+	/* no subscriber until the shared loop is adopted */
+	if (loop->shared)
+		return shadow_multiclient_pending(loop->UpdateSubscriber);
+
+	return WaitForSingleObject(loop->UpdateEvent, 0) == WAIT_OBJECT_0;
+}
 
-		if (WaitForSingleObject(UpdateEvent, 0) == WAIT_OBJECT_0)
+/**
+ * Handles whatever is signaled for this client without blocking.
+ * Returns FALSE when the session is over.
+ */
+
+BOOL shadow_client_loop_check(rdpShadowClientLoop* loop)
+{
+	wMessage message;
+	wMessage pointerPositionMsg;
+	wMessage pointerAlphaMsg;
+	wMessage audioVolumeMsg;
+	rdpShadowClient* client = loop->client;
+	freerdp_peer* peer = ((rdpContext*) client)->peer;
+	rdpSettings* settings = peer->settings;
+	wMessageQueue* MsgQueue = client->MsgQueue;
+
+	if (shadow_client_loop_update_pending(loop))
+	{
+		/* The UpdateEvent means to start sending current frame. It is
+		 * triggered from subsystem implementation and it should ensure
+		 * that the screen and primary surface meta data (width, height,
+		 * scanline, invalid region, etc) is not changed until it is reset
+		 * (at shadow_multiclient_consume). As best practice, subsystem
+		 * implementation should invoke shadow_subsystem_frame_update which
+		 * triggers the event and then wait for completion */
+		if (client->activated && !client->suppressOutput)
 		{
-			/* The UpdateEvent means to start sending current frame. It is
-			 * triggered from subsystem implementation and it should ensure
-			 * that the screen and primary surface meta data (width, height,
-			 * scanline, invalid region, etc) is not changed until it is reset
-			 * (at shadow_multiclient_consume). As best practice, subsystem
-			 * implementation should invoke shadow_subsystem_frame_update which
-			 * triggers the event and then wait for completion */
-			if (client->activated && !client->suppressOutput)
-			{
-				/* Send screen update or resize to this client */
+			/* Send screen update or resize to this client */
 
-				/* Check resize */
-				if (shadow_client_recalc_desktop_size(client))
-				{
-					/* Screen size changed, do resize */
-					if (!shadow_client_send_resize(client, &gfxstatus))
-					{
-						WLog_ERR(TAG, "Failed to send resize message");
-						break;
-					}
-				}
-				else
+			/* Check resize */
+			if (shadow_client_recalc_desktop_size(client))
+			{
+				/* Screen size changed, do resize */
+				if (!shadow_client_send_resize(client, &loop->gfxstatus))
 				{
-					/* Send frame */
-					if (!shadow_client_send_surface_update(client, &gfxstatus))
-					{
-						WLog_ERR(TAG, "Failed to send surface update");
-						break;
-					}
+					WLog_ERR(TAG, "Failed to send resize message");
+					return FALSE;
 				}
 			}
 			else
 			{
-				/* Our client don't receive graphic updates. Just save the invalid region */
-				if (!shadow_client_no_surface_update(client, &gfxstatus))
+				/* Send frame */
+				if (!shadow_client_send_surface_update(client, &loop->gfxstatus))
 				{
-					WLog_ERR(TAG, "Failed to handle surface update");
-					break;
+					WLog_ERR(TAG, "Failed to send surface update");
+					return FALSE;
 				}
 			}
-
-			/*
-			 * The return value of shadow_multiclient_consume is whether or not
-			 * the subscriber really consumes the event. It's not cared currently.
-			 */
-			(void)shadow_multiclient_consume(UpdateSubscriber);
 		}
-
-		if (!peer->CheckFileDescriptor(peer))
+		else
 		{
-			WLog_ERR(TAG, "Failed to check FreeRDP file descriptor");
-			break;
+			/* Our client don't receive graphic updates. Just save the invalid region */
+			if (!shadow_client_no_surface_update(client, &loop->gfxstatus))
+			{
+				WLog_ERR(TAG, "Failed to handle surface update");
+				return FALSE;
+			}
 		}
+
+		/*
+		 * The return value of shadow_multiclient_consume is whether or not
+		 * the subscriber really consumes the event. It's not cared currently.
+		 */
+		if (loop->shared)
+			(void)shadow_multiclient_consume_nowait(loop->UpdateSubscriber);
 		else
+			(void)shadow_multiclient_consume(loop->UpdateSubscriber);
+	}
+
+	if (!peer->CheckFileDescriptor(peer))
+	{
+		WLog_ERR(TAG, "Failed to check FreeRDP file descriptor");
+		return FALSE;
+	}
+	else
+	{
+		if (WTSVirtualChannelManagerIsChannelJoined(client->vcm, "drdynvc"))
 		{
-			if (WTSVirtualChannelManagerIsChannelJoined(client->vcm, "drdynvc"))
+			/* Dynamic channel status may have been changed after processing */
+			if (WTSVirtualChannelManagerGetDrdynvcState(client->vcm) == DRDYNVC_STATE_NONE)
 			{
-				/* Dynamic channel status may have been changed after processing */
-				if (WTSVirtualChannelManagerGetDrdynvcState(client->vcm) == DRDYNVC_STATE_NONE)
+				/* Call this routine to Initialize drdynvc channel */
+				if (!WTSVirtualChannelManagerCheckFileDescriptor(client->vcm))
 				{
-					/* Call this routine to Initialize drdynvc channel */
-					if (!WTSVirtualChannelManagerCheckFileDescriptor(client->vcm))
-					{
-						WLog_ERR(TAG, "Failed to initialize drdynvc channel");
-						break;
-					}
+					WLog_ERR(TAG, "Failed to initialize drdynvc channel");
+					return FALSE;
 				}
-				else if (WTSVirtualChannelManagerGetDrdynvcState(client->vcm) ==
-				         DRDYNVC_STATE_READY)
+			}
+			else if (WTSVirtualChannelManagerGetDrdynvcState(client->vcm) ==
+			         DRDYNVC_STATE_READY)
+			{
+				/* Init RDPGFX dynamic channel */
+				if (settings->SupportGraphicsPipeline && client->rdpgfx &&
+				    !loop->gfxstatus.gfxOpened)
 				{
-					/* Init RDPGFX dynamic channel */
-					if (settings->SupportGraphicsPipeline && client->rdpgfx &&
-					    !gfxstatus.gfxOpened)
-					{
-						client->rdpgfx->FrameAcknowledge = shadow_client_rdpgfx_frame_acknowledge;
-						client->rdpgfx->CapsAdvertise = shadow_client_rdpgfx_caps_advertise;
+					client->rdpgfx->FrameAcknowledge = shadow_client_rdpgfx_frame_acknowledge;
+					client->rdpgfx->CapsAdvertise = shadow_client_rdpgfx_caps_advertise;
 
-						if (!client->rdpgfx->Open(client->rdpgfx))
-						{
-							WLog_WARN(TAG, "Failed to open GraphicsPipeline");
-							settings->SupportGraphicsPipeline = FALSE;
-						}
-
-						gfxstatus.gfxOpened = TRUE;
-						WLog_INFO(TAG, "Gfx Pipeline Opened");
+					if (!client->rdpgfx->Open(client->rdpgfx))
+					{
+						WLog_WARN(TAG, "Failed to open GraphicsPipeline");
+						settings->SupportGraphicsPipeline = FALSE;
 					}
+
+					loop->gfxstatus.gfxOpened = TRUE;
+					WLog_INFO(TAG, "Gfx Pipeline Opened");
 				}
 			}
 		}
+	}
+
+	if (WaitForSingleObject(loop->ChannelEvent, 0) == WAIT_OBJECT_0)
+	{
+		if (!WTSVirtualChannelManagerCheckFileDescriptor(client->vcm))
+		{
+			WLog_ERR(TAG, "WTSVirtualChannelManagerCheckFileDescriptor failure");
+			return FALSE;
+		}
+	}
 
-		if (WaitForSingleObject(ChannelEvent, 0) == WAIT_OBJECT_0)
+	if (WaitForSingleObject(MessageQueue_Event(MsgQueue), 0) == WAIT_OBJECT_0)
+	{
+		/* Drain messages. Pointer update could be accumulated. */
+		pointerPositionMsg.id = 0;
+		pointerPositionMsg.Free = NULL;
+		pointerAlphaMsg.id = 0;
+		pointerAlphaMsg.Free = NULL;
+		audioVolumeMsg.id = 0;
+		audioVolumeMsg.Free = NULL;
+
+		while (MessageQueue_Peek(MsgQueue, &message, TRUE))
 		{
-			if (!WTSVirtualChannelManagerCheckFileDescriptor(client->vcm))
+			if (message.id == WMQ_QUIT)
 			{
-				WLog_ERR(TAG, "WTSVirtualChannelManagerCheckFileDescriptor failure");
 				break;
 			}
-		}
 
-		if (WaitForSingleObject(MessageQueue_Event(MsgQueue), 0) == WAIT_OBJECT_0)
-		{
-			/* Drain messages. Pointer update could be accumulated. */
-			pointerPositionMsg.id = 0;
-			pointerPositionMsg.Free = NULL;
-			pointerAlphaMsg.id = 0;
-			pointerAlphaMsg.Free = NULL;
-			audioVolumeMsg.id = 0;
-			audioVolumeMsg.Free = NULL;
-
-			while (MessageQueue_Peek(MsgQueue, &message, TRUE))
+			switch (message.id)
 			{
-				if (message.id == WMQ_QUIT)
-				{
+				case SHADOW_MSG_OUT_POINTER_POSITION_UPDATE_ID:
+					/* Abandon previous message */
+					shadow_client_free_queued_message(&pointerPositionMsg);
+					CopyMemory(&pointerPositionMsg, &message, sizeof(wMessage));
 					break;
-				}
-
-				switch (message.id)
-				{
-					case SHADOW_MSG_OUT_POINTER_POSITION_UPDATE_ID:
-						/* Abandon previous message */
-						shadow_client_free_queued_message(&pointerPositionMsg);
-						CopyMemory(&pointerPositionMsg, &message, sizeof(wMessage));
-						break;
 
-					case SHADOW_MSG_OUT_POINTER_ALPHA_UPDATE_ID:
-						/* Abandon previous message */
-						shadow_client_free_queued_message(&pointerAlphaMsg);
-						CopyMemory(&pointerAlphaMsg, &message, sizeof(wMessage));
-						break;
+				case SHADOW_MSG_OUT_POINTER_ALPHA_UPDATE_ID:
+					/* Abandon previous message */
+					shadow_client_free_queued_message(&pointerAlphaMsg);
+					CopyMemory(&pointerAlphaMsg, &message, sizeof(wMessage));
+					break;
 
-					case SHADOW_MSG_OUT_AUDIO_OUT_VOLUME_ID:
-						/* Abandon previous message */
-						shadow_client_free_queued_message(&audioVolumeMsg);
-						CopyMemory(&audioVolumeMsg, &message, sizeof(wMessage));
-						break;
+				case SHADOW_MSG_OUT_AUDIO_OUT_VOLUME_ID:
+					/* Abandon previous message */
+					shadow_client_free_queued_message(&audioVolumeMsg);
+					CopyMemory(&audioVolumeMsg, &message, sizeof(wMessage));
+					break;
 
-					default:
-						shadow_client_subsystem_process_message(client, &message);
-						break;
-				}
+				default:
+					shadow_client_subsystem_process_message(client, &message);
+					break;
 			}
+		}
 
-			if (message.id == WMQ_QUIT)
+		if (message.id == WMQ_QUIT)
+		{
+			/* Release stored message */
+			shadow_client_free_queued_message(&pointerPositionMsg);
+			shadow_client_free_queued_message(&pointerAlphaMsg);
+			shadow_client_free_queued_message(&audioVolumeMsg);
+			return FALSE;
+		}
+		else
+		{
+			/* Process accumulated messages if needed */
+			if (pointerPositionMsg.id)
 			{
-				/* Release stored message */
-				shadow_client_free_queued_message(&pointerPositionMsg);
-				shadow_client_free_queued_message(&pointerAlphaMsg);
-				shadow_client_free_queued_message(&audioVolumeMsg);
-				break;
+				shadow_client_subsystem_process_message(client, &pointerPositionMsg);
 			}
-			else
-			{
-				/* Process accumulated messages if needed */
-				if (pointerPositionMsg.id)
-				{
-					shadow_client_subsystem_process_message(client, &pointerPositionMsg);
-				}
 
-				if (pointerAlphaMsg.id)
-				{
-					shadow_client_subsystem_process_message(client, &pointerAlphaMsg);
-				}
+			if (pointerAlphaMsg.id)
+			{
+				shadow_client_subsystem_process_message(client, &pointerAlphaMsg);
+			}
 
-				if (audioVolumeMsg.id)
-				{
-					shadow_client_subsystem_process_message(client, &audioVolumeMsg);
-				}
+			if (audioVolumeMsg.id)
+			{
+				shadow_client_subsystem_process_message(client, &audioVolumeMsg);
 			}
 		}
 	}
 
+	return TRUE;
+}
+
+/**
+ * Ends the session: closes the channels and frees the peer along with the client.
+ */
+
+void shadow_client_loop_free(rdpShadowClientLoop* loop)
+{
+	rdpShadowClient* client;
+	rdpShadowSubsystem* subsystem;
+	freerdp_peer* peer;
+
+	if (!loop)
+		return;
+
+	client = loop->client;
+	subsystem = client->server->subsystem;
+	peer = ((rdpContext*) client)->peer;
+
 	/* Free channels early because we establish channels in post connect */
-	if (gfxstatus.gfxOpened)
+	if (loop->gfxstatus.gfxOpened)
 	{
-		if (gfxstatus.gfxSurfaceCreated)
+		if (loop->gfxstatus.gfxSurfaceCreated)
 		{
 			if (!shadow_client_rdpgfx_release_surface(client))
 				WLog_WARN(TAG, "GFX release surface failure!");
@@ -1733,10 +2901,10 @@ static void* shadow_client_thread(rdpShadowClient* client)
 
 	shadow_client_channels_free(client);
 
-	if (UpdateSubscriber)
+	if (loop->UpdateSubscriber)
 	{
-		shadow_multiclient_release_subscriber(UpdateSubscriber);
-		UpdateSubscriber = NULL;
+		shadow_multiclient_release_subscriber(loop->UpdateSubscriber);
+		loop->UpdateSubscriber = NULL;
 	}
 
 	if (peer->connected && subsystem->ClientDisconnect)
@@ -1744,10 +2912,46 @@ static void* shadow_client_thread(rdpShadowClient* client)
 		subsystem->ClientDisconnect(subsystem, client);
 	}
 
-out:
+	free(loop);
 	peer->Disconnect(peer);
 	freerdp_peer_context_free(peer);
 	freerdp_peer_free(peer);
+}
+
+static void* shadow_client_thread(rdpShadowClient* client)
+{
+	DWORD status;
+	DWORD nCount;
+	HANDLE events[32];
+	rdpShadowClientLoop* loop;
+
+	if (!(loop = shadow_client_loop_new(client, FALSE)))
+		goto out;
+
+	while (1)
+	{
+		nCount = 0;
+		events[nCount++] = loop->UpdateEvent;
+		{
+			DWORD tmp = shadow_client_loop_get_event_handles(loop, &events[nCount],
+			            ARRAYSIZE(events) - nCount);
+
+			if (tmp == 0)
+				break;
+
+			nCount += tmp;
+		}
+		status = WaitForMultipleObjects(nCount, events, FALSE, INFINITE);
+
+		if (status == WAIT_FAILED)
+			break;
+
+		if (!shadow_client_loop_check(loop))
+			break;
+	}
+
+	shadow_client_loop_free(loop);
+out:
 	ExitThread(0);
 	return NULL;
 }
@@ -1772,6 +2976,17 @@ BOOL shadow_client_accepted(freerdp_listener* listener, freerdp_peer* peer)
 
 	client = (rdpShadowClient*) peer->context;
 
+	if (server->reactor)
+	{
+		if (!shadow_reactor_add_client(server->reactor, client))
+		{
+			freerdp_peer_context_free(peer);
+			return FALSE;
+		}
+
+		return TRUE;
+	}
+
 	if (!(client->thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)
 	                                    shadow_client_thread, client, 0, NULL)))
 	{
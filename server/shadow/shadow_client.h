@@ -25,9 +25,20 @@
 extern "C" {
 #endif
 
+typedef struct rdp_shadow_client_loop rdpShadowClientLoop;
+
 BOOL shadow_client_surface_update(rdpShadowClient* client, REGION16* region);
 BOOL shadow_client_accepted(freerdp_listener* instance, freerdp_peer* client);
 
+/* A shared loop serves several clients from one thread and never blocks on the others */
+rdpShadowClientLoop* shadow_client_loop_new(rdpShadowClient* client, BOOL shared);
+void shadow_client_loop_free(rdpShadowClientLoop* loop);
+BOOL shadow_client_loop_subscribe(rdpShadowClientLoop* loop);
+HANDLE shadow_client_loop_get_update_event(rdpShadowClientLoop* loop);
+DWORD shadow_client_loop_get_event_handles(rdpShadowClientLoop* loop, HANDLE* events,
+        DWORD count);
+BOOL shadow_client_loop_check(rdpShadowClientLoop* loop);
+
 #ifdef __cplusplus
 }
 #endif
@@ -144,6 +144,7 @@ static int shadow_encoder_init_rfx(rdpShadowEncoder* encoder)
 	return 1;
 fail:
 	rfx_context_free(encoder->rfx);
+	encoder->rfx = NULL;
 	return -1;
 }
 
@@ -242,11 +243,13 @@ static int shadow_encoder_init_h264(rdpShadowEncoder* encoder)
 	return 1;
 fail:
 	h264_context_free(encoder->h264);
+	encoder->h264 = NULL;
 	return -1;
 }
 
 static int shadow_encoder_init(rdpShadowEncoder* encoder)
 {
+	rdpContext* context = (rdpContext*) encoder->client;
 	encoder->width = encoder->server->screen->width;
 	encoder->height = encoder->server->screen->height;
 	encoder->maxTileWidth = 64;
@@ -260,6 +263,16 @@ static int shadow_encoder_init(rdpShadowEncoder* encoder)
 	if (!encoder->bs)
 		return -1;
 
+	/* glyph orders are only used if the client supports them */
+	encoder->glyphCache = shadow_glyph_cache_new(context->settings);
+
+	/* the frame the client last received, as reference for motion detection */
+	if (!(encoder->motion = shadow_motion_new(encoder->width, encoder->height)))
+		return -1;
+
+	if (!(encoder->classifier = shadow_classifier_new(encoder->width, encoder->height)))
+		return -1;
+
 	return 1;
 }
 
@@ -333,6 +346,13 @@ static int shadow_encoder_uninit(rdpShadowEncoder* encoder)
 		encoder->bs = NULL;
 	}
 
+	shadow_glyph_cache_free(encoder->glyphCache);
+	encoder->glyphCache = NULL;
+	shadow_motion_free(encoder->motion);
+	encoder->motion = NULL;
+	shadow_classifier_free(encoder->classifier);
+	encoder->classifier = NULL;
+
 	if (encoder->codecs & FREERDP_CODEC_REMOTEFX)
 	{
 		shadow_encoder_uninit_rfx(encoder);
@@ -471,5 +491,6 @@ void shadow_encoder_free(rdpShadowEncoder* encoder)
 		return;
 
 	shadow_encoder_uninit(encoder);
+	shadow_tile_cache_free(encoder->tileCache);
 	free(encoder);
 }
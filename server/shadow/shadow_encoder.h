@@ -27,6 +27,11 @@
 
 #include <freerdp/server/shadow.h>
 
+#include "shadow_glyph.h"
+#include "shadow_tilecache.h"
+#include "shadow_motion.h"
+#include "shadow_classifier.h"
+
 struct rdp_shadow_encoder
 {
 	rdpShadowClient* client;
@@ -50,6 +55,11 @@ struct rdp_shadow_encoder
 	BITMAP_PLANAR_CONTEXT* planar;
 	BITMAP_INTERLEAVED_CONTEXT* interleaved;
 	H264_CONTEXT* h264;
+	rdpShadowGlyphCache* glyphCache;
+	rdpShadowTileCache* tileCache;
+	volatile LONG tileCacheReset;
+	rdpShadowMotion* motion;
+	rdpShadowClassifier* classifier;
 
 	int fps;
 	int maxFps;
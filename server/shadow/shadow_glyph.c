@@ -0,0 +1,942 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/log.h>
+#include <freerdp/codec/color.h>
+
+#include "shadow_glyph.h"
+
+#define TAG SERVER_TAG("shadow.glyph")
+
+/**
+ * Text is recovered from the captured surface without any knowledge of fonts:
+ * a two color rectangle is cut into lines (runs of rows containing foreground
+ * pixels) and every line into glyphs (runs of columns containing foreground
+ * pixels). The glyph bitmaps are kept in a mirror of the client glyph caches,
+ * so that repeated characters cost two bytes in a glyph index order instead
+ * of being sent as bitmap data again.
+ */
+
+#define SHADOW_GLYPH_CACHE_COUNT	10
+#define SHADOW_GLYPH_MAX_ENTRIES	254 /* indices 0xFE and 0xFF are fragment operations */
+#define SHADOW_GLYPH_MAX_ORDER_DATA	255
+#define SHADOW_GLYPH_MAX_CACHE_ORDER	4096
+
+struct _SHADOW_GLYPH_ENTRY
+{
+	BOOL used;
+	UINT32 hash;
+	UINT32 y;
+	UINT32 cx;
+	UINT32 cy;
+	UINT32 cb;
+	UINT32 lastUse;
+	BYTE* aj;
+};
+typedef struct _SHADOW_GLYPH_ENTRY SHADOW_GLYPH_ENTRY;
+
+struct _SHADOW_GLYPH_SLOTS
+{
+	UINT32 count;
+	UINT32 maxCellSize;
+	SHADOW_GLYPH_ENTRY* entries;
+	BYTE* buffer;
+};
+typedef struct _SHADOW_GLYPH_SLOTS SHADOW_GLYPH_SLOTS;
+
+/* A glyph cut out of the rectangle being encoded */
+struct _SHADOW_GLYPH
+{
+	UINT32 x;
+	UINT32 y;
+	UINT32 cx;
+	UINT32 cy;
+	UINT32 cb;
+	UINT32 hash;
+	size_t offset;
+	UINT32 cacheId;
+	UINT32 cacheIndex;
+	BOOL isNew;
+};
+typedef struct _SHADOW_GLYPH SHADOW_GLYPH;
+
+/* A band of rows drawn by the same orders, glyphs are placed relative to origin */
+struct _SHADOW_GLYPH_LINE
+{
+	UINT32 top;
+	UINT32 bottom;
+	UINT32 origin;
+	UINT32 first;
+	UINT32 count;
+};
+typedef struct _SHADOW_GLYPH_LINE SHADOW_GLYPH_LINE;
+
+struct rdp_shadow_glyph_cache
+{
+	BOOL v2;
+	UINT32 colorFormat;
+	UINT32 maxCellSize;
+	UINT32 tick;
+	SHADOW_GLYPH_SLOTS slots[SHADOW_GLYPH_CACHE_COUNT];
+
+	SHADOW_GLYPH* glyphs;
+	UINT32 glyphCount;
+	UINT32 glyphCapacity;
+
+	SHADOW_GLYPH_LINE* lines;
+	UINT32 lineCount;
+	UINT32 lineCapacity;
+
+	BYTE* bits;
+	size_t bitsSize;
+	size_t bitsCapacity;
+
+	BYTE* columns;
+	UINT32 columnCapacity;
+	UINT32* table;
+	UINT32 tableCapacity;
+
+	CACHE_GLYPH_ORDER cacheGlyph;
+	CACHE_GLYPH_V2_ORDER cacheGlyphV2;
+	GLYPH_INDEX_ORDER glyphIndex;
+};
+
+static INLINE UINT32 shadow_glyph_pixel(const BYTE* pSrcData, UINT32 nSrcStep, UINT32 x,
+                                        UINT32 y)
+{
+	return (*((const UINT32*) &pSrcData[y * nSrcStep + x * 4])) & 0x00FFFFFF;
+}
+
+int shadow_glyph_classify(const BYTE* pSrcData, UINT32 nSrcStep,
+                          const RECTANGLE_16* rect, UINT32* colors, UINT32* counts)
+{
+	UINT32 x, y;
+	int count = 0;
+
+	if (!pSrcData || !rect || !colors || !counts)
+		return 0;
+
+	counts[0] = counts[1] = 0;
+
+	for (y = rect->top; y < rect->bottom; y++)
+	{
+		const UINT32* pixel = (const UINT32*) &pSrcData[y * nSrcStep + rect->left * 4];
+
+		for (x = rect->left; x < rect->right; x++)
+		{
+			const UINT32 color = *pixel++ & 0x00FFFFFF;
+
+			if ((count > 0) && (color == colors[0]))
+				counts[0]++;
+			else if ((count > 1) && (color == colors[1]))
+				counts[1]++;
+			else if (count < 2)
+			{
+				colors[count] = color;
+				counts[count++] = 1;
+			}
+			else
+				return 0;
+		}
+	}
+
+	if ((count == 2) && (counts[1] > counts[0]))
+	{
+		UINT32 tmp = colors[0];
+		colors[0] = colors[1];
+		colors[1] = tmp;
+		tmp = counts[0];
+		counts[0] = counts[1];
+		counts[1] = tmp;
+	}
+
+	return count;
+}
+
+static UINT32 shadow_glyph_hash(const BYTE* aj, UINT32 y, UINT32 cx, UINT32 cy, UINT32 cb)
+{
+	UINT32 i;
+	UINT32 hash = 2166136261U ^ (y << 24) ^ (cx << 12) ^ cy;
+
+	for (i = 0; i < cb; i++)
+		hash = (hash ^ aj[i]) * 16777619U;
+
+	return hash;
+}
+
+static BOOL shadow_glyph_ensure_capacity(void** ptr, UINT32* capacity, UINT32 count,
+        size_t size)
+{
+	void* tmp;
+	UINT32 newCapacity;
+
+	if (count <= *capacity)
+		return TRUE;
+
+	newCapacity = (*capacity > 0) ? *capacity : 64;
+
+	while (newCapacity < count)
+		newCapacity *= 2;
+
+	tmp = realloc(*ptr, newCapacity * size);
+
+	if (!tmp)
+		return FALSE;
+
+	*ptr = tmp;
+	*capacity = newCapacity;
+	return TRUE;
+}
+
+static BYTE* shadow_glyph_alloc_bits(rdpShadowGlyphCache* cache, UINT32 cb, size_t* offset)
+{
+	if (cache->bitsSize + cb > cache->bitsCapacity)
+	{
+		BYTE* tmp;
+		size_t newCapacity = (cache->bitsCapacity > 0) ? cache->bitsCapacity : 4096;
+
+		while (newCapacity < cache->bitsSize + cb)
+			newCapacity *= 2;
+
+		tmp = (BYTE*) realloc(cache->bits, newCapacity);
+
+		if (!tmp)
+			return NULL;
+
+		cache->bits = tmp;
+		cache->bitsCapacity = newCapacity;
+	}
+
+	*offset = cache->bitsSize;
+	cache->bitsSize += cb;
+	ZeroMemory(&cache->bits[*offset], cb);
+	return &cache->bits[*offset];
+}
+
+static BOOL shadow_glyph_select_cache(rdpShadowGlyphCache* cache, UINT32 cb, UINT32* cacheId)
+{
+	UINT32 id;
+	BOOL found = FALSE;
+
+	for (id = 0; id < SHADOW_GLYPH_CACHE_COUNT; id++)
+	{
+		const SHADOW_GLYPH_SLOTS* slots = &cache->slots[id];
+
+		if ((slots->count == 0) || (slots->maxCellSize < cb))
+			continue;
+
+		if (!found || (slots->maxCellSize < cache->slots[*cacheId].maxCellSize))
+		{
+			*cacheId = id;
+			found = TRUE;
+		}
+	}
+
+	return found;
+}
+
+static BOOL shadow_glyph_add(rdpShadowGlyphCache* cache, const BYTE* pSrcData,
+                             UINT32 nSrcStep, const RECTANGLE_16* rect, UINT32 fgColor,
+                             UINT32 left, UINT32 top, UINT32 cx, UINT32 cy, UINT32 origin)
+{
+	UINT32 x, y;
+	BYTE* aj;
+	SHADOW_GLYPH* glyph;
+	const UINT32 scanline = (cx + 7) / 8;
+	UINT32 cb = scanline * cy;
+	cb += ((cb % 4) > 0) ? 4 - (cb % 4) : 0;
+
+	if (!shadow_glyph_ensure_capacity((void**) &cache->glyphs, &cache->glyphCapacity,
+	                                  cache->glyphCount + 1, sizeof(SHADOW_GLYPH)))
+		return FALSE;
+
+	glyph = &cache->glyphs[cache->glyphCount];
+
+	if (!shadow_glyph_select_cache(cache, cb, &glyph->cacheId))
+		return FALSE;
+
+	if (!(aj = shadow_glyph_alloc_bits(cache, cb, &glyph->offset)))
+		return FALSE;
+
+	for (y = 0; y < cy; y++)
+	{
+		BYTE* row = &aj[y * scanline];
+
+		for (x = 0; x < cx; x++)
+		{
+			if (shadow_glyph_pixel(pSrcData, nSrcStep, rect->left + left + x,
+			                       rect->top + top + y) == fgColor)
+				row[x / 8] |= 0x80 >> (x % 8);
+		}
+	}
+
+	glyph->x = left;
+	glyph->y = top - origin;
+	glyph->cx = cx;
+	glyph->cy = cy;
+	glyph->cb = cb;
+	glyph->hash = shadow_glyph_hash(aj, glyph->y, cx, cy, cb);
+	glyph->cacheIndex = 0;
+	glyph->isNew = FALSE;
+	cache->glyphCount++;
+	return TRUE;
+}
+
+static BOOL shadow_glyph_segment_line(rdpShadowGlyphCache* cache, const BYTE* pSrcData,
+                                      UINT32 nSrcStep, const RECTANGLE_16* rect, UINT32 fgColor,
+                                      UINT32 inkTop, UINT32 inkBottom, SHADOW_GLYPH_LINE* line)
+{
+	UINT32 x, y;
+	const UINT32 width = rect->right - rect->left;
+	BYTE* columns = cache->columns;
+	ZeroMemory(columns, width);
+	line->first = cache->glyphCount;
+
+	for (y = inkTop; y <= inkBottom; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			if (shadow_glyph_pixel(pSrcData, nSrcStep, rect->left + x, rect->top + y) == fgColor)
+				columns[x] = 1;
+		}
+	}
+
+	x = 0;
+
+	while (x < width)
+	{
+		UINT32 left, right;
+		UINT32 top = inkBottom;
+		UINT32 bottom = inkTop;
+		UINT32 maxWidth;
+
+		if (!columns[x])
+		{
+			x++;
+			continue;
+		}
+
+		left = x;
+
+		while ((x < width) && columns[x])
+			x++;
+
+		right = x;
+
+		/* trim the glyph to the rows actually containing ink */
+		for (y = inkTop; y <= inkBottom; y++)
+		{
+			UINT32 i;
+
+			for (i = left; i < right; i++)
+			{
+				if (shadow_glyph_pixel(pSrcData, nSrcStep, rect->left + i, rect->top + y) == fgColor)
+				{
+					if (y < top)
+						top = y;
+
+					bottom = y;
+					break;
+				}
+			}
+		}
+
+		/* glyphs wider than the largest cache cell are split in columns */
+		maxWidth = 8 * (cache->maxCellSize / (bottom - top + 1));
+
+		if (maxWidth == 0)
+			return FALSE;
+
+		for (; left < right; left += maxWidth)
+		{
+			const UINT32 cx = MIN(maxWidth, right - left);
+
+			if (!shadow_glyph_add(cache, pSrcData, nSrcStep, rect, fgColor, left, top, cx,
+			                      bottom - top + 1, line->origin))
+				return FALSE;
+		}
+	}
+
+	line->count = cache->glyphCount - line->first;
+	return TRUE;
+}
+
+static BOOL shadow_glyph_segment(rdpShadowGlyphCache* cache, const BYTE* pSrcData,
+                                 UINT32 nSrcStep, const RECTANGLE_16* rect, UINT32 fgColor)
+{
+	UINT32 x, y;
+	UINT32 index;
+	UINT32 inkTop = 0;
+	BOOL inLine = FALSE;
+	const UINT32 width = rect->right - rect->left;
+	const UINT32 height = rect->bottom - rect->top;
+	cache->glyphCount = 0;
+	cache->lineCount = 0;
+	cache->bitsSize = 0;
+
+	if (!shadow_glyph_ensure_capacity((void**) &cache->columns, &cache->columnCapacity,
+	                                  width, sizeof(BYTE)))
+		return FALSE;
+
+	/* find the lines of text: maximal runs of rows containing ink */
+	for (y = 0; y <= height; y++)
+	{
+		BOOL ink = FALSE;
+
+		if (y < height)
+		{
+			for (x = 0; x < width; x++)
+			{
+				if (shadow_glyph_pixel(pSrcData, nSrcStep, rect->left + x, rect->top + y) == fgColor)
+				{
+					ink = TRUE;
+					break;
+				}
+			}
+		}
+
+		if (ink && !inLine)
+		{
+			inkTop = y;
+			inLine = TRUE;
+		}
+		else if (!ink && inLine)
+		{
+			SHADOW_GLYPH_LINE* line;
+
+			if (!shadow_glyph_ensure_capacity((void**) &cache->lines, &cache->lineCapacity,
+			                                  cache->lineCount + 1, sizeof(SHADOW_GLYPH_LINE)))
+				return FALSE;
+
+			line = &cache->lines[cache->lineCount++];
+			line->top = inkTop;
+			line->bottom = y - 1;
+			inLine = FALSE;
+		}
+	}
+
+	if (cache->lineCount == 0)
+		return FALSE;
+
+	/**
+	 * Every line is drawn over a band reaching down to the next line, so the
+	 * bands cover the whole rectangle. The client drops glyph orders with a
+	 * background rectangle of a single row, a last band that thin is merged.
+	 */
+	if ((cache->lineCount > 1) && (cache->lines[cache->lineCount - 1].top == height - 1))
+	{
+		cache->lines[cache->lineCount - 2].bottom = height - 1;
+		cache->lineCount--;
+	}
+
+	for (index = 0; index < cache->lineCount; index++)
+	{
+		SHADOW_GLYPH_LINE* line = &cache->lines[index];
+		const UINT32 inkBottom = line->bottom;
+		const UINT32 inkLineTop = line->top;
+		line->origin = inkLineTop;
+		line->top = (index == 0) ? 0 : inkLineTop;
+		line->bottom = (index + 1 < cache->lineCount) ? cache->lines[index + 1].top - 1 :
+		               height - 1;
+
+		if (!shadow_glyph_segment_line(cache, pSrcData, nSrcStep, rect, fgColor, inkLineTop,
+		                               inkBottom, line))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL shadow_glyph_find(rdpShadowGlyphCache* cache, const SHADOW_GLYPH* glyph,
+                              UINT32* cacheIndex)
+{
+	UINT32 index;
+	const BYTE* aj = &cache->bits[glyph->offset];
+	const SHADOW_GLYPH_SLOTS* slots = &cache->slots[glyph->cacheId];
+
+	for (index = 0; index < slots->count; index++)
+	{
+		const SHADOW_GLYPH_ENTRY* entry = &slots->entries[index];
+
+		if (entry->used && (entry->hash == glyph->hash) && (entry->y == glyph->y) &&
+		    (entry->cx == glyph->cx) &&
+		    (entry->cy == glyph->cy) && (memcmp(entry->aj, aj, glyph->cb) == 0))
+		{
+			*cacheIndex = index;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * Estimates the size of the orders for the segmented rectangle, counting the
+ * bitmap of glyphs not cached yet once even if they repeat in the rectangle.
+ */
+static UINT32 shadow_glyph_estimate(rdpShadowGlyphCache* cache)
+{
+	UINT32 index;
+	UINT32 mask;
+	UINT32 size = cache->lineCount * 48;
+	UINT32 tableSize = 64;
+
+	while (tableSize < cache->glyphCount * 2)
+		tableSize *= 2;
+
+	if (!shadow_glyph_ensure_capacity((void**) &cache->table, &cache->tableCapacity,
+	                                  tableSize, sizeof(UINT32)))
+		return UINT32_MAX;
+
+	ZeroMemory(cache->table, tableSize * sizeof(UINT32));
+	mask = tableSize - 1;
+
+	for (index = 0; index < cache->glyphCount; index++)
+	{
+		UINT32 cacheIndex;
+		UINT32 slot;
+		const SHADOW_GLYPH* glyph = &cache->glyphs[index];
+		size += 2;
+
+		if (shadow_glyph_find(cache, glyph, &cacheIndex))
+			continue;
+
+		for (slot = glyph->hash & mask; cache->table[slot]; slot = (slot + 1) & mask)
+		{
+			const SHADOW_GLYPH* other = &cache->glyphs[cache->table[slot] - 1];
+
+			if ((other->hash == glyph->hash) && (other->y == glyph->y) && (other->cx == glyph->cx) &&
+			    (other->cy == glyph->cy) &&
+			    (memcmp(&cache->bits[other->offset], &cache->bits[glyph->offset], glyph->cb) == 0))
+				break;
+		}
+
+		if (!cache->table[slot])
+		{
+			cache->table[slot] = index + 1;
+			size += glyph->cb + 12;
+		}
+	}
+
+	return size;
+}
+
+/* Places a glyph in the cache, evicting the least recently used entry not in the current batch */
+static BOOL shadow_glyph_store(rdpShadowGlyphCache* cache, SHADOW_GLYPH* glyph)
+{
+	UINT32 index;
+	SHADOW_GLYPH_ENTRY* entry;
+	SHADOW_GLYPH_ENTRY* victim = NULL;
+	SHADOW_GLYPH_SLOTS* slots = &cache->slots[glyph->cacheId];
+
+	if (shadow_glyph_find(cache, glyph, &glyph->cacheIndex))
+	{
+		slots->entries[glyph->cacheIndex].lastUse = cache->tick;
+		glyph->isNew = FALSE;
+		return TRUE;
+	}
+
+	for (index = 0; index < slots->count; index++)
+	{
+		entry = &slots->entries[index];
+
+		if (!entry->used)
+		{
+			victim = entry;
+			break;
+		}
+
+		if ((entry->lastUse != cache->tick) && (!victim || (entry->lastUse < victim->lastUse)))
+			victim = entry;
+	}
+
+	if (!victim)
+		return FALSE;
+
+	victim->used = TRUE;
+	victim->hash = glyph->hash;
+	victim->y = glyph->y;
+	victim->cx = glyph->cx;
+	victim->cy = glyph->cy;
+	victim->cb = glyph->cb;
+	victim->lastUse = cache->tick;
+	CopyMemory(victim->aj, &cache->bits[glyph->offset], glyph->cb);
+	glyph->cacheIndex = (UINT32)(victim - slots->entries);
+	glyph->isNew = TRUE;
+	return TRUE;
+}
+
+static BOOL shadow_glyph_send_cache_orders(rdpShadowGlyphCache* cache, rdpContext* context,
+        UINT32 cacheId, UINT32 first, UINT32 last)
+{
+	UINT32 index;
+	UINT32 size = 0;
+	UINT32 cGlyphs = 0;
+	BOOL rc = TRUE;
+	rdpSecondaryUpdate* secondary = context->update->secondary;
+	const SHADOW_GLYPH_SLOTS* slots = &cache->slots[cacheId];
+
+	for (index = first; index <= last; index++)
+	{
+		const SHADOW_GLYPH* glyph = (index < last) ? &cache->glyphs[index] : NULL;
+
+		if (glyph && (!glyph->isNew || (glyph->cacheId != cacheId)))
+			continue;
+
+		if ((cGlyphs > 0) && (!glyph || (cGlyphs == SHADOW_GLYPH_MAX_ENTRIES) ||
+		                      (size + glyph->cb > SHADOW_GLYPH_MAX_CACHE_ORDER)))
+		{
+			if (cache->v2)
+			{
+				cache->cacheGlyphV2.cacheId = cacheId;
+				cache->cacheGlyphV2.flags = 0;
+				cache->cacheGlyphV2.cGlyphs = cGlyphs;
+				IFCALLRET(secondary->CacheGlyphV2, rc, context, &cache->cacheGlyphV2);
+			}
+			else
+			{
+				cache->cacheGlyph.cacheId = cacheId;
+				cache->cacheGlyph.cGlyphs = cGlyphs;
+				IFCALLRET(secondary->CacheGlyph, rc, context, &cache->cacheGlyph);
+			}
+
+			if (!rc)
+				return FALSE;
+
+			cGlyphs = 0;
+			size = 0;
+		}
+
+		if (!glyph)
+			break;
+
+		if (cache->v2)
+		{
+			GLYPH_DATA_V2* data = &cache->cacheGlyphV2.glyphData[cGlyphs];
+			data->cacheIndex = glyph->cacheIndex;
+			data->x = 0;
+			data->y = glyph->y;
+			data->cx = glyph->cx;
+			data->cy = glyph->cy;
+			data->cb = glyph->cb;
+			data->aj = slots->entries[glyph->cacheIndex].aj;
+		}
+		else
+		{
+			GLYPH_DATA* data = &cache->cacheGlyph.glyphData[cGlyphs];
+			data->cacheIndex = glyph->cacheIndex;
+			data->x = 0;
+			data->y = glyph->y;
+			data->cx = glyph->cx;
+			data->cy = glyph->cy;
+			data->cb = glyph->cb;
+			data->aj = slots->entries[glyph->cacheIndex].aj;
+		}
+
+		cGlyphs++;
+		size += glyph->cb + 12;
+	}
+
+	return TRUE;
+}
+
+static BOOL shadow_glyph_send_index_order(rdpShadowGlyphCache* cache, rdpContext* context,
+        const RECTANGLE_16* rect, const SHADOW_GLYPH_LINE* line,
+        UINT32 x, BOOL* filled)
+{
+	BOOL rc = TRUE;
+	GLYPH_INDEX_ORDER* order = &cache->glyphIndex;
+	order->bkLeft = rect->left;
+	order->bkTop = rect->top + line->top;
+	order->bkRight = rect->right - 1;
+	order->bkBottom = rect->top + line->bottom;
+
+	/* the first order of a line paints the background of the whole band */
+	if (!*filled)
+	{
+		order->opLeft = order->bkLeft;
+		order->opTop = order->bkTop;
+		order->opRight = order->bkRight;
+		order->opBottom = order->bkBottom;
+		*filled = TRUE;
+	}
+	else
+	{
+		order->opLeft = order->opTop = order->opRight = order->opBottom = 0;
+	}
+
+	order->x = rect->left + x;
+	order->y = rect->top + line->origin;
+	IFCALLRET(context->update->primary->GlyphIndex, rc, context, order);
+	order->cbData = 0;
+	return rc;
+}
+
+static BOOL shadow_glyph_send_batch(rdpShadowGlyphCache* cache, rdpContext* context,
+                                    const RECTANGLE_16* rect, const SHADOW_GLYPH_LINE* line,
+                                    UINT32 first, UINT32 last, BOOL* filled)
+{
+	UINT32 cacheId;
+	UINT32 index;
+	GLYPH_INDEX_ORDER* order = &cache->glyphIndex;
+
+	for (cacheId = 0; cacheId < SHADOW_GLYPH_CACHE_COUNT; cacheId++)
+	{
+		if (!shadow_glyph_send_cache_orders(cache, context, cacheId, first, last))
+			return FALSE;
+	}
+
+	for (cacheId = 0; cacheId < SHADOW_GLYPH_CACHE_COUNT; cacheId++)
+	{
+		UINT32 startX = 0;
+		UINT32 lastX = 0;
+		order->cacheId = cacheId;
+		order->cbData = 0;
+
+		for (index = first; index < last; index++)
+		{
+			UINT32 delta;
+			const SHADOW_GLYPH* glyph = &cache->glyphs[index];
+
+			if (glyph->cacheId != cacheId)
+				continue;
+
+			if (order->cbData + 4 > SHADOW_GLYPH_MAX_ORDER_DATA)
+			{
+				if (!shadow_glyph_send_index_order(cache, context, rect, line, startX, filled))
+					return FALSE;
+			}
+
+			if (order->cbData == 0)
+				startX = lastX = glyph->x;
+
+			delta = glyph->x - lastX;
+			lastX = glyph->x;
+			order->data[order->cbData++] = (BYTE) glyph->cacheIndex;
+
+			if (delta < 0x80)
+			{
+				order->data[order->cbData++] = (BYTE) delta;
+			}
+			else
+			{
+				order->data[order->cbData++] = 0x80;
+				order->data[order->cbData++] = delta & 0xFF;
+				order->data[order->cbData++] = (delta >> 8) & 0xFF;
+			}
+		}
+
+		if (order->cbData > 0)
+		{
+			if (!shadow_glyph_send_index_order(cache, context, rect, line, startX, filled))
+				return FALSE;
+		}
+	}
+
+	cache->tick++;
+	return TRUE;
+}
+
+/* Forgets all glyphs, used when orders may not have reached the client */
+static void shadow_glyph_cache_invalidate(rdpShadowGlyphCache* cache)
+{
+	UINT32 id;
+	UINT32 index;
+
+	for (id = 0; id < SHADOW_GLYPH_CACHE_COUNT; id++)
+	{
+		const SHADOW_GLYPH_SLOTS* slots = &cache->slots[id];
+
+		for (index = 0; index < slots->count; index++)
+			slots->entries[index].used = FALSE;
+	}
+}
+
+/* Colors are BGRX32 pixels loaded as little endian 32 bit values */
+static UINT32 shadow_glyph_wire_color(rdpShadowGlyphCache* cache, UINT32 color)
+{
+	const BYTE r = (color >> 16) & 0xFF;
+	const BYTE g = (color >> 8) & 0xFF;
+	const BYTE b = color & 0xFF;
+	return GetColor(cache->colorFormat, r, g, b, 0xFF);
+}
+
+BOOL shadow_glyph_cache_encode(rdpShadowGlyphCache* cache, rdpContext* context,
+                               const BYTE* pSrcData, UINT32 nSrcStep,
+                               const RECTANGLE_16* rect, UINT32 bgColor, UINT32 fgColor)
+{
+	UINT32 index;
+	UINT32 width, height;
+	GLYPH_INDEX_ORDER* order;
+
+	if (!cache || !context || !pSrcData || !rect)
+		return FALSE;
+
+	width = rect->right - rect->left;
+	height = rect->bottom - rect->top;
+
+	if ((width < 2) || (height < 2) || (bgColor == fgColor))
+		return FALSE;
+
+	if (!shadow_glyph_segment(cache, pSrcData, nSrcStep, rect, fgColor))
+		return FALSE;
+
+	/* noise and images with two colors do not pay off as text */
+	if (shadow_glyph_estimate(cache) > (width * height) / 2)
+		return FALSE;
+
+	order = &cache->glyphIndex;
+	ZeroMemory(order, sizeof(GLYPH_INDEX_ORDER));
+	order->flAccel = SO_HORIZONTAL;
+	order->ulCharInc = 0;
+	order->fOpRedundant = 0;
+	/* backColor is the text color, foreColor fills the opaque rectangle */
+	order->backColor = shadow_glyph_wire_color(cache, fgColor);
+	order->foreColor = shadow_glyph_wire_color(cache, bgColor);
+
+	for (index = 0; index < cache->lineCount; index++)
+	{
+		UINT32 glyphIndex;
+		BOOL filled = FALSE;
+		const SHADOW_GLYPH_LINE* line = &cache->lines[index];
+		const UINT32 last = line->first + line->count;
+		UINT32 first = line->first;
+
+		for (glyphIndex = first; glyphIndex < last; glyphIndex++)
+		{
+			SHADOW_GLYPH* glyph = &cache->glyphs[glyphIndex];
+
+			if (shadow_glyph_store(cache, glyph))
+				continue;
+
+			/* the cache is full of glyphs of this batch, send them first */
+			if (!shadow_glyph_send_batch(cache, context, rect, line, first, glyphIndex, &filled))
+				goto fail;
+
+			first = glyphIndex;
+
+			if (!shadow_glyph_store(cache, glyph))
+				goto fail;
+		}
+
+		if (!shadow_glyph_send_batch(cache, context, rect, line, first, last, &filled))
+			goto fail;
+	}
+
+	return TRUE;
+fail:
+	WLog_WARN(TAG, "failed to send glyph orders, resetting glyph cache");
+	shadow_glyph_cache_invalidate(cache);
+	return FALSE;
+}
+
+rdpShadowGlyphCache* shadow_glyph_cache_new(rdpSettings* settings)
+{
+	UINT32 id;
+	UINT32 index;
+	rdpShadowGlyphCache* cache;
+
+	if (!settings || !settings->GlyphCache)
+		return NULL;
+
+	if (!settings->OrderSupport[NEG_GLYPH_INDEX_INDEX])
+		return NULL;
+
+	if ((settings->GlyphSupportLevel != GLYPH_SUPPORT_FULL) &&
+	    (settings->GlyphSupportLevel != GLYPH_SUPPORT_ENCODE))
+		return NULL;
+
+	cache = (rdpShadowGlyphCache*) calloc(1, sizeof(rdpShadowGlyphCache));
+
+	if (!cache)
+		return NULL;
+
+	cache->v2 = (settings->GlyphSupportLevel == GLYPH_SUPPORT_ENCODE);
+
+	switch (settings->ColorDepth)
+	{
+		case 32:
+		case 24:
+			cache->colorFormat = PIXEL_FORMAT_BGR24;
+			break;
+
+		case 16:
+			cache->colorFormat = PIXEL_FORMAT_RGB16;
+			break;
+
+		case 15:
+			cache->colorFormat = PIXEL_FORMAT_RGB15;
+			break;
+
+		default:
+			goto fail;
+	}
+
+	for (id = 0; id < SHADOW_GLYPH_CACHE_COUNT; id++)
+	{
+		SHADOW_GLYPH_SLOTS* slots = &cache->slots[id];
+		const GLYPH_CACHE_DEFINITION* definition = &settings->GlyphCache[id];
+
+		if ((definition->cacheEntries == 0) || (definition->cacheMaximumCellSize < 4))
+			continue;
+
+		slots->count = MIN(definition->cacheEntries, SHADOW_GLYPH_MAX_ENTRIES);
+		slots->maxCellSize = definition->cacheMaximumCellSize & ~3;
+		slots->entries = (SHADOW_GLYPH_ENTRY*) calloc(slots->count, sizeof(SHADOW_GLYPH_ENTRY));
+		slots->buffer = (BYTE*) calloc(slots->count, slots->maxCellSize);
+
+		if (!slots->entries || !slots->buffer)
+			goto fail;
+
+		for (index = 0; index < slots->count; index++)
+			slots->entries[index].aj = &slots->buffer[index * slots->maxCellSize];
+
+		cache->maxCellSize = MAX(cache->maxCellSize, slots->maxCellSize);
+	}
+
+	if (cache->maxCellSize == 0)
+		goto fail;
+
+	return cache;
+fail:
+	shadow_glyph_cache_free(cache);
+	return NULL;
+}
+
+void shadow_glyph_cache_free(rdpShadowGlyphCache* cache)
+{
+	UINT32 id;
+
+	if (!cache)
+		return;
+
+	for (id = 0; id < SHADOW_GLYPH_CACHE_COUNT; id++)
+	{
+		free(cache->slots[id].entries);
+		free(cache->slots[id].buffer);
+	}
+
+	free(cache->glyphs);
+	free(cache->lines);
+	free(cache->bits);
+	free(cache->columns);
+	free(cache->table);
+	free(cache);
+}
@@ -0,0 +1,56 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SHADOW_SERVER_GLYPH_H
+#define FREERDP_SHADOW_SERVER_GLYPH_H
+
+#include <winpr/crt.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/codec/region.h>
+
+typedef struct rdp_shadow_glyph_cache rdpShadowGlyphCache;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Counts the distinct colors of a BGRX32 rectangle, up to two.
+ * Returns 1 or 2 with colors[0] being the most frequent one,
+ * or 0 if the rectangle has more than two colors.
+ */
+int shadow_glyph_classify(const BYTE* pSrcData, UINT32 nSrcStep,
+                          const RECTANGLE_16* rect, UINT32* colors, UINT32* counts);
+
+/**
+ * Sends a two color BGRX32 rectangle as glyph index orders, caching
+ * the glyph bitmaps on the client. Returns FALSE if the rectangle is
+ * not worth sending as text, in which case nothing has been sent.
+ */
+BOOL shadow_glyph_cache_encode(rdpShadowGlyphCache* cache, rdpContext* context,
+                               const BYTE* pSrcData, UINT32 nSrcStep,
+                               const RECTANGLE_16* rect, UINT32 bgColor, UINT32 fgColor);
+
+/* Returns NULL if the client does not support glyph caching */
+rdpShadowGlyphCache* shadow_glyph_cache_new(rdpSettings* settings);
+void shadow_glyph_cache_free(rdpShadowGlyphCache* cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SHADOW_SERVER_GLYPH_H */
@@ -335,3 +335,78 @@ HANDLE shadow_multiclient_getevent(void* subscriber)
 
 	return ((struct rdp_shadow_multiclient_subscriber*)subscriber)->ref->event;
 }
+
+/*
+ * Non-blocking variants for clients sharing an event loop thread: waiting
+ * on the barrier would stall the other clients of that thread, so instead
+ * a subscriber remembers it already consumed the current event and sits
+ * out the rest of the turn.
+ */
+void* shadow_multiclient_get_subscriber_nowait(rdpShadowMultiClientEvent* event)
+{
+	struct rdp_shadow_multiclient_subscriber* subscriber;
+
+	if (!event)
+		return NULL;
+
+	subscriber = (struct rdp_shadow_multiclient_subscriber*) calloc(1, sizeof(struct rdp_shadow_multiclient_subscriber));
+
+	if (!subscriber)
+		return NULL;
+
+	subscriber->ref = event;
+	subscriber->pleaseHandle = FALSE;
+	EnterCriticalSection(&(event->lock));
+
+	if (ArrayList_Add(event->subscribers, subscriber) < 0)
+	{
+		LeaveCriticalSection(&(event->lock));
+		free(subscriber);
+		return NULL;
+	}
+
+	LeaveCriticalSection(&(event->lock));
+	return subscriber;
+}
+
+BOOL shadow_multiclient_pending(void* subscriber)
+{
+	struct rdp_shadow_multiclient_subscriber* s;
+	rdpShadowMultiClientEvent* event;
+	BOOL ret;
+
+	if (!subscriber)
+		return FALSE;
+
+	s = (struct rdp_shadow_multiclient_subscriber*)subscriber;
+	event = s->ref;
+
+	EnterCriticalSection(&(event->lock));
+	ret = s->pleaseHandle && (WaitForSingleObject(event->event, 0) == WAIT_OBJECT_0);
+	LeaveCriticalSection(&(event->lock));
+
+	return ret;
+}
+
+BOOL shadow_multiclient_consume_nowait(void* subscriber)
+{
+	struct rdp_shadow_multiclient_subscriber* s;
+	rdpShadowMultiClientEvent* event;
+	BOOL ret;
+
+	if (!subscriber)
+		return FALSE;
+
+	s = (struct rdp_shadow_multiclient_subscriber*)subscriber;
+	event = s->ref;
+
+	EnterCriticalSection(&(event->lock));
+	ret = _Consume(s, FALSE);
+
+	if (ret)
+		s->pleaseHandle = FALSE;
+
+	LeaveCriticalSection(&(event->lock));
+
+	return ret;
+}
@@ -57,6 +57,9 @@ void* shadow_multiclient_get_subscriber(rdpShadowMultiClientEvent* event);
 void shadow_multiclient_release_subscriber(void* subscriber);
 BOOL shadow_multiclient_consume(void* subscriber);
 HANDLE shadow_multiclient_getevent(void* subscriber);
+void* shadow_multiclient_get_subscriber_nowait(rdpShadowMultiClientEvent* event);
+BOOL shadow_multiclient_pending(void* subscriber);
+BOOL shadow_multiclient_consume_nowait(void* subscriber);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,379 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/log.h>
+
+#include "shadow_motion.h"
+
+#define TAG SERVER_TAG("shadow.motion")
+
+/**
+ * Scrolls and window moves are found by hashing a few row segments of the
+ * current frame that changed and looking for the same segments in the
+ * previous frame: in the same columns for vertical scrolls, with a rolling
+ * hash along the same row for horizontal ones and over all rows for moves.
+ * Every match gives a candidate offset, which is grown from the segment into
+ * the largest rectangle that moved by exactly that offset.
+ */
+
+#define SHADOW_MOTION_SEGMENT		32
+#define SHADOW_MOTION_ANCHORS		3
+#define SHADOW_MOTION_CANDIDATES	32
+#define SHADOW_MOTION_MIN_AREA		(128 * 128)
+#define SHADOW_MOTION_HASH_BASE		0x100000001B3ULL
+
+struct rdp_shadow_motion
+{
+	UINT32 width;
+	UINT32 height;
+	UINT32 scanline;
+	BYTE* frame;
+	UINT64 basePower;
+};
+
+struct _SHADOW_MOTION_ANCHOR
+{
+	UINT32 x;
+	UINT32 y;
+	UINT64 hash;
+};
+typedef struct _SHADOW_MOTION_ANCHOR SHADOW_MOTION_ANCHOR;
+
+struct _SHADOW_MOTION_MATCH
+{
+	INT32 dx;
+	INT32 dy;
+	INT64 area;
+	RECTANGLE_16 rect;
+	UINT32 candidates;
+};
+typedef struct _SHADOW_MOTION_MATCH SHADOW_MOTION_MATCH;
+
+static INLINE const UINT32* shadow_motion_row(const BYTE* pData, UINT32 nStep, UINT32 y)
+{
+	return (const UINT32*) &pData[y * nStep];
+}
+
+static INLINE UINT64 shadow_motion_hash(const UINT32* pixels)
+{
+	UINT32 i;
+	UINT64 hash = 0;
+
+	for (i = 0; i < SHADOW_MOTION_SEGMENT; i++)
+		hash = (hash * SHADOW_MOTION_HASH_BASE) + pixels[i];
+
+	return hash;
+}
+
+/* single colour segments match everywhere and say nothing about motion */
+static INLINE BOOL shadow_motion_flat(const UINT32* pixels)
+{
+	UINT32 i;
+
+	for (i = 1; i < SHADOW_MOTION_SEGMENT; i++)
+	{
+		if (pixels[i] != pixels[0])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Grows the segment at x, y of the current frame, which equals the previous
+ * frame at x - dx, y - dy, first along its row and then row by row. Both the
+ * source and the destination stay within extents.
+ *
+ * @return the area of the rectangle
+ */
+static INT64 shadow_motion_grow(const rdpShadowMotion* motion, const BYTE* pSrcData,
+                                UINT32 nSrcStep, const RECTANGLE_16* extents, INT32 x, INT32 y,
+                                INT32 dx, INT32 dy, RECTANGLE_16* rect)
+{
+	size_t size;
+	INT32 left = x;
+	INT32 right = x + SHADOW_MOTION_SEGMENT;
+	INT32 top = y;
+	INT32 bottom = y + 1;
+	const INT32 minX = MAX(extents->left, extents->left + dx);
+	const INT32 maxX = MIN(extents->right, extents->right + dx);
+	const INT32 minY = MAX(extents->top, extents->top + dy);
+	const INT32 maxY = MIN(extents->bottom, extents->bottom + dy);
+	const UINT32* cur = shadow_motion_row(pSrcData, nSrcStep, y);
+	const UINT32* ref = shadow_motion_row(motion->frame, motion->scanline, y - dy);
+
+	while ((left > minX) && (cur[left - 1] == ref[left - 1 - dx]))
+		left--;
+
+	while ((right < maxX) && (cur[right] == ref[right - dx]))
+		right++;
+
+	size = (right - left) * 4;
+
+	while ((top > minY) &&
+	       (memcmp(&shadow_motion_row(pSrcData, nSrcStep, top - 1)[left],
+	               &shadow_motion_row(motion->frame, motion->scanline, top - 1 - dy)[left - dx],
+	               size) == 0))
+		top--;
+
+	while ((bottom < maxY) &&
+	       (memcmp(&shadow_motion_row(pSrcData, nSrcStep, bottom)[left],
+	               &shadow_motion_row(motion->frame, motion->scanline, bottom - dy)[left - dx],
+	               size) == 0))
+		bottom++;
+
+	rect->left = left;
+	rect->top = top;
+	rect->right = right;
+	rect->bottom = bottom;
+	return (INT64)(right - left) * (bottom - top);
+}
+
+/* Verifies a candidate offset and keeps it if it moved the largest area so far */
+static void shadow_motion_try(const rdpShadowMotion* motion, const BYTE* pSrcData,
+                              UINT32 nSrcStep, const RECTANGLE_16* area,
+                              const SHADOW_MOTION_ANCHOR* anchor, INT32 dx, INT32 dy,
+                              SHADOW_MOTION_MATCH* best)
+{
+	INT64 size;
+	RECTANGLE_16 rect;
+	const UINT32* cur = shadow_motion_row(pSrcData, nSrcStep, anchor->y);
+	const UINT32* ref = shadow_motion_row(motion->frame, motion->scanline, anchor->y - dy);
+
+	if (((dx == best->dx) && (dy == best->dy)) ||
+	    (memcmp(&cur[anchor->x], &ref[anchor->x - dx], SHADOW_MOTION_SEGMENT * 4) != 0))
+		return;
+
+	best->candidates++;
+	size = shadow_motion_grow(motion, pSrcData, nSrcStep, area, anchor->x, anchor->y, dx, dy,
+	                          &rect);
+
+	if (size > best->area)
+	{
+		best->area = size;
+		best->rect = rect;
+		best->dx = dx;
+		best->dy = dy;
+	}
+}
+
+BOOL shadow_motion_detect(rdpShadowMotion* motion, const BYTE* pSrcData, UINT32 nSrcStep,
+                          const RECTANGLE_16* extents, RECTANGLE_16* rectSrc,
+                          RECTANGLE_16* rectDst)
+{
+	UINT32 i, x, y;
+	UINT32 numAnchors = 0;
+	INT64 areaSize;
+	RECTANGLE_16 area;
+	SHADOW_MOTION_MATCH best = { 0 };
+	SHADOW_MOTION_ANCHOR anchors[SHADOW_MOTION_ANCHORS];
+
+	if (!motion || !pSrcData || !extents || !rectSrc || !rectDst)
+		return FALSE;
+
+	area.left = extents->left;
+	area.top = extents->top;
+	area.right = MIN(extents->right, motion->width);
+	area.bottom = MIN(extents->bottom, motion->height);
+
+	if ((area.right < area.left + SHADOW_MOTION_SEGMENT) || (area.bottom <= area.top))
+		return FALSE;
+
+	areaSize = (INT64)(area.right - area.left) * (area.bottom - area.top);
+
+	if (areaSize < SHADOW_MOTION_MIN_AREA)
+		return FALSE;
+
+	/* one changed segment in each of a few rows spread over the area */
+	for (i = 0; i < SHADOW_MOTION_ANCHORS; i++)
+	{
+		const UINT32* cur;
+		const UINT32* ref;
+		y = area.top + ((area.bottom - area.top) * (i + 1) / (SHADOW_MOTION_ANCHORS + 1));
+		cur = shadow_motion_row(pSrcData, nSrcStep, y);
+		ref = shadow_motion_row(motion->frame, motion->scanline, y);
+
+		for (x = area.left; x + SHADOW_MOTION_SEGMENT <= area.right; x += SHADOW_MOTION_SEGMENT)
+		{
+			if (shadow_motion_flat(&cur[x]) ||
+			    (memcmp(&cur[x], &ref[x], SHADOW_MOTION_SEGMENT * 4) == 0))
+				continue;
+
+			anchors[numAnchors].x = x;
+			anchors[numAnchors].y = y;
+			anchors[numAnchors].hash = shadow_motion_hash(&cur[x]);
+			numAnchors++;
+			break;
+		}
+	}
+
+	if (numAnchors < 1)
+		return FALSE;
+
+	/* vertical scrolls, the segment in the same columns of another row */
+	for (i = 0; i < numAnchors; i++)
+	{
+		const SHADOW_MOTION_ANCHOR* anchor = &anchors[i];
+
+		for (y = area.top; y < area.bottom; y++)
+		{
+			const UINT32* ref = shadow_motion_row(motion->frame, motion->scanline, y);
+
+			if ((y != anchor->y) && (shadow_motion_hash(&ref[anchor->x]) == anchor->hash))
+				shadow_motion_try(motion, pSrcData, nSrcStep, &area, anchor, 0,
+				                  (INT32) anchor->y - (INT32) y, &best);
+		}
+	}
+
+	/* horizontal scrolls, the segment elsewhere in the same row */
+	for (i = 0; i < numAnchors; i++)
+	{
+		const SHADOW_MOTION_ANCHOR* anchor = &anchors[i];
+		const UINT32* ref = shadow_motion_row(motion->frame, motion->scanline, anchor->y);
+		UINT64 hash = shadow_motion_hash(&ref[area.left]);
+
+		for (x = area.left; ; x++)
+		{
+			if ((x != anchor->x) && (hash == anchor->hash))
+				shadow_motion_try(motion, pSrcData, nSrcStep, &area, anchor,
+				                  (INT32) anchor->x - (INT32) x, 0, &best);
+
+			if (x + SHADOW_MOTION_SEGMENT >= area.right)
+				break;
+
+			hash = (hash * SHADOW_MOTION_HASH_BASE) + ref[x + SHADOW_MOTION_SEGMENT] -
+			       (ref[x] * motion->basePower);
+		}
+	}
+
+	/* window moves, the segment anywhere in the area */
+	best.candidates = 0;
+
+	for (y = area.top; (y < area.bottom) && (best.area < areaSize / 2) &&
+	     (best.candidates < SHADOW_MOTION_CANDIDATES); y++)
+	{
+		const UINT32* ref = shadow_motion_row(motion->frame, motion->scanline, y);
+		UINT64 hash = shadow_motion_hash(&ref[area.left]);
+
+		for (x = area.left; ; x++)
+		{
+			for (i = 0; i < numAnchors; i++)
+			{
+				const SHADOW_MOTION_ANCHOR* anchor = &anchors[i];
+
+				if ((hash == anchor->hash) && (x != anchor->x) && (y != anchor->y))
+					shadow_motion_try(motion, pSrcData, nSrcStep, &area, anchor,
+					                  (INT32) anchor->x - (INT32) x, (INT32) anchor->y - (INT32) y,
+					                  &best);
+			}
+
+			if (x + SHADOW_MOTION_SEGMENT >= area.right)
+				break;
+
+			hash = (hash * SHADOW_MOTION_HASH_BASE) + ref[x + SHADOW_MOTION_SEGMENT] -
+			       (ref[x] * motion->basePower);
+		}
+	}
+
+	if (best.area < SHADOW_MOTION_MIN_AREA)
+		return FALSE;
+
+	*rectDst = best.rect;
+	rectSrc->left = best.rect.left - best.dx;
+	rectSrc->top = best.rect.top - best.dy;
+	rectSrc->right = best.rect.right - best.dx;
+	rectSrc->bottom = best.rect.bottom - best.dy;
+	return TRUE;
+}
+
+void shadow_motion_update(rdpShadowMotion* motion, const BYTE* pSrcData, UINT32 nSrcStep,
+                          const RECTANGLE_16* rects, UINT32 numRects)
+{
+	UINT32 i, y;
+
+	if (!motion || !pSrcData || !rects)
+		return;
+
+	for (i = 0; i < numRects; i++)
+	{
+		const UINT32 left = MIN(rects[i].left, motion->width);
+		const UINT32 right = MIN(rects[i].right, motion->width);
+		const UINT32 bottom = MIN(rects[i].bottom, motion->height);
+
+		if (right <= left)
+			continue;
+
+		for (y = rects[i].top; y < bottom; y++)
+		{
+			CopyMemory(&motion->frame[(y * motion->scanline) + (left * 4)],
+			           &pSrcData[(y * nSrcStep) + (left * 4)], (right - left) * 4);
+		}
+	}
+}
+
+void shadow_motion_reset(rdpShadowMotion* motion)
+{
+	if (!motion)
+		return;
+
+	ZeroMemory(motion->frame, (size_t) motion->height * motion->scanline);
+}
+
+rdpShadowMotion* shadow_motion_new(UINT32 width, UINT32 height)
+{
+	UINT32 i;
+	rdpShadowMotion* motion;
+
+	if ((width < 1) || (height < 1))
+		return NULL;
+
+	motion = (rdpShadowMotion*) calloc(1, sizeof(rdpShadowMotion));
+
+	if (!motion)
+		return NULL;
+
+	motion->width = width;
+	motion->height = height;
+	motion->scanline = width * 4;
+	motion->frame = (BYTE*) calloc(height, motion->scanline);
+
+	if (!motion->frame)
+	{
+		WLog_ERR(TAG, "Failed to allocate the %"PRIu32"x%"PRIu32" reference frame", width, height);
+		free(motion);
+		return NULL;
+	}
+
+	motion->basePower = 1;
+
+	for (i = 0; i < SHADOW_MOTION_SEGMENT; i++)
+		motion->basePower *= SHADOW_MOTION_HASH_BASE;
+
+	return motion;
+}
+
+void shadow_motion_free(rdpShadowMotion* motion)
+{
+	if (!motion)
+		return;
+
+	free(motion->frame);
+	free(motion);
+}
@@ -0,0 +1,55 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SHADOW_SERVER_MOTION_H
+#define FREERDP_SHADOW_SERVER_MOTION_H
+
+#include <winpr/crt.h>
+
+#include <freerdp/freerdp.h>
+
+typedef struct rdp_shadow_motion rdpShadowMotion;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Looks for a rectangle of the previous frame that was scrolled or moved to
+ * another place within extents of the current BGRX32 frame, both frames in
+ * the same coordinates. On success
+ * rectDst is the area of the current frame that equals rectSrc of the
+ * previous frame, so a copy of rectSrc to rectDst on the client reproduces it.
+ */
+BOOL shadow_motion_detect(rdpShadowMotion* motion, const BYTE* pSrcData, UINT32 nSrcStep,
+                          const RECTANGLE_16* extents, RECTANGLE_16* rectSrc,
+                          RECTANGLE_16* rectDst);
+
+/* Records the rectangles of the current frame as sent to the client */
+void shadow_motion_update(rdpShadowMotion* motion, const BYTE* pSrcData, UINT32 nSrcStep,
+                          const RECTANGLE_16* rects, UINT32 numRects);
+
+/* Forgets the previous frame, when the client surface was recreated blank */
+void shadow_motion_reset(rdpShadowMotion* motion);
+
+rdpShadowMotion* shadow_motion_new(UINT32 width, UINT32 height);
+void shadow_motion_free(rdpShadowMotion* motion);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SHADOW_SERVER_MOTION_H */
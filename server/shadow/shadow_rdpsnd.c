@@ -20,27 +20,65 @@
 #include "config.h"
 #endif
 
+#include <winpr/synch.h>
+
 #include <freerdp/log.h>
+#include <freerdp/codec/dsp.h>
 #include "shadow.h"
 
 #include "shadow_rdpsnd.h"
 
 #define TAG SERVER_TAG("shadow")
 
-/* Default supported audio formats */
+static BYTE gsm610_samples_per_block[] = { 0x40, 0x01 };
+
+/**
+ * Default supported audio formats, in order of preference. AAC is only
+ * offered when built with FFmpeg. Without it PCM is preferred as before,
+ * the built in codecs lose quality and save less than AAC.
+ */
 static const AUDIO_FORMAT default_supported_audio_formats[] =
 {
+	{ WAVE_FORMAT_AAC_MS, 2, 44100, 12000, 4, 16, 0, NULL },
 	{ WAVE_FORMAT_PCM, 2, 44100, 176400, 4, 16, 0, NULL },
-	{ WAVE_FORMAT_ALAW, 2, 22050, 44100, 2, 8, 0, NULL }
+	{ WAVE_FORMAT_ALAW, 2, 22050, 44100, 2, 8, 0, NULL },
+	{ WAVE_FORMAT_DVI_ADPCM, 2, 44100, 44251, 2048, 4, 0, NULL },
+	{ WAVE_FORMAT_GSM610, 1, 8000, 1625, 65, 0, 2, gsm610_samples_per_block }
 };
 
+/* The samples of the subsystems */
+static const AUDIO_FORMAT default_source_audio_format =
+{
+	WAVE_FORMAT_PCM, 2, 44100, 176400, 4, 16, 0, NULL
+};
+
+static AUDIO_FORMAT encodable_audio_formats[ARRAYSIZE(default_supported_audio_formats)];
+static int num_encodable_audio_formats = 0;
+static INIT_ONCE encodable_audio_formats_once = INIT_ONCE_STATIC_INIT;
+
+/* Only offer what this build can encode */
+static BOOL CALLBACK rdpsnd_init_formats(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAYSIZE(default_supported_audio_formats); i++)
+	{
+		if (freerdp_dsp_supports_format(&default_supported_audio_formats[i], TRUE))
+			encodable_audio_formats[num_encodable_audio_formats++] = default_supported_audio_formats[i];
+	}
+
+	return TRUE;
+}
+
 static void rdpsnd_activated(RdpsndServerContext* context)
 {
 	AUDIO_FORMAT* agreed_format = NULL;
 	int i = 0, j = 0;
-	for (i = 0; i < context->num_client_formats; i++)
+
+	/* the order of the server formats is the preference */
+	for (j = 0; j < context->num_server_formats; j++)
 	{
-		for (j = 0; j < context->num_server_formats; j++)
+		for (i = 0; i < context->num_client_formats; i++)
 		{
 			if ((context->client_formats[i].wFormatTag == context->server_formats[j].wFormatTag) &&
 					(context->client_formats[i].nChannels == context->server_formats[j].nChannels) &&
@@ -84,12 +122,15 @@ int shadow_client_rdpsnd_init(rdpShadowClient* client)
 	else
 	{
 		/* Set default audio formats. */
-		rdpsnd->server_formats = default_supported_audio_formats;
-		rdpsnd->num_server_formats =
-			sizeof(default_supported_audio_formats) / sizeof(default_supported_audio_formats[0]);
+		InitOnceExecuteOnce(&encodable_audio_formats_once, rdpsnd_init_formats, NULL, NULL);
+		rdpsnd->server_formats = encodable_audio_formats;
+		rdpsnd->num_server_formats = num_encodable_audio_formats;
 	}
 
-	rdpsnd->src_format = rdpsnd->server_formats[0];
+	if (client->subsystem->rdpsndFormats)
+		rdpsnd->src_format = rdpsnd->server_formats[0];
+	else
+		rdpsnd->src_format = default_source_audio_format;
 
 	rdpsnd->Activated = rdpsnd_activated;
 
@@ -0,0 +1,632 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+
+#include <freerdp/log.h>
+
+#include "shadow.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#endif
+
+#define TAG SERVER_TAG("shadow.reactor")
+
+#ifdef __linux__
+
+#define SHADOW_REACTOR_MAX_HANDLES	32
+#define SHADOW_REACTOR_MAX_EVENTS	64
+
+/* the workers look for connections over their time limit once per tick */
+#define SHADOW_REACTOR_TICK		1000
+#define SHADOW_REACTOR_CONNECT_TIMEOUT	30000
+
+typedef struct rdp_shadow_reactor_worker rdpShadowReactorWorker;
+typedef struct rdp_shadow_reactor_session rdpShadowReactorSession;
+typedef struct rdp_shadow_reactor_connect rdpShadowReactorConnect;
+
+struct rdp_shadow_reactor_session
+{
+	rdpShadowClientLoop* loop;
+	rdpShadowReactorSession* next;
+	BOOL ready;
+
+	DWORD fdCount;
+	int fds[SHADOW_REACTOR_MAX_HANDLES];
+};
+
+struct rdp_shadow_reactor_connect
+{
+	rdpShadowReactor* reactor;
+	rdpShadowClient* client;
+	UINT64 deadline;
+	BOOL expired;
+	rdpShadowReactorConnect* next;
+};
+
+struct rdp_shadow_reactor_worker
+{
+	rdpShadowReactor* reactor;
+	HANDLE thread;
+	int epfd;
+	HANDLE wakeEvent;
+	int updateFd;
+	BOOL volatile stop;
+	LONG count;
+
+	CRITICAL_SECTION lock;
+	rdpShadowReactorSession* incoming;
+	rdpShadowReactorSession* sessions;
+};
+
+struct rdp_shadow_reactor
+{
+	rdpShadowServer* server;
+	UINT32 count;
+	rdpShadowReactorWorker* workers;
+
+	/* clients still in the connection sequence, guarded by lock */
+	CRITICAL_SECTION lock;
+	BOOL volatile stop;
+	LONG volatile connectCount;
+	rdpShadowReactorConnect* connecting;
+};
+
+static BOOL shadow_reactor_session_has_fd(rdpShadowReactorSession* session, int fd)
+{
+	DWORD index;
+
+	for (index = 0; index < session->fdCount; index++)
+	{
+		if (session->fds[index] == fd)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Brings the epoll set in line with the handles the client waits on now,
+ * the transport may swap its handles during the connection sequence.
+ */
+
+static BOOL shadow_reactor_session_sync(rdpShadowReactorWorker* worker,
+                                        rdpShadowReactorSession* session)
+{
+	DWORD index;
+	DWORD nCount;
+	DWORD fdCount = 0;
+	int fds[SHADOW_REACTOR_MAX_HANDLES];
+	HANDLE events[SHADOW_REACTOR_MAX_HANDLES];
+	rdpShadowReactorSession current;
+	nCount = shadow_client_loop_get_event_handles(session->loop, events, ARRAYSIZE(events));
+
+	if (nCount == 0)
+		return FALSE;
+
+	current.fdCount = 0;
+
+	for (index = 0; index < nCount; index++)
+	{
+		int fd = GetEventFileDescriptor(events[index]);
+
+		if (fd < 0)
+		{
+			WLog_ERR(TAG, "client event handle without file descriptor");
+			return FALSE;
+		}
+
+		if (!shadow_reactor_session_has_fd(&current, fd))
+			current.fds[current.fdCount++] = fd;
+	}
+
+	for (index = 0; index < session->fdCount; index++)
+	{
+		if (!shadow_reactor_session_has_fd(&current, session->fds[index]))
+			epoll_ctl(worker->epfd, EPOLL_CTL_DEL, session->fds[index], NULL);
+		else
+			fds[fdCount++] = session->fds[index];
+	}
+
+	for (index = 0; index < current.fdCount; index++)
+	{
+		struct epoll_event event = { 0 };
+
+		if (shadow_reactor_session_has_fd(session, current.fds[index]))
+			continue;
+
+		event.events = EPOLLIN;
+		event.data.ptr = session;
+
+		if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, current.fds[index], &event) < 0)
+		{
+			WLog_ERR(TAG, "epoll_ctl(EPOLL_CTL_ADD) failed with %d", errno);
+			session->fdCount = fdCount;
+			CopyMemory(session->fds, fds, fdCount * sizeof(int));
+			return FALSE;
+		}
+
+		fds[fdCount++] = current.fds[index];
+	}
+
+	session->fdCount = fdCount;
+	CopyMemory(session->fds, fds, fdCount * sizeof(int));
+	return TRUE;
+}
+
+static void shadow_reactor_session_free(rdpShadowReactorWorker* worker,
+                                        rdpShadowReactorSession* session)
+{
+	DWORD index;
+
+	/* the descriptors are closed along with the peer */
+	for (index = 0; index < session->fdCount; index++)
+		epoll_ctl(worker->epfd, EPOLL_CTL_DEL, session->fds[index], NULL);
+
+	shadow_client_loop_free(session->loop);
+	InterlockedDecrement(&worker->count);
+	free(session);
+}
+
+/**
+ * The update event is shared by all clients, so it is registered once per
+ * worker and edge triggered: it stays set until the last client of every
+ * worker consumed it, the clients done with it must not be woken again.
+ */
+
+static BOOL shadow_reactor_worker_watch_update(rdpShadowReactorWorker* worker,
+        rdpShadowReactorSession* session)
+{
+	struct epoll_event event = { 0 };
+
+	if (worker->updateFd >= 0)
+		return TRUE;
+
+	worker->updateFd = GetEventFileDescriptor(shadow_client_loop_get_update_event(session->loop));
+
+	if (worker->updateFd < 0)
+		return FALSE;
+
+	event.events = EPOLLIN | EPOLLET;
+	event.data.ptr = &worker->updateFd;
+
+	if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->updateFd, &event) < 0)
+	{
+		WLog_ERR(TAG, "epoll_ctl(EPOLL_CTL_ADD) failed with %d", errno);
+		worker->updateFd = -1;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void shadow_reactor_worker_adopt(rdpShadowReactorWorker* worker)
+{
+	rdpShadowReactorSession* session;
+	rdpShadowReactorSession* next;
+	EnterCriticalSection(&worker->lock);
+	session = worker->incoming;
+	worker->incoming = NULL;
+	LeaveCriticalSection(&worker->lock);
+
+	for (; session; session = next)
+	{
+		next = session->next;
+
+		/* subscribed only now, clients in their handshake never hold up the frames */
+		if (!shadow_client_loop_subscribe(session->loop) ||
+		    !shadow_reactor_worker_watch_update(worker, session) ||
+		    !shadow_reactor_session_sync(worker, session))
+		{
+			shadow_reactor_session_free(worker, session);
+			continue;
+		}
+
+		session->next = worker->sessions;
+		worker->sessions = session;
+	}
+}
+
+static void shadow_reactor_worker_dispatch(rdpShadowReactorWorker* worker)
+{
+	rdpShadowReactorSession* prev = NULL;
+	rdpShadowReactorSession* session = worker->sessions;
+
+	while (session)
+	{
+		rdpShadowReactorSession* next = session->next;
+
+		if (session->ready)
+		{
+			session->ready = FALSE;
+
+			if (!shadow_client_loop_check(session->loop) ||
+			    !shadow_reactor_session_sync(worker, session))
+			{
+				if (prev)
+					prev->next = next;
+				else
+					worker->sessions = next;
+
+				shadow_reactor_session_free(worker, session);
+				session = next;
+				continue;
+			}
+		}
+
+		prev = session;
+		session = next;
+	}
+}
+
+/**
+ * TLS and NLA block while they run, a client hanging in its handshake
+ * would stall every session of a worker. The connection sequence runs on
+ * its own short lived thread instead, the client is handed to a worker
+ * once it is activated. Connections that take too long have their socket
+ * shut down, which ends a handshake blocked in a read.
+ */
+
+static void shadow_reactor_expire_connections(rdpShadowReactor* reactor, BOOL all)
+{
+	rdpShadowReactorConnect* connect;
+	const UINT64 now = GetTickCount64();
+	EnterCriticalSection(&reactor->lock);
+
+	for (connect = reactor->connecting; connect; connect = connect->next)
+	{
+		freerdp_peer* peer = ((rdpContext*) connect->client)->peer;
+
+		if (connect->expired || (!all && (now < connect->deadline)))
+			continue;
+
+		if (!all)
+			WLog_WARN(TAG, "Client %s did not finish connecting in %d ms, closing",
+			          peer->hostname, SHADOW_REACTOR_CONNECT_TIMEOUT);
+
+		connect->expired = TRUE;
+		shutdown(peer->sockfd, SHUT_RDWR);
+	}
+
+	LeaveCriticalSection(&reactor->lock);
+}
+
+static DWORD WINAPI shadow_reactor_worker_thread(LPVOID arg)
+{
+	int index;
+	int status;
+	rdpShadowReactorSession* session;
+	rdpShadowReactorWorker* worker = (rdpShadowReactorWorker*) arg;
+	struct epoll_event events[SHADOW_REACTOR_MAX_EVENTS];
+
+	while (!worker->stop)
+	{
+		status = epoll_wait(worker->epfd, events, ARRAYSIZE(events), SHADOW_REACTOR_TICK);
+
+		if (status < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			WLog_ERR(TAG, "epoll_wait failed with %d", errno);
+			break;
+		}
+
+		for (index = 0; index < status; index++)
+		{
+			void* ptr = events[index].data.ptr;
+
+			if (ptr == worker)
+			{
+				ResetEvent(worker->wakeEvent);
+				shadow_reactor_worker_adopt(worker);
+			}
+			else if (ptr == &worker->updateFd)
+			{
+				for (session = worker->sessions; session; session = session->next)
+					session->ready = TRUE;
+			}
+			else
+				((rdpShadowReactorSession*) ptr)->ready = TRUE;
+		}
+
+		shadow_reactor_worker_dispatch(worker);
+		shadow_reactor_expire_connections(worker->reactor, FALSE);
+	}
+
+	/* end the sessions still around, including the ones not adopted yet */
+	shadow_reactor_worker_adopt(worker);
+
+	while ((session = worker->sessions))
+	{
+		worker->sessions = session->next;
+		shadow_reactor_session_free(worker, session);
+	}
+
+	ExitThread(0);
+	return 0;
+}
+
+static void shadow_reactor_worker_uninit(rdpShadowReactorWorker* worker)
+{
+	if (worker->thread)
+	{
+		worker->stop = TRUE;
+		SetEvent(worker->wakeEvent);
+		WaitForSingleObject(worker->thread, INFINITE);
+		CloseHandle(worker->thread);
+		worker->thread = NULL;
+	}
+
+	if (worker->epfd >= 0)
+		close(worker->epfd);
+
+	if (worker->wakeEvent)
+		CloseHandle(worker->wakeEvent);
+
+	DeleteCriticalSection(&worker->lock);
+}
+
+static BOOL shadow_reactor_worker_init(rdpShadowReactorWorker* worker)
+{
+	struct epoll_event event = { 0 };
+	worker->updateFd = -1;
+
+	if (!InitializeCriticalSectionAndSpinCount(&worker->lock, 4000))
+		return FALSE;
+
+	worker->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (worker->epfd < 0)
+		return FALSE;
+
+	if (!(worker->wakeEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		return FALSE;
+
+	event.events = EPOLLIN;
+	event.data.ptr = worker;
+
+	if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, GetEventFileDescriptor(worker->wakeEvent),
+	              &event) < 0)
+		return FALSE;
+
+	if (!(worker->thread = CreateThread(NULL, 0, shadow_reactor_worker_thread, worker, 0, NULL)))
+		return FALSE;
+
+	return TRUE;
+}
+
+static BOOL shadow_reactor_adopt_client(rdpShadowReactor* reactor, rdpShadowClientLoop* loop)
+{
+	UINT32 index;
+	rdpShadowReactorSession* session;
+	rdpShadowReactorWorker* worker = &reactor->workers[0];
+
+	/* clients stay on the least loaded worker of the time they were activated */
+	for (index = 1; index < reactor->count; index++)
+	{
+		if (reactor->workers[index].count < worker->count)
+			worker = &reactor->workers[index];
+	}
+
+	if (!(session = (rdpShadowReactorSession*) calloc(1, sizeof(rdpShadowReactorSession))))
+		return FALSE;
+
+	session->loop = loop;
+	InterlockedIncrement(&worker->count);
+	EnterCriticalSection(&worker->lock);
+	session->next = worker->incoming;
+	worker->incoming = session;
+	LeaveCriticalSection(&worker->lock);
+	SetEvent(worker->wakeEvent);
+	return TRUE;
+}
+
+static void shadow_reactor_remove_connection(rdpShadowReactor* reactor,
+        rdpShadowReactorConnect* connect)
+{
+	rdpShadowReactorConnect** link;
+	EnterCriticalSection(&reactor->lock);
+
+	for (link = &reactor->connecting; *link; link = &(*link)->next)
+	{
+		if (*link == connect)
+		{
+			*link = connect->next;
+			break;
+		}
+	}
+
+	LeaveCriticalSection(&reactor->lock);
+}
+
+static DWORD WINAPI shadow_reactor_connect_thread(LPVOID arg)
+{
+	DWORD status;
+	DWORD nCount;
+	HANDLE events[SHADOW_REACTOR_MAX_HANDLES];
+	BOOL listed = FALSE;
+	rdpShadowReactorConnect* connect = (rdpShadowReactorConnect*) arg;
+	rdpShadowReactor* reactor = connect->reactor;
+	rdpShadowClient* client = connect->client;
+	/* frees the peer on failure */
+	rdpShadowClientLoop* loop = shadow_client_loop_new(client, TRUE);
+
+	if (loop)
+	{
+		EnterCriticalSection(&reactor->lock);
+
+		if (!reactor->stop)
+		{
+			connect->next = reactor->connecting;
+			reactor->connecting = connect;
+			listed = TRUE;
+		}
+
+		LeaveCriticalSection(&reactor->lock);
+	}
+
+	while (listed && !client->activated)
+	{
+		if (reactor->stop || connect->expired)
+			break;
+
+		nCount = shadow_client_loop_get_event_handles(loop, events, ARRAYSIZE(events));
+
+		if (nCount == 0)
+			break;
+
+		status = WaitForMultipleObjects(nCount, events, FALSE, 100);
+
+		if ((status == WAIT_FAILED) || !shadow_client_loop_check(loop))
+			break;
+	}
+
+	/* the socket must not be shut down once the peer is handed on or freed */
+	if (listed)
+		shadow_reactor_remove_connection(reactor, connect);
+
+	if (loop && !(listed && client->activated && !reactor->stop && !connect->expired &&
+	              shadow_reactor_adopt_client(reactor, loop)))
+		shadow_client_loop_free(loop);
+
+	free(connect);
+	InterlockedDecrement(&reactor->connectCount);
+	ExitThread(0);
+	return 0;
+}
+
+BOOL shadow_reactor_add_client(rdpShadowReactor* reactor, rdpShadowClient* client)
+{
+	HANDLE thread;
+	rdpShadowReactorConnect* connect;
+
+	if (!(connect = (rdpShadowReactorConnect*) calloc(1, sizeof(rdpShadowReactorConnect))))
+		return FALSE;
+
+	connect->reactor = reactor;
+	connect->client = client;
+	connect->deadline = GetTickCount64() + SHADOW_REACTOR_CONNECT_TIMEOUT;
+	InterlockedIncrement(&reactor->connectCount);
+
+	if (!(thread = CreateThread(NULL, 0, shadow_reactor_connect_thread, connect, 0, NULL)))
+	{
+		InterlockedDecrement(&reactor->connectCount);
+		free(connect);
+		return FALSE;
+	}
+
+	CloseHandle(thread);
+	return TRUE;
+}
+
+rdpShadowReactor* shadow_reactor_new(rdpShadowServer* server, UINT32 workers)
+{
+	UINT32 index;
+	rdpShadowReactor* reactor;
+
+	if (workers < 1)
+		return NULL;
+
+	if (!(reactor = (rdpShadowReactor*) calloc(1, sizeof(rdpShadowReactor))))
+		return NULL;
+
+	reactor->server = server;
+
+	if (!InitializeCriticalSectionAndSpinCount(&reactor->lock, 4000))
+	{
+		free(reactor);
+		return NULL;
+	}
+
+	if (!(reactor->workers = (rdpShadowReactorWorker*) calloc(workers,
+	                         sizeof(rdpShadowReactorWorker))))
+	{
+		DeleteCriticalSection(&reactor->lock);
+		free(reactor);
+		return NULL;
+	}
+
+	for (index = 0; index < workers; index++)
+	{
+		reactor->count++;
+		reactor->workers[index].reactor = reactor;
+		reactor->workers[index].epfd = -1;
+
+		if (!shadow_reactor_worker_init(&reactor->workers[index]))
+		{
+			WLog_ERR(TAG, "Failed to start event loop thread %"PRIu32"", index);
+			shadow_reactor_free(reactor);
+			return NULL;
+		}
+	}
+
+	WLog_INFO(TAG, "Serving clients from %"PRIu32" event loop threads", workers);
+	return reactor;
+}
+
+void shadow_reactor_free(rdpShadowReactor* reactor)
+{
+	UINT32 index;
+
+	if (!reactor)
+		return;
+
+	/* end the connections in progress, they would hand their client to a worker */
+	reactor->stop = TRUE;
+	shadow_reactor_expire_connections(reactor, TRUE);
+
+	while (reactor->connectCount > 0)
+		Sleep(10);
+
+	for (index = 0; index < reactor->count; index++)
+		shadow_reactor_worker_uninit(&reactor->workers[index]);
+
+	free(reactor->workers);
+	DeleteCriticalSection(&reactor->lock);
+	free(reactor);
+}
+
+#else
+
+rdpShadowReactor* shadow_reactor_new(rdpShadowServer* server, UINT32 workers)
+{
+	WLog_WARN(TAG, "Event loop threads are not supported on this platform");
+	return NULL;
+}
+
+void shadow_reactor_free(rdpShadowReactor* reactor)
+{
+}
+
+BOOL shadow_reactor_add_client(rdpShadowReactor* reactor, rdpShadowClient* client)
+{
+	return FALSE;
+}
+
+#endif
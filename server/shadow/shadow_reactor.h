@@ -0,0 +1,44 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SHADOW_SERVER_REACTOR_H
+#define FREERDP_SHADOW_SERVER_REACTOR_H
+
+#include <freerdp/server/shadow.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHADOW_REACTOR_MAX_WORKERS	64
+
+/**
+ * Serves the clients from a fixed number of event loop threads instead of
+ * a thread per client. The connection sequence, TLS and NLA included,
+ * runs on a short lived thread per client; once activated the client
+ * stays on the least loaded worker of that time. Returns NULL where the
+ * platform has no epoll.
+ */
+rdpShadowReactor* shadow_reactor_new(rdpShadowServer* server, UINT32 workers);
+void shadow_reactor_free(rdpShadowReactor* reactor);
+
+BOOL shadow_reactor_add_client(rdpShadowReactor* reactor, rdpShadowClient* client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SHADOW_SERVER_REACTOR_H */
@@ -58,6 +58,7 @@ static COMMAND_LINE_ARGUMENT_A shadow_args[] =
 	{ "sec-nla", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "nla protocol security" },
 	{ "sec-ext", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "nla extended protocol security" },
 	{ "sam-file", COMMAND_LINE_VALUE_REQUIRED, "<file>", NULL, NULL, -1, NULL, "NTLM SAM file for NLA authentication" },
+	{ "workers", COMMAND_LINE_VALUE_REQUIRED, "<count>", NULL, NULL, -1, NULL, "Serve all clients from <count> (1 to 64) event loop threads instead of one thread each" },
 	{ "version", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_VERSION, NULL, NULL, NULL, -1, NULL, "Print version" },
 	{ "help", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_HELP, NULL, NULL, NULL, -1, "?", "Print help" },
 	{ NULL, 0, NULL, NULL, NULL, -1, NULL, NULL }
@@ -314,6 +315,20 @@ int shadow_server_parse_command_line(rdpShadowServer* server, int argc, char** a
 		{
 			freerdp_set_param_string(settings, FreeRDP_NtlmSamFile, arg->Value);
 		}
+		CommandLineSwitchCase(arg, "workers")
+		{
+			char* end = NULL;
+			unsigned long workers = strtoul(arg->Value, &end, 10);
+
+			if (!end || *end || (workers < 1) || (workers > SHADOW_REACTOR_MAX_WORKERS))
+			{
+				WLog_ERR(TAG, "invalid worker count %s, expected 1 to %d", arg->Value,
+				         SHADOW_REACTOR_MAX_WORKERS);
+				return -1;
+			}
+
+			server->workers = (UINT32) workers;
+		}
 		CommandLineSwitchDefault(arg)
 		{
 		}
@@ -461,6 +476,9 @@ int shadow_server_start(rdpShadowServer* server)
 		return -1;
 	}
 
+	if (server->workers && !(server->reactor = shadow_reactor_new(server, server->workers)))
+		WLog_WARN(TAG, "Falling back to one thread per client");
+
 	if (!server->ipcSocket)
 		status = server->listener->Open(server->listener, NULL, (UINT16) server->port);
 	else
@@ -495,6 +513,10 @@ int shadow_server_stop(rdpShadowServer* server)
 		server->listener->Close(server->listener);
 	}
 
+	/* the clients are gone by now, stop their event loop threads */
+	shadow_reactor_free(server->reactor);
+	server->reactor = NULL;
+
 	if (server->screen)
 	{
 		shadow_screen_free(server->screen);
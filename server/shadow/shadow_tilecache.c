@@ -0,0 +1,355 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/log.h>
+
+#include "shadow_tilecache.h"
+
+#define TAG SERVER_TAG("shadow.tilecache")
+
+/**
+ * Mirror of the client GFX bitmap cache. Every slot remembers the content
+ * hash and a copy of the tile stored in it, the slots are found by hash
+ * through chained buckets and kept in least recently used order in a doubly
+ * linked list. A hash match is only a hit if the pixels match too, a
+ * collision must never show a wrong tile on the client, so the cache holds
+ * up to maxBytes of copies. Slot 0 is never used, it terminates the chains
+ * and the lists.
+ */
+
+#define SHADOW_TILE_HASH_PRIME1	0x9E3779B185EBCA87ULL
+#define SHADOW_TILE_HASH_PRIME2	0xC2B2AE3D27D4EB4FULL
+#define SHADOW_TILE_HASH_PRIME3	0x165667B19E3779F9ULL
+
+struct _SHADOW_TILE_SLOT
+{
+	UINT64 key;
+	UINT16 next;
+	UINT16 older;
+	UINT16 newer;
+	UINT32 width;
+	UINT32 height;
+	size_t size;
+	BYTE* data;
+};
+typedef struct _SHADOW_TILE_SLOT SHADOW_TILE_SLOT;
+
+struct rdp_shadow_tile_cache
+{
+	UINT32 maxSlots;
+	UINT32 usedSlots;
+	size_t maxBytes;
+	size_t usedBytes;
+	UINT16 freeSlots;
+	SHADOW_TILE_SLOT* slots;
+	UINT16* buckets;
+	UINT32 bucketMask;
+	UINT16 oldest;
+	UINT16 newest;
+};
+
+static INLINE UINT64 shadow_tile_hash_round(UINT64 acc, UINT64 value)
+{
+	acc += value * SHADOW_TILE_HASH_PRIME2;
+	acc = (acc << 31) | (acc >> 33);
+	return acc * SHADOW_TILE_HASH_PRIME1;
+}
+
+static INLINE UINT64 shadow_tile_hash_read(const BYTE* data)
+{
+	UINT64 value;
+	CopyMemory(&value, data, sizeof(value));
+	return value;
+}
+
+/* Four independent lanes over 32 bytes per step keep the multipliers busy */
+UINT64 shadow_tile_cache_hash(const BYTE* pSrcData, UINT32 nSrcStep, UINT32 width,
+                              UINT32 height)
+{
+	UINT32 y;
+	const size_t length = (size_t) width * 4;
+	UINT64 acc[4] = { SHADOW_TILE_HASH_PRIME1, SHADOW_TILE_HASH_PRIME2,
+	                  SHADOW_TILE_HASH_PRIME3, ((UINT64) width << 32) | height
+	                };
+	UINT64 hash;
+
+	for (y = 0; y < height; y++)
+	{
+		size_t x = 0;
+		const BYTE* line = &pSrcData[(size_t) y * nSrcStep];
+
+		for (; x + 32 <= length; x += 32)
+		{
+			acc[0] = shadow_tile_hash_round(acc[0], shadow_tile_hash_read(&line[x]));
+			acc[1] = shadow_tile_hash_round(acc[1], shadow_tile_hash_read(&line[x + 8]));
+			acc[2] = shadow_tile_hash_round(acc[2], shadow_tile_hash_read(&line[x + 16]));
+			acc[3] = shadow_tile_hash_round(acc[3], shadow_tile_hash_read(&line[x + 24]));
+		}
+
+		for (; x + 8 <= length; x += 8)
+			acc[0] = shadow_tile_hash_round(acc[0], shadow_tile_hash_read(&line[x]));
+
+		for (; x < length; x += 4)
+		{
+			UINT32 value;
+			CopyMemory(&value, &line[x], sizeof(value));
+			acc[1] = shadow_tile_hash_round(acc[1], value);
+		}
+	}
+
+	hash = shadow_tile_hash_round(acc[0], acc[1]);
+	hash = shadow_tile_hash_round(hash, acc[2]);
+	hash = shadow_tile_hash_round(hash, acc[3]);
+	hash ^= hash >> 33;
+	hash *= SHADOW_TILE_HASH_PRIME2;
+	hash ^= hash >> 29;
+	hash *= SHADOW_TILE_HASH_PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+static INLINE UINT16* shadow_tile_cache_bucket(rdpShadowTileCache* cache, UINT64 key)
+{
+	return &cache->buckets[(key ^ (key >> 32)) & cache->bucketMask];
+}
+
+static void shadow_tile_cache_unlink(rdpShadowTileCache* cache, UINT16 slot)
+{
+	SHADOW_TILE_SLOT* entry = &cache->slots[slot];
+
+	if (entry->older)
+		cache->slots[entry->older].newer = entry->newer;
+	else
+		cache->oldest = entry->newer;
+
+	if (entry->newer)
+		cache->slots[entry->newer].older = entry->older;
+	else
+		cache->newest = entry->older;
+
+	entry->older = entry->newer = 0;
+}
+
+static void shadow_tile_cache_link_newest(rdpShadowTileCache* cache, UINT16 slot)
+{
+	SHADOW_TILE_SLOT* entry = &cache->slots[slot];
+	entry->older = cache->newest;
+	entry->newer = 0;
+
+	if (cache->newest)
+		cache->slots[cache->newest].newer = slot;
+	else
+		cache->oldest = slot;
+
+	cache->newest = slot;
+}
+
+static void shadow_tile_cache_remove_key(rdpShadowTileCache* cache, UINT16 slot)
+{
+	UINT16* link = shadow_tile_cache_bucket(cache, cache->slots[slot].key);
+
+	while (*link)
+	{
+		if (*link == slot)
+		{
+			*link = cache->slots[slot].next;
+			break;
+		}
+
+		link = &cache->slots[*link].next;
+	}
+
+	cache->slots[slot].next = 0;
+}
+
+static BOOL shadow_tile_cache_equal(const SHADOW_TILE_SLOT* entry, const BYTE* pSrcData,
+                                    UINT32 nSrcStep, UINT32 width, UINT32 height)
+{
+	UINT32 y;
+
+	if ((entry->width != width) || (entry->height != height))
+		return FALSE;
+
+	for (y = 0; y < height; y++)
+	{
+		if (memcmp(&entry->data[(size_t) y * width * 4], &pSrcData[(size_t) y * nSrcStep],
+		           (size_t) width * 4) != 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+UINT16 shadow_tile_cache_lookup(rdpShadowTileCache* cache, UINT64 key, const BYTE* pSrcData,
+                                UINT32 nSrcStep, UINT32 width, UINT32 height)
+{
+	UINT16 slot;
+
+	if (!cache || !pSrcData)
+		return 0;
+
+	for (slot = *shadow_tile_cache_bucket(cache, key); slot; slot = cache->slots[slot].next)
+	{
+		if ((cache->slots[slot].key != key) ||
+		    !shadow_tile_cache_equal(&cache->slots[slot], pSrcData, nSrcStep, width, height))
+			continue;
+
+		if (cache->newest != slot)
+		{
+			shadow_tile_cache_unlink(cache, slot);
+			shadow_tile_cache_link_newest(cache, slot);
+		}
+
+		return slot;
+	}
+
+	return 0;
+}
+
+static INLINE size_t shadow_tile_cache_bytes(UINT32 width, UINT32 height)
+{
+	return (size_t) width * height * 4;
+}
+
+static BOOL shadow_tile_cache_fits(rdpShadowTileCache* cache, size_t bytes)
+{
+	if (cache->usedBytes + bytes > cache->maxBytes)
+		return FALSE;
+
+	return cache->freeSlots || (cache->usedSlots < cache->maxSlots);
+}
+
+UINT16 shadow_tile_cache_evict(rdpShadowTileCache* cache, UINT32 width, UINT32 height)
+{
+	UINT16 slot;
+	SHADOW_TILE_SLOT* entry;
+
+	if (!cache || !cache->oldest || shadow_tile_cache_fits(cache, shadow_tile_cache_bytes(width,
+	        height)))
+		return 0;
+
+	slot = cache->oldest;
+	entry = &cache->slots[slot];
+	shadow_tile_cache_unlink(cache, slot);
+	shadow_tile_cache_remove_key(cache, slot);
+	cache->usedBytes -= shadow_tile_cache_bytes(entry->width, entry->height);
+	entry->next = cache->freeSlots;
+	cache->freeSlots = slot;
+	return slot;
+}
+
+UINT16 shadow_tile_cache_add(rdpShadowTileCache* cache, UINT64 key, const BYTE* pSrcData,
+                             UINT32 nSrcStep, UINT32 width, UINT32 height)
+{
+	UINT32 y;
+	UINT16 slot;
+	UINT16* bucket;
+	SHADOW_TILE_SLOT* entry;
+	const size_t bytes = shadow_tile_cache_bytes(width, height);
+
+	if (!cache || !pSrcData || !shadow_tile_cache_fits(cache, bytes))
+		return 0;
+
+	slot = cache->freeSlots ? cache->freeSlots : (UINT16)(cache->usedSlots + 1);
+	entry = &cache->slots[slot];
+
+	if (entry->size < bytes)
+	{
+		BYTE* data = (BYTE*) realloc(entry->data, bytes);
+
+		if (!data)
+			return 0;
+
+		entry->data = data;
+		entry->size = bytes;
+	}
+
+	if (cache->freeSlots)
+		cache->freeSlots = entry->next;
+	else
+		cache->usedSlots++;
+
+	for (y = 0; y < height; y++)
+		CopyMemory(&entry->data[(size_t) y * width * 4], &pSrcData[(size_t) y * nSrcStep],
+		           (size_t) width * 4);
+
+	bucket = shadow_tile_cache_bucket(cache, key);
+	entry->key = key;
+	entry->width = width;
+	entry->height = height;
+	entry->next = *bucket;
+	*bucket = slot;
+	cache->usedBytes += bytes;
+	shadow_tile_cache_link_newest(cache, slot);
+	return slot;
+}
+
+rdpShadowTileCache* shadow_tile_cache_new(UINT32 maxSlots, UINT32 maxBytes)
+{
+	UINT32 buckets = 1;
+	rdpShadowTileCache* cache;
+
+	/* slot 0 is reserved and slot numbers are 16 bit */
+	if (maxSlots < 2)
+		return NULL;
+
+	maxSlots = MIN(maxSlots - 1, 0xFFFF);
+
+	while (buckets < maxSlots * 2)
+		buckets <<= 1;
+
+	cache = (rdpShadowTileCache*) calloc(1, sizeof(rdpShadowTileCache));
+
+	if (!cache)
+		return NULL;
+
+	cache->maxSlots = maxSlots;
+	cache->maxBytes = maxBytes;
+	cache->bucketMask = buckets - 1;
+	cache->slots = (SHADOW_TILE_SLOT*) calloc(maxSlots + 1, sizeof(SHADOW_TILE_SLOT));
+	cache->buckets = (UINT16*) calloc(buckets, sizeof(UINT16));
+
+	if (!cache->slots || !cache->buckets)
+	{
+		WLog_ERR(TAG, "failed to allocate a cache of %"PRIu32" slots", maxSlots);
+		shadow_tile_cache_free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+void shadow_tile_cache_free(rdpShadowTileCache* cache)
+{
+	UINT32 slot;
+
+	if (!cache)
+		return;
+
+	if (cache->slots)
+	{
+		for (slot = 1; slot <= cache->maxSlots; slot++)
+			free(cache->slots[slot].data);
+	}
+
+	free(cache->slots);
+	free(cache->buckets);
+	free(cache);
+}
@@ -0,0 +1,64 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SHADOW_SERVER_TILECACHE_H
+#define FREERDP_SHADOW_SERVER_TILECACHE_H
+
+#include <winpr/crt.h>
+
+#include <freerdp/freerdp.h>
+
+typedef struct rdp_shadow_tile_cache rdpShadowTileCache;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Content hash of a BGRX32 rectangle, used as the cache key */
+UINT64 shadow_tile_cache_hash(const BYTE* pSrcData, UINT32 nSrcStep, UINT32 width,
+                              UINT32 height);
+
+/**
+ * Returns the client cache slot holding this tile and marks it as most
+ * recently used, or 0 if the tile is not cached. A slot with the same key
+ * is only returned if its pixels are the same.
+ */
+UINT16 shadow_tile_cache_lookup(rdpShadowTileCache* cache, UINT64 key, const BYTE* pSrcData,
+                                UINT32 nSrcStep, UINT32 width, UINT32 height);
+
+/**
+ * Frees the least recently used slot while a tile of this size doesn't fit
+ * in the slots and bytes left. Returns the slot, which must be evicted on
+ * the client, or 0 once the tile fits or the cache is empty.
+ */
+UINT16 shadow_tile_cache_evict(rdpShadowTileCache* cache, UINT32 width, UINT32 height);
+
+/**
+ * Stores a new tile in a free slot and returns the slot, or 0 if it doesn't
+ * fit, see shadow_tile_cache_evict.
+ */
+UINT16 shadow_tile_cache_add(rdpShadowTileCache* cache, UINT64 key, const BYTE* pSrcData,
+                             UINT32 nSrcStep, UINT32 width, UINT32 height);
+
+/* Slots and bytes of the client cache, as negotiated by the capabilities */
+rdpShadowTileCache* shadow_tile_cache_new(UINT32 maxSlots, UINT32 maxBytes);
+void shadow_tile_cache_free(rdpShadowTileCache* cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SHADOW_SERVER_TILECACHE_H */
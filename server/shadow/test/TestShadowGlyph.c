@@ -0,0 +1,317 @@
+#include <winpr/crt.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/settings.h>
+
+#include "shadow_glyph.h"
+
+#define TEST_WIDTH	48
+#define TEST_HEIGHT	12
+#define TEST_STEP	(TEST_WIDTH * 4)
+#define TEST_BG		0xFFFFFF
+#define TEST_FG		0x000000
+
+#define TEST_MAX_GLYPHS	32
+
+static const char* const TEST_GLYPH_A[7] =
+{
+	"#####",
+	"#...#",
+	"#...#",
+	"#####",
+	"#...#",
+	"#...#",
+	"#...#"
+};
+
+static const char* const TEST_GLYPH_B[7] =
+{
+	"####.",
+	"#...#",
+	"####.",
+	"#...#",
+	"#...#",
+	"#...#",
+	"####."
+};
+
+static const char* const TEST_GLYPH_C[7] =
+{
+	".###",
+	"#...",
+	"#...",
+	"#...",
+	"#...",
+	"#...",
+	".###"
+};
+
+struct test_glyph
+{
+	UINT32 cacheIndex;
+	UINT32 x;
+	UINT32 cx;
+	UINT32 cy;
+};
+
+struct test_orders
+{
+	UINT32 cacheOrders;
+	UINT32 cachedCount;
+	struct test_glyph cached[TEST_MAX_GLYPHS];
+	UINT32 indexOrders;
+	UINT32 drawnCount;
+	struct test_glyph drawn[TEST_MAX_GLYPHS];
+};
+
+static struct test_orders g_Orders;
+
+static BOOL test_cache_glyph_v2(rdpContext* context, const CACHE_GLYPH_V2_ORDER* order)
+{
+	UINT32 index;
+	g_Orders.cacheOrders++;
+
+	for (index = 0; index < order->cGlyphs; index++)
+	{
+		struct test_glyph* glyph;
+
+		if (g_Orders.cachedCount >= TEST_MAX_GLYPHS)
+			return FALSE;
+
+		glyph = &g_Orders.cached[g_Orders.cachedCount++];
+		glyph->cacheIndex = order->glyphData[index].cacheIndex;
+		glyph->cx = order->glyphData[index].cx;
+		glyph->cy = order->glyphData[index].cy;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_glyph_index(rdpContext* context, GLYPH_INDEX_ORDER* order)
+{
+	UINT32 offset = 0;
+	UINT32 x = order->x;
+	g_Orders.indexOrders++;
+
+	while (offset + 1 < order->cbData)
+	{
+		UINT32 delta;
+		struct test_glyph* glyph;
+
+		if (g_Orders.drawnCount >= TEST_MAX_GLYPHS)
+			return FALSE;
+
+		glyph = &g_Orders.drawn[g_Orders.drawnCount++];
+		glyph->cacheIndex = order->data[offset++];
+		delta = order->data[offset++];
+
+		if (delta == 0x80)
+		{
+			delta = order->data[offset] | (order->data[offset + 1] << 8);
+			offset += 2;
+		}
+
+		x += delta;
+		glyph->x = x;
+	}
+
+	return TRUE;
+}
+
+static void test_draw_text(BYTE* data, const char* const* glyphs[], UINT32 count)
+{
+	UINT32 x, y;
+	UINT32 index;
+
+	for (y = 0; y < TEST_HEIGHT; y++)
+	{
+		for (x = 0; x < TEST_WIDTH; x++)
+			*((UINT32*) &data[y * TEST_STEP + x * 4]) = TEST_BG;
+	}
+
+	for (index = 0; index < count; index++)
+	{
+		for (y = 0; y < 7; y++)
+		{
+			const char* row = glyphs[index][y];
+
+			for (x = 0; row[x]; x++)
+			{
+				if (row[x] == '#')
+					*((UINT32*) &data[(y + 2) * TEST_STEP + (index * 8 + 2 + x) * 4]) = TEST_FG;
+			}
+		}
+	}
+}
+
+static BOOL test_encode(rdpShadowGlyphCache* cache, rdpContext* context, BYTE* data,
+                        const char* const* glyphs[], UINT32 count)
+{
+	const RECTANGLE_16 rect = { 0, 0, TEST_WIDTH, TEST_HEIGHT };
+	ZeroMemory(&g_Orders, sizeof(g_Orders));
+	test_draw_text(data, glyphs, count);
+	return shadow_glyph_cache_encode(cache, context, data, TEST_STEP, &rect, TEST_BG, TEST_FG);
+}
+
+static BOOL test_classify(BYTE* data)
+{
+	UINT32 colors[2];
+	UINT32 counts[2];
+	const char* const* text[] = { TEST_GLYPH_A };
+	const RECTANGLE_16 rect = { 0, 0, TEST_WIDTH, TEST_HEIGHT };
+	test_draw_text(data, text, 1);
+
+	if (shadow_glyph_classify(data, TEST_STEP, &rect, colors, counts) != 2)
+		return FALSE;
+
+	if ((colors[0] != TEST_BG) || (colors[1] != TEST_FG) || (counts[0] <= counts[1]))
+		return FALSE;
+
+	*((UINT32*) &data[TEST_STEP + 4]) = 0x808080;
+	return shadow_glyph_classify(data, TEST_STEP, &rect, colors, counts) == 0;
+}
+
+/**
+ * Glyphs are cut at empty columns, repeated glyphs share one cache entry and
+ * are placed at their original position.
+ */
+static BOOL test_extraction(rdpShadowGlyphCache* cache, rdpContext* context, BYTE* data)
+{
+	UINT32 index;
+	const char* const* text[] = { TEST_GLYPH_A, TEST_GLYPH_B, TEST_GLYPH_A };
+
+	if (!test_encode(cache, context, data, text, 3))
+		return FALSE;
+
+	if ((g_Orders.cachedCount != 2) || (g_Orders.drawnCount != 3))
+		return FALSE;
+
+	if ((g_Orders.cached[0].cx != 5) || (g_Orders.cached[0].cy != 7) ||
+	    (g_Orders.cached[0].cacheIndex == g_Orders.cached[1].cacheIndex))
+		return FALSE;
+
+	for (index = 0; index < 3; index++)
+	{
+		if (g_Orders.drawn[index].x != index * 8 + 2)
+			return FALSE;
+	}
+
+	if ((g_Orders.drawn[0].cacheIndex != g_Orders.drawn[2].cacheIndex) ||
+	    (g_Orders.drawn[0].cacheIndex == g_Orders.drawn[1].cacheIndex))
+		return FALSE;
+
+	/* the same text again only costs a glyph index order */
+	if (!test_encode(cache, context, data, text, 3))
+		return FALSE;
+
+	return (g_Orders.cacheOrders == 0) && (g_Orders.indexOrders == 1) &&
+	       (g_Orders.drawnCount == 3);
+}
+
+/**
+ * With two cache entries the least recently used glyph is evicted, and a
+ * line with more distinct glyphs than entries is split in two batches.
+ */
+static BOOL test_eviction(rdpShadowGlyphCache* cache, rdpContext* context, BYTE* data)
+{
+	UINT32 indexA, indexB;
+	const char* const* textAB[] = { TEST_GLYPH_A, TEST_GLYPH_B };
+	const char* const* textA[] = { TEST_GLYPH_A };
+	const char* const* textB[] = { TEST_GLYPH_B };
+	const char* const* textC[] = { TEST_GLYPH_C };
+	const char* const* textABC[] = { TEST_GLYPH_A, TEST_GLYPH_B, TEST_GLYPH_C };
+
+	if (!test_encode(cache, context, data, textAB, 2) || (g_Orders.cachedCount != 2))
+		return FALSE;
+
+	indexA = g_Orders.drawn[0].cacheIndex;
+	indexB = g_Orders.drawn[1].cacheIndex;
+
+	if (!test_encode(cache, context, data, textA, 1) || (g_Orders.cachedCount != 0))
+		return FALSE;
+
+	/* B is the least recently used glyph */
+	if (!test_encode(cache, context, data, textC, 1) || (g_Orders.cachedCount != 1) ||
+	    (g_Orders.cached[0].cacheIndex != indexB) || (g_Orders.cached[0].cx != 4))
+		return FALSE;
+
+	if (!test_encode(cache, context, data, textA, 1) || (g_Orders.cachedCount != 0) ||
+	    (g_Orders.drawn[0].cacheIndex != indexA))
+		return FALSE;
+
+	if (!test_encode(cache, context, data, textB, 1) || (g_Orders.cachedCount != 1))
+		return FALSE;
+
+	if (!test_encode(cache, context, data, textABC, 3))
+		return FALSE;
+
+	return (g_Orders.cachedCount == 1) && (g_Orders.indexOrders == 2) &&
+	       (g_Orders.drawnCount == 3) && (g_Orders.drawn[2].x == 18);
+}
+
+static rdpShadowGlyphCache* test_cache_new(rdpSettings* settings, UINT32 entries)
+{
+	UINT32 index;
+
+	for (index = 0; index < 10; index++)
+	{
+		settings->GlyphCache[index].cacheEntries = 0;
+		settings->GlyphCache[index].cacheMaximumCellSize = 0;
+	}
+
+	settings->GlyphCache[0].cacheEntries = entries;
+	settings->GlyphCache[0].cacheMaximumCellSize = 32;
+	return shadow_glyph_cache_new(settings);
+}
+
+int TestShadowGlyph(int argc, char* argv[])
+{
+	int rc = -1;
+	BYTE* data;
+	rdpContext context = { 0 };
+	rdpUpdate update = { 0 };
+	rdpPrimaryUpdate primary = { 0 };
+	rdpSecondaryUpdate secondary = { 0 };
+	rdpShadowGlyphCache* cache = NULL;
+	rdpSettings* settings = freerdp_settings_new(FREERDP_SETTINGS_SERVER_MODE);
+	data = (BYTE*) calloc(TEST_HEIGHT, TEST_STEP);
+
+	if (!settings || !data)
+		goto fail;
+
+	primary.GlyphIndex = test_glyph_index;
+	secondary.CacheGlyphV2 = test_cache_glyph_v2;
+	update.primary = &primary;
+	update.secondary = &secondary;
+	context.update = &update;
+	settings->ColorDepth = 32;
+	settings->GlyphSupportLevel = GLYPH_SUPPORT_ENCODE;
+	settings->OrderSupport[NEG_GLYPH_INDEX_INDEX] = TRUE;
+
+	if (!test_classify(data))
+	{
+		fprintf(stderr, "glyph classification test failed\n");
+		goto fail;
+	}
+
+	if (!(cache = test_cache_new(settings, 64)) || !test_extraction(cache, &context, data))
+	{
+		fprintf(stderr, "glyph extraction test failed\n");
+		goto fail;
+	}
+
+	shadow_glyph_cache_free(cache);
+
+	if (!(cache = test_cache_new(settings, 2)) || !test_eviction(cache, &context, data))
+	{
+		fprintf(stderr, "glyph cache eviction test failed\n");
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+	shadow_glyph_cache_free(cache);
+	freerdp_settings_free(settings);
+	free(data);
+	return rc;
+}
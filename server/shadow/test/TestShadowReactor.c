@@ -0,0 +1,312 @@
+#include <winpr/crt.h>
+#include <winpr/crypto.h>
+#include <winpr/path.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/server/shadow.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define TEST_PORT	33897
+#define TEST_WIDTH	64
+#define TEST_HEIGHT	64
+#define TEST_FRAMES	8
+#define TEST_TIMEOUT	10000
+
+/* the other clients must get their frames long before a stalled connection times out */
+static LONG volatile s_frames = 0;
+static BOOL volatile s_stop = FALSE;
+
+static rdpShadowSubsystem* test_subsystem_new(void)
+{
+	return (rdpShadowSubsystem*) calloc(1, sizeof(rdpShadowSubsystem));
+}
+
+static void test_subsystem_free(rdpShadowSubsystem* subsystem)
+{
+	free(subsystem);
+}
+
+static int test_subsystem_init(rdpShadowSubsystem* subsystem)
+{
+	subsystem->numMonitors = 1;
+	subsystem->monitors[0].right = TEST_WIDTH;
+	subsystem->monitors[0].bottom = TEST_HEIGHT;
+	subsystem->monitors[0].flags = 1;
+	subsystem->virtualScreen = subsystem->monitors[0];
+	return 1;
+}
+
+static int test_subsystem_nop(rdpShadowSubsystem* subsystem)
+{
+	return 1;
+}
+
+static int test_subsystem_entry(RDP_SHADOW_ENTRY_POINTS* pEntryPoints)
+{
+	pEntryPoints->New = test_subsystem_new;
+	pEntryPoints->Free = test_subsystem_free;
+	pEntryPoints->Init = test_subsystem_init;
+	pEntryPoints->Uninit = test_subsystem_nop;
+	pEntryPoints->Start = test_subsystem_nop;
+	pEntryPoints->Stop = test_subsystem_nop;
+	return 1;
+}
+
+static BOOL test_surface_bits(rdpContext* context, const SURFACE_BITS_COMMAND* cmd)
+{
+	InterlockedIncrement(&s_frames);
+	return TRUE;
+}
+
+static BOOL test_bitmap_update(rdpContext* context, const BITMAP_UPDATE* bitmap)
+{
+	InterlockedIncrement(&s_frames);
+	return TRUE;
+}
+
+static BOOL test_post_connect(freerdp* instance)
+{
+	instance->update->SurfaceBits = test_surface_bits;
+	instance->update->BitmapUpdate = test_bitmap_update;
+	return TRUE;
+}
+
+static DWORD WINAPI test_client_thread(LPVOID arg)
+{
+	DWORD nCount;
+	HANDLE handles[64];
+	freerdp* instance = (freerdp*) arg;
+
+	if (!freerdp_connect(instance))
+	{
+		fprintf(stderr, "client failed to connect\n");
+		ExitThread(1);
+		return 1;
+	}
+
+	while (!s_stop)
+	{
+		if (!(nCount = freerdp_get_event_handles(instance->context, handles, ARRAYSIZE(handles))))
+			break;
+
+		if (WaitForMultipleObjects(nCount, handles, FALSE, 100) == WAIT_FAILED)
+			break;
+
+		if (!freerdp_check_event_handles(instance->context))
+			break;
+	}
+
+	freerdp_disconnect(instance);
+	ExitThread(0);
+	return 0;
+}
+
+static freerdp* test_client_new(void)
+{
+	rdpSettings* settings;
+	freerdp* instance = freerdp_new();
+
+	if (!instance)
+		return NULL;
+
+	instance->PostConnect = test_post_connect;
+
+	if (!freerdp_context_new(instance))
+	{
+		freerdp_free(instance);
+		return NULL;
+	}
+
+	settings = instance->settings;
+	settings->ServerPort = TEST_PORT;
+	settings->IgnoreCertificate = TRUE;
+	settings->RdpSecurity = FALSE;
+	settings->NlaSecurity = FALSE;
+	settings->TlsSecurity = TRUE;
+	settings->DesktopWidth = TEST_WIDTH;
+	settings->DesktopHeight = TEST_HEIGHT;
+
+	if (!(settings->ServerHostname = _strdup("127.0.0.1")))
+	{
+		freerdp_context_free(instance);
+		freerdp_free(instance);
+		return NULL;
+	}
+
+	return instance;
+}
+
+static void test_client_free(freerdp* instance)
+{
+	if (!instance)
+		return;
+
+	freerdp_context_free(instance);
+	freerdp_free(instance);
+}
+
+/**
+ * Asks for TLS and then goes quiet, the server hangs in the handshake
+ * reading a ClientHello that never comes.
+ */
+static int test_stalled_connect(void)
+{
+	const BYTE request[] =
+	{
+		/* TPKT header */
+		0x03, 0x00, 0x00, 0x13,
+		/* X.224 Connection Request */
+		0x0E, 0xE0, 0x00, 0x00, 0x00, 0x00, 0x00,
+		/* RDP_NEG_REQ, PROTOCOL_SSL */
+		0x01, 0x00, 0x08, 0x00, 0x01, 0x00, 0x00, 0x00
+	};
+	BYTE response[64];
+	struct sockaddr_in addr = { 0 };
+	struct timeval tv = { TEST_TIMEOUT / 1000, 0 };
+	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (sockfd < 0)
+		return -1;
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(TEST_PORT);
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+	if ((setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) ||
+	    (connect(sockfd, (struct sockaddr*) &addr, sizeof(addr)) < 0) ||
+	    (send(sockfd, request, sizeof(request), 0) != sizeof(request)) ||
+	    /* the connection confirm, the server is in its TLS handshake now */
+	    (recv(sockfd, response, sizeof(response), 0) <= 0))
+	{
+		close(sockfd);
+		return -1;
+	}
+
+	return sockfd;
+}
+
+/* noise, a solid fill or a moved frame would go out as orders instead */
+static void test_frame_update(rdpShadowServer* server)
+{
+	RECTANGLE_16 rect;
+	rdpShadowSurface* surface = server->surface;
+	rect.left = 0;
+	rect.top = 0;
+	rect.right = (UINT16) surface->width;
+	rect.bottom = (UINT16) surface->height;
+	winpr_RAND(surface->data, surface->scanline * surface->height);
+	region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion), &rect);
+	shadow_subsystem_frame_update(server->subsystem);
+	region16_clear(&(surface->invalidRegion));
+}
+
+int TestShadowReactor(int argc, char* argv[])
+{
+	int rc = -1;
+	int sockfd = -1;
+	UINT64 start;
+	UINT64 elapsed = 0;
+	char name[64];
+	char* path = NULL;
+	HANDLE thread = NULL;
+	freerdp* instance = NULL;
+	rdpShadowServer* server = NULL;
+	sprintf_s(name, sizeof(name), "TestShadowReactor-%d", (int) getpid());
+	shadow_subsystem_set_entry(test_subsystem_entry);
+
+	if (!(path = GetKnownSubPath(KNOWN_PATH_TEMP, name)))
+		return -1;
+
+	if (!(server = shadow_server_new()))
+		goto fail;
+
+	server->port = TEST_PORT;
+	server->workers = 1;
+
+	if (!(server->ConfigPath = _strdup(path)))
+		goto fail;
+
+	if ((shadow_server_init(server) < 0) || (shadow_server_start(server) < 0))
+	{
+		fprintf(stderr, "failed to start the shadow server\n");
+		goto fail;
+	}
+
+	if ((sockfd = test_stalled_connect()) < 0)
+	{
+		fprintf(stderr, "failed to stall a connection in its handshake\n");
+		goto fail;
+	}
+
+	if (!(instance = test_client_new()) ||
+	    !(thread = CreateThread(NULL, 0, test_client_thread, instance, 0, NULL)))
+		goto fail;
+
+	start = GetTickCount64();
+
+	while ((InterlockedCompareExchange(&s_frames, 0, 0) < TEST_FRAMES) && (elapsed < TEST_TIMEOUT))
+	{
+		if (WaitForSingleObject(thread, 0) == WAIT_OBJECT_0)
+			break;
+
+		test_frame_update(server);
+		Sleep(10);
+		elapsed = GetTickCount64() - start;
+	}
+
+	if (InterlockedCompareExchange(&s_frames, 0, 0) < TEST_FRAMES)
+	{
+		fprintf(stderr, "%"PRId32" frames in %"PRIu64" ms with a stalled connection\n",
+		        InterlockedCompareExchange(&s_frames, 0, 0), elapsed);
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+	s_stop = TRUE;
+
+	if (thread)
+	{
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+	}
+
+	test_client_free(instance);
+
+	if (sockfd >= 0)
+		close(sockfd);
+
+	if (server)
+	{
+		if (server->CertificateFile)
+			DeleteFileA(server->CertificateFile);
+
+		if (server->PrivateKeyFile)
+			DeleteFileA(server->PrivateKeyFile);
+
+		shadow_server_uninit(server);
+		shadow_server_free(server);
+	}
+
+	if (path)
+	{
+		char* shadowPath = GetCombinedPath(path, "shadow");
+
+		if (shadowPath)
+			RemoveDirectoryA(shadowPath);
+
+		RemoveDirectoryA(path);
+		free(shadowPath);
+		free(path);
+	}
+
+	return rc;
+}
@@ -0,0 +1,183 @@
+#include <winpr/crt.h>
+
+#include "shadow_tilecache.h"
+
+#define TEST_TILE	64
+#define TEST_STEP	(TEST_TILE * 4)
+#define TEST_BYTES	(TEST_TILE * TEST_STEP)
+
+static void test_fill(BYTE* data, BYTE value)
+{
+	FillMemory(data, TEST_BYTES, value);
+}
+
+/**
+ * A tile is only found under its key if its pixels are the same, a key
+ * collision with other content is a miss.
+ */
+static BOOL test_collision(BYTE* data)
+{
+	UINT16 slot;
+	BOOL rc = FALSE;
+	rdpShadowTileCache* cache = shadow_tile_cache_new(16, 16 * TEST_BYTES);
+
+	if (!cache)
+		return FALSE;
+
+	test_fill(data, 0x11);
+
+	if (!(slot = shadow_tile_cache_add(cache, 42, data, TEST_STEP, TEST_TILE, TEST_TILE)))
+		goto out;
+
+	if (shadow_tile_cache_lookup(cache, 42, data, TEST_STEP, TEST_TILE, TEST_TILE) != slot)
+		goto out;
+
+	/* the same key for other content */
+	data[TEST_BYTES - 1] = 0x12;
+
+	if (shadow_tile_cache_lookup(cache, 42, data, TEST_STEP, TEST_TILE, TEST_TILE) != 0)
+		goto out;
+
+	if (shadow_tile_cache_lookup(cache, 42, data, TEST_STEP, TEST_TILE / 2, TEST_TILE) != 0)
+		goto out;
+
+	/* both tiles live side by side */
+	if (shadow_tile_cache_add(cache, 42, data, TEST_STEP, TEST_TILE, TEST_TILE) == slot)
+		goto out;
+
+	data[TEST_BYTES - 1] = 0x11;
+	rc = (shadow_tile_cache_lookup(cache, 42, data, TEST_STEP, TEST_TILE, TEST_TILE) == slot);
+out:
+	shadow_tile_cache_free(cache);
+	return rc;
+}
+
+/**
+ * With room for 4 tiles by bytes, adding a fifth evicts the least recently
+ * used tile, and a larger tile evicts as many as it needs.
+ */
+static BOOL test_byte_budget(BYTE* data)
+{
+	UINT16 slots[5];
+	UINT16 slot;
+	UINT32 index;
+	BOOL rc = FALSE;
+	rdpShadowTileCache* cache = shadow_tile_cache_new(64, 4 * TEST_BYTES);
+
+	if (!cache)
+		return FALSE;
+
+	for (index = 0; index < 4; index++)
+	{
+		test_fill(data, (BYTE) index);
+
+		if (shadow_tile_cache_evict(cache, TEST_TILE, TEST_TILE) != 0)
+			goto out;
+
+		if (!(slots[index] = shadow_tile_cache_add(cache, index, data, TEST_STEP, TEST_TILE,
+		                     TEST_TILE)))
+			goto out;
+	}
+
+	/* tile 0 is used again, tile 1 becomes the oldest */
+	test_fill(data, 0);
+
+	if (shadow_tile_cache_lookup(cache, 0, data, TEST_STEP, TEST_TILE, TEST_TILE) != slots[0])
+		goto out;
+
+	test_fill(data, 4);
+
+	if (shadow_tile_cache_add(cache, 4, data, TEST_STEP, TEST_TILE, TEST_TILE) != 0)
+		goto out;
+
+	if ((shadow_tile_cache_evict(cache, TEST_TILE, TEST_TILE) != slots[1]) ||
+	    (shadow_tile_cache_evict(cache, TEST_TILE, TEST_TILE) != 0))
+		goto out;
+
+	if ((slots[4] = shadow_tile_cache_add(cache, 4, data, TEST_STEP, TEST_TILE,
+	                                      TEST_TILE)) != slots[1])
+		goto out;
+
+	/* twice the bytes of a tile need two evictions */
+	if ((shadow_tile_cache_evict(cache, TEST_TILE, 2 * TEST_TILE) != slots[2]) ||
+	    (shadow_tile_cache_evict(cache, TEST_TILE, 2 * TEST_TILE) != slots[3]) ||
+	    (shadow_tile_cache_evict(cache, TEST_TILE, 2 * TEST_TILE) != 0))
+		goto out;
+
+	test_fill(data, 1);
+
+	if (shadow_tile_cache_lookup(cache, 1, data, TEST_STEP, TEST_TILE, TEST_TILE) != 0)
+		goto out;
+
+	/* a tile larger than the whole cache empties it and is not stored */
+	while ((slot = shadow_tile_cache_evict(cache, TEST_TILE, 8 * TEST_TILE)))
+	{
+	}
+
+	if (shadow_tile_cache_add(cache, 5, data, TEST_STEP, TEST_TILE, 8 * TEST_TILE) != 0)
+		goto out;
+
+	rc = (shadow_tile_cache_add(cache, 1, data, TEST_STEP, TEST_TILE, TEST_TILE) != 0);
+out:
+	shadow_tile_cache_free(cache);
+	return rc;
+}
+
+/* The slot count bounds the cache when the tiles are small */
+static BOOL test_slot_budget(BYTE* data)
+{
+	UINT32 index;
+	BOOL rc = FALSE;
+	rdpShadowTileCache* cache = shadow_tile_cache_new(4, 64 * TEST_BYTES);
+
+	if (!cache)
+		return FALSE;
+
+	/* slot 0 is reserved, 3 slots are left */
+	for (index = 0; index < 3; index++)
+	{
+		test_fill(data, (BYTE) index);
+
+		if (!shadow_tile_cache_add(cache, index, data, TEST_STEP, 8, 8))
+			goto out;
+	}
+
+	rc = (shadow_tile_cache_add(cache, 3, data, TEST_STEP, 8, 8) == 0) &&
+	     (shadow_tile_cache_evict(cache, 8, 8) != 0) &&
+	     (shadow_tile_cache_add(cache, 3, data, TEST_STEP, 8, 8) != 0);
+out:
+	shadow_tile_cache_free(cache);
+	return rc;
+}
+
+int TestShadowTileCache(int argc, char* argv[])
+{
+	int rc = -1;
+	BYTE* data = (BYTE*) malloc(8 * TEST_BYTES);
+
+	if (!data)
+		return -1;
+
+	if (!test_collision(data))
+	{
+		fprintf(stderr, "tile cache collision test failed\n");
+		goto fail;
+	}
+
+	if (!test_byte_budget(data))
+	{
+		fprintf(stderr, "tile cache byte budget test failed\n");
+		goto fail;
+	}
+
+	if (!test_slot_budget(data))
+	{
+		fprintf(stderr, "tile cache slot budget test failed\n");
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+	free(data);
+	return rc;
+}
@@ -23,12 +23,15 @@
 #include <winpr/winpr.h>
 #include <winpr/wtypes.h>
 
+typedef struct winpr_sam_index WINPR_SAM_INDEX;
+
 struct winpr_sam
 {
 	FILE* fp;
 	char* line;
 	char* buffer;
 	BOOL readOnly;
+	WINPR_SAM_INDEX* index;
 };
 typedef struct winpr_sam WINPR_SAM;
 
@@ -238,6 +238,7 @@ int ntlm_fetch_ntlm_v2_hash(NTLM_CONTEXT* context, BYTE* hash)
 	else
 	{
 		WLog_ERR(TAG, "Error: Could not find user in SAM database");
+		SamClose(sam);
 		return 0;
 	}
 
@@ -22,119 +22,326 @@
 #endif
 
 #include <winpr/crt.h>
+#include <winpr/interlocked.h>
 
 #include <winpr/collections.h>
 
+#include "StreamPool.h"
+
+/**
+ * Pooled buffers are rounded up to a power of two size class so that
+ * returned streams can be recycled for any request of the same class.
+ * Streams of the smaller classes are cached in lock-free free lists,
+ * up to STREAMPOOL_MAX_CACHED_BYTES per pool.
+ */
+#define STREAMPOOL_MIN_CLASS_SHIFT	8
+#define STREAMPOOL_CLASS_COUNT		24
+#define STREAMPOOL_CACHED_CLASS_COUNT	15
+#define STREAMPOOL_FREE_LIST_SIZE	32
+#define STREAMPOOL_FREE_LIST_MASK	(STREAMPOOL_FREE_LIST_SIZE - 1)
+#define STREAMPOOL_MAX_CACHED_BYTES	(16 * 1024 * 1024)
+
+#define STREAMPOOL_CLASS_SIZE(_index) \
+	(((size_t) 1) << ((_index) + STREAMPOOL_MIN_CLASS_SHIFT))
+
+struct _wStreamPoolFreeList
+{
+	LONG volatile enqueuePos;
+	LONG volatile dequeuePos;
+	LONG volatile sequence[STREAMPOOL_FREE_LIST_SIZE];
+	wStream* volatile slots[STREAMPOOL_FREE_LIST_SIZE];
+};
+typedef struct _wStreamPoolFreeList wStreamPoolFreeList;
+
+/**
+ * The public wStreamPool is the first member, StreamPool_New hands out
+ * a pointer to it. The pool is reference counted by the streams in use
+ * and only destroyed once the last of them is returned.
+ */
+struct _wStreamPoolPrivate
+{
+	wStreamPool pool;
+
+	LONG volatile refCount;
+	LONG volatile closing;
+	LONG volatile cachedBytes;
+	wStreamPoolFreeList freeLists[STREAMPOOL_CACHED_CLASS_COUNT];
+
+	/* every stream owning a pool buffer, sorted by buffer address, guarded by lock */
+	wStream** buffers;
+	size_t bufferCount;
+	size_t bufferCapacity;
+};
+typedef struct _wStreamPoolPrivate wStreamPoolPrivate;
+
 /**
  * Methods
  */
 
-void StreamPool_ShiftUsed(wStreamPool* pool, int index, int count)
+static int StreamPool_ClassIndex(size_t size)
 {
-	if (count > 0)
+	int index;
+
+	for (index = 0; index < STREAMPOOL_CLASS_COUNT; index++)
 	{
-		if (pool->uSize + count > pool->uCapacity)
+		if (STREAMPOOL_CLASS_SIZE(index) >= size)
+			return index;
+	}
+
+	return -1;
+}
+
+/**
+ * The free lists are bounded multi-producer multi-consumer rings:
+ * every slot carries a sequence number telling whether it is ready
+ * to be written (sequence == position) or read (sequence == position + 1).
+ */
+
+static LONG StreamPool_SequenceDiff(LONG a, LONG b)
+{
+	return (LONG)((ULONG) a - (ULONG) b);
+}
+
+static BOOL StreamPool_FreeListPush(wStreamPoolFreeList* list, wStream* s)
+{
+	LONG diff;
+	LONG sequence;
+	LONG pos = list->enqueuePos;
+
+	for (;;)
+	{
+		sequence = list->sequence[pos & STREAMPOOL_FREE_LIST_MASK];
+		diff = StreamPool_SequenceDiff(sequence, pos);
+
+		if (diff == 0)
 		{
-			int new_cap;
-			wStream **new_arr;
-
-			new_cap = pool->uCapacity * 2;
-			new_arr = (wStream**) realloc(pool->uArray, sizeof(wStream*) * new_cap);
-			if (!new_arr)
-				return;
-			pool->uCapacity = new_cap;
-			pool->uArray = new_arr;
-		}
+			LONG next = (LONG)((ULONG) pos + 1);
+			LONG current = InterlockedCompareExchange(&list->enqueuePos, next, pos);
+
+			if (current == pos)
+				break;
 
-		MoveMemory(&pool->uArray[index + count], &pool->uArray[index], (pool->uSize - index) * sizeof(wStream*));
-		pool->uSize += count;
+			pos = current;
+		}
+		else if (diff < 0)
+			return FALSE; /* full */
+		else
+			pos = list->enqueuePos;
 	}
-	else if (count < 0)
+
+	list->slots[pos & STREAMPOOL_FREE_LIST_MASK] = s;
+	InterlockedExchange(&list->sequence[pos & STREAMPOOL_FREE_LIST_MASK], (LONG)((ULONG) pos + 1));
+	return TRUE;
+}
+
+static wStream* StreamPool_FreeListPop(wStreamPoolFreeList* list)
+{
+	LONG diff;
+	LONG sequence;
+	wStream* s;
+	LONG pos = list->dequeuePos;
+
+	for (;;)
 	{
-		if (pool->uSize - index + count > 0)
+		sequence = list->sequence[pos & STREAMPOOL_FREE_LIST_MASK];
+		diff = StreamPool_SequenceDiff(sequence, (LONG)((ULONG) pos + 1));
+
+		if (diff == 0)
 		{
-			MoveMemory(&pool->uArray[index], &pool->uArray[index - count],
-					(pool->uSize - index + count) * sizeof(wStream*));
-		}
+			LONG next = (LONG)((ULONG) pos + 1);
+			LONG current = InterlockedCompareExchange(&list->dequeuePos, next, pos);
+
+			if (current == pos)
+				break;
 
-		pool->uSize += count;
+			pos = current;
+		}
+		else if (diff < 0)
+			return NULL; /* empty */
+		else
+			pos = list->dequeuePos;
 	}
+
+	s = list->slots[pos & STREAMPOOL_FREE_LIST_MASK];
+	InterlockedExchange(&list->sequence[pos & STREAMPOOL_FREE_LIST_MASK],
+	                    (LONG)((ULONG) pos + STREAMPOOL_FREE_LIST_SIZE));
+	return s;
 }
 
 /**
- * Adds a used stream to the pool.
+ * Buffer registry, callers hold the pool lock.
  */
 
-void StreamPool_AddUsed(wStreamPool* pool, wStream* s)
+static size_t StreamPool_BufferIndex(wStreamPoolPrivate* priv, const BYTE* ptr)
 {
-	if ((pool->uSize + 1) >= pool->uCapacity)
+	size_t low = 0;
+	size_t high = priv->bufferCount;
+
+	/* number of registered buffers starting at or below ptr */
+	while (low < high)
 	{
-		int new_cap;
-		wStream **new_arr;
+		size_t mid = low + (high - low) / 2;
 
-		new_cap = pool->uCapacity * 2;
-		new_arr = (wStream**) realloc(pool->uArray, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			return;
-		pool->uCapacity = new_cap;
-		pool->uArray = new_arr;
+		if ((ULONG_PTR) Stream_Buffer(priv->buffers[mid]) <= (ULONG_PTR) ptr)
+			low = mid + 1;
+		else
+			high = mid;
 	}
 
-	pool->uArray[(pool->uSize)++] = s;
+	return low;
 }
 
-/**
- * Removes a used stream from the pool.
- */
-
-void StreamPool_RemoveUsed(wStreamPool* pool, wStream* s)
+static BOOL StreamPool_RegisterBuffer(wStreamPoolPrivate* priv, wStream* s)
 {
-	int index;
-	BOOL found = FALSE;
+	size_t index;
 
-	for (index = 0; index < pool->uSize; index++)
+	if (priv->bufferCount >= priv->bufferCapacity)
 	{
-		if (pool->uArray[index] == s)
-		{
-			found = TRUE;
-			break;
-		}
+		size_t new_cap = priv->bufferCapacity ? priv->bufferCapacity * 2 : 32;
+		wStream** new_arr = (wStream**) realloc(priv->buffers, sizeof(wStream*) * new_cap);
+
+		if (!new_arr)
+			return FALSE;
+
+		priv->buffers = new_arr;
+		priv->bufferCapacity = new_cap;
 	}
 
-	if (found)
-		StreamPool_ShiftUsed(pool, index, -1);
+	index = StreamPool_BufferIndex(priv, Stream_Buffer(s));
+	MoveMemory(&priv->buffers[index + 1], &priv->buffers[index],
+	           (priv->bufferCount - index) * sizeof(wStream*));
+	priv->buffers[index] = s;
+	priv->bufferCount++;
+	return TRUE;
 }
 
-void StreamPool_ShiftAvailable(wStreamPool* pool, int index, int count)
+static void StreamPool_UnregisterBuffer(wStreamPoolPrivate* priv, wStream* s)
 {
-	if (count > 0)
-	{
-		if (pool->aSize + count > pool->aCapacity)
-		{
-			int new_cap;
-			wStream **new_arr;
-
-			new_cap = pool->aCapacity * 2;
-			new_arr = (wStream**) realloc(pool->aArray, sizeof(wStream*) * new_cap);
-			if (!new_arr)
-				return;
-			pool->aCapacity = new_cap;
-			pool->aArray = new_arr;
-		}
+	size_t index = StreamPool_BufferIndex(priv, Stream_Buffer(s));
+
+	if ((index == 0) || (priv->buffers[index - 1] != s))
+		return;
+
+	index--;
+	priv->bufferCount--;
+	MoveMemory(&priv->buffers[index], &priv->buffers[index + 1],
+	           (priv->bufferCount - index) * sizeof(wStream*));
+}
 
-		MoveMemory(&pool->aArray[index + count], &pool->aArray[index], (pool->aSize - index) * sizeof(wStream*));
-		pool->aSize += count;
+static wStream* StreamPool_NewStream(wStreamPoolPrivate* priv, int index)
+{
+	wStream* s;
+	const size_t capacity = STREAMPOOL_CLASS_SIZE(index);
+
+	s = (wStream*) calloc(1, sizeof(wStream));
+
+	if (!s)
+		return NULL;
+
+	s->buffer = (BYTE*) malloc(capacity);
+
+	if (!s->buffer)
+	{
+		free(s);
+		return NULL;
 	}
-	else if (count < 0)
+
+	s->pointer = s->buffer;
+	s->capacity = capacity;
+	s->length = capacity;
+	EnterCriticalSection(&priv->pool.lock);
+
+	if (!StreamPool_RegisterBuffer(priv, s))
 	{
-		if (pool->aSize - index + count > 0)
-		{
-			MoveMemory(&pool->aArray[index], &pool->aArray[index - count],
-					(pool->aSize - index + count) * sizeof(wStream*));
-		}
+		LeaveCriticalSection(&priv->pool.lock);
+		free(s->buffer);
+		free(s);
+		return NULL;
+	}
+
+	LeaveCriticalSection(&priv->pool.lock);
+	return s;
+}
+
+static void StreamPool_DeleteStream(wStreamPoolPrivate* priv, wStream* s, BOOL bFreeBuffer)
+{
+	EnterCriticalSection(&priv->pool.lock);
+	StreamPool_UnregisterBuffer(priv, s);
+	LeaveCriticalSection(&priv->pool.lock);
+
+	if (bFreeBuffer)
+		free(s->buffer);
+
+	free(s);
+}
 
-		pool->aSize += count;
+static void StreamPool_Destroy(wStreamPoolPrivate* priv)
+{
+	StreamPool_Clear(&priv->pool);
+	DeleteCriticalSection(&priv->pool.lock);
+	free(priv->buffers);
+	free(priv);
+}
+
+static void StreamPool_ReleasePool(wStreamPoolPrivate* priv)
+{
+	if (InterlockedDecrement(&priv->refCount) == 0)
+		StreamPool_Destroy(priv);
+}
+
+/**
+ * Detaches a stream in use from the pool. Pool buffers are plain malloc'ed
+ * blocks, the caller owns the buffer unless bFreeBuffer is set.
+ */
+
+void StreamPool_FreeStream(wStreamPool* pool, wStream* s, BOOL bFreeBuffer)
+{
+	wStreamPoolPrivate* priv = (wStreamPoolPrivate*) pool;
+	StreamPool_DeleteStream(priv, s, bFreeBuffer);
+	InterlockedDecrement((LONG volatile*) &pool->uSize);
+	StreamPool_ReleasePool(priv);
+}
+
+/**
+ * Moves a pooled stream to a buffer of a larger class, preserving its content.
+ */
+
+BOOL StreamPool_ResizeBuffer(wStream* s, size_t size)
+{
+	BOOL rc;
+	size_t position;
+	size_t capacity;
+	BYTE* buffer;
+	wStreamPoolPrivate* priv = (wStreamPoolPrivate*) s->pool;
+	int index = StreamPool_ClassIndex(size);
+
+	if (index < 0)
+		return FALSE;
+
+	capacity = STREAMPOOL_CLASS_SIZE(index);
+
+	if (capacity <= Stream_Capacity(s))
+		return TRUE;
+
+	position = Stream_GetPosition(s);
+	EnterCriticalSection(&priv->pool.lock);
+	StreamPool_UnregisterBuffer(priv, s);
+	buffer = (BYTE*) realloc(Stream_Buffer(s), capacity);
+	rc = (buffer != NULL);
+
+	if (rc)
+	{
+		ZeroMemory(&buffer[Stream_Capacity(s)], capacity - Stream_Capacity(s));
+		s->buffer = buffer;
+		s->capacity = capacity;
+		s->length = capacity;
+		Stream_SetPosition(s, position);
 	}
+
+	/* should this fail the stream is no longer found by pointer, but still usable */
+	StreamPool_RegisterBuffer(priv, s);
+	LeaveCriticalSection(&priv->pool.lock);
+	return rc;
 }
 
 /**
@@ -144,52 +351,60 @@ void StreamPool_ShiftAvailable(wStreamPool* pool, int index, int count)
 wStream* StreamPool_Take(wStreamPool* pool, size_t size)
 {
 	int index;
-	int foundIndex;
 	wStream* s = NULL;
-
-	if (pool->synchronized)
-		EnterCriticalSection(&pool->lock);
+	wStreamPoolPrivate* priv = (wStreamPoolPrivate*) pool;
 
 	if (size == 0)
 		size = pool->defaultSize;
 
-	foundIndex = -1;
-
-	for (index = 0; index < pool->aSize; index++)
-	{
-		s = pool->aArray[index];
+	if ((index = StreamPool_ClassIndex(size)) < 0)
+		return NULL;
 
-		if (Stream_Capacity(s) >= size)
-		{
-			foundIndex = index;
-			break;
-		}
-	}
+	if (index < STREAMPOOL_CACHED_CLASS_COUNT)
+		s = StreamPool_FreeListPop(&priv->freeLists[index]);
 
-	if (foundIndex < 0)
+	if (s)
 	{
-		s = Stream_New(NULL, size);
-		if (!s)
-			goto out_fail;
+		InterlockedDecrement((LONG volatile*) &pool->aSize);
+		InterlockedExchangeAdd(&priv->cachedBytes, -((LONG) Stream_Capacity(s)));
 	}
-	else
+	else if (!(s = StreamPool_NewStream(priv, index)))
+		return NULL;
+
+	Stream_SetPosition(s, 0);
+	Stream_SetLength(s, Stream_Capacity(s));
+	s->pool = pool;
+	s->count = 1;
+	InterlockedIncrement(&priv->refCount);
+	InterlockedIncrement((LONG volatile*) &pool->uSize);
+	return s;
+}
+
+static BOOL StreamPool_Cache(wStreamPoolPrivate* priv, wStream* s)
+{
+	LONG capacity;
+	int index = StreamPool_ClassIndex(Stream_Capacity(s));
+
+	if ((index < 0) || (index >= STREAMPOOL_CACHED_CLASS_COUNT) ||
+	    (Stream_Capacity(s) != STREAMPOOL_CLASS_SIZE(index)) || priv->closing)
+		return FALSE;
+
+	capacity = (LONG) Stream_Capacity(s);
+
+	if (InterlockedExchangeAdd(&priv->cachedBytes, capacity) + capacity > STREAMPOOL_MAX_CACHED_BYTES)
 	{
-		Stream_SetPosition(s, 0);
-		StreamPool_ShiftAvailable(pool, foundIndex, -1);
+		InterlockedExchangeAdd(&priv->cachedBytes, -capacity);
+		return FALSE;
 	}
 
-	if (s)
+	if (!StreamPool_FreeListPush(&priv->freeLists[index], s))
 	{
-		s->pool = pool;
-		s->count = 1;
-		StreamPool_AddUsed(pool, s);
+		InterlockedExchangeAdd(&priv->cachedBytes, -capacity);
+		return FALSE;
 	}
 
-out_fail:
-	if (pool->synchronized)
-		LeaveCriticalSection(&pool->lock);
-
-	return s;
+	InterlockedIncrement((LONG volatile*) &priv->pool.aSize);
+	return TRUE;
 }
 
 /**
@@ -198,40 +413,13 @@ out_fail:
 
 void StreamPool_Return(wStreamPool* pool, wStream* s)
 {
-	if (pool->synchronized)
-		EnterCriticalSection(&pool->lock);
+	wStreamPoolPrivate* priv = (wStreamPoolPrivate*) pool;
+	InterlockedDecrement((LONG volatile*) &pool->uSize);
 
-	if ((pool->aSize + 1) >= pool->aCapacity)
-	{
-		int new_cap;
-		wStream **new_arr;
-
-		new_cap = pool->aCapacity * 2;
-		new_arr = (wStream**) realloc(pool->aArray, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			goto out_fail;
-		pool->aCapacity = new_cap;
-		pool->aArray = new_arr;
-	}
-	else if ((pool->aSize + 1) * 3 < pool->aCapacity)
-	{
-		int new_cap;
-		wStream **new_arr;
+	if (!StreamPool_Cache(priv, s))
+		StreamPool_DeleteStream(priv, s, TRUE);
 
-		new_cap = pool->aCapacity / 2;
-		new_arr = (wStream**) realloc(pool->aArray, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			goto out_fail;
-		pool->aCapacity = new_cap;
-		pool->aArray = new_arr;
-	}
-
-	pool->aArray[(pool->aSize)++] = s;
-	StreamPool_RemoveUsed(pool, s);
-
-out_fail:
-	if (pool->synchronized)
-		LeaveCriticalSection(&pool->lock);
+	StreamPool_ReleasePool(priv);
 }
 
 /**
@@ -259,11 +447,7 @@ void StreamPool_Unlock(wStreamPool* pool)
 void Stream_AddRef(wStream* s)
 {
 	if (s->pool)
-	{
-		StreamPool_Lock(s->pool);
-		s->count++;
-		StreamPool_Unlock(s->pool);
-	}
+		InterlockedIncrement((LONG volatile*) &s->count);
 }
 
 /**
@@ -272,15 +456,9 @@ void Stream_AddRef(wStream* s)
 
 void Stream_Release(wStream* s)
 {
-	DWORD count;
-
 	if (s->pool)
 	{
-		StreamPool_Lock(s->pool);
-		count = --(s->count);
-		StreamPool_Unlock(s->pool);
-
-		if (count == 0)
+		if (InterlockedDecrement((LONG volatile*) &s->count) == 0)
 			StreamPool_Return(s->pool, s);
 	}
 }
@@ -291,26 +469,24 @@ void Stream_Release(wStream* s)
 
 wStream* StreamPool_Find(wStreamPool* pool, BYTE* ptr)
 {
-	int index;
+	size_t index;
 	wStream* s = NULL;
-	BOOL found = FALSE;
+	wStreamPoolPrivate* priv = (wStreamPoolPrivate*) pool;
 
 	EnterCriticalSection(&pool->lock);
+	index = StreamPool_BufferIndex(priv, ptr);
 
-	for (index = 0; index < pool->uSize; index++)
+	if (index > 0)
 	{
-		s = pool->uArray[index];
+		s = priv->buffers[index - 1];
 
-		if ((ptr >= Stream_Buffer(s)) && (ptr < (Stream_Buffer(s) + Stream_Capacity(s))))
-		{
-			found = TRUE;
-			break;
-		}
+		if ((s->count == 0) ||
+		    ((ULONG_PTR) ptr >= (ULONG_PTR)(Stream_Buffer(s) + Stream_Capacity(s))))
+			s = NULL;
 	}
 
 	LeaveCriticalSection(&pool->lock);
-
-	return (found) ? s : NULL;
+	return s;
 }
 
 /**
@@ -347,17 +523,19 @@ void StreamPool_Release(wStreamPool* pool, BYTE* ptr)
 
 void StreamPool_Clear(wStreamPool* pool)
 {
-	if (pool->synchronized)
-		EnterCriticalSection(&pool->lock);
+	int index;
+	wStream* s;
+	wStreamPoolPrivate* priv = (wStreamPoolPrivate*) pool;
 
-	while (pool->aSize > 0)
+	for (index = 0; index < STREAMPOOL_CACHED_CLASS_COUNT; index++)
 	{
-		(pool->aSize)--;
-		Stream_Free(pool->aArray[pool->aSize], TRUE);
+		while ((s = StreamPool_FreeListPop(&priv->freeLists[index])))
+		{
+			InterlockedDecrement((LONG volatile*) &pool->aSize);
+			InterlockedExchangeAdd(&priv->cachedBytes, -((LONG) Stream_Capacity(s)));
+			StreamPool_DeleteStream(priv, s, TRUE);
+		}
 	}
-
-	if (pool->synchronized)
-		LeaveCriticalSection(&pool->lock);
 }
 
 /**
@@ -366,53 +544,42 @@ void StreamPool_Clear(wStreamPool* pool)
 
 wStreamPool* StreamPool_New(BOOL synchronized, size_t defaultSize)
 {
-	wStreamPool* pool = NULL;
-
-	pool = (wStreamPool*) calloc(1, sizeof(wStreamPool));
-
-	if (pool)
-	{
-		pool->synchronized = synchronized;
-		pool->defaultSize = defaultSize;
-
-		pool->aSize = 0;
-		pool->aCapacity = 32;
-		pool->aArray = (wStream**) calloc(pool->aCapacity, sizeof(wStream*));
+	int index;
+	int slot;
+	wStreamPoolPrivate* priv;
 
-		if (!pool->aArray)
-		{
-			free(pool);
-			return NULL;
-		}
+	priv = (wStreamPoolPrivate*) calloc(1, sizeof(wStreamPoolPrivate));
 
-		pool->uSize = 0;
-		pool->uCapacity = 32;
-		pool->uArray = (wStream**) calloc(pool->uCapacity, sizeof(wStream*));
+	if (!priv)
+		return NULL;
 
-		if (!pool->uArray)
-		{
-			free(pool->aArray);
-			free(pool);
-			return NULL;
-		}
+	priv->pool.synchronized = synchronized;
+	priv->pool.defaultSize = defaultSize;
+	priv->refCount = 1;
 
-		InitializeCriticalSectionAndSpinCount(&pool->lock, 4000);
+	for (index = 0; index < STREAMPOOL_CACHED_CLASS_COUNT; index++)
+	{
+		for (slot = 0; slot < STREAMPOOL_FREE_LIST_SIZE; slot++)
+			priv->freeLists[index].sequence[slot] = slot;
 	}
 
-	return pool;
+	InitializeCriticalSectionAndSpinCount(&priv->pool.lock, 4000);
+	return &priv->pool;
 }
 
+/**
+ * Streams still in use keep the pool alive, it is destroyed when the last
+ * of them is returned or freed.
+ */
+
 void StreamPool_Free(wStreamPool* pool)
 {
-	if (pool)
+	wStreamPoolPrivate* priv = (wStreamPoolPrivate*) pool;
+
+	if (priv)
 	{
+		InterlockedExchange(&priv->closing, TRUE);
 		StreamPool_Clear(pool);
-
-		DeleteCriticalSection(&pool->lock);
-
-		free(pool->aArray);
-		free(pool->uArray);
-
-		free(pool);
+		StreamPool_ReleasePool(priv);
 	}
 }
@@ -0,0 +1,27 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * Object Pool
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WINPR_UTILS_STREAMPOOL_PRIVATE_H
+#define WINPR_UTILS_STREAMPOOL_PRIVATE_H
+
+#include <winpr/stream.h>
+
+/* Pooled streams are resized and freed through the pool, stream.c hands them back here */
+BOOL StreamPool_ResizeBuffer(wStream* s, size_t size);
+void StreamPool_FreeStream(wStreamPool* pool, wStream* s, BOOL bFreeBuffer);
+
+#endif /* WINPR_UTILS_STREAMPOOL_PRIVATE_H */
@@ -25,9 +25,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/stat.h>
+
 #include <winpr/crt.h>
 #include <winpr/sam.h>
 #include <winpr/print.h>
+#include <winpr/synch.h>
+#include <winpr/interlocked.h>
 
 #include "../log.h"
 
@@ -42,6 +46,385 @@
 #endif
 #define TAG WINPR_TAG("utils")
 
+/* indexes of SAM files no longer opened that are kept for the next SamOpen */
+#define WINPR_SAM_MAX_IDLE_INDEXES	2
+
+/**
+ * SAM files are parsed once into a hashed index shared by every WINPR_SAM
+ * opened on the same file, and parsed again only after the file changed.
+ * Lookups search an immutable, reference counted snapshot of the index so
+ * that concurrent NTLM authentications only briefly hold the index lock.
+ *
+ * Users and domains are matched case insensitively on their UTF-16 upper
+ * case form, the first matching line of the file wins.
+ *
+ * Every lookup compares the stat data of the file (mtime, ctime, size and
+ * inode) against the indexed one. Indexes are reference counted by the
+ * WINPR_SAM handles using them, once closed they stay cached in most recently
+ * used order and only the last WINPR_SAM_MAX_IDLE_INDEXES are kept.
+ */
+
+struct winpr_sam_record
+{
+	LPSTR User;
+	UINT32 UserLength;
+	LPSTR Domain;
+	UINT32 DomainLength;
+	LPWSTR UserKey;
+	UINT32 UserKeyLength;
+	LPWSTR DomainKey;
+	UINT32 DomainKeyLength;
+	UINT32 next; /* index + 1 of the next record of the bucket, in file order */
+	BYTE LmHash[16];
+	BYTE NtHash[16];
+};
+typedef struct winpr_sam_record WINPR_SAM_RECORD;
+
+struct winpr_sam_table
+{
+	volatile LONG refCount;
+	char* buffer;
+	LPWSTR keys;
+	WINPR_SAM_RECORD* records;
+	UINT32 count;
+	UINT32* buckets;
+	UINT32 bucketMask;
+};
+typedef struct winpr_sam_table WINPR_SAM_TABLE;
+
+struct winpr_sam_index
+{
+	char* filename;
+	UINT32 refCount;
+	CRITICAL_SECTION lock;
+	WINPR_SAM_TABLE* table;
+	struct stat fileStat;
+	struct winpr_sam_index* next;
+};
+
+static INIT_ONCE g_SamIndexOnce = INIT_ONCE_STATIC_INIT;
+static CRITICAL_SECTION g_SamIndexLock;
+static WINPR_SAM_INDEX* g_SamIndexes = NULL;
+
+static void HexStrToBin(char* str, BYTE* bin, int length);
+
+static UINT32 SamHashKey(LPCWSTR key, UINT32 length)
+{
+	UINT32 i;
+	UINT32 hash = 2166136261U;
+
+	for (i = 0; i < length; i++)
+		hash = (hash ^ key[i]) * 16777619U;
+
+	return hash;
+}
+
+static LPWSTR SamMakeKey(LPCSTR str, UINT32 length, LPWSTR key, UINT32* keyLength)
+{
+	int status = 0;
+
+	if (length > 0)
+	{
+		status = MultiByteToWideChar(CP_ACP, 0, str, (int) length, key, (int) length);
+
+		if (status < 1)
+			return NULL;
+
+		CharUpperBuffW(key, (DWORD) status);
+	}
+
+	*keyLength = (UINT32) status;
+	return key;
+}
+
+static void SamTableRelease(WINPR_SAM_TABLE* table)
+{
+	if (!table)
+		return;
+
+	if (InterlockedDecrement(&table->refCount) > 0)
+		return;
+
+	free(table->buffer);
+	free(table->keys);
+	free(table->records);
+	free(table->buckets);
+	free(table);
+}
+
+static BOOL SamTableParseLine(WINPR_SAM_TABLE* table, char* line, LPWSTR* keys)
+{
+	int i;
+	char* p[5];
+	WINPR_SAM_RECORD* record = &table->records[table->count];
+	p[0] = line;
+
+	/* User:Domain:LmHash:NtHash:... */
+	for (i = 1; i < 5; i++)
+	{
+		char* sep = strchr(p[i - 1], ':');
+
+		if (!sep)
+			return TRUE;
+
+		*sep = '\0';
+		p[i] = sep + 1;
+	}
+
+	ZeroMemory(record, sizeof(WINPR_SAM_RECORD));
+	record->User = p[0];
+	record->UserLength = (UINT32) strlen(p[0]);
+	record->Domain = p[1];
+	record->DomainLength = (UINT32) strlen(p[1]);
+
+	if (record->UserLength < 1)
+		return TRUE;
+
+	if (!SamMakeKey(record->User, record->UserLength, *keys, &record->UserKeyLength))
+		return TRUE;
+
+	record->UserKey = *keys;
+	*keys += record->UserKeyLength;
+
+	if (!SamMakeKey(record->Domain, record->DomainLength, *keys, &record->DomainKeyLength))
+		return TRUE;
+
+	record->DomainKey = *keys;
+	*keys += record->DomainKeyLength;
+
+	if (strlen(p[2]) == 32)
+		HexStrToBin(p[2], record->LmHash, 16);
+
+	if (strlen(p[3]) == 32)
+		HexStrToBin(p[3], record->NtHash, 16);
+
+	table->count++;
+	return TRUE;
+}
+
+static WINPR_SAM_TABLE* SamTableLoad(const char* filename)
+{
+	FILE* fp;
+	char* line;
+	char* end;
+	LPWSTR keys;
+	long int fileSize;
+	UINT32 index;
+	UINT32 lines = 1;
+	UINT32 bucketCount = 16;
+	WINPR_SAM_TABLE* table = (WINPR_SAM_TABLE*) calloc(1, sizeof(WINPR_SAM_TABLE));
+
+	if (!table)
+		return NULL;
+
+	table->refCount = 1;
+	fp = fopen(filename, "r");
+
+	if (!fp)
+		goto fail;
+
+	if ((fseek(fp, 0, SEEK_END) != 0) || ((fileSize = ftell(fp)) < 0) ||
+	    (fseek(fp, 0, SEEK_SET) != 0))
+		goto fail_file;
+
+	table->buffer = (char*) malloc(fileSize + 1);
+	/* a key has at most as many UTF-16 code units as its UTF-8 form has bytes */
+	table->keys = (LPWSTR) calloc(fileSize + 1, sizeof(WCHAR));
+
+	if (!table->buffer || !table->keys)
+		goto fail_file;
+
+	if ((fileSize > 0) && (fread(table->buffer, fileSize, 1, fp) != 1))
+		goto fail_file;
+
+	fclose(fp);
+	table->buffer[fileSize] = '\0';
+
+	for (line = table->buffer; (line = strchr(line, '\n')) != NULL; line++)
+		lines++;
+
+	while (bucketCount < lines * 2)
+		bucketCount *= 2;
+
+	table->records = (WINPR_SAM_RECORD*) calloc(lines, sizeof(WINPR_SAM_RECORD));
+	table->buckets = (UINT32*) calloc(bucketCount, sizeof(UINT32));
+
+	if (!table->records || !table->buckets)
+		goto fail;
+
+	table->bucketMask = bucketCount - 1;
+	keys = table->keys;
+
+	for (line = table->buffer; line; line = end)
+	{
+		end = strchr(line, '\n');
+
+		if (end)
+			*end++ = '\0';
+
+		if ((strlen(line) > 1) && (line[0] != '#'))
+			SamTableParseLine(table, line, &keys);
+	}
+
+	/* chain the buckets backwards so that they are walked in file order */
+	for (index = table->count; index > 0; index--)
+	{
+		WINPR_SAM_RECORD* record = &table->records[index - 1];
+		UINT32* bucket = &table->buckets[SamHashKey(record->UserKey,
+		                                 record->UserKeyLength) & table->bucketMask];
+		record->next = *bucket;
+		*bucket = index;
+	}
+
+	return table;
+fail_file:
+	fclose(fp);
+fail:
+	SamTableRelease(table);
+	return NULL;
+}
+
+static BOOL SamFileChanged(const struct stat* a, const struct stat* b)
+{
+	if ((a->st_mtime != b->st_mtime) || (a->st_ctime != b->st_ctime) ||
+	    (a->st_size != b->st_size) || (a->st_ino != b->st_ino) || (a->st_dev != b->st_dev))
+		return TRUE;
+
+#if defined(__linux__)
+	if ((a->st_mtim.tv_nsec != b->st_mtim.tv_nsec) || (a->st_ctim.tv_nsec != b->st_ctim.tv_nsec))
+		return TRUE;
+#endif
+	return FALSE;
+}
+
+/**
+ * Returns a reference to the current index of the file, parsing the file
+ * again if it changed since the last lookup.
+ */
+static WINPR_SAM_TABLE* SamIndexAcquire(WINPR_SAM_INDEX* index)
+{
+	struct stat fileStat;
+	WINPR_SAM_TABLE* table = NULL;
+	const BOOL exists = (stat(index->filename, &fileStat) == 0);
+	EnterCriticalSection(&index->lock);
+
+	if (!exists)
+	{
+		SamTableRelease(index->table);
+		index->table = NULL;
+	}
+	else if (!index->table || SamFileChanged(&index->fileStat, &fileStat))
+	{
+		SamTableRelease(index->table);
+		index->table = SamTableLoad(index->filename);
+		index->fileStat = fileStat;
+
+		if (index->table)
+			WLog_DBG(TAG, "indexed %"PRIu32" SAM entries of %s", index->table->count, index->filename);
+	}
+
+	if (index->table)
+	{
+		table = index->table;
+		InterlockedIncrement(&table->refCount);
+	}
+
+	LeaveCriticalSection(&index->lock);
+	return table;
+}
+
+static BOOL CALLBACK SamIndexInit(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	return InitializeCriticalSectionAndSpinCount(&g_SamIndexLock, 4000);
+}
+
+static void SamIndexFree(WINPR_SAM_INDEX* index)
+{
+	if (!index)
+		return;
+
+	SamTableRelease(index->table);
+	DeleteCriticalSection(&index->lock);
+	free(index->filename);
+	free(index);
+}
+
+static WINPR_SAM_INDEX* SamIndexGet(const char* filename)
+{
+	WINPR_SAM_INDEX* index;
+	WINPR_SAM_INDEX** link;
+
+	if (!InitOnceExecuteOnce(&g_SamIndexOnce, SamIndexInit, NULL, NULL))
+		return NULL;
+
+	EnterCriticalSection(&g_SamIndexLock);
+
+	for (link = &g_SamIndexes; (index = *link) != NULL; link = &index->next)
+	{
+		if (strcmp(index->filename, filename) == 0)
+		{
+			*link = index->next;
+			break;
+		}
+	}
+
+	if (!index)
+	{
+		index = (WINPR_SAM_INDEX*) calloc(1, sizeof(WINPR_SAM_INDEX));
+
+		if (index && !(index->filename = _strdup(filename)))
+		{
+			free(index);
+			index = NULL;
+		}
+		else if (index && !InitializeCriticalSectionAndSpinCount(&index->lock, 4000))
+		{
+			free(index->filename);
+			free(index);
+			index = NULL;
+		}
+	}
+
+	if (index)
+	{
+		index->refCount++;
+		index->next = g_SamIndexes;
+		g_SamIndexes = index;
+	}
+
+	LeaveCriticalSection(&g_SamIndexLock);
+	return index;
+}
+
+static void SamIndexPut(WINPR_SAM_INDEX* index)
+{
+	UINT32 idle = 0;
+	WINPR_SAM_INDEX* current;
+	WINPR_SAM_INDEX** link;
+
+	if (!index)
+		return;
+
+	EnterCriticalSection(&g_SamIndexLock);
+	index->refCount--;
+	link = &g_SamIndexes;
+
+	/* the list is in most recently used order, drop the oldest unused indexes */
+	while ((current = *link) != NULL)
+	{
+		if ((current->refCount == 0) && (++idle > WINPR_SAM_MAX_IDLE_INDEXES))
+		{
+			*link = current->next;
+			SamIndexFree(current);
+			continue;
+		}
+
+		link = &current->next;
+	}
+
+	LeaveCriticalSection(&g_SamIndexLock);
+}
+
 WINPR_SAM* SamOpen(const char* filename, BOOL readOnly)
 {
 	FILE* fp = NULL;
@@ -64,7 +447,7 @@ WINPR_SAM* SamOpen(const char* filename, BOOL readOnly)
 
 	if (fp)
 	{
-		sam = (WINPR_SAM*) malloc(sizeof(WINPR_SAM));
+		sam = (WINPR_SAM*) calloc(1, sizeof(WINPR_SAM));
 
 		if (!sam)
 		{
@@ -74,6 +457,14 @@ WINPR_SAM* SamOpen(const char* filename, BOOL readOnly)
 
 		sam->readOnly = readOnly;
 		sam->fp = fp;
+		sam->index = SamIndexGet(filename);
+
+		if (!sam->index)
+		{
+			fclose(fp);
+			free(sam);
+			return NULL;
+		}
 	}
 	else
 	{
@@ -83,52 +474,6 @@ WINPR_SAM* SamOpen(const char* filename, BOOL readOnly)
 	return sam;
 }
 
-static BOOL SamLookupStart(WINPR_SAM* sam)
-{
-	size_t readSize;
-	long int fileSize;
-
-	fseek(sam->fp, 0, SEEK_END);
-	fileSize = ftell(sam->fp);
-	fseek(sam->fp, 0, SEEK_SET);
-
-	if (fileSize < 1)
-		return FALSE;
-
-	sam->buffer = (char*) malloc(fileSize + 2);
-
-	if (!sam->buffer)
-		return FALSE;
-
-	readSize = fread(sam->buffer, fileSize, 1, sam->fp);
-
-	if (!readSize)
-	{
-		if (!ferror(sam->fp))
-			readSize = fileSize;
-	}
-
-	if (readSize < 1)
-	{
-		free(sam->buffer);
-		sam->buffer = NULL;
-		return FALSE;
-	}
-
-	sam->buffer[fileSize] = '\n';
-	sam->buffer[fileSize + 1] = '\0';
-	sam->line = strtok(sam->buffer, "\n");
-
-	return TRUE;
-}
-
-static void SamLookupFinish(WINPR_SAM* sam)
-{
-	free(sam->buffer);
-	sam->buffer = NULL;
-	sam->line = NULL;
-}
-
 static void HexStrToBin(char* str, BYTE* bin, int length)
 {
 	int i;
@@ -240,165 +585,108 @@ void SamResetEntry(WINPR_SAM_ENTRY* entry)
 	ZeroMemory(entry->NtHash, sizeof(entry->NtHash));
 }
 
-WINPR_SAM_ENTRY* SamLookupUserA(WINPR_SAM* sam, LPSTR User, UINT32 UserLength, LPSTR Domain, UINT32 DomainLength)
+static WINPR_SAM_ENTRY* SamLookupUserKey(WINPR_SAM* sam, LPCWSTR User, UINT32 UserLength,
+        LPCWSTR Domain, UINT32 DomainLength)
 {
-	int length;
-	BOOL found = FALSE;
-	WINPR_SAM_ENTRY* entry;
-
-	entry = (WINPR_SAM_ENTRY*) calloc(1, sizeof(WINPR_SAM_ENTRY));
+	UINT32 index;
+	WINPR_SAM_ENTRY* entry = NULL;
+	const WINPR_SAM_RECORD* record = NULL;
+	WINPR_SAM_TABLE* table = SamIndexAcquire(sam->index);
 
-	if (!entry)
+	if (!table)
 		return NULL;
 
-	if (!SamLookupStart(sam))
-	{
-		free(entry);
-		return NULL;
-	}
+	index = table->buckets[SamHashKey(User, UserLength) & table->bucketMask];
 
-	while (sam->line != NULL)
+	for (; index > 0; index = record->next)
 	{
-		length = (int) strlen(sam->line);
+		record = &table->records[index - 1];
 
-		if (length > 1)
-		{
-			if (sam->line[0] != '#')
-			{
-				if (!SamReadEntry(sam, entry))
-				{
-					goto out_fail;
-				}
-
-				if (strcmp(User, entry->User) == 0)
-				{
-					found = 1;
-					break;
-				}
-			}
-		}
-		SamResetEntry(entry);
-		sam->line = strtok(NULL, "\n");
+		if ((record->UserKeyLength != UserLength) ||
+		    (memcmp(record->UserKey, User, UserLength * sizeof(WCHAR)) != 0))
+			continue;
+
+		if ((DomainLength > 0) && ((record->DomainKeyLength != DomainLength) ||
+		                           (memcmp(record->DomainKey, Domain, DomainLength * sizeof(WCHAR)) != 0)))
+			continue;
+
+		break;
 	}
 
-out_fail:
-	SamLookupFinish(sam);
+	if (index > 0)
+		entry = (WINPR_SAM_ENTRY*) calloc(1, sizeof(WINPR_SAM_ENTRY));
 
-	if (!found)
+	if (entry)
 	{
-		free(entry);
-		return NULL;
+		entry->UserLength = record->UserLength;
+		entry->User = (LPSTR) malloc(record->UserLength + 1);
+		entry->DomainLength = record->DomainLength;
+
+		if (entry->User)
+			CopyMemory(entry->User, record->User, record->UserLength + 1);
+
+		if ((record->DomainLength > 0) && (entry->Domain = (LPSTR) malloc(record->DomainLength + 1)))
+			CopyMemory(entry->Domain, record->Domain, record->DomainLength + 1);
+
+		CopyMemory(entry->LmHash, record->LmHash, sizeof(entry->LmHash));
+		CopyMemory(entry->NtHash, record->NtHash, sizeof(entry->NtHash));
+
+		if (!entry->User || ((record->DomainLength > 0) && !entry->Domain))
+		{
+			free(entry->User);
+			free(entry->Domain);
+			free(entry);
+			entry = NULL;
+		}
 	}
 
+	SamTableRelease(table);
 	return entry;
 }
 
-WINPR_SAM_ENTRY* SamLookupUserW(WINPR_SAM* sam, LPWSTR User, UINT32 UserLength, LPWSTR Domain, UINT32 DomainLength)
+WINPR_SAM_ENTRY* SamLookupUserA(WINPR_SAM* sam, LPSTR User, UINT32 UserLength, LPSTR Domain, UINT32 DomainLength)
 {
-	int length;
-	BOOL Found = FALSE;
-	BOOL UserMatch;
-	BOOL DomainMatch;
-	LPWSTR EntryUser = NULL;
-	UINT32 EntryUserLength;
-	LPWSTR EntryDomain = NULL;
-	UINT32 EntryDomainLength;
-	WINPR_SAM_ENTRY* entry;
+	LPWSTR key;
+	UINT32 UserKeyLength;
+	UINT32 DomainKeyLength = 0;
+	WINPR_SAM_ENTRY* entry = NULL;
 
-	if (!(entry = (WINPR_SAM_ENTRY*) calloc(1, sizeof(WINPR_SAM_ENTRY))))
+	if (!sam || !User || (UserLength < 1))
 		return NULL;
 
-	if (!SamLookupStart(sam))
-	{
-		free(entry);
+	if (!Domain)
+		DomainLength = 0;
+
+	if (!(key = (LPWSTR) calloc(UserLength + DomainLength + 1, sizeof(WCHAR))))
 		return NULL;
-	}
 
-	while (sam->line != NULL)
-	{
-		length = (int) strlen(sam->line);
+	if (SamMakeKey(User, UserLength, key, &UserKeyLength) &&
+	    SamMakeKey(Domain, DomainLength, &key[UserKeyLength], &DomainKeyLength))
+		entry = SamLookupUserKey(sam, key, UserKeyLength, &key[UserKeyLength], DomainKeyLength);
 
-		if (length > 1)
-		{
-			if (sam->line[0] != '#')
-			{
-				DomainMatch = 0;
-				UserMatch = 0;
-				if (!SamReadEntry(sam, entry))
-					goto out_fail;
-
-				if (DomainLength > 0)
-				{
-					if (entry->DomainLength > 0)
-					{
-						EntryDomainLength = (UINT32) strlen(entry->Domain) * 2;
-						EntryDomain = (LPWSTR) malloc(EntryDomainLength + 2);
-						if (!EntryDomain)
-							goto out_fail;
-						MultiByteToWideChar(CP_ACP, 0, entry->Domain, EntryDomainLength / 2,
-											(LPWSTR) EntryDomain, EntryDomainLength / 2);
-
-						if (DomainLength == EntryDomainLength)
-						{
-							if (memcmp(Domain, EntryDomain, DomainLength) == 0)
-							{
-								DomainMatch = 1;
-							}
-						}
-
-						free(EntryDomain);
-					}
-					else
-					{
-						DomainMatch = 0;
-					}
-				}
-				else
-				{
-					DomainMatch = 1;
-				}
-
-				if (DomainMatch)
-				{
-					EntryUserLength = (UINT32) strlen(entry->User) * 2;
-					EntryUser = (LPWSTR) malloc(EntryUserLength + 2);
-					if (!EntryUser)
-						goto out_fail;
-					MultiByteToWideChar(CP_ACP, 0, entry->User, EntryUserLength / 2,
-										(LPWSTR) EntryUser, EntryUserLength / 2);
-
-					if (UserLength == EntryUserLength)
-					{
-						if (memcmp(User, EntryUser, UserLength) == 0)
-						{
-							UserMatch = 1;
-						}
-					}
-
-					free(EntryUser);
-
-					if (UserMatch && DomainMatch)
-					{
-						Found = TRUE;
-						break;
-					}
-				}
-			}
-		}
+	free(key);
+	return entry;
+}
 
-		SamResetEntry(entry);
-		sam->line = strtok(NULL, "\n");
-	}
+WINPR_SAM_ENTRY* SamLookupUserW(WINPR_SAM* sam, LPWSTR User, UINT32 UserLength, LPWSTR Domain, UINT32 DomainLength)
+{
+	LPWSTR key;
+	WINPR_SAM_ENTRY* entry;
+	/* lengths are in bytes */
+	UserLength /= 2;
+	DomainLength = Domain ? DomainLength / 2 : 0;
 
-out_fail:
-	SamLookupFinish(sam);
+	if (!sam || !User || (UserLength < 1))
+		return NULL;
 
-	if (!Found)
-	{
-		free(entry);
+	if (!(key = (LPWSTR) calloc(UserLength + DomainLength + 1, sizeof(WCHAR))))
 		return NULL;
-	}
 
+	CopyMemory(key, User, UserLength * sizeof(WCHAR));
+	CopyMemory(&key[UserLength], Domain, DomainLength * sizeof(WCHAR));
+	CharUpperBuffW(key, UserLength + DomainLength);
+	entry = SamLookupUserKey(sam, key, UserLength, &key[UserLength], DomainLength);
+	free(key);
 	return entry;
 }
 
@@ -406,6 +694,7 @@ void SamClose(WINPR_SAM* sam)
 {
 	if (sam != NULL)
 	{
+		SamIndexPut(sam->index);
 		fclose(sam->fp);
 		free(sam);
 	}
@@ -25,6 +25,8 @@
 #include <winpr/crt.h>
 #include <winpr/stream.h>
 
+#include "collections/StreamPool.h"
+
 BOOL Stream_EnsureCapacity(wStream* s, size_t size)
 {
 	if (s->capacity < size)
@@ -44,6 +46,9 @@ BOOL Stream_EnsureCapacity(wStream* s, size_t size)
 		while (new_capacity < size);
 
 
+		if (s->pool)
+			return StreamPool_ResizeBuffer(s, new_capacity);
+
 		position = Stream_GetPosition(s);
 
 		new_buf = (BYTE*) realloc(s->buffer, new_capacity);
@@ -104,6 +109,12 @@ void Stream_Free(wStream* s, BOOL bFreeBuffer)
 {
 	if (s)
 	{
+		if (s->pool)
+		{
+			StreamPool_FreeStream(s->pool, s, bFreeBuffer);
+			return;
+		}
+
 		if (bFreeBuffer)
 			free(s->buffer);
 
@@ -0,0 +1,257 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/sam.h>
+#include <winpr/path.h>
+#include <winpr/file.h>
+#include <winpr/sysinfo.h>
+
+#define TEST_SAM_USERS	20000
+
+static void test_sam_hash(BYTE* hash, UINT32 seed)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		hash[i] = (BYTE)(seed * 31 + i);
+}
+
+static void test_sam_write_line(FILE* fp, const char* user, const char* domain, UINT32 seed)
+{
+	int i;
+	BYTE hash[16];
+	test_sam_hash(hash, seed);
+	fprintf(fp, "%s:%s:", user, domain);
+
+	for (i = 0; i < 16; i++)
+		fprintf(fp, "%02x", 0);
+
+	fprintf(fp, ":");
+
+	for (i = 0; i < 16; i++)
+		fprintf(fp, "%02x", hash[i]);
+
+	fprintf(fp, ":::\n");
+}
+
+static BOOL test_sam_write(const char* filename)
+{
+	UINT32 i;
+	char user[32];
+	char domain[32];
+	FILE* fp = fopen(filename, "w");
+
+	if (!fp)
+		return FALSE;
+
+	fprintf(fp, "# comment:with:colons:::\n");
+
+	for (i = 0; i < TEST_SAM_USERS; i++)
+	{
+		sprintf_s(user, sizeof(user), "User%05"PRIu32"", i);
+		sprintf_s(domain, sizeof(domain), "Domain%"PRIu32"", i % 4);
+		test_sam_write_line(fp, user, domain, i);
+	}
+
+	test_sam_write_line(fp, "Dup", "", 100001);
+	test_sam_write_line(fp, "Dup", "Corp", 100002);
+	test_sam_write_line(fp, "J\xC3\xBCrgen", "Corp", 100003);
+	fprintf(fp, "malformed line\n");
+	fclose(fp);
+	return TRUE;
+}
+
+static BOOL test_sam_lookup_w(WINPR_SAM* sam, const char* user, const char* domain,
+                              UINT32 seed)
+{
+	BOOL rc;
+	BYTE hash[16];
+	WCHAR* userW = NULL;
+	WCHAR* domainW = NULL;
+	int userLength;
+	int domainLength = 0;
+	WINPR_SAM_ENTRY* entry;
+	userLength = ConvertToUnicode(CP_UTF8, 0, user, -1, &userW, 0) - 1;
+
+	if (domain)
+		domainLength = ConvertToUnicode(CP_UTF8, 0, domain, -1, &domainW, 0) - 1;
+
+	entry = SamLookupUserW(sam, userW, userLength * 2, domainW, domainLength * 2);
+	free(userW);
+	free(domainW);
+
+	if (!seed)
+	{
+		rc = (entry == NULL);
+	}
+	else
+	{
+		test_sam_hash(hash, seed);
+		rc = entry && (memcmp(entry->NtHash, hash, sizeof(hash)) == 0);
+	}
+
+	if (!rc)
+		printf("SamLookupUserW(%s, %s) failed\n", user, domain ? domain : "(null)");
+
+	if (entry)
+		SamFreeEntry(sam, entry);
+
+	return rc;
+}
+
+static int test_sam_benchmark(WINPR_SAM* sam)
+{
+	UINT32 i;
+	UINT64 start;
+	UINT64 elapsed;
+	const UINT32 lookups = 200000;
+	WCHAR* users[64];
+
+	for (i = 0; i < 64; i++)
+	{
+		char user[32];
+		users[i] = NULL;
+		sprintf_s(user, sizeof(user), "USER%05"PRIu32"", (i * 7919) % TEST_SAM_USERS);
+
+		if (ConvertToUnicode(CP_UTF8, 0, user, -1, &users[i], 0) < 1)
+			return -1;
+	}
+
+	start = GetTickCount64();
+
+	for (i = 0; i < lookups; i++)
+	{
+		WINPR_SAM_ENTRY* entry = SamLookupUserW(sam, users[i % 64], 18, NULL, 0);
+
+		if (!entry)
+			return -1;
+
+		SamFreeEntry(sam, entry);
+	}
+
+	elapsed = GetTickCount64() - start;
+	printf("SAM: %"PRIu32" lookups among %d users in %"PRIu64" ms (%"PRIu64" lookups/s)\n",
+	       lookups, TEST_SAM_USERS, elapsed, (lookups * 1000ULL) / (elapsed ? elapsed : 1));
+
+	for (i = 0; i < 64; i++)
+		free(users[i]);
+
+	return 0;
+}
+
+/**
+ * Closed files keep their index cached, only the most recently used ones
+ * survive opening other files.
+ */
+static BOOL test_sam_reopen(const char* filename)
+{
+	int i;
+	BOOL rc = TRUE;
+	WINPR_SAM* sam;
+
+	for (i = 0; rc && (i < 4); i++)
+	{
+		FILE* fp;
+		char name[32];
+		char* other;
+		sprintf_s(name, sizeof(name), "TestSam%d.sam", i);
+
+		if (!(other = GetKnownSubPath(KNOWN_PATH_TEMP, name)))
+			return FALSE;
+
+		rc = FALSE;
+
+		if ((fp = fopen(other, "w")))
+		{
+			test_sam_write_line(fp, name, "", 200000 + i);
+			fclose(fp);
+
+			if ((sam = SamOpen(other, TRUE)))
+			{
+				rc = test_sam_lookup_w(sam, name, NULL, 200000 + i);
+				SamClose(sam);
+			}
+		}
+
+		DeleteFileA(other);
+		free(other);
+	}
+
+	if (!rc || !(sam = SamOpen(filename, TRUE)))
+		return FALSE;
+
+	rc = test_sam_lookup_w(sam, "User00042", NULL, 42) && test_sam_lookup_w(sam, "late", NULL, 100004);
+	SamClose(sam);
+	return rc;
+}
+
+int TestSam(int argc, char* argv[])
+{
+	int rc = -1;
+	FILE* fp;
+	WINPR_SAM* sam = NULL;
+	WINPR_SAM_ENTRY* entry;
+	char* filename = GetKnownSubPath(KNOWN_PATH_TEMP, "TestSam.sam");
+
+	if (!filename || !test_sam_write(filename))
+		goto fail;
+
+	if (!(sam = SamOpen(filename, TRUE)))
+		goto fail;
+
+	/* user and domain are case insensitive, an empty domain matches any */
+	if (!test_sam_lookup_w(sam, "user00042", "DOMAIN2", 42) ||
+	    !test_sam_lookup_w(sam, "User19999", NULL, 19999) ||
+	    !test_sam_lookup_w(sam, "User00042", "Domain1", 0) ||
+	    !test_sam_lookup_w(sam, "User20000", NULL, 0) ||
+	    !test_sam_lookup_w(sam, "comment", NULL, 0))
+		goto fail;
+
+	/* the first matching line wins */
+	if (!test_sam_lookup_w(sam, "dup", NULL, 100001) ||
+	    !test_sam_lookup_w(sam, "dup", "corp", 100002))
+		goto fail;
+
+	if (!test_sam_lookup_w(sam, "J\xC3\x9CRGEN", "CORP", 100003))
+		goto fail;
+
+	entry = SamLookupUserA(sam, "uSER00007", 9, NULL, 0);
+
+	if (!entry || (strcmp(entry->User, "User00007") != 0) || (strcmp(entry->Domain, "Domain3") != 0))
+	{
+		printf("SamLookupUserA failed\n");
+		SamFreeEntry(sam, entry);
+		goto fail;
+	}
+
+	SamFreeEntry(sam, entry);
+
+	/* changes to the file are picked up by the next lookup */
+	if (!(fp = fopen(filename, "a")))
+		goto fail;
+
+	test_sam_write_line(fp, "Late", "", 100004);
+	fclose(fp);
+
+	if (!test_sam_lookup_w(sam, "late", NULL, 100004))
+		goto fail;
+
+	if (test_sam_benchmark(sam) < 0)
+		goto fail;
+
+	SamClose(sam);
+	sam = NULL;
+
+	if (!test_sam_reopen(filename))
+		goto fail;
+
+	rc = 0;
+fail:
+	SamClose(sam);
+
+	if (filename)
+		DeleteFileA(filename);
+
+	free(filename);
+	return rc;
+}
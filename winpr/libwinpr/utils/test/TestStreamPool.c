@@ -2,9 +2,195 @@
 #include <winpr/crt.h>
 #include <winpr/stream.h>
 #include <winpr/collections.h>
+#include <winpr/thread.h>
 
 #define BUFFER_SIZE 16384
 
+#define TEST_THREADS 4
+#define TEST_ITERATIONS 20000
+
+static DWORD WINAPI test_stream_pool_thread(LPVOID arg)
+{
+	int i;
+	wStream* s[4];
+	wStreamPool* pool = (wStreamPool*) arg;
+
+	for (i = 0; i < TEST_ITERATIONS; i++)
+	{
+		int j;
+
+		for (j = 0; j < 4; j++)
+		{
+			if (!(s[j] = StreamPool_Take(pool, 64 << ((i + j) % 10))))
+				return 1;
+
+			Stream_Write_UINT32(s[j], (UINT32) i);
+		}
+
+		for (j = 0; j < 4; j++)
+		{
+			if (StreamPool_Find(pool, Stream_Buffer(s[j]) + 2) != s[j])
+				return 1;
+
+			Stream_Release(s[j]);
+		}
+	}
+
+	return 0;
+}
+
+static BOOL test_stream_pool_find(wStreamPool* pool)
+{
+	BOOL rc = FALSE;
+	BYTE* buffer;
+	wStream* s = StreamPool_Take(pool, 100);
+
+	if (!s || (Stream_Capacity(s) < 100))
+		goto fail;
+
+	buffer = Stream_Buffer(s);
+
+	if ((StreamPool_Find(pool, buffer) != s) || (StreamPool_Find(pool, buffer + 99) != s))
+		goto fail;
+
+	/* a grown stream is found at its new buffer */
+	Stream_SetPosition(s, 50);
+
+	if (!Stream_EnsureCapacity(s, BUFFER_SIZE * 4) || (Stream_GetPosition(s) != 50))
+		goto fail;
+
+	buffer = Stream_Buffer(s);
+
+	if ((StreamPool_Find(pool, buffer + BUFFER_SIZE * 3) != s) ||
+	    (StreamPool_Find(pool, buffer + Stream_Capacity(s)) == s))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	if (!rc)
+		printf("StreamPool_Find failed\n");
+
+	if (s)
+		Stream_Release(s);
+
+	return rc;
+}
+
+/**
+ * Returned streams are cached up to a byte budget, larger amounts are freed.
+ */
+static BOOL test_stream_pool_cache_limit(wStreamPool* pool)
+{
+	int i;
+	wStream* s[8];
+
+	StreamPool_Clear(pool);
+
+	for (i = 0; i < 8; i++)
+	{
+		if (!(s[i] = StreamPool_Take(pool, 4 * 1024 * 1024)))
+			return FALSE;
+	}
+
+	for (i = 0; i < 8; i++)
+		Stream_Release(s[i]);
+
+	if ((pool->aSize == 0) || (pool->aSize >= 8))
+	{
+		printf("StreamPool: cache limit not applied (aSize: %d)\n", pool->aSize);
+		return FALSE;
+	}
+
+	StreamPool_Clear(pool);
+	return pool->aSize == 0;
+}
+
+/**
+ * Stream_Free leaves the buffer to the caller, who releases it with free().
+ */
+static BOOL test_stream_pool_detach(wStreamPool* pool)
+{
+	BYTE* buffer;
+	wStream* s;
+	const int uSize = pool->uSize;
+
+	if (!(s = StreamPool_Take(pool, 1000)))
+		return FALSE;
+
+	buffer = Stream_Buffer(s);
+	Stream_Free(s, FALSE);
+
+	if ((pool->uSize != uSize) || StreamPool_Find(pool, buffer))
+	{
+		printf("StreamPool: detached stream still in the pool\n");
+		free(buffer);
+		return FALSE;
+	}
+
+	free(buffer);
+	return TRUE;
+}
+
+/**
+ * A stream in use keeps its pool alive after StreamPool_Free.
+ */
+static BOOL test_stream_pool_outstanding(void)
+{
+	wStream* s[2];
+	wStreamPool* pool = StreamPool_New(TRUE, BUFFER_SIZE);
+
+	if (!pool)
+		return FALSE;
+
+	s[0] = StreamPool_Take(pool, 0);
+	s[1] = StreamPool_Take(pool, 0);
+	StreamPool_Free(pool);
+
+	if (!s[0] || !s[1])
+		return FALSE;
+
+	Stream_Write_UINT32(s[0], 1);
+	Stream_Release(s[0]);
+
+	if (!Stream_EnsureCapacity(s[1], BUFFER_SIZE * 2))
+		return FALSE;
+
+	Stream_Release(s[1]);
+	return TRUE;
+}
+
+static BOOL test_stream_pool_threads(wStreamPool* pool)
+{
+	int i;
+	DWORD code;
+	BOOL rc = TRUE;
+	HANDLE threads[TEST_THREADS];
+
+	for (i = 0; i < TEST_THREADS; i++)
+	{
+		if (!(threads[i] = CreateThread(NULL, 0, test_stream_pool_thread, pool, 0, NULL)))
+			return FALSE;
+	}
+
+	for (i = 0; i < TEST_THREADS; i++)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+
+		if (!GetExitCodeThread(threads[i], &code) || code)
+			rc = FALSE;
+
+		CloseHandle(threads[i]);
+	}
+
+	if (!rc || pool->uSize)
+	{
+		printf("StreamPool: concurrent take/return failed (uSize: %"PRId32")\n", pool->uSize);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 int TestStreamPool(int argc, char* argv[])
 {
 	wStream* s[5];
@@ -94,6 +280,14 @@ int TestStreamPool(int argc, char* argv[])
 
 	printf("StreamPool: aSize: %d uSize: %d\n", pool->aSize, pool->uSize);
 
+	if (!test_stream_pool_find(pool) || !test_stream_pool_threads(pool) ||
+	    !test_stream_pool_cache_limit(pool) || !test_stream_pool_detach(pool) ||
+	    !test_stream_pool_outstanding())
+	{
+		StreamPool_Free(pool);
+		return -1;
+	}
+
 	StreamPool_Free(pool);
 
 	return 0;